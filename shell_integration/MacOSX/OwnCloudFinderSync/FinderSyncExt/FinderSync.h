@@ -23,6 +23,8 @@
 	NSMutableSet *_registeredDirectories;
 	NSString *_shareMenuTitle;
 	NSMutableDictionary *_strings;
+	// The badge identifiers by path, by directory
+	NSMutableDictionary *_statusCache;
 }
 
 @end
@@ -60,6 +60,7 @@
 	_syncClientProxy = [[SyncClientProxy alloc] initWithDelegate:self serverName:serverName];
 	_registeredDirectories = [[NSMutableSet alloc] init];
 	_strings = [[NSMutableDictionary alloc] init];
+	_statusCache = [[NSMutableDictionary alloc] init];
 	
 	[_syncClientProxy start];
 	return self;
@@ -69,14 +70,27 @@
 
 - (void)requestBadgeIdentifierForURL:(NSURL *)url
 {
-	BOOL isDir;
-	if ([[NSFileManager defaultManager] fileExistsAtPath:[url path] isDirectory: &isDir] == NO) {
-		NSLog(@"ERROR: Could not determine file type of %@", [url path]);
-		isDir = NO;
+	NSString* normalizedPath = [[url path] decomposedStringWithCanonicalMapping];
+
+	// Scrolling asks again for the same items, the STATUS pushes keep the cache up to date
+	NSString *badge;
+	@synchronized(_statusCache) {
+		badge = [[_statusCache objectForKey:[normalizedPath stringByDeletingLastPathComponent]] objectForKey:normalizedPath];
 	}
-	
+	if (badge) {
+		[[FIFinderSyncController defaultController] setBadgeIdentifier:badge forURL:url];
+		return;
+	}
+	[_syncClientProxy askForStatus:normalizedPath];
+}
+
+- (void)endObservingDirectoryAtURL:(NSURL *)url
+{
+	// No window shows the directory anymore
 	NSString* normalizedPath = [[url path] decomposedStringWithCanonicalMapping];
-	[_syncClientProxy askForIcon:normalizedPath isDirectory:isDir];
+	@synchronized(_statusCache) {
+		[_statusCache removeObjectForKey:normalizedPath];
+	}
 }
 
 #pragma mark - Menu and toolbar item support
@@ -156,11 +170,44 @@
 - (void)setResultForPath:(NSString*)path result:(NSString*)result
 {
 	NSString *normalizedPath = [path decomposedStringWithCanonicalMapping];
+	NSString *directory = [normalizedPath stringByDeletingLastPathComponent];
+	@synchronized(_statusCache) {
+		NSMutableDictionary *statuses = [_statusCache objectForKey:directory];
+		if (!statuses) {
+			statuses = [[NSMutableDictionary alloc] init];
+			[_statusCache setObject:statuses forKey:directory];
+		} else if ([[statuses objectForKey:normalizedPath] isEqualToString:result]) {
+			// Finder already shows it
+			return;
+		}
+		[statuses setObject:result forKey:normalizedPath];
+	}
 	[[FIFinderSyncController defaultController] setBadgeIdentifier:result forURL:[NSURL fileURLWithPath:normalizedPath]];
 }
 
+// The paths in the cache below @a path
+- (NSArray*)cachedPathsBelow:(NSString*)path remove:(BOOL)remove
+{
+	NSString *normalizedPath = [path decomposedStringWithCanonicalMapping];
+	NSString *prefix = [normalizedPath stringByAppendingString:@"/"];
+	NSMutableArray *paths = [[NSMutableArray alloc] init];
+	@synchronized(_statusCache) {
+		for (NSString *directory in [_statusCache allKeys]) {
+			if (![directory isEqualToString:normalizedPath] && ![directory hasPrefix:prefix])
+				continue;
+			[paths addObjectsFromArray:[[_statusCache objectForKey:directory] allKeys]];
+			if (remove)
+				[_statusCache removeObjectForKey:directory];
+		}
+	}
+	return paths;
+}
+
 - (void)reFetchFileNameCacheForPath:(NSString*)path
 {
+	// The old badges stay until the answers come
+	for (NSString *file in [self cachedPathsBelow:path remove:NO])
+		[_syncClientProxy askForStatus:file];
 }
 
 - (void)registerPath:(NSString*)path
@@ -172,6 +219,7 @@
 
 - (void)unregisterPath:(NSString*)path
 {
+	[self cachedPathsBelow:path remove:YES];
 	[_registeredDirectories removeObject:[NSURL fileURLWithPath:path]];
 	[FIFinderSyncController defaultController].directoryURLs = _registeredDirectories;
 }
@@ -184,6 +232,9 @@
 - (void)connectionDidDie
 {
 	[_strings removeAllObjects];
+	@synchronized(_statusCache) {
+		[_statusCache removeAllObjects];
+	}
 	[_registeredDirectories removeAllObjects];
 	// For some reason the FIFinderSync cache doesn't seem to be cleared for the root item when
 	// we reset the directoryURLs (seen on macOS 10.12 at least).
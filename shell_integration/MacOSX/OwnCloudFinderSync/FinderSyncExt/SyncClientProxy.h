@@ -32,6 +32,11 @@
 {
 	NSString *_serverName;
 	NSDistantObject <ChannelProtocol> *_remoteEnd;
+	// Whether the client understands RETRIEVE_FILE_STATUS_BATCH
+	BOOL _batchSupported;
+	// The paths to ask the status of, by directory
+	NSMutableDictionary *_pendingStatusRequests;
+	BOOL _statusRequestsScheduled;
 }
 
 @property (weak) id <SyncClientProxyDelegate> delegate;
@@ -39,5 +44,5 @@
 - (instancetype)initWithDelegate:(id)arg1 serverName:(NSString*)serverName;
 - (void)start;
 - (void)askOnSocket:(NSString*)path query:(NSString*)verb;
-- (void)askForIcon:(NSString*)path isDirectory:(BOOL)isDir;
+- (void)askForStatus:(NSString*)path;
 @end
@@ -31,6 +31,9 @@
 	self.delegate = arg1;
 	_serverName = serverName;
 	_remoteEnd = nil;
+	_batchSupported = NO;
+	_pendingStatusRequests = [[NSMutableDictionary alloc] init];
+	_statusRequestsScheduled = NO;
 
 	return self;
 }
@@ -73,6 +76,9 @@
 	[_remoteEnd setProtocolForProxy:@protocol(ChannelProtocol)];
 
 	// Everything is set up, start querying
+	// Until the client tells its version
+	_batchSupported = NO;
+	[self askOnSocket:@"" query:@"VERSION"];
 	[self askOnSocket:@"" query:@"GET_STRINGS"];
 }
 
@@ -96,8 +102,15 @@
 {
 	NSString *answer = [[NSString alloc] initWithData:msg encoding:NSUTF8StringEncoding];
 
-	// Cut the trailing newline
-	answer = [answer substringToIndex:[answer length] - 1];
+	// The client writes several lines at once, like the answers to a batch
+	for (NSString *line in [answer componentsSeparatedByString:@"\n"]) {
+		if ([line length] > 0)
+			[self handleMessage:line];
+	}
+}
+
+- (void)handleMessage:(NSString*)answer
+{
 	NSArray *chunks = [answer componentsSeparatedByString: @":"];
 
 	if( [[chunks objectAtIndex:0] isEqualToString:@"STATUS"] ) {
@@ -123,6 +136,14 @@
 		// BEGIN and END messages, do nothing.
 	} else if( [[chunks objectAtIndex:0 ] isEqualToString:@"STRING"] ) {
 		[_delegate setString:[chunks objectAtIndex:1] value:[chunks objectAtIndex:2]];
+	} else if( [[chunks objectAtIndex:0 ] isEqualToString:@"VERSION"] ) {
+		// VERSION:<client version>:<socket api version>, the batches are in 1.1
+		NSArray *api = [[chunks lastObject] componentsSeparatedByString:@"."];
+		int major = [[api objectAtIndex:0] intValue];
+		int minor = [api count] > 1 ? [[api objectAtIndex:1] intValue] : 0;
+		_batchSupported = major > 1 || (major == 1 && minor >= 1);
+	} else if( [[chunks objectAtIndex:0 ] isEqualToString:@"STATUS_BATCH_END"] ) {
+		// The STATUS messages of the batch came before, do nothing.
 	} else {
 		NSLog(@"SyncState: Unknown command %@", [chunks objectAtIndex:0]);
 	}
@@ -139,10 +160,41 @@
 	}
 }
 
-- (void)askForIcon:(NSString*)path isDirectory:(BOOL)isDir
+- (void)askForStatus:(NSString*)path
+{
+	// Finder may ask from other threads, the requests are collected on the main one
+	dispatch_async(dispatch_get_main_queue(), ^{
+		NSString *directory = [path stringByDeletingLastPathComponent];
+		NSMutableSet *files = [_pendingStatusRequests objectForKey:directory];
+		if (!files) {
+			files = [[NSMutableSet alloc] init];
+			[_pendingStatusRequests setObject:files forKey:directory];
+		}
+		[files addObject:path];
+
+		// Finder asks for all the items of a window at once
+		if (!_statusRequestsScheduled) {
+			_statusRequestsScheduled = YES;
+			dispatch_after(dispatch_time(DISPATCH_TIME_NOW, 20 * NSEC_PER_MSEC), dispatch_get_main_queue(), ^{
+				[self sendStatusRequests];
+			});
+		}
+	});
+}
+
+- (void)sendStatusRequests
 {
-	NSString *verb = isDir ? @"RETRIEVE_FOLDER_STATUS" : @"RETRIEVE_FILE_STATUS";
-	[self askOnSocket:path query:verb];
+	_statusRequestsScheduled = NO;
+	[_pendingStatusRequests enumerateKeysAndObjectsUsingBlock: ^(id directory, id files, BOOL *stop) {
+		if (_batchSupported && [files count] > 1) {
+			// The paths are separated by the ASCII record separator
+			[self askOnSocket:[[files allObjects] componentsJoinedByString:@"\x1e"] query:@"RETRIEVE_FILE_STATUS_BATCH"];
+		} else {
+			for (NSString *file in files)
+				[self askOnSocket:file query:@"RETRIEVE_FILE_STATUS"];
+		}
+	}];
+	[_pendingStatusRequests removeAllObjects];
 }
 
 @end
@@ -30,8 +30,9 @@ class OwncloudDolphinPlugin : public KOverlayIconPlugin
     Q_PLUGIN_METADATA(IID "com.owncloud.ovarlayiconplugin" FILE "ownclouddolphinoverlayplugin.json")
     Q_OBJECT
 
-    typedef QHash<QByteArray, QByteArray> StatusMap;
-    StatusMap m_status;
+    typedef QHash<QByteArray, QByteArray> StatusMap; // by file name
+    // The statuses by directory, kept up to date by the STATUS pushes
+    QHash<QByteArray, StatusMap> m_status;
 
 public:
 
@@ -39,6 +40,8 @@ public:
         auto helper = OwncloudDolphinPluginHelper::instance();
         QObject::connect(helper, &OwncloudDolphinPluginHelper::commandRecieved,
                          this, &OwncloudDolphinPlugin::slotCommandRecieved);
+        QObject::connect(helper, &OwncloudDolphinPluginHelper::connected,
+                         this, [this] { m_status.clear(); });
     }
 
     QStringList getOverlays(const QUrl& url) override {
@@ -49,13 +52,17 @@ public:
             return QStringList();
         QDir localPath(url.toLocalFile());
         const QByteArray localFile = localPath.canonicalPath().toUtf8();
+        const int slash = localFile.lastIndexOf('/');
 
-        helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + localFile + "\n"));
-
-        StatusMap::iterator it = m_status.find(localFile);
-        if (it != m_status.constEnd()) {
+        StatusMap &directory = m_status[localFile.left(slash)];
+        const QByteArray name = localFile.mid(slash + 1);
+        StatusMap::const_iterator it = directory.constFind(name);
+        if (it != directory.constEnd()) {
             return  overlaysForString(*it);
         }
+        // Empty until the answer comes, so that it is asked for once
+        directory.insert(name, QByteArray());
+        helper->requestFileStatus(localFile);
         return QStringList();
     }
 
@@ -80,9 +87,36 @@ private:
         return r;
     }
 
+    static bool isInDirectory(const QByteArray &directory, const QByteArray &path) {
+        return directory == path || directory.startsWith(path + '/');
+    }
+
     void slotCommandRecieved(const QByteArray &line) {
 
         QList<QByteArray> tokens = line.split(':');
+        if (tokens.count() == 2 && tokens[0] == "UPDATE_VIEW") {
+            // Ask again for what is shown below it, the old statuses stay until the answers come
+            auto helper = OwncloudDolphinPluginHelper::instance();
+            for (auto dir = m_status.constBegin(); dir != m_status.constEnd(); ++dir) {
+                if (!isInDirectory(dir.key(), tokens[1]))
+                    continue;
+                for (auto it = dir->constBegin(); it != dir->constEnd(); ++it)
+                    helper->requestFileStatus(dir.key() + '/' + it.key());
+            }
+            return;
+        }
+        if (tokens.count() == 2 && tokens[0] == "UNREGISTER_PATH") {
+            for (auto dir = m_status.begin(); dir != m_status.end();) {
+                if (!isInDirectory(dir.key(), tokens[1])) {
+                    ++dir;
+                    continue;
+                }
+                for (auto it = dir->constBegin(); it != dir->constEnd(); ++it)
+                    emit overlaysChanged(QUrl::fromLocalFile(QString::fromUtf8(dir.key() + '/' + it.key())), QStringList());
+                dir = m_status.erase(dir);
+            }
+            return;
+        }
         if (tokens.count() != 3)
             return;
         if (tokens[0] != "STATUS" && tokens[0] != "BROADCAST")
@@ -91,7 +125,12 @@ private:
             return;
 
         const QByteArray name = tokens[2];
-        QByteArray &status = m_status[name]; // reference to the item in the hash
+        const int slash = name.lastIndexOf('/');
+        auto directory = m_status.find(name.left(slash));
+        // Dolphin does not show that directory
+        if (directory == m_status.end())
+            return;
+        QByteArray &status = (*directory)[name.mid(slash + 1)]; // reference to the item in the hash
         if (status == tokens[1])
             return;
         status = tokens[1];
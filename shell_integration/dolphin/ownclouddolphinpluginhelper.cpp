@@ -43,6 +43,10 @@ void OwncloudDolphinPluginHelper::timerEvent(QTimerEvent *e)
         tryConnect();
         return;
     }
+    if (e->timerId() == _statusRequestTimer.timerId()) {
+        sendStatusRequests();
+        return;
+    }
     QObject::timerEvent(e);
 }
 
@@ -57,9 +61,43 @@ void OwncloudDolphinPluginHelper::sendCommand(const char* data)
     _socket.flush();
 }
 
+void OwncloudDolphinPluginHelper::requestFileStatus(const QByteArray &localFile)
+{
+    const int slash = localFile.lastIndexOf('/');
+    _pendingStatusRequests[localFile.left(slash)].insert(localFile);
+    // Dolphin asks for all the items of a listing at once
+    if (!_statusRequestTimer.isActive())
+        _statusRequestTimer.start(20, this);
+}
+
+void OwncloudDolphinPluginHelper::sendStatusRequests()
+{
+    _statusRequestTimer.stop();
+    for (auto it = _pendingStatusRequests.constBegin(); it != _pendingStatusRequests.constEnd(); ++it) {
+        const QSet<QByteArray> &files = it.value();
+        if (_batchSupported && files.size() > 1) {
+            QByteArray paths;
+            for (const QByteArray &file : files) {
+                if (!paths.isEmpty())
+                    paths += '\x1e';
+                paths += file;
+            }
+            sendCommand(QByteArray("RETRIEVE_FILE_STATUS_BATCH:" + paths + "\n"));
+        } else {
+            for (const QByteArray &file : files)
+                sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + file + "\n"));
+        }
+    }
+    _pendingStatusRequests.clear();
+}
+
 void OwncloudDolphinPluginHelper::slotConnected()
 {
+    // Until the client tells its version
+    _batchSupported = false;
+    sendCommand("VERSION:\n");
     sendCommand("GET_STRINGS:\n");
+    emit connected();
 }
 
 void OwncloudDolphinPluginHelper::tryConnect()
@@ -92,6 +130,13 @@ void OwncloudDolphinPluginHelper::slotReadyRead()
             QString file = QString::fromUtf8(line.constData() + col + 1, line.size() - col - 1);
             _paths.append(file);
             continue;
+        } else if (line.startsWith("VERSION:")) {
+            // VERSION:<client version>:<socket api version>, the batches are in 1.1
+            const QList<QByteArray> api = line.mid(line.lastIndexOf(':') + 1).split('.');
+            const int major = api.value(0).toInt();
+            const int minor = api.value(1).toInt();
+            _batchSupported = major > 1 || (major == 1 && minor >= 1);
+            continue;
         } else if (line.startsWith("STRING:")) {
             auto args = QString::fromUtf8(line).split(QLatin1Char(':'));
             if (args.size() >= 3) {
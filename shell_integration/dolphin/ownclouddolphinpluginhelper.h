@@ -20,6 +20,8 @@
 #pragma once
 #include <QObject>
 #include <QBasicTimer>
+#include <QMap>
+#include <QSet>
 #include <QLocalSocket>
 #include "ownclouddolphinpluginhelper_export.h"
 
@@ -30,6 +32,8 @@ public:
 
     bool isConnected() const;
     void sendCommand(const char *data);
+    /** Asks for the status of @a localFile, the requests of a directory listing are sent together */
+    void requestFileStatus(const QByteArray &localFile);
     QVector<QString> paths() const { return _paths; }
 
     QString contextMenuTitle() const
@@ -46,6 +50,7 @@ public:
 
 signals:
     void commandRecieved(const QByteArray &cmd);
+    void connected();
 
 protected:
     void timerEvent(QTimerEvent*) override;
@@ -55,10 +60,15 @@ private:
     void slotConnected();
     void slotReadyRead();
     void tryConnect();
+    void sendStatusRequests();
     QLocalSocket _socket;
     QByteArray _line;
     QVector<QString> _paths;
     QBasicTimer _connectTimer;
 
+    QBasicTimer _statusRequestTimer;
+    QMap<QByteArray, QSet<QByteArray>> _pendingStatusRequests; // the files by directory
+    bool _batchSupported = false;
+
     QMap<QString, QString> _strings;
 };
@@ -252,6 +252,14 @@ class MenuExtension(GObject.GObject, Nautilus.MenuProvider):
             item_emailprivatelink.connect("activate", self.context_menu_action, 'EMAIL_PRIVATE_LINK', file)
             menu.append_item(item_emailprivatelink)
 
+        # Placeholders of virtual files can be replaced by the file
+        suffix = self.strings.get('VIRTUAL_FILE_SUFFIX')
+        if suffix and filename.endswith(suffix) and 'DOWNLOAD_VIRTUAL_FILE_MENU_TITLE' in self.strings:
+            item_download = Nautilus.MenuItem(
+                name='DownloadVirtualFile', label=self.strings.get('DOWNLOAD_VIRTUAL_FILE_MENU_TITLE'))
+            item_download.connect("activate", self.context_menu_action, 'DOWNLOAD_VIRTUAL_FILE', file)
+            menu.append_item(item_download)
+
         return [item_owncloud]
 
 
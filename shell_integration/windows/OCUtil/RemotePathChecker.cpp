@@ -100,6 +100,7 @@ void RemotePathChecker::workerThreadLoop()
                     for (auto it = _cache.begin(); it != _cache.end() ; ) {
                         if (StringUtil::isDescendantOf(it->first, responsePath)) {
                             removedPaths.emplace_back(move(it->first));
+                            _lru.erase(it->second.lruPosition);
                             it = _cache.erase(it);
                         } else {
                             ++it;
@@ -108,6 +109,20 @@ void RemotePathChecker::workerThreadLoop()
                 }
                 for (auto& path : removedPaths)
                     SHChangeNotify(SHCNE_UPDATEITEM, SHCNF_PATH | SHCNF_FLUSHNOWAIT, path.data(), NULL);
+            } else if (StringUtil::begins_with(response, wstring(L"UPDATE_VIEW:"))) {
+                wstring responsePath = response.substr(12); // length of UPDATE_VIEW:
+
+                {   std::unique_lock<std::mutex> lock(_mutex);
+                    ++_generation;
+                    if (_viewGenerations.size() >= MaxViewGenerations) {
+                        // Refresh everything rather than keeping track of more directories
+                        _viewGenerations.clear();
+                        _minGeneration = _generation;
+                    }
+                    _viewGenerations[responsePath] = _generation;
+                }
+                // Explorer asks for the states it shows again, they get refreshed then
+                SHChangeNotify(SHCNE_UPDATEDIR, SHCNF_PATH | SHCNF_FLUSHNOWAIT, responsePath.data(), NULL);
             } else if (StringUtil::begins_with(response, wstring(L"STATUS:")) ||
                     StringUtil::begins_with(response, wstring(L"BROADCAST:"))) {
 
@@ -120,19 +135,7 @@ void RemotePathChecker::workerThreadLoop()
 
                 bool updateView = false;
                 {   std::unique_lock<std::mutex> lock(_mutex);
-                    auto it = _cache.find(responsePath);
-                    if (it == _cache.end()) {
-                        // The client only approximates requested files, if the bloom
-                        // filter becomes saturated after navigating multiple directories we'll start getting
-                        // status pushes that we never requested and fill our cache. Ignore those.
-                        if (!wasAsked) {
-                            continue;
-                        }
-                        it = _cache.insert(make_pair(responsePath, StateNone)).first;
-                    }
-
-                    updateView = it->second != state;
-                    it->second = state;
+                    updateView = _storeState(responsePath, state, wasAsked);
                 }
                 if (updateView) {
                     SHChangeNotify(SHCNE_UPDATEITEM, SHCNF_PATH | SHCNF_FLUSHNOWAIT, responsePath.data(), NULL);
@@ -146,8 +149,10 @@ void RemotePathChecker::workerThreadLoop()
             _connected = connected = false;
 
             // Swap to make a copy of the cache under the mutex and clear the one stored.
-            std::unordered_map<std::wstring, FileState> cache;
+            std::unordered_map<std::wstring, CacheEntry> cache;
             swap(cache, _cache);
+            _lru.clear();
+            _viewGenerations.clear();
             lock.unlock();
             // Let explorer know about each invalidated cache entry that needs to get its icon removed.
             for (auto it = cache.begin(); it != cache.end(); ++it) {
@@ -166,6 +171,8 @@ void RemotePathChecker::workerThreadLoop()
 
 RemotePathChecker::RemotePathChecker()
     : _stop(false)
+    , _generation(0)
+    , _minGeneration(0)
     , _watchedDirectories(make_shared<const vector<wstring>>())
     , _connected(false)
     , _newQueries(CreateEvent(NULL, FALSE, FALSE, NULL))
@@ -200,8 +207,18 @@ bool RemotePathChecker::IsMonitoredPath(const wchar_t* filePath, int* state)
 
     auto it = _cache.find(path);
     if (it != _cache.end()) {
+        CacheEntry &entry = it->second;
+        _lru.splice(_lru.begin(), _lru, entry.lruPosition);
         // The path is in our cache, and we'll get updates pushed if the status changes.
-        *state = it->second;
+        *state = entry.state;
+        if (entry.refreshing || !_isStale(path, entry)) {
+            return true;
+        }
+        // Keep showing the last known state until the client answers
+        entry.refreshing = true;
+        _pending.push(path);
+        lock.unlock();
+        SetEvent(_newQueries);
         return true;
     }
 
@@ -212,6 +229,63 @@ bool RemotePathChecker::IsMonitoredPath(const wchar_t* filePath, int* state)
     return false;
 }
 
+bool RemotePathChecker::_isStale(const std::wstring &path, const CacheEntry &entry) const
+{
+    if (entry.generation < _minGeneration) {
+        return true;
+    }
+    if (_viewGenerations.empty()) {
+        return false;
+    }
+    // An UPDATE_VIEW for the path or one of its parent directories since the state was received
+    std::wstring directory = path;
+    while (!directory.empty()) {
+        auto it = _viewGenerations.find(directory);
+        if (it != _viewGenerations.end() && it->second > entry.generation) {
+            return true;
+        }
+        auto separator = directory.find_last_of(L'\\');
+        if (separator == std::wstring::npos) {
+            break;
+        }
+        directory.resize(separator);
+    }
+    return false;
+}
+
+bool RemotePathChecker::_storeState(const std::wstring &path, FileState state, bool wasAsked)
+{
+    auto it = _cache.find(path);
+    if (it == _cache.end()) {
+        // The client only approximates requested files, if the bloom
+        // filter becomes saturated after navigating multiple directories we'll start getting
+        // status pushes that we never requested and fill our cache. Ignore those.
+        if (!wasAsked) {
+            return false;
+        }
+        if (_cache.size() >= MaxCacheEntries) {
+            // Explorer asks again for the least recently used one if it shows it again
+            _eraseFromCache(_cache.find(_lru.back()));
+        }
+        _lru.push_front(path);
+        CacheEntry entry = { StateNone, 0, false, _lru.begin() };
+        it = _cache.insert(make_pair(path, entry)).first;
+    }
+
+    CacheEntry &entry = it->second;
+    bool changed = entry.state != state;
+    entry.state = state;
+    entry.generation = _generation;
+    entry.refreshing = false;
+    return changed;
+}
+
+void RemotePathChecker::_eraseFromCache(std::unordered_map<std::wstring, CacheEntry>::iterator it)
+{
+    _lru.erase(it->second.lruPosition);
+    _cache.erase(it);
+}
+
 RemotePathChecker::FileState RemotePathChecker::_StrToFileState(const std::wstring &str)
 {
     if (str == L"NOP" || str == L"NONE") {
@@ -17,6 +17,7 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <list>
 #include <queue>
 #include <thread>
 #include <memory>
@@ -42,7 +43,24 @@ public:
     bool IsMonitoredPath(const wchar_t* filePath, int* state);
 
 private:
+    struct CacheEntry {
+        FileState state;
+        // The _generation when the state was received
+        uint64_t generation;
+        // A RETRIEVE_FILE_STATUS for it is on the way
+        bool refreshing;
+        std::list<std::wstring>::iterator lruPosition;
+    };
+
+    // Explorer asks for every file it shows, don't keep them all for huge directories
+    static const size_t MaxCacheEntries = 10000;
+    static const size_t MaxViewGenerations = 256;
+
     FileState _StrToFileState(const std::wstring &str);
+    bool _isStale(const std::wstring &path, const CacheEntry &entry) const;
+    /** Stores the state of a path, returns whether it changed */
+    bool _storeState(const std::wstring &path, FileState state, bool wasAsked);
+    void _eraseFromCache(std::unordered_map<std::wstring, CacheEntry>::iterator it);
     std::mutex _mutex;
     std::atomic<bool> _stop;
 
@@ -52,7 +70,15 @@ private:
      * send that to the socket. */
     std::queue<std::wstring> _pending;
 
-    std::unordered_map<std::wstring, FileState> _cache;
+    std::unordered_map<std::wstring, CacheEntry> _cache;
+    // The paths of _cache, the most recently used first
+    std::list<std::wstring> _lru;
+    // Incremented for each UPDATE_VIEW, the cached states below its
+    // directory that are older are refreshed when they are asked for.
+    uint64_t _generation;
+    std::unordered_map<std::wstring, uint64_t> _viewGenerations;
+    // All the states older than this are refreshed
+    uint64_t _minGeneration;
     // The vector is const since it will be accessed from multiple threads through OCOverlay::IsMemberOf.
     // Each modification needs to be made onto a copy and then atomically replaced in the shared_ptr.
     std::shared_ptr<const std::vector<std::wstring>> _watchedDirectories;
@@ -15,14 +15,19 @@
  */
 
 #include <iostream>
+#include <memory>
 #include <random>
 #include <qcoreapplication.h>
 #include <QStringList>
 #include <QUrl>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QTimer>
 #include <qdebug.h>
 
 #include "account.h"
@@ -31,9 +36,14 @@
 #include "creds/httpcredentials.h"
 #include "simplesslerrorhandler.h"
 #include "syncengine.h"
+#include "csync_util.h"
 #include "common/syncjournaldb.h"
+#include "common/sessionrecorder.h"
+#include "common/tracing.h"
 #include "config.h"
 #include "connectionvalidator.h"
+#include "syncwatcher.h"
+#include "foldersyncqueue.h"
 
 #include "cmd.h"
 
@@ -77,6 +87,12 @@ struct CmdOptions
     int restartTimes;
     int downlimit;
     int uplimit;
+    QString stats;
+    bool dryRun;
+    int watchInterval; // seconds between the remote polls of --watch, 0 without it
+    QString folderList;
+    int parallelFolders;
+    int liveMetricsInterval; // seconds between the SyncEngine::liveMetrics() lines, 0 without them
 };
 
 // we can't use csync_set_userdata because the SyncEngine sets it already.
@@ -85,6 +101,11 @@ CmdOptions *opts = 0;
 
 const qint64 timeoutToUseMsec = qMax(1000, ConnectionValidator::DefaultCallingIntervalMsec - 5 * 1000);
 
+// Seconds between the remote polls of --watch without a value, like the client's default
+static const int DefaultWatchInterval = 30;
+// Seconds between the lines of --live-metrics without a value
+static const int DefaultLiveMetricsInterval = 5;
+
 class EchoDisabler
 {
 public:
@@ -168,6 +189,7 @@ void help()
     std::cout << binaryName << " - command line " APPLICATION_NAME " client tool" << std::endl;
     std::cout << "" << std::endl;
     std::cout << "Usage: " << binaryName << " [OPTION] <source_dir> <server_url>" << std::endl;
+    std::cout << "       " << binaryName << " [OPTION] --folders [file] <server_url>" << std::endl;
     std::cout << "" << std::endl;
     std::cout << "A proxy can either be set manually using --httpproxy." << std::endl;
     std::cout << "Otherwise, the setting from a configured sync client will be used." << std::endl;
@@ -191,6 +213,19 @@ void help()
     std::cout << "  -h                     Sync hidden files,do not ignore them" << std::endl;
     std::cout << "  --version, -v          Display version and exit" << std::endl;
     std::cout << "  --logdebug             More verbose logging" << std::endl;
+    std::cout << "  --trace [file]         Write a trace of the sync to [file], for chrome://tracing" << std::endl;
+    std::cout << "  --record [file]        Record the sync anonymized to [file], for the ReplayBench" << std::endl;
+    std::cout << "  --stats [format]       Print the timings and counters of the syncs at the end," << std::endl;
+    std::cout << "                         the format is json or text" << std::endl;
+    std::cout << "  --dry-run              Only discover and reconcile, don't propagate anything" << std::endl;
+    std::cout << "  --benchmark            Same as --silent --stats json" << std::endl;
+    std::cout << "  --live-metrics [seconds]  Print the counters of the running syncs to stderr" << std::endl;
+    std::cout << "                         as a line of json every [seconds] (default to 5)" << std::endl;
+    std::cout << "  --watch [seconds]      Keep running and sync the local changes as they happen," << std::endl;
+    std::cout << "                         the remote folder is polled every [seconds] (default to 30)" << std::endl;
+    std::cout << "  --folders [file]       Sync the folders listed in [file] with one account, a line" << std::endl;
+    std::cout << "                         holds a local directory, a tab and a remote folder" << std::endl;
+    std::cout << "  --parallel-folders [n] Sync at most n folders of --folders at once (default to 2)" << std::endl;
     std::cout << "" << std::endl;
     exit(0);
 }
@@ -219,16 +254,19 @@ void parseOptions(const QStringList &app_args, CmdOptions *options)
 
     options->target_url = args.takeLast();
 
-    options->source_dir = args.takeLast();
-    if (!options->source_dir.endsWith('/')) {
-        options->source_dir.append('/');
-    }
-    QFileInfo fi(options->source_dir);
-    if (!fi.exists()) {
-        std::cerr << "Source dir '" << qPrintable(options->source_dir) << "' does not exist." << std::endl;
-        exit(1);
+    // The --folders list replaces the source dir
+    if (!args.contains("--folders")) {
+        options->source_dir = args.takeLast();
+        if (!options->source_dir.endsWith('/')) {
+            options->source_dir.append('/');
+        }
+        QFileInfo fi(options->source_dir);
+        if (!fi.exists()) {
+            std::cerr << "Source dir '" << qPrintable(options->source_dir) << "' does not exist." << std::endl;
+            exit(1);
+        }
+        options->source_dir = fi.absoluteFilePath();
     }
-    options->source_dir = fi.absoluteFilePath();
 
     QStringListIterator it(args);
     // skip file name;
@@ -271,14 +309,98 @@ void parseOptions(const QStringList &app_args, CmdOptions *options)
         } else if (option == "--logdebug") {
             Logger::instance()->setLogFile("-");
             Logger::instance()->setLogDebug(true);
+        } else if (option == "--trace" && !it.peekNext().startsWith("-")) {
+            Tracing::setOutputFile(it.next());
+        } else if (option == "--record" && !it.peekNext().startsWith("-")) {
+            SessionRecorder::setOutputFile(it.next());
+        } else if (option == "--stats" && !it.peekNext().startsWith("-")) {
+            options->stats = it.next();
+            if (options->stats != "json" && options->stats != "text")
+                help();
+        } else if (option == "--dry-run") {
+            options->dryRun = true;
+        } else if (option == "--watch") {
+            options->watchInterval = DefaultWatchInterval;
+            if (it.hasNext() && !it.peekNext().startsWith("-")) {
+                options->watchInterval = it.next().toInt();
+                if (options->watchInterval <= 0)
+                    help();
+            }
+        } else if (option == "--folders" && !it.peekNext().startsWith("-")) {
+            options->folderList = it.next();
+        } else if (option == "--parallel-folders" && !it.peekNext().startsWith("-")) {
+            options->parallelFolders = it.next().toInt();
+            if (options->parallelFolders <= 0)
+                help();
+        } else if (option == "--live-metrics") {
+            options->liveMetricsInterval = DefaultLiveMetricsInterval;
+            if (it.hasNext() && !it.peekNext().startsWith("-")) {
+                options->liveMetricsInterval = it.next().toInt();
+                if (options->liveMetricsInterval <= 0)
+                    help();
+            }
+        } else if (option == "--benchmark") {
+            options->silent = true;
+            options->stats = "json";
         } else {
             help();
         }
     }
 
-    if (options->target_url.isEmpty() || options->source_dir.isEmpty()) {
+    if (options->target_url.isEmpty() || (options->source_dir.isEmpty() && options->folderList.isEmpty())) {
         help();
     }
+    // Every folder would need its own watcher and its own selective sync list
+    if (!options->folderList.isEmpty() && (options->watchInterval > 0 || !options->unsyncedfolders.isEmpty())) {
+        std::cerr << "--folders can't be used with --watch or --unsyncedfolders" << std::endl;
+        exit(1);
+    }
+}
+
+/* A local directory and the remote folder it syncs with */
+struct FolderPair
+{
+    QString localPath;
+    QString remotePath;
+};
+
+/* Reads the --folders list, a line holds the local directory, a tab and the remote folder */
+bool readFolderList(const QString &fileName, QVector<FolderPair> *folders)
+{
+    QFile f(fileName);
+    if (!f.open(QFile::ReadOnly)) {
+        std::cerr << "Could not open the folder list " << qPrintable(fileName) << std::endl;
+        return false;
+    }
+    int lineNumber = 0;
+    foreach (const QString &line, QString::fromUtf8(f.readAll()).split('\n')) {
+        ++lineNumber;
+        const QString trimmed = line.trimmed();
+        if (trimmed.isEmpty() || trimmed.startsWith('#'))
+            continue;
+        const int tab = trimmed.indexOf('\t');
+        if (tab <= 0) {
+            std::cerr << qPrintable(fileName) << ":" << lineNumber << ": expected a local directory, a tab and a remote folder" << std::endl;
+            return false;
+        }
+        FolderPair folder;
+        QFileInfo fi(trimmed.left(tab).trimmed());
+        if (!fi.isDir()) {
+            std::cerr << "Source dir '" << qPrintable(fi.filePath()) << "' does not exist." << std::endl;
+            return false;
+        }
+        folder.localPath = fi.absoluteFilePath();
+        if (!folder.localPath.endsWith('/'))
+            folder.localPath.append('/');
+        // Remote folders typically start with a / and don't end with one
+        folder.remotePath = trimmed.mid(tab + 1).trimmed();
+        if (!folder.remotePath.startsWith('/'))
+            folder.remotePath.prepend('/');
+        if (folder.remotePath.endsWith('/') && folder.remotePath != "/")
+            folder.remotePath.chop(1);
+        folders->append(folder);
+    }
+    return true;
 }
 
 /* If the selective sync list is different from before, we need to disable the read from db
@@ -305,6 +427,124 @@ void selectiveSyncFixup(OCC::SyncJournalDb *journal, const QStringList &newList)
     }
 }
 
+/* The metrics of every sync that ran, with the items each one had */
+struct CmdStats
+{
+    QJsonArray syncs;
+    QHash<const SyncEngine *, QJsonObject> pendingItems; // the engines of --folders sync at once
+    qint64 bytesTransferred = 0;
+    qint64 networkRequests = 0;
+    qint64 propagationMs = 0;
+
+    void addItems(const SyncEngine *engine, const SyncFileItemVector &items)
+    {
+        QJsonObject &counts = pendingItems[engine];
+        counts = QJsonObject();
+        for (const auto &item : items) {
+            const QString instruction = QString::fromLatin1(csync_instruction_str(item->_instruction));
+            counts.insert(instruction, counts.value(instruction).toInt() + 1);
+        }
+    }
+
+    void addMetrics(const SyncEngine *engine, const SyncRunMetrics &metrics)
+    {
+        QJsonObject sync = metrics.toJson();
+        sync.insert(QStringLiteral("items"), pendingItems.take(engine));
+        syncs.append(sync);
+        bytesTransferred += metrics._bytesTransferred;
+        networkRequests += metrics._networkRequests;
+        propagationMs += metrics._propagationMs;
+    }
+
+    qint64 throughput() const
+    {
+        return propagationMs > 0 ? bytesTransferred * 1000 / propagationMs : 0;
+    }
+
+    void print(const QString &format, bool success, bool dryRun, qint64 wallMs) const
+    {
+        if (format == "json") {
+            QJsonObject total;
+            total.insert(QStringLiteral("bytesTransferred"), double(bytesTransferred));
+            total.insert(QStringLiteral("networkRequests"), double(networkRequests));
+            total.insert(QStringLiteral("propagationMs"), double(propagationMs));
+            total.insert(QStringLiteral("throughputBytesPerSecond"), double(throughput()));
+
+            QJsonObject result;
+            result.insert(QStringLiteral("success"), success);
+            result.insert(QStringLiteral("dryRun"), dryRun);
+            result.insert(QStringLiteral("wallMs"), double(wallMs));
+            result.insert(QStringLiteral("syncs"), syncs);
+            result.insert(QStringLiteral("total"), total);
+            std::cout << QJsonDocument(result).toJson().constData();
+            return;
+        }
+
+        int n = 0;
+        foreach (const QJsonValue &value, syncs) {
+            const QJsonObject phases = value.toObject().value("phasesMs").toObject();
+            const QJsonObject counters = value.toObject().value("counters").toObject();
+            std::cout << "Sync " << ++n << ": local discovery " << phases.value("localDiscovery").toInt()
+                      << " ms, remote discovery " << phases.value("remoteDiscovery").toInt()
+                      << " ms, reconcile " << phases.value("reconcile").toInt()
+                      << " ms, propagation " << phases.value("propagation").toInt()
+                      << " ms, total " << phases.value("total").toInt() << " ms" << std::endl;
+            std::cout << "        " << counters.value("discoveredEntries").toInt() << " entries discovered, "
+                      << counters.value("peakItemCount").toInt() << " items, "
+                      << counters.value("networkRequests").toInt() << " requests" << std::endl;
+        }
+        std::cout << "Transferred " << bytesTransferred << " bytes with " << networkRequests << " requests, "
+                  << throughput() / 1024 << " KB/s, " << wallMs << " ms in all"
+                  << (dryRun ? " (dry run)" : "") << (success ? "" : ", failed") << std::endl;
+    }
+};
+
+/* Applies the options that every engine gets, false if the exclude lists can't be loaded */
+bool setupEngine(SyncEngine *engine, const CmdOptions &options, CmdStats *stats)
+{
+    engine->setIgnoreHiddenFiles(options.ignoreHiddenFiles);
+    engine->setNetworkLimits(options.uplimit, options.downlimit);
+    if (options.dryRun) {
+        SyncOptions syncOptions;
+        syncOptions._dryRun = true;
+        engine->setSyncOptions(syncOptions);
+    }
+    if (!options.stats.isEmpty()) {
+        QObject::connect(engine, &SyncEngine::aboutToPropagate,
+            [stats, engine](SyncFileItemVector &items) { stats->addItems(engine, items); });
+        QObject::connect(engine, &SyncEngine::syncMetrics,
+            [stats, engine](const SyncRunMetrics &metrics) { stats->addMetrics(engine, metrics); });
+    }
+    if (options.liveMetricsInterval > 0) {
+        // stdout has the --stats, and the lines must not mix with them
+        auto timer = new QTimer(engine);
+        QObject::connect(timer, &QTimer::timeout, engine, [engine]() {
+            if (!engine->isSyncRunning())
+                return;
+            QJsonObject snapshot = engine->liveMetrics();
+            snapshot.insert(QStringLiteral("localPath"), engine->localPath());
+            std::cerr << QJsonDocument(snapshot).toJson(QJsonDocument::Compact).constData() << std::endl;
+        });
+        timer->start(options.liveMetricsInterval * 1000);
+    }
+
+    // Exclude lists
+
+    bool hasUserExcludeFile = !options.exclude.isEmpty();
+    QString systemExcludeFile = ConfigFile::excludeFileFromSystem();
+
+    // Always try to load the user-provided exclude list if one is specified
+    if (hasUserExcludeFile) {
+        engine->excludedFiles().addExcludeFilePath(options.exclude);
+    }
+    // Load the system list if available, or if there's no user-provided list
+    if (!hasUserExcludeFile || QFile::exists(systemExcludeFile)) {
+        engine->excludedFiles().addExcludeFilePath(systemExcludeFile);
+    }
+
+    return engine->excludedFiles().reloadExcludeFiles();
+}
+
 int main(int argc, char **argv)
 {
     QCoreApplication app(argc, argv);
@@ -327,10 +567,18 @@ int main(int argc, char **argv)
     options.restartTimes = 3;
     options.uplimit = 0;
     options.downlimit = 0;
+    options.dryRun = false;
+    options.watchInterval = 0;
+    options.parallelFolders = 2;
+    options.liveMetricsInterval = 0;
     ClientProxy clientProxy;
 
     parseOptions(app.arguments(), &options);
 
+    CmdStats stats;
+    QElapsedTimer wallTimer;
+    wallTimer.start();
+
     csync_set_log_level(options.silent ? 1 : 11);
     if (options.silent) {
         qInstallMsgHandler(nullMessageHandler);
@@ -504,6 +752,36 @@ restart_sync:
         }
     }
 
+    if (!options.folderList.isEmpty()) {
+        QVector<FolderPair> folders;
+        if (!readFolderList(options.folderList, &folders))
+            return EXIT_FAILURE;
+
+        // The journals outlive the engines using them
+        std::vector<std::unique_ptr<SyncJournalDb>> journals;
+        std::vector<std::unique_ptr<SyncEngine>> engines;
+        FolderSyncQueue queue(options.parallelFolders, options.dryRun ? 0 : options.restartTimes);
+        foreach (const FolderPair &folderPair, folders) {
+            const QString folderDbPath = folderPair.localPath
+                + SyncJournalDb::makeDbName(folderPair.localPath, credentialFreeUrl, folderPair.remotePath, user);
+            journals.emplace_back(new SyncJournalDb(folderDbPath));
+            engines.emplace_back(new SyncEngine(account, folderPair.localPath, folderPair.remotePath, journals.back().get()));
+            if (!setupEngine(engines.back().get(), options, &stats)) {
+                qFatal("Cannot load system exclude list or list supplied via --exclude");
+                return EXIT_FAILURE;
+            }
+            queue.addEngine(engines.back().get());
+        }
+        QObject::connect(&queue, &FolderSyncQueue::finished,
+            [&app](bool result) { app.exit(result ? EXIT_SUCCESS : EXIT_FAILURE); });
+        queue.start();
+
+        int resultCode = app.exec();
+        if (!options.stats.isEmpty())
+            stats.print(options.stats, resultCode == EXIT_SUCCESS, options.dryRun, wallTimer.elapsed());
+        return resultCode;
+    }
+
     Cmd cmd;
     QString dbPath = options.source_dir + SyncJournalDb::makeDbName(options.source_dir, credentialFreeUrl, folder, user);
     SyncJournalDb db(dbPath);
@@ -513,39 +791,31 @@ restart_sync:
     }
 
     SyncEngine engine(account, options.source_dir, folder, &db);
-    engine.setIgnoreHiddenFiles(options.ignoreHiddenFiles);
-    engine.setNetworkLimits(options.uplimit, options.downlimit);
-    QObject::connect(&engine, &SyncEngine::finished,
-        [&app](bool result) { app.exit(result ? EXIT_SUCCESS : EXIT_FAILURE); });
-    QObject::connect(&engine, &SyncEngine::transmissionProgress, &cmd, &Cmd::transmissionProgressSlot);
-
-
-    // Exclude lists
-
-    bool hasUserExcludeFile = !options.exclude.isEmpty();
-    QString systemExcludeFile = ConfigFile::excludeFileFromSystem();
-
-    // Always try to load the user-provided exclude list if one is specified
-    if (hasUserExcludeFile) {
-        engine.excludedFiles().addExcludeFilePath(options.exclude);
-    }
-    // Load the system list if available, or if there's no user-provided list
-    if (!hasUserExcludeFile || QFile::exists(systemExcludeFile)) {
-        engine.excludedFiles().addExcludeFilePath(systemExcludeFile);
-    }
-
-    if (!engine.excludedFiles().reloadExcludeFiles()) {
+    if (!setupEngine(&engine, options, &stats)) {
         qFatal("Cannot load system exclude list or list supplied via --exclude");
         return EXIT_FAILURE;
     }
-
+    bool watching = false;
+    QString remoteEtag;
+    QObject::connect(&engine, &SyncEngine::finished, [&](bool result) {
+        if (!watching)
+            app.exit(result ? EXIT_SUCCESS : EXIT_FAILURE);
+        else if (!options.stats.isEmpty()) {
+            // One report per sync of --watch
+            stats.print(options.stats, result, false, wallTimer.elapsed());
+            stats = CmdStats();
+            wallTimer.restart();
+        }
+    });
+    QObject::connect(&engine, &SyncEngine::rootEtag, [&remoteEtag](const QString &etag) { remoteEtag = etag; });
+    QObject::connect(&engine, &SyncEngine::transmissionProgress, &cmd, &Cmd::transmissionProgressSlot);
 
     // Have to be done async, else, an error before exec() does not terminate the event loop.
     QMetaObject::invokeMethod(&engine, "startSync", Qt::QueuedConnection);
 
     int resultCode = app.exec();
 
-    if (engine.isAnotherSyncNeeded() != NoFollowUpSync) {
+    if (!options.dryRun && engine.isAnotherSyncNeeded() != NoFollowUpSync) {
         if (restartCount < options.restartTimes) {
             restartCount++;
             qDebug() << "Restarting Sync, because another sync is needed" << restartCount;
@@ -554,5 +824,18 @@ restart_sync:
         qWarning() << "Another sync is needed, but not done because restart count is exceeded" << restartCount;
     }
 
+    if (!options.stats.isEmpty())
+        stats.print(options.stats, resultCode == EXIT_SUCCESS, options.dryRun, wallTimer.elapsed());
+
+    if (options.watchInterval > 0 && !options.dryRun) {
+        // The engine, the journal and the account are kept for the next syncs
+        watching = true;
+        stats = CmdStats();
+        wallTimer.restart();
+        SyncWatcher watcher(&engine, account, options.source_dir, folder, options.watchInterval * 1000);
+        watcher.start(resultCode == EXIT_SUCCESS ? remoteEtag : QString());
+        return app.exec();
+    }
+
     return resultCode;
 }
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "foldersyncqueue.h"
+
+#include <QLoggingCategory>
+
+#include "syncengine.h"
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcFolderSyncQueue, "cmd.folderqueue", QtInfoMsg)
+
+FolderSyncQueue::FolderSyncQueue(int maxParallel, int maxRestarts, QObject *parent)
+    : QObject(parent)
+    , _maxParallel(qMax(1, maxParallel))
+    , _maxRestarts(maxRestarts)
+{
+}
+
+void FolderSyncQueue::addEngine(SyncEngine *engine)
+{
+    const int index = _folders.size();
+    _folders.append(Folder{ engine, 0 });
+    connect(engine, &SyncEngine::finished, this, [this, index](bool success) { slotEngineFinished(index, success); });
+}
+
+void FolderSyncQueue::start()
+{
+    if (_folders.isEmpty()) {
+        // Not before the event loop runs
+        QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection, Q_ARG(bool, true));
+        return;
+    }
+    while (_running < _maxParallel && _next < _folders.size())
+        startNext();
+}
+
+void FolderSyncQueue::startNext()
+{
+    SyncEngine *engine = _folders[_next++].engine;
+    ++_running;
+    qCInfo(lcFolderSyncQueue) << "Syncing" << engine->localPath() << "with" << engine->remotePath()
+                              << _running << "running," << _folders.size() - _next << "waiting";
+    // Have to be done async, else an error before exec() does not terminate the event loop
+    QMetaObject::invokeMethod(engine, "startSync", Qt::QueuedConnection);
+}
+
+void FolderSyncQueue::slotEngineFinished(int index, bool success)
+{
+    Folder &folder = _folders[index];
+    if (success && folder.engine->isAnotherSyncNeeded() != NoFollowUpSync) {
+        if (folder.restarts < _maxRestarts) {
+            ++folder.restarts;
+            qCInfo(lcFolderSyncQueue) << "Restarting the sync of" << folder.engine->localPath() << folder.restarts;
+            QMetaObject::invokeMethod(folder.engine, "startSync", Qt::QueuedConnection);
+            return;
+        }
+        qCWarning(lcFolderSyncQueue) << "Another sync of" << folder.engine->localPath()
+                                     << "is needed, but not done because restart count is exceeded";
+    }
+    if (!success) {
+        qCWarning(lcFolderSyncQueue) << "The sync of" << folder.engine->localPath() << "failed";
+        _success = false;
+    }
+
+    --_running;
+    if (_next < _folders.size()) {
+        startNext();
+    } else if (_running == 0) {
+        emit finished(_success);
+    }
+}
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QVector>
+
+namespace OCC {
+
+class SyncEngine;
+
+/**
+ * @brief Syncs the folders of owncloudcmd --folders, a few at a time
+ *
+ * The engines share the account of owncloudcmd and so its AccessManager:
+ * the folders reuse the connections to the server, the credentials and the
+ * capabilities are fetched once. At most maxParallel folders sync at the
+ * same time, a folder that needs another sync is restarted up to
+ * maxRestarts times before the next one is started.
+ *
+ * @ingroup cmd
+ */
+class FolderSyncQueue : public QObject
+{
+    Q_OBJECT
+public:
+    FolderSyncQueue(int maxParallel, int maxRestarts, QObject *parent = nullptr);
+
+    /** The engine is not owned, it must outlive the queue */
+    void addEngine(SyncEngine *engine);
+
+    void start();
+
+signals:
+    /** All the folders were synced, @a success if every one succeeded */
+    void finished(bool success);
+
+private:
+    void startNext();
+    void slotEngineFinished(int index, bool success);
+
+    struct Folder
+    {
+        SyncEngine *engine;
+        int restarts;
+    };
+    QVector<Folder> _folders;
+    int _maxParallel;
+    int _maxRestarts;
+    int _next = 0;
+    int _running = 0;
+    bool _success = true;
+};
+}
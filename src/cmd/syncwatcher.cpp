@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncwatcher.h"
+
+#include <QLoggingCategory>
+
+#include "account.h"
+#include "networkjobs.h"
+#include "syncengine.h"
+
+#ifdef OWNCLOUDCMD_FOLDERWATCHER
+#include "folderwatcher.h"
+#endif
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcSyncWatcher, "cmd.watcher", QtInfoMsg)
+
+// Changes often come in bursts, like a copied directory
+static const int SyncDelayMs = 2000;
+
+SyncWatcher::SyncWatcher(SyncEngine *engine, AccountPtr account, const QString &localPath,
+    const QString &remotePath, int pollIntervalMs, QObject *parent)
+    : QObject(parent)
+    , _engine(engine)
+    , _account(account)
+    , _localPath(localPath)
+    , _remotePath(remotePath)
+{
+    _syncTimer.setSingleShot(true);
+    _syncTimer.setInterval(SyncDelayMs);
+    connect(&_syncTimer, &QTimer::timeout, this, &SyncWatcher::startSync);
+    _pollTimer.setInterval(pollIntervalMs);
+    connect(&_pollTimer, &QTimer::timeout, this, &SyncWatcher::slotPollRemote);
+    connect(_engine, &SyncEngine::finished, this, &SyncWatcher::slotSyncFinished);
+    connect(_engine, &SyncEngine::rootEtag, this, [this](const QString &etag) { _lastEtag = etag; });
+}
+
+SyncWatcher::~SyncWatcher()
+{
+}
+
+void SyncWatcher::start(const QString &remoteEtag)
+{
+    _lastEtag = remoteEtag;
+#ifdef OWNCLOUDCMD_FOLDERWATCHER
+    _watcher.reset(new FolderWatcher(_localPath));
+    connect(_watcher.data(), &FolderWatcher::pathChanged, this, &SyncWatcher::slotPathChanged);
+    connect(_watcher.data(), &FolderWatcher::lostChanges, this, &SyncWatcher::slotLostChanges);
+    qCInfo(lcSyncWatcher) << "Watching" << _localPath << "for changes";
+#else
+    qCInfo(lcSyncWatcher) << "No folder watcher, every poll syncs" << _localPath;
+#endif
+    _pollTimer.start();
+}
+
+void SyncWatcher::slotPathChanged(const QString &path)
+{
+    if (!path.startsWith(_localPath))
+        return;
+    if (_engine->excludedFiles().isExcluded(path, _localPath, _engine->ignoreHiddenFiles()))
+        return;
+    // The watcher reports what the sync itself writes too
+    if (_engine->wasFileTouched(path))
+        return;
+
+    _localDiscoveryPaths.insert(path.midRef(_localPath.size()).toUtf8());
+    scheduleSync();
+}
+
+void SyncWatcher::slotLostChanges()
+{
+    // Also the end of the initial walk of the inotify backend
+    qCInfo(lcSyncWatcher) << "The watcher may have lost changes, discovering everything";
+    _fullLocalDiscovery = true;
+    scheduleSync();
+}
+
+void SyncWatcher::slotPollRemote()
+{
+    if (!_watcher) {
+        scheduleSync();
+        return;
+    }
+    auto job = new RequestEtagJob(_account, _remotePath, this);
+    job->setTimeout(60 * 1000);
+    connect(job, &RequestEtagJob::etagRetreived, this, &SyncWatcher::slotEtagRetrieved);
+    job->start();
+}
+
+void SyncWatcher::slotEtagRetrieved(const QString &etag)
+{
+    if (etag == _lastEtag)
+        return;
+    qCInfo(lcSyncWatcher) << "The remote folder changed or the last sync failed, etag" << etag;
+    scheduleSync();
+}
+
+void SyncWatcher::scheduleSync()
+{
+    if (_engine->isSyncRunning()) {
+        _syncAgain = true;
+        return;
+    }
+    if (!_syncTimer.isActive())
+        _syncTimer.start();
+}
+
+void SyncWatcher::startSync()
+{
+    if (_engine->isSyncRunning()) {
+        _syncAgain = true;
+        return;
+    }
+    _syncAgain = false;
+
+    if (_watcher && _watcher->isReliable() && !_fullLocalDiscovery) {
+        qCInfo(lcSyncWatcher) << "Syncing" << _localDiscoveryPaths.size() << "changed local paths";
+        _engine->setLocalDiscoveryOptions(LocalDiscoveryStyle::DatabaseAndFilesystem, _localDiscoveryPaths);
+    } else {
+        _engine->setLocalDiscoveryOptions(LocalDiscoveryStyle::FilesystemOnly);
+    }
+    _previousLocalDiscoveryPaths = std::move(_localDiscoveryPaths);
+    _localDiscoveryPaths.clear();
+    _fullLocalDiscovery = false;
+
+    QMetaObject::invokeMethod(_engine, "startSync", Qt::QueuedConnection);
+}
+
+void SyncWatcher::slotSyncFinished(bool success)
+{
+    if (!success) {
+        // The failed sync is retried with the next poll, its changes with it
+        _localDiscoveryPaths.insert(_previousLocalDiscoveryPaths.begin(), _previousLocalDiscoveryPaths.end());
+        _previousLocalDiscoveryPaths.clear();
+        _lastEtag.clear();
+        return;
+    }
+    _previousLocalDiscoveryPaths.clear();
+    for (const auto &path : _engine->retryPaths())
+        _localDiscoveryPaths.insert(path.toUtf8());
+    if (_syncAgain || _engine->isAnotherSyncNeeded() != NoFollowUpSync)
+        scheduleSync();
+}
+}
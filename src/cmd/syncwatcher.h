@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QScopedPointer>
+#include <QString>
+#include <QTimer>
+#include <set>
+
+#include "accountfwd.h"
+
+namespace OCC {
+
+class FolderWatcher;
+class SyncEngine;
+
+/**
+ * @brief Keeps syncing a folder of owncloudcmd --watch
+ *
+ * The engine, its journal and the account stay alive between the syncs.
+ * The local changes reported by the FolderWatcher are synced with the
+ * DatabaseAndFilesystem discovery, only their directories are listed; the
+ * etag of the remote folder is polled for the remote changes. A full local
+ * discovery is done when the watcher lost changes or isn't reliable.
+ *
+ * Without a FolderWatcher in the build every poll does a full sync.
+ *
+ * @ingroup cmd
+ */
+class SyncWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    SyncWatcher(SyncEngine *engine, AccountPtr account, const QString &localPath,
+        const QString &remotePath, int pollIntervalMs, QObject *parent = nullptr);
+    ~SyncWatcher();
+
+    /** Starts watching, the first sync has been done already and found @a remoteEtag */
+    void start(const QString &remoteEtag);
+
+private slots:
+    void slotPathChanged(const QString &path);
+    void slotLostChanges();
+    void slotPollRemote();
+    void slotEtagRetrieved(const QString &etag);
+    void slotSyncFinished(bool success);
+    void startSync();
+
+private:
+    void scheduleSync();
+
+    SyncEngine *_engine;
+    AccountPtr _account;
+    QString _localPath;
+    QString _remotePath;
+    QScopedPointer<FolderWatcher> _watcher;
+    QTimer _syncTimer;
+    QTimer _pollTimer;
+    QString _lastEtag;
+    std::set<QByteArray> _localDiscoveryPaths;
+    std::set<QByteArray> _previousLocalDiscoveryPaths;
+    bool _fullLocalDiscovery = false;
+    bool _syncAgain = false;
+};
+}
@@ -18,10 +18,27 @@
 #include "config.h"
 #include "filesystembase.h"
 #include "common/checksums.h"
+#include "common/syncjournaldb.h"
+#include "common/tracing.h"
+#include "common/utility.h"
+#include "csync/vio/csync_vio_local.h"
 
+#include <QFile>
+#include <QFutureInterface>
 #include <QLoggingCategory>
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QThreadPool>
+#include <QtEndian>
 #include <qtconcurrentrun.h>
 
+#include <cstring>
+
+#ifdef ZLIB_FOUND
+#include <zlib.h>
+#endif
+
 /** \file checksums.cpp
  *
  * \brief Computing and validating file checksums
@@ -73,13 +90,173 @@
  * - Adler32 (requires zlib)
  * - MD5
  * - SHA1
+ * - XXH64, the 64 bit xxHash with seed 0, as 16 hex digits
  *
+ * They are in the knownChecksums list. A new one needs a
+ * ChecksumCalculator::Algorithm there; its name gets into the journal
+ * through SyncJournalDb::mapChecksumType() like the others. The server
+ * lists the ones it accepts in its capabilities.
  */
 
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcChecksums, "sync.checksums", QtInfoMsg)
 
+class ChecksumCalculator::Algorithm
+{
+public:
+    virtual ~Algorithm() {}
+    virtual void addData(const char *data, qint64 length) = 0;
+    virtual QByteArray result() = 0;
+};
+
+namespace {
+
+class CryptoHashAlgorithm : public ChecksumCalculator::Algorithm
+{
+public:
+    explicit CryptoHashAlgorithm(QCryptographicHash::Algorithm algorithm)
+        : _hash(algorithm)
+    {
+    }
+    void addData(const char *data, qint64 length) override { _hash.addData(data, length); }
+    QByteArray result() override { return _hash.result().toHex(); }
+
+private:
+    QCryptographicHash _hash;
+};
+
+#ifdef ZLIB_FOUND
+class AdlerAlgorithm : public ChecksumCalculator::Algorithm
+{
+public:
+    void addData(const char *data, qint64 length) override
+    {
+        _value = adler32(_value, reinterpret_cast<const Bytef *>(data), length);
+    }
+    QByteArray result() override { return QByteArray::number(qulonglong(_value), 16); }
+
+private:
+    unsigned long _value = adler32(0L, Z_NULL, 0);
+};
+#endif
+
+/**
+ * XXH64, several times faster than SHA1 and still good enough to find
+ * corrupted transfers and changed contents
+ */
+class XXHash64Algorithm : public ChecksumCalculator::Algorithm
+{
+public:
+    void addData(const char *data, qint64 length) override
+    {
+        auto input = reinterpret_cast<const uchar *>(data);
+        _totalLength += length;
+        if (_bufferSize + length < StripeSize) {
+            memcpy(_buffer + _bufferSize, input, length);
+            _bufferSize += int(length);
+            return;
+        }
+        if (_bufferSize > 0) {
+            const int fill = StripeSize - _bufferSize;
+            memcpy(_buffer + _bufferSize, input, fill);
+            consumeStripe(_buffer);
+            input += fill;
+            length -= fill;
+            _bufferSize = 0;
+        }
+        for (; length >= StripeSize; input += StripeSize, length -= StripeSize)
+            consumeStripe(input);
+        memcpy(_buffer, input, length);
+        _bufferSize = int(length);
+    }
+
+    QByteArray result() override
+    {
+        quint64 h;
+        if (_totalLength >= StripeSize) {
+            h = rotl(_v[0], 1) + rotl(_v[1], 7) + rotl(_v[2], 12) + rotl(_v[3], 18);
+            for (quint64 v : _v)
+                h = (h ^ round(0, v)) * Prime1 + Prime4;
+        } else {
+            h = Prime5;
+        }
+        h += _totalLength;
+
+        const uchar *p = _buffer;
+        const uchar *end = _buffer + _bufferSize;
+        for (; p + 8 <= end; p += 8)
+            h = rotl(h ^ round(0, qFromLittleEndian<quint64>(p)), 27) * Prime1 + Prime4;
+        if (p + 4 <= end) {
+            h = rotl(h ^ (quint64(qFromLittleEndian<quint32>(p)) * Prime1), 23) * Prime2 + Prime3;
+            p += 4;
+        }
+        for (; p < end; ++p)
+            h = rotl(h ^ (*p * Prime5), 11) * Prime1;
+
+        h ^= h >> 33;
+        h *= Prime2;
+        h ^= h >> 29;
+        h *= Prime3;
+        h ^= h >> 32;
+        return QByteArray::number(h, 16).rightJustified(16, '0');
+    }
+
+private:
+    static const int StripeSize = 32;
+    static const quint64 Prime1 = Q_UINT64_C(0x9E3779B185EBCA87);
+    static const quint64 Prime2 = Q_UINT64_C(0xC2B2AE3D27D4EB4F);
+    static const quint64 Prime3 = Q_UINT64_C(0x165667B19E3779F9);
+    static const quint64 Prime4 = Q_UINT64_C(0x85EBCA77C2B2AE63);
+    static const quint64 Prime5 = Q_UINT64_C(0x27D4EB2F165667C5);
+
+    static quint64 rotl(quint64 x, int r) { return (x << r) | (x >> (64 - r)); }
+    static quint64 round(quint64 acc, quint64 input) { return rotl(acc + input * Prime2, 31) * Prime1; }
+
+    void consumeStripe(const uchar *p)
+    {
+        for (int i = 0; i < 4; ++i)
+            _v[i] = round(_v[i], qFromLittleEndian<quint64>(p + 8 * i));
+    }
+
+    // With seed 0
+    quint64 _v[4] = { Prime1 + Prime2, Prime2, 0, 0 - Prime1 };
+    uchar _buffer[StripeSize];
+    int _bufferSize = 0;
+    quint64 _totalLength = 0;
+};
+
+struct KnownChecksum
+{
+    const char *type;
+    ChecksumCalculator::Algorithm *(*create)();
+};
+
+// In the order findBestChecksum() prefers them
+const KnownChecksum knownChecksums[] = {
+    { checkSumXXH64C, []() -> ChecksumCalculator::Algorithm * { return new XXHash64Algorithm; } },
+    { checkSumSHA1C, []() -> ChecksumCalculator::Algorithm * { return new CryptoHashAlgorithm(QCryptographicHash::Sha1); } },
+    { checkSumMD5C, []() -> ChecksumCalculator::Algorithm * { return new CryptoHashAlgorithm(QCryptographicHash::Md5); } },
+#ifdef ZLIB_FOUND
+    { checkSumAdlerC, []() -> ChecksumCalculator::Algorithm * { return new AdlerAlgorithm; } },
+#endif
+};
+
+const KnownChecksum *findKnownChecksum(const QByteArray &checksumType)
+{
+    for (const auto &known : knownChecksums) {
+        if (checksumType == known.type)
+            return &known;
+    }
+    return nullptr;
+}
+}
+
+bool isChecksumTypeSupported(const QByteArray &checksumType)
+{
+    return findKnownChecksum(checksumType);
+}
+
 QByteArray makeChecksumHeader(const QByteArray &checksumType, const QByteArray &checksum)
 {
     if (checksumType.isEmpty() || checksum.isEmpty())
@@ -92,15 +269,15 @@ QByteArray makeChecksumHeader(const QByteArray &checksumType, const QByteArray &
 
 QByteArray findBestChecksum(const QByteArray &checksums)
 {
-    int i = 0;
-    // The order of the searches here defines the preference ordering.
-    if (-1 != (i = checksums.indexOf("SHA1:"))
-        || -1 != (i = checksums.indexOf("MD5:"))
-        || -1 != (i = checksums.indexOf("Adler32:"))) {
-        // Now i is the start of the best checksum
-        // Grab it until the next space or end of string.
-        auto checksum = checksums.mid(i);
-        return checksum.mid(0, checksum.indexOf(" "));
+    // The order of knownChecksums defines the preference ordering.
+    for (const auto &known : knownChecksums) {
+        const int i = checksums.indexOf(QByteArray(known.type) + ':');
+        if (i != -1) {
+            // Now i is the start of the best checksum
+            // Grab it until the next space or end of string.
+            auto checksum = checksums.mid(i);
+            return checksum.mid(0, checksum.indexOf(" "));
+        }
     }
     return QByteArray();
 }
@@ -154,6 +331,145 @@ static bool checksumComputationEnabled()
     return enabled;
 }
 
+namespace {
+
+/**
+ * The checksums of ComputeChecksum::start(), on threads of their own
+ *
+ * The checksums are limited by the disk rather than by the CPU, so they
+ * don't go to the global pool where they would compete with everything
+ * else. A few threads each take the next file from the queue until it
+ * is empty, a burst of small files does not need a task per file.
+ */
+class ChecksumQueue
+{
+public:
+    ChecksumQueue()
+    {
+        bool ok = false;
+        int threads = qgetenv("OWNCLOUD_CHECKSUM_THREADS").toInt(&ok);
+        if (!ok)
+            threads = qBound(2, QThread::idealThreadCount(), 4);
+        _pool.setMaxThreadCount(qMax(1, threads));
+    }
+
+    QFuture<QByteArray> enqueue(const QString &filePath, const QByteArray &checksumType, bool backgroundIo)
+    {
+        Request request;
+        request.filePath = filePath;
+        request.checksumType = checksumType;
+        request.backgroundIo = backgroundIo;
+        request.result.reportStarted();
+        QFuture<QByteArray> future = request.result.future();
+
+        QMutexLocker lock(&_mutex);
+        _requests.enqueue(request);
+        if (_runningWorkers < _pool.maxThreadCount()) {
+            ++_runningWorkers;
+            QtConcurrent::run(&_pool, [this] { work(); });
+        }
+        return future;
+    }
+
+private:
+    struct Request
+    {
+        QString filePath;
+        QByteArray checksumType;
+        bool backgroundIo;
+        QFutureInterface<QByteArray> result;
+    };
+
+    void work()
+    {
+        // The requests of the folders can differ in the I/O priority
+        bool backgroundIo = false;
+        forever {
+            Request request;
+            {
+                QMutexLocker lock(&_mutex);
+                if (_requests.isEmpty()) {
+                    --_runningWorkers;
+                    break;
+                }
+                request = _requests.dequeue();
+            }
+            if (request.backgroundIo != backgroundIo) {
+                Utility::setThreadBackgroundIo(request.backgroundIo);
+                backgroundIo = request.backgroundIo;
+            }
+            const qint64 traceStart = Tracing::isEnabled() ? Tracing::now() : -1;
+            const QByteArray checksum = ComputeChecksum::computeNow(request.filePath, request.checksumType);
+            if (traceStart >= 0)
+                Tracing::addSpan("checksum", QLatin1String("compute ") + QString::fromLatin1(request.checksumType), traceStart, request.filePath);
+            request.result.reportResult(checksum);
+            request.result.reportFinished();
+        }
+        if (backgroundIo)
+            Utility::setThreadBackgroundIo(false);
+    }
+
+    QMutex _mutex;
+    QQueue<Request> _requests;
+    int _runningWorkers = 0;
+    // Last, it waits for the workers when it goes away
+    QThreadPool _pool;
+};
+
+Q_GLOBAL_STATIC(ChecksumQueue, checksumQueue)
+}
+
+QByteArray computeBlockChecksums(const QString &filePath, qint64 blockSize)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCWarning(lcChecksums) << "Could not open" << filePath << "for the block checksums:" << file.errorString();
+        return QByteArray();
+    }
+
+    QByteArray result;
+    result.reserve((file.size() / blockSize + 1) * blockChecksumSize);
+    QByteArray buf(blockSize, Qt::Uninitialized);
+    while (!file.atEnd()) {
+        const qint64 size = file.read(buf.data(), blockSize);
+        if (size < 0) {
+            qCWarning(lcChecksums) << "Error reading" << filePath << "for the block checksums:" << file.errorString();
+            return QByteArray();
+        }
+        result.append(QCryptographicHash::hash(QByteArray::fromRawData(buf.constData(), size), QCryptographicHash::Sha1));
+    }
+    return result;
+}
+
+ChecksumCalculator::ChecksumCalculator(const QByteArray &checksumType)
+    : _checksumType(checksumType)
+{
+    if (auto known = findKnownChecksum(checksumType))
+        _algorithm.reset(known->create());
+}
+
+ChecksumCalculator::~ChecksumCalculator()
+{
+}
+
+bool ChecksumCalculator::isValid() const
+{
+    return _algorithm != nullptr;
+}
+
+void ChecksumCalculator::addData(const char *data, qint64 length)
+{
+    if (_algorithm)
+        _algorithm->addData(data, length);
+}
+
+QByteArray ChecksumCalculator::result()
+{
+    if (_algorithm)
+        return _algorithm->result();
+    return QByteArray();
+}
+
 ComputeChecksum::ComputeChecksum(QObject *parent)
     : QObject(parent)
 {
@@ -164,6 +480,11 @@ void ComputeChecksum::setChecksumType(const QByteArray &type)
     _checksumType = type;
 }
 
+void ComputeChecksum::setBackgroundIo(bool enabled)
+{
+    _backgroundIo = enabled;
+}
+
 QByteArray ComputeChecksum::checksumType() const
 {
     return _checksumType;
@@ -173,11 +494,14 @@ void ComputeChecksum::start(const QString &filePath)
 {
     qCInfo(lcChecksums) << "Computing" << checksumType() << "checksum of" << filePath << "in a thread";
 
+    _traceStart = Tracing::isEnabled() ? Tracing::now() : -1;
+    _traceFile = _traceStart >= 0 ? filePath : QString();
+
     // Calculate the checksum in a different thread first.
     connect(&_watcher, &QFutureWatcherBase::finished,
         this, &ComputeChecksum::slotCalculationDone,
         Qt::UniqueConnection);
-    _watcher.setFuture(QtConcurrent::run(ComputeChecksum::computeNow, filePath, checksumType()));
+    _watcher.setFuture(checksumQueue()->enqueue(filePath, checksumType(), _backgroundIo));
 }
 
 QByteArray ComputeChecksum::computeNow(const QString &filePath, const QByteArray &checksumType)
@@ -197,6 +521,19 @@ QByteArray ComputeChecksum::computeNow(const QString &filePath, const QByteArray
         return FileSystem::calcAdler32(filePath);
     }
 #endif
+    else if (isChecksumTypeSupported(checksumType)) {
+        QFile file(filePath);
+        if (!file.open(QIODevice::ReadOnly))
+            return QByteArray();
+        ChecksumCalculator calculator(checksumType);
+        QByteArray buf(qMin(qint64(500 * 1024), file.size() + 1), Qt::Uninitialized);
+        qint64 size;
+        while ((size = file.read(buf.data(), buf.size())) > 0)
+            calculator.addData(buf.constData(), size);
+        if (size < 0)
+            return QByteArray();
+        return calculator.result();
+    }
     // for an unknown checksum or no checksum, we're done right now
     if (!checksumType.isEmpty()) {
         qCWarning(lcChecksums) << "Unknown checksum type:" << checksumType;
@@ -206,6 +543,8 @@ QByteArray ComputeChecksum::computeNow(const QString &filePath, const QByteArray
 
 void ComputeChecksum::slotCalculationDone()
 {
+    if (_traceStart >= 0)
+        Tracing::addAsyncSpan("checksum", QStringLiteral("wait for checksum"), _traceStart, _traceFile);
     QByteArray checksum = _watcher.future().result();
     if (!checksum.isNull()) {
         emit done(_checksumType, checksum);
@@ -234,8 +573,15 @@ void ValidateChecksumHeader::start(const QString &filePath, const QByteArray &ch
         return;
     }
 
+    auto known = _knownChecksums.constFind(_expectedChecksumType);
+    if (known != _knownChecksums.constEnd()) {
+        slotChecksumCalculated(known.key(), known.value());
+        return;
+    }
+
     auto calculator = new ComputeChecksum(this);
     calculator->setChecksumType(_expectedChecksumType);
+    calculator->setBackgroundIo(_backgroundIo);
     connect(calculator, &ComputeChecksum::done,
         this, &ValidateChecksumHeader::slotChecksumCalculated);
     calculator->start(filePath);
@@ -259,12 +605,32 @@ CSyncChecksumHook::CSyncChecksumHook()
 {
 }
 
-QByteArray CSyncChecksumHook::hook(const QByteArray &path, const QByteArray &otherChecksumHeader, void * /*this_obj*/)
+QByteArray CSyncChecksumHook::hook(const QByteArray &path, const QByteArray &otherChecksumHeader, void *this_obj)
 {
     QByteArray type = parseChecksumHeaderType(QByteArray(otherChecksumHeader));
     if (type.isEmpty())
         return NULL;
 
+    auto self = static_cast<CSyncChecksumHook *>(this_obj);
+    csync_file_stat_t stat;
+    const bool statOk = self && csync_vio_local_stat(path.constData(), &stat) == 0;
+    auto journal = statOk ? self->_journal : nullptr;
+    const qint64 modtimeNsecs = journal ? FileSystem::getModTimeNsecs(QString::fromUtf8(path)) : -1;
+    if (modtimeNsecs == -1)
+        journal = nullptr;
+    // No lookup in the cache: the rename checks hash the files whose mtime
+    // and size look unchanged, exactly what a cached entry can't tell apart.
+    // Storing the result still refreshes the entry for the upload.
+
+    if (statOk && self->_budget >= 0) {
+        // Without a checksum the file counts as changed, the upload compares it
+        if (stat.size > self->_budget) {
+            qCInfo(lcChecksums) << "Not computing the checksum of" << path << "in the csync hook, the budget of this sync is used up";
+            return NULL;
+        }
+        self->_budget -= stat.size;
+    }
+
     qCInfo(lcChecksums) << "Computing" << type << "checksum of" << path << "in the csync hook";
     QByteArray checksum = ComputeChecksum::computeNow(QString::fromUtf8(path), type);
     if (checksum.isNull()) {
@@ -272,7 +638,10 @@ QByteArray CSyncChecksumHook::hook(const QByteArray &path, const QByteArray &oth
         return NULL;
     }
 
-    return makeChecksumHeader(type, checksum);
+    const QByteArray checksumHeader = makeChecksumHeader(type, checksum);
+    if (journal)
+        journal->setCachedChecksum(stat.inode, modtimeNsecs, stat.size, checksumHeader);
+    return checksumHeader;
 }
 
 }
@@ -22,7 +22,11 @@
 
 #include <QObject>
 #include <QByteArray>
+#include <QCryptographicHash>
 #include <QFutureWatcher>
+#include <QMap>
+
+#include <memory>
 
 namespace OCC {
 
@@ -33,6 +37,7 @@ namespace OCC {
 static const char checkSumMD5C[] = "MD5";
 static const char checkSumSHA1C[] = "SHA1";
 static const char checkSumAdlerC[] = "Adler32";
+static const char checkSumXXH64C[] = "XXH64";
 
 class SyncJournalDb;
 
@@ -55,6 +60,9 @@ OCSYNC_EXPORT bool parseChecksumHeader(const QByteArray &header, QByteArray *typ
 /// Convenience for getting the type from a checksum header, null if none
 OCSYNC_EXPORT QByteArray parseChecksumHeaderType(const QByteArray &header);
 
+/// Whether ChecksumCalculator and ComputeChecksum know the type
+OCSYNC_EXPORT bool isChecksumTypeSupported(const QByteArray &checksumType);
+
 /// Checks OWNCLOUD_DISABLE_CHECKSUM_UPLOAD
 OCSYNC_EXPORT bool uploadChecksumEnabled();
 
@@ -62,6 +70,46 @@ OCSYNC_EXPORT bool uploadChecksumEnabled();
 OCSYNC_EXPORT QByteArray contentChecksumType();
 
 
+/**
+ * Computes the binary SHA1 of every \a blockSize bytes of a file and
+ * returns them one after the other, for the delta uploads.
+ *
+ * Returns an empty array if the file can't be read.
+ */
+OCSYNC_EXPORT QByteArray computeBlockChecksums(const QString &filePath, qint64 blockSize);
+
+/// The size of one checksum in the result of computeBlockChecksums()
+static const int blockChecksumSize = 20;
+
+
+/**
+ * Computes a checksum over data that is passed in piece by piece, for
+ * checksumming data while it is transferred.
+ * \ingroup libsync
+ */
+class OCSYNC_EXPORT ChecksumCalculator
+{
+public:
+    explicit ChecksumCalculator(const QByteArray &checksumType);
+    ~ChecksumCalculator();
+
+    /// Whether the type is known, addData() and result() do nothing otherwise
+    bool isValid() const;
+    QByteArray checksumType() const { return _checksumType; }
+
+    void addData(const char *data, qint64 length);
+
+    /// The checksum of all the data, in the same format as ComputeChecksum
+    QByteArray result();
+
+    /// One of the checksum types, see the list in checksums.cpp
+    class Algorithm;
+
+private:
+    QByteArray _checksumType;
+    std::unique_ptr<Algorithm> _algorithm;
+};
+
 /**
  * Computes the checksum of a file.
  * \ingroup libsync
@@ -79,6 +127,12 @@ public:
 
     QByteArray checksumType() const;
 
+    /**
+     * Whether start() reads the file with the background I/O priority,
+     * see Utility::setThreadBackgroundIo(). The default is false.
+     */
+    void setBackgroundIo(bool enabled);
+
     /**
      * Computes the checksum for the given file path.
      *
@@ -99,9 +153,14 @@ private slots:
 
 private:
     QByteArray _checksumType;
+    bool _backgroundIo = false;
 
     // watcher for the checksum calculation thread
     QFutureWatcher<QByteArray> _watcher;
+
+    // For the trace of the wait, -1 when not tracing
+    qint64 _traceStart = -1;
+    QString _traceFile;
 };
 
 /**
@@ -123,6 +182,15 @@ public:
      */
     void start(const QString &filePath, const QByteArray &checksumHeader);
 
+    /**
+     * Checksums of the file that are already known, computed while it
+     * was written. If one has the type of the header, the file isn't read.
+     */
+    void setKnownChecksums(const QMap<QByteArray, QByteArray> &checksums) { _knownChecksums = checksums; }
+
+    /// See ComputeChecksum::setBackgroundIo()
+    void setBackgroundIo(bool enabled) { _backgroundIo = enabled; }
+
 signals:
     void validated(const QByteArray &checksumType, const QByteArray &checksum);
     void validationFailed(const QString &errMsg);
@@ -133,6 +201,8 @@ private slots:
 private:
     QByteArray _expectedChecksumType;
     QByteArray _expectedChecksum;
+    QMap<QByteArray, QByteArray> _knownChecksums;
+    bool _backgroundIo = false;
 };
 
 /**
@@ -145,6 +215,12 @@ class OCSYNC_EXPORT CSyncChecksumHook : public QObject
 public:
     explicit CSyncChecksumHook();
 
+    /// Where hook() stores the checksums it computed, see SyncJournalDb::setCachedChecksum()
+    void setJournal(SyncJournalDb *journal) { _journal = journal; }
+
+    /// The bytes hook() may still hash in this sync, -1 for no limit
+    void setBudget(qint64 bytes) { _budget = bytes; }
+
     /**
      * Returns the checksum value for \a path that is comparable to \a otherChecksum.
      *
@@ -153,5 +229,9 @@ public:
      * The return value will be owned by csync.
      */
     static QByteArray hook(const QByteArray &path, const QByteArray &otherChecksumHeader, void *this_obj);
+
+private:
+    SyncJournalDb *_journal = nullptr;
+    qint64 _budget = -1;
 };
 }
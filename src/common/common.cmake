@@ -9,4 +9,7 @@ set(common_SOURCES
     ${CMAKE_CURRENT_LIST_DIR}/syncjournalfilerecord.cpp
     ${CMAKE_CURRENT_LIST_DIR}/utility.cpp
     ${CMAKE_CURRENT_LIST_DIR}/remotepermissions.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/tracing.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/instancecounter.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/sessionrecorder.cpp
 )
@@ -333,6 +333,31 @@ bool FileSystem::fileExists(const QString &filename, const QFileInfo &fileInfo)
     return re;
 }
 
+qint64 FileSystem::getModTimeNsecs(const QString &filename)
+{
+#ifdef Q_OS_WIN
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(reinterpret_cast<const wchar_t *>(longWinPath(filename).utf16()),
+            GetFileExInfoStandard, &data)) {
+        return -1;
+    }
+    // In units of 100ns since 1601-01-01
+    ULARGE_INTEGER lastWrite;
+    lastWrite.LowPart = data.ftLastWriteTime.dwLowDateTime;
+    lastWrite.HighPart = data.ftLastWriteTime.dwHighDateTime;
+    return (qint64(lastWrite.QuadPart) - Q_INT64_C(116444736000000000)) * 100;
+#else
+    struct stat sb;
+    if (stat(QFile::encodeName(filename).constData(), &sb) != 0)
+        return -1;
+#if defined(Q_OS_MAC)
+    return qint64(sb.st_mtimespec.tv_sec) * 1000000000 + sb.st_mtimespec.tv_nsec;
+#else
+    return qint64(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+#endif
+#endif
+}
+
 #ifdef Q_OS_WIN
 QString FileSystem::fileSystemForPath(const QString &path)
 {
@@ -364,10 +389,15 @@ static QByteArray readToCrypto( const QString& filename, QCryptographicHash::Alg
      QByteArray arr;
      QCryptographicHash crypto( algo );
 
+     // QCryptographicHash::addData(QIODevice *) reads 16 KiB at a time
      if (file.open(QIODevice::ReadOnly)) {
-         if (crypto.addData(&file)) {
+         const qint64 bufSize = qMin(BUFSIZE, file.size() + 1);
+         QByteArray buf(bufSize, Qt::Uninitialized);
+         qint64 size;
+         while ((size = file.read(buf.data(), bufSize)) > 0)
+             crypto.addData(buf.constData(), size);
+         if (size == 0)
              arr = crypto.result().toHex();
-         }
      }
      return arr;
  }
@@ -118,6 +118,15 @@ namespace FileSystem {
      */
     bool OCSYNC_EXPORT openAndSeekFileSharedRead(QFile *file, QString *error, qint64 seek);
 
+    /**
+     * The modification time of \a filename in nanoseconds since the epoch,
+     * or -1 if it can't be read.
+     *
+     * Finer than the seconds csync works with, so that it can tell apart the
+     * versions of a file that is written several times per second.
+     */
+    qint64 OCSYNC_EXPORT getModTimeNsecs(const QString &filename);
+
 #ifdef Q_OS_WIN
     /**
      * Returns the file system used at the given path.
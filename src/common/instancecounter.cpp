@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "common/instancecounter.h"
+
+#include <QAtomicInt>
+#include <QtGlobal>
+
+namespace OCC {
+
+namespace {
+    struct Counter
+    {
+        QAtomicInt live;
+        QAtomicInt peak;
+    };
+    Counter counters[InstanceCounts::TypeCount];
+}
+
+bool InstanceCounts::isEnabled()
+{
+    // Read once, the counts must stay balanced
+    static const bool enabled = qEnvironmentVariableIntValue("OWNCLOUD_COUNT_INSTANCES") > 0;
+    return enabled;
+}
+
+void InstanceCounts::add(Type type)
+{
+    auto &counter = counters[type];
+    const int live = counter.live.fetchAndAddRelaxed(1) + 1;
+    // A race may lose a peak of a few instances, that is fine for a count
+    if (live > counter.peak.load())
+        counter.peak.store(live);
+}
+
+void InstanceCounts::remove(Type type)
+{
+    counters[type].live.fetchAndAddRelaxed(-1);
+}
+
+int InstanceCounts::live(Type type)
+{
+    return counters[type].live.load();
+}
+
+int InstanceCounts::peak(Type type)
+{
+    return counters[type].peak.load();
+}
+
+void InstanceCounts::resetPeaks()
+{
+    for (auto &counter : counters)
+        counter.peak.store(counter.live.load());
+}
+}
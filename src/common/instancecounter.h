@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "ocsynclib.h"
+
+namespace OCC {
+
+/**
+ * @brief Live and peak instance counts of the core sync structures
+ *
+ * Counting is enabled with the OWNCLOUD_COUNT_INSTANCES environment
+ * variable, which is read once: only then the instances pay for the
+ * atomic counters. The counts end up in the SyncRunMetrics.
+ *
+ * @ingroup libsync
+ */
+namespace InstanceCounts {
+    enum Type {
+        FileStats, // csync_file_stat_t
+        SyncFileItems,
+        ProgressItems,
+        TypeCount
+    };
+
+    OCSYNC_EXPORT bool isEnabled();
+    OCSYNC_EXPORT void add(Type type);
+    OCSYNC_EXPORT void remove(Type type);
+
+    OCSYNC_EXPORT int live(Type type);
+    /** The most instances that were alive at the same time since resetPeaks() */
+    OCSYNC_EXPORT int peak(Type type);
+    OCSYNC_EXPORT void resetPeaks();
+}
+
+/**
+ * A base class that counts the instances of the derived class, it adds no size.
+ */
+template <InstanceCounts::Type type>
+class InstanceCounted
+{
+protected:
+    InstanceCounted()
+    {
+        if (InstanceCounts::isEnabled())
+            InstanceCounts::add(type);
+    }
+    InstanceCounted(const InstanceCounted &)
+    {
+        if (InstanceCounts::isEnabled())
+            InstanceCounts::add(type);
+    }
+    InstanceCounted &operator=(const InstanceCounted &) { return *this; }
+    ~InstanceCounted()
+    {
+        if (InstanceCounts::isEnabled())
+            InstanceCounts::remove(type);
+    }
+};
+}
@@ -22,9 +22,14 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
+#include <QHash>
+#include <QMutex>
+
+#include <cstring>
 
 #include "ownsql.h"
 #include "common/utility.h"
+#include "common/filesystembase.h"
 #include "common/asserts.h"
 
 #define SQLITE_SLEEP_TIME_USEC 100000
@@ -48,6 +53,54 @@ SqlDatabase::SqlDatabase()
 {
 }
 
+SqlDatabase::~SqlDatabase()
+{
+    close();
+}
+
+namespace {
+    // The read-write connections of this process to each database file
+    QMutex openMarkersMutex;
+    QHash<QString, int> openMarkers;
+}
+
+bool SqlDatabase::acquireOpenMarker(const QString &filename)
+{
+    const QString marker = filename + QLatin1String("-open");
+    QMutexLocker locker(&openMarkersMutex);
+    int &connections = openMarkers[marker];
+    if (connections++ > 0) {
+        _openMarker = marker;
+        return false;
+    }
+    const bool unclean = QFile::exists(marker);
+    QFile file(marker);
+    if (!file.open(QIODevice::WriteOnly)) {
+        // Without the marker every open is checked
+        qCWarning(lcSql) << "Could not create" << marker << file.errorString();
+        openMarkers.remove(marker);
+        return true;
+    }
+    file.close();
+    FileSystem::setFileHidden(marker, true);
+    _openMarker = marker;
+    return unclean;
+}
+
+void SqlDatabase::releaseOpenMarker(bool removeFile)
+{
+    if (_openMarker.isEmpty())
+        return;
+    QMutexLocker locker(&openMarkersMutex);
+    auto it = openMarkers.find(_openMarker);
+    if (it != openMarkers.end() && --*it <= 0) {
+        openMarkers.erase(it);
+        if (removeFile)
+            QFile::remove(_openMarker);
+    }
+    _openMarker.clear();
+}
+
 bool SqlDatabase::isOpen()
 {
     return _db != 0;
@@ -123,6 +176,11 @@ bool SqlDatabase::openOrCreateReadWrite(const QString &filename)
         return false;
     }
 
+    // A full read of the database at every start is slow on a large journal
+    if (!acquireOpenMarker(filename))
+        return true;
+    qCInfo(lcSql) << "Checking the consistency of" << filename << "after it wasn't closed";
+
     auto checkResult = checkDb();
     if (checkResult != CheckDbResult::Ok) {
         if (checkResult == CheckDbResult::CantPrepare) {
@@ -131,6 +189,7 @@ bool SqlDatabase::openOrCreateReadWrite(const QString &filename)
             qint64 freeSpace = Utility::freeDiskSpace(QFileInfo(filename).dir().absolutePath());
             if (freeSpace != -1 && freeSpace < 1000000) {
                 qCWarning(lcSql) << "Can't prepare consistency check and disk space is low:" << freeSpace;
+                releaseOpenMarker(false);
                 close();
                 return false;
             }
@@ -139,6 +198,7 @@ bool SqlDatabase::openOrCreateReadWrite(const QString &filename)
             // file is on a read-only filesystem and can't be opened because of that.
             if (_errId == SQLITE_CANTOPEN) {
                 qCWarning(lcSql) << "Can't open db to prepare consistency check, aborting";
+                releaseOpenMarker(false);
                 close();
                 return false;
             }
@@ -148,13 +208,15 @@ bool SqlDatabase::openOrCreateReadWrite(const QString &filename)
         close();
         QFile::remove(filename);
 
-        return openHelper(filename, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+        if (!openHelper(filename, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE))
+            return false;
+        acquireOpenMarker(filename);
     }
 
     return true;
 }
 
-bool SqlDatabase::openReadOnly(const QString &filename)
+bool SqlDatabase::openReadOnly(const QString &filename, bool check)
 {
     if (isOpen()) {
         return true;
@@ -164,7 +226,7 @@ bool SqlDatabase::openReadOnly(const QString &filename)
         return false;
     }
 
-    if (checkDb() != CheckDbResult::Ok) {
+    if (check && checkDb() != CheckDbResult::Ok) {
         qCWarning(lcSql) << "Consistency check failed in readonly mode, giving up" << filename;
         close();
         return false;
@@ -180,14 +242,37 @@ QString SqlDatabase::error() const
     return err;
 }
 
+// Upper limit of statements kept by a database for reuse
+static const int StatementCacheSize = 64;
+
+sqlite3_stmt *SqlDatabase::takeCachedStatement(const QString &sql)
+{
+    return _statementCache.take(sql);
+}
+
+void SqlDatabase::cacheStatement(const QString &sql, sqlite3_stmt *stmt)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    if (_statementCache.size() >= StatementCacheSize || _statementCache.contains(sql)) {
+        sqlite3_finalize(stmt);
+        return;
+    }
+    _statementCache.insert(sql, stmt);
+}
+
 void SqlDatabase::close()
 {
     if (_db) {
+        for (auto stmt : _statementCache)
+            sqlite3_finalize(stmt);
+        _statementCache.clear();
         SQLITE_DO(sqlite3_close(_db));
         if (_errId != SQLITE_OK)
             qCWarning(lcSql) << "Closing database failed" << _error;
         _db = 0;
     }
+    releaseOpenMarker();
 }
 
 bool SqlDatabase::transaction()
@@ -216,7 +301,8 @@ sqlite3 *SqlDatabase::sqliteDb()
 /* =========================================================================================== */
 
 SqlQuery::SqlQuery(SqlDatabase &db)
-    : _db(db.sqliteDb())
+    : _sqldb(&db)
+    , _db(db.sqliteDb())
     , _stmt(0)
     , _errId(0)
 {
@@ -230,7 +316,8 @@ SqlQuery::~SqlQuery()
 }
 
 SqlQuery::SqlQuery(const QString &sql, SqlDatabase &db)
-    : _db(db.sqliteDb())
+    : _sqldb(&db)
+    , _db(db.sqliteDb())
     , _stmt(0)
     , _errId(0)
 {
@@ -245,6 +332,16 @@ int SqlQuery::prepare(const QString &sql, bool allow_failure)
         finish();
     }
     if (!_sql.isEmpty()) {
+        // Statements of earlier queries with the same SQL are reused, their
+        // compilation is a good part of the cost of a short query
+        if (_db && _sqldb->sqliteDb() == _db) {
+            _stmt = _sqldb->takeCachedStatement(_sql);
+            if (_stmt) {
+                _errId = SQLITE_OK;
+                return _errId;
+            }
+        }
+
         int n = 0;
         int rc;
         do {
@@ -283,6 +380,7 @@ bool SqlQuery::exec()
         qCWarning(lcSql) << "Can't exec query, statement unprepared.";
         return false;
     }
+    _sqldb->_execCount.ref();
 
     // Don't do anything for selects, that is how we use the lib :-|
     if (!isSelect() && !isPragma()) {
@@ -390,6 +488,35 @@ void SqlQuery::bindValue(int pos, const QVariant &value)
     ASSERT(res == SQLITE_OK);
 }
 
+void SqlQuery::bindInt64(int pos, qint64 value)
+{
+    qCDebug(lcSql) << "SQL bind" << pos << value;
+    if (!_stmt) {
+        ASSERT(false);
+        return;
+    }
+    int res = sqlite3_bind_int64(_stmt, pos, value);
+    if (res != SQLITE_OK) {
+        qCWarning(lcSql) << "ERROR binding SQL value:" << value << "error:" << res;
+    }
+    ASSERT(res == SQLITE_OK);
+}
+
+void SqlQuery::bindByteArray(int pos, const QByteArray &value)
+{
+    qCDebug(lcSql) << "SQL bind" << pos << value;
+    if (!_stmt) {
+        ASSERT(false);
+        return;
+    }
+    // Bound as text, like bindValue does
+    int res = sqlite3_bind_text(_stmt, pos, value.constData(), value.size(), SQLITE_TRANSIENT);
+    if (res != SQLITE_OK) {
+        qCWarning(lcSql) << "ERROR binding SQL value:" << value << "error:" << res;
+    }
+    ASSERT(res == SQLITE_OK);
+}
+
 bool SqlQuery::nullValue(int index)
 {
     return sqlite3_column_type(_stmt, index) == SQLITE_NULL;
@@ -416,6 +543,30 @@ QByteArray SqlQuery::baValue(int index)
         sqlite3_column_bytes(_stmt, index));
 }
 
+const char *SqlQuery::textValue(int index)
+{
+    return reinterpret_cast<const char *>(sqlite3_column_text(_stmt, index));
+}
+
+int SqlQuery::bytesValue(int index)
+{
+    return sqlite3_column_bytes(_stmt, index);
+}
+
+QByteArray SqlQuery::baView(int index)
+{
+    // Call _text first, _bytes is only valid after the conversion to text
+    const char *data = textValue(index);
+    return QByteArray::fromRawData(data, sqlite3_column_bytes(_stmt, index));
+}
+
+bool SqlQuery::valueEquals(int index, const QByteArray &value)
+{
+    const char *data = textValue(index);
+    const int size = sqlite3_column_bytes(_stmt, index);
+    return size == value.size() && (size == 0 || memcmp(data, value.constData(), size) == 0);
+}
+
 QString SqlQuery::error() const
 {
     return _error;
@@ -438,7 +589,14 @@ int SqlQuery::numRowsAffected()
 
 void SqlQuery::finish()
 {
-    SQLITE_DO(sqlite3_finalize(_stmt));
+    // Statements of a database that was closed and reopened since can't
+    // go into its cache
+    if (_stmt && _sqldb->sqliteDb() == _db) {
+        _sqldb->cacheStatement(_sql, _stmt);
+        _errId = SQLITE_OK;
+    } else {
+        SQLITE_DO(sqlite3_finalize(_stmt));
+    }
     _stmt = 0;
 }
 
@@ -21,6 +21,8 @@
 
 #include <sqlite3.h>
 
+#include <QAtomicInt>
+#include <QHash>
 #include <QObject>
 #include <QVariant>
 
@@ -37,17 +39,31 @@ class OCSYNC_EXPORT SqlDatabase
     Q_DISABLE_COPY(SqlDatabase)
 public:
     explicit SqlDatabase();
+    ~SqlDatabase();
 
     bool isOpen();
+    /**
+     * Opens or creates the database, replacing it if it's broken.
+     *
+     * The consistency check only runs if a read-write connection of the file
+     * wasn't closed, after a crash or a power loss. The file ending in -open
+     * next to the database exists while it is open.
+     */
     bool openOrCreateReadWrite(const QString &filename);
-    bool openReadOnly(const QString &filename);
+    /** Opens an existing database read-only, @a check runs a consistency check first */
+    bool openReadOnly(const QString &filename, bool check = true);
     bool transaction();
     bool commit();
     void close();
     QString error() const;
     sqlite3 *sqliteDb();
 
+    /** Number of statements executed on this database so far */
+    int execCount() const { return _execCount.load(); }
+
 private:
+    friend class SqlQuery;
+
     enum class CheckDbResult {
         Ok,
         CantPrepare,
@@ -57,10 +73,22 @@ private:
 
     bool openHelper(const QString &filename, int sqliteFlags);
     CheckDbResult checkDb();
+    // Whether the database wasn't closed the last time, then creates the marker
+    bool acquireOpenMarker(const QString &filename);
+    // Removes the marker with the last connection, unless the check failed
+    void releaseOpenMarker(bool removeFile = true);
+
+    // Returns a compiled statement for sql that no query is using, or NULL
+    sqlite3_stmt *takeCachedStatement(const QString &sql);
+    // Keeps the statement of a finished query for the next prepare
+    void cacheStatement(const QString &sql, sqlite3_stmt *stmt);
 
     sqlite3 *_db;
     QString _error; // last error string
     int _errId;
+    QAtomicInt _execCount;
+    QHash<QString, sqlite3_stmt *> _statementCache;
+    QString _openMarker;
 };
 
 /**
@@ -86,6 +114,19 @@ public:
     int intValue(int index);
     quint64 int64Value(int index);
     QByteArray baValue(int index);
+    /**
+     * The value as NUL terminated text without copying it, or NULL for a
+     * NULL value. Only valid until the next call to next() or reset.
+     */
+    const char *textValue(int index);
+    int bytesValue(int index);
+    /**
+     * Like baValue, but the QByteArray only points to the column data, with
+     * the same lifetime as textValue(). Copy it to keep it around.
+     */
+    QByteArray baView(int index);
+    /// Compares the value with @a value without copying it
+    bool valueEquals(int index, const QByteArray &value);
 
     bool isSelect();
     bool isPragma();
@@ -93,12 +134,16 @@ public:
     int prepare(const QString &sql, bool allow_failure = false);
     bool next();
     void bindValue(int pos, const QVariant &value);
+    /// Like bindValue, without going through QVariant
+    void bindInt64(int pos, qint64 value);
+    void bindByteArray(int pos, const QByteArray &value);
     QString lastQuery() const;
     int numRowsAffected();
     void reset_and_clear_bindings();
     void finish();
 
 private:
+    SqlDatabase *_sqldb;
     sqlite3 *_db;
     sqlite3_stmt *_stmt;
     QString _error;
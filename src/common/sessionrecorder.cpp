@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "common/sessionrecorder.h"
+
+#include <QAtomicInt>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QStringList>
+#include <QVector>
+
+#include <random>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcSessionRecorder, "sync.sessionrecorder", QtInfoMsg)
+
+// Longer extensions are part of the name
+static const int MaxExtensionLength = 5;
+
+namespace {
+    struct Entry
+    {
+        QString path;
+        QByteArray permissions;
+        qint64 size;
+        qint64 modtime;
+        bool isDirectory;
+    };
+
+    struct Request
+    {
+        QByteArray verb;
+        QString path;
+        int status;
+        qint64 start;
+        qint64 duration;
+        qint64 sent;
+        qint64 received;
+    };
+
+    struct Item
+    {
+        QString path;
+        QString renameTarget;
+        const char *instruction;
+        const char *direction;
+        qint64 size;
+        bool isDirectory;
+    };
+
+    struct Directory
+    {
+        QString path;
+        bool remote;
+    };
+
+    struct Recorder
+    {
+        Recorder()
+        {
+            std::random_device random;
+            for (int i = 0; i < 4; ++i) {
+                const quint32 value = random();
+                salt.append(reinterpret_cast<const char *>(&value), sizeof(value));
+            }
+            timer.start();
+            fileName = QString::fromLocal8Bit(qgetenv("OWNCLOUD_RECORD_SESSION"));
+            enabled.store(fileName.isEmpty() ? 0 : 1);
+        }
+
+        // Called with the mutex locked
+        QString anonymizedName(const QString &name)
+        {
+            auto it = names.constFind(name);
+            if (it != names.constEnd())
+                return *it;
+
+            QString prefix;
+            if (name.startsWith(QLatin1Char('.')))
+                prefix = QStringLiteral(".");
+            QString extension;
+            const int dot = name.lastIndexOf(QLatin1Char('.'));
+            if (dot > 0 && name.size() - dot - 1 <= MaxExtensionLength)
+                extension = name.mid(dot);
+            const QByteArray hash = QCryptographicHash::hash(salt + name.toUtf8(), QCryptographicHash::Sha1);
+            const QString anonymized = prefix + QString::fromLatin1(hash.left(6).toHex()) + extension;
+            names.insert(name, anonymized);
+            return anonymized;
+        }
+
+        QString anonymizedPath(const QString &path)
+        {
+            QStringList components = path.split(QLatin1Char('/'), QString::SkipEmptyParts);
+            for (auto &component : components)
+                component = anonymizedName(component);
+            return components.join(QLatin1Char('/'));
+        }
+
+        // The WebDAV prefix tells the kind of request, the user and the files don't
+        QString anonymizedUrlPath(const QString &urlPath)
+        {
+            const QStringList components = urlPath.split(QLatin1Char('/'), QString::SkipEmptyParts);
+            int kept = components.indexOf(QLatin1String("remote.php"));
+            if (kept < 0)
+                kept = components.indexOf(QLatin1String("ocs"));
+            if (kept < 0)
+                kept = components.indexOf(QLatin1String("status.php"));
+            if (kept < 0)
+                return anonymizedPath(urlPath);
+
+            QStringList result;
+            int i = kept;
+            for (; i < components.size(); ++i) {
+                const QString &component = components[i];
+                const bool known = i == kept
+                    || component == QLatin1String("webdav") || component == QLatin1String("dav")
+                    || component == QLatin1String("files") || component == QLatin1String("uploads")
+                    || (components[kept] == QLatin1String("ocs") && i < kept + 4);
+                if (!known)
+                    break;
+                result.append(component);
+            }
+            for (; i < components.size(); ++i)
+                result.append(anonymizedName(components[i]));
+            return result.join(QLatin1Char('/'));
+        }
+
+        QAtomicInt enabled;
+        QElapsedTimer timer;
+        QMutex mutex;
+        QString fileName;
+        QByteArray salt;
+        QHash<QString, QString> names;
+        QHash<const void *, Directory> directories;
+        QVector<Entry> local;
+        QVector<Entry> remote;
+        QVector<Request> requests;
+        QVector<Item> items;
+    };
+
+    Q_GLOBAL_STATIC(Recorder, recorder)
+
+    QString typeName(bool isDirectory)
+    {
+        return isDirectory ? QStringLiteral("dir") : QStringLiteral("file");
+    }
+
+    QByteArray toJson(const QJsonObject &obj)
+    {
+        return QJsonDocument(obj).toJson(QJsonDocument::Compact);
+    }
+
+    QByteArray toJson(const Entry &entry, bool remote)
+    {
+        QJsonArray values{ entry.path, typeName(entry.isDirectory), double(entry.size), double(entry.modtime) };
+        if (remote)
+            values.append(QString::fromLatin1(entry.permissions));
+        return QJsonDocument(values).toJson(QJsonDocument::Compact);
+    }
+
+    QByteArray toJson(const Request &request)
+    {
+        QJsonObject obj;
+        obj.insert(QStringLiteral("verb"), QString::fromLatin1(request.verb));
+        obj.insert(QStringLiteral("path"), request.path);
+        obj.insert(QStringLiteral("status"), request.status);
+        obj.insert(QStringLiteral("start"), double(request.start));
+        obj.insert(QStringLiteral("duration"), double(request.duration));
+        obj.insert(QStringLiteral("sent"), double(request.sent));
+        obj.insert(QStringLiteral("received"), double(request.received));
+        return toJson(obj);
+    }
+
+    QByteArray toJson(const Item &item)
+    {
+        QJsonObject obj;
+        obj.insert(QStringLiteral("path"), item.path);
+        if (!item.renameTarget.isEmpty())
+            obj.insert(QStringLiteral("renameTarget"), item.renameTarget);
+        obj.insert(QStringLiteral("type"), typeName(item.isDirectory));
+        obj.insert(QStringLiteral("instruction"), QLatin1String(item.instruction));
+        obj.insert(QStringLiteral("direction"), QLatin1String(item.direction));
+        obj.insert(QStringLiteral("size"), double(item.size));
+        return toJson(obj);
+    }
+
+    // One element per line, a large tree stays far from the limits of QJsonDocument
+    template <typename T, typename... Args>
+    void writeArray(QFile &file, const char *name, const QVector<T> &values, Args... args)
+    {
+        file.write(",\n\"");
+        file.write(name);
+        file.write("\":[");
+        bool first = true;
+        foreach (const T &value, values) {
+            file.write(first ? "\n" : ",\n");
+            first = false;
+            file.write(toJson(value, args...));
+        }
+        file.write("\n]");
+    }
+}
+
+bool SessionRecorder::isEnabled()
+{
+    return recorder()->enabled.load();
+}
+
+void SessionRecorder::setOutputFile(const QString &fileName)
+{
+    auto r = recorder();
+    QMutexLocker lock(&r->mutex);
+    r->fileName = fileName;
+    r->enabled.store(fileName.isEmpty() ? 0 : 1);
+}
+
+QString SessionRecorder::anonymizedPath(const QString &path)
+{
+    auto r = recorder();
+    QMutexLocker lock(&r->mutex);
+    return r->anonymizedPath(path);
+}
+
+void SessionRecorder::beginSync()
+{
+    auto r = recorder();
+    QMutexLocker lock(&r->mutex);
+    r->timer.restart();
+    r->directories.clear();
+    r->local.clear();
+    r->remote.clear();
+    r->requests.clear();
+    r->items.clear();
+}
+
+void SessionRecorder::beginDirectory(const void *handle, bool remote, const QByteArray &path)
+{
+    auto r = recorder();
+    QMutexLocker lock(&r->mutex);
+    r->directories.insert(handle, Directory{ r->anonymizedPath(QString::fromUtf8(path)), remote });
+}
+
+void SessionRecorder::addEntry(const void *handle, const QByteArray &name, bool isDirectory,
+    qint64 size, qint64 modtime, const QByteArray &permissions)
+{
+    if (name == "." || name == "..")
+        return;
+    auto r = recorder();
+    QMutexLocker lock(&r->mutex);
+    auto it = r->directories.constFind(handle);
+    if (it == r->directories.constEnd())
+        return;
+    const QString anonymized = r->anonymizedName(QString::fromUtf8(name));
+    Entry entry{ it->path.isEmpty() ? anonymized : it->path + QLatin1Char('/') + anonymized,
+        permissions, isDirectory ? 0 : size, modtime, isDirectory };
+    (it->remote ? r->remote : r->local).append(entry);
+}
+
+void SessionRecorder::endDirectory(const void *handle)
+{
+    auto r = recorder();
+    QMutexLocker lock(&r->mutex);
+    r->directories.remove(handle);
+}
+
+qint64 SessionRecorder::now()
+{
+    return recorder()->timer.elapsed();
+}
+
+void SessionRecorder::addRequest(const QByteArray &verb, const QString &urlPath, int httpStatus,
+    qint64 start, qint64 bytesSent, qint64 bytesReceived)
+{
+    auto r = recorder();
+    QMutexLocker lock(&r->mutex);
+    r->requests.append(Request{ verb, r->anonymizedUrlPath(urlPath), httpStatus, start,
+        r->timer.elapsed() - start, bytesSent, bytesReceived });
+}
+
+void SessionRecorder::addItem(const QString &path, const QString &renameTarget, bool isDirectory,
+    const char *instruction, const char *direction, qint64 size)
+{
+    auto r = recorder();
+    QMutexLocker lock(&r->mutex);
+    const bool renamed = !renameTarget.isEmpty() && renameTarget != path;
+    r->items.append(Item{ r->anonymizedPath(path), renamed ? r->anonymizedPath(renameTarget) : QString(),
+        instruction, direction, size, isDirectory });
+}
+
+bool SessionRecorder::writeFile(const QJsonObject &metrics)
+{
+    auto r = recorder();
+    QMutexLocker lock(&r->mutex);
+    if (r->fileName.isEmpty())
+        return false;
+
+    QFile file(r->fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCWarning(lcSessionRecorder) << "Could not write the session to" << r->fileName << file.errorString();
+        return false;
+    }
+    file.write("{\"version\":1,\n\"metrics\":");
+    file.write(toJson(metrics));
+    writeArray(file, "requests", r->requests);
+    writeArray(file, "items", r->items);
+    writeArray(file, "local", r->local, false);
+    writeArray(file, "remote", r->remote, true);
+    file.write("\n}\n");
+    qCInfo(lcSessionRecorder) << "Recorded the session to" << r->fileName;
+    return file.error() == QFile::NoError;
+}
+}
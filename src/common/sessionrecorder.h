@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "ocsynclib.h"
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+
+namespace OCC {
+
+/**
+ * @brief Records an anonymized sync session, for replaying it with ReplayBench
+ *
+ * Recording is enabled with the OWNCLOUD_RECORD_SESSION environment variable
+ * or setOutputFile(). A recording holds the shape of the local and the remote
+ * trees as the discovery listed them, the requests sent with their timings,
+ * and the items the sync propagated. Every path component is replaced by a
+ * hash with a salt of the process, only a leading dot and a short extension
+ * are kept; host names and queries are not recorded.
+ *
+ * beginSync() starts a new recording, writeFile() writes it: the file holds
+ * the last sync of the process.
+ *
+ * @ingroup libsync
+ */
+namespace SessionRecorder {
+    /** Whether the session is recorded */
+    OCSYNC_EXPORT bool isEnabled();
+
+    /** Records the syncs from now on and writes them to @a fileName, empty to stop */
+    OCSYNC_EXPORT void setOutputFile(const QString &fileName);
+
+    /** The anonymized form of a relative path, the same for the whole process */
+    OCSYNC_EXPORT QString anonymizedPath(const QString &path);
+
+    /** Forgets what was recorded for the previous sync */
+    OCSYNC_EXPORT void beginSync();
+
+    /** The entries read from @a handle belong to the directory @a path of a tree */
+    OCSYNC_EXPORT void beginDirectory(const void *handle, bool remote, const QByteArray &path);
+    OCSYNC_EXPORT void addEntry(const void *handle, const QByteArray &name, bool isDirectory,
+        qint64 size, qint64 modtime, const QByteArray &permissions = QByteArray());
+    OCSYNC_EXPORT void endDirectory(const void *handle);
+
+    /** A request to the server, the times are in milliseconds since beginSync() */
+    OCSYNC_EXPORT qint64 now();
+    OCSYNC_EXPORT void addRequest(const QByteArray &verb, const QString &urlPath, int httpStatus,
+        qint64 start, qint64 bytesSent, qint64 bytesReceived);
+
+    /** An item of the propagation, @a instruction and @a direction as words */
+    OCSYNC_EXPORT void addItem(const QString &path, const QString &renameTarget, bool isDirectory,
+        const char *instruction, const char *direction, qint64 size);
+
+    /** Writes the recording with the @a metrics of the sync to the output file */
+    OCSYNC_EXPORT bool writeFile(const QJsonObject &metrics);
+}
+}
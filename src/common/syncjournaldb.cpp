@@ -18,17 +18,26 @@
 
 #include <QCryptographicHash>
 #include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
 #include <QLoggingCategory>
 #include <QStringList>
 #include <QElapsedTimer>
 #include <QUrl>
 #include <QDir>
+#include <QThread>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <cstring>
 
 #include "common/syncjournaldb.h"
 #include "version.h"
 #include "filesystembase.h"
 #include "common/asserts.h"
 #include "common/checksums.h"
+#include "common/tracing.h"
 
 #include "common/c_jhash.h"
 
@@ -36,24 +45,50 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcDb, "sync.database", QtInfoMsg)
 
+// Number of entries in each of the lookup caches
+static const int LookupCacheSize = 10000;
+// Lookups by inode or file id before their index is built, a few renames don't need it
+static const int InodeIndexThreshold = 64;
+
+// Upper limit for the read-only connections of getFileRecordReadOnly()
+static const int MaxReadConnections = 4;
+
+// The part of the physical memory the page cache of a journal may take,
+// and the limit when that isn't known
+static const int AutoTuneMemoryShare = 32;
+static const qint64 AutoTuneUnknownMemoryShare = 64 * 1024 * 1024;
+
+// commitIfNeededAndStartNewTransaction() commits and checkpoints beyond
+// that, twice the size at which sqlite checkpoints on its own
+static const qint64 CommitMaxWalSize = 8 * 1000 * 1000;
+
 #define GET_FILE_RECORD_QUERY \
         "SELECT path, inode, modtime, type, md5, fileid, remotePerm, filesize," \
-        "  ignoredChildrenRemote, contentchecksumtype.name || ':' || contentChecksum" \
+        "  ignoredChildrenRemote, contentchecksumtype.name || ':' || contentChecksum, phash" \
         " FROM metadata" \
         "  LEFT JOIN checksumtype as contentchecksumtype ON metadata.contentChecksumTypeId == contentchecksumtype.id"
 
+// phash() in SQL, for the queries that rewrite the paths of records
+static void sqlitePHash(sqlite3_context *context, int, sqlite3_value **argv)
+{
+    const auto text = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+    const int size = sqlite3_value_bytes(argv[0]);
+    sqlite3_result_int64(context, SyncJournalDb::getPHash(QByteArray::fromRawData(text, size)));
+}
+
 static void fillFileRecordFromGetQuery(SyncJournalFileRecord &rec, SqlQuery &query)
 {
-    rec._path = query.baValue(0);
-    rec._inode = query.intValue(1);
-    rec._modtime = query.int64Value(2);
-    rec._type = query.intValue(3);
-    rec._etag = query.baValue(4);
-    rec._fileId = query.baValue(5);
-    rec._remotePerm = RemotePermissions(query.baValue(6).constData());
-    rec._fileSize = query.int64Value(7);
-    rec._serverHasIgnoredFiles = (query.intValue(8) > 0);
-    rec._checksumHeader = query.baValue(9);
+    rec._path = query.baValue(SyncJournalDb::PathColumn);
+    rec._inode = query.intValue(SyncJournalDb::InodeColumn);
+    rec._modtime = query.int64Value(SyncJournalDb::ModtimeColumn);
+    rec._type = query.intValue(SyncJournalDb::TypeColumn);
+    rec._etag = query.baValue(SyncJournalDb::EtagColumn);
+    rec._fileId = query.baValue(SyncJournalDb::FileIdColumn);
+    const char *remotePerm = query.textValue(SyncJournalDb::RemotePermColumn);
+    rec._remotePerm = RemotePermissions(remotePerm ? remotePerm : "");
+    rec._fileSize = query.int64Value(SyncJournalDb::FileSizeColumn);
+    rec._serverHasIgnoredFiles = (query.intValue(SyncJournalDb::IgnoredChildrenRemoteColumn) > 0);
+    rec._checksumHeader = query.baValue(SyncJournalDb::ChecksumHeaderColumn);
 }
 
 static QString defaultJournalMode(const QString &dbPath)
@@ -79,6 +114,12 @@ SyncJournalDb::SyncJournalDb(const QString &dbFilePath, QObject *parent)
     , _mutex(QMutex::Recursive)
     , _transaction(0)
     , _metadataTableIsEmpty(false)
+    , _fileRecordFlushScheduled(false)
+    , _fileRecordCache(LookupCacheSize)
+    , _readConnectionCount(0)
+    , _readConnectionGeneration(0)
+    , _readConnectionsEnabled(false)
+    , _cacheSizeKib(0)
 {
     // Allow forcing the journal mode for debugging
     static QString envJournalMode = QString::fromLocal8Bit(qgetenv("OWNCLOUD_SQLITE_JOURNAL_MODE"));
@@ -86,6 +127,38 @@ SyncJournalDb::SyncJournalDb(const QString &dbFilePath, QObject *parent)
     if (_journalMode.isEmpty()) {
         _journalMode = defaultJournalMode(_dbFile);
     }
+
+    // Number of file records that are queued before they get written,
+    // 0 writes every record right away.
+    static int batchSize = [] {
+        bool ok = false;
+        int env = qgetenv("OWNCLOUD_JOURNAL_WRITE_BATCH").toInt(&ok);
+        return ok ? env : 100;
+    }();
+    _fileRecordBatchSize = batchSize;
+
+    // When commitIfNeededAndStartNewTransaction() commits, in msec and rows
+    static int commitInterval = [] {
+        bool ok = false;
+        int env = qgetenv("OWNCLOUD_JOURNAL_COMMIT_INTERVAL").toInt(&ok);
+        return ok ? env : 2000;
+    }();
+    _commitInterval = commitInterval;
+    static int commitRows = [] {
+        bool ok = false;
+        int env = qgetenv("OWNCLOUD_JOURNAL_COMMIT_ROWS").toInt(&ok);
+        return ok ? env : 1000;
+    }();
+    _commitRows = commitRows;
+
+    // A single writer keeps the batches in order
+    _writerPool.setMaxThreadCount(1);
+    _fileRecordFlushTimer.setSingleShot(true);
+    _fileRecordFlushTimer.setInterval(1000);
+    connect(&_fileRecordFlushTimer, &QTimer::timeout, this, [this] {
+        QMutexLocker locker(&_mutex);
+        scheduleFileRecordFlush();
+    });
 }
 
 QString SyncJournalDb::makeDbName(const QString &localPath,
@@ -180,6 +253,8 @@ bool SyncJournalDb::maybeMigrateDb(const QString &localPath, const QString &abso
             return false;
         }
     }
+    // The snapshot of the replaced db is outdated
+    QFile::remove(newDbName + QLatin1String(".snapshot"));
 
     if (!FileSystem::rename(oldDbName, newDbName, &error)) {
         qCWarning(lcDb) << "Database migration: could not rename " << oldDbName
@@ -201,6 +276,123 @@ bool SyncJournalDb::maybeMigrateDb(const QString &localPath, const QString &abso
     return true;
 }
 
+// Free space below which maintain() doesn't bother, in bytes and as a
+// fraction of the database size
+static const qint64 MaintenanceMinFreeSize = 10 * 1000 * 1000;
+static const int MaintenanceMinFreePercent = 20;
+// WAL size above which maintain() truncates it
+static const qint64 MaintenanceMaxWalSize = 10 * 1000 * 1000;
+
+static void setCacheSizePragma(SqlDatabase &db, int kibibytes)
+{
+    SqlQuery query(db);
+    query.prepare(QString("PRAGMA cache_size = -%1;").arg(kibibytes));
+    // exec() doesn't step pragmas
+    if (!query.exec() || (!query.next() && query.errorId() != SQLITE_DONE))
+        qCWarning(lcDb) << "Setting the cache size failed:" << query.error();
+}
+
+static void setMmapSizePragma(SqlDatabase &db, qint64 bytes)
+{
+    SqlQuery query(db);
+    query.prepare(QString("PRAGMA mmap_size = %1;").arg(bytes));
+    if (!query.exec() || (!query.next() && query.errorId() != SQLITE_DONE))
+        qCWarning(lcDb) << "Setting the mmap size failed:" << query.error();
+}
+
+static qint64 pragmaIntValue(SqlDatabase &db, const char *pragma)
+{
+    SqlQuery query(db);
+    query.prepare(QString("PRAGMA %1;").arg(QLatin1String(pragma)));
+    if (!query.exec() || !query.next())
+        return -1;
+    return query.int64Value(0);
+}
+
+SyncJournalDb::FileStatistics SyncJournalDb::fileStatistics()
+{
+    QMutexLocker locker(&_mutex);
+    FileStatistics stats;
+    if (!checkConnect())
+        return stats;
+    stats._pageSize = pragmaIntValue(_db, "page_size");
+    stats._pageCount = pragmaIntValue(_db, "page_count");
+    stats._freelistCount = pragmaIntValue(_db, "freelist_count");
+    stats._walSize = QFileInfo(_dbFile + QLatin1String("-wal")).size();
+    return stats;
+}
+
+qint64 SyncJournalDb::pragmaValue(const char *pragma)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect())
+        return -1;
+    return pragmaIntValue(_db, pragma);
+}
+
+qint64 SyncJournalDb::maintain()
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect())
+        return -1;
+    flushFileRecordsLocked(false);
+    commitTransaction();
+
+    const auto before = fileStatistics();
+    const bool fragmented = before.freeSize() >= MaintenanceMinFreeSize
+        && before.freeSize() * 100 >= before.databaseSize() * MaintenanceMinFreePercent;
+    if (!fragmented && before._walSize < MaintenanceMaxWalSize)
+        return 0;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // VACUUM fails while statements are still stepping, like a lookup
+    // that returned a row and wasn't reset since
+    for (auto stmt = sqlite3_next_stmt(_db.sqliteDb(), nullptr); stmt; stmt = sqlite3_next_stmt(_db.sqliteDb(), stmt)) {
+        if (sqlite3_stmt_busy(stmt))
+            sqlite3_reset(stmt);
+    }
+
+    SqlQuery query(_db);
+    if (fragmented) {
+        // 2 is INCREMENTAL, switching to it only takes effect with a VACUUM
+        if (pragmaIntValue(_db, "auto_vacuum") != 2) {
+            qCInfo(lcDb) << "Switching" << _dbFile << "to incremental auto vacuum";
+            query.prepare("PRAGMA auto_vacuum = INCREMENTAL;");
+            query.exec();
+            query.next();
+            query.prepare("VACUUM;", true);
+            if (!query.exec()) {
+                sqlFail("VACUUM", query);
+                return -1;
+            }
+        } else {
+            // Returns a row for every page that was freed
+            query.prepare("PRAGMA incremental_vacuum;", true);
+            query.exec();
+            while (query.next()) {
+            }
+            if (query.errorId() != SQLITE_DONE) {
+                sqlFail("PRAGMA incremental_vacuum", query);
+                return -1;
+            }
+        }
+    }
+    query.prepare("PRAGMA wal_checkpoint(TRUNCATE);", true);
+    query.exec();
+    query.next();
+    query.finish();
+
+    const auto after = fileStatistics();
+    const qint64 reclaimed = (before.databaseSize() + before._walSize) - (after.databaseSize() + after._walSize);
+    qCInfo(lcDb) << "Maintenance of" << _dbFile << "took" << timer.elapsed() << "msec,"
+                 << "free pages" << before._freelistCount << "->" << after._freelistCount
+                 << ", WAL size" << before._walSize << "->" << after._walSize
+                 << ", reclaimed" << reclaimed << "bytes";
+    return qMax<qint64>(0, reclaimed);
+}
+
 bool SyncJournalDb::exists()
 {
     QMutexLocker locker(&_mutex);
@@ -215,15 +407,31 @@ QString SyncJournalDb::databaseFilePath() const
 // Note that this does not change the size of the -wal file, but it is supposed to make
 // the normal .db faster since the changes from the wal will be incorporated into it.
 // Then the next sync (and the SocketAPI) will have a faster access.
+//
+// It runs on the writer thread, and PASSIVE doesn't wait for the readers:
+// whatever can't be copied yet is left for the next checkpoint.
 void SyncJournalDb::walCheckpoint()
 {
-    QElapsedTimer t;
-    t.start();
-    SqlQuery pragma1(_db);
-    pragma1.prepare("PRAGMA wal_checkpoint(FULL);");
-    if (pragma1.exec()) {
-        qCDebug(lcDb) << "took" << t.elapsed() << "msec";
-    }
+    if (_walCheckpointScheduled)
+        return;
+    _walCheckpointScheduled = true;
+    QtConcurrent::run(&_writerPool, [this] {
+        QMutexLocker locker(&_mutex);
+        _walCheckpointScheduled = false;
+        if (!_db.isOpen() || _journalMode != QLatin1String("WAL"))
+            return;
+        // No checkpoint from within a transaction, a new one only starts
+        // with the next statement
+        if (_transaction == 1)
+            commitInternal(QStringLiteral("wal checkpoint"), true);
+        QElapsedTimer t;
+        t.start();
+        SqlQuery pragma1(_db);
+        pragma1.prepare("PRAGMA wal_checkpoint(PASSIVE);");
+        if (pragma1.exec() && pragma1.next()) {
+            qCDebug(lcDb) << "took" << t.elapsed() << "msec, copied" << pragma1.intValue(2) << "of" << pragma1.intValue(1) << "pages";
+        }
+    });
 }
 
 void SyncJournalDb::startTransaction()
@@ -242,11 +450,16 @@ void SyncJournalDb::startTransaction()
 void SyncJournalDb::commitTransaction()
 {
     if (_transaction == 1) {
+        // Together with the writes that outdated the snapshot
+        if (_localFileSnapshotOutdated)
+            bumpLocalFileSnapshotGeneration();
         if (!_db.commit()) {
             qCWarning(lcDb) << "ERROR committing to the database: " << _db.error();
             return;
         }
         _transaction = 0;
+        _lastCommit.start();
+        _changesAtLastCommit = sqlite3_total_changes(_db.sqliteDb());
     } else {
         qCDebug(lcDb) << "No database Transaction to commit";
     }
@@ -315,10 +528,36 @@ bool SyncJournalDb::checkConnect()
     if (!pragma1.exec()) {
         return sqlFail("Set PRAGMA synchronous", pragma1);
     }
+    // Only has an effect on new databases, maintain() converts existing ones
+    pragma1.prepare("PRAGMA auto_vacuum = INCREMENTAL;");
+    if (!pragma1.exec()) {
+        return sqlFail("Set PRAGMA auto_vacuum", pragma1);
+    }
+    pragma1.next();
     pragma1.prepare("PRAGMA case_sensitive_like = ON;");
     if (!pragma1.exec()) {
         return sqlFail("Set PRAGMA case_sensitivity", pragma1);
     }
+    if (sqlite3_create_function(_db.sqliteDb(), "phash", 1, SQLITE_UTF8, nullptr, &sqlitePHash, nullptr, nullptr) != SQLITE_OK) {
+        qCWarning(lcDb) << "Could not create the phash function" << sqlite3_errmsg(_db.sqliteDb());
+        close();
+        return false;
+    }
+    // Called for each row written by this connection, before the commit
+    sqlite3_update_hook(_db.sqliteDb(), [](void *journal, int, const char *, const char *table, sqlite3_int64) {
+        if (strcmp(table, "metadata") == 0)
+            static_cast<SyncJournalDb *>(journal)->invalidateLocalFileSnapshot();
+    }, this);
+    _localFileSnapshotValid = true;
+    {
+        QMutexLocker locker(&_readConnectionsMutex);
+        autoTune();
+        const int cacheSize = _cacheSizeKib > 0 ? _cacheSizeKib : _autoCacheSizeKib;
+        if (cacheSize > 0)
+            setCacheSizePragma(_db, cacheSize);
+        if (_mmapSize > 0)
+            setMmapSizePragma(_db, _mmapSize);
+    }
 
     /* Because insert is so slow, we do everything in a transaction, and only need one call to commit */
     startTransaction();
@@ -445,6 +684,66 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Create table datafingerprint", createQuery);
     }
 
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS snapshotgeneration("
+                        "generation INTEGER(8)"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table snapshotgeneration", createQuery);
+    }
+
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS localdirinfo("
+                        "phash INTEGER(8) PRIMARY KEY,"
+                        "modtime INTEGER(8),"
+                        "inode INTEGER"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table localdirinfo", createQuery);
+    }
+
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS watchercursor("
+                        "cursor BLOB"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table watchercursor", createQuery);
+    }
+
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS syncmetrics("
+                        "finished INTEGER(8),"
+                        "metrics BLOB"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table syncmetrics", createQuery);
+    }
+
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS discoverylisting("
+                        "phash INTEGER(8) PRIMARY KEY,"
+                        "etag VARCHAR(32),"
+                        "listing BLOB"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table discoverylisting", createQuery);
+    }
+
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS blockchecksums("
+                        "phash INTEGER(8) PRIMARY KEY,"
+                        "etag VARCHAR(32),"
+                        "blocksize INTEGER(8),"
+                        "checksums BLOB"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table blockchecksums", createQuery);
+    }
+
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS checksumcache("
+                        "inode INTEGER(8) PRIMARY KEY,"
+                        "modtime INTEGER(8),"
+                        "filesize INTEGER(8),"
+                        "checksum VARCHAR(128)"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table checksumcache", createQuery);
+    }
+
     createQuery.prepare("CREATE TABLE IF NOT EXISTS version("
                         "major INTEGER(8),"
                         "minor INTEGER(8),"
@@ -547,6 +846,13 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("prepare _getFileRecordQueryByFileId", *_getFileRecordQueryByFileId);
     }
 
+    _getFileRecordQueryByChecksum.reset(new SqlQuery(_db));
+    if (_getFileRecordQueryByChecksum->prepare(
+            GET_FILE_RECORD_QUERY
+            " WHERE contentChecksum=?1")) {
+        return sqlFail("prepare _getFileRecordQueryByChecksum", *_getFileRecordQueryByChecksum);
+    }
+
     // This query is used to skip discovery and fill the tree from the
     // database instead
     _getFilesBelowPathQuery.reset(new SqlQuery(_db));
@@ -562,6 +868,28 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("prepare _getFilesBelowPathQuery", *_getFilesBelowPathQuery);
     }
 
+    // The direct children are the paths below that don't have another '/'
+    _getFilesInDirectoryQuery.reset(new SqlQuery(_db));
+    if (_getFilesInDirectoryQuery->prepare(
+            GET_FILE_RECORD_QUERY
+            " WHERE path > (?1||'/') AND path < (?1||'0')"
+            " AND instr(substr(path, length(?1) + 2), '/') = 0")) {
+        return sqlFail("prepare _getFilesInDirectoryQuery", *_getFilesInDirectoryQuery);
+    }
+
+    _getFileRecordCountBelowPathQuery.reset(new SqlQuery(_db));
+    if (_getFileRecordCountBelowPathQuery->prepare(
+            "SELECT COUNT(*) FROM metadata WHERE path > (?1||'/') AND path < (?1||'0')")) {
+        return sqlFail("prepare _getFileRecordCountBelowPathQuery", *_getFileRecordCountBelowPathQuery);
+    }
+
+    _getFilesInRootQuery.reset(new SqlQuery(_db));
+    if (_getFilesInRootQuery->prepare(
+            GET_FILE_RECORD_QUERY
+            " WHERE instr(path, '/') = 0")) {
+        return sqlFail("prepare _getFilesInRootQuery", *_getFilesInRootQuery);
+    }
+
     _getAllFilesQuery.reset(new SqlQuery(_db));
     if (_getAllFilesQuery->prepare(
             GET_FILE_RECORD_QUERY
@@ -593,15 +921,15 @@ bool SyncJournalDb::checkConnect()
     }
 
     _getDownloadInfoQuery.reset(new SqlQuery(_db));
-    if (_getDownloadInfoQuery->prepare("SELECT tmpfile, etag, errorcount FROM "
+    if (_getDownloadInfoQuery->prepare("SELECT tmpfile, etag, errorcount, segments FROM "
                                        "downloadinfo WHERE path=?1")) {
         return sqlFail("prepare _getDownloadInfoQuery", *_getDownloadInfoQuery);
     }
 
     _setDownloadInfoQuery.reset(new SqlQuery(_db));
     if (_setDownloadInfoQuery->prepare("INSERT OR REPLACE INTO downloadinfo "
-                                       "(path, tmpfile, etag, errorcount) "
-                                       "VALUES ( ?1 , ?2, ?3, ?4 )")) {
+                                       "(path, tmpfile, etag, errorcount, segments) "
+                                       "VALUES ( ?1 , ?2, ?3, ?4, ?5 )")) {
         return sqlFail("prepare _setDownloadInfoQuery", *_setDownloadInfoQuery);
     }
 
@@ -635,22 +963,11 @@ bool SyncJournalDb::checkConnect()
     }
 
     _deleteFileRecordRecursively.reset(new SqlQuery(_db));
-    if (_deleteFileRecordRecursively->prepare("DELETE FROM metadata WHERE path LIKE(?||'/%')")) {
+    // Range over the path index, see _getFilesBelowPathQuery
+    if (_deleteFileRecordRecursively->prepare("DELETE FROM metadata WHERE path > (?1||'/') AND path < (?1||'0')")) {
         return sqlFail("prepare _deleteFileRecordRecursively", *_deleteFileRecordRecursively);
     }
 
-    QString sql("SELECT lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration, renameTarget, errorCategory "
-                "FROM blacklist WHERE path=?1");
-    if (Utility::fsCasePreserving()) {
-        // if the file system is case preserving we have to check the blacklist
-        // case insensitively
-        sql += QLatin1String(" COLLATE NOCASE");
-    }
-    _getErrorBlacklistQuery.reset(new SqlQuery(_db));
-    if (_getErrorBlacklistQuery->prepare(sql)) {
-        return sqlFail("prepare _getErrorBlacklistQuery", *_getErrorBlacklistQuery);
-    }
-
     _setErrorBlacklistQuery.reset(new SqlQuery(_db));
     if (_setErrorBlacklistQuery->prepare("INSERT OR REPLACE INTO blacklist "
                                          "(path, lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration, renameTarget, errorCategory) "
@@ -692,6 +1009,55 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("prepare _setDataFingerprintQuery2", *_setDataFingerprintQuery2);
     }
 
+    _getLocalDirectoryInfoQuery.reset(new SqlQuery(_db));
+    if (_getLocalDirectoryInfoQuery->prepare("SELECT modtime, inode FROM localdirinfo WHERE phash=?1")) {
+        return sqlFail("prepare _getLocalDirectoryInfoQuery", *_getLocalDirectoryInfoQuery);
+    }
+
+    _setLocalDirectoryInfoQuery.reset(new SqlQuery(_db));
+    if (_setLocalDirectoryInfoQuery->prepare("INSERT OR REPLACE INTO localdirinfo "
+                                             "(phash, modtime, inode) VALUES (?1, ?2, ?3)")) {
+        return sqlFail("prepare _setLocalDirectoryInfoQuery", *_setLocalDirectoryInfoQuery);
+    }
+
+    _deleteLocalDirectoryInfoQuery.reset(new SqlQuery(_db));
+    if (_deleteLocalDirectoryInfoQuery->prepare("DELETE FROM localdirinfo WHERE phash=?1")) {
+        return sqlFail("prepare _deleteLocalDirectoryInfoQuery", *_deleteLocalDirectoryInfoQuery);
+    }
+
+    _getDiscoveryListingQuery.reset(new SqlQuery(_db));
+    if (_getDiscoveryListingQuery->prepare("SELECT etag, listing FROM discoverylisting WHERE phash=?1")) {
+        return sqlFail("prepare _getDiscoveryListingQuery", *_getDiscoveryListingQuery);
+    }
+
+    _setDiscoveryListingQuery.reset(new SqlQuery(_db));
+    if (_setDiscoveryListingQuery->prepare("INSERT OR REPLACE INTO discoverylisting "
+                                           "(phash, etag, listing) VALUES (?1, ?2, ?3)")) {
+        return sqlFail("prepare _setDiscoveryListingQuery", *_setDiscoveryListingQuery);
+    }
+
+    _getBlockChecksumsQuery.reset(new SqlQuery(_db));
+    if (_getBlockChecksumsQuery->prepare("SELECT etag, blocksize, checksums FROM blockchecksums WHERE phash=?1")) {
+        return sqlFail("prepare _getBlockChecksumsQuery", *_getBlockChecksumsQuery);
+    }
+
+    _setBlockChecksumsQuery.reset(new SqlQuery(_db));
+    if (_setBlockChecksumsQuery->prepare("INSERT OR REPLACE INTO blockchecksums "
+                                         "(phash, etag, blocksize, checksums) VALUES (?1, ?2, ?3, ?4)")) {
+        return sqlFail("prepare _setBlockChecksumsQuery", *_setBlockChecksumsQuery);
+    }
+
+    _getCachedChecksumQuery.reset(new SqlQuery(_db));
+    if (_getCachedChecksumQuery->prepare("SELECT modtime, filesize, checksum FROM checksumcache WHERE inode=?1")) {
+        return sqlFail("prepare _getCachedChecksumQuery", *_getCachedChecksumQuery);
+    }
+
+    _setCachedChecksumQuery.reset(new SqlQuery(_db));
+    if (_setCachedChecksumQuery->prepare("INSERT OR REPLACE INTO checksumcache "
+                                         "(inode, modtime, filesize, checksum) VALUES (?1, ?2, ?3, ?4)")) {
+        return sqlFail("prepare _setCachedChecksumQuery", *_setCachedChecksumQuery);
+    }
+
     // don't start a new transaction now
     commitInternal(QString("checkConnect End"), false);
 
@@ -699,6 +1065,11 @@ bool SyncJournalDb::checkConnect()
     // thereby speeding up the initial discovery significantly.
     _metadataTableIsEmpty = (getFileRecordCount() == 0);
 
+    if (_journalMode == QLatin1String("WAL")) {
+        QMutexLocker locker(&_readConnectionsMutex);
+        _readConnectionsEnabled = true;
+    }
+
     // Hide 'em all!
     FileSystem::setFileHidden(databaseFilePath(), true);
     FileSystem::setFileHidden(databaseFilePath() + "-wal", true);
@@ -713,12 +1084,19 @@ void SyncJournalDb::close()
     QMutexLocker locker(&_mutex);
     qCInfo(lcDb) << "Closing DB" << _dbFile;
 
+    if (_db.isOpen())
+        flushFileRecordsLocked(false);
     commitTransaction();
+    closeReadConnections();
 
     _getFileRecordQuery.reset(0);
     _getFileRecordQueryByInode.reset(0);
+    _getFileRecordQueryByChecksum.reset(0);
     _getFileRecordQueryByFileId.reset(0);
     _getFilesBelowPathQuery.reset(0);
+    _getFilesInDirectoryQuery.reset(0);
+    _getFileRecordCountBelowPathQuery.reset(0);
+    _getFilesInRootQuery.reset(0);
     _getAllFilesQuery.reset(0);
     _setFileRecordQuery.reset(0);
     _setFileRecordChecksumQuery.reset(0);
@@ -731,7 +1109,6 @@ void SyncJournalDb::close()
     _deleteUploadInfoQuery.reset(0);
     _deleteFileRecordPhash.reset(0);
     _deleteFileRecordRecursively.reset(0);
-    _getErrorBlacklistQuery.reset(0);
     _setErrorBlacklistQuery.reset(0);
     _getSelectiveSyncListQuery.reset(0);
     _getChecksumTypeIdQuery.reset(0);
@@ -740,8 +1117,28 @@ void SyncJournalDb::close()
     _getDataFingerprintQuery.reset(0);
     _setDataFingerprintQuery1.reset(0);
     _setDataFingerprintQuery2.reset(0);
+    _getLocalDirectoryInfoQuery.reset(0);
+    _setLocalDirectoryInfoQuery.reset(0);
+    _deleteLocalDirectoryInfoQuery.reset(0);
+    _getDiscoveryListingQuery.reset(0);
+    _setDiscoveryListingQuery.reset(0);
+    _getBlockChecksumsQuery.reset(0);
+    _setBlockChecksumsQuery.reset(0);
+    _getCachedChecksumQuery.reset(0);
+    _setCachedChecksumQuery.reset(0);
 
     _db.close();
+    _fileRecordCache.clear();
+    _errorBlacklist.clear();
+    _errorBlacklistLoaded = false;
+    _inodeIndex.clear();
+    _inodeIndex.squeeze();
+    _inodeIndexBuilt = false;
+    _inodeLookups = 0;
+    _fileIdIndex.clear();
+    _fileIdIndex.squeeze();
+    _fileIdIndexBuilt = false;
+    _fileIdLookups = 0;
     _avoidReadFromDbOnNextSyncFilter.clear();
     _metadataTableIsEmpty = false;
 }
@@ -753,6 +1150,8 @@ bool SyncJournalDb::updateDatabaseStructure()
         return false;
     if (!updateErrorBlacklistTableStructure())
         return false;
+    if (!updateDownloadInfoTableStructure())
+        return false;
     return true;
 }
 
@@ -820,6 +1219,16 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal("update database structure: add path index");
     }
 
+    if (1) {
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_checksum ON metadata(contentChecksum);");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: create index contentChecksum", query);
+            re = false;
+        }
+        commitInternal("update database structure: add contentChecksum index");
+    }
+
     if (columns.indexOf(QLatin1String("ignoredChildrenRemote")) == -1) {
         SqlQuery query(_db);
         query.prepare("ALTER TABLE metadata ADD COLUMN ignoredChildrenRemote INT;");
@@ -907,6 +1316,28 @@ bool SyncJournalDb::updateErrorBlacklistTableStructure()
     return re;
 }
 
+bool SyncJournalDb::updateDownloadInfoTableStructure()
+{
+    QStringList columns = tableColumns("downloadinfo");
+    bool re = true;
+
+    if (!checkConnect()) {
+        return false;
+    }
+
+    if (columns.indexOf(QLatin1String("segments")) == -1) {
+        SqlQuery query(_db);
+        query.prepare("ALTER TABLE downloadinfo ADD COLUMN segments TEXT;");
+        if (!query.exec()) {
+            sqlFail("updateDownloadInfoTableStructure: Add segments", query);
+            re = false;
+        }
+        commitInternal("update database structure: add segments col");
+    }
+
+    return re;
+}
+
 QStringList SyncJournalDb::tableColumns(const QString &table)
 {
     QStringList columns;
@@ -966,6 +1397,45 @@ bool SyncJournalDb::setFileRecord(const SyncJournalFileRecord &_record)
                  << "etag:" << record._etag << "fileId:" << record._fileId << "remotePerm:" << record._remotePerm.toString()
                  << "fileSize:" << record._fileSize << "checksum:" << record._checksumHeader;
 
+    _fileRecordCache.remove(getPHash(record._path));
+
+    if (_fileRecordBatchSize <= 0)
+        return writeFileRecord(record);
+
+    // The writer can't report its failures, the next caller gets them
+    if (_fileRecordWriteFailed) {
+        _fileRecordWriteFailed = false;
+        qCWarning(lcDb) << "Earlier queued file records could not be written, not queueing" << record._path;
+        return false;
+    }
+
+    // Queue the record the way it will be read back from the database
+    QByteArray checksumType, checksum;
+    parseChecksumHeader(record._checksumHeader, &checksumType, &checksum);
+    record._checksumHeader = checksumType.isEmpty() ? QByteArray() : checksumType + ':' + checksum;
+    record._remotePerm = RemotePermissions(record._remotePerm.toString().constData());
+    record._inode = static_cast<int>(record._inode);
+
+    auto it = _pendingFileRecordIndex.constFind(record._path);
+    if (it != _pendingFileRecordIndex.constEnd()) {
+        _pendingFileRecords[*it] = record;
+    } else {
+        _pendingFileRecordIndex.insert(record._path, _pendingFileRecords.size());
+        _pendingFileRecords.append(record);
+    }
+    _metadataTableIsEmpty = false;
+
+    if (_pendingFileRecords.size() >= _fileRecordBatchSize) {
+        scheduleFileRecordFlush();
+    } else if (!_fileRecordFlushTimer.isActive() && QThread::currentThread() == thread()
+        && thread()->eventDispatcher()) {
+        _fileRecordFlushTimer.start();
+    }
+    return true;
+}
+
+bool SyncJournalDb::writeFileRecord(const SyncJournalFileRecord &record)
+{
     qlonglong phash = getPHash(record._path);
     if (checkConnect()) {
         int plen = record._path.length();
@@ -981,26 +1451,33 @@ bool SyncJournalDb::setFileRecord(const SyncJournalFileRecord &_record)
         parseChecksumHeader(record._checksumHeader, &checksumType, &checksum);
         int contentChecksumTypeId = mapChecksumType(checksumType);
         _setFileRecordQuery->reset_and_clear_bindings();
-        _setFileRecordQuery->bindValue(1, phash);
-        _setFileRecordQuery->bindValue(2, plen);
-        _setFileRecordQuery->bindValue(3, record._path);
-        _setFileRecordQuery->bindValue(4, record._inode);
-        _setFileRecordQuery->bindValue(5, 0); // uid Not used
-        _setFileRecordQuery->bindValue(6, 0); // gid Not used
-        _setFileRecordQuery->bindValue(7, 0); // mode Not used
-        _setFileRecordQuery->bindValue(8, record._modtime);
-        _setFileRecordQuery->bindValue(9, record._type);
-        _setFileRecordQuery->bindValue(10, etag);
-        _setFileRecordQuery->bindValue(11, fileId);
-        _setFileRecordQuery->bindValue(12, remotePerm);
-        _setFileRecordQuery->bindValue(13, record._fileSize);
-        _setFileRecordQuery->bindValue(14, record._serverHasIgnoredFiles ? 1 : 0);
-        _setFileRecordQuery->bindValue(15, checksum);
-        _setFileRecordQuery->bindValue(16, contentChecksumTypeId);
+        _setFileRecordQuery->bindInt64(1, phash);
+        _setFileRecordQuery->bindInt64(2, plen);
+        _setFileRecordQuery->bindByteArray(3, record._path);
+        _setFileRecordQuery->bindInt64(4, record._inode);
+        _setFileRecordQuery->bindInt64(5, 0); // uid Not used
+        _setFileRecordQuery->bindInt64(6, 0); // gid Not used
+        _setFileRecordQuery->bindInt64(7, 0); // mode Not used
+        _setFileRecordQuery->bindInt64(8, record._modtime);
+        _setFileRecordQuery->bindInt64(9, record._type);
+        _setFileRecordQuery->bindByteArray(10, etag);
+        _setFileRecordQuery->bindByteArray(11, fileId);
+        _setFileRecordQuery->bindByteArray(12, remotePerm);
+        _setFileRecordQuery->bindInt64(13, record._fileSize);
+        _setFileRecordQuery->bindInt64(14, record._serverHasIgnoredFiles ? 1 : 0);
+        _setFileRecordQuery->bindByteArray(15, checksum);
+        _setFileRecordQuery->bindInt64(16, contentChecksumTypeId);
 
         if (!_setFileRecordQuery->exec()) {
             return false;
         }
+        if (_inodeIndexBuilt && record._inode)
+            _inodeIndex.insert(record._inode, phash);
+        if (_fileIdIndexBuilt && !record._fileId.isEmpty()) {
+            const qint64 fileIdHash = getPHash(record._fileId);
+            if (!_fileIdIndex.contains(fileIdHash, phash))
+                _fileIdIndex.insert(fileIdHash, phash);
+        }
 
         // Can't be true anymore.
         _metadataTableIsEmpty = false;
@@ -1012,22 +1489,101 @@ bool SyncJournalDb::setFileRecord(const SyncJournalFileRecord &_record)
     }
 }
 
+SyncJournalDb::LookupCacheStatistics SyncJournalDb::lookupCacheStatistics()
+{
+    QMutexLocker locker(&_mutex);
+    LookupCacheStatistics stats = _lookupCacheStatistics;
+    stats._cachedFileRecords = _fileRecordCache.count();
+    stats._cachedErrorBlacklistEntries = _errorBlacklist.size();
+    stats._pendingFileRecords = _pendingFileRecords.size();
+    stats._indexedInodes = _inodeIndex.size();
+    stats._indexedFileIds = _fileIdIndex.size();
+    return stats;
+}
+
+bool SyncJournalDb::flushFileRecords()
+{
+    QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(true);
+    // Also fails for the earlier writes of the writer thread
+    const bool ok = !_fileRecordWriteFailed;
+    _fileRecordWriteFailed = false;
+    return ok;
+}
+
+bool SyncJournalDb::flushFileRecordsLocked(bool commit)
+{
+    if (_pendingFileRecords.isEmpty())
+        return true;
+
+    const auto records = std::move(_pendingFileRecords);
+    _pendingFileRecords.clear();
+    _pendingFileRecordIndex.clear();
+
+    if (!checkConnect()) {
+        qCWarning(lcDb) << "Failed to connect database, dropping" << records.size() << "file records";
+        _fileRecordWriteFailed = true;
+        return false;
+    }
+
+    TraceSpan span("journal", QStringLiteral("write queued file records"));
+    const bool hadTransaction = _transaction == 1;
+    startTransaction();
+    for (const auto &record : records) {
+        if (!writeFileRecord(record)) {
+            qCWarning(lcDb) << "Failed to write file record for" << record._path;
+            _fileRecordWriteFailed = true;
+            return false;
+        }
+    }
+    qCDebug(lcDb) << "Wrote" << records.size() << "queued file records";
+    if (commit)
+        commitInternal(QStringLiteral("queued file records"), hadTransaction);
+    return true;
+}
+
+void SyncJournalDb::scheduleFileRecordFlush()
+{
+    if (_fileRecordFlushScheduled || _pendingFileRecords.isEmpty())
+        return;
+    _fileRecordFlushScheduled = true;
+    QtConcurrent::run(&_writerPool, [this] {
+        QMutexLocker locker(&_mutex);
+        _fileRecordFlushScheduled = false;
+        flushFileRecordsLocked(true);
+    });
+}
+
 bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
 {
     QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
 
     if (checkConnect()) {
         // if (!recursively) {
         // always delete the actual file.
 
         qlonglong phash = getPHash(filename.toUtf8());
+        if (recursively)
+            _fileRecordCache.clear();
+        else
+            _fileRecordCache.remove(phash);
         _deleteFileRecordPhash->reset_and_clear_bindings();
-        _deleteFileRecordPhash->bindValue(1, phash);
+        _deleteFileRecordPhash->bindInt64(1, phash);
 
         if (!_deleteFileRecordPhash->exec()) {
             return false;
         }
 
+        // The parent directory has to be listed again, otherwise the file
+        // would be missing from a DirectoryModtime discovery.
+        const QString parent = filename.left(qMax(0, filename.lastIndexOf(QLatin1Char('/'))));
+        for (auto dirHash : { phash, getPHash(parent.toUtf8()) }) {
+            _deleteLocalDirectoryInfoQuery->reset_and_clear_bindings();
+            _deleteLocalDirectoryInfoQuery->bindValue(1, dirHash);
+            _deleteLocalDirectoryInfoQuery->exec();
+        }
+
         if (recursively) {
             _deleteFileRecordRecursively->reset_and_clear_bindings();
             _deleteFileRecordRecursively->bindValue(1, filename);
@@ -1042,8 +1598,38 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
     }
 }
 
+bool SyncJournalDb::moveSubtree(const QByteArray &from, const QByteArray &to)
+{
+    QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
+
+    if (!checkConnect())
+        return false;
+    _fileRecordCache.clear();
+
+    // A record that was written at the new path by its own job is newer, the
+    // old one is removed with the leftovers
+    SqlQuery query(_db);
+    if (query.prepare("UPDATE OR IGNORE metadata"
+                      " SET path = ?2 || substr(path, length(?1) + 1),"
+                      "  pathlen = length(CAST(?2 || substr(path, length(?1) + 1) AS BLOB)),"
+                      "  phash = phash(?2 || substr(path, length(?1) + 1))"
+                      " WHERE path > (?1||'/') AND path < (?1||'0')")
+        != 0) {
+        return false;
+    }
+    query.bindByteArray(1, from);
+    query.bindByteArray(2, to);
+    if (!query.exec())
+        return false;
+    qCInfo(lcDb) << "Moved" << query.numRowsAffected() << "records from" << from << "to" << to;
 
-bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec)
+    _deleteFileRecordRecursively->reset_and_clear_bindings();
+    _deleteFileRecordRecursively->bindByteArray(1, from);
+    return _deleteFileRecordRecursively->exec();
+}
+
+bool SyncJournalDb::getFileRecord(const QByteArray &filename, qint64 phash, SyncJournalFileRecord *rec)
 {
     QMutexLocker locker(&_mutex);
 
@@ -1052,6 +1638,12 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
     rec->_path.clear();
     Q_ASSERT(!rec->isValid());
 
+    auto pending = _pendingFileRecordIndex.constFind(filename);
+    if (pending != _pendingFileRecordIndex.constEnd()) {
+        *rec = _pendingFileRecords.at(*pending);
+        return true;
+    }
+
     if (_metadataTableIsEmpty)
         return true; // no error, yet nothing found (rec->isValid() == false)
 
@@ -1059,8 +1651,16 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
         return false;
 
     if (!filename.isEmpty()) {
+        Q_ASSERT(phash == getPHash(filename));
+        if (auto cached = _fileRecordCache.object(phash)) {
+            ++_lookupCacheStatistics._fileRecordHits;
+            *rec = *cached;
+            return true;
+        }
+        ++_lookupCacheStatistics._fileRecordMisses;
+
         _getFileRecordQuery->reset_and_clear_bindings();
-        _getFileRecordQuery->bindValue(1, getPHash(filename));
+        _getFileRecordQuery->bindInt64(1, phash);
 
         if (!_getFileRecordQuery->exec()) {
             close();
@@ -1075,51 +1675,342 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
                 QString err = _getFileRecordQuery->error();
                 qCWarning(lcDb) << "No journal entry found for " << filename << "Error: " << err;
                 close();
+                return true;
             }
         }
+        _fileRecordCache.insert(phash, new SyncJournalFileRecord(*rec));
     }
     return true;
 }
 
-bool SyncJournalDb::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec)
+struct SyncJournalDb::ReadConnection
 {
-    QMutexLocker locker(&_mutex);
-
-    // Reset the output var in case the caller is reusing it.
-    Q_ASSERT(rec);
-    rec->_path.clear();
-    Q_ASSERT(!rec->isValid());
-
-    if (!inode || _metadataTableIsEmpty)
-        return true; // no error, yet nothing found (rec->isValid() == false)
+    SqlDatabase _db;
+    QScopedPointer<SqlQuery> _getFileRecordQuery;
+    int _generation = 0;
 
-    if (!checkConnect())
-        return false;
+    ~ReadConnection()
+    {
+        _getFileRecordQuery.reset();
+        _db.close();
+    }
+};
 
-    _getFileRecordQueryByInode->reset_and_clear_bindings();
-    _getFileRecordQueryByInode->bindValue(1, inode);
+void SyncJournalDb::runAsync(QObject *context, const std::function<void(SyncJournalDb *)> &job, const std::function<void()> &done)
+{
+    // Owned by the context so that done isn't called once it is gone
+    auto watcher = new QFutureWatcher<void>(context);
+    connect(watcher, &QFutureWatcherBase::finished, watcher, [watcher, done] {
+        watcher->deleteLater();
+        if (done)
+            done();
+    });
+    watcher->setFuture(QtConcurrent::run(&_writerPool, [this, job] { job(this); }));
+}
 
-    if (!_getFileRecordQueryByInode->exec()) {
-        return false;
-    }
+void SyncJournalDb::getFileRecordAsync(const QByteArray &filename, QObject *context, const std::function<void(const SyncJournalFileRecord &)> &callback)
+{
+    auto rec = QSharedPointer<SyncJournalFileRecord>::create();
+    runAsync(context,
+        [filename, rec](SyncJournalDb *db) {
+            if (!db->getFileRecordReadOnly(filename, rec.data()))
+                *rec = SyncJournalFileRecord();
+        },
+        [rec, callback] { callback(*rec); });
+}
 
-    if (_getFileRecordQueryByInode->next()) {
-        fillFileRecordFromGetQuery(*rec, *_getFileRecordQueryByInode);
+std::unique_ptr<SyncJournalDb::ReadConnection> SyncJournalDb::takeReadConnection()
+{
+    int generation = 0;
+    int cacheSize = 0;
+    qint64 mmapSize = 0;
+    {
+        QMutexLocker locker(&_readConnectionsMutex);
+        if (!_readConnectionsEnabled)
+            return nullptr;
+        if (!_readConnections.empty()) {
+            auto connection = std::move(_readConnections.back());
+            _readConnections.pop_back();
+            return connection;
+        }
+        if (_readConnectionCount >= MaxReadConnections)
+            return nullptr;
+        ++_readConnectionCount;
+        generation = _readConnectionGeneration;
+        // The automatic cache size is for the writer, the readers share the mapping
+        cacheSize = _cacheSizeKib;
+        mmapSize = _mmapSize;
+    }
+
+    std::unique_ptr<ReadConnection> connection(new ReadConnection);
+    connection->_generation = generation;
+    // The writer already checked the database when opening it
+    if (connection->_db.openReadOnly(_dbFile, false)) {
+        if (cacheSize > 0)
+            setCacheSizePragma(connection->_db, cacheSize);
+        if (mmapSize > 0)
+            setMmapSizePragma(connection->_db, mmapSize);
+        connection->_getFileRecordQuery.reset(new SqlQuery(connection->_db));
+        if (connection->_getFileRecordQuery->prepare(
+                GET_FILE_RECORD_QUERY
+                " WHERE phash=?1") == 0) {
+            return connection;
+        }
+        qCWarning(lcDb) << "Failed to prepare the read-only query:" << connection->_getFileRecordQuery->error();
+    } else {
+        qCWarning(lcDb) << "Failed to open a read-only connection:" << connection->_db.error();
     }
 
-    return true;
+    QMutexLocker locker(&_readConnectionsMutex);
+    --_readConnectionCount;
+    return nullptr;
 }
 
-bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+void SyncJournalDb::setCacheSize(int kibibytes)
 {
     QMutexLocker locker(&_mutex);
+    {
+        QMutexLocker readLocker(&_readConnectionsMutex);
+        if (_cacheSizeKib == kibibytes)
+            return;
+        _cacheSizeKib = kibibytes;
+        // The pooled connections are reopened with the new size
+        ++_readConnectionGeneration;
+        _readConnectionCount -= static_cast<int>(_readConnections.size());
+        _readConnections.clear();
+    }
+    if (_db.isOpen()) {
+        // A negative cache_size is in KiB, the default is -2000
+        setCacheSizePragma(_db, kibibytes > 0 ? kibibytes : (_autoCacheSizeKib > 0 ? _autoCacheSizeKib : 2000));
+    }
+}
 
-    if (fileId.isEmpty() || _metadataTableIsEmpty)
-        return true; // no error, yet nothing found (rec->isValid() == false)
+void SyncJournalDb::setAutoTuneLimits(int maxCacheSizeKib, qint64 maxMmapSize)
+{
+    QMutexLocker locker(&_mutex);
+    QMutexLocker readLocker(&_readConnectionsMutex);
+    if (_maxCacheSizeKib == maxCacheSizeKib && _maxMmapSize == maxMmapSize)
+        return;
+    _maxCacheSizeKib = maxCacheSizeKib;
+    _maxMmapSize = maxMmapSize;
+    if (!_db.isOpen())
+        return;
+
+    autoTune();
+    if (_cacheSizeKib <= 0)
+        setCacheSizePragma(_db, _autoCacheSizeKib > 0 ? _autoCacheSizeKib : 2000);
+    setMmapSizePragma(_db, _mmapSize);
+    // The pooled connections are reopened with the new mapping
+    ++_readConnectionGeneration;
+    _readConnectionCount -= static_cast<int>(_readConnections.size());
+    _readConnections.clear();
+}
+
+void SyncJournalDb::autoTune()
+{
+    _autoCacheSizeKib = 0;
+    _mmapSize = 0;
+    if (_maxCacheSizeKib <= 0 && _maxMmapSize <= 0)
+        return;
+
+    const qint64 dbSize = QFileInfo(_dbFile).size() + QFileInfo(_dbFile + QLatin1String("-wal")).size();
+    // Several folders may each have a journal, none takes a large part
+    const qint64 memory = Utility::physicalMemorySize();
+    const qint64 memoryShare = memory > 0 ? memory / AutoTuneMemoryShare : AutoTuneUnknownMemoryShare;
+
+    // The indexes and the recently used records are the hot part of the
+    // file, a quarter of it is enough to stop going to the disk for them
+    const qint64 cacheKib = qMin<qint64>(dbSize / 4, memoryShare) / 1024;
+    if (cacheKib > 2000)
+        _autoCacheSizeKib = static_cast<int>(qMin<qint64>(cacheKib, _maxCacheSizeKib));
+
+    // A mapping costs no memory of its own, the pages are the ones of the
+    // file system cache. A file system that reports I/O errors as signals
+    // on mapped pages is also one that needs another journal mode.
+    if (_journalMode == QLatin1String("WAL"))
+        _mmapSize = qMin(_maxMmapSize, memoryShare * 4);
+
+    qCInfo(lcDb) << "Tuned for" << dbSize << "bytes: cache size" << _autoCacheSizeKib << "KiB, mmap size" << _mmapSize;
+}
+
+void SyncJournalDb::closeReadConnections()
+{
+    QMutexLocker locker(&_readConnectionsMutex);
+    _readConnectionsEnabled = false;
+    ++_readConnectionGeneration;
+    _readConnectionCount -= static_cast<int>(_readConnections.size());
+    _readConnections.clear();
+}
+
+bool SyncJournalDb::getFileRecordReadOnly(const QByteArray &filename, SyncJournalFileRecord *rec)
+{
+    // Nobody is using the database right now, the regular lookup also sees
+    // the uncommitted changes.
+    if (_mutex.tryLock()) {
+        bool ok = getFileRecord(filename, rec);
+        _mutex.unlock();
+        return ok;
+    }
+
+    auto connection = takeReadConnection();
+    if (!connection)
+        return getFileRecord(filename, rec);
+
+    Q_ASSERT(rec);
+    rec->_path.clear();
+
+    auto &query = *connection->_getFileRecordQuery;
+    query.reset_and_clear_bindings();
+    query.bindInt64(1, getPHash(filename));
+    bool ok = query.exec();
+    if (ok) {
+        if (query.next()) {
+            fillFileRecordFromGetQuery(*rec, query);
+        } else {
+            ok = query.errorId() == SQLITE_DONE;
+        }
+    }
+    // Don't keep the read transaction open, it would hold back checkpoints
+    query.reset_and_clear_bindings();
+
+    {
+        QMutexLocker locker(&_readConnectionsMutex);
+        if (ok && connection->_generation == _readConnectionGeneration) {
+            _readConnections.push_back(std::move(connection));
+        } else {
+            --_readConnectionCount;
+        }
+    }
+    // Dropped connections are closed outside of the lock
+    connection.reset();
+
+    if (!ok) {
+        qCWarning(lcDb) << "Read-only lookup failed for" << filename << ", retrying with the main connection";
+        rec->_path.clear();
+        return getFileRecord(filename, rec);
+    }
+    return true;
+}
+
+bool SyncJournalDb::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec)
+{
+    QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
+
+    // Reset the output var in case the caller is reusing it.
+    Q_ASSERT(rec);
+    rec->_path.clear();
+    Q_ASSERT(!rec->isValid());
+
+    if (!inode || _metadataTableIsEmpty)
+        return true; // no error, yet nothing found (rec->isValid() == false)
+
+    if (!checkConnect())
+        return false;
+
+    if (!_inodeIndexBuilt && ++_inodeLookups > InodeIndexThreshold && !buildInodeIndex())
+        return false;
+
+    if (_inodeIndexBuilt) {
+        // Every written inode is in the index, a missing one is in no record
+        auto it = _inodeIndex.constFind(inode);
+        if (it == _inodeIndex.constEnd())
+            return true;
+
+        _getFileRecordQuery->reset_and_clear_bindings();
+        _getFileRecordQuery->bindInt64(1, *it);
+        if (!_getFileRecordQuery->exec())
+            return false;
+        if (_getFileRecordQuery->next()
+            && static_cast<quint64>(_getFileRecordQuery->int64Value(InodeColumn)) == inode) {
+            fillFileRecordFromGetQuery(*rec, *_getFileRecordQuery);
+            return true;
+        }
+        // The record was renamed, removed or has another inode now
+        _inodeIndex.remove(inode);
+    }
+
+    _getFileRecordQueryByInode->reset_and_clear_bindings();
+    _getFileRecordQueryByInode->bindValue(1, inode);
+
+    if (!_getFileRecordQueryByInode->exec()) {
+        return false;
+    }
+
+    if (_getFileRecordQueryByInode->next()) {
+        fillFileRecordFromGetQuery(*rec, *_getFileRecordQueryByInode);
+        if (_inodeIndexBuilt)
+            _inodeIndex.insert(inode, getPHash(rec->_path));
+    }
+
+    return true;
+}
+
+bool SyncJournalDb::buildInodeIndex()
+{
+    SqlQuery query(_db);
+    if (query.prepare("SELECT inode, phash FROM metadata WHERE inode != 0") || !query.exec())
+        return false;
+
+    _inodeIndex.reserve(qMax(0, getFileRecordCount()));
+    while (query.next())
+        _inodeIndex.insert(static_cast<quint64>(query.int64Value(0)), query.int64Value(1));
+    _inodeIndexBuilt = true;
+    qCInfo(lcDb) << "Indexed" << _inodeIndex.size() << "inodes for the rename detection";
+    return true;
+}
+
+bool SyncJournalDb::buildFileIdIndex()
+{
+    SqlQuery query(_db);
+    if (query.prepare("SELECT fileid, phash FROM metadata WHERE fileid != ''") || !query.exec())
+        return false;
+
+    _fileIdIndex.reserve(qMax(0, getFileRecordCount()));
+    while (query.next())
+        _fileIdIndex.insert(getPHash(query.baValue(0)), query.int64Value(1));
+    _fileIdIndexBuilt = true;
+    qCInfo(lcDb) << "Indexed" << _fileIdIndex.size() << "file ids for the rename detection";
+    return true;
+}
+
+bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+{
+    QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
+
+    if (fileId.isEmpty() || _metadataTableIsEmpty)
+        return true; // no error, yet nothing found (rec->isValid() == false)
 
     if (!checkConnect())
         return false;
 
+    if (!_fileIdIndexBuilt && ++_fileIdLookups > InodeIndexThreshold && !buildFileIdIndex())
+        return false;
+
+    if (_fileIdIndexBuilt) {
+        // Every written file id is in the index, a missing one is in no record
+        const qint64 fileIdHash = getPHash(fileId);
+        const QList<qint64> phashes = _fileIdIndex.values(fileIdHash);
+        for (qint64 phash : phashes) {
+            _getFileRecordQuery->reset_and_clear_bindings();
+            _getFileRecordQuery->bindInt64(1, phash);
+            if (!_getFileRecordQuery->exec())
+                return false;
+            const bool found = _getFileRecordQuery->next();
+            const QByteArray recordFileId = found ? _getFileRecordQuery->baValue(FileIdColumn) : QByteArray();
+            if (recordFileId == fileId) {
+                SyncJournalFileRecord rec;
+                fillFileRecordFromGetQuery(rec, *_getFileRecordQuery);
+                rowCallback(rec);
+            } else if (!found || getPHash(recordFileId) != fileIdHash) {
+                // The record was removed or has another file id now
+                _fileIdIndex.remove(fileIdHash, phash);
+            }
+        }
+        return true;
+    }
+
     _getFileRecordQueryByFileId->reset_and_clear_bindings();
     _getFileRecordQueryByFileId->bindValue(1, fileId);
 
@@ -1136,9 +2027,49 @@ bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::
     return true;
 }
 
+bool SyncJournalDb::getFileRecordsByChecksum(const QByteArray &checksumHeader, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+{
+    QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
+
+    QByteArray checksumType, checksum;
+    if (!parseChecksumHeader(checksumHeader, &checksumType, &checksum) || checksum.isEmpty() || _metadataTableIsEmpty)
+        return true; // no error, yet nothing found
+
+    if (!checkConnect())
+        return false;
+
+    _getFileRecordQueryByChecksum->reset_and_clear_bindings();
+    _getFileRecordQueryByChecksum->bindValue(1, checksum);
+
+    if (!_getFileRecordQueryByChecksum->exec()) {
+        return false;
+    }
+
+    while (_getFileRecordQueryByChecksum->next()) {
+        SyncJournalFileRecord rec;
+        fillFileRecordFromGetQuery(rec, *_getFileRecordQueryByChecksum);
+        // The same value of another checksum type is no match
+        if (rec._checksumHeader == checksumHeader)
+            rowCallback(rec);
+    }
+
+    return true;
+}
+
 bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback)
+{
+    return getFileRowsBelowPath(path, [&rowCallback](SqlQuery &query) {
+        SyncJournalFileRecord rec;
+        fillFileRecordFromGetQuery(rec, query);
+        rowCallback(rec);
+    });
+}
+
+bool SyncJournalDb::getFileRowsBelowPath(const QByteArray &path, const std::function<void(SqlQuery &)> &rowCallback)
 {
     QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
 
     if (_metadataTableIsEmpty)
         return true; // no error, yet nothing found
@@ -1154,7 +2085,56 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
 
     query->reset_and_clear_bindings();
     if (query == _getFilesBelowPathQuery)
-        query->bindValue(1, path);
+        query->bindByteArray(1, path);
+
+    if (!query->exec()) {
+        return false;
+    }
+
+    while (query->next()) {
+        rowCallback(*query);
+    }
+
+    return true;
+}
+
+qint64 SyncJournalDb::getFileRecordCountBelowPath(const QByteArray &path)
+{
+    QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
+
+    if (_metadataTableIsEmpty)
+        return 0;
+
+    if (!checkConnect())
+        return -1;
+
+    auto &query = _getFileRecordCountBelowPathQuery;
+    query->reset_and_clear_bindings();
+    query->bindByteArray(1, path);
+    if (!query->exec() || !query->next()) {
+        return -1;
+    }
+    return query->int64Value(0);
+}
+
+bool SyncJournalDb::getFilesInDirectory(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+{
+    QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
+
+    if (_metadataTableIsEmpty)
+        return true; // no error, yet nothing found
+
+    if (!checkConnect())
+        return false;
+
+    // Same issue with the root path as in getFilesBelowPath()
+    auto &query = path.isEmpty() ? _getFilesInRootQuery : _getFilesInDirectoryQuery;
+
+    query->reset_and_clear_bindings();
+    if (query == _getFilesInDirectoryQuery)
+        query->bindByteArray(1, path);
 
     if (!query->exec()) {
         return false;
@@ -1169,10 +2149,13 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
     return true;
 }
 
-bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
-    const QSet<QString> &prefixesToKeep)
+bool SyncJournalDb::postSyncCleanup(const std::vector<qint64> &phashesToKeep,
+    const QSet<QString> &prefixesToKeep,
+    const QStringList &subtreesToKeep)
 {
     QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
+    _fileRecordCache.clear();
 
     if (!checkConnect()) {
         return false;
@@ -1188,8 +2171,18 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
     QByteArrayList superfluousItems;
 
     while (query.next()) {
+        const qint64 phash = query.int64Value(0);
+        if (std::binary_search(phashesToKeep.begin(), phashesToKeep.end(), phash))
+            continue;
+
         const QString file = query.baValue(1);
-        bool keep = filepathsToKeep.contains(file);
+        bool keep = false;
+        if (!subtreesToKeep.isEmpty()) {
+            // Since the subtrees are disjoint, only the last one that sorts
+            // before the file can contain it.
+            auto it = std::upper_bound(subtreesToKeep.begin(), subtreesToKeep.end(), file);
+            keep = it != subtreesToKeep.begin() && file.startsWith(*(it - 1));
+        }
         if (!keep) {
             foreach (const QString &prefix, prefixesToKeep) {
                 if (file.startsWith(prefix)) {
@@ -1199,7 +2192,7 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
             }
         }
         if (!keep) {
-            superfluousItems.append(query.baValue(0));
+            superfluousItems.append(QByteArray::number(phash));
         }
     }
 
@@ -1211,8 +2204,19 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
         if (!delQuery.exec()) {
             return false;
         }
+        delQuery.prepare("DELETE FROM blockchecksums WHERE phash in (" + superfluousItems.join(",") + ")");
+        if (!delQuery.exec()) {
+            return false;
+        }
     }
 
+    // The checksums of files that are not in the journal, except the last
+    // ones: their upload may have failed and be retried
+    SqlQuery cacheQuery(_db);
+    cacheQuery.prepare("DELETE FROM checksumcache WHERE inode NOT IN (SELECT inode FROM metadata)"
+                       " AND rowid NOT IN (SELECT rowid FROM checksumcache ORDER BY rowid DESC LIMIT 1000);");
+    cacheQuery.exec();
+
     // Incorporate results back into main DB
     walCheckpoint();
 
@@ -1238,15 +2242,30 @@ int SyncJournalDb::getFileRecordCount()
     return -1;
 }
 
+bool SyncJournalDb::hasFileRecords()
+{
+    QMutexLocker locker(&_mutex);
+    if (!_pendingFileRecords.isEmpty())
+        return true;
+    if (!checkConnect())
+        return false;
+
+    SqlQuery query(_db);
+    query.prepare("SELECT 1 FROM metadata LIMIT 1;");
+    return query.exec() && query.next();
+}
+
 bool SyncJournalDb::updateFileRecordChecksum(const QString &filename,
     const QByteArray &contentChecksum,
     const QByteArray &contentChecksumType)
 {
     QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
 
     qCInfo(lcDb) << "Updating file checksum" << filename << contentChecksum << contentChecksumType;
 
     qlonglong phash = getPHash(filename.toUtf8());
+    _fileRecordCache.remove(phash);
     if (!checkConnect()) {
         qCWarning(lcDb) << "Failed to connect database.";
         return false;
@@ -1272,10 +2291,12 @@ bool SyncJournalDb::updateLocalMetadata(const QString &filename,
 
 {
     QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
 
     qCInfo(lcDb) << "Updating local metadata for:" << filename << modtime << size << inode;
 
     qlonglong phash = getPHash(filename.toUtf8());
+    _fileRecordCache.remove(phash);
     if (!checkConnect()) {
         qCWarning(lcDb) << "Failed to connect database.";
         return false;
@@ -1292,6 +2313,8 @@ bool SyncJournalDb::updateLocalMetadata(const QString &filename,
     if (!query->exec()) {
         return false;
     }
+    if (_inodeIndexBuilt && inode)
+        _inodeIndex.insert(inode, phash);
 
     return true;
 }
@@ -1325,6 +2348,14 @@ static void toDownloadInfo(SqlQuery &query, SyncJournalDb::DownloadInfo *res)
     res->_tmpfile = query.stringValue(0);
     res->_etag = query.baValue(1);
     res->_errorCount = query.intValue(2);
+    res->_segments.clear();
+    // Stored as "first-last,first-last"
+    foreach (const QByteArray &segment, query.baValue(3).split(',')) {
+        const int dash = segment.indexOf('-');
+        if (dash <= 0)
+            continue;
+        res->_segments.append(qMakePair(segment.left(dash).toULongLong(), segment.mid(dash + 1).toULongLong()));
+    }
     res->_valid = ok;
 }
 
@@ -1383,6 +2414,10 @@ void SyncJournalDb::setDownloadInfo(const QString &file, const SyncJournalDb::Do
         _setDownloadInfoQuery->bindValue(2, i._tmpfile);
         _setDownloadInfoQuery->bindValue(3, i._etag);
         _setDownloadInfoQuery->bindValue(4, i._errorCount);
+        QByteArrayList segments;
+        for (const auto &segment : i._segments)
+            segments.append(QByteArray::number(segment.first) + '-' + QByteArray::number(segment.second));
+        _setDownloadInfoQuery->bindValue(5, segments.join(','));
 
         if (!_setDownloadInfoQuery->exec()) {
             return;
@@ -1408,7 +2443,7 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
 
     SqlQuery query(_db);
     // The selected values *must* match the ones expected by toDownloadInfo().
-    query.prepare("SELECT tmpfile, etag, errorcount, path FROM downloadinfo");
+    query.prepare("SELECT tmpfile, etag, errorcount, segments, path FROM downloadinfo");
 
     if (!query.exec()) {
         return empty_result;
@@ -1418,7 +2453,7 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
     QVector<SyncJournalDb::DownloadInfo> deleted_entries;
 
     while (query.next()) {
-        const QString file = query.stringValue(3); // path
+        const QString file = query.stringValue(4); // path
         if (!keep.contains(file)) {
             superfluousPaths.append(file);
             DownloadInfo info;
@@ -1538,35 +2573,68 @@ QVector<uint> SyncJournalDb::deleteStaleUploadInfos(const QSet<QString> &keep)
     return ids;
 }
 
+// If the file system is case preserving, the blacklist is checked case
+// insensitively, like COLLATE NOCASE does
+static QString errorBlacklistKey(const QString &path)
+{
+    if (!Utility::fsCasePreserving())
+        return path;
+    QString key = path;
+    for (QChar &c : key) {
+        if (c.unicode() < 128)
+            c = c.toLower();
+    }
+    return key;
+}
+
+bool SyncJournalDb::loadErrorBlacklist()
+{
+    if (_errorBlacklistLoaded)
+        return true;
+    if (!checkConnect())
+        return false;
+
+    SqlQuery query("SELECT path, lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, "
+                   "ignoreDuration, renameTarget, errorCategory FROM blacklist",
+        _db);
+    if (!query.exec()) {
+        sqlFail("Reading the blacklist failed", query);
+        return false;
+    }
+    _errorBlacklist.clear();
+    while (query.next()) {
+        SyncJournalErrorBlacklistRecord entry;
+        entry._file = query.stringValue(0);
+        entry._lastTryEtag = query.baValue(1);
+        entry._lastTryModtime = query.int64Value(2);
+        entry._retryCount = query.intValue(3);
+        entry._errorString = query.stringValue(4);
+        entry._lastTryTime = query.int64Value(5);
+        entry._ignoreDuration = query.int64Value(6);
+        entry._renameTarget = query.stringValue(7);
+        entry._errorCategory = static_cast<SyncJournalErrorBlacklistRecord::Category>(query.intValue(8));
+        _errorBlacklist.insert(errorBlacklistKey(entry._file), entry);
+    }
+    _errorBlacklistLoaded = true;
+    ++_lookupCacheStatistics._errorBlacklistMisses;
+    qCInfo(lcDb) << "Read" << _errorBlacklist.size() << "blacklist entries";
+    return true;
+}
+
 SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString &file)
 {
     QMutexLocker locker(&_mutex);
     SyncJournalErrorBlacklistRecord entry;
 
-    if (file.isEmpty())
+    if (file.isEmpty() || !loadErrorBlacklist())
         return entry;
 
-    // SELECT lastTryEtag, lastTryModtime, retrycount, errorstring
-
-    if (checkConnect()) {
-        _getErrorBlacklistQuery->reset_and_clear_bindings();
-        _getErrorBlacklistQuery->bindValue(1, file);
-        if (_getErrorBlacklistQuery->exec()) {
-            if (_getErrorBlacklistQuery->next()) {
-                entry._lastTryEtag = _getErrorBlacklistQuery->baValue(0);
-                entry._lastTryModtime = _getErrorBlacklistQuery->int64Value(1);
-                entry._retryCount = _getErrorBlacklistQuery->intValue(2);
-                entry._errorString = _getErrorBlacklistQuery->stringValue(3);
-                entry._lastTryTime = _getErrorBlacklistQuery->int64Value(4);
-                entry._ignoreDuration = _getErrorBlacklistQuery->int64Value(5);
-                entry._renameTarget = _getErrorBlacklistQuery->stringValue(6);
-                entry._errorCategory = static_cast<SyncJournalErrorBlacklistRecord::Category>(
-                    _getErrorBlacklistQuery->intValue(7));
-                entry._file = file;
-            }
-        }
+    ++_lookupCacheStatistics._errorBlacklistHits;
+    auto it = _errorBlacklist.constFind(errorBlacklistKey(file));
+    if (it != _errorBlacklist.constEnd()) {
+        entry = *it;
+        entry._file = file;
     }
-
     return entry;
 }
 
@@ -1594,6 +2662,11 @@ bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QSet<QString> &keep)
         }
     }
 
+    // Read again by the next lookup, the rows of paths that differ only by
+    // case aren't all in memory
+    _errorBlacklist.clear();
+    _errorBlacklistLoaded = false;
+
     SqlQuery delQuery(_db);
     delQuery.prepare("DELETE FROM blacklist WHERE path = ?");
     return deleteBatch(delQuery, superfluousPaths, "blacklist");
@@ -1620,6 +2693,8 @@ int SyncJournalDb::errorBlackListEntryCount()
 int SyncJournalDb::wipeErrorBlacklist()
 {
     QMutexLocker locker(&_mutex);
+    _errorBlacklist.clear();
+    _errorBlacklistLoaded = false;
     if (checkConnect()) {
         SqlQuery query(_db);
 
@@ -1649,6 +2724,10 @@ void SyncJournalDb::wipeErrorBlacklistEntry(const QString &file)
         if (!query.exec()) {
             sqlFail("Deletion of blacklist item failed.", query);
         }
+        // Only the exact path is deleted
+        auto it = _errorBlacklist.find(errorBlacklistKey(file));
+        if (it != _errorBlacklist.end() && it->_file == file)
+            _errorBlacklist.erase(it);
     }
 }
 
@@ -1663,6 +2742,12 @@ void SyncJournalDb::wipeErrorBlacklistCategory(SyncJournalErrorBlacklistRecord::
         if (!query.exec()) {
             sqlFail("Deletion of blacklist category failed.", query);
         }
+        for (auto it = _errorBlacklist.begin(); it != _errorBlacklist.end();) {
+            if (it->_errorCategory == category)
+                it = _errorBlacklist.erase(it);
+            else
+                ++it;
+        }
     }
 }
 
@@ -1689,7 +2774,14 @@ void SyncJournalDb::setErrorBlacklistEntry(const SyncJournalErrorBlacklistRecord
     _setErrorBlacklistQuery->bindValue(7, item._ignoreDuration);
     _setErrorBlacklistQuery->bindValue(8, item._renameTarget);
     _setErrorBlacklistQuery->bindValue(9, item._errorCategory);
-    _setErrorBlacklistQuery->exec();
+    if (!_setErrorBlacklistQuery->exec()) {
+        // Read again by the next lookup, it's not known what the table has
+        _errorBlacklist.clear();
+        _errorBlacklistLoaded = false;
+        return;
+    }
+    if (_errorBlacklistLoaded)
+        _errorBlacklist.insert(errorBlacklistKey(item._file), item);
 }
 
 QVector<SyncJournalDb::PollInfo> SyncJournalDb::getPollInfos()
@@ -1797,15 +2889,16 @@ void SyncJournalDb::setSelectiveSyncList(SyncJournalDb::SelectiveSyncListType ty
 void SyncJournalDb::avoidRenamesOnNextSync(const QByteArray &path)
 {
     QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
+    _fileRecordCache.clear();
 
     if (!checkConnect()) {
         return;
     }
 
     SqlQuery query(_db);
-    query.prepare("UPDATE metadata SET fileid = '', inode = '0' WHERE path == ?1 OR path LIKE(?2||'/%')");
+    query.prepare("UPDATE metadata SET fileid = '', inode = '0' WHERE path == ?1 OR (path > (?1||'/') AND path < (?1||'0'))");
     query.bindValue(1, path);
-    query.bindValue(2, path);
     query.exec();
 
     // We also need to remove the ETags so the update phase refreshes the directory paths
@@ -1820,17 +2913,23 @@ void SyncJournalDb::avoidReadFromDbOnNextSync(const QByteArray &fileName)
     // We achieve that by clearing the etag of the parents directory recursively
 
     QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
+    _fileRecordCache.clear();
 
     if (!checkConnect()) {
         return;
     }
 
-    SqlQuery query(_db);
-    // This query will match entries for which the path is a prefix of fileName
+    // Look the parent directories up by their phash instead of matching
+    // every path in the table against fileName
     // Note: CSYNC_FTW_TYPE_DIR == 2
-    query.prepare("UPDATE metadata SET md5='_invalid_' WHERE ?1 LIKE(path||'/%') AND type == 2;");
-    query.bindValue(1, fileName);
-    query.exec();
+    SqlQuery query(_db);
+    query.prepare("UPDATE metadata SET md5='_invalid_' WHERE phash == ?1 AND type == 2;");
+    for (int slash = fileName.indexOf('/'); slash > 0; slash = fileName.indexOf('/', slash + 1)) {
+        query.reset_and_clear_bindings();
+        query.bindValue(1, getPHash(fileName.left(slash)));
+        query.exec();
+    }
 
     // Prevent future overwrite of the etag for this sync
     _avoidReadFromDbOnNextSyncFilter.append(fileName);
@@ -1839,6 +2938,7 @@ void SyncJournalDb::avoidReadFromDbOnNextSync(const QByteArray &fileName)
 void SyncJournalDb::forceRemoteDiscoveryNextSync()
 {
     QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
 
     if (!checkConnect()) {
         return;
@@ -1847,12 +2947,29 @@ void SyncJournalDb::forceRemoteDiscoveryNextSync()
     forceRemoteDiscoveryNextSyncLocked();
 }
 
+void SyncJournalDb::forceRemoteDiscoveryOfIgnoredFilesNextSync()
+{
+    QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
+
+    if (!checkConnect()) {
+        return;
+    }
+
+    SqlQuery query(_db);
+    query.prepare("UPDATE metadata SET md5='_invalid_' WHERE type=2 AND ignoredChildrenRemote > 0;");
+    query.exec();
+    qCInfo(lcDb) << "Forcing remote re-discovery of" << query.numRowsAffected() << "folders with ignored files";
+    _fileRecordCache.clear();
+}
+
 void SyncJournalDb::forceRemoteDiscoveryNextSyncLocked()
 {
     qCInfo(lcDb) << "Forcing remote re-discovery by deleting folder Etags";
     SqlQuery deleteRemoteFolderEtagsQuery(_db);
     deleteRemoteFolderEtagsQuery.prepare("UPDATE metadata SET md5='_invalid_' WHERE type=2;");
     deleteRemoteFolderEtagsQuery.exec();
+    _fileRecordCache.clear();
 }
 
 
@@ -1941,9 +3058,492 @@ void SyncJournalDb::setDataFingerprint(const QByteArray &dataFingerprint)
 void SyncJournalDb::clearFileTable()
 {
     QMutexLocker lock(&_mutex);
+    _pendingFileRecords.clear();
+    _pendingFileRecordIndex.clear();
+    _fileRecordCache.clear();
+    // Without a WHERE, the rows are dropped without calling the update hook
+    invalidateLocalFileSnapshot();
     SqlQuery query(_db);
     query.prepare("DELETE FROM metadata;");
     query.exec();
+    query.prepare("DELETE FROM localdirinfo;");
+    query.exec();
+    query.prepare("DELETE FROM watchercursor;");
+    query.exec();
+    query.prepare("DELETE FROM discoverylisting;");
+    query.exec();
+    query.prepare("DELETE FROM blockchecksums;");
+    query.exec();
+    query.prepare("DELETE FROM checksumcache;");
+    query.exec();
+}
+
+namespace {
+    struct LocalFileSnapshotHeader
+    {
+        quint64 magic;
+        quint32 version;
+        quint32 reserved;
+        quint64 count;
+        // Must be the one in the journal, see bumpLocalFileSnapshotGeneration()
+        quint64 generation;
+    };
+
+    // Also tells a snapshot written with another byte order
+    const quint64 LocalFileSnapshotMagic = Q_UINT64_C(0x6f63736e61707368);
+    const quint32 LocalFileSnapshotVersion = 2;
+
+    qint64 localFileSnapshotSize(qint64 count)
+    {
+        return sizeof(LocalFileSnapshotHeader)
+            + count * (sizeof(qint64) + sizeof(SyncJournalDb::LocalFileSnapshot::Stat));
+    }
+}
+
+const qint64 *SyncJournalDb::LocalFileSnapshot::phashes() const
+{
+    const uchar *data = _mapped ? _mapped : reinterpret_cast<const uchar *>(_buffer.constData());
+    return reinterpret_cast<const qint64 *>(data + sizeof(LocalFileSnapshotHeader));
+}
+
+const SyncJournalDb::LocalFileSnapshot::Stat *SyncJournalDb::LocalFileSnapshot::stats() const
+{
+    return reinterpret_cast<const Stat *>(phashes() + _count);
+}
+
+bool SyncJournalDb::LocalFileSnapshot::matches(const QByteArray &path, qint64 modtime,
+    qint64 fileSize, quint64 inode, int type) const
+{
+    if (_count == 0)
+        return false;
+    const qint64 phash = getPHash(path);
+    const qint64 *begin = phashes();
+    const qint64 *end = begin + _count;
+    const qint64 *it = std::lower_bound(begin, end, phash);
+    if (it == end || *it != phash)
+        return false;
+    const Stat &stat = stats()[it - begin];
+    return stat._modtime == modtime && stat._fileSize == fileSize
+        && stat._inode == inode && stat._type == type;
+}
+
+QString SyncJournalDb::localFileSnapshotFilePath() const
+{
+    return _dbFile + QLatin1String(".snapshot");
+}
+
+bool SyncJournalDb::getLocalFileSnapshot(LocalFileSnapshot *snapshot)
+{
+    QMutexLocker locker(&_mutex);
+    flushFileRecordsLocked(false);
+
+    *snapshot = LocalFileSnapshot();
+    if (!checkConnect())
+        return false;
+    const int records = getFileRecordCount();
+    if (records < 0)
+        return false;
+
+    const qint64 generation = localFileSnapshotGeneration();
+    if (generation < 0)
+        return false;
+
+    if (_localFileSnapshotValid && !_localFileSnapshotOutdated
+        && readLocalFileSnapshot(snapshot, records, generation)) {
+        qCInfo(lcDb) << "Read the snapshot of" << records << "records from" << localFileSnapshotFilePath();
+        return true;
+    }
+
+    // Scanning the table and sorting is faster than walking the phash index
+    SqlQuery query(_db);
+    if (query.prepare("SELECT phash, modtime, filesize, inode, type FROM metadata") != 0 || !query.exec())
+        return false;
+    std::vector<std::pair<qint64, LocalFileSnapshot::Stat>> rows;
+    rows.reserve(records);
+    while (query.next()) {
+        LocalFileSnapshot::Stat stat;
+        stat._modtime = static_cast<qint64>(query.int64Value(1));
+        stat._fileSize = static_cast<qint64>(query.int64Value(2));
+        stat._inode = query.int64Value(3);
+        stat._type = query.intValue(4);
+        rows.emplace_back(static_cast<qint64>(query.int64Value(0)), stat);
+    }
+    std::sort(rows.begin(), rows.end(), [](const std::pair<qint64, LocalFileSnapshot::Stat> &a,
+                                              const std::pair<qint64, LocalFileSnapshot::Stat> &b) {
+        return a.first < b.first;
+    });
+
+    const int count = static_cast<int>(rows.size());
+    snapshot->_buffer.resize(localFileSnapshotSize(count));
+    snapshot->_count = count;
+    char *data = snapshot->_buffer.data();
+    // A file of an earlier state of the journal can't match anymore
+    const qint64 newGeneration = generation + 1;
+    if (!setLocalFileSnapshotGeneration(newGeneration))
+        return true;
+    const LocalFileSnapshotHeader header = { LocalFileSnapshotMagic, LocalFileSnapshotVersion, 0, quint64(count), quint64(newGeneration) };
+    memcpy(data, &header, sizeof(header));
+    auto phashes = reinterpret_cast<qint64 *>(data + sizeof(header));
+    auto stats = reinterpret_cast<LocalFileSnapshot::Stat *>(phashes + count);
+    for (int i = 0; i < count; ++i) {
+        phashes[i] = rows[i].first;
+        stats[i] = rows[i].second;
+    }
+
+    QSaveFile file(localFileSnapshotFilePath());
+    if (!file.open(QIODevice::WriteOnly) || file.write(snapshot->_buffer) != snapshot->_buffer.size()
+        || !file.commit()) {
+        qCWarning(lcDb) << "Could not write the snapshot" << file.fileName() << file.errorString();
+        return true;
+    }
+    FileSystem::setFileHidden(localFileSnapshotFilePath(), true);
+    _localFileSnapshotValid = true;
+    _localFileSnapshotOutdated = false;
+    return true;
+}
+
+bool SyncJournalDb::readLocalFileSnapshot(LocalFileSnapshot *snapshot, int records, qint64 generation)
+{
+    QSharedPointer<QFile> file(new QFile(localFileSnapshotFilePath()));
+    if (!file->open(QIODevice::ReadOnly))
+        return false;
+    if (file->size() != localFileSnapshotSize(records)) {
+        qCInfo(lcDb) << "The snapshot" << file->fileName() << "doesn't have" << records << "records";
+        return false;
+    }
+
+#ifdef Q_OS_WIN
+    // A mapped file could not be removed by invalidateLocalFileSnapshot()
+    snapshot->_buffer = file->readAll();
+    if (snapshot->_buffer.size() != file->size())
+        return false;
+    const uchar *data = reinterpret_cast<const uchar *>(snapshot->_buffer.constData());
+#else
+    const uchar *data = file->map(0, file->size());
+    if (!data)
+        return false;
+    snapshot->_mappedFile = file;
+    snapshot->_mapped = data;
+#endif
+
+    LocalFileSnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != LocalFileSnapshotMagic || header.version != LocalFileSnapshotVersion
+        || header.count != quint64(records)) {
+        qCInfo(lcDb) << "The snapshot" << file->fileName() << "is for another version or journal";
+        *snapshot = LocalFileSnapshot();
+        return false;
+    }
+    if (header.generation != quint64(generation)) {
+        qCInfo(lcDb) << "The snapshot" << file->fileName() << "has the generation" << header.generation
+                     << "instead of" << generation;
+        *snapshot = LocalFileSnapshot();
+        return false;
+    }
+    snapshot->_count = records;
+    return true;
+}
+
+qint64 SyncJournalDb::localFileSnapshotGeneration()
+{
+    SqlQuery query(_db);
+    if (query.prepare("SELECT generation FROM snapshotgeneration") != 0 || !query.exec()) {
+        qCWarning(lcDb) << "Could not read the snapshot generation" << query.error();
+        return -1;
+    }
+    return query.next() ? static_cast<qint64>(query.int64Value(0)) : 0;
+}
+
+bool SyncJournalDb::setLocalFileSnapshotGeneration(qint64 generation)
+{
+    SqlQuery query(_db);
+    if (query.prepare("INSERT OR REPLACE INTO snapshotgeneration (rowid, generation) VALUES (1, ?1)") != 0) {
+        qCWarning(lcDb) << "Could not write the snapshot generation" << query.error();
+        return false;
+    }
+    query.bindValue(1, generation);
+    if (!query.exec()) {
+        qCWarning(lcDb) << "Could not write the snapshot generation" << query.error();
+        return false;
+    }
+    return true;
+}
+
+void SyncJournalDb::bumpLocalFileSnapshotGeneration()
+{
+    const qint64 generation = localFileSnapshotGeneration();
+    if (generation >= 0 && setLocalFileSnapshotGeneration(generation + 1))
+        _localFileSnapshotOutdated = false;
+}
+
+void SyncJournalDb::invalidateLocalFileSnapshot()
+{
+    // Even if the file can't be removed, its generation won't match
+    _localFileSnapshotOutdated = true;
+    if (!_localFileSnapshotValid)
+        return;
+    _localFileSnapshotValid = false;
+    const QString fileName = localFileSnapshotFilePath();
+    if (QFile::exists(fileName) && !QFile::remove(fileName))
+        qCWarning(lcDb) << "Could not remove the outdated snapshot" << fileName;
+}
+
+bool SyncJournalDb::getLocalDirectoryInfo(const QByteArray &path, LocalDirectoryInfo *info)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return false;
+    }
+
+    _getLocalDirectoryInfoQuery->reset_and_clear_bindings();
+    _getLocalDirectoryInfoQuery->bindValue(1, getPHash(path));
+    if (!_getLocalDirectoryInfoQuery->exec() || !_getLocalDirectoryInfoQuery->next()) {
+        return false;
+    }
+
+    info->_modtime = _getLocalDirectoryInfoQuery->int64Value(0);
+    info->_inode = _getLocalDirectoryInfoQuery->int64Value(1);
+    return true;
+}
+
+void SyncJournalDb::setLocalDirectoryInfo(const QByteArray &path, const LocalDirectoryInfo &info)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return;
+    }
+
+    _setLocalDirectoryInfoQuery->reset_and_clear_bindings();
+    _setLocalDirectoryInfoQuery->bindValue(1, getPHash(path));
+    _setLocalDirectoryInfoQuery->bindValue(2, info._modtime);
+    _setLocalDirectoryInfoQuery->bindValue(3, info._inode);
+    if (!_setLocalDirectoryInfoQuery->exec()) {
+        qCWarning(lcDb) << "Error storing local directory info" << path << _setLocalDirectoryInfoQuery->error();
+    }
+}
+
+void SyncJournalDb::clearLocalDirectoryInfos()
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return;
+    }
+
+    SqlQuery query(_db);
+    query.prepare("DELETE FROM localdirinfo;");
+    query.exec();
+}
+
+QByteArray SyncJournalDb::watcherCursor()
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return QByteArray();
+    }
+
+    SqlQuery query(_db);
+    query.prepare("SELECT cursor FROM watchercursor;");
+    if (!query.exec() || !query.next()) {
+        return QByteArray();
+    }
+    return query.baValue(0);
+}
+
+void SyncJournalDb::setWatcherCursor(const QByteArray &cursor)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return;
+    }
+
+    SqlQuery query(_db);
+    query.prepare("DELETE FROM watchercursor;");
+    query.exec();
+    if (cursor.isEmpty())
+        return;
+    query.prepare("INSERT INTO watchercursor (cursor) VALUES (?1);");
+    query.bindValue(1, cursor);
+    if (!query.exec()) {
+        qCWarning(lcDb) << "Error storing the watcher cursor" << query.error();
+    }
+}
+
+QVector<SyncJournalDb::SyncMetricsEntry> SyncJournalDb::syncMetricsHistory()
+{
+    QMutexLocker locker(&_mutex);
+    QVector<SyncMetricsEntry> history;
+    if (!checkConnect()) {
+        return history;
+    }
+
+    SqlQuery query(_db);
+    query.prepare("SELECT finished, metrics FROM syncmetrics ORDER BY rowid;");
+    if (!query.exec()) {
+        return history;
+    }
+    while (query.next()) {
+        SyncMetricsEntry entry;
+        entry._finished = QDateTime::fromMSecsSinceEpoch(query.int64Value(0));
+        entry._metrics = query.baValue(1);
+        history.append(entry);
+    }
+    return history;
+}
+
+void SyncJournalDb::addSyncMetrics(const QByteArray &metrics)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return;
+    }
+
+    SqlQuery query(_db);
+    query.prepare("INSERT INTO syncmetrics (finished, metrics) VALUES (?1, ?2);");
+    query.bindValue(1, QDateTime::currentMSecsSinceEpoch());
+    query.bindValue(2, metrics);
+    if (!query.exec()) {
+        qCWarning(lcDb) << "Error storing the sync metrics" << query.error();
+        return;
+    }
+    query.prepare("DELETE FROM syncmetrics WHERE rowid NOT IN"
+                  " (SELECT rowid FROM syncmetrics ORDER BY rowid DESC LIMIT ?1);");
+    query.bindValue(1, int(SyncMetricsHistorySize));
+    query.exec();
+}
+
+QByteArray SyncJournalDb::getDiscoveryListing(const QByteArray &path, const QByteArray &etag)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return QByteArray();
+    }
+
+    _getDiscoveryListingQuery->reset_and_clear_bindings();
+    _getDiscoveryListingQuery->bindValue(1, getPHash(path));
+    if (!_getDiscoveryListingQuery->exec() || !_getDiscoveryListingQuery->next()) {
+        return QByteArray();
+    }
+    if (_getDiscoveryListingQuery->baValue(0) != etag) {
+        // The directory changed on the server since it was listed
+        return QByteArray();
+    }
+    return _getDiscoveryListingQuery->baValue(1);
+}
+
+void SyncJournalDb::setDiscoveryListing(const QByteArray &path, const QByteArray &etag, const QByteArray &listing)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return;
+    }
+
+    _setDiscoveryListingQuery->reset_and_clear_bindings();
+    _setDiscoveryListingQuery->bindValue(1, getPHash(path));
+    _setDiscoveryListingQuery->bindValue(2, etag);
+    _setDiscoveryListingQuery->bindValue(3, listing);
+    if (!_setDiscoveryListingQuery->exec()) {
+        qCWarning(lcDb) << "Error storing discovery listing" << path << _setDiscoveryListingQuery->error();
+    }
+}
+
+bool SyncJournalDb::hasDiscoveryListings()
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return false;
+    }
+
+    SqlQuery query(_db);
+    query.prepare("SELECT 1 FROM discoverylisting LIMIT 1;");
+    return query.exec() && query.next();
+}
+
+void SyncJournalDb::clearDiscoveryListings()
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return;
+    }
+
+    SqlQuery query(_db);
+    query.prepare("DELETE FROM discoverylisting;");
+    query.exec();
+}
+
+QByteArray SyncJournalDb::getCachedChecksum(quint64 inode, qint64 modtime, qint64 size, const QByteArray &checksumType)
+{
+    QMutexLocker locker(&_mutex);
+    if (inode == 0 || checksumType.isEmpty() || !checkConnect()) {
+        return QByteArray();
+    }
+
+    _getCachedChecksumQuery->reset_and_clear_bindings();
+    _getCachedChecksumQuery->bindInt64(1, qint64(inode));
+    if (!_getCachedChecksumQuery->exec() || !_getCachedChecksumQuery->next()) {
+        return QByteArray();
+    }
+    if (_getCachedChecksumQuery->int64Value(0) != modtime || _getCachedChecksumQuery->int64Value(1) != size) {
+        // The file changed since it was hashed
+        return QByteArray();
+    }
+    const QByteArray checksumHeader = _getCachedChecksumQuery->baValue(2);
+    if (parseChecksumHeaderType(checksumHeader) != checksumType) {
+        return QByteArray();
+    }
+    return checksumHeader;
+}
+
+void SyncJournalDb::setCachedChecksum(quint64 inode, qint64 modtime, qint64 size, const QByteArray &checksumHeader)
+{
+    QMutexLocker locker(&_mutex);
+    if (inode == 0 || checksumHeader.isEmpty() || !checkConnect()) {
+        return;
+    }
+
+    _setCachedChecksumQuery->reset_and_clear_bindings();
+    _setCachedChecksumQuery->bindInt64(1, qint64(inode));
+    _setCachedChecksumQuery->bindInt64(2, modtime);
+    _setCachedChecksumQuery->bindInt64(3, size);
+    _setCachedChecksumQuery->bindValue(4, checksumHeader);
+    if (!_setCachedChecksumQuery->exec()) {
+        qCWarning(lcDb) << "Error storing the cached checksum" << inode << _setCachedChecksumQuery->error();
+    }
+}
+
+QByteArray SyncJournalDb::getBlockChecksums(const QByteArray &path, const QByteArray &etag, qint64 blockSize)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return QByteArray();
+    }
+
+    _getBlockChecksumsQuery->reset_and_clear_bindings();
+    _getBlockChecksumsQuery->bindValue(1, getPHash(path));
+    if (!_getBlockChecksumsQuery->exec() || !_getBlockChecksumsQuery->next()) {
+        return QByteArray();
+    }
+    if (_getBlockChecksumsQuery->baValue(0) != etag || _getBlockChecksumsQuery->int64Value(1) != blockSize) {
+        // The file was changed by someone else since
+        return QByteArray();
+    }
+    return _getBlockChecksumsQuery->baValue(2);
+}
+
+void SyncJournalDb::setBlockChecksums(const QByteArray &path, const QByteArray &etag, qint64 blockSize, const QByteArray &checksums)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return;
+    }
+
+    _setBlockChecksumsQuery->reset_and_clear_bindings();
+    _setBlockChecksumsQuery->bindValue(1, getPHash(path));
+    _setBlockChecksumsQuery->bindValue(2, etag);
+    _setBlockChecksumsQuery->bindValue(3, blockSize);
+    _setBlockChecksumsQuery->bindValue(4, checksums);
+    if (!_setBlockChecksumsQuery->exec()) {
+        qCWarning(lcDb) << "Error storing block checksums" << path << _setBlockChecksumsQuery->error();
+    }
 }
 
 void SyncJournalDb::commit(const QString &context, bool startTrans)
@@ -1955,17 +3555,34 @@ void SyncJournalDb::commit(const QString &context, bool startTrans)
 void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 {
     QMutexLocker lock(&_mutex);
-    if (_transaction == 1) {
-        commitInternal(context, true);
-    } else {
+    if (_transaction != 1) {
         startTransaction();
+        return;
     }
+
+    // Each commit syncs the files to disk, while a long transaction makes
+    // the WAL grow and the next checkpoint take long.
+    const bool walTooLarge = _journalMode == QLatin1String("WAL")
+        && QFileInfo(_dbFile + QLatin1String("-wal")).size() >= CommitMaxWalSize;
+    if (!walTooLarge
+        && _lastCommit.isValid() && _lastCommit.elapsed() < _commitInterval
+        && sqlite3_total_changes(_db.sqliteDb()) - _changesAtLastCommit < _commitRows) {
+        return;
+    }
+    commitInternal(context, true);
+    if (walTooLarge)
+        walCheckpoint();
 }
 
 
 void SyncJournalDb::commitInternal(const QString &context, bool startTrans)
 {
     qCDebug(lcDb) << "Transaction commit " << context << (startTrans ? "and starting new transaction" : "");
+    TraceSpan span("journal", context);
+    // The queued records are committed by the writer, except when the
+    // transaction is closed for good.
+    if (!startTrans)
+        flushFileRecordsLocked(false);
     commitTransaction();
 
     if (startTrans) {
@@ -1975,6 +3592,7 @@ void SyncJournalDb::commitInternal(const QString &context, bool startTrans)
 
 SyncJournalDb::~SyncJournalDb()
 {
+    _writerPool.waitForDone();
     close();
 }
 
@@ -1990,7 +3608,8 @@ bool operator==(const SyncJournalDb::DownloadInfo &lhs,
     return lhs._errorCount == rhs._errorCount
         && lhs._etag == rhs._etag
         && lhs._tmpfile == rhs._tmpfile
-        && lhs._valid == rhs._valid;
+        && lhs._valid == rhs._valid
+        && lhs._segments == rhs._segments;
 }
 
 bool operator==(const SyncJournalDb::UploadInfo &lhs,
@@ -22,8 +22,17 @@
 #include <QObject>
 #include <qmutex.h>
 #include <QDateTime>
+#include <QElapsedTimer>
+#include <QCache>
+#include <QFile>
 #include <QHash>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
 #include <functional>
+#include <memory>
+#include <vector>
 
 #include "common/utility.h"
 #include "common/ownsql.h"
@@ -56,16 +65,112 @@ public:
 
     // To verify that the record could be found check with SyncJournalFileRecord::isValid()
     bool getFileRecord(const QString &filename, SyncJournalFileRecord *rec) { return getFileRecord(filename.toUtf8(), rec); }
-    bool getFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec);
+    bool getFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec) { return getFileRecord(filename, getPHash(filename), rec); }
+    /// Like getFileRecord(), with the getPHash() of @a filename computed already
+    bool getFileRecord(const QByteArray &filename, qint64 phash, SyncJournalFileRecord *rec);
     bool getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec);
+
+    /**
+     * Like getFileRecord, for status queries of the GUI and the shell
+     * integration that shouldn't wait for a running sync.
+     *
+     * If the sync holds the lock, the record is read from one of a few
+     * read-only connections instead. Those only see what was committed,
+     * so the result may be a little behind the sync.
+     */
+    bool getFileRecordReadOnly(const QString &filename, SyncJournalFileRecord *rec) { return getFileRecordReadOnly(filename.toUtf8(), rec); }
+    bool getFileRecordReadOnly(const QByteArray &filename, SyncJournalFileRecord *rec);
+
+    /**
+     * Runs @a job with the journal on its worker thread and then @a done in
+     * the thread of @a context, unless @a context was destroyed meanwhile.
+     *
+     * For the GUI, which shouldn't wait while a sync holds the database.
+     * The jobs run one after the other, in the order they were started.
+     */
+    void runAsync(QObject *context, const std::function<void(SyncJournalDb *)> &job, const std::function<void()> &done = {});
+    /// getFileRecordReadOnly() through runAsync(), the record is invalid if there is none or on error
+    void getFileRecordAsync(const QByteArray &filename, QObject *context, const std::function<void(const SyncJournalFileRecord &)> &callback);
     bool getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
+    /// The records of the files with the content checksum \a checksumHeader, like "SHA1:abc"
+    bool getFileRecordsByChecksum(const QByteArray &checksumHeader, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
     bool getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback);
+
+    /// Column order of the rows passed to getFileRowsBelowPath()
+    enum FileRecordColumn {
+        PathColumn = 0,
+        InodeColumn,
+        ModtimeColumn,
+        TypeColumn,
+        EtagColumn,
+        FileIdColumn,
+        RemotePermColumn,
+        FileSizeColumn,
+        IgnoredChildrenRemoteColumn,
+        ChecksumHeaderColumn,
+        PHashColumn
+    };
+
+    /**
+     * Like getFilesBelowPath, but hands out the query positioned on each row
+     * instead of a SyncJournalFileRecord, ordered by path.
+     *
+     * For bulk readers that only need some of the columns or want to build
+     * their own structures without copying every field twice. The values
+     * are only valid during the callback.
+     */
+    bool getFileRowsBelowPath(const QByteArray &path, const std::function<void(SqlQuery &)> &rowCallback);
+    /// Like getFilesBelowPath, but only the direct children of \a path
+    bool getFilesInDirectory(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback);
+    /// Number of records below \a path (not counting \a path itself), -1 on error
+    qint64 getFileRecordCountBelowPath(const QByteArray &path);
+    /**
+     * Stores the record.
+     *
+     * Records are queued and written in batches by a writer thread once
+     * enough of them are pending or after a short delay, see
+     * flushFileRecords(). All other accessors of the file records see the
+     * queued records as if they were written already.
+     *
+     * Returns false if the writing of earlier queued records failed since
+     * the last call, the record is not queued then.
+     */
     bool setFileRecord(const SyncJournalFileRecord &record);
 
+    /// Writes and commits the queued file records, false if any write failed since the last call
+    bool flushFileRecords();
+
+    /**
+     * Hit and miss counts of the in-memory caches in front of
+     * getFileRecord() and errorBlacklistEntry(), for tuning their size.
+     */
+    struct LookupCacheStatistics
+    {
+        qint64 _fileRecordHits = 0;
+        qint64 _fileRecordMisses = 0;
+        // The blacklist is held whole: its lookups and reads of the table
+        qint64 _errorBlacklistHits = 0;
+        qint64 _errorBlacklistMisses = 0;
+        // Held in memory now
+        int _cachedFileRecords = 0;
+        int _cachedErrorBlacklistEntries = 0;
+        int _pendingFileRecords = 0;
+        int _indexedInodes = 0;
+        int _indexedFileIds = 0;
+    };
+    LookupCacheStatistics lookupCacheStatistics();
+
     /// Like setFileRecord, but preserves checksums
     bool setFileRecordMetadata(const SyncJournalFileRecord &record);
 
     bool deleteFileRecord(const QString &filename, bool recursively = false);
+    /**
+     * Moves the records below @a from to below @a to, with one query.
+     *
+     * For the contents of a renamed directory, the record of the directory
+     * itself isn't touched.
+     */
+    bool moveSubtree(const QByteArray &from, const QByteArray &to);
     bool updateFileRecordChecksum(const QString &filename,
         const QByteArray &contentChecksum,
         const QByteArray &contentChecksumType);
@@ -74,6 +179,54 @@ public:
     bool exists();
     void walCheckpoint();
 
+    /// Size and fragmentation of the database files, see maintain()
+    struct FileStatistics
+    {
+        qint64 _pageSize = 0;
+        qint64 _pageCount = 0;
+        qint64 _freelistCount = 0;
+        qint64 _walSize = 0;
+
+        qint64 databaseSize() const { return _pageSize * _pageCount; }
+        qint64 freeSize() const { return _pageSize * _freelistCount; }
+    };
+    FileStatistics fileStatistics();
+
+    /// The value of an integer PRAGMA like "cache_size" on the main connection, -1 on error
+    qint64 pragmaValue(const char *pragma);
+
+    /**
+     * Gives unused pages back to the file system and truncates the WAL.
+     *
+     * Does nothing if there is little to reclaim. Databases that were created
+     * without incremental auto vacuum are converted with a full VACUUM the
+     * first time. Meant to be called while no sync is running since it ends
+     * the current transaction. It holds the journal for as long as it takes,
+     * the GUI runs it through runAsync().
+     *
+     * Returns the number of bytes reclaimed, -1 on error.
+     */
+    qint64 maintain();
+
+    /**
+     * Limits the page cache of each connection to @a kibibytes.
+     *
+     * 0 keeps the size chosen by setAutoTuneLimits(), or the SQLite default
+     * of about 2 MB. Used to bound the memory when many folders are
+     * configured. Takes effect immediately for the open connection.
+     */
+    void setCacheSize(int kibibytes);
+
+    /**
+     * Sizes the page cache and the memory mapping of the database by its
+     * size and the physical memory when it is opened, up to
+     * @a maxCacheSizeKib and @a maxMmapSize bytes.
+     *
+     * 0 keeps the SQLite defaults, see ConfigFile::journalMaxCacheSize().
+     * Takes effect immediately for the open connection.
+     */
+    void setAutoTuneLimits(int maxCacheSizeKib, qint64 maxMmapSize);
+
     QString databaseFilePath() const;
 
     static qint64 getPHash(const QByteArray &);
@@ -95,6 +248,9 @@ public:
         QByteArray _etag;
         int _errorCount;
         bool _valid;
+        /// For a download in parallel segments: the byte ranges, first and
+        /// last byte, that are still missing in the preallocated _tmpfile
+        QVector<QPair<quint64, quint64>> _segments;
     };
     struct UploadInfo
     {
@@ -179,13 +335,34 @@ public:
      */
     void forceRemoteDiscoveryNextSync();
 
-    bool postSyncCleanup(const QSet<QString> &filepathsToKeep,
-        const QSet<QString> &prefixesToKeep);
+    /**
+     * Makes the next sync list the remote directories again that had ignored
+     * files, and their parents, after the exclude patterns changed.
+     *
+     * The flag of the directories goes up to the root, the others come from
+     * the database still.
+     */
+    void forceRemoteDiscoveryOfIgnoredFilesNextSync();
+
+    /**
+     * Deletes the records whose phash is not in the sorted @a phashesToKeep and don't start
+     * with one of @a prefixesToKeep or with one of the sorted, disjoint
+     * @a subtreesToKeep (which end with a slash).
+     */
+    bool postSyncCleanup(const std::vector<qint64> &phashesToKeep,
+        const QSet<QString> &prefixesToKeep,
+        const QStringList &subtreesToKeep = QStringList());
 
     /* Because sqlite transactions are really slow, we encapsulate everything in big transactions
      * Commit will actually commit the transaction and create a new one.
      */
     void commit(const QString &context, bool startTrans = true);
+    /**
+     * Like commit(), but only once a while: after OWNCLOUD_JOURNAL_COMMIT_INTERVAL
+     * msec or OWNCLOUD_JOURNAL_COMMIT_ROWS changed rows since the last commit,
+     * or when the WAL grew large. For the progress of the propagation, which
+     * can be redone after a crash.
+     */
     void commitIfNeededAndStartNewTransaction(const QString &context);
 
     void close();
@@ -195,6 +372,11 @@ public:
      */
     bool isConnected();
 
+    /**
+     * Number of statements executed on the database, for statistics.
+     */
+    int executedQueryCount() const { return _db.execCount(); }
+
     /**
      * Returns the checksum type for an id.
      */
@@ -213,11 +395,140 @@ public:
      */
     void clearFileTable();
 
-private:
+    /**
+     * Modification time and inode that a local directory had when its
+     * entries were last read from the filesystem by a successful sync.
+     *
+     * Used by LocalDiscoveryStyle::DirectoryModtime to decide whether a
+     * directory needs to be listed again.
+     */
+    struct LocalDirectoryInfo
+    {
+        qint64 _modtime = 0;
+        quint64 _inode = 0;
+    };
+
+    /**
+     * The columns of all file records that tell whether a local file
+     * changed, sorted by phash.
+     *
+     * Read before the local discovery: a file whose stat matches its row is
+     * unchanged, its record doesn't need to be read.
+     *
+     * It is kept next to the journal in a memory-mappable file: a header,
+     * the phashes and the stats, in fixed-width columns. Any write to the
+     * file records removes that file, the journal stays the source of truth.
+     */
+    struct LocalFileSnapshot
+    {
+        struct Stat
+        {
+            qint64 _modtime;
+            qint64 _fileSize;
+            quint64 _inode;
+            qint64 _type;
+        };
+
+        int size() const { return _count; }
+        const qint64 *phashes() const;
+        const Stat *stats() const;
+
+        /// Whether \a path has a record with exactly these values
+        bool matches(const QByteArray &path, qint64 modtime, qint64 fileSize, quint64 inode, int type) const;
+
+        // The content of the file, either read or built or mapped
+        QByteArray _buffer;
+        QSharedPointer<QFile> _mappedFile;
+        const uchar *_mapped = nullptr;
+        int _count = 0;
+    };
+    /// Maps the file of the snapshot, or builds it from the records and writes the file
+    bool getLocalFileSnapshot(LocalFileSnapshot *snapshot);
+    QString localFileSnapshotFilePath() const;
+
+    /// Returns false if there is no info for \a path
+    bool getLocalDirectoryInfo(const QByteArray &path, LocalDirectoryInfo *info);
+    void setLocalDirectoryInfo(const QByteArray &path, const LocalDirectoryInfo &info);
+    /// Forces all directories to be listed again by the next DirectoryModtime discovery
+    void clearLocalDirectoryInfos();
+
+    /**
+     * Position in the change journal of the OS at the start of the last
+     * successful sync, see FolderWatcher::cursor().
+     *
+     * The folder watcher replays the changes since then at startup. Empty
+     * if there is none; clearFileTable() removes it.
+     */
+    QByteArray watcherCursor();
+    void setWatcherCursor(const QByteArray &cursor);
+
+    /** The SyncRunMetrics of one finished sync, see syncMetricsHistory() */
+    struct SyncMetricsEntry
+    {
+        QDateTime _finished;
+        QByteArray _metrics; // the compact JSON of SyncRunMetrics::toJson()
+    };
+
+    /** Number of syncs syncMetricsHistory() keeps */
+    enum { SyncMetricsHistorySize = 200 };
+
+    /**
+     * The metrics of the last syncs of this folder, oldest first.
+     *
+     * They show whether the syncs of a folder get slower as it grows. Unlike
+     * the file records, they are kept by clearFileTable().
+     */
+    QVector<SyncMetricsEntry> syncMetricsHistory();
+    /// Adds the metrics of a sync that finished now and drops the oldest ones
+    void addSyncMetrics(const QByteArray &metrics);
+
+    /**
+     * Directory listings of an interrupted discovery.
+     *
+     * The discovery stores the raw result of every remote directory it
+     * listed while no sync completed yet, so that a restarted sync doesn't
+     * have to list the whole server again. A listing is only returned if
+     * the directory still has the same \a etag.
+     */
+    QByteArray getDiscoveryListing(const QByteArray &path, const QByteArray &etag);
+    void setDiscoveryListing(const QByteArray &path, const QByteArray &etag, const QByteArray &listing);
+    bool hasDiscoveryListings();
+    /// Called once a sync completed, the file records then hold the same information
+    void clearDiscoveryListings();
+
+    /**
+     * Checksums of the fixed size blocks of a file, for the delta uploads.
+     *
+     * \a checksums is the concatenation of the binary SHA1 of every block of
+     * \a blockSize bytes, see computeBlockChecksums(). They are only returned
+     * while the file on the server still has the \a etag and the same block size.
+     */
+    QByteArray getBlockChecksums(const QByteArray &path, const QByteArray &etag, qint64 blockSize);
+    void setBlockChecksums(const QByteArray &path, const QByteArray &etag, qint64 blockSize, const QByteArray &checksums);
+
+    /**
+     * A checksum header of the content of the local file with \a inode.
+     *
+     * Only returned while the file still has the \a modtime and \a size it
+     * had when it was hashed, and if it is of \a checksumType. The modtime is
+     * in nanoseconds, from FileSystem::getModTimeNsecs(): two writes within the
+     * same second must not share an entry. Filled by the
+     * uploads, the downloads and CSyncChecksumHook so that the same content
+     * isn't hashed again, for example when an upload is retried.
+     */
+    QByteArray getCachedChecksum(quint64 inode, qint64 modtime, qint64 size, const QByteArray &checksumType);
+    void setCachedChecksum(quint64 inode, qint64 modtime, qint64 size, const QByteArray &checksumHeader);
+
+    /// Number of file records, -1 on error
     int getFileRecordCount();
+    /// Whether there is any file record, without counting all of them
+    bool hasFileRecords();
+
+private:
     bool updateDatabaseStructure();
     bool updateMetadataTableStructure();
     bool updateErrorBlacklistTableStructure();
+    bool updateDownloadInfoTableStructure();
     bool sqlFail(const QString &log, const SqlQuery &query);
     void commitInternal(const QString &context, bool startTrans = true);
     void startTransaction();
@@ -225,6 +536,15 @@ private:
     QStringList tableColumns(const QString &table);
     bool checkConnect();
 
+    // Both expect the mutex to be held
+    bool writeFileRecord(const SyncJournalFileRecord &record);
+    bool flushFileRecordsLocked(bool commit);
+    void scheduleFileRecordFlush();
+
+    struct ReadConnection;
+    std::unique_ptr<ReadConnection> takeReadConnection();
+    void closeReadConnections();
+
     // Same as forceRemoteDiscoveryNextSync but without acquiring the lock
     void forceRemoteDiscoveryNextSyncLocked();
 
@@ -237,13 +557,23 @@ private:
     QString _dbFile;
     QMutex _mutex; // Public functions are protected with the mutex.
     int _transaction;
+    // See commitIfNeededAndStartNewTransaction()
+    QElapsedTimer _lastCommit;
+    int _changesAtLastCommit = 0;
+    int _commitInterval;
+    int _commitRows;
+    bool _walCheckpointScheduled = false;
     bool _metadataTableIsEmpty;
 
     // NOTE! when adding a query, don't forget to reset it in SyncJournalDb::close
     QScopedPointer<SqlQuery> _getFileRecordQuery;
     QScopedPointer<SqlQuery> _getFileRecordQueryByInode;
     QScopedPointer<SqlQuery> _getFileRecordQueryByFileId;
+    QScopedPointer<SqlQuery> _getFileRecordQueryByChecksum;
     QScopedPointer<SqlQuery> _getFilesBelowPathQuery;
+    QScopedPointer<SqlQuery> _getFilesInDirectoryQuery;
+    QScopedPointer<SqlQuery> _getFileRecordCountBelowPathQuery;
+    QScopedPointer<SqlQuery> _getFilesInRootQuery;
     QScopedPointer<SqlQuery> _getAllFilesQuery;
     QScopedPointer<SqlQuery> _setFileRecordQuery;
     QScopedPointer<SqlQuery> _setFileRecordChecksumQuery;
@@ -256,7 +586,6 @@ private:
     QScopedPointer<SqlQuery> _deleteUploadInfoQuery;
     QScopedPointer<SqlQuery> _deleteFileRecordPhash;
     QScopedPointer<SqlQuery> _deleteFileRecordRecursively;
-    QScopedPointer<SqlQuery> _getErrorBlacklistQuery;
     QScopedPointer<SqlQuery> _setErrorBlacklistQuery;
     QScopedPointer<SqlQuery> _getSelectiveSyncListQuery;
     QScopedPointer<SqlQuery> _getChecksumTypeIdQuery;
@@ -265,6 +594,15 @@ private:
     QScopedPointer<SqlQuery> _getDataFingerprintQuery;
     QScopedPointer<SqlQuery> _setDataFingerprintQuery1;
     QScopedPointer<SqlQuery> _setDataFingerprintQuery2;
+    QScopedPointer<SqlQuery> _getLocalDirectoryInfoQuery;
+    QScopedPointer<SqlQuery> _setLocalDirectoryInfoQuery;
+    QScopedPointer<SqlQuery> _deleteLocalDirectoryInfoQuery;
+    QScopedPointer<SqlQuery> _getDiscoveryListingQuery;
+    QScopedPointer<SqlQuery> _setDiscoveryListingQuery;
+    QScopedPointer<SqlQuery> _getBlockChecksumsQuery;
+    QScopedPointer<SqlQuery> _setBlockChecksumsQuery;
+    QScopedPointer<SqlQuery> _getCachedChecksumQuery;
+    QScopedPointer<SqlQuery> _setCachedChecksumQuery;
 
     /* This is the list of paths we called avoidReadFromDbOnNextSync on.
      * It means that they should not be written to the DB in any case since doing
@@ -272,6 +610,85 @@ private:
      */
     QList<QByteArray> _avoidReadFromDbOnNextSyncFilter;
 
+    /* File records not written yet, in the order they were set. The index
+     * maps the path to the position of the latest record for it.
+     */
+    QVector<SyncJournalFileRecord> _pendingFileRecords;
+    QHash<QByteArray, int> _pendingFileRecordIndex;
+    int _fileRecordBatchSize;
+    bool _fileRecordFlushScheduled;
+    // A flush failed, the next setFileRecord() or flushFileRecords() returns false
+    bool _fileRecordWriteFailed = false;
+    QTimer _fileRecordFlushTimer;
+    // Also runs the jobs of runAsync()
+    QThreadPool _writerPool;
+
+    /* Results of getFileRecord() by phash, including the ones that were not
+     * found. Writes invalidate them.
+     */
+    QCache<qint64, SyncJournalFileRecord> _fileRecordCache;
+
+    /* The whole blacklist table, read by the first errorBlacklistEntry().
+     * The writes update it.
+     */
+    bool loadErrorBlacklist();
+    QHash<QString, SyncJournalErrorBlacklistRecord> _errorBlacklist;
+    bool _errorBlacklistLoaded = false;
+    LookupCacheStatistics _lookupCacheStatistics;
+
+    /* The phash of the record of each inode, for getFileRecordByInode(). It
+     * is built from all records once the rename detection of a sync asks for
+     * many inodes, the writes add to it and close() drops it. An entry can
+     * be stale, it is checked against the record.
+     */
+    bool buildInodeIndex();
+    QHash<quint64, qint64> _inodeIndex;
+    bool _inodeIndexBuilt = false;
+    int _inodeLookups = 0;
+
+    /* The same for getFileRecordsByFileId() and the remote rename detection,
+     * keyed by getPHash() of the file id to keep the ids out of memory.
+     */
+    bool buildFileIdIndex();
+    QMultiHash<qint64, qint64> _fileIdIndex;
+    bool _fileIdIndexBuilt = false;
+    int _fileIdLookups = 0;
+
+    /* Whether the snapshot file may match the records, see LocalFileSnapshot.
+     * Cleared by the update hook of the connection on the first write. */
+    bool readLocalFileSnapshot(LocalFileSnapshot *snapshot, int records, qint64 generation);
+    void invalidateLocalFileSnapshot();
+    bool _localFileSnapshotValid = false;
+
+    /* The snapshot file has the generation of the journal it was written
+     * for. It changes with each written snapshot and with the commit of the
+     * writes that outdated one, so a file that couldn't be removed or that
+     * outlived a crash is never used. */
+    qint64 localFileSnapshotGeneration();
+    bool setLocalFileSnapshotGeneration(qint64 generation);
+    void bumpLocalFileSnapshotGeneration();
+    bool _localFileSnapshotOutdated = false;
+
+    /* Idle read-only connections used by getFileRecordReadOnly(). They are
+     * only handed out while the database is open in WAL mode, where readers
+     * don't block the writer and the other way around.
+     */
+    QMutex _readConnectionsMutex;
+    std::vector<std::unique_ptr<ReadConnection>> _readConnections;
+    int _readConnectionCount;
+    int _readConnectionGeneration;
+    bool _readConnectionsEnabled;
+
+    /// See setCacheSize(), protected by _readConnectionsMutex
+    int _cacheSizeKib;
+
+    /// See setAutoTuneLimits(), protected by _readConnectionsMutex
+    void autoTune();
+    int _maxCacheSizeKib = 0;
+    qint64 _maxMmapSize = 0;
+    int _autoCacheSizeKib = 0;
+    qint64 _mmapSize = 0;
+
     /** The journal mode to use for the db.
      *
      * Typically WAL initially, but may be set to other modes via environment
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "common/tracing.h"
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcTracing, "sync.tracing", QtInfoMsg)
+
+// Further spans until the next writeFile() are dropped, a trace of a long
+// sync stays within memory
+static const int MaxSpans = 1000000;
+
+namespace {
+    struct Span
+    {
+        const char *category;
+        QString name;
+        QString detail;
+        qint64 start;
+        qint64 duration;
+        int thread; // 0 for an async span
+        int id; // of an async span
+    };
+
+    struct Recorder
+    {
+        Recorder()
+        {
+            timer.start();
+            fileName = QString::fromLocal8Bit(qgetenv("OWNCLOUD_TRACE_FILE"));
+            enabled.store(fileName.isEmpty() ? 0 : 1);
+        }
+
+        void add(const char *category, const QString &name, qint64 start, const QString &detail, bool async)
+        {
+            const qint64 end = timer.nsecsElapsed() / 1000;
+            QMutexLocker lock(&mutex);
+            if (spans.size() >= MaxSpans) {
+                ++dropped;
+                return;
+            }
+            Span span{ category, name, detail, start, end - start, 0, 0 };
+            if (async) {
+                span.id = ++lastId;
+            } else {
+                auto &thread = threads[QThread::currentThreadId()];
+                if (!thread)
+                    thread = threads.size();
+                span.thread = thread;
+            }
+            spans.append(span);
+        }
+
+        QAtomicInt enabled;
+        QElapsedTimer timer;
+        QMutex mutex;
+        QString fileName;
+        QVector<Span> spans;
+        QHash<Qt::HANDLE, int> threads;
+        int lastId = 0;
+        int dropped = 0;
+        bool fileStarted = false; // the "[" of the array was written
+        bool fileHasEvents = false;
+    };
+
+    Q_GLOBAL_STATIC(Recorder, recorder)
+
+    QByteArray event(const Span &span, const char *phase, qint64 ts)
+    {
+        QJsonObject obj;
+        obj.insert(QStringLiteral("name"), span.name);
+        obj.insert(QStringLiteral("cat"), QLatin1String(span.category));
+        obj.insert(QStringLiteral("ph"), QLatin1String(phase));
+        obj.insert(QStringLiteral("ts"), double(ts));
+        obj.insert(QStringLiteral("pid"), 1);
+        if (span.id) {
+            obj.insert(QStringLiteral("id"), span.id);
+            obj.insert(QStringLiteral("tid"), 0);
+        } else {
+            obj.insert(QStringLiteral("tid"), span.thread);
+            obj.insert(QStringLiteral("dur"), double(span.duration));
+        }
+        if (!span.detail.isEmpty() && *phase != 'e')
+            obj.insert(QStringLiteral("args"), QJsonObject{ { QStringLiteral("detail"), span.detail } });
+        return QJsonDocument(obj).toJson(QJsonDocument::Compact);
+    }
+}
+
+bool Tracing::isEnabled()
+{
+    return recorder()->enabled.load();
+}
+
+void Tracing::setOutputFile(const QString &fileName)
+{
+    auto r = recorder();
+    QMutexLocker lock(&r->mutex);
+    r->fileName = fileName;
+    r->fileStarted = false;
+    r->fileHasEvents = false;
+    r->enabled.store(fileName.isEmpty() ? 0 : 1);
+}
+
+qint64 Tracing::now()
+{
+    return recorder()->timer.nsecsElapsed() / 1000;
+}
+
+void Tracing::addSpan(const char *category, const QString &name, qint64 start, const QString &detail)
+{
+    if (isEnabled())
+        recorder()->add(category, name, start, detail, false);
+}
+
+void Tracing::addAsyncSpan(const char *category, const QString &name, qint64 start, const QString &detail)
+{
+    if (isEnabled())
+        recorder()->add(category, name, start, detail, true);
+}
+
+bool Tracing::writeFile()
+{
+    auto r = recorder();
+    QVector<Span> spans;
+    QString fileName;
+    int dropped;
+    bool append;
+    bool needSeparator;
+    {
+        QMutexLocker lock(&r->mutex);
+        if (r->fileName.isEmpty())
+            return false;
+        // The next sync starts with room for MaxSpans again
+        spans.swap(r->spans);
+        fileName = r->fileName;
+        dropped = r->dropped;
+        r->dropped = 0;
+        append = r->fileStarted;
+        needSeparator = r->fileHasEvents;
+        r->fileStarted = true;
+        r->fileHasEvents = r->fileHasEvents || !spans.isEmpty();
+    }
+
+    QFile file(fileName);
+    if (!file.open(append ? QIODevice::Append : (QIODevice::WriteOnly | QIODevice::Truncate))) {
+        qCWarning(lcTracing) << "Could not write the trace to" << fileName << file.errorString();
+        return false;
+    }
+    // The closing "]" is optional, that way the next spans can be appended
+    if (!append)
+        file.write("[\n");
+    foreach (const Span &span, spans) {
+        if (needSeparator)
+            file.write(",\n");
+        needSeparator = true;
+        if (span.id) {
+            file.write(event(span, "b", span.start));
+            file.write(",\n");
+            file.write(event(span, "e", span.start + span.duration));
+        } else {
+            file.write(event(span, "X", span.start));
+        }
+    }
+    if (dropped > 0)
+        qCWarning(lcTracing) << dropped << "spans were dropped from the trace";
+    return file.error() == QFile::NoError;
+}
+}
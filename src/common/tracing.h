@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "ocsynclib.h"
+
+#include <QString>
+
+namespace OCC {
+
+/**
+ * @brief Spans of time for a trace of the sync, in the Chrome trace format
+ *
+ * Tracing is enabled with the OWNCLOUD_TRACE_FILE environment variable or
+ * setOutputFile(). The spans are collected in memory and writeFile() appends
+ * them to the file, in the JSON array format of chrome://tracing and
+ * https://ui.perfetto.dev.
+ *
+ * When tracing is disabled nothing is recorded; callers that need work
+ * to name a span check isEnabled() first.
+ *
+ * @ingroup libsync
+ */
+namespace Tracing {
+    /** Whether spans are recorded */
+    OCSYNC_EXPORT bool isEnabled();
+
+    /** Records the spans from now on and writes them to @a fileName, empty to stop */
+    OCSYNC_EXPORT void setOutputFile(const QString &fileName);
+
+    /** The time in microseconds, for the start of a span */
+    OCSYNC_EXPORT qint64 now();
+
+    /** A span from @a start until now, in the current thread */
+    OCSYNC_EXPORT void addSpan(const char *category, const QString &name, qint64 start,
+        const QString &detail = QString());
+
+    /** A span from @a start until now that may overlap others, like network requests */
+    OCSYNC_EXPORT void addAsyncSpan(const char *category, const QString &name, qint64 start,
+        const QString &detail = QString());
+
+    /** Appends the spans recorded since the last call to the output file, and forgets them */
+    OCSYNC_EXPORT bool writeFile();
+}
+
+/**
+ * @brief Records the lifetime of the object as a span of the current thread
+ * @ingroup libsync
+ */
+class OCSYNC_EXPORT TraceSpan
+{
+public:
+    TraceSpan(const char *category, const QString &name)
+        : _category(category)
+        , _start(Tracing::isEnabled() ? Tracing::now() : -1)
+    {
+        if (_start < 0)
+            return;
+        _name = name;
+    }
+    ~TraceSpan()
+    {
+        if (_start >= 0)
+            Tracing::addSpan(_category, _name, _start);
+    }
+
+private:
+    Q_DISABLE_COPY(TraceSpan)
+    const char *_category;
+    QString _name;
+    qint64 _start;
+};
+}
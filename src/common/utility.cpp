@@ -43,6 +43,13 @@
 #include <sys/types.h>
 #include <unistd.h>
 #endif
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#endif
+#ifdef Q_OS_MAC
+#include <sys/resource.h>
+#include <sys/sysctl.h>
+#endif
 
 #include <math.h>
 #include <stdarg.h>
@@ -222,6 +229,52 @@ qint64 Utility::freeDiskSpace(const QString &path)
     return -1;
 }
 
+qint64 Utility::physicalMemorySize()
+{
+#if defined(Q_OS_MAC)
+    int64_t size = 0;
+    size_t length = sizeof(size);
+    if (sysctlbyname("hw.memsize", &size, &length, NULL, 0) == 0) {
+        return size;
+    }
+#elif defined(Q_OS_UNIX)
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0) {
+        return (qint64)pages * pageSize;
+    }
+#elif defined(Q_OS_WIN)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status)) {
+        return status.ullTotalPhys;
+    }
+#endif
+    return -1;
+}
+
+bool Utility::setThreadBackgroundIo(bool enabled)
+{
+#if defined(Q_OS_LINUX) && defined(SYS_ioprio_set)
+    // From linux/ioprio.h, which isn't always installed. The class "none"
+    // follows the CPU priority of the thread again.
+    const int IoprioWhoProcess = 1;
+    const int IoprioClassShift = 13;
+    const int IoprioClassIdle = 3;
+    const int ioprio = enabled ? IoprioClassIdle << IoprioClassShift : 0;
+    // The process id 0 is the calling thread
+    return syscall(SYS_ioprio_set, IoprioWhoProcess, 0, ioprio) == 0;
+#elif defined(Q_OS_MAC)
+    return setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, enabled ? IOPOL_THROTTLE : IOPOL_DEFAULT) == 0;
+#elif defined(Q_OS_WIN)
+    // Also lowers the CPU priority; it fails if the mode doesn't change
+    return SetThreadPriority(GetCurrentThread(), enabled ? THREAD_MODE_BACKGROUND_BEGIN : THREAD_MODE_BACKGROUND_END);
+#else
+    Q_UNUSED(enabled);
+    return false;
+#endif
+}
+
 QString Utility::compactFormatDouble(double value, int prec, const QString &unit)
 {
     QLocale locale = QLocale::system();
@@ -361,22 +414,32 @@ QString Utility::fileNameForGuiUse(const QString &fName)
 
 QByteArray Utility::normalizeEtag(QByteArray etag)
 {
+    // Narrows the range first, the result is copied at most once
+    const char *begin = etag.constData();
+    const char *end = begin + etag.size();
+    auto endsWith = [&](const char *suffix, int length) {
+        return end - begin >= length && memcmp(end - length, suffix, length) == 0;
+    };
     /* strip "XXXX-gzip" */
-    if(etag.startsWith('"') && etag.endsWith("-gzip\"")) {
-        etag.chop(6);
-        etag.remove(0, 1);
+    if (begin != end && *begin == '"' && endsWith("-gzip\"", 6)) {
+        end -= 6;
+        ++begin;
     }
     /* strip trailing -gzip */
-    if(etag.endsWith("-gzip")) {
-        etag.chop(5);
+    if (endsWith("-gzip", 5)) {
+        end -= 5;
     }
     /* strip normal quotes */
-    if (etag.startsWith('"') && etag.endsWith('"')) {
-        etag.chop(1);
-        etag.remove(0, 1);
+    if (begin != end && *begin == '"' && end[-1] == '"') {
+        --end;
+        if (begin != end)
+            ++begin;
+    }
+    if (begin == etag.constData() && end == begin + etag.size()) {
+        etag.squeeze();
+        return etag;
     }
-    etag.squeeze();
-    return etag;
+    return QByteArray(begin, int(end - begin));
 }
 
 bool Utility::hasDarkSystray()
@@ -62,6 +62,20 @@ namespace Utility {
      */
     OCSYNC_EXPORT qint64 freeDiskSpace(const QString &path);
 
+    /**
+     * Return the size of the physical memory of the machine, -1 if unknown.
+     */
+    OCSYNC_EXPORT qint64 physicalMemorySize();
+
+    /**
+     * Gives the disk I/O of the calling thread the lowest priority, or the
+     * normal one again, so that the sync doesn't slow down the other programs.
+     *
+     * Uses the idle I/O class on Linux, the background mode on Windows and
+     * the throttled I/O policy on macOS. Returns false if not supported.
+     */
+    OCSYNC_EXPORT bool setThreadBackgroundIo(bool enabled);
+
     /**
      * @brief compactFormatDouble - formats a double value human readable.
      *
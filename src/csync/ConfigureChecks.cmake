@@ -51,6 +51,11 @@ check_function_exists(timegm HAVE_TIMEGM)
 check_function_exists(strerror_r HAVE_STRERROR_R)
 check_function_exists(utimes HAVE_UTIMES)
 check_function_exists(lstat HAVE_LSTAT)
+if (LINUX)
+    set(CMAKE_REQUIRED_DEFINITIONS -D_GNU_SOURCE)
+    check_symbol_exists(statx "sys/stat.h" HAVE_STATX)
+    unset(CMAKE_REQUIRED_DEFINITIONS)
+endif (LINUX)
 check_function_exists(asprintf HAVE_ASPRINTF)
 if (WIN32)
 	check_function_exists(__mingw_asprintf HAVE___MINGW_ASPRINTF)
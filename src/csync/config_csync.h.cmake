@@ -16,6 +16,7 @@
 #cmakedefine HAVE_STRERROR_R 1
 #cmakedefine HAVE_UTIMES 1
 #cmakedefine HAVE_LSTAT 1
+#cmakedefine HAVE_STATX 1
 #cmakedefine HAVE_FNMATCH 1
 
 #cmakedefine HAVE___MINGW_ASPRINTF 1
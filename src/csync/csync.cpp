@@ -45,11 +45,15 @@
 #include "csync_reconcile.h"
 
 #include "vio/csync_vio.h"
+#include "vio/csync_vio_local_prefetch.h"
 
 #include "csync_log.h"
 #include "csync_rename.h"
 #include "common/c_jhash.h"
 
+#include <QMutex>
+#include <vector>
+
 
 csync_s::csync_s(const char *localUri, OCC::SyncJournalDb *statedb)
   : statedb(statedb)
@@ -63,6 +67,98 @@ csync_s::csync_s(const char *localUri, OCC::SyncJournalDb *statedb)
   local.uri = c_strndup(localUri, len);
 }
 
+/*
+ * A sync creates one csync_file_stat_t per file and replica and frees them
+ * all at once in csync_s::reinitialize(). Carving them out of large slabs
+ * avoids the malloc overhead per record and the fragmentation that millions
+ * of small blocks leave behind. The records are also allocated from the
+ * local discovery threads, hence the mutex.
+ */
+namespace {
+class FileStatPool
+{
+public:
+    void *allocate()
+    {
+        QMutexLocker locker(&_mutex);
+        if (!_freeList) {
+            _slabs.push_back(static_cast<char *>(::operator new(EntriesPerSlab * sizeof(csync_file_stat_t))));
+            addToFreeList(_slabs.back());
+        }
+        FreeNode *node = _freeList;
+        _freeList = node->next;
+        ++_live;
+        return node;
+    }
+
+    void release(void *ptr)
+    {
+        QMutexLocker locker(&_mutex);
+        auto node = static_cast<FreeNode *>(ptr);
+        node->next = _freeList;
+        _freeList = node;
+        if (--_live == 0 && _slabs.size() > 1) {
+            // Everything was freed: give the memory back, but keep one slab
+            // for the next sync and for the occasional single record.
+            for (size_t i = 1; i < _slabs.size(); ++i) {
+                ::operator delete(_slabs[i]);
+            }
+            _slabs.resize(1);
+            _freeList = nullptr;
+            addToFreeList(_slabs.front());
+        }
+    }
+
+private:
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+    static const size_t EntriesPerSlab = 1024;
+
+    void addToFreeList(char *slab)
+    {
+        for (size_t i = EntriesPerSlab; i > 0; --i) {
+            auto node = reinterpret_cast<FreeNode *>(slab + (i - 1) * sizeof(csync_file_stat_t));
+            node->next = _freeList;
+            _freeList = node;
+        }
+    }
+
+    QMutex _mutex;
+    std::vector<char *> _slabs;
+    FreeNode *_freeList = nullptr;
+    size_t _live = 0;
+};
+
+// Never destroyed, records might outlive static destruction.
+FileStatPool *fileStatPool()
+{
+    static FileStatPool *pool = new FileStatPool;
+    return pool;
+}
+}
+
+void *csync_file_stat_s::operator new(size_t size)
+{
+    if (size != sizeof(csync_file_stat_s)) {
+        return ::operator new(size);
+    }
+    return fileStatPool()->allocate();
+}
+
+void csync_file_stat_s::operator delete(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return;
+    }
+    if (size != sizeof(csync_file_stat_s)) {
+        ::operator delete(ptr);
+        return;
+    }
+    fileStatPool()->release(ptr);
+}
+
 int csync_update(CSYNC *ctx) {
   int rc = -1;
   struct timespec start, finish;
@@ -74,6 +170,7 @@ int csync_update(CSYNC *ctx) {
   ctx->status_code = CSYNC_STATUS_OK;
 
   ctx->status_code = CSYNC_STATUS_OK;
+  ctx->update_metrics = {};
 
   csync_memstat_check();
 
@@ -85,7 +182,28 @@ int csync_update(CSYNC *ctx) {
   csync_gettime(&start);
   ctx->current = LOCAL_REPLICA;
 
-  rc = csync_ftw(ctx, ctx->local.uri, csync_walker, MAX_DEPTH);
+  /* Only a few directories are walked otherwise */
+  if (ctx->local_discovery_style != LocalDiscoveryStyle::DatabaseAndFilesystem
+      && !ctx->statedb->getLocalFileSnapshot(&ctx->local.snapshot)) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Could not read the journal, comparing every file with its record");
+  }
+
+  {
+      std::unique_ptr<LocalDirectoryPrefetcher> prefetcher;
+      const int threads = LocalDirectoryPrefetcher::defaultThreadCount();
+      if (threads > 1) {
+          prefetcher.reset(new LocalDirectoryPrefetcher(threads));
+      }
+      ctx->local.prefetcher = prefetcher.get();
+      rc = csync_ftw(ctx, ctx->local.uri, csync_walker, MAX_DEPTH);
+      ctx->local.prefetcher = nullptr;
+
+      /* waiting for the workers must not clobber the errno of a failed walk */
+      int saved_errno = errno;
+      prefetcher.reset();
+      ctx->local.snapshot = OCC::SyncJournalDb::LocalFileSnapshot();
+      errno = saved_errno;
+  }
   if (rc < 0) {
     if(ctx->status_code == CSYNC_STATUS_OK) {
         ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_UPDATE_ERROR);
@@ -94,10 +212,11 @@ int csync_update(CSYNC *ctx) {
   }
 
   csync_gettime(&finish);
+  ctx->update_metrics.local_walk_ms = qRound64(c_secdiff(finish, start) * 1000);
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
-            "Update detection for local replica took %.2f seconds walking %zu files.",
-            c_secdiff(finish, start), ctx->local.files.size());
+            "Update detection for local replica took %.2f seconds walking %zu files, %lld unchanged.",
+            c_secdiff(finish, start), ctx->local.files.size(), (long long)ctx->update_metrics.local_unchanged);
   csync_memstat_check();
 
   /* update detection for remote replica */
@@ -112,12 +231,17 @@ int csync_update(CSYNC *ctx) {
       return rc;
   }
 
+  /* The counterparts of the dropped remote subtrees must go before the reconcile */
+  ctx->local.files.eraseRanges(std::move(ctx->local.dropped_ranges));
+  ctx->local.dropped_ranges.clear();
+
   csync_gettime(&finish);
+  ctx->update_metrics.remote_walk_ms = qRound64(c_secdiff(finish, start) * 1000);
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
             "Update detection for remote replica took %.2f seconds "
-            "walking %zu files.",
-            c_secdiff(finish, start), ctx->remote.files.size());
+            "walking %zu files, %zu unchanged subtrees dropped.",
+            c_secdiff(finish, start), ctx->remote.files.size(), ctx->dropped_subtrees.size());
   csync_memstat_check();
 
   ctx->status |= CSYNC_STATUS_UPDATE;
@@ -312,13 +436,19 @@ int csync_s::reinitialize() {
   read_remote_from_db = true;
 
   local.files.clear();
+  local.listed_directories.clear();
+  local.dropped_ranges.clear();
   remote.files.clear();
+  dropped_subtrees.clear();
+  dropped_unchanged_files = false;
 
   renames.folder_renamed_from.clear();
   renames.folder_renamed_to.clear();
 
   local_discovery_style = LocalDiscoveryStyle::FilesystemOnly;
   locally_touched_dirs.clear();
+  remote_discovery_paths.clear();
+  remote_changes_deferred = false;
 
   status = CSYNC_STATUS_INIT;
   SAFE_FREE(error_string);
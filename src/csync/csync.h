@@ -35,6 +35,8 @@
 #include "std/c_private.h"
 #include "ocsynclib.h"
 #include "common/syncjournalfilerecord.h"
+#include "common/instancecounter.h"
+#include "common/c_jhash.h"
 
 #include <sys/stat.h>
 #include <stdbool.h>
@@ -109,7 +111,8 @@ enum csync_status_codes_e {
     CSYNC_STATUS_FORBIDDEN,
     CSYNC_STATUS_INDIVIDUAL_TOO_DEEP,
     CSYNC_STATUS_INDIVIDUAL_IS_CONFLICT_FILE,
-    CSYNC_STATUS_INDIVIDUAL_CANNOT_ENCODE
+    CSYNC_STATUS_INDIVIDUAL_CANNOT_ENCODE,
+    CSYNC_STATUS_INDIVIDUAL_IS_VIRTUAL_FILE
 };
 
 typedef enum csync_status_codes_e CSYNC_STATUS;
@@ -152,7 +155,11 @@ enum csync_ftw_type_e {
     CSYNC_FTW_TYPE_FILE,
     CSYNC_FTW_TYPE_SLINK,
     CSYNC_FTW_TYPE_DIR,
-    CSYNC_FTW_TYPE_SKIP
+    CSYNC_FTW_TYPE_SKIP,
+    /* A placeholder for a remote file, named with the virtual file suffix */
+    CSYNC_FTW_TYPE_VIRTUAL_FILE,
+    /* A placeholder that is to be replaced by the file, see Folder::downloadVirtualFile() */
+    CSYNC_FTW_TYPE_VIRTUAL_FILE_DOWNLOAD
 };
 
 
@@ -163,10 +170,27 @@ enum csync_ftw_type_e {
 
 typedef struct csync_file_stat_s csync_file_stat_t;
 
-struct OCSYNC_EXPORT csync_file_stat_s {
+/**
+ * The hash of a path, the same as SyncJournalDb::getPHash().
+ *
+ * It is computed once for a tree entry, see csync_file_stat_s::phash, and
+ * serves the FileMap, the journal queries and the seen files of the engine.
+ */
+static inline int64_t csync_path_hash(const char *path, int size)
+{
+    return size > 0 ? static_cast<int64_t>(c_jhash64(reinterpret_cast<const uint8_t *>(path), size, 0)) : -1;
+}
+
+static inline int64_t csync_path_hash(const QByteArray &path)
+{
+    return csync_path_hash(path.constData(), path.size());
+}
+
+struct OCSYNC_EXPORT csync_file_stat_s : private OCC::InstanceCounted<OCC::InstanceCounts::FileStats> {
   time_t modtime;
   int64_t size;
   uint64_t inode;
+  int64_t phash; // csync_path_hash() of path, set before the entry goes to a tree
 
   OCC::RemotePermissions remotePerm;
   enum csync_ftw_type_e type BITFIELD(4);
@@ -196,6 +220,7 @@ struct OCSYNC_EXPORT csync_file_stat_s {
     : modtime(0)
     , size(0)
     , inode(0)
+    , phash(0)
     , type(CSYNC_FTW_TYPE_SKIP)
     , child_modified(false)
     , has_ignored_files(false)
@@ -204,10 +229,15 @@ struct OCSYNC_EXPORT csync_file_stat_s {
     , instruction(CSYNC_INSTRUCTION_NONE)
   { }
 
+  /* Records are carved out of large slabs, see csync.cpp */
+  static void *operator new(size_t size);
+  static void operator delete(void *ptr, size_t size);
+
   static std::unique_ptr<csync_file_stat_t> fromSyncJournalFileRecord(const OCC::SyncJournalFileRecord &rec)
   {
     std::unique_ptr<csync_file_stat_t> st(new csync_file_stat_t);
     st->path = rec._path;
+    st->phash = csync_path_hash(rec._path);
     st->inode = rec._inode;
     st->modtime = rec._modtime;
     st->type = static_cast<csync_ftw_type_e>(rec._type);
@@ -41,6 +41,7 @@
 
 #include <QString>
 #include <QFileInfo>
+#include <QVarLengthArray>
 
 #ifdef _WIN32
 #include <io.h>
@@ -218,11 +219,20 @@ bool csync_is_windows_reserved_word(const char *filename)
     return false;
 }
 
+/* Whether bname is prefix + anything + infix + anything */
+static bool _csync_bname_matches(const char *bname, const char *prefix, const char *infix)
+{
+    const size_t len = strlen(prefix);
+    if (strncmp(bname, prefix, len) != 0) {
+        return false;
+    }
+    return !infix || strstr(bname + len, infix);
+}
+
 static CSYNC_EXCLUDE_TYPE _csync_excluded_common(const char *path)
 {
     const char *bname = NULL;
     size_t blen = 0;
-    int rc = -1;
     CSYNC_EXCLUDE_TYPE match = CSYNC_NOT_EXCLUDED;
 
     /* split up the path */
@@ -235,24 +245,13 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(const char *path)
     blen = strlen(bname);
 
     // 9 = strlen(".sync_.db")
+    // Like csync_fnmatch() with "._sync_*.db*", ".sync_*.db*",
+    // ".csync_journal.db*" and ".owncloudsync.log*"
     if (blen >= 9 && bname[0] == '.') {
-        rc = csync_fnmatch("._sync_*.db*", bname, 0);
-        if (rc == 0) {
-            match = CSYNC_FILE_SILENTLY_EXCLUDED;
-            goto out;
-        }
-        rc = csync_fnmatch(".sync_*.db*", bname, 0);
-        if (rc == 0) {
-            match = CSYNC_FILE_SILENTLY_EXCLUDED;
-            goto out;
-        }
-        rc = csync_fnmatch(".csync_journal.db*", bname, 0);
-        if (rc == 0) {
-            match = CSYNC_FILE_SILENTLY_EXCLUDED;
-            goto out;
-        }
-        rc = csync_fnmatch(".owncloudsync.log*", bname, 0);
-        if (rc == 0) {
+        if (_csync_bname_matches(bname, "._sync_", ".db")
+            || _csync_bname_matches(bname, ".sync_", ".db")
+            || _csync_bname_matches(bname, ".csync_journal.db", nullptr)
+            || _csync_bname_matches(bname, ".owncloudsync.log", nullptr)) {
             match = CSYNC_FILE_SILENTLY_EXCLUDED;
             goto out;
         }
@@ -305,12 +304,9 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(const char *path)
 #endif
 
     /* We create a desktop.ini on Windows for the sidebar icon, make sure we don't sync them. */
-    if (blen == 11) {
-        rc = csync_fnmatch("Desktop.ini", bname, 0);
-        if (rc == 0) {
-            match = CSYNC_FILE_SILENTLY_EXCLUDED;
-            goto out;
-        }
+    if (blen == 11 && strcmp(bname, "Desktop.ini") == 0) {
+        match = CSYNC_FILE_SILENTLY_EXCLUDED;
+        goto out;
     }
 
     if (!OCC::Utility::shouldUploadConflictFiles()) {
@@ -406,6 +402,34 @@ bool ExcludedFiles::isExcluded(
     return fullPatternMatch(relativePath.toUtf8(), type) != CSYNC_NOT_EXCLUDED;
 }
 
+bool ExcludedFiles::isExcludedRelative(
+    const QString &basePath,
+    const QString &relativePath,
+    bool excludeHidden,
+    int filetype) const
+{
+    QString path = relativePath;
+    if (path.endsWith(QLatin1Char('/')))
+        path.chop(1);
+    if (path.isEmpty())
+        return false;
+
+    if (excludeHidden && (path.startsWith(QLatin1Char('.')) || path.contains(QLatin1String("/."))))
+        return true;
+
+    const QByteArray pathUtf8 = path.toUtf8();
+    if (filetype == -1) {
+        // What excludes a file also excludes a directory, only the
+        // directory-only patterns need to know which one it is
+        if (fullPatternMatch(pathUtf8, CSYNC_FTW_TYPE_DIR) == CSYNC_NOT_EXCLUDED)
+            return false;
+        if (fullPatternMatch(pathUtf8, CSYNC_FTW_TYPE_FILE) != CSYNC_NOT_EXCLUDED)
+            return true;
+        return QFileInfo(basePath + path).isDir();
+    }
+    return fullPatternMatch(pathUtf8, filetype) != CSYNC_NOT_EXCLUDED;
+}
+
 CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const char *path, int filetype) const
 {
     auto match = _csync_excluded_common(path);
@@ -423,24 +447,29 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const char *path, int fi
     } else {
         bname = path;
     }
-    QString bnameStr = QString::fromUtf8(bname);
-
-    QRegularExpressionMatch m;
-    if (filetype == CSYNC_FTW_TYPE_DIR) {
-        m = _bnameActivationRegexDir.match(bnameStr);
-    } else {
-        m = _bnameActivationRegexFile.match(bnameStr);
-    }
-    if (!m.hasMatch())
+    const auto &activation = filetype == CSYNC_FTW_TYPE_DIR ? _bnameActivationDir : _bnameActivationFile;
+    if (!activation.matches(bname, strlen(bname)))
         return match;
 
-    // Now run the full match
+    // Now run the full match, or only the bname one when no full path
+    // pattern can match in this directory
 
-    QString pathStr = QString::fromUtf8(path);
-    if (filetype == CSYNC_FTW_TYPE_DIR) {
-        m = _fullRegexDir.match(pathStr);
+    const QByteArray dirPath = QByteArray::fromRawData(path, bname - path);
+    QRegularExpressionMatch m;
+    if (!fullPatternsCanMatchIn(dirPath)) {
+        QString bnameStr = QString::fromUtf8(bname);
+        if (filetype == CSYNC_FTW_TYPE_DIR) {
+            m = _bnameRegexDir.match(bnameStr);
+        } else {
+            m = _bnameRegexFile.match(bnameStr);
+        }
     } else {
-        m = _fullRegexFile.match(pathStr);
+        QString pathStr = QString::fromUtf8(path);
+        if (filetype == CSYNC_FTW_TYPE_DIR) {
+            m = _fullRegexDir.match(pathStr);
+        } else {
+            m = _fullRegexFile.match(pathStr);
+        }
     }
     if (m.hasMatch()) {
         if (!m.captured(1).isEmpty()) {
@@ -452,6 +481,51 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const char *path, int fi
     return match;
 }
 
+bool ExcludedFiles::fullPatternsCanMatchIn(const QByteArray &dirPath) const
+{
+    if (_fullPatternComponents.isEmpty())
+        return false;
+
+    if (_traversalDirs.isEmpty()) {
+        TraversalDir root;
+        for (int i = 0; i < _fullPatternComponents.size(); ++i)
+            root.candidates.append(i);
+        _traversalDirs.append(root);
+    }
+
+    // Go back to the closest parent we know
+    while (_traversalDirs.size() > 1 && !dirPath.startsWith(_traversalDirs.last().path))
+        _traversalDirs.removeLast();
+
+    // And down to dirPath, one component at a time
+    while (_traversalDirs.last().path.size() != dirPath.size()) {
+        const TraversalDir &parent = _traversalDirs.last();
+        const int depth = _traversalDirs.size() - 1;
+        const int start = parent.path.size();
+        const int end = dirPath.indexOf('/', start);
+        const QString name = QString::fromUtf8(dirPath.constData() + start, end - start);
+
+        TraversalDir dir;
+        dir.path = QByteArray(dirPath.constData(), end + 1);
+        for (int i : parent.candidates) {
+            const auto &components = _fullPatternComponents.at(i);
+            if (components.isEmpty()
+                || (components.size() > depth + 1 && components.at(depth).match(name).hasMatch())) {
+                dir.candidates.append(i);
+            }
+        }
+        _traversalDirs.append(dir);
+    }
+
+    const int depth = _traversalDirs.size() - 1;
+    for (int i : _traversalDirs.last().candidates) {
+        const auto &components = _fullPatternComponents.at(i);
+        if (components.isEmpty() || components.size() == depth + 1)
+            return true;
+    }
+    return false;
+}
+
 CSYNC_EXCLUDE_TYPE ExcludedFiles::fullPatternMatch(const char *path, int filetype) const
 {
     auto match = _csync_excluded_common(path);
@@ -565,11 +639,112 @@ static QString convertToRegexpSyntax(QString exclude)
     return regex;
 }
 
+static void asciiToLower(char *data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        if (data[i] >= 'A' && data[i] <= 'Z')
+            data[i] += 'a' - 'A';
+    }
+}
+
+void ExcludedFiles::BnameActivation::build(const QList<QByteArray> &patterns, bool caseInsensitiveMatch)
+{
+    *this = BnameActivation();
+    caseInsensitive = caseInsensitiveMatch;
+
+    QString wildcardPattern;
+    for (QByteArray pattern : patterns) {
+        int stars = 0;
+        int specials = 0;
+        bool ascii = true;
+        for (char c : pattern) {
+            if (c == '*')
+                ++stars;
+            else if (c == '?' || c == '[' || c == '\\')
+                ++specials;
+            else if (static_cast<unsigned char>(c) >= 0x80)
+                ascii = false;
+        }
+        if (specials > 0 || stars > 1 || (caseInsensitive && !ascii)) {
+            if (!wildcardPattern.isEmpty())
+                wildcardPattern.append('|');
+            wildcardPattern.append(convertToRegexpSyntax(QString::fromUtf8(pattern)));
+            continue;
+        }
+
+        if (caseInsensitive)
+            asciiToLower(pattern.data(), pattern.size());
+        if (stars == 0) {
+            names.insert(pattern);
+            continue;
+        }
+        const int star = pattern.indexOf('*');
+        const QByteArray prefix = pattern.left(star);
+        const QByteArray suffix = pattern.mid(star + 1);
+        if (prefix.isEmpty() && suffix.isEmpty()) {
+            matchAll = true;
+        } else if (prefix.isEmpty()) {
+            suffixes.insert(suffix);
+            if (!suffixLengths.contains(suffix.size()))
+                suffixLengths.append(suffix.size());
+        } else if (suffix.isEmpty()) {
+            prefixes.insert(prefix);
+            if (!prefixLengths.contains(prefix.size()))
+                prefixLengths.append(prefix.size());
+        } else {
+            prefixSuffixes.append(qMakePair(prefix, suffix));
+        }
+    }
+
+    hasWildcards = !wildcardPattern.isEmpty();
+    if (hasWildcards) {
+        wildcards.setPattern("^(?:" + wildcardPattern + ")$");
+        if (caseInsensitive)
+            wildcards.setPatternOptions(QRegularExpression::CaseInsensitiveOption);
+        wildcards.optimize();
+    }
+}
+
+bool ExcludedFiles::BnameActivation::matches(const char *bname, size_t len) const
+{
+    if (matchAll)
+        return true;
+
+    QVarLengthArray<char, 256> lowered;
+    const char *data = bname;
+    if (caseInsensitive) {
+        lowered.append(bname, static_cast<int>(len));
+        asciiToLower(lowered.data(), len);
+        data = lowered.constData();
+    }
+    const int size = static_cast<int>(len);
+
+    if (names.contains(QByteArray::fromRawData(data, size)))
+        return true;
+    for (int l : suffixLengths) {
+        if (l <= size && suffixes.contains(QByteArray::fromRawData(data + size - l, l)))
+            return true;
+    }
+    for (int l : prefixLengths) {
+        if (l <= size && prefixes.contains(QByteArray::fromRawData(data, l)))
+            return true;
+    }
+    for (const auto &pair : prefixSuffixes) {
+        const int prefixSize = pair.first.size();
+        const int suffixSize = pair.second.size();
+        if (prefixSize + suffixSize <= size
+            && memcmp(data, pair.first.constData(), prefixSize) == 0
+            && memcmp(data + size - suffixSize, pair.second.constData(), suffixSize) == 0)
+            return true;
+    }
+    return hasWildcards && wildcards.match(QString::fromUtf8(bname, size)).hasMatch();
+}
+
 void ExcludedFiles::prepare()
 {
     // Build regular expressions for the different cases.
     //
-    // To compose the _bnameActivationRegex and _fullRegex patterns we
+    // To compose the bname activations and the _fullRegex patterns we
     // collect several subgroups of patterns here.
     //
     // * The "full" group will contain all patterns that contain a non-trailing
@@ -578,7 +753,7 @@ void ExcludedFiles::prepare()
     //   These need separate handling in the _fullRegex (slash-containing
     //   patterns must be anchored to the front, these don't need it)
     // * The "bnameTrigger" group contains the bname part of all patterns in the
-    //   "full" group. These and the "bname" group become _bnameActivationRegex.
+    //   "full" group. These and the "bname" group become the bname activations.
     //
     // To complicate matters, the exclude patterns have two binary attributes
     // meaning we'll end up with 4 variants:
@@ -598,8 +773,16 @@ void ExcludedFiles::prepare()
     QString bnameDirKeep;
     QString bnameDirRemove;
 
-    QString bnameTriggerFileDir;
-    QString bnameTriggerDir;
+    // The bname patterns of the activation, in glob syntax
+    QList<QByteArray> activationFileDir;
+    QList<QByteArray> activationDir;
+
+    QRegularExpression::PatternOptions patternOptions = QRegularExpression::NoPatternOption;
+    if (OCC::Utility::fsCasePreserving())
+        patternOptions |= QRegularExpression::CaseInsensitiveOption;
+
+    _fullPatternComponents.clear();
+    _traversalDirs.clear();
 
     auto regexAppend = [](QString &fileDirPattern, QString &dirPattern, const QString &appendMe, bool dirOnly) {
         QString &pattern = dirOnly ? dirPattern : fileDirPattern;
@@ -631,15 +814,28 @@ void ExcludedFiles::prepare()
         auto &fullDir = removeExcluded ? fullDirRemove : fullDirKeep;
 
         auto regexExclude = convertToRegexpSyntax(QString::fromUtf8(exclude));
+        auto &activation = matchDirOnly ? activationDir : activationFileDir;
         if (!fullPath) {
             regexAppend(bnameFileDir, bnameDir, regexExclude, matchDirOnly);
+            activation.append(exclude);
         } else {
             regexAppend(fullFileDir, fullDir, regexExclude, matchDirOnly);
 
             // for activation, trigger on the 'bname' part of the full pattern
             auto bnameExclude = exclude.mid(exclude.lastIndexOf('/') + 1);
-            auto regexBname = convertToRegexpSyntax(bnameExclude);
-            regexAppend(bnameTriggerFileDir, bnameTriggerDir, regexBname, matchDirOnly);
+            activation.append(bnameExclude);
+
+            // A bracket expression could contain a slash, such a pattern is
+            // always checked with the full regex
+            QVector<QRegularExpression> components;
+            if (!exclude.contains('[')) {
+                foreach (const QByteArray &component, exclude.split('/')) {
+                    QRegularExpression re("^(?:" + convertToRegexpSyntax(QString::fromUtf8(component)) + ")$", patternOptions);
+                    re.optimize();
+                    components.append(re);
+                }
+            }
+            _fullPatternComponents.append(components);
         }
     }
 
@@ -658,19 +854,12 @@ void ExcludedFiles::prepare()
     emptyMatchNothing(bnameDirKeep);
     emptyMatchNothing(bnameDirRemove);
 
-    emptyMatchNothing(bnameTriggerFileDir);
-    emptyMatchNothing(bnameTriggerDir);
-
-    // The bname activation regexe is applied to the bname only, so must be
-    // anchored in the beginning and in the end. It has the explicit triggers
-    // plus the bname-only patterns. Here we don't care about the remove/keep
-    // distinction.
-    _bnameActivationRegexFile.setPattern(
-        "^(?:" + bnameFileDirKeep + "|" + bnameFileDirRemove + "|" + bnameTriggerFileDir + ")$");
-    _bnameActivationRegexDir.setPattern(
-        "^(?:" + bnameFileDirKeep + "|" + bnameFileDirRemove
-        + "|" + bnameDirKeep + "|" + bnameFileDirRemove
-        + "|" + bnameTriggerFileDir + "|" + bnameTriggerDir + ")$");
+    // The bname activation is applied to the bname only. It has the explicit
+    // triggers plus the bname-only patterns. Here we don't care about the
+    // remove/keep distinction.
+    const bool caseInsensitive = OCC::Utility::fsCasePreserving();
+    _bnameActivationFile.build(activationFileDir, caseInsensitive);
+    _bnameActivationDir.build(activationFileDir + activationDir, caseInsensitive);
 
     // The full regex has two captures, it's basic form is "(...)|(...)". The first
     // capture has the keep/exclude-only patterns, the second the remove/exclude-and-remove
@@ -698,15 +887,20 @@ void ExcludedFiles::prepare()
         + "(?:^|/)(?:" + bnameFileDirRemove + "|" + bnameDirRemove + ")(?:$|/)"
         + ")");
 
-    QRegularExpression::PatternOptions patternOptions = QRegularExpression::NoPatternOption;
-    if (OCC::Utility::fsCasePreserving())
-        patternOptions |= QRegularExpression::CaseInsensitiveOption;
-    _bnameActivationRegexFile.setPatternOptions(patternOptions);
-    _bnameActivationRegexFile.optimize();
-    _bnameActivationRegexDir.setPatternOptions(patternOptions);
-    _bnameActivationRegexDir.optimize();
+    // The parents were checked already, without a full path pattern for
+    // the directory only the bname patterns are left
+    _bnameRegexFile.setPattern(
+        QLatin1String("^(?:(") + bnameFileDirKeep + ")|(" + bnameFileDirRemove + "))$");
+    _bnameRegexDir.setPattern(
+        QLatin1String("^(?:(") + bnameFileDirKeep + "|" + bnameDirKeep
+        + ")|(" + bnameFileDirRemove + "|" + bnameDirRemove + "))$");
+
     _fullRegexFile.setPatternOptions(patternOptions);
     _fullRegexFile.optimize();
     _fullRegexDir.setPatternOptions(patternOptions);
     _fullRegexDir.optimize();
+    _bnameRegexFile.setPatternOptions(patternOptions);
+    _bnameRegexFile.optimize();
+    _bnameRegexDir.setPatternOptions(patternOptions);
+    _bnameRegexDir.optimize();
 }
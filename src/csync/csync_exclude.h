@@ -26,9 +26,11 @@
 #include "csync.h"
 
 #include <QObject>
+#include <QPair>
 #include <QSet>
 #include <QString>
 #include <QRegularExpression>
+#include <QVector>
 
 enum csync_exclude_type_e {
   CSYNC_NOT_EXCLUDED   = 0,
@@ -85,6 +87,23 @@ public:
         const QString &basePath,
         bool excludeHidden) const;
 
+    /**
+     * Like isExcluded(), for the paths that are checked very often.
+     *
+     * A path is hidden when one of its components starts with a dot, the
+     * hidden attribute on Windows is not looked at. Without @a filetype the
+     * file is only looked at when a directory-only pattern matches.
+     *
+     * @param basePath      folder path from which to apply exclude rules, ends with a /
+     * @param relativePath  path relative to basePath
+     * @param filetype      a csync_ftw_type_e, -1 when not known
+     */
+    bool isExcludedRelative(
+        const QString &basePath,
+        const QString &relativePath,
+        bool excludeHidden,
+        int filetype = -1) const;
+
     /**
      * Adds an exclude pattern.
      *
@@ -165,8 +184,9 @@ private:
      *   full("a/b/c/d") == traversal("a") || traversal("a/b") || traversal("a/b/c")
      *
      * The traversal matcher can be extremely fast because it has a fast early-out
-     * case: It checks the bname part of the path against _bnameActivationRegex
-     * and only runs the full regex if the bname activation was triggered.
+     * case: It checks the bname part of the path against _bnameActivationFile
+     * or _bnameActivationDir and only runs the full regex if the bname activation
+     * was triggered.
      *
      * Note: The traversal matcher will return not-excluded on some paths that the
      * full matcher would exclude. Example: "b" is excluded. traversal("b/c")
@@ -183,11 +203,63 @@ private:
     /// List of all active exclude patterns
     QList<QByteArray> _allExcludes;
 
+    /**
+     * Whether a bname matches one of a set of patterns, on the UTF-8 bytes.
+     *
+     * The patterns without wildcards and the ones with a single '*' are
+     * looked up in hash sets or compared directly, only the others go to a
+     * regular expression. Most exclude patterns are like "*~" or
+     * ".DS_Store". With a case insensitive file system only the ASCII
+     * patterns are compared as bytes, with the ASCII letters lowered.
+     */
+    struct BnameActivation
+    {
+        bool matchAll = false;
+        QSet<QByteArray> names;
+        QSet<QByteArray> prefixes;
+        QSet<QByteArray> suffixes;
+        QVector<int> prefixLengths;
+        QVector<int> suffixLengths;
+        QVector<QPair<QByteArray, QByteArray>> prefixSuffixes;
+        QRegularExpression wildcards;
+        bool hasWildcards = false;
+        bool caseInsensitive = false;
+
+        void build(const QList<QByteArray> &patterns, bool caseInsensitive);
+        bool matches(const char *bname, size_t len) const;
+    };
+
+    /**
+     * Whether a full path pattern can match an entry of @a dirPath.
+     *
+     * @a dirPath is empty for the top level or ends with a slash.
+     *
+     * The traversal goes through the parents first, only the full path
+     * patterns with exactly one component more than @a dirPath can newly
+     * match one of its entries. When there is none the bname regexes are
+     * enough. The state of the parents of the last directory is kept in
+     * _traversalDirs, the discovery goes depth first.
+     */
+    bool fullPatternsCanMatchIn(const QByteArray &dirPath) const;
+
     /// see prepare()
-    QRegularExpression _bnameActivationRegexFile;
-    QRegularExpression _bnameActivationRegexDir;
+    BnameActivation _bnameActivationFile;
+    BnameActivation _bnameActivationDir;
     QRegularExpression _fullRegexFile;
     QRegularExpression _fullRegexDir;
+    QRegularExpression _bnameRegexFile;
+    QRegularExpression _bnameRegexDir;
+
+    /// The components of the full path patterns, empty if it can't be split
+    QVector<QVector<QRegularExpression>> _fullPatternComponents;
+
+    struct TraversalDir
+    {
+        QByteArray path; // with the trailing slash
+        /// Indexes in _fullPatternComponents that can match below path
+        QVector<int> candidates;
+    };
+    mutable QVector<TraversalDir> _traversalDirs;
 
     friend class ExcludedFilesTest;
 };
@@ -39,6 +39,8 @@
 #include <sqlite3.h>
 #include <map>
 #include <set>
+#include <algorithm>
+#include <vector>
 #include <functional>
 
 #include "common/syncjournaldb.h"
@@ -73,6 +75,12 @@ enum csync_replica_e {
 enum class LocalDiscoveryStyle {
     FilesystemOnly, //< read all local data from the filesystem
     DatabaseAndFilesystem, //< read from the db, except for listed paths
+    /** List a directory from the db if its modtime and inode are the ones
+     * recorded by the last successful sync, except for listed paths.
+     *
+     * Only the directories are stat'ed. Files that are written in place
+     * don't change their directory's modtime and are not noticed. */
+    DirectoryModtime,
 };
 
 
@@ -108,19 +116,195 @@ public:
     friend bool operator==(const ByteArrayRef &a, const ByteArrayRef &b)
     { return a.size() == b.size() && qstrncmp(a.data(), b.data(), a.size()) == 0; }
 };
-struct ByteArrayRefHash { uint operator()(const ByteArrayRef &a) const { return qHashBits(a.data(), a.size()); } };
+/* The slots of the FileMap take the hash of the tree entries, folded */
+static inline uint csync_slot_hash(int64_t phash) { return uint(phash) ^ uint(uint64_t(phash) >> 32); }
+struct ByteArrayRefHash { uint operator()(const ByteArrayRef &a) const { return csync_slot_hash(csync_path_hash(a.data(), a.size())); } };
+
+class LocalDirectoryPrefetcher;
 
 /**
  * @brief csync public structure
  */
 struct OCSYNC_EXPORT csync_s {
 
-  class FileMap : public std::unordered_map<ByteArrayRef, std::unique_ptr<csync_file_stat_t>, ByteArrayRefHash> {
+  /**
+   * Hash map from path to file record.
+   *
+   * The entries are kept in a dense vector in insertion order, and an open
+   * addressing table (linear probing, Robin Hood insertion) indexes them.
+   * Each slot stores the hash next to the entry index, so most probes
+   * don't touch the keys at all. Elements can't be erased individually,
+   * see truncate() and eraseRanges().
+   *
+   * The hash is csync_path_hash() of the key, so insert() and the
+   * findFile() variant with a hash reuse csync_file_stat_s::phash.
+   */
+  class FileMap {
   public:
+      struct value_type {
+          ByteArrayRef first;
+          std::unique_ptr<csync_file_stat_t> second;
+      };
+      using iterator = std::vector<value_type>::iterator;
+      using const_iterator = std::vector<value_type>::const_iterator;
+
+      iterator begin() { return _entries.begin(); }
+      iterator end() { return _entries.end(); }
+      const_iterator begin() const { return _entries.begin(); }
+      const_iterator end() const { return _entries.end(); }
+      const_iterator cbegin() const { return _entries.cbegin(); }
+      const_iterator cend() const { return _entries.cend(); }
+      size_t size() const { return _entries.size(); }
+      bool empty() const { return _entries.empty(); }
+
+      void clear() {
+          // Release the memory as well, the maps of a big sync are big.
+          std::vector<value_type>().swap(_entries);
+          std::vector<Slot>().swap(_slots);
+      }
+
+      void swap(FileMap &other) {
+          _entries.swap(other._entries);
+          _slots.swap(other._slots);
+      }
+
+      iterator find(const ByteArrayRef &key) {
+          size_t pos = lookup(key, ByteArrayRefHash()(key));
+          return pos == NotFound ? end() : begin() + _slots[pos].index;
+      }
+      const_iterator find(const ByteArrayRef &key) const {
+          size_t pos = lookup(key, ByteArrayRefHash()(key));
+          return pos == NotFound ? end() : begin() + _slots[pos].index;
+      }
       csync_file_stat_t *findFile(const ByteArrayRef &key) const {
-          auto it = find(key);
-          return it != end() ? it->second.get() : nullptr;
+          size_t pos = lookup(key, ByteArrayRefHash()(key));
+          return pos == NotFound ? nullptr : _entries[_slots[pos].index].second.get();
+      }
+      /** Like findFile(), @a phash is csync_path_hash() of @a key */
+      csync_file_stat_t *findFile(const ByteArrayRef &key, int64_t phash) const {
+          size_t pos = lookup(key, csync_slot_hash(phash));
+          return pos == NotFound ? nullptr : _entries[_slots[pos].index].second.get();
       }
+
+      std::unique_ptr<csync_file_stat_t> &operator[](const ByteArrayRef &key) {
+          return slotFor(key, ByteArrayRefHash()(key));
+      }
+
+      /** Stores @a fs by its path, replacing an entry with the same path. Its phash must be set. */
+      void insert(std::unique_ptr<csync_file_stat_t> fs) {
+          auto &slot = slotFor(fs->path, csync_slot_hash(fs->phash));
+          slot = std::move(fs);
+      }
+
+      /** Erases the entries from index @a size on. */
+      void truncate(size_t size) {
+          while (_entries.size() > size) {
+              eraseSlot(lookup(_entries.back().first, entryHash(_entries.back())));
+              _entries.pop_back();
+          }
+      }
+
+      /** Erases the entries in the given [begin, end) index ranges, which must not overlap. */
+      void eraseRanges(std::vector<std::pair<size_t, size_t>> ranges) {
+          if (ranges.empty())
+              return;
+          std::sort(ranges.begin(), ranges.end());
+          size_t out = ranges.front().first;
+          size_t in = out;
+          for (size_t i = 0; i < ranges.size(); ++i) {
+              in = ranges[i].second;
+              const size_t next = i + 1 < ranges.size() ? ranges[i + 1].first : _entries.size();
+              for (; in < next; ++in, ++out)
+                  _entries[out] = std::move(_entries[in]);
+          }
+          _entries.erase(_entries.begin() + out, _entries.end());
+          rehash(_slots.size());
+      }
+
+  private:
+      struct Slot {
+          uint hash;
+          uint index; // into _entries, EmptyIndex if unused
+      };
+      static const uint EmptyIndex = ~0u;
+      static const size_t NotFound = ~size_t(0);
+
+      std::unique_ptr<csync_file_stat_t> &slotFor(const ByteArrayRef &key, uint hash) {
+          size_t pos = lookup(key, hash);
+          if (pos != NotFound)
+              return _entries[_slots[pos].index].second;
+
+          // keep the load factor below 3/4
+          if ((_entries.size() + 1) * 4 > _slots.size() * 3)
+              rehash(qMax<size_t>(16, _slots.size() * 2));
+          _entries.push_back(value_type{ key, nullptr });
+          insertSlot(Slot{ hash, static_cast<uint>(_entries.size() - 1) });
+          return _entries.back().second;
+      }
+
+      static uint entryHash(const value_type &entry) {
+          return entry.second && entry.second->phash ? csync_slot_hash(entry.second->phash) : ByteArrayRefHash()(entry.first);
+      }
+
+      size_t mask() const { return _slots.size() - 1; }
+      size_t probeDistance(const Slot &slot, size_t pos) const {
+          return (pos - (slot.hash & mask())) & mask();
+      }
+
+      size_t lookup(const ByteArrayRef &key, uint hash) const {
+          if (_slots.empty())
+              return NotFound;
+          size_t pos = hash & mask();
+          for (size_t dist = 0;; ++dist, pos = (pos + 1) & mask()) {
+              const Slot &slot = _slots[pos];
+              // With Robin Hood insertion the key would have displaced any
+              // entry that is closer to its own bucket.
+              if (slot.index == EmptyIndex || probeDistance(slot, pos) < dist)
+                  return NotFound;
+              if (slot.hash == hash && _entries[slot.index].first == key)
+                  return pos;
+          }
+      }
+
+      void insertSlot(Slot slot) {
+          size_t pos = slot.hash & mask();
+          for (size_t dist = 0;; ++dist, pos = (pos + 1) & mask()) {
+              Slot &current = _slots[pos];
+              if (current.index == EmptyIndex) {
+                  current = slot;
+                  return;
+              }
+              size_t currentDist = probeDistance(current, pos);
+              if (currentDist < dist) {
+                  std::swap(current, slot);
+                  dist = currentDist;
+              }
+          }
+      }
+
+      void eraseSlot(size_t pos) {
+          // Backward shift deletion: move the following entries of the
+          // cluster one slot closer to their bucket.
+          for (;;) {
+              const size_t next = (pos + 1) & mask();
+              const Slot &nextSlot = _slots[next];
+              if (nextSlot.index == EmptyIndex || probeDistance(nextSlot, next) == 0) {
+                  _slots[pos].index = EmptyIndex;
+                  return;
+              }
+              _slots[pos] = nextSlot;
+              pos = next;
+          }
+      }
+
+      void rehash(size_t slotCount) {
+          _slots.assign(slotCount, Slot{ 0, EmptyIndex });
+          for (size_t i = 0; i < _entries.size(); ++i)
+              insertSlot(Slot{ entryHash(_entries[i]), static_cast<uint>(i) });
+      }
+
+      std::vector<value_type> _entries;
+      std::vector<Slot> _slots; // size is zero or a power of two
   };
 
   struct {
@@ -163,6 +347,14 @@ struct OCSYNC_EXPORT csync_s {
   struct {
     char *uri = nullptr;
     FileMap files;
+    /* Reads directory listings ahead of the walker, see csync_update() */
+    LocalDirectoryPrefetcher *prefetcher = nullptr;
+    /* Directories that were listed from the filesystem, with their stat */
+    std::vector<std::pair<QByteArray, OCC::SyncJournalDb::LocalDirectoryInfo>> listed_directories;
+    /* Index ranges of dropped subtrees that are still in files, see max_tree_memory */
+    std::vector<std::pair<size_t, size_t>> dropped_ranges;
+    /* The stat of the files in the journal during the walk, see csync_update() */
+    OCC::SyncJournalDb::LocalFileSnapshot snapshot;
   } local;
 
   struct {
@@ -201,8 +393,51 @@ struct OCSYNC_EXPORT csync_s {
    */
   std::set<QByteArray> locally_touched_dirs;
 
+  /**
+   * Folder-relative paths the sync is for, all of them if empty.
+   *
+   * A remote directory that is neither one of them nor a parent or a child
+   * of one is read from the db even if its etag changed. It keeps the etag
+   * of the db, the next sync for all paths looks into it. Then
+   * remote_changes_deferred is set.
+   */
+  std::set<QByteArray> remote_discovery_paths;
+  bool remote_changes_deferred = false;
+
   bool ignore_hidden_files = true;
 
+  /**
+   * Whether the new remote files get a placeholder instead of their content.
+   *
+   * The placeholder is an empty file with virtual_file_suffix appended to
+   * the name, the journal keeps the metadata of the remote file under that
+   * name. Local files with the suffix are placeholders either way.
+   */
+  bool new_files_are_virtual = false;
+  QByteArray virtual_file_suffix;
+
+  /**
+   * Estimated memory in bytes the trees may use during the update, 0 for no limit.
+   *
+   * Above it, the subtrees of remote directories that have no change on
+   * either side are dropped from both trees as soon as they have been
+   * walked. Nothing would be done for them anyway.
+   */
+  qint64 max_tree_memory = 0;
+
+  /* Counters of the last csync_update(), reset when it starts */
+  struct {
+      qint64 local_walk_ms = 0;
+      qint64 remote_walk_ms = 0;
+      qint64 local_stats = 0;
+      qint64 local_unchanged = 0;
+      qint64 remote_listings = 0;
+  } update_metrics;
+
+  /* The dropped directories, disjoint. The journal must keep their records. */
+  std::vector<QByteArray> dropped_subtrees;
+  bool dropped_unchanged_files = false;
+
   csync_s(const char *localUri, OCC::SyncJournalDb *statedb);
   ~csync_s();
   int reinitialize();
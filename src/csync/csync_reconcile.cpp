@@ -29,6 +29,11 @@
 #include "common/asserts.h"
 
 #include <QLoggingCategory>
+#include <QThread>
+#include <QtConcurrent>
+
+#include <algorithm>
+
 Q_LOGGING_CATEGORY(lcReconcile, "sync.csync.reconciler", QtInfoMsg)
 
 // Needed for PRIu64 on MinGW in C++ mode.
@@ -91,7 +96,7 @@ static csync_file_stat_t *_csync_check_ignored(csync_s::FileMap *tree, const Byt
  * (timestamp is newer), it is not overwritten. If both files, on the
  * source and the destination, have been changed, the newer file wins.
  */
-static int _csync_merge_algorithm_visitor(csync_file_stat_t *cur, CSYNC * ctx) {
+static int _csync_merge_with_other(csync_file_stat_t *cur, csync_file_stat_t *other, CSYNC *ctx) {
     csync_s::FileMap *our_tree = nullptr;
     csync_s::FileMap *other_tree = nullptr;
 
@@ -109,18 +114,6 @@ static int _csync_merge_algorithm_visitor(csync_file_stat_t *cur, CSYNC * ctx) {
         break;
     }
 
-    csync_file_stat_t *other = other_tree->findFile(cur->path);;
-
-    if (!other) {
-        /* Check the renamed path as well. */
-        other = other_tree->findFile(csync_rename_adjust_parent_path(ctx, cur->path));
-    }
-    if (!other) {
-        /* Check if it is ignored */
-        other = _csync_check_ignored(other_tree, cur->path);
-        /* If it is ignored, other->instruction will be  IGNORE so this one will also be ignored */
-    }
-
     /* file only found on current replica */
     if (!other) {
         switch(cur->instruction) {
@@ -418,6 +411,130 @@ static int _csync_merge_algorithm_visitor(csync_file_stat_t *cur, CSYNC * ctx) {
     return 0;
 }
 
+static int _csync_merge_algorithm_visitor(csync_file_stat_t *cur, CSYNC *ctx) {
+    csync_s::FileMap *other_tree = ctx->current == LOCAL_REPLICA ? &ctx->remote.files : &ctx->local.files;
+
+    csync_file_stat_t *other = other_tree->findFile(cur->path, cur->phash);
+
+    if (!other) {
+        /* Check the renamed path as well. */
+        other = other_tree->findFile(csync_rename_adjust_parent_path(ctx, cur->path));
+    }
+    if (!other) {
+        /* Check if it is ignored */
+        other = _csync_check_ignored(other_tree, cur->path);
+        /* If it is ignored, other->instruction will be  IGNORE so this one will also be ignored */
+    }
+
+    return _csync_merge_with_other(cur, other, ctx);
+}
+
+/* Below this size the thread handoff costs more than the merge itself.
+ * OWNCLOUD_PARALLEL_RECONCILE_THRESHOLD overrides it, the tests use 0. */
+static size_t _csync_parallel_reconcile_threshold() {
+    bool ok = false;
+    const int env = qEnvironmentVariableIntValue("OWNCLOUD_PARALLEL_RECONCILE_THRESHOLD", &ok);
+    return ok && env >= 0 ? size_t(env) : 20000;
+}
+
+/**
+ * Merges the entries of @a tree on the global thread pool.
+ *
+ * An entry whose counterpart exists under the same path in the other tree
+ * only reads and writes that pair, and every other node has a unique path,
+ * so these entries can be merged concurrently. Everything else either
+ * claims a node under a different path (renames) or reads the instruction
+ * of a parent in the other tree (ignored directories). Those entries are
+ * collected and merged afterwards on the calling thread, in tree order.
+ */
+static int _csync_reconcile_parallel(csync_s::FileMap *tree, CSYNC *ctx) {
+    csync_s::FileMap *other_tree = ctx->current == LOCAL_REPLICA ? &ctx->remote.files : &ctx->local.files;
+
+    struct Chunk {
+        csync_s::FileMap::iterator begin;
+        csync_s::FileMap::iterator end;
+        std::vector<csync_file_stat_t *> deferred;
+    };
+    const size_t chunkCount = std::max(1, QThread::idealThreadCount()) * 4;
+    const size_t chunkSize = (tree->size() + chunkCount - 1) / chunkCount;
+    QVector<Chunk> chunks;
+    for (auto it = tree->begin(); it != tree->end();) {
+        Chunk chunk;
+        chunk.begin = it;
+        it += std::min<size_t>(chunkSize, tree->end() - it);
+        chunk.end = it;
+        chunks.append(std::move(chunk));
+    }
+
+    QtConcurrent::blockingMap(chunks, [ctx, other_tree](Chunk &chunk) {
+        for (auto it = chunk.begin; it != chunk.end; ++it) {
+            csync_file_stat_t *cur = it->second.get();
+            csync_file_stat_t *other = nullptr;
+            if (cur->instruction != CSYNC_INSTRUCTION_EVAL_RENAME)
+                other = other_tree->findFile(cur->path);
+            if (other)
+                _csync_merge_with_other(cur, other, ctx);
+            else
+                chunk.deferred.push_back(cur);
+        }
+    });
+
+    for (const auto &chunk : chunks) {
+        for (auto cur : chunk.deferred) {
+            if (_csync_merge_algorithm_visitor(cur, ctx) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static std::vector<csync_file_stat_t *> _csync_sorted_by_path(const csync_s::FileMap &tree) {
+    std::vector<csync_file_stat_t *> result;
+    result.reserve(tree.size());
+    for (const auto &pair : tree)
+        result.push_back(pair.second.get());
+    auto lessPath = [](const csync_file_stat_t *a, const csync_file_stat_t *b) { return a->path < b->path; };
+    // A tree that was filled in path order doesn't need the sort.
+    if (!std::is_sorted(result.begin(), result.end(), lessPath))
+        std::sort(result.begin(), result.end(), lessPath);
+    return result;
+}
+
+/**
+ * Merges @a tree by walking both trees in path order side by side.
+ *
+ * The counterpart under the same path is found by advancing a cursor in
+ * the other tree instead of a hash probe. Only renames and entries that
+ * have no counterpart under their own path go through the lookups of
+ * _csync_merge_algorithm_visitor(). Entries are merged in path order.
+ */
+static int _csync_reconcile_sorted(csync_s::FileMap *tree, CSYNC *ctx) {
+    const csync_s::FileMap *other_tree = ctx->current == LOCAL_REPLICA ? &ctx->remote.files : &ctx->local.files;
+
+    const auto ours = _csync_sorted_by_path(*tree);
+    const auto others = _csync_sorted_by_path(*other_tree);
+
+    auto otherIt = others.begin();
+    for (auto cur : ours) {
+        while (otherIt != others.end() && (*otherIt)->path < cur->path)
+            ++otherIt;
+        int rc = 0;
+        if (otherIt != others.end() && (*otherIt)->path == cur->path
+            && cur->instruction != CSYNC_INSTRUCTION_EVAL_RENAME) {
+            rc = _csync_merge_with_other(cur, *otherIt, ctx);
+        } else {
+            rc = _csync_merge_algorithm_visitor(cur, ctx);
+        }
+        if (rc < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static bool _csync_use_sorted_reconcile() {
+    return qEnvironmentVariableIntValue("OWNCLOUD_SORTED_RECONCILE") != 0;
+}
+
 int csync_reconcile_updates(CSYNC *ctx) {
   csync_s::FileMap *tree = nullptr;
 
@@ -432,6 +549,22 @@ int csync_reconcile_updates(CSYNC *ctx) {
       break;
   }
 
+  if (_csync_use_sorted_reconcile()) {
+    if (_csync_reconcile_sorted(tree, ctx) < 0) {
+      ctx->status_code = CSYNC_STATUS_RECONCILE_ERROR;
+      return -1;
+    }
+    return 0;
+  }
+
+  if (tree->size() >= _csync_parallel_reconcile_threshold()) {
+    if (_csync_reconcile_parallel(tree, ctx) < 0) {
+      ctx->status_code = CSYNC_STATUS_RECONCILE_ERROR;
+      return -1;
+    }
+    return 0;
+  }
+
   for (auto &pair : *tree) {
     if (_csync_merge_algorithm_visitor(pair.second.get(), ctx) < 0) {
       ctx->status_code = CSYNC_STATUS_RECONCILE_ERROR;
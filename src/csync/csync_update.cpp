@@ -40,6 +40,8 @@
 #include "csync_misc.h"
 
 #include "vio/csync_vio.h"
+#include "vio/csync_vio_local.h"
+#include "vio/csync_vio_local_prefetch.h"
 
 #include "csync_rename.h"
 
@@ -117,6 +119,9 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
     return -1;
   }
 
+  /* The one hash of the path, for the tree, the journal and the engine */
+  fs->phash = csync_path_hash(fs->path);
+
   if (fs->type == CSYNC_FTW_TYPE_SKIP) {
       excluded =CSYNC_FILE_EXCLUDE_STAT_FAILED;
   } else {
@@ -174,16 +179,51 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
       goto out;
   }
 
+  /* Most local files didn't change: their stat is the one of their record,
+   * compared in the snapshot without reading the record. Anything else,
+   * like the tolerated mtime differences, gets the full comparison. */
+  if (ctx->current == LOCAL_REPLICA && fs->type == CSYNC_FTW_TYPE_FILE
+      && ctx->local.snapshot.matches(fs->path, fs->modtime, fs->size, fs->inode, CSYNC_FTW_TYPE_FILE)) {
+      ctx->update_metrics.local_unchanged++;
+      fs->instruction = CSYNC_INSTRUCTION_NONE;
+      goto out;
+  }
+
   /* Update detection: Check if a database entry exists.
    * If not, the file is either new or has been renamed. To see if it is
    * renamed, the db gets queried by the inode of the file as that one
    * does not change on rename.
    */
-  if(!ctx->statedb->getFileRecord(fs->path, &base)) {
+  if(!ctx->statedb->getFileRecord(fs->path, fs->phash, &base)) {
       ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
       return -1;
   }
 
+  /* A remote file that has a placeholder is known by the name of the placeholder,
+   * like when the remote tree is read from the database. */
+  if (ctx->current == REMOTE_REPLICA && !base.isValid() && fs->type == CSYNC_FTW_TYPE_FILE
+      && !ctx->virtual_file_suffix.isEmpty()) {
+      QByteArray virtualFilePath = fs->path + ctx->virtual_file_suffix;
+      if (!ctx->statedb->getFileRecord(virtualFilePath, &base)) {
+          ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
+          return -1;
+      }
+      if (base.isValid() && (base._type == CSYNC_FTW_TYPE_VIRTUAL_FILE
+                                || base._type == CSYNC_FTW_TYPE_VIRTUAL_FILE_DOWNLOAD)) {
+          fs->path = virtualFilePath;
+          fs->phash = csync_path_hash(fs->path);
+          fs->type = static_cast<csync_ftw_type_e>(base._type);
+      } else {
+          base = OCC::SyncJournalFileRecord();
+      }
+  }
+
+  /* A local file with the suffix that was synced as a regular file stays one */
+  if (ctx->current == LOCAL_REPLICA && fs->type == CSYNC_FTW_TYPE_VIRTUAL_FILE
+      && base.isValid() && base._type == CSYNC_FTW_TYPE_FILE) {
+      fs->type = CSYNC_FTW_TYPE_FILE;
+  }
+
   if(base.isValid()) { /* there is an entry in the database */
       /* we have an update! */
       qCInfo(lcUpdate, "Database entry found, compare: %" PRId64 " <-> %" PRId64
@@ -192,6 +232,29 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
                 ((int64_t) fs->modtime), ((int64_t) base._modtime),
                 fs->etag.constData(), base._etag.constData(), (uint64_t) fs->inode, (uint64_t) base._inode,
                 (uint64_t) fs->size, (uint64_t) base._fileSize, *reinterpret_cast<short*>(&fs->remotePerm), *reinterpret_cast<short*>(&base._remotePerm), base._serverHasIgnoredFiles );
+      if (ctx->current == REMOTE_REPLICA && fs->etag != base._etag
+          && fs->type == CSYNC_FTW_TYPE_DIR && base._type == fs->type
+          && !csync_remote_dir_wanted(ctx, fs->path)) {
+          qCInfo(lcUpdate, "%s changed, but the sync is not for it: deferred", fs->path.constData());
+          fs->etag = base._etag;
+          ctx->remote_changes_deferred = true;
+          // Its parents get their new etags, the next sync has to list them anyway
+          ctx->statedb->avoidReadFromDbOnNextSync(fs->path);
+      }
+      if (base._type == CSYNC_FTW_TYPE_VIRTUAL_FILE || base._type == CSYNC_FTW_TYPE_VIRTUAL_FILE_DOWNLOAD) {
+          if (ctx->current == LOCAL_REPLICA && fs->type == CSYNC_FTW_TYPE_VIRTUAL_FILE) {
+              /* The placeholder has no content, its size and modtime don't matter.
+               * It has the type of the record so that it is replaced by the download. */
+              fs->type = static_cast<csync_ftw_type_e>(base._type);
+              fs->instruction = CSYNC_INSTRUCTION_NONE;
+              goto out;
+          }
+          if (ctx->current == REMOTE_REPLICA && base._type == CSYNC_FTW_TYPE_VIRTUAL_FILE_DOWNLOAD) {
+              qCInfo(lcUpdate, "%s was requested for download", fs->path.constData());
+              fs->instruction = CSYNC_INSTRUCTION_EVAL;
+              goto out;
+          }
+      }
       if (ctx->current == REMOTE_REPLICA && fs->etag != base._etag) {
           fs->instruction = CSYNC_INSTRUCTION_EVAL;
 
@@ -275,9 +338,12 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
           // Default to NEW unless we're sure it's a rename.
           fs->instruction = CSYNC_INSTRUCTION_NEW;
 
+          // The journal has the size of the remote file for a placeholder
           bool isRename =
               base.isValid() && base._type == fs->type
-                  && ((base._modtime == fs->modtime && base._fileSize == fs->size) || fs->type == CSYNC_FTW_TYPE_DIR)
+                  && ((base._modtime == fs->modtime
+                          && (base._fileSize == fs->size || fs->type == CSYNC_FTW_TYPE_VIRTUAL_FILE))
+                      || fs->type == CSYNC_FTW_TYPE_DIR)
 #ifdef NO_RENAME_EXTENSION
                   && _csync_sameextension(base._path, fs->path)
 #endif
@@ -303,6 +369,11 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
               if (fs->type == CSYNC_FTW_TYPE_DIR) {
                   csync_rename_record(ctx, base._path, fs->path);
               }
+          } else if (fs->type == CSYNC_FTW_TYPE_VIRTUAL_FILE) {
+              /* Only what the journal knows is a placeholder, a copied one isn't uploaded */
+              qCInfo(lcUpdate, "%s is an unknown placeholder", fs->path.constData());
+              fs->instruction = CSYNC_INSTRUCTION_IGNORE;
+              fs->error_status = CSYNC_STATUS_INDIVIDUAL_IS_VIRTUAL_FILE;
           }
           goto out;
 
@@ -317,6 +388,25 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
               if (!base.isValid())
                   return;
 
+              // Moved with its placeholder, it stays one
+              if (base._type == CSYNC_FTW_TYPE_VIRTUAL_FILE && fs->type == CSYNC_FTW_TYPE_FILE
+                  && !ctx->virtual_file_suffix.isEmpty()) {
+                  fs->type = CSYNC_FTW_TYPE_VIRTUAL_FILE;
+                  fs->path += ctx->virtual_file_suffix;
+                  // The trees and the journal know it by the new path
+                  fs->phash = csync_path_hash(fs->path);
+              }
+
+              // The source isn't discovered, it would not be removed. It's
+              // a new file until the next sync for all paths.
+              const int slash = base._path.lastIndexOf('/');
+              if (slash > 0 && !csync_remote_dir_wanted(ctx, base._path.left(slash))) {
+                  qCInfo(lcUpdate, "%s was moved from %s which the sync is not for", fs->path.constData(), base._path.constData());
+                  ctx->remote_changes_deferred = true;
+                  done = true;
+                  return;
+              }
+
               // Some things prohibit rename detection entirely.
               // Since we don't do the same checks again in reconcile, we can't
               // just skip the candidate, but have to give up completely.
@@ -361,6 +451,18 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
                   return 1;
               }
           }
+
+          /* A new remote file gets a placeholder, unless a local file of that
+           * name is to be compared with it. The local tree is complete already. */
+          if (fs->instruction == CSYNC_INSTRUCTION_NEW
+              && fs->type == CSYNC_FTW_TYPE_FILE
+              && ctx->new_files_are_virtual
+              && !ctx->virtual_file_suffix.isEmpty()
+              && !ctx->local.files.findFile(fs->path)) {
+              fs->type = CSYNC_FTW_TYPE_VIRTUAL_FILE;
+              fs->path += ctx->virtual_file_suffix;
+              fs->phash = csync_path_hash(fs->path);
+          }
           goto out;
       }
   }
@@ -411,13 +513,12 @@ out:
   qCInfo(lcUpdate, "file: %s, instruction: %s <<=", fs->path.constData(),
       csync_instruction_str(fs->instruction));
 
-  QByteArray path = fs->path;
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      ctx->local.files[path] = std::move(fs);
+      ctx->local.files.insert(std::move(fs));
       break;
     case REMOTE_REPLICA:
-      ctx->remote.files[path] = std::move(fs);
+      ctx->remote.files.insert(std::move(fs));
       break;
     default:
       break;
@@ -437,6 +538,10 @@ int csync_walker(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> fs) {
 
   switch (fs->type) {
     case CSYNC_FTW_TYPE_FILE:
+      if (ctx->current == LOCAL_REPLICA && !ctx->virtual_file_suffix.isEmpty()
+          && fs->path.endsWith(ctx->virtual_file_suffix)) {
+          fs->type = CSYNC_FTW_TYPE_VIRTUAL_FILE;
+      }
       if (ctx->current == REMOTE_REPLICA) {
           qCDebug(lcUpdate, "file: %s [file_id=%s size=%" PRIu64 "]", fs->path.constData(), fs->file_id.constData(), fs->size);
       } else {
@@ -463,12 +568,38 @@ int csync_walker(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> fs) {
   return rc;
 }
 
+/* Builds the tree entry straight from the columns of a metadata row,
+ * the journal record would only be an extra copy of every field. */
+static std::unique_ptr<csync_file_stat_t> _csync_file_stat_from_db_row(OCC::SqlQuery &row, QByteArray &&path)
+{
+    using Db = OCC::SyncJournalDb;
+    std::unique_ptr<csync_file_stat_t> st(new csync_file_stat_t);
+    st->path = std::move(path);
+    // The journal has the hash already
+    st->phash = row.int64Value(Db::PHashColumn);
+    st->inode = row.intValue(Db::InodeColumn);
+    st->modtime = row.int64Value(Db::ModtimeColumn);
+    st->type = static_cast<csync_ftw_type_e>(row.intValue(Db::TypeColumn));
+    st->etag = row.baValue(Db::EtagColumn);
+    st->file_id = row.baValue(Db::FileIdColumn);
+    const char *perm = row.textValue(Db::RemotePermColumn);
+    st->remotePerm = OCC::RemotePermissions(perm ? perm : "");
+    st->size = row.int64Value(Db::FileSizeColumn);
+    st->has_ignored_files = row.intValue(Db::IgnoredChildrenRemoteColumn) > 0;
+    st->checksumHeader = row.baValue(Db::ChecksumHeaderColumn);
+    return st;
+}
+
 static bool fill_tree_from_db(CSYNC *ctx, const char *uri)
 {
+    using Db = OCC::SyncJournalDb;
     int64_t count = 0;
     QByteArray skipbase;
     auto &files = ctx->current == LOCAL_REPLICA ? ctx->local.files : ctx->remote.files;
-    auto rowCallback = [ctx, &count, &skipbase, &files](const OCC::SyncJournalFileRecord &rec) {
+    auto rowCallback = [ctx, &count, &skipbase, &files](OCC::SqlQuery &row) {
+        // Only a view on the row, copied once it is known to be kept
+        const auto pathView = row.baView(Db::PathColumn);
+
         if (ctx->current == REMOTE_REPLICA) {
             /* When selective sync is used, the database may have subtrees with a parent
              * whose etag is _invalid_. These are ignored and shall not appear in the
@@ -477,24 +608,26 @@ static bool fill_tree_from_db(CSYNC *ctx, const char *uri)
              * _invalid_, but that is not a problem as the next discovery will retrieve
              * their correct etags again and we don't run into this case.
              */
-            if (rec._etag == "_invalid_") {
-                qCDebug(lcUpdate, "%s selective sync excluded", rec._path.constData());
-                skipbase = rec._path;
+            static const QByteArray invalidEtag = QByteArrayLiteral("_invalid_");
+            if (row.valueEquals(Db::EtagColumn, invalidEtag)) {
+                qCDebug(lcUpdate, "%s selective sync excluded", pathView.constData());
+                skipbase = QByteArray(pathView.constData(), pathView.size());
                 skipbase += '/';
                 return;
             }
 
             /* Skip over all entries with the same base path. Note that this depends
              * strongly on the ordering of the retrieved items. */
-            if (!skipbase.isEmpty() && rec._path.startsWith(skipbase)) {
-                qCDebug(lcUpdate, "%s selective sync excluded because the parent is", rec._path.constData());
+            if (!skipbase.isEmpty() && pathView.startsWith(skipbase)) {
+                qCDebug(lcUpdate, "%s selective sync excluded because the parent is", pathView.constData());
                 return;
             } else {
                 skipbase.clear();
             }
         }
 
-        std::unique_ptr<csync_file_stat_t> st = csync_file_stat_t::fromSyncJournalFileRecord(rec);
+        std::unique_ptr<csync_file_stat_t> st =
+            _csync_file_stat_from_db_row(row, QByteArray(pathView.constData(), pathView.size()));
 
         /* Check for exclusion from the tree.
          * Note that this is only a safety net in case the ignore list changes
@@ -514,11 +647,11 @@ static bool fill_tree_from_db(CSYNC *ctx, const char *uri)
         }
 
         /* store into result list. */
-        files[rec._path] = std::move(st);
+        files.insert(std::move(st));
         ++count;
     };
 
-    if (!ctx->statedb->getFilesBelowPath(uri, rowCallback)) {
+    if (!ctx->statedb->getFileRowsBelowPath(uri, rowCallback)) {
         ctx->status_code = CSYNC_STATUS_STATEDB_LOAD_ERROR;
         return false;
     }
@@ -547,7 +680,260 @@ static bool mark_current_item_ignored( CSYNC *ctx, csync_file_stat_t *previous_f
     return false;
 }
 
+bool csync_remote_dir_wanted(CSYNC *ctx, const QByteArray &path)
+{
+    const auto &paths = ctx->remote_discovery_paths;
+    if (paths.empty() || paths.count(path)) {
+        return true;
+    }
+    // A parent of one of the paths
+    auto it = paths.lower_bound(path + '/');
+    if (it != paths.end() && it->startsWith(path + '/')) {
+        return true;
+    }
+    // Inside one of them
+    for (int slash = path.indexOf('/'); slash > 0; slash = path.indexOf('/', slash + 1)) {
+        if (paths.count(path.left(slash))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Whether the local directory (relative to the sync root) can be restored
+ * from the database with LocalDiscoveryStyle::DatabaseAndFilesystem. */
+static bool _csync_local_dir_from_db(CSYNC *ctx, const char *local_uri)
+{
+    // Minor bug: local_uri doesn't have a trailing /. Example: Assume it's "d/foo"
+    // and we want to check whether we should read from the db. Assume "d/foo a" is
+    // in locally_touched_dirs. Then this check will say no, don't read from the db!
+    // (because "d/foo" < "d/foo a" < "d/foo/bar")
+    // C++14: Could skip the conversion to QByteArray here.
+    auto it = ctx->locally_touched_dirs.lower_bound(QByteArray(local_uri));
+    if (it != ctx->locally_touched_dirs.end() && it->startsWith(local_uri)) {
+        return false;
+    }
+    return true;
+}
+
+/* With LocalDiscoveryStyle::DirectoryModtime: fill entries with the direct
+ * children of the directory from the db if the directory still has the
+ * modtime and inode it had when it was last listed. Subdirectories are
+ * stat'ed so the same check can be done one level deeper.
+ * Returns false if the directory has to be read from the filesystem. */
+static bool _csync_list_local_dir_from_db(CSYNC *ctx, const char *uri, const char *local_uri,
+    std::vector<std::unique_ptr<csync_file_stat_t>> *entries)
+{
+    const csync_file_stat_t *dir = ctx->current_fs;
+    if (!dir || *local_uri == '\0' || !_csync_local_dir_from_db(ctx, local_uri)) {
+        return false;
+    }
+
+    OCC::SyncJournalDb::LocalDirectoryInfo info;
+    if (!ctx->statedb->getLocalDirectoryInfo(local_uri, &info)
+        || info._modtime == 0
+        || info._modtime != dir->modtime
+        || info._inode != dir->inode) {
+        return false;
+    }
+
+    const int prefix_len = strlen(local_uri) + 1;
+    bool ok = true;
+    auto rowCallback = [&](const OCC::SyncJournalFileRecord &rec) {
+        if (!ok) {
+            return;
+        }
+        std::unique_ptr<csync_file_stat_t> st = csync_file_stat_t::fromSyncJournalFileRecord(rec);
+        // csync_ftw() expects the file name only
+        st->path = st->path.mid(prefix_len);
+        if (st->type == CSYNC_FTW_TYPE_DIR) {
+            csync_file_stat_t current;
+            QByteArray fullpath = QByteArray() % uri % '/' % st->path;
+            ctx->update_metrics.local_stats++;
+            if (csync_vio_local_stat(fullpath.constData(), &current) < 0
+                || current.type != CSYNC_FTW_TYPE_DIR) {
+                ok = false;
+                return;
+            }
+            st->modtime = current.modtime;
+            st->inode = current.inode;
+            st->is_hidden = current.is_hidden;
+        }
+        entries->push_back(std::move(st));
+    };
+
+    if (!ctx->statedb->getFilesInDirectory(local_uri, rowCallback) || !ok) {
+        entries->clear();
+        return false;
+    }
+    qCDebug(lcUpdate, "%s unchanged, %zu entries read from db.", local_uri, entries->size());
+    return true;
+}
+
+/* Queue the listings of the subdirectories of uri that the walker is going to
+ * descend into, so they are read while the current directory is processed. */
+static void _csync_prefetch_local_subdirs(CSYNC *ctx, const char *uri, csync_vio_handle_t *dh)
+{
+    const size_t root_len = strlen(ctx->local.uri);
+    const auto names = LocalDirectoryPrefetcher::subdirectories(dh);
+    for (const auto &name : names) {
+        if (ctx->ignore_hidden_files && name.startsWith('.')) {
+            continue;
+        }
+        const QByteArray fullpath = QByteArray() % uri % '/' % name;
+        if (fullpath.size() <= (int)root_len) {
+            continue;
+        }
+        const QByteArray relpath = fullpath.mid(root_len + 1);
+        if (ctx->local_discovery_style == LocalDiscoveryStyle::DatabaseAndFilesystem
+            && _csync_local_dir_from_db(ctx, relpath.constData())) {
+            continue;
+        }
+        if (ctx->exclude_traversal_fn
+            && ctx->exclude_traversal_fn(relpath.constData(), CSYNC_FTW_TYPE_DIR) != CSYNC_NOT_EXCLUDED) {
+            continue;
+        }
+        ctx->local.prefetcher->prefetch(fullpath);
+    }
+}
+
 /* File tree walker */
+/* Rough memory cost of one entry in a tree, including its strings */
+static const qint64 EstimatedTreeEntryMemory =
+    sizeof(csync_file_stat_t) + sizeof(csync_s::FileMap::value_type) + 128;
+
+static bool _csync_tree_memory_exceeded(CSYNC *ctx)
+{
+    if (ctx->max_tree_memory <= 0)
+        return false;
+    const auto entries = static_cast<qint64>(ctx->local.files.size() + ctx->remote.files.size());
+    return entries * EstimatedTreeEntryMemory > ctx->max_tree_memory;
+}
+
+/**
+ * Drops the subtree of a remote directory that was just walked if nothing
+ * in it will be synced, see csync_s::max_tree_memory.
+ *
+ * @a remote_begin is the index of the directory entry in remote.files; its
+ * subtree is the rest of the tree. It is dropped if every remote entry has
+ * a local counterpart under the same path, the local subtree has nothing
+ * else, and all of them are unchanged. The local entries stay in place
+ * until enough of them are dropped to make compacting the tree worth it.
+ */
+static void _csync_drop_unchanged_subtree(CSYNC *ctx, size_t remote_begin)
+{
+    auto &remote = ctx->remote.files;
+    auto &local = ctx->local.files;
+    if (remote_begin >= remote.size())
+        return;
+
+    const QByteArray dir = (remote.begin() + remote_begin)->second->path;
+    const QByteArray prefix = dir + '/';
+    auto localIt = local.find(dir);
+    if (localIt == local.end())
+        return;
+    const size_t local_begin = localIt - local.begin();
+    size_t local_end = local_begin + 1;
+    while (local_end < local.size() && (local.begin() + local_end)->second->path.startsWith(prefix))
+        ++local_end;
+
+    auto unchanged = [](const csync_file_stat_t *fs) {
+        return fs->instruction == CSYNC_INSTRUCTION_NONE && fs->error_status == CSYNC_STATUS_OK;
+    };
+    bool has_files = false;
+    for (auto it = remote.begin() + remote_begin; it != remote.end(); ++it) {
+        if (!unchanged(it->second.get()))
+            return;
+        auto other = local.findFile(it->second->path, it->second->phash);
+        if (!other || !unchanged(other))
+            return;
+        has_files |= it->second->type != CSYNC_FTW_TYPE_DIR;
+    }
+
+    /* Subtrees dropped while walking this one were pushed last */
+    auto &ranges = ctx->local.dropped_ranges;
+    auto inside = ranges.end();
+    size_t dropped_inside = 0;
+    while (inside != ranges.begin() && (inside - 1)->first > local_begin && (inside - 1)->second <= local_end) {
+        --inside;
+        dropped_inside += inside->second - inside->first;
+    }
+    if (remote.size() - remote_begin != local_end - local_begin - dropped_inside) {
+        /* The local subtree has entries that are not on the remote */
+        return;
+    }
+    ranges.erase(inside, ranges.end());
+
+    auto &subtrees = ctx->dropped_subtrees;
+    while (!subtrees.empty() && subtrees.back().startsWith(prefix))
+        subtrees.pop_back();
+    subtrees.push_back(dir);
+    ctx->dropped_unchanged_files |= has_files;
+
+    remote.truncate(remote_begin);
+    ranges.emplace_back(local_begin, local_end);
+
+    // Compacting moves all entries, only do it when it frees a good part of the tree
+    size_t dropped = 0;
+    for (const auto &range : ranges)
+        dropped += range.second - range.first;
+    if (dropped * 4 >= local.size()) {
+        local.eraseRanges(std::move(ranges));
+        ranges.clear();
+    }
+}
+
+/**
+ * Skips the subtree of a remote directory whose etag did not change if the
+ * local subtree has no change either, instead of reading it from the db.
+ *
+ * The local subtree is unchanged if all its entries match their db record
+ * and no record is missing locally. The remote one has the same records
+ * since the etag is the same. So reconcile would find nothing to do and
+ * the contents of @a path are dropped from the local tree right away,
+ * like _csync_drop_unchanged_subtree() does after a walk.
+ */
+static bool _csync_skip_unchanged_subtree(CSYNC *ctx, const char *path)
+{
+    if (!*path)
+        return false;
+    const QByteArray dir(path);
+    const QByteArray prefix = dir + '/';
+    auto &local = ctx->local.files;
+    auto localIt = local.find(dir);
+    if (localIt == local.end() || localIt->second->instruction != CSYNC_INSTRUCTION_NONE
+        || localIt->second->type != CSYNC_FTW_TYPE_DIR)
+        return false;
+
+    /* The local walk inserted the contents of the directory right after it */
+    const size_t local_begin = localIt - local.begin() + 1;
+    size_t local_end = local_begin;
+    bool has_files = false;
+    for (auto it = local.begin() + local_begin; it != local.end() && it->second->path.startsWith(prefix); ++it) {
+        if (it->second->instruction != CSYNC_INSTRUCTION_NONE || it->second->error_status != CSYNC_STATUS_OK)
+            return false;
+        has_files |= it->second->type != CSYNC_FTW_TYPE_DIR;
+        ++local_end;
+    }
+
+    /* Local deletions don't have an entry, they show as a missing record */
+    const qint64 records = ctx->statedb->getFileRecordCountBelowPath(dir);
+    if (records < 0 || records != static_cast<qint64>(local_end - local_begin))
+        return false;
+
+    qCDebug(lcUpdate, "%s unchanged on both sides, skipping %" PRId64 " entries", path, records);
+    if (local_end == local_begin)
+        return true;
+
+    auto &subtrees = ctx->dropped_subtrees;
+    while (!subtrees.empty() && subtrees.back().startsWith(prefix))
+        subtrees.pop_back();
+    subtrees.push_back(dir);
+    ctx->dropped_unchanged_files |= has_files;
+    ctx->local.dropped_ranges.emplace_back(local_begin, local_end);
+    return true;
+}
+
 int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     unsigned int depth) {
   QByteArray filename;
@@ -558,26 +944,34 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
   int read_from_db = 0;
   int rc = 0;
 
+  /* entries of a directory listed with _csync_list_local_dir_from_db() */
+  std::vector<std::unique_ptr<csync_file_stat_t>> db_entries;
+  size_t db_entries_next = 0;
+  bool listed_from_db = false;
+  auto next_dirent = [&]() -> std::unique_ptr<csync_file_stat_t> {
+      if (!listed_from_db) {
+          return csync_vio_readdir(ctx, dh);
+      }
+      if (db_entries_next >= db_entries.size()) {
+          return {};
+      }
+      return std::move(db_entries[db_entries_next++]);
+  };
+
   bool do_read_from_db = (ctx->current == REMOTE_REPLICA && ctx->remote.read_from_db);
   const char *db_uri = uri;
+  const char *local_uri = "";
 
-  if (ctx->current == LOCAL_REPLICA
-      && ctx->local_discovery_style == LocalDiscoveryStyle::DatabaseAndFilesystem) {
-      const char *local_uri = uri + strlen(ctx->local.uri);
+  if (ctx->current == LOCAL_REPLICA) {
+      local_uri = uri + strlen(ctx->local.uri);
       if (*local_uri == '/')
           ++local_uri;
-      db_uri = local_uri;
-      do_read_from_db = true;
+  }
 
-      // Minor bug: local_uri doesn't have a trailing /. Example: Assume it's "d/foo"
-      // and we want to check whether we should read from the db. Assume "d/foo a" is
-      // in locally_touched_dirs. Then this check will say no, don't read from the db!
-      // (because "d/foo" < "d/foo a" < "d/foo/bar")
-      // C++14: Could skip the conversion to QByteArray here.
-      auto it = ctx->locally_touched_dirs.lower_bound(QByteArray(local_uri));
-      if (it != ctx->locally_touched_dirs.end() && it->startsWith(local_uri)) {
-          do_read_from_db = false;
-      }
+  if (ctx->current == LOCAL_REPLICA
+      && ctx->local_discovery_style == LocalDiscoveryStyle::DatabaseAndFilesystem) {
+      db_uri = local_uri;
+      do_read_from_db = _csync_local_dir_from_db(ctx, local_uri);
   }
 
   if (!depth) {
@@ -590,6 +984,9 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
   // if the etag of this dir is still the same, its content is restored from the
   // database.
   if( do_read_from_db ) {
+      if (ctx->current == REMOTE_REPLICA && _csync_skip_unchanged_subtree(ctx, db_uri)) {
+          return 0;
+      }
       if( ! fill_tree_from_db(ctx, db_uri) ) {
         errno = ENOENT;
         ctx->status_code = CSYNC_STATUS_OPENDIR_ERROR;
@@ -598,7 +995,12 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       return 0;
   }
 
-  if ((dh = csync_vio_opendir(ctx, uri)) == NULL) {
+  if (ctx->current == LOCAL_REPLICA
+      && ctx->local_discovery_style == LocalDiscoveryStyle::DirectoryModtime) {
+      listed_from_db = _csync_list_local_dir_from_db(ctx, uri, local_uri, &db_entries);
+  }
+
+  if (!listed_from_db && (dh = csync_vio_opendir(ctx, uri)) == NULL) {
       if (ctx->abort) {
           qCDebug(lcUpdate, "Aborted!");
           ctx->status_code = CSYNC_STATUS_ABORTED;
@@ -641,7 +1043,12 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       goto error;
   }
 
-  while ((dirent = csync_vio_readdir(ctx, dh))) {
+  if (ctx->current == LOCAL_REPLICA && ctx->local.prefetcher && dh && depth > 1
+      && ctx->local_discovery_style != LocalDiscoveryStyle::DirectoryModtime) {
+      _csync_prefetch_local_subdirs(ctx, uri, dh);
+  }
+
+  while ((dirent = next_dirent())) {
     /* Conversion error */
     if (dirent->path.isEmpty() && !dirent->original_path.isEmpty()) {
         ctx->status_code = CSYNC_STATUS_INVALID_CHARACTERS;
@@ -691,6 +1098,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
 
     previous_fs = ctx->current_fs;
     bool recurse = dirent->type == CSYNC_FTW_TYPE_DIR;
+    const size_t remote_begin = ctx->remote.files.size();
 
     /* Call walker function for each file */
     rc = fn(ctx, std::move(dirent));
@@ -733,13 +1141,32 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
         previous_fs->child_modified = ctx->current_fs->child_modified;
     }
 
+    if (ctx->current == REMOTE_REPLICA && recurse && rc == 0 && remote_begin < ctx->remote.files.size()
+        && _csync_tree_memory_exceeded(ctx)) {
+        _csync_drop_unchanged_subtree(ctx, remote_begin);
+    }
+
     ctx->current_fs = previous_fs;
     ctx->remote.read_from_db = read_from_db;
   }
 
-  csync_vio_closedir(ctx, dh);
+  if (dh != NULL) {
+    csync_vio_closedir(ctx, dh);
+  }
   qCDebug(lcUpdate, " <= Closing walk for %s with read_from_db %d", uri, read_from_db);
 
+  /* Remember the stat of directories whose entries came from the filesystem,
+   * see LocalDiscoveryStyle::DirectoryModtime. The modtime only has a
+   * resolution of one second: a directory modified very recently could
+   * change again without its modtime changing. */
+  if (ctx->current == LOCAL_REPLICA && !listed_from_db && ctx->current_fs && *local_uri != '\0'
+      && time(NULL) - ctx->current_fs->modtime > 2) {
+      OCC::SyncJournalDb::LocalDirectoryInfo info;
+      info._modtime = ctx->current_fs->modtime;
+      info._inode = ctx->current_fs->inode;
+      ctx->local.listed_directories.emplace_back(QByteArray(local_uri), info);
+  }
+
   return rc;
 
 error:
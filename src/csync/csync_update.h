@@ -77,6 +77,12 @@ int csync_walker(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> fs);
 int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     unsigned int depth);
 
+/**
+ * @brief Whether the remote directory has to be listed, see
+ * csync_s::remote_discovery_paths.
+ */
+bool OCSYNC_EXPORT csync_remote_dir_wanted(CSYNC *ctx, const QByteArray &path);
+
 #endif /* _CSYNC_UPDATE_H */
 
 /* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
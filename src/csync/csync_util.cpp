@@ -28,11 +28,13 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #include "common/c_jhash.h"
 #include "csync_util.h"
 #include "vio/csync_vio.h"
+#include "common/instancecounter.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.util"
 #include "csync_log.h"
@@ -104,6 +106,12 @@ void csync_memstat_check(void) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO, "Memory: %dK total size, %dK resident, %dK shared",
                  m.size * 4, m.resident * 4, m.shared * 4);
+  if (OCC::InstanceCounts::isEnabled()) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO, "Instances: %d file stats (%dK), %d sync file items",
+        OCC::InstanceCounts::live(OCC::InstanceCounts::FileStats),
+        int(OCC::InstanceCounts::live(OCC::InstanceCounts::FileStats) * sizeof(csync_file_stat_t) / 1024),
+        OCC::InstanceCounts::live(OCC::InstanceCounts::SyncFileItems));
+  }
 }
 
 bool (*csync_file_locked_or_open_ext) (const char*) = 0; // filled in by library user
@@ -181,6 +189,53 @@ static const char short_months[12][4] = {
     "Jan", "Feb", "Mar", "Apr", "May", "Jun",
     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
 };
+
+/* The days since 1970-01-01 of a date of the Gregorian calendar, month from 1 */
+static long long days_from_civil(int year, int month, int day)
+{
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int yoe = year - era * 400;
+    const int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097LL + doe - 719468;
+}
+
+static int parse_digits(const char *p, int count)
+{
+    int value = 0;
+    for (int i = 0; i < count; ++i) {
+        if (p[i] < '0' || p[i] > '9')
+            return -1;
+        value = value * 10 + (p[i] - '0');
+    }
+    return value;
+}
+
+/*
+ * The servers send exactly "Sun, 06 Nov 1994 08:49:37 GMT": read it at
+ * the fixed positions, without sscanf and the time zone juggling of timegm.
+ */
+static bool httpdate_parse_fixed(const char *date, time_t *result)
+{
+    if (strlen(date) != 29 || date[3] != ',' || date[4] != ' ' || date[7] != ' ' || date[11] != ' '
+        || date[16] != ' ' || date[19] != ':' || date[22] != ':' || strcmp(date + 25, " GMT") != 0)
+        return false;
+    const int day = parse_digits(date + 5, 2);
+    const int year = parse_digits(date + 12, 4);
+    const int hour = parse_digits(date + 17, 2);
+    const int min = parse_digits(date + 20, 2);
+    const int sec = parse_digits(date + 23, 2);
+    int month = 0;
+    while (month < 12 && memcmp(date + 8, short_months[month], 3) != 0)
+        month++;
+    if (day < 1 || day > 31 || year < 1970 || hour < 0 || hour > 23 || min < 0 || min > 59
+        || sec < 0 || sec > 60 || month == 12)
+        return false;
+    *result = static_cast<time_t>(((days_from_civil(year, month + 1, day) * 24 + hour) * 60 + min) * 60 + sec);
+    return true;
+}
+
 /*
  * This function is borrowed from libneon's ne_httpdate_parse.
  * Unfortunately that one converts to local time but here UTC is
@@ -193,6 +248,9 @@ time_t oc_httpdate_parse( const char *date ) {
     int n;
     time_t result = 0;
 
+    if (httpdate_parse_fixed(date, &result))
+        return result;
+
     memset(&gmt, 0, sizeof(struct tm));
 
     /*  it goes: Sun, 06 Nov 1994 08:49:37 GMT */
@@ -35,9 +35,30 @@
 #include <QtCore/QFile>
 #endif
 
+#ifdef __APPLE__
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#endif
+
 #include "c_alloc.h"
 #include "c_string.h"
-#include "common/filesystembase.h"
+
+#ifdef __APPLE__
+namespace {
+/* HFS+ lists the names decomposed, and converting them to NFC is at the top
+ * of the discovery profiles of big trees with non latin names. The same
+ * names come back with every sync, so the conversions are remembered. */
+struct NormalizationCache
+{
+    QMutex mutex;
+    QHash<QByteArray, QByteArray> names;
+};
+}
+Q_GLOBAL_STATIC(NormalizationCache, normalizationCache)
+
+// Some MB, a much bigger tree just converts part of the names again
+static const int normalizationCacheLimit = 100000;
+#endif
 
 /* Convert a locale String to UTF8 */
 QByteArray c_utf8_from_locale(const mbchar_t *wstr)
@@ -46,11 +67,22 @@ QByteArray c_utf8_from_locale(const mbchar_t *wstr)
     return QByteArray();
   }
 
+#ifdef _WIN32
+  return c_utf8_from_locale(wstr, wcslen(wstr));
+#else
+  return c_utf8_from_locale(wstr, qstrlen(wstr));
+#endif
+}
+
+QByteArray c_utf8_from_locale(const mbchar_t *wstr, int len)
+{
+  if (wstr == NULL) {
+    return QByteArray();
+  }
+
 #ifdef _WIN32
   QByteArray dst;
   int size_needed;
-  size_t len;
-  len = wcslen(wstr);
   /* Call once to get the required size. */
   size_needed = WideCharToMultiByte(CP_UTF8, 0, wstr, len, NULL, 0, NULL, NULL);
   if (size_needed > 0) {
@@ -64,20 +96,91 @@ QByteArray c_utf8_from_locale(const mbchar_t *wstr)
     if (codec->mibEnum() == 106) { // UTF-8
         // Optimisation for UTF-8: no need to convert to QString.
         // We still need to do it for mac because of normalization
-        return QByteArray(wstr);
+        return QByteArray(wstr, len);
     }
 #endif
+    // ASCII is the same in the locale codecs and in any normalization form
+    int i = 0;
+    while (i < len && static_cast<uchar>(wstr[i]) < 0x80)
+        ++i;
+    if (i == len) {
+        return QByteArray(wstr, len);
+    }
+
+#ifdef __APPLE__
+    auto cache = normalizationCache();
+    {
+        QMutexLocker lock(&cache->mutex);
+        auto it = cache->names.constFind(QByteArray::fromRawData(wstr, len));
+        if (it != cache->names.constEnd()) {
+            return *it;
+        }
+    }
+#endif
+
+    QByteArray dst;
     QTextDecoder dec(codec);
-    QString s = dec.toUnicode(wstr, qstrlen(wstr));
+    QString s = dec.toUnicode(wstr, len);
     if (s.isEmpty() || dec.hasFailure()) {
         /* Conversion error: since we can't report error from this function, just return the original
             string.  We take care of invalid utf-8 in SyncEngine::treewalkFile */
-        return QByteArray(wstr);
+        dst = QByteArray(wstr, len);
+    } else {
+#ifdef __APPLE__
+        s = s.normalized(QString::NormalizationForm_C);
+#endif
+        dst = std::move(s).toUtf8();
     }
+
 #ifdef __APPLE__
-    s = s.normalized(QString::NormalizationForm_C);
+    QMutexLocker lock(&cache->mutex);
+    if (cache->names.size() >= normalizationCacheLimit) {
+        cache->names.clear();
+    }
+    cache->names.insert(QByteArray(wstr, len), dst);
+#endif
+    return dst;
+#endif
+}
+
+const mbchar_t *c_utf8_path_to_locale_buf(const char *str, c_locale_path_buffer &buf)
+{
+    if (str == NULL) {
+        return NULL;
+    }
+#ifdef _WIN32
+    /* What OCC::FileSystem::pathtoUNC() does, straight into the buffer */
+    const int len = strlen(str);
+    int prefix_len = 4; // \\?\ for the drive letter paths
+    if (str[0] == '/' || str[0] == '\\') {
+        // Don't prepend if already UNC
+        prefix_len = (len > 1 && (str[1] == '/' || str[1] == '\\')) ? 0 : 3;
+    }
+    // A UTF-8 path never has fewer bytes than UTF-16 code units
+    buf.resize(prefix_len + len + 1);
+    mbchar_t *dst = buf.data();
+    memcpy(dst, L"\\\\?\\", prefix_len * sizeof(mbchar_t));
+    int converted = MultiByteToWideChar(CP_UTF8, 0, str, len, dst + prefix_len, len);
+    if (converted <= 0 && len > 0) {
+        return NULL;
+    }
+    dst[prefix_len + converted] = L'\0';
+    for (mbchar_t *it = dst; *it; ++it) {
+        if (*it == L'/') {
+            *it = L'\\';
+        }
+    }
+    return dst;
+#else
+#ifndef __APPLE__
+    if (QTextCodec::codecForLocale()->mibEnum() == 106) { // UTF-8
+        return str;
+    }
 #endif
-    return std::move(s).toUtf8();
+    const QByteArray encoded = QFile::encodeName(QString::fromUtf8(str));
+    buf.resize(encoded.size() + 1);
+    memcpy(buf.data(), encoded.constData(), encoded.size() + 1);
+    return buf.constData();
 #endif
 }
 
@@ -104,6 +207,11 @@ mbchar_t* c_utf8_string_to_locale(const char *str)
     }
     return dst;
 #else
+#ifndef __APPLE__
+    if (QTextCodec::codecForLocale()->mibEnum() == 106) { // UTF-8
+        return c_strdup(str);
+    }
+#endif
     return c_strdup(QFile::encodeName(QString::fromUtf8(str)));
 #endif
 }
@@ -114,8 +222,14 @@ mbchar_t* c_utf8_string_to_locale(const char *str)
          return NULL;
      } else {
  #ifdef _WIN32
-         QByteArray unc_str = OCC::FileSystem::pathtoUNC(QByteArray::fromRawData(str, strlen(str)));
-         mbchar_t *dst = c_utf8_string_to_locale(unc_str);
+         c_locale_path_buffer buf;
+         const mbchar_t *converted = c_utf8_path_to_locale_buf(str, buf);
+         if (converted == NULL) {
+             return NULL;
+         }
+         const size_t size_char = (wcslen(converted) + 1) * sizeof(mbchar_t);
+         mbchar_t *dst = (mbchar_t *)c_malloc(size_char);
+         memcpy(dst, converted, size_char);
          return dst;
  #else
          return c_utf8_string_to_locale(str);
@@ -37,6 +37,7 @@
 
 #ifdef __cplusplus
 #include <QByteArray>
+#include <QVarLengthArray>
 
 /**
  * @brief Convert a platform locale string to utf8.
@@ -60,6 +61,32 @@
  */
  QByteArray c_utf8_from_locale(const mbchar_t *str);
 
+/**
+ * @brief Convert the first len characters of a platform locale string to utf8.
+ *
+ * Like c_utf8_from_locale(), for strings that are not null terminated, such
+ * as the names in a directory listing.
+ */
+ QByteArray c_utf8_from_locale(const mbchar_t *str, int len);
+
+/** Scratch space for c_utf8_path_to_locale_buf(), on the stack for most paths */
+typedef QVarLengthArray<mbchar_t, 1024> c_locale_path_buffer;
+
+/**
+ * @brief Converts a unixoid path like c_utf8_path_to_locale(), without a malloc
+ *
+ * The converted path is written to buf, which only allocates for very long
+ * paths. With a UTF-8 locale on Linux no conversion is needed and str itself
+ * is returned.
+ *
+ * @param str The path to convert
+ * @param buf Where the converted path is stored, can be reused for the next one
+ *
+ * @return The converted path, valid as long as both str and buf are, or NULL
+ *         on error. It must not be freed.
+ */
+const mbchar_t *c_utf8_path_to_locale_buf(const char *str, c_locale_path_buffer &buf);
+
 extern "C" {
 
 #endif // __cplusplus
@@ -24,24 +24,31 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include "common/asserts.h"
 
 #include "csync_private.h"
 #include "csync_util.h"
 #include "vio/csync_vio.h"
 #include "vio/csync_vio_local.h"
+#include "vio/csync_vio_local_prefetch.h"
 #include "common/c_jhash.h"
+#include "common/sessionrecorder.h"
 
-csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
+static csync_vio_handle_t *csync_vio_opendir_replica(CSYNC *ctx, const char *name) {
   switch(ctx->current) {
     case REMOTE_REPLICA:
       ASSERT(!ctx->remote.read_from_db);
+      ctx->update_metrics.remote_listings++;
       return ctx->callbacks.remote_opendir_hook(name, ctx->callbacks.vio_userdata);
       break;
     case LOCAL_REPLICA:
 	if( ctx->callbacks.update_callback ) {
         ctx->callbacks.update_callback(ctx->current, name, ctx->callbacks.update_callback_userdata);
 	}
+      if (ctx->local.prefetcher) {
+          return ctx->local.prefetcher->opendir(name);
+      }
       return csync_vio_local_opendir(name);
       break;
     default:
@@ -50,6 +57,21 @@ csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
   return NULL;
 }
 
+csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
+  csync_vio_handle_t *dh = csync_vio_opendir_replica(ctx, name);
+  if (dh && OCC::SessionRecorder::isEnabled()) {
+      /* the local names are absolute, the remote ones relative to the folder */
+      const char *path = name;
+      if (ctx->current == LOCAL_REPLICA) {
+          path += strlen(ctx->local.uri);
+          if (*path == '/')
+              ++path;
+      }
+      OCC::SessionRecorder::beginDirectory(dh, ctx->current == REMOTE_REPLICA, QByteArray(path));
+  }
+  return dh;
+}
+
 int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
   int rc = -1;
 
@@ -58,6 +80,10 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
     return -1;
   }
 
+  if (OCC::SessionRecorder::isEnabled()) {
+      OCC::SessionRecorder::endDirectory(dhandle);
+  }
+
   switch(ctx->current) {
   case REMOTE_REPLICA:
       ASSERT(!ctx->remote.read_from_db);
@@ -65,6 +91,10 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
       rc = 0;
       break;
   case LOCAL_REPLICA:
+      if (ctx->local.prefetcher) {
+          rc = LocalDirectoryPrefetcher::closedir(dhandle);
+          break;
+      }
       rc = csync_vio_local_closedir(dhandle);
       break;
   default:
@@ -74,15 +104,19 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
   return rc;
 }
 
-std::unique_ptr<csync_file_stat_t> csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
+static std::unique_ptr<csync_file_stat_t> csync_vio_readdir_replica(CSYNC *ctx, csync_vio_handle_t *dhandle) {
   switch(ctx->current) {
     case REMOTE_REPLICA:
       ASSERT(!ctx->remote.read_from_db);
       return ctx->callbacks.remote_readdir_hook(dhandle, ctx->callbacks.vio_userdata);
       break;
-    case LOCAL_REPLICA:
-      return csync_vio_local_readdir(dhandle);
-      break;
+    case LOCAL_REPLICA: {
+      auto dirent = ctx->local.prefetcher ? LocalDirectoryPrefetcher::readdir(dhandle)
+                                          : csync_vio_local_readdir(dhandle);
+      if (dirent)
+          ctx->update_metrics.local_stats++;
+      return dirent;
+    }
     default:
       ASSERT(false);
   }
@@ -90,6 +124,16 @@ std::unique_ptr<csync_file_stat_t> csync_vio_readdir(CSYNC *ctx, csync_vio_handl
   return NULL;
 }
 
+std::unique_ptr<csync_file_stat_t> csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
+  auto dirent = csync_vio_readdir_replica(ctx, dhandle);
+  if (dirent && OCC::SessionRecorder::isEnabled()) {
+      OCC::SessionRecorder::addEntry(dhandle, dirent->path, dirent->type == CSYNC_FTW_TYPE_DIR,
+          dirent->size, dirent->modtime,
+          ctx->current == REMOTE_REPLICA ? dirent->remotePerm.toString() : QByteArray());
+  }
+  return dirent;
+}
+
 char *csync_vio_get_status_string(CSYNC *ctx) {
   if(ctx->error_string) {
     return ctx->error_string;
@@ -0,0 +1,139 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2018 by the ownCloud developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+
+#include <QThread>
+#include <QtConcurrent>
+
+#include "vio/csync_vio_local_prefetch.h"
+#include "vio/csync_vio_local.h"
+
+LocalDirectoryPrefetcher::LocalDirectoryPrefetcher(int threadCount)
+{
+    _pool.setMaxThreadCount(qMax(1, threadCount));
+}
+
+LocalDirectoryPrefetcher::~LocalDirectoryPrefetcher()
+{
+    clear();
+}
+
+int LocalDirectoryPrefetcher::defaultThreadCount()
+{
+    static int threads = [] {
+        bool ok = false;
+        int env = qgetenv("OWNCLOUD_LOCAL_DISCOVERY_THREADS").toInt(&ok);
+        if (ok)
+            return env;
+        // The work is mostly waiting on the disk, a few more threads than
+        // cores helps on network mounts without hurting local disks.
+        return qBound(2, QThread::idealThreadCount(), 8);
+    }();
+    return threads;
+}
+
+LocalDirectoryPrefetcher::ListingPtr LocalDirectoryPrefetcher::readListing(const QByteArray &path)
+{
+    ListingPtr listing(new Listing);
+    auto dh = csync_vio_local_opendir(path.constData());
+    if (!dh) {
+        listing->error = errno;
+        return listing;
+    }
+    while (auto dirent = csync_vio_local_readdir(dh)) {
+        listing->entries.push_back(std::move(dirent));
+    }
+    csync_vio_local_closedir(dh);
+    return listing;
+}
+
+void LocalDirectoryPrefetcher::prefetch(const QByteArray &path)
+{
+    QMutexLocker locker(&_mutex);
+    if (_pending.contains(path))
+        return;
+    _pending.insert(path, QtConcurrent::run(&_pool, &LocalDirectoryPrefetcher::readListing, path));
+}
+
+csync_vio_handle_t *LocalDirectoryPrefetcher::opendir(const QByteArray &path)
+{
+    QFuture<ListingPtr> future;
+    bool found = false;
+    {
+        QMutexLocker locker(&_mutex);
+        auto it = _pending.find(path);
+        if (it != _pending.end()) {
+            future = *it;
+            _pending.erase(it);
+            found = true;
+        }
+    }
+
+    // If the read was not picked up by a worker yet, waiting for the
+    // result runs it in this thread.
+    ListingPtr listing = found ? future.result() : readListing(path);
+
+    if (listing->error != 0) {
+        errno = listing->error;
+        return nullptr;
+    }
+    return new ListingPtr(std::move(listing));
+}
+
+std::unique_ptr<csync_file_stat_t> LocalDirectoryPrefetcher::readdir(csync_vio_handle_t *handle)
+{
+    auto &listing = *static_cast<ListingPtr *>(handle);
+    if (listing->next >= listing->entries.size())
+        return {};
+    return std::move(listing->entries[listing->next++]);
+}
+
+int LocalDirectoryPrefetcher::closedir(csync_vio_handle_t *handle)
+{
+    if (!handle) {
+        errno = EBADF;
+        return -1;
+    }
+    delete static_cast<ListingPtr *>(handle);
+    return 0;
+}
+
+QVector<QByteArray> LocalDirectoryPrefetcher::subdirectories(csync_vio_handle_t *handle)
+{
+    QVector<QByteArray> result;
+    const auto &listing = *static_cast<ListingPtr *>(handle);
+    for (size_t i = listing->next; i < listing->entries.size(); ++i) {
+        const auto &entry = listing->entries[i];
+        if (entry->type == CSYNC_FTW_TYPE_DIR && !entry->path.isEmpty())
+            result.append(entry->path);
+    }
+    return result;
+}
+
+void LocalDirectoryPrefetcher::clear()
+{
+    _pool.clear();
+    {
+        QMutexLocker locker(&_mutex);
+        _pending.clear();
+    }
+    _pool.waitForDone();
+}
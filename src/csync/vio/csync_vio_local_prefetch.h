@@ -0,0 +1,100 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2018 by the ownCloud developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _CSYNC_VIO_LOCAL_PREFETCH_H
+#define _CSYNC_VIO_LOCAL_PREFETCH_H
+
+#include <QByteArray>
+#include <QFuture>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QVector>
+
+#include <memory>
+#include <vector>
+
+#include "csync.h"
+
+/**
+ * @brief Reads local directory listings ahead of the update walker
+ *
+ * csync_ftw() still visits the entries of the local tree one by one and in
+ * the same order, so the update detection itself stays sequential. What is
+ * moved to a small thread pool is the opendir/readdir/stat work for the
+ * subdirectories of the directory that is currently being walked. On slow
+ * disks and network mounts that work dominates the local discovery time.
+ *
+ * The handles returned by opendir() are used in place of the ones from
+ * csync_vio_local_opendir() while a prefetcher is installed in the context.
+ */
+class OCSYNC_EXPORT LocalDirectoryPrefetcher
+{
+public:
+    /** Uses @a threadCount worker threads, see defaultThreadCount(). */
+    explicit LocalDirectoryPrefetcher(int threadCount);
+    ~LocalDirectoryPrefetcher();
+
+    /**
+     * Number of threads used for local discovery.
+     *
+     * Can be overridden with OWNCLOUD_LOCAL_DISCOVERY_THREADS; a value of
+     * 1 or less disables prefetching.
+     */
+    static int defaultThreadCount();
+
+    /** Starts reading the listing of @a path in the background. */
+    void prefetch(const QByteArray &path);
+
+    /**
+     * Returns a handle to the listing of @a path.
+     *
+     * Waits for a pending prefetch or reads the directory in the calling
+     * thread if it was never requested. Returns NULL and sets errno if the
+     * directory could not be opened.
+     */
+    csync_vio_handle_t *opendir(const QByteArray &path);
+    static std::unique_ptr<csync_file_stat_t> readdir(csync_vio_handle_t *handle);
+    static int closedir(csync_vio_handle_t *handle);
+
+    /** Names of the subdirectories in a listing that has not been fully read yet. */
+    static QVector<QByteArray> subdirectories(csync_vio_handle_t *handle);
+
+    /** Drops all pending listings and waits for the running reads to finish. */
+    void clear();
+
+private:
+    struct Listing
+    {
+        int error = 0;
+        std::vector<std::unique_ptr<csync_file_stat_t>> entries;
+        size_t next = 0;
+    };
+    using ListingPtr = QSharedPointer<Listing>;
+
+    static ListingPtr readListing(const QByteArray &path);
+
+    QThreadPool _pool;
+    QMutex _mutex;
+    QHash<QByteArray, QFuture<ListingPtr>> _pending;
+};
+
+#endif /* _CSYNC_VIO_LOCAL_PREFETCH_H */
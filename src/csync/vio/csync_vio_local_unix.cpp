@@ -19,6 +19,10 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -26,6 +30,9 @@
 #include <dirent.h>
 #include <stdio.h>
 
+#include <QAtomicInt>
+
+#include "config_csync.h"
 #include "c_private.h"
 #include "c_lib.h"
 #include "c_string.h"
@@ -46,24 +53,28 @@ typedef struct dhandle_s {
 } dhandle_t;
 
 static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf);
+static int _csync_vio_local_stat_at(int dir_fd, const char *name, csync_file_stat_t *buf);
 
 csync_vio_handle_t *csync_vio_local_opendir(const char *name) {
   dhandle_t *handle = NULL;
-  mbchar_t *dirname = NULL;
+  const mbchar_t *dirname = NULL;
 
-  handle = (dhandle_t*)c_malloc(sizeof(dhandle_t));
+  c_locale_path_buffer buf;
 
-  dirname = c_utf8_path_to_locale(name);
+  dirname = c_utf8_path_to_locale_buf(name, buf);
+  if (dirname == NULL) {
+    errno = ENOENT;
+    return NULL;
+  }
 
+  handle = (dhandle_t*)c_malloc(sizeof(dhandle_t));
   handle->dh = _topendir( dirname );
   if (handle->dh == NULL) {
-    c_free_locale_string(dirname);
     SAFE_FREE(handle);
     return NULL;
   }
 
   handle->path = c_strdup(name);
-  c_free_locale_string(dirname);
 
   return (csync_vio_handle_t *) handle;
 }
@@ -102,9 +113,8 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *d
 
   file_stat.reset(new csync_file_stat_t);
   file_stat->path = c_utf8_from_locale(dirent->d_name);
-  QByteArray fullPath = QByteArray() % const_cast<const char *>(handle->path) % '/' % QByteArray() % const_cast<const char *>(dirent->d_name);
   if (file_stat->path.isNull()) {
-      file_stat->original_path = fullPath;
+      file_stat->original_path = QByteArray() % const_cast<const char *>(handle->path) % '/' % QByteArray() % const_cast<const char *>(dirent->d_name);
       CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Invalid characters in file/directory name, please rename: \"%s\" (%s)",
                 dirent->d_name, handle->path);
   }
@@ -116,7 +126,13 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *d
     case DT_SOCK:
     case DT_CHR:
     case DT_BLK:
-      break;
+      /* Will get excluded by _csync_detect_update, no need to stat. */
+      file_stat->type = CSYNC_FTW_TYPE_SKIP;
+      return file_stat;
+    case DT_LNK:
+      /* Symlinks are ignored, their attributes are never looked at. */
+      file_stat->type = CSYNC_FTW_TYPE_SLINK;
+      return file_stat;
     case DT_DIR:
     case DT_REG:
       if (dirent->d_type == DT_DIR) {
@@ -133,7 +149,9 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *d
   if (file_stat->path.isNull())
       return file_stat;
 
-  if (_csync_vio_local_stat_mb(fullPath.constData(), file_stat.get()) < 0) {
+  /* Stat relative to the open directory: that saves resolving the full
+   * path for every entry. */
+  if (_csync_vio_local_stat_at(dirfd(handle->dh), dirent->d_name, file_stat.get()) < 0) {
       // Will get excluded by _csync_detect_update.
       file_stat->type = CSYNC_FTW_TYPE_SKIP;
   }
@@ -143,21 +161,18 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *d
 
 int csync_vio_local_stat(const char *uri, csync_file_stat_t *buf)
 {
-    mbchar_t *wuri = c_utf8_path_to_locale(uri);
+    c_locale_path_buffer pathBuf;
+    const mbchar_t *wuri = c_utf8_path_to_locale_buf(uri, pathBuf);
     *buf = csync_file_stat_t();
-    int rc = _csync_vio_local_stat_mb(wuri, buf);
-    c_free_locale_string(wuri);
-    return rc;
-}
-
-static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf)
-{
-    csync_stat_t sb;
-
-    if (_tstat(wuri, &sb) < 0) {
+    if (wuri == NULL) {
+        errno = ENOENT;
         return -1;
     }
+    return _csync_vio_local_stat_mb(wuri, buf);
+}
 
+static void _csync_vio_local_fill_stat(const csync_stat_t &sb, csync_file_stat_t *buf)
+{
     switch (sb.st_mode & S_IFMT) {
     case S_IFDIR:
       buf->type = CSYNC_FTW_TYPE_DIR;
@@ -183,5 +198,76 @@ static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf
   buf->inode = sb.st_ino;
   buf->modtime = sb.st_mtime;
   buf->size = sb.st_size;
-  return 0;
+}
+
+static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf)
+{
+    csync_stat_t sb;
+
+    if (_tstat(wuri, &sb) < 0) {
+        return -1;
+    }
+
+    _csync_vio_local_fill_stat(sb, buf);
+    return 0;
+}
+
+#ifdef HAVE_STATX
+/* statx() only fetches what we ask for, which is cheaper on network file
+ * systems. Returns -1 with errno ENOSYS if the kernel doesn't have it. */
+static int _csync_vio_local_statx(int dir_fd, const char *name, csync_file_stat_t *buf)
+{
+    static QAtomicInt unsupported;
+    if (unsupported.load()) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    struct statx sx;
+    if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_SYNC_AS_STAT,
+            STATX_TYPE | STATX_MODE | STATX_INO | STATX_MTIME | STATX_SIZE, &sx) < 0) {
+        if (errno == ENOSYS)
+            unsupported.store(1);
+        return -1;
+    }
+
+    switch (sx.stx_mode & S_IFMT) {
+    case S_IFDIR:
+      buf->type = CSYNC_FTW_TYPE_DIR;
+      break;
+    case S_IFREG:
+      buf->type = CSYNC_FTW_TYPE_FILE;
+      break;
+    case S_IFLNK:
+    case S_IFSOCK:
+      buf->type = CSYNC_FTW_TYPE_SLINK;
+      break;
+    default:
+      buf->type = CSYNC_FTW_TYPE_SKIP;
+      break;
+    }
+
+    buf->inode = sx.stx_ino;
+    buf->modtime = sx.stx_mtime.tv_sec;
+    buf->size = sx.stx_size;
+    return 0;
+}
+#endif
+
+static int _csync_vio_local_stat_at(int dir_fd, const char *name, csync_file_stat_t *buf)
+{
+#ifdef HAVE_STATX
+    int rc = _csync_vio_local_statx(dir_fd, name, buf);
+    if (rc == 0 || errno != ENOSYS) {
+        return rc;
+    }
+#endif
+
+    csync_stat_t sb;
+    if (fstatat(dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+        return -1;
+    }
+
+    _csync_vio_local_fill_stat(sb, buf);
+    return 0;
 }
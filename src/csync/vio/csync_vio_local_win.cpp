@@ -46,10 +46,73 @@ typedef struct dhandle_s {
   HANDLE hFind;
   int firstFind;
   mbchar_t *path; // Always ends with '\'
+
+  /* Directory handle and buffer for the bulk listing, see
+   * _csync_vio_local_opendir_bulk(). hDir is INVALID_HANDLE_VALUE if
+   * the FindFirstFile() API is used instead. */
+  HANDLE hDir;
+  char *buffer;
+  FILE_ID_BOTH_DIR_INFO *current;
+
+  /* Where _csync_vio_local_entry_path() puts the full paths of the
+   * entries, it only grows */
+  mbchar_t *entryPath;
+  size_t entryPathSize;
 } dhandle_t;
 
+/* Size of the buffer for GetFileInformationByHandleEx, enough for a few
+ * hundred entries per call. */
+#define BULK_BUFFER_SIZE (64 * 1024)
+
 static int _csync_vio_local_stat_mb(const mbchar_t *uri, csync_file_stat_t *buf);
 
+/* Returns the path of the directory with name appended, in a buffer of the
+ * handle: stating the entries doesn't allocate for each of them. Valid
+ * until the next call. */
+static const mbchar_t *_csync_vio_local_entry_path(dhandle_t *handle, const mbchar_t *name, size_t nameLen)
+{
+    const size_t pathLen = std::wcslen(handle->path); // ends with '\', by construction
+    const size_t needed = pathLen + nameLen + 1;
+    if (needed > handle->entryPathSize) {
+        handle->entryPathSize = qMax(needed, 2 * handle->entryPathSize);
+        handle->entryPath = (mbchar_t *)c_realloc(handle->entryPath, handle->entryPathSize * sizeof(mbchar_t));
+        memcpy(handle->entryPath, handle->path, pathLen * sizeof(mbchar_t));
+    }
+    memcpy(handle->entryPath + pathLen, name, nameLen * sizeof(mbchar_t));
+    handle->entryPath[pathLen + nameLen] = L'\0';
+    return handle->entryPath;
+}
+
+/* Lists the directory with GetFileInformationByHandleEx(FileIdBothDirectoryInfo).
+ * That returns the file id together with the other attributes, so no file
+ * needs to be opened to get it. File systems that don't support it fall back
+ * to FindFirstFile(). */
+static bool _csync_vio_local_opendir_bulk(dhandle_t *handle, const mbchar_t *dirname)
+{
+    handle->hDir = CreateFileW(dirname, FILE_LIST_DIRECTORY,
+                               FILE_SHARE_WRITE | FILE_SHARE_READ | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (handle->hDir == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    handle->buffer = (char *)c_malloc(BULK_BUFFER_SIZE);
+    if (GetFileInformationByHandleEx(handle->hDir, FileIdBothDirectoryRestartInfo,
+            handle->buffer, BULK_BUFFER_SIZE)) {
+        handle->current = (FILE_ID_BOTH_DIR_INFO *)handle->buffer;
+        return true;
+    }
+    if (GetLastError() == ERROR_NO_MORE_FILES) {
+        /* empty directory */
+        return true;
+    }
+
+    CloseHandle(handle->hDir);
+    handle->hDir = INVALID_HANDLE_VALUE;
+    SAFE_FREE(handle->buffer);
+    return false;
+}
+
 csync_vio_handle_t *csync_vio_local_opendir(const char *name) {
   dhandle_t *handle = NULL;
   mbchar_t *dirname = NULL;
@@ -70,8 +133,24 @@ csync_vio_handle_t *csync_vio_local_opendir(const char *name) {
       SAFE_FREE(h);
   }
 
+  handle->hDir = INVALID_HANDLE_VALUE;
+  handle->buffer = NULL;
+  handle->current = NULL;
+  handle->entryPath = NULL;
+  handle->entryPathSize = 0;
+
   if( dirname ) {
-      handle->hFind = FindFirstFile(dirname, &(handle->ffd));
+      dirname[std::wcslen(dirname) - 1] = L'\0'; // remove the * for the bulk listing
+      if (_csync_vio_local_opendir_bulk(handle, dirname)) {
+          handle->hFind = INVALID_HANDLE_VALUE;
+          handle->firstFind = 0;
+          handle->path = dirname;
+          return (csync_vio_handle_t *) handle;
+      }
+      dirname[std::wcslen(dirname)] = L'*';
+
+      handle->hFind = FindFirstFileEx(dirname, FindExInfoBasic, &(handle->ffd),
+          FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
   }
 
   if (!dirname || handle->hFind == INVALID_HANDLE_VALUE) {
@@ -104,8 +183,16 @@ int csync_vio_local_closedir(csync_vio_handle_t *dhandle) {
   }
 
   handle = (dhandle_t *) dhandle;
+  if (handle->hDir != INVALID_HANDLE_VALUE) {
+      // CloseHandle returns non-zero on success
+      if (CloseHandle(handle->hDir) != 0) {
+          rc = 0;
+      } else {
+          errno = EBADF;
+      }
+      SAFE_FREE(handle->buffer);
   // FindClose returns non-zero on success
-  if( FindClose(handle->hFind) != 0 ) {
+  } else if( FindClose(handle->hFind) != 0 ) {
       rc = 0;
   } else {
       // error case, set errno
@@ -113,6 +200,7 @@ int csync_vio_local_closedir(csync_vio_handle_t *dhandle) {
   }
 
   c_free_locale_string(handle->path);
+  SAFE_FREE(handle->entryPath);
   SAFE_FREE(handle);
 
   return rc;
@@ -137,6 +225,90 @@ static time_t FileTimeToUnixTime(FILETIME *filetime, DWORD *remainder)
     }
 }
 
+static void _csync_vio_local_fill_type(DWORD attributes, DWORD reparseTag, csync_file_stat_t *file_stat)
+{
+    if (attributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+        // Detect symlinks, and treat junctions as symlinks too.
+        if (reparseTag == IO_REPARSE_TAG_SYMLINK
+            || reparseTag == IO_REPARSE_TAG_MOUNT_POINT) {
+            file_stat->type = CSYNC_FTW_TYPE_SLINK;
+        } else {
+            // The SIS and DEDUP reparse points should be treated as
+            // regular files. We don't know about the other ones yet,
+            // but will also treat them normally for now.
+            file_stat->type = CSYNC_FTW_TYPE_FILE;
+        }
+    } else if (attributes & FILE_ATTRIBUTE_DEVICE
+               || attributes & FILE_ATTRIBUTE_OFFLINE
+               || attributes & FILE_ATTRIBUTE_TEMPORARY) {
+        file_stat->type = CSYNC_FTW_TYPE_SKIP;
+    } else if (attributes & FILE_ATTRIBUTE_DIRECTORY) {
+        file_stat->type = CSYNC_FTW_TYPE_DIR;
+    } else {
+        file_stat->type = CSYNC_FTW_TYPE_FILE;
+    }
+
+    /* Check for the hidden flag */
+    if (attributes & FILE_ATTRIBUTE_HIDDEN) {
+        file_stat->is_hidden = true;
+    }
+}
+
+static std::unique_ptr<csync_file_stat_t> _csync_vio_local_readdir_bulk(dhandle_t *handle)
+{
+    while (true) {
+        if (!handle->current) {
+            if (!GetFileInformationByHandleEx(handle->hDir, FileIdBothDirectoryInfo,
+                    handle->buffer, BULK_BUFFER_SIZE)) {
+                if (GetLastError() != ERROR_NO_MORE_FILES) {
+                    errno = EACCES; // no more files is fine. Otherwise EACCESS
+                }
+                return nullptr;
+            }
+            handle->current = (FILE_ID_BOTH_DIR_INFO *)handle->buffer;
+        }
+
+        FILE_ID_BOTH_DIR_INFO *info = handle->current;
+        if (info->NextEntryOffset) {
+            handle->current = (FILE_ID_BOTH_DIR_INFO *)((char *)info + info->NextEntryOffset);
+        } else {
+            handle->current = NULL;
+        }
+
+        // FileName is not null terminated
+        const WCHAR *name = info->FileName;
+        const size_t nameLen = info->FileNameLength / sizeof(WCHAR);
+        if ((nameLen == 1 && name[0] == L'.') || (nameLen == 2 && name[0] == L'.' && name[1] == L'.'))
+            continue;
+
+        std::unique_ptr<csync_file_stat_t> file_stat(new csync_file_stat_t);
+        file_stat->path = c_utf8_from_locale(name, nameLen);
+
+        // For reparse points EaSize holds the reparse tag.
+        _csync_vio_local_fill_type(info->FileAttributes, info->EaSize, file_stat.get());
+
+        file_stat->size = info->EndOfFile.QuadPart;
+        FILETIME lastWrite;
+        lastWrite.dwLowDateTime = info->LastWriteTime.LowPart;
+        lastWrite.dwHighDateTime = info->LastWriteTime.HighPart;
+        DWORD rem;
+        file_stat->modtime = FileTimeToUnixTime(&lastWrite, &rem);
+
+        /* Same truncation as in _csync_vio_local_stat_mb, so the inodes
+         * stored in the journal still match. */
+        file_stat->inode = info->FileId.QuadPart & 0x0000FFFFFFFFFFFF;
+
+        if (info->FileId.QuadPart == 0) {
+            // Some file systems don't report ids in the listing.
+            if (_csync_vio_local_stat_mb(_csync_vio_local_entry_path(handle, name, nameLen), file_stat.get()) < 0) {
+                // Will get excluded by _csync_detect_update.
+                file_stat->type = CSYNC_FTW_TYPE_SKIP;
+            }
+        }
+        return file_stat;
+    }
+}
+
 std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *dhandle) {
 
   dhandle_t *handle = NULL;
@@ -147,6 +319,10 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *d
 
   errno = 0;
 
+  if (handle->hDir != INVALID_HANDLE_VALUE) {
+      return _csync_vio_local_readdir_bulk(handle);
+  }
+
   // the win32 functions get the first valid entry with the opendir
   // thus we must not jump to next entry if it was the first find.
   if( handle->firstFind ) {
@@ -168,41 +344,13 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *d
   file_stat.reset(new csync_file_stat_t);
   file_stat->path = path;
 
-  if (handle->ffd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
-      // Detect symlinks, and treat junctions as symlinks too.
-      if (handle->ffd.dwReserved0 == IO_REPARSE_TAG_SYMLINK
-          || handle->ffd.dwReserved0 == IO_REPARSE_TAG_MOUNT_POINT) {
-          file_stat->type = CSYNC_FTW_TYPE_SLINK;
-      } else {
-          // The SIS and DEDUP reparse points should be treated as
-          // regular files. We don't know about the other ones yet,
-          // but will also treat them normally for now.
-          file_stat->type = CSYNC_FTW_TYPE_FILE;
-      }
-    } else if (handle->ffd.dwFileAttributes & FILE_ATTRIBUTE_DEVICE
-                || handle->ffd.dwFileAttributes & FILE_ATTRIBUTE_OFFLINE
-                || handle->ffd.dwFileAttributes & FILE_ATTRIBUTE_TEMPORARY) {
-        file_stat->type = CSYNC_FTW_TYPE_SKIP;
-    } else if (handle->ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-        file_stat->type = CSYNC_FTW_TYPE_DIR;
-    } else {
-        file_stat->type = CSYNC_FTW_TYPE_FILE;
-    }
-
-    /* Check for the hidden flag */
-    if( handle->ffd.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN ) {
-        file_stat->is_hidden = true;
-    }
+  _csync_vio_local_fill_type(handle->ffd.dwFileAttributes, handle->ffd.dwReserved0, file_stat.get());
 
     file_stat->size = (handle->ffd.nFileSizeHigh * ((int64_t)(MAXDWORD)+1)) + handle->ffd.nFileSizeLow;
     file_stat->modtime = FileTimeToUnixTime(&handle->ffd.ftLastWriteTime, &rem);
 
-    std::wstring fullPath;
-    fullPath.reserve(std::wcslen(handle->path) + std::wcslen(handle->ffd.cFileName));
-    fullPath += handle->path; // path always ends with '\', by construction
-    fullPath += handle->ffd.cFileName;
-
-    if (_csync_vio_local_stat_mb(fullPath.data(), file_stat.get()) < 0) {
+    const mbchar_t *fullPath = _csync_vio_local_entry_path(handle, handle->ffd.cFileName, std::wcslen(handle->ffd.cFileName));
+    if (_csync_vio_local_stat_mb(fullPath, file_stat.get()) < 0) {
         // Will get excluded by _csync_detect_update.
         file_stat->type = CSYNC_FTW_TYPE_SKIP;
     }
@@ -213,10 +361,13 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *d
 
 int csync_vio_local_stat(const char *uri, csync_file_stat_t *buf)
 {
-    mbchar_t *wuri = c_utf8_path_to_locale(uri);
-    int rc = _csync_vio_local_stat_mb(wuri, buf);
-    c_free_locale_string(wuri);
-    return rc;
+    c_locale_path_buffer pathBuf;
+    const mbchar_t *wuri = c_utf8_path_to_locale_buf(uri, pathBuf);
+    if (wuri == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    return _csync_vio_local_stat_mb(wuri, buf);
 }
 
 static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf)
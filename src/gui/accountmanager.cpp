@@ -22,6 +22,8 @@
 #include <cookiejar.h>
 #include <QSettings>
 #include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QNetworkAccessManager>
 
 namespace {
@@ -33,6 +35,9 @@ static const char caCertsKeyC[] = "CaCertificates";
 static const char accountsC[] = "Accounts";
 static const char versionC[] = "version";
 static const char serverVersionC[] = "serverVersion";
+static const char chunkUploadThroughputC[] = "chunkUploadThroughput";
+static const char capabilitiesC[] = "capabilities";
+static const char davUserC[] = "davUser";
 }
 
 
@@ -176,6 +181,15 @@ void AccountManager::saveAccountHelper(Account *acc, QSettings &settings, bool s
 {
     settings.setValue(QLatin1String(urlC), acc->_url.toString());
     settings.setValue(QLatin1String(serverVersionC), acc->_serverVersion);
+    if (acc->chunkUploadThroughput() > 0)
+        settings.setValue(QLatin1String(chunkUploadThroughputC), acc->chunkUploadThroughput());
+    // The next start syncs with them before the server answers, see ConnectionValidator
+    if (acc->hasCapabilities()) {
+        settings.setValue(QLatin1String(capabilitiesC),
+            QJsonDocument(QJsonObject::fromVariantMap(acc->capabilities().toVariantMap())).toJson(QJsonDocument::Compact));
+    }
+    if (!acc->_davUser.isEmpty())
+        settings.setValue(QLatin1String(davUserC), acc->_davUser);
     if (acc->_credentials) {
         if (saveCredentials) {
             // Only persist the credentials if the parameter is set, on migration from 1.8.x
@@ -253,6 +267,10 @@ AccountPtr AccountManager::loadAccountHelper(QSettings &settings)
     qCInfo(lcAccountManager) << "Account for" << acc->url() << "using auth type" << authType;
 
     acc->_serverVersion = settings.value(QLatin1String(serverVersionC)).toString();
+    acc->setChunkUploadThroughput(settings.value(QLatin1String(chunkUploadThroughputC)).toULongLong());
+    acc->_davUser = settings.value(QLatin1String(davUserC)).toString();
+    const QJsonDocument capabilities = QJsonDocument::fromJson(settings.value(QLatin1String(capabilitiesC)).toByteArray());
+    acc->setCapabilities(capabilities.object().toVariantMap());
 
     // We want to only restore settings for that auth type and the user value
     acc->_settingsMap.insert(QLatin1String(userC), settings.value(userC));
@@ -33,19 +33,28 @@
 #include "creds/httpcredentialsgui.h"
 #include "tooltipupdater.h"
 #include "filesystem.h"
+#include "syncrunmetrics.h"
 
 #include <math.h>
 
 #include <QDesktopServices>
+#include <QDialog>
+#include <QDialogButtonBox>
 #include <QDir>
+#include <QFileDialog>
+#include <QHeaderView>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QListWidgetItem>
 #include <QMessageBox>
+#include <QPushButton>
 #include <QAction>
 #include <QVBoxLayout>
 #include <QTreeView>
 #include <QKeySequence>
 #include <QIcon>
 #include <QVariant>
+#include <QTableWidget>
 #include <QToolTip>
 #include <qstringlistmodel.h>
 #include <qpropertyanimation.h>
@@ -303,7 +312,7 @@ void AccountSettings::slotCustomContextMenuRequested(const QPoint &pos)
 
     if (!folderPaused) {
         ac = menu->addAction(tr("Force sync now"));
-        if (folderMan->currentSyncFolder() == folderMan->folder(alias)) {
+        if (folderMan->currentSyncFolders().contains(folderMan->folder(alias))) {
             ac->setText(tr("Restart sync"));
         }
         ac->setEnabled(folderConnected);
@@ -313,6 +322,17 @@ void AccountSettings::slotCustomContextMenuRequested(const QPoint &pos)
     ac = menu->addAction(folderPaused ? tr("Resume sync") : tr("Pause sync"));
     connect(ac, &QAction::triggered, this, &AccountSettings::slotEnableCurrentFolder);
 
+    if (Folder *folder = folderMan->folder(alias)) {
+        ac = menu->addAction(tr("Create placeholders for new files"));
+        ac->setToolTip(tr("New files on the server are downloaded when they are opened"));
+        ac->setCheckable(true);
+        ac->setChecked(folder->newFilesAreVirtual());
+        connect(ac, &QAction::toggled, folder, &Folder::setNewFilesAreVirtual);
+
+        ac = menu->addAction(tr("Sync history..."));
+        connect(ac, &QAction::triggered, this, &AccountSettings::slotShowSyncHistory);
+    }
+
     ac = menu->addAction(tr("Remove folder sync connection"));
     connect(ac, &QAction::triggered, this, &AccountSettings::slotRemoveCurrentFolder);
     menu->popup(tv->mapToGlobal(pos));
@@ -409,12 +429,16 @@ void AccountSettings::slotFolderWizardAccepted()
 
     Folder *f = folderMan->addFolder(_accountState, definition);
     if (f) {
-        f->journalDb()->setSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, selectiveSyncBlackList);
-
-        // The user already accepted the selective sync dialog. everything is in the white list
-        f->journalDb()->setSelectiveSyncList(SyncJournalDb::SelectiveSyncWhiteList,
-            QStringList() << QLatin1String("/"));
-        folderMan->scheduleAllFolders();
+        // The first sync waits for the lists
+        f->journalDb()->runAsync(f,
+            [selectiveSyncBlackList](SyncJournalDb *journal) {
+                journal->setSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, selectiveSyncBlackList);
+
+                // The user already accepted the selective sync dialog. everything is in the white list
+                journal->setSelectiveSyncList(SyncJournalDb::SelectiveSyncWhiteList,
+                    QStringList() << QLatin1String("/"));
+            },
+            [folderMan] { folderMan->scheduleAllFolders(); });
         emit folderChanged();
     }
 }
@@ -480,6 +504,77 @@ void AccountSettings::slotOpenCurrentLocalSubFolder()
     QDesktopServices::openUrl(url);
 }
 
+void AccountSettings::slotShowSyncHistory()
+{
+    Folder *folder = FolderMan::instance()->folder(selectedFolderAlias());
+    if (!folder)
+        return;
+
+    // A running sync may hold the database
+    const QString folderName = folder->shortGuiLocalPath();
+    auto history = QSharedPointer<QVector<SyncJournalDb::SyncMetricsEntry>>::create();
+    folder->journalDb()->runAsync(this,
+        [history](SyncJournalDb *journal) { *history = journal->syncMetricsHistory(); },
+        [this, folderName, history] { showSyncHistory(folderName, *history); });
+}
+
+void AccountSettings::showSyncHistory(const QString &folderName, const QVector<SyncJournalDb::SyncMetricsEntry> &history)
+{
+    if (history.isEmpty()) {
+        QMessageBox::information(this, tr("Sync history"),
+            tr("No sync of the folder %1 was recorded yet.").arg(folderName));
+        return;
+    }
+
+    auto dialog = new QDialog(this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->setWindowTitle(tr("Sync history of %1").arg(folderName));
+
+    // The last sync first
+    auto table = new QTableWidget(history.size(), 4, dialog);
+    table->setHorizontalHeaderLabels({ tr("Finished"), tr("Duration (ms)"), tr("Items"), tr("Bytes") });
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    table->verticalHeader()->hide();
+    for (int row = 0; row < history.size(); ++row) {
+        const auto &entry = history.at(history.size() - 1 - row);
+        const QJsonObject json = QJsonDocument::fromJson(entry._metrics).object();
+        const QJsonObject counters = json.value(QStringLiteral("counters")).toObject();
+        auto number = [](const QJsonValue &value) {
+            auto item = new QTableWidgetItem(QString::number(qint64(value.toDouble())));
+            item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+            return item;
+        };
+        table->setItem(row, 0, new QTableWidgetItem(entry._finished.toLocalTime().toString(Qt::SystemLocaleShortDate)));
+        table->setItem(row, 1, number(json.value(QStringLiteral("phasesMs")).toObject().value(QStringLiteral("total"))));
+        table->setItem(row, 2, number(counters.value(QStringLiteral("discoveredEntries"))));
+        table->setItem(row, 3, number(counters.value(QStringLiteral("bytesTransferred"))));
+    }
+    table->resizeColumnsToContents();
+    table->horizontalHeader()->setStretchLastSection(true);
+
+    auto buttons = new QDialogButtonBox(QDialogButtonBox::Close, dialog);
+    QPushButton *exportButton = buttons->addButton(tr("Export..."), QDialogButtonBox::ActionRole);
+    connect(buttons, &QDialogButtonBox::rejected, dialog, &QDialog::reject);
+    connect(exportButton, &QPushButton::clicked, dialog, [dialog, history] {
+        const QString saveFile = QFileDialog::getSaveFileName(dialog, tr("Export sync history"),
+            QDir::homePath() + QLatin1String("/sync-history.csv"), tr("CSV files (*.csv)"));
+        if (saveFile.isEmpty())
+            return;
+
+        QFile file(saveFile);
+        if (!file.open(QIODevice::WriteOnly) || file.write(SyncRunMetrics::historyToCsv(history)) < 0) {
+            QMessageBox::critical(dialog, tr("Error"), tr("Could not write to %1").arg(saveFile));
+        }
+    });
+
+    auto layout = new QVBoxLayout(dialog);
+    layout->addWidget(table);
+    layout->addWidget(buttons);
+    dialog->resize(600, 400);
+    dialog->open();
+}
+
 void AccountSettings::showConnectionLabel(const QString &message, QStringList errors)
 {
     const QString errStyle = QLatin1String("color:#ffffff; background-color:#bb4d4d;padding:5px;"
@@ -508,42 +603,12 @@ void AccountSettings::slotEnableCurrentFolder()
         FolderMan *folderMan = FolderMan::instance();
 
         qCInfo(lcAccountSettings) << "Application: enable folder with alias " << alias;
-        bool terminate = false;
-        bool currentlyPaused = false;
-
-        // this sets the folder status to disabled but does not interrupt it.
+        // A running sync is paused where it is, see Folder::setSyncPaused()
         Folder *f = folderMan->folder(alias);
         if (!f) {
             return;
         }
-        currentlyPaused = f->syncPaused();
-        if (!currentlyPaused) {
-            // check if a sync is still running and if so, ask if we should terminate.
-            if (f->isBusy()) { // its still running
-#if defined(Q_OS_MAC)
-                QWidget *parent = this;
-                Qt::WindowFlags flags = Qt::Sheet;
-#else
-                QWidget *parent = 0;
-                Qt::WindowFlags flags = Qt::Dialog | Qt::MSWindowsFixedSizeDialogHint; // default flags
-#endif
-                QMessageBox msgbox(QMessageBox::Question, tr("Sync Running"),
-                    tr("The syncing operation is running.<br/>Do you want to terminate it?"),
-                    QMessageBox::Yes | QMessageBox::No, parent, flags);
-                msgbox.setDefaultButton(QMessageBox::Yes);
-                int reply = msgbox.exec();
-                if (reply == QMessageBox::Yes)
-                    terminate = true;
-                else
-                    return; // do nothing
-            }
-        }
-
-        // message box can return at any time while the thread keeps running,
-        // so better check again after the user has responded.
-        if (f->isBusy() && terminate) {
-            f->slotTerminateSync();
-        }
+        bool currentlyPaused = f->syncPaused();
         f->setSyncPaused(!currentlyPaused);
 
         // keep state for the icon setting.
@@ -574,16 +639,8 @@ void AccountSettings::slotScheduleCurrentFolderForceRemoteDiscovery()
 void AccountSettings::slotForceSyncCurrentFolder()
 {
     FolderMan *folderMan = FolderMan::instance();
-    if (auto selectedFolder = folderMan->folder(selectedFolderAlias())) {
-        // Terminate and reschedule any running sync
-        if (Folder *current = folderMan->currentSyncFolder()) {
-            folderMan->terminateSyncProcess();
-            folderMan->scheduleFolder(current);
-        }
-
-        // Insert the selected folder at the front of the queue
-        folderMan->scheduleFolderNext(selectedFolder);
-    }
+    if (auto selectedFolder = folderMan->folder(selectedFolderAlias()))
+        folderMan->forceSyncFolder(selectedFolder);
 }
 
 void AccountSettings::slotOpenOC()
@@ -754,20 +811,50 @@ AccountSettings::~AccountSettings()
 }
 
 void AccountSettings::refreshSelectiveSyncStatus()
+{
+    // The lists are read on the journal threads, only the last refresh is shown
+    const int refresh = ++_selectiveSyncStatusRefresh;
+    QVector<QPointer<Folder>> folders;
+    QVector<QSharedPointer<QStringList>> undecidedLists;
+    foreach (Folder *folder, FolderMan::instance()->map().values()) {
+        if (folder->accountState() == _accountState) {
+            folders.append(folder);
+            undecidedLists.append(QSharedPointer<QStringList>::create());
+        }
+    }
+    if (folders.isEmpty()) {
+        showSelectiveSyncStatus(folders, undecidedLists);
+        return;
+    }
+
+    auto pending = QSharedPointer<int>::create(folders.size());
+    for (int i = 0; i < folders.size(); ++i) {
+        const auto undecidedList = undecidedLists[i];
+        folders[i]->journalDb()->runAsync(this,
+            [undecidedList](SyncJournalDb *journal) {
+                bool ok;
+                *undecidedList = journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncUndecidedList, &ok);
+            },
+            [this, refresh, pending, folders, undecidedLists] {
+                if (--*pending == 0 && refresh == _selectiveSyncStatusRefresh)
+                    showSelectiveSyncStatus(folders, undecidedLists);
+            });
+    }
+}
+
+void AccountSettings::showSelectiveSyncStatus(const QVector<QPointer<Folder>> &folders,
+    const QVector<QSharedPointer<QStringList>> &undecidedLists)
 {
     bool shouldBeVisible = _model->isDirty() && _accountState->isConnected();
 
     QString msg;
     int cnt = 0;
-    foreach (Folder *folder, FolderMan::instance()->map().values()) {
-        if (folder->accountState() != _accountState) {
+    for (int i = 0; i < folders.size(); ++i) {
+        Folder *folder = folders[i];
+        if (!folder)
             continue;
-        }
 
-        bool ok;
-        auto undecidedList = folder->journalDb()->getSelectiveSyncList(SyncJournalDb::SelectiveSyncUndecidedList, &ok);
-        QString p;
-        foreach (const auto &it, undecidedList) {
+        foreach (const auto &it, *undecidedLists[i]) {
             // FIXME: add the folder alias in a hoover hint.
             // folder->alias() + QLatin1String("/")
             if (cnt++) {
@@ -19,6 +19,8 @@
 #include <QUrl>
 #include <QPointer>
 #include <QHash>
+#include <QSharedPointer>
+#include <QVector>
 #include <QTimer>
 
 #include "folder.h"
@@ -78,6 +80,7 @@ protected slots:
     void slotRemoveCurrentFolder();
     void slotOpenCurrentFolder(); // sync folder
     void slotOpenCurrentLocalSubFolder(); // selected subfolder in sync folder
+    void slotShowSyncHistory(); // of the selected folder
     void slotFolderWizardAccepted();
     void slotFolderWizardRejected();
     void slotDeleteAccount();
@@ -99,6 +102,13 @@ private:
     /// Returns the alias of the selected folder, empty string if none
     QString selectedFolderAlias() const;
 
+    /// The rest of refreshSelectiveSyncStatus(), once the undecided lists are read
+    void showSelectiveSyncStatus(const QVector<QPointer<Folder>> &folders,
+        const QVector<QSharedPointer<QStringList>> &undecidedLists);
+
+    /// The rest of slotShowSyncHistory(), once the history is read
+    void showSyncHistory(const QString &folderName, const QVector<SyncJournalDb::SyncMetricsEntry> &history);
+
     Ui::AccountSettings *ui;
 
     FolderStatusModel *_model;
@@ -108,6 +118,7 @@ private:
     QuotaInfo _quotaInfo;
     QAction *_toggleSignInOutAction;
     QAction *_addAccountAction;
+    int _selectiveSyncStatusRefresh = 0;
 };
 
 } // namespace OCC
@@ -19,6 +19,7 @@
 #include "creds/httpcredentials.h"
 #include "logger.h"
 #include "configfile.h"
+#include "remotechangenotifier.h"
 
 #include <QSettings>
 #include <QTimer>
@@ -28,6 +29,9 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcAccountState, "gui.account.state", QtInfoMsg)
 
+// Recovers quicker than the regular check if the new network doesn't work yet
+static const qint64 NetworkChangeValidationTimeoutMsecs = 10 * 1000;
+
 AccountState::AccountState(AccountPtr account)
     : QObject()
     , _account(account)
@@ -45,6 +49,7 @@ AccountState::AccountState(AccountPtr account)
     connect(account.data(), &Account::credentialsAsked,
         this, &AccountState::slotCredentialsAsked);
     _timeSinceLastETagCheck.invalidate();
+    _remoteChangeNotifier = new RemoteChangeNotifier(this);
 }
 
 AccountState::~AccountState()
@@ -169,6 +174,11 @@ void AccountState::tagLastSuccessfullETagRequest()
     _timeSinceLastETagCheck.start();
 }
 
+void AccountState::reportQuota(const QString &remotePath, qint64 usedBytes, qint64 availableBytes)
+{
+    emit quotaReported(remotePath, usedBytes, availableBytes);
+}
+
 void AccountState::checkConnectivity()
 {
     if (isSignedOut() || _waitingForNewCredentials) {
@@ -201,6 +211,10 @@ void AccountState::checkConnectivity()
 
     ConnectionValidator *conValidator = new ConnectionValidator(account());
     _connectionValidator = conValidator;
+    if (_networkChanged) {
+        // The new network may not work yet, the next check then comes soon
+        conValidator->setTimeout(NetworkChangeValidationTimeoutMsecs);
+    }
     connect(conValidator, &ConnectionValidator::connectionResult,
         this, &AccountState::slotConnectionValidatorResult);
     if (isConnected()) {
@@ -225,6 +239,29 @@ void AccountState::checkConnectivity()
         //#endif
         conValidator->checkServerAndAuth();
     }
+    if (_networkChanged) {
+        // The sync that follows doesn't wait for the handshakes
+        account()->warmUpConnection();
+        _networkChanged = false;
+    }
+}
+
+void AccountState::handleNetworkChange()
+{
+    if (isSignedOut() || _waitingForNewCredentials)
+        return;
+
+    // A running check may wait on a connection of the old network
+    if (_connectionValidator) {
+        qCInfo(lcAccountState) << "Dropping the connection check that started before the network change";
+        _connectionValidator->deleteLater();
+        _connectionValidator.clear();
+    }
+    account()->handleNetworkChange();
+    _timeSinceLastETagCheck.invalidate();
+
+    _networkChanged = true;
+    checkConnectivity();
 }
 
 void AccountState::slotConnectionValidatorResult(ConnectionValidator::Status status, const QStringList &errors)
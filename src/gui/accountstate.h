@@ -29,6 +29,7 @@ namespace OCC {
 
 class AccountState;
 class Account;
+class RemoteChangeNotifier;
 
 typedef QExplicitlySharedDataPointer<AccountState> AccountStatePtr;
 
@@ -121,17 +122,30 @@ public:
      */
     void tagLastSuccessfullETagRequest();
 
+    /** Passes on the quota that a sync of the folder @a remotePath received, see QuotaInfo */
+    void reportQuota(const QString &remotePath, qint64 usedBytes, qint64 availableBytes);
+
+    /** Reports the changes the server notifies, see RemoteChangeNotifier */
+    RemoteChangeNotifier *remoteChangeNotifier() const { return _remoteChangeNotifier; }
+
 public slots:
     /// Triggers a ping to the server to update state and
     /// connection status and errors.
     void checkConnectivity();
 
+    /**
+     * Validates the connection again right away, with a short timeout and a
+     * fresh connection, after the network of the computer changed.
+     */
+    void handleNetworkChange();
+
 private:
     void setState(State state);
 
 signals:
     void stateChanged(int state);
     void isConnectedChanged();
+    void quotaReported(const QString &remotePath, qint64 usedBytes, qint64 availableBytes);
 
 protected Q_SLOTS:
     void slotConnectionValidatorResult(ConnectionValidator::Status status, const QStringList &errors);
@@ -145,8 +159,10 @@ private:
     ConnectionStatus _connectionStatus;
     QStringList _connectionErrors;
     bool _waitingForNewCredentials;
+    bool _networkChanged = false; // handleNetworkChange() wants the next check
     QElapsedTimer _timeSinceLastETagCheck;
     QPointer<ConnectionValidator> _connectionValidator;
+    RemoteChangeNotifier *_remoteChangeNotifier;
 
     /**
      * Starts counting when the server starts being back up after 503 or
@@ -126,6 +126,11 @@ void ActivityListModel::startFetchJob(AccountState *s)
     JsonApiJob *job = new JsonApiJob(s->account(), QLatin1String("ocs/v1.php/cloud/activity"), this);
     QObject::connect(job, &JsonApiJob::jsonReceived,
         this, &ActivityListModel::slotActivitiesReceived);
+    QObject::connect(job, &JsonApiJob::notModified,
+        this, &ActivityListModel::slotActivitiesNotModified);
+    // The shown activities are only replaced if the server has others
+    if (_activityLists.contains(s))
+        job->setIfNoneMatch(_activityEtags.value(s));
     job->setProperty("AccountStatePtr", QVariant::fromValue<QPointer<AccountState>>(s));
 
     QList<QPair<QString, QString>> params;
@@ -164,31 +169,62 @@ void ActivityListModel::slotActivitiesReceived(const QJsonDocument &json, int st
         list.append(a);
     }
 
-    _activityLists[ast] = list;
+    if (statusCode == 100) {
+        _activityEtags[ast] = qobject_cast<JsonApiJob *>(sender())->etag();
+    } else {
+        _activityEtags.remove(ast);
+    }
 
     emit activityJobStatusCode(ast, statusCode);
 
-    combineActivityLists();
+    updateActivityList(ast, list);
 }
 
+void ActivityListModel::slotActivitiesNotModified()
+{
+    auto ast = qvariant_cast<QPointer<AccountState>>(sender()->property("AccountStatePtr"));
+    if (!ast)
+        return;
+
+    _currentlyFetching.remove(ast);
+    qCInfo(lcActivity) << "The activities of" << ast->account()->displayName() << "did not change";
+}
 
-void ActivityListModel::combineActivityLists()
+void ActivityListModel::updateActivityList(AccountState *ast, const ActivityList &list)
 {
-    ActivityList resultList;
+    _activityLists[ast] = list;
+    const QString accountName = ast->account()->displayName();
 
-    foreach (ActivityList list, _activityLists.values()) {
-        resultList.append(list);
+    QSet<Activity::Identifier> received;
+    foreach (const Activity &activity, list) {
+        received.insert(activity.ident());
     }
 
-    std::sort(resultList.begin(), resultList.end());
-
-    beginResetModel();
-    _finalList.clear();
-    endResetModel();
+    // Remove the rows of the account the server doesn't list any more
+    QSet<Activity::Identifier> shown;
+    for (int row = _finalList.count() - 1; row >= 0; --row) {
+        const Activity &activity = _finalList.at(row);
+        if (activity._accName != accountName)
+            continue;
+        if (received.contains(activity.ident())) {
+            shown.insert(activity.ident());
+            continue;
+        }
+        beginRemoveRows(QModelIndex(), row, row);
+        _finalList.removeAt(row);
+        endRemoveRows();
+    }
 
-    beginInsertRows(QModelIndex(), 0, resultList.count());
-    _finalList = resultList;
-    endInsertRows();
+    // Only the new activities are inserted, the list stays sorted by date
+    foreach (const Activity &activity, list) {
+        if (shown.contains(activity.ident()))
+            continue;
+        auto pos = std::upper_bound(_finalList.begin(), _finalList.end(), activity);
+        const int row = pos - _finalList.begin();
+        beginInsertRows(QModelIndex(), row, row);
+        _finalList.insert(row, activity);
+        endInsertRows();
+    }
 }
 
 void ActivityListModel::fetchMore(const QModelIndex &)
@@ -205,29 +241,25 @@ void ActivityListModel::fetchMore(const QModelIndex &)
 
 void ActivityListModel::slotRefreshActivity(AccountState *ast)
 {
-    if (ast && _activityLists.contains(ast)) {
-        _activityLists.remove(ast);
-    }
+    if (!ast || _currentlyFetching.contains(ast))
+        return;
     startFetchJob(ast);
 }
 
 void ActivityListModel::slotRemoveAccount(AccountState *ast)
 {
     if (_activityLists.contains(ast)) {
-        int i = 0;
         const QString accountToRemove = ast->account()->displayName();
 
-        QMutableListIterator<Activity> it(_finalList);
-
-        while (it.hasNext()) {
-            Activity activity = it.next();
-            if (activity._accName == accountToRemove) {
-                beginRemoveRows(QModelIndex(), i, i + 1);
-                it.remove();
+        for (int row = _finalList.count() - 1; row >= 0; --row) {
+            if (_finalList.at(row)._accName == accountToRemove) {
+                beginRemoveRows(QModelIndex(), row, row);
+                _finalList.removeAt(row);
                 endRemoveRows();
             }
         }
         _activityLists.remove(ast);
+        _activityEtags.remove(ast);
         _currentlyFetching.remove(ast);
     }
 }
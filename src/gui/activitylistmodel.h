@@ -54,15 +54,19 @@ public slots:
 
 private slots:
     void slotActivitiesReceived(const QJsonDocument &json, int statusCode);
+    void slotActivitiesNotModified();
 
 signals:
     void activityJobStatusCode(AccountState *ast, int statusCode);
 
 private:
     void startFetchJob(AccountState *s);
-    void combineActivityLists();
+    // Replaces the activities of the account, changing only the rows that differ
+    void updateActivityList(AccountState *ast, const ActivityList &list);
 
     QMap<AccountState *, ActivityList> _activityLists;
+    // ETag of the last answer with the activities of the account
+    QHash<AccountState *, QByteArray> _activityEtags;
     ActivityList _finalList;
     QSet<AccountState *> _currentlyFetching;
 };
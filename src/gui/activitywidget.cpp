@@ -112,8 +112,12 @@ void ActivityWidget::slotRefreshNotifications(AccountState *ptr)
     // are running
     if (_notificationRequestsRunning == 0) {
         ServerNotificationHandler *snh = new ServerNotificationHandler;
+        snh->setIfNoneMatch(_notificationEtags.value(ptr));
         connect(snh, &ServerNotificationHandler::newNotificationList,
-            this, &ActivityWidget::slotBuildNotificationDisplay);
+            this, [this, snh, ptr](const ActivityList &list) {
+                _notificationEtags[ptr] = snh->etag();
+                slotBuildNotificationDisplay(list);
+            });
 
         snh->slotFetchNotifications(ptr);
     } else {
@@ -124,6 +128,7 @@ void ActivityWidget::slotRefreshNotifications(AccountState *ptr)
 void ActivityWidget::slotRemoveAccount(AccountState *ptr)
 {
     _model->slotRemoveAccount(ptr);
+    _notificationEtags.remove(ptr);
 }
 
 void ActivityWidget::showLabels()
@@ -537,6 +542,7 @@ ActivitySettings::ActivitySettings(QWidget *parent)
 
     connect(&_notificationCheckTimer, &QTimer::timeout,
         this, &ActivitySettings::slotRegularNotificationCheck);
+    _notificationCheckTimer.setTimerType(Qt::VeryCoarseTimer);
 
     // connect a model signal to stop the animation.
     connect(_activityWidget, &ActivityWidget::rowsInserted, _progressIndicator, &QProgressIndicator::stopAnimation);
@@ -102,6 +102,8 @@ private:
 
     QSet<QString> _accountsWithoutActivities;
     QMap<Activity::Identifier, NotificationWidget *> _widgetForNotifId;
+    // ETag of the last notifications of the account that were shown
+    QHash<AccountState *, QByteArray> _notificationEtags;
     QElapsedTimer _guiLogTimer;
     QSet<int> _guiLoggedNotifications;
     ActivityList _blacklistedNotifications;
@@ -27,6 +27,7 @@
 #include "folderman.h"
 #include "logger.h"
 #include "configfile.h"
+#include "imagecache.h"
 #include "socketapi.h"
 #include "sslerrordialog.h"
 #include "theme.h"
@@ -70,6 +71,10 @@ namespace {
         "                         in folder <name>.\n"
         "  --logexpire <hours>  : removes logs older than <hours> hours.\n"
         "                         (to be used with --logdir)\n"
+        "  --logmaxsize <MB>    : starts a new log file beyond <MB> megabytes,\n"
+        "                         0 for no limit (to be used with --logdir).\n"
+        "  --logdirmaxsize <MB> : removes the oldest logs beyond <MB> megabytes\n"
+        "                         in total, 0 for no limit (to be used with --logdir).\n"
         "  --logflush           : flush the log file after every write.\n"
         "  --logdebug           : also output debug-level messages in the log (equivalent to setting the env var QT_LOGGING_RULES=\"qt.*=true;*.debug=true\").\n"
         "  --confdir <dirname>  : Use the given configuration folder.\n";
@@ -102,6 +107,8 @@ Application::Application(int &argc, char **argv)
     , _versionOnly(false)
     , _showLogWindow(false)
     , _logExpire(0)
+    , _logMaxSize(-1)
+    , _logDirMaxSize(-1)
     , _logFlush(false)
     , _logDebug(false)
     , _userTriggeredConnect(false)
@@ -159,6 +166,10 @@ Application::Application(int &argc, char **argv)
     setupLogging();
     setupTranslations();
 
+    // The thumbnail urls don't have the user, an instance with its own
+    // --confdir keeps its own images
+    ImageCache::setDirectory(ConfigFile().configPath() + QLatin1String("images"));
+
     // The timeout is initialized with an environment variable, if not, override with the value from the config
     ConfigFile cfg;
     if (!AbstractNetworkJob::httpTimeout)
@@ -201,6 +212,12 @@ Application::Application(int &argc, char **argv)
     if (_showLogWindow) {
         _gui->slotToggleLogBrowser(); // _showLogWindow is set in parseOptions.
     }
+    // The first event processed, the time to compare for a faster start
+    QTimer::singleShot(0, this, [this] {
+        qCInfo(lcApplication) << "Responsive after" << _startedAt.elapsed() << "msec with"
+                              << AccountManager::instance()->accounts().size() << "accounts and"
+                              << FolderMan::instance()->map().size() << "folders";
+    });
 
     // Enable word wrapping of QInputDialog (#4197)
     setStyleSheet("QInputDialog QLabel { qproperty-wordWrap:1; }");
@@ -219,13 +236,20 @@ Application::Application(int &argc, char **argv)
     // startup procedure.
     connect(&_checkConnectionTimer, &QTimer::timeout, this, &Application::slotCheckConnection);
     _checkConnectionTimer.setInterval(ConnectionValidator::DefaultCallingIntervalMsec); // check for connection every 32 seconds.
+    _checkConnectionTimer.setTimerType(Qt::VeryCoarseTimer);
     _checkConnectionTimer.start();
     // Also check immediately
     QTimer::singleShot(0, this, &Application::slotCheckConnection);
 
     // Can't use onlineStateChanged because it is always true on modern systems because of many interfaces
+    foreach (const auto &cnf, _networkConfigurationManager.allConfigurations(QNetworkConfiguration::Active))
+        _activeNetworkConfigurations.insert(cnf.identifier());
     connect(&_networkConfigurationManager, &QNetworkConfigurationManager::configurationChanged,
         this, &Application::slotSystemOnlineConfigurationChanged);
+    // A switch of the network changes several configurations at once
+    _networkChangedTimer.setSingleShot(true);
+    _networkChangedTimer.setInterval(1000);
+    connect(&_networkChangedTimer, &QTimer::timeout, this, &Application::slotNetworkChanged);
 
     // Update checks
     UpdaterScheduler *updaterScheduler = new UpdaterScheduler(this);
@@ -301,8 +325,31 @@ void Application::slotCleanup()
 // Maybe we need 2 validators, one triggered by timer, one by network configuration changes?
 void Application::slotSystemOnlineConfigurationChanged(QNetworkConfiguration cnf)
 {
-    if (cnf.state() & QNetworkConfiguration::Active) {
-        QMetaObject::invokeMethod(this, "slotCheckConnection", Qt::QueuedConnection);
+    // The configurations change for all kinds of reasons, like a new wifi in range.
+    // Only one that goes up or down matters: going down, the connections over it are dead.
+    const bool active = (cnf.state() & QNetworkConfiguration::Active) == QNetworkConfiguration::Active;
+    bool changed = false;
+    if (active) {
+        changed = !_activeNetworkConfigurations.contains(cnf.identifier());
+        _activeNetworkConfigurations.insert(cnf.identifier());
+    } else {
+        changed = _activeNetworkConfigurations.remove(cnf.identifier());
+    }
+    if (!changed)
+        return;
+    qCInfo(lcApplication) << "Network configuration changed" << cnf.name() << int(cnf.state());
+    _networkChangedTimer.start();
+}
+
+void Application::slotNetworkChanged()
+{
+    foreach (const auto &accountState, AccountManager::instance()->accounts()) {
+        AccountState::State state = accountState->state();
+        if (state != AccountState::SignedOut
+            && state != AccountState::ConfigurationError
+            && state != AccountState::AskingCredentials) {
+            accountState->handleNetworkChange();
+        }
     }
 }
 
@@ -366,6 +413,10 @@ void Application::setupLogging()
     Logger::instance()->setLogFile(_logFile);
     Logger::instance()->setLogDir(_logDir);
     Logger::instance()->setLogExpire(_logExpire);
+    if (_logMaxSize >= 0)
+        Logger::instance()->setLogMaxSize(qint64(_logMaxSize) * 1024 * 1024);
+    if (_logDirMaxSize >= 0)
+        Logger::instance()->setLogDirMaxSize(qint64(_logDirMaxSize) * 1024 * 1024);
     Logger::instance()->setLogFlush(_logFlush);
     Logger::instance()->setLogDebug(_logDebug);
 
@@ -430,6 +481,18 @@ void Application::parseOptions(const QStringList &options)
             } else {
                 showHint("Log expiration not specified");
             }
+        } else if (option == QLatin1String("--logmaxsize")) {
+            if (it.hasNext() && !it.peekNext().startsWith(QLatin1String("--"))) {
+                _logMaxSize = it.next().toInt();
+            } else {
+                showHint("Log file size not specified");
+            }
+        } else if (option == QLatin1String("--logdirmaxsize")) {
+            if (it.hasNext() && !it.peekNext().startsWith(QLatin1String("--"))) {
+                _logDirMaxSize = it.next().toInt();
+            } else {
+                showHint("Log dir size not specified");
+            }
         } else if (option == QLatin1String("--logflush")) {
             _logFlush = true;
         } else if (option == QLatin1String("--logdebug")) {
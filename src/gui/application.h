@@ -18,6 +18,7 @@
 #include <QApplication>
 #include <QPointer>
 #include <QQueue>
+#include <QSet>
 #include <QTimer>
 #include <QElapsedTimer>
 #include <QNetworkConfigurationManager>
@@ -92,6 +93,7 @@ protected slots:
     void slotAccountStateAdded(AccountState *accountState);
     void slotAccountStateRemoved(AccountState *accountState);
     void slotSystemOnlineConfigurationChanged(QNetworkConfiguration);
+    void slotNetworkChanged();
 
 private:
     void setHelp();
@@ -110,6 +112,8 @@ private:
     QString _logFile;
     QString _logDir;
     int _logExpire;
+    int _logMaxSize; // MB, -1 for the default
+    int _logDirMaxSize; // MB, -1 for the default
     bool _logFlush;
     bool _logDebug;
     bool _userTriggeredConnect;
@@ -118,7 +122,9 @@ private:
     ClientProxy _proxy;
 
     QNetworkConfigurationManager _networkConfigurationManager;
+    QSet<QString> _activeNetworkConfigurations; // by identifier, see slotSystemOnlineConfigurationChanged()
     QTimer _checkConnectionTimer;
+    QTimer _networkChangedTimer;
 
 #if defined(WITH_CRASHREPORTER)
     QScopedPointer<CrashReporter::Handler> _crashHandler;
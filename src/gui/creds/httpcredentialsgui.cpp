@@ -90,6 +90,8 @@ void HttpCredentialsGui::asyncAuthResult(OAuth::Result r, const QString &user,
     _password = token;
     _refreshToken = refreshToken;
     _ready = true;
+    // The login doesn't pass the lifetime of the token on
+    scheduleTokenRefresh(0);
     persist();
     _asyncAuth.reset(0);
     emit asked();
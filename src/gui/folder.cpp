@@ -30,9 +30,12 @@
 #include "socketapi.h"
 #include "theme.h"
 #include "filesystem.h"
+#include "bandwidthbudget.h"
+#include "transferpolicy.h"
 
 #include "creds/abstractcredentials.h"
 
+#include <QDateTime>
 #include <QTimer>
 #include <QUrl>
 #include <QDir>
@@ -41,10 +44,28 @@
 #include <QMessageBox>
 #include <QPushButton>
 
+#include <algorithm>
+#include <limits>
+
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcFolder, "gui.folder", QtInfoMsg)
 
+// Well below the timeout of the network jobs, which don't see any activity
+// while the sync is paused
+static const int PausedSyncTimeoutMsecs = 2 * 60 * 1000;
+
+/**
+ * Whether LocalDiscoveryStyle::DirectoryModtime may be used instead of a
+ * full local discovery. Opt-in since it can miss files that are written
+ * in place while the client isn't watching.
+ */
+static bool useDirectoryModtimeDiscovery()
+{
+    static bool enabled = qEnvironmentVariableIntValue("OWNCLOUD_DIRECTORY_MTIME_DISCOVERY") != 0;
+    return enabled;
+}
+
 Folder::Folder(const FolderDefinition &definition,
     AccountState *accountState,
     QObject *parent)
@@ -84,6 +105,10 @@ Folder::Folder(const FolderDefinition &definition,
 
     connect(_accountState.data(), &AccountState::isConnectedChanged, this, &Folder::canSyncChanged);
     connect(_engine.data(), &SyncEngine::rootEtag, this, &Folder::etagRetreivedFromSyncEngine);
+    connect(_engine.data(), &SyncEngine::rootQuota, this, [this](qint64 usedBytes, qint64 availableBytes) {
+        if (_accountState)
+            _accountState->reportQuota(remotePath(), usedBytes, availableBytes);
+    });
 
     connect(_engine.data(), &SyncEngine::started, this, &Folder::slotSyncStarted, Qt::QueuedConnection);
     connect(_engine.data(), &SyncEngine::finished, this, &Folder::slotSyncFinished, Qt::QueuedConnection);
@@ -95,8 +120,11 @@ Folder::Folder(const FolderDefinition &definition,
     connect(_engine.data(), &SyncEngine::aboutToRestoreBackup,
         this, &Folder::slotAboutToRestoreBackup);
     connect(_engine.data(), &SyncEngine::transmissionProgress, this, &Folder::slotTransmissionProgress);
-    connect(_engine.data(), &SyncEngine::itemCompleted,
-        this, &Folder::slotItemCompleted);
+    connect(_engine.data(), &SyncEngine::syncMetrics, this, [this](const SyncRunMetrics &metrics) {
+        SyncRunFileLog::logMetrics(path(), metrics);
+    });
+    connect(_engine.data(), &SyncEngine::itemsCompleted,
+        this, &Folder::slotItemsCompleted);
     connect(_engine.data(), &SyncEngine::newBigFolder,
         this, &Folder::slotNewBigFolderDiscovered);
     connect(_engine.data(), &SyncEngine::seenLockedFile, FolderMan::instance(), &FolderMan::slotSyncOnceFileUnlocks);
@@ -107,7 +135,14 @@ Folder::Folder(const FolderDefinition &definition,
     _scheduleSelfTimer.setSingleShot(true);
     _scheduleSelfTimer.setInterval(SyncEngine::minimumFileAgeForUpload);
     connect(&_scheduleSelfTimer, &QTimer::timeout,
-        this, &Folder::slotScheduleThisFolder);
+        this, &Folder::slotScheduleSelfTimerTimeout);
+
+    _pausedSyncTimer.setSingleShot(true);
+    _pausedSyncTimer.setInterval(PausedSyncTimeoutMsecs);
+    connect(&_pausedSyncTimer, &QTimer::timeout, this, &Folder::slotPausedSyncTimeout);
+
+    _retryTimer.setSingleShot(true);
+    connect(&_retryTimer, &QTimer::timeout, this, &Folder::slotRetryTimerTimeout);
 }
 
 Folder::~Folder()
@@ -196,6 +231,156 @@ void Folder::setIgnoreHiddenFiles(bool ignore)
     _definition.ignoreHiddenFiles = ignore;
 }
 
+void Folder::setNewFilesAreVirtual(bool enabled)
+{
+    _definition.newFilesAreVirtual = enabled;
+    saveToSettings();
+}
+
+// Runs on the journal's worker thread, see SyncJournalDb::runAsync()
+static bool requestVirtualFileDownload(SyncJournalDb *journal, const QByteArray &path)
+{
+    SyncJournalFileRecord record;
+    if (!journal->getFileRecord(path, &record) || !record.isValid()
+        || record._type != SyncFileItem::VirtualFile) {
+        return false;
+    }
+    record._type = SyncFileItem::VirtualFileDownload;
+    if (!journal->setFileRecord(record))
+        return false;
+
+    // The etags didn't change, the remote directory must be listed to see the request
+    journal->avoidReadFromDbOnNextSync(record._path);
+    return true;
+}
+
+void Folder::downloadVirtualFile(const QString &relativePath)
+{
+    const QByteArray path = relativePath.toUtf8();
+    auto requested = QSharedPointer<bool>::create(false);
+    _journal.runAsync(this,
+        [path, requested](SyncJournalDb *journal) { *requested = requestVirtualFileDownload(journal, path); },
+        [this, path, relativePath, requested] {
+            if (!*requested) {
+                qCWarning(lcFolder) << "Not a virtual file:" << relativePath;
+                return;
+            }
+            qCInfo(lcFolder) << "Downloading the virtual file" << relativePath;
+            _localDiscoveryPaths.insert(path);
+            scheduleThisFolderSoon();
+            prefetchSiblings(relativePath);
+        });
+}
+
+void Folder::prefetchSiblings(const QString &relativePath)
+{
+    // Applications open the files of a project or an album one after the
+    // other. The second placeholder of a directory that is opened soon after
+    // the first one makes the rest of the directory likely to follow.
+    static const qint64 OpenedTogetherMsecs = 60 * 1000;
+    static const int OpenedTogetherCount = 2;
+
+    const QString directory = relativePath.left(qMax(0, relativePath.lastIndexOf(QLatin1Char('/'))));
+    if (directory != _lastOpenedDirectory || !_lastOpenedTimer.isValid()
+        || _lastOpenedTimer.elapsed() > OpenedTogetherMsecs) {
+        _lastOpenedDirectory = directory;
+        _openedInDirectory = 0;
+    }
+    _lastOpenedTimer.start();
+    if (++_openedInDirectory != OpenedTogetherCount)
+        return;
+
+    // Guesses are not worth the traffic of a metered connection
+    qint64 budget = ConfigFile().virtualFilePrefetchBudget();
+    if (budget <= 0 || TransferPolicy::instance()->isConstrained())
+        return;
+    // Nor more than a small part of the free space
+    const qint64 freeBytes = Utility::freeDiskSpace(path());
+    if (freeBytes >= 0)
+        budget = qMin(budget, freeBytes / 10);
+
+    // A sync may hold the database, the placeholders are read on its thread
+    auto placeholders = QSharedPointer<std::vector<SyncJournalFileRecord>>::create();
+    const QByteArray directoryPath = directory.toUtf8();
+    _journal.runAsync(this,
+        [directoryPath, placeholders](SyncJournalDb *journal) {
+            journal->getFilesInDirectory(directoryPath, [&](const SyncJournalFileRecord &rec) {
+                if (rec._type == SyncFileItem::VirtualFile)
+                    placeholders->push_back(rec);
+            });
+        },
+        [this, directory, budget, placeholders] { pickPrefetch(directory, budget, *placeholders); });
+}
+
+void Folder::pickPrefetch(const QString &directory, qint64 budget, std::vector<SyncJournalFileRecord> &placeholders)
+{
+    static const int MaxPendingPrefetch = 1000;
+
+    // The smallest first, the budget then covers the most of them
+    std::sort(placeholders.begin(), placeholders.end(),
+        [](const SyncJournalFileRecord &a, const SyncJournalFileRecord &b) { return a._fileSize < b._fileSize; });
+
+    int picked = 0;
+    qint64 left = budget;
+    for (const auto &rec : placeholders) {
+        if (rec._fileSize > left)
+            break;
+        left -= rec._fileSize;
+        auto pending = std::find_if(_pendingPrefetch.begin(), _pendingPrefetch.end(),
+            [&](const QPair<QByteArray, qint64> &entry) { return entry.first == rec._path; });
+        if (pending == _pendingPrefetch.end()) {
+            _pendingPrefetch.append(qMakePair(rec._path, rec._fileSize));
+            _pendingPrefetchBytes += rec._fileSize;
+            ++picked;
+        }
+    }
+
+    // The budget holds for all the guesses together, the oldest ones go
+    // first. The new ones fit in it on their own.
+    int evicted = 0;
+    while (!_pendingPrefetch.isEmpty()
+        && (_pendingPrefetchBytes > budget || _pendingPrefetch.size() > MaxPendingPrefetch)) {
+        _pendingPrefetchBytes -= _pendingPrefetch.takeFirst().second;
+        ++evicted;
+    }
+    if (picked)
+        qCInfo(lcFolder) << "Prefetching" << picked << "virtual files of" << directory;
+    if (evicted)
+        qCInfo(lcFolder) << "Not prefetching" << evicted << "older picks anymore";
+}
+
+void Folder::startPrefetch()
+{
+    if (_prefetchAfterSync.isEmpty())
+        return;
+    const QByteArrayList paths = std::move(_prefetchAfterSync);
+    _prefetchAfterSync.clear();
+
+    auto requested = QSharedPointer<QByteArrayList>::create();
+    _journal.runAsync(this,
+        [paths, requested](SyncJournalDb *journal) {
+            // Unless downloaded or gone in the meantime
+            for (const auto &path : paths) {
+                if (requestVirtualFileDownload(journal, path))
+                    requested->append(path);
+            }
+        },
+        [this, requested] {
+            if (requested->isEmpty())
+                return;
+            static const QLatin1String suffix(APPLICATION_DOTVIRTUALFILE_SUFFIX);
+            for (const auto &path : *requested) {
+                _localDiscoveryPaths.insert(path);
+                // The download is of the file without the suffix
+                QString file = QString::fromUtf8(path);
+                if (file.endsWith(suffix))
+                    file.chop(suffix.size());
+                _prefetchDownloads.insert(file);
+            }
+            scheduleThisFolderSoon();
+        });
+}
+
 QString Folder::cleanPath() const
 {
     QString cleanedPath = QDir::cleanPath(_canonicalLocalPath);
@@ -240,8 +425,18 @@ void Folder::setSyncPaused(bool paused)
     _definition.paused = paused;
     saveToSettings();
 
+    // A running sync is held where it is, resuming it soon doesn't have to
+    // discover everything again or restart the transfers
+    if (paused && isBusy()) {
+        _engine->setPaused(true);
+        _pausedSyncTimer.start();
+    } else if (!paused) {
+        _pausedSyncTimer.stop();
+        _engine->setPaused(false);
+    }
+
     if (!paused) {
-        setSyncState(SyncResult::NotYetStarted);
+        setSyncState(isBusy() ? SyncResult::SyncRunning : SyncResult::NotYetStarted);
     } else {
         setSyncState(SyncResult::Paused);
     }
@@ -307,6 +502,33 @@ void Folder::etagRetreived(const QString &etag)
     _accountState->tagLastSuccessfullETagRequest();
 }
 
+const RemoteFolderListing *Folder::remoteFolderListing(const QString &path) const
+{
+    auto it = _remoteFolderListings.constFind(path);
+    if (it == _remoteFolderListings.constEnd())
+        return 0;
+    return &*it;
+}
+
+void Folder::setRemoteFolderListing(const QString &path, const RemoteFolderListing &listing)
+{
+    _remoteFolderListings[path] = listing;
+}
+
+QByteArray Folder::remoteFolderEtag(const QString &path)
+{
+    if (path == QLatin1String("/"))
+        return Utility::normalizeEtag(_lastEtag.toUtf8());
+
+    QString dirPath = path;
+    if (dirPath.endsWith(QLatin1Char('/')))
+        dirPath.chop(1);
+    SyncJournalFileRecord rec;
+    if (!_journal.getFileRecordReadOnly(dirPath.toUtf8(), &rec) || !rec.isValid() || rec._type != SyncFileItem::Directory)
+        return QByteArray();
+    return rec._etag;
+}
+
 void Folder::etagRetreivedFromSyncEngine(const QString &etag)
 {
     qCInfo(lcFolder) << "Root etag from during sync:" << etag;
@@ -441,9 +663,9 @@ int Folder::errorBlackListEntryCount()
     return _journal.errorBlackListEntryCount();
 }
 
-int Folder::slotWipeErrorBlacklist()
+void Folder::slotWipeErrorBlacklist()
 {
-    return _journal.wipeErrorBlacklist();
+    _journal.runAsync(this, [](SyncJournalDb *journal) { journal->wipeErrorBlacklist(); });
 }
 
 void Folder::slotWatchedPathChanged(const QString &path)
@@ -462,6 +684,9 @@ void Folder::slotWatchedPathChanged(const QString &path)
     auto relativePathBytes = relativePath.toUtf8();
     _localDiscoveryPaths.insert(relativePathBytes);
     qCDebug(lcFolder) << "local discovery: inserted" << relativePath << "due to file watcher";
+    auto slash = relativePath.lastIndexOf(QLatin1Char('/'));
+    if (slash > 0)
+        prioritizeDirectory(relativePath.left(slash).toString());
 
 // The folder watcher fires a lot of bogus notifications during
 // a sync operation, both for actual user files and the database
@@ -479,19 +704,31 @@ void Folder::slotWatchedPathChanged(const QString &path)
 #endif
 
     // Check that the mtime actually changed.
-    SyncJournalFileRecord record;
-    if (_journal.getFileRecord(relativePathBytes, &record)
-        && record.isValid()
-        && !FileSystem::fileChanged(path, record._fileSize, record._modtime)) {
-        qCInfo(lcFolder) << "Ignoring spurious notification for file" << relativePath;
-        return; // probably a spurious notification
-    }
+    const QString relativePathString = relativePath.toString();
+    _journal.getFileRecordAsync(relativePathBytes, this, [this, path, relativePathString](const SyncJournalFileRecord &record) {
+        if (record.isValid() && !FileSystem::fileChanged(path, record._fileSize, record._modtime)) {
+            qCInfo(lcFolder) << "Ignoring spurious notification for file" << relativePathString;
+            return; // probably a spurious notification
+        }
 
-    emit watchedFileChangedExternally(path);
+        emit watchedFileChangedExternally(path);
+        _engine->noteLocalChange(relativePathString);
 
-    // Also schedule this folder for a sync, but only after some delay:
-    // The sync will not upload files that were changed too recently.
-    scheduleThisFolderSoon();
+        // Also schedule this folder for a sync, but only after some delay:
+        // The sync will not upload files that were changed too recently.
+        scheduleAfterWatchedChange();
+    });
+}
+
+void Folder::scheduleUnlockedFile(const QString &path)
+{
+    if (!path.startsWith(this->path()))
+        return;
+
+    // The lock may have kept a download from replacing it, its mtime
+    // doesn't need to have changed
+    _localDiscoveryPaths.insert(path.midRef(this->path().size()).toUtf8());
+    scheduleAfterWatchedChange();
 }
 
 void Folder::saveToSettings() const
@@ -539,9 +776,13 @@ void Folder::removeFromSettings() const
     settings->remove(FolderMan::escapeAlias(_definition.alias));
 }
 
-bool Folder::isFileExcludedAbsolute(const QString &fullPath) const
+bool Folder::isFileExcludedAbsolute(const QString &fullPath, int filetype) const
 {
-    return _engine->excludedFiles().isExcluded(fullPath, path(), _definition.ignoreHiddenFiles);
+    const QString folderPath = path();
+    if (!fullPath.startsWith(folderPath, Utility::fsCasePreserving() ? Qt::CaseInsensitive : Qt::CaseSensitive))
+        return true;
+    return _engine->excludedFiles().isExcludedRelative(folderPath, fullPath.mid(folderPath.size()),
+        _definition.ignoreHiddenFiles, filetype);
 }
 
 bool Folder::isFileExcludedRelative(const QString &relativePath) const
@@ -549,6 +790,13 @@ bool Folder::isFileExcludedRelative(const QString &relativePath) const
     return _engine->excludedFiles().isExcluded(path() + relativePath, path(), _definition.ignoreHiddenFiles);
 }
 
+void Folder::slotPausedSyncTimeout()
+{
+    // The servers and proxies drop the stalled transfers eventually
+    qCInfo(lcFolder) << "folder " << alias() << " was paused for too long";
+    slotTerminateSync();
+}
+
 void Folder::slotTerminateSync()
 {
     qCInfo(lcFolder) << "folder " << alias() << " Terminating!";
@@ -590,6 +838,7 @@ void Folder::wipe()
     QFile::remove(stateDbFile + "-shm");
     QFile::remove(stateDbFile + "-wal");
     QFile::remove(stateDbFile + "-journal");
+    QFile::remove(stateDbFile + ".snapshot");
 
     if (canSync())
         FolderMan::instance()->socketApi()->slotRegisterPath(alias());
@@ -612,7 +861,6 @@ bool Folder::proxyDirty()
 
 void Folder::startSync(const QStringList &pathList)
 {
-    Q_UNUSED(pathList)
     if (proxyDirty()) {
         setProxyDirty(false);
     }
@@ -641,6 +889,23 @@ void Folder::startSync(const QStringList &pathList)
     setDirtyNetworkLimits();
     setSyncOptions();
 
+    // The changes after this are reported to the next sync, or replayed
+    // after a restart
+    _watcherCursorAtSyncStart = _folderWatcher ? _folderWatcher->cursor() : QByteArray();
+
+    std::set<QByteArray> syncPaths;
+    foreach (const QString &path, pathList)
+        syncPaths.insert(path.toUtf8());
+    if (!syncPaths.empty()) {
+        qCInfo(lcFolder) << "Only syncing" << syncPaths.size() << "changed paths";
+    } else {
+        // The retries that are still waiting are part of this sync
+        _retryDue.clear();
+        _retryTimer.stop();
+    }
+    _localDiscoveryPaths.insert(syncPaths.begin(), syncPaths.end());
+    _engine->setRemoteDiscoveryPaths(std::move(syncPaths));
+
     static qint64 fullLocalDiscoveryInterval = []() {
         auto interval = ConfigFile().fullLocalDiscoveryInterval();
         QByteArray env = qgetenv("OWNCLOUD_FULL_LOCAL_DISCOVERY_INTERVAL");
@@ -663,6 +928,14 @@ void Folder::startSync(const QStringList &pathList)
             qCDebug(lcFolder) << "local discovery paths: " << paths;
         }
 
+        _previousLocalDiscoveryPaths = std::move(_localDiscoveryPaths);
+    } else if (useDirectoryModtimeDiscovery() && !_fullLocalDiscoveryRequested
+        && !(_timeSinceLastFullLocalDiscovery.isValid() && fullLocalDiscoveryInterval >= 0
+               && _timeSinceLastFullLocalDiscovery.elapsed() >= fullLocalDiscoveryInterval)) {
+        // Used at startup and when the watcher is unreliable. The periodic
+        // full discovery is still done with FilesystemOnly.
+        qCInfo(lcFolder) << "Allowing local discovery to read unchanged directories from the database";
+        _engine->setLocalDiscoveryOptions(LocalDiscoveryStyle::DirectoryModtime, _localDiscoveryPaths);
         _previousLocalDiscoveryPaths = std::move(_localDiscoveryPaths);
     } else {
         qCInfo(lcFolder) << "Forbidding local discovery to read from the database";
@@ -671,6 +944,14 @@ void Folder::startSync(const QStringList &pathList)
     }
     _localDiscoveryPaths.clear();
 
+    // This sync downloads the requested files, the guesses come after them
+    for (const auto &entry : _pendingPrefetch)
+        _prefetchAfterSync.append(entry.first);
+    _pendingPrefetch.clear();
+    _pendingPrefetchBytes = 0;
+    // Handed to this sync by setSyncOptions()
+    _prefetchDownloads.clear();
+
     _engine->setIgnoreHiddenFiles(_definition.ignoreHiddenFiles);
 
     QMetaObject::invokeMethod(_engine.data(), "startSync", Qt::QueuedConnection);
@@ -713,6 +994,43 @@ void Folder::setSyncOptions()
     opt._minChunkSize = qMin(opt._minChunkSize, opt._initialChunkSize);
     opt._maxChunkSize = qMax(opt._maxChunkSize, opt._initialChunkSize);
 
+    opt._discoveryBatchSize = qEnvironmentVariableIntValue("OWNCLOUD_DISCOVERY_BATCH_SIZE");
+    opt._maxDiscoveryMemory = qEnvironmentVariableIntValue("OWNCLOUD_MAX_DISCOVERY_MEMORY_MB") * 1000LL * 1000LL;
+    QByteArray checksumBudgetEnv = qgetenv("OWNCLOUD_DISCOVERY_CHECKSUM_BUDGET_MB");
+    if (!checksumBudgetEnv.isEmpty()) {
+        const qint64 budget = checksumBudgetEnv.toLongLong();
+        opt._discoveryChecksumBudget = budget < 0 ? -1 : budget * 1000LL * 1000LL;
+    }
+    // A few listings in flight hide most of the latency without loading the server much.
+    // Over HTTP/2 they don't need a connection each, so allow more.
+    QByteArray discoveryParallelismEnv = qgetenv("OWNCLOUD_REMOTE_DISCOVERY_PARALLELISM");
+    if (!discoveryParallelismEnv.isEmpty()) {
+        opt._remoteDiscoveryParallelism = discoveryParallelismEnv.toInt();
+    } else {
+        opt._remoteDiscoveryParallelism = _accountState->account()->isHttp2Supported() ? 8 : 4;
+    }
+    opt._priorityPaths = _priorityPaths;
+    opt._prefetchPaths = _prefetchDownloads;
+    opt._bandwidthWeight = _definition.bandwidthWeight;
+    opt._newFilesAreVirtual = _definition.newFilesAreVirtual;
+    opt._backgroundIo = _definition.backgroundIo;
+    opt._constrainedNetwork = TransferPolicy::instance()->isConstrained();
+
+    // The progress is shown, there is no point in more than a few updates per second
+    QByteArray progressIntervalEnv = qgetenv("OWNCLOUD_PROGRESS_INTERVAL");
+    if (!progressIntervalEnv.isEmpty()) {
+        opt._progressInterval = progressIntervalEnv.toLongLong();
+    } else {
+        opt._progressInterval = 100;
+    }
+
+    QByteArray downloadDurabilityEnv = qgetenv("OWNCLOUD_DOWNLOAD_DURABILITY");
+    if (downloadDurabilityEnv == "file") {
+        opt._downloadDurability = SyncOptions::DurabilityPerFile;
+    } else if (downloadDurabilityEnv == "batch") {
+        opt._downloadDurability = SyncOptions::DurabilityBatched;
+    }
+
     QByteArray targetChunkUploadDurationEnv = qgetenv("OWNCLOUD_TARGET_CHUNK_UPLOAD_DURATION");
     if (!targetChunkUploadDurationEnv.isEmpty()) {
         opt._targetChunkUploadDuration = targetChunkUploadDurationEnv.toUInt();
@@ -720,6 +1038,13 @@ void Folder::setSyncOptions()
         opt._targetChunkUploadDuration = cfgFile.targetChunkUploadDuration();
     }
 
+    QByteArray uploadStabilityEnv = qgetenv("OWNCLOUD_UPLOAD_STABILITY_INTERVAL");
+    if (!uploadStabilityEnv.isEmpty()) {
+        opt._uploadStabilityMsec = uploadStabilityEnv.toLongLong();
+    } else {
+        opt._uploadStabilityMsec = cfgFile.uploadStabilityInterval();
+    }
+
     _engine->setSyncOptions(opt);
 }
 
@@ -742,6 +1067,8 @@ void Folder::setDirtyNetworkLimits()
         uploadLimit = 0;
     }
 
+    // The limits hold for all the folders together
+    BandwidthBudget::instance()->setSchedule(BandwidthBudget::parseSchedule(cfg.bandwidthSchedule()));
     _engine->setNetworkLimits(uploadLimit, downloadLimit);
 }
 
@@ -765,6 +1092,9 @@ void Folder::slotCsyncUnavailable()
 
 void Folder::slotSyncFinished(bool success)
 {
+    _pausedSyncTimer.stop();
+    _engine->setPaused(false);
+
     qCInfo(lcFolder) << "Client version" << qPrintable(Theme::instance()->version())
                      << " Qt" << qVersion()
                      << " SSL " << QSslSocket::sslLibraryVersionString().toUtf8().data()
@@ -773,6 +1103,8 @@ void Folder::slotSyncFinished(bool success)
     bool syncError = !_syncResult.errorStrings().isEmpty();
     if (syncError) {
         qCWarning(lcFolder) << "SyncEngine finished with ERROR";
+        // Keep the messages that led to the error
+        Logger::instance()->dumpLogRecorder();
     } else {
         qCInfo(lcFolder) << "SyncEngine finished without problem.";
     }
@@ -815,7 +1147,14 @@ void Folder::slotSyncFinished(bool success)
         && success) {
         if (_engine->lastLocalDiscoveryStyle() == LocalDiscoveryStyle::FilesystemOnly) {
             _timeSinceLastFullLocalDiscovery.start();
+            _fullLocalDiscoveryRequested = false;
+        } else if (_engine->lastLocalDiscoveryStyle() == LocalDiscoveryStyle::DirectoryModtime
+            && !_timeSinceLastFullLocalDiscovery.isValid()) {
+            // Close enough to a full discovery: all changed directories were listed
+            _timeSinceLastFullLocalDiscovery.start();
         }
+        if (!_watcherCursorAtSyncStart.isEmpty())
+            _journal.setWatcherCursor(_watcherCursorAtSyncStart);
         qCDebug(lcFolder) << "Sync success, forgetting last sync's local discovery path list";
     } else {
         // On overall-failure we can't forget about last sync's local discovery
@@ -850,12 +1189,98 @@ void Folder::slotSyncFinished(bool success)
     }
 
     // Maybe force a follow-up sync to take place, but only a couple of times.
-    if (anotherSyncNeeded == ImmediateFollowUp && _consecutiveFollowUpSyncs <= 3) {
+    // A discovery that was cut short always continues with the next batch.
+    if ((anotherSyncNeeded == ImmediateFollowUp && _consecutiveFollowUpSyncs <= 3)
+        || anotherSyncNeeded == BatchFollowUp) {
         // Sometimes another sync is requested because a local file is still
         // changing, so wait at least a small amount of time before syncing
         // the folder again.
         scheduleThisFolderSoon();
     }
+
+    // A few failed items don't need a full discovery to be tried again
+    queueRetries(anotherSyncNeeded == RetryFollowUp ? _engine->retryPaths() : QSet<QString>());
+
+    startPrefetch();
+}
+
+// Beyond that many changed paths discovering everything is as fast
+static const size_t MaxTargetedSyncPaths = 1000;
+
+void Folder::queueRetries(const QSet<QString> &paths)
+{
+    static const int MaxRetries = 5;
+    static const qint64 MaxRetryDelayMsecs = 10 * 60 * 1000;
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const qint64 baseDelay = qMax(SyncEngine::minimumFileAgeForUpload,
+        _engine->syncOptions()._uploadStabilityMsec);
+
+    QHash<QByteArray, int> attempts;
+    for (const auto &path : paths) {
+        const QByteArray pathBytes = path.toUtf8();
+        const int attempt = _retryAttempts.value(pathBytes) + 1;
+        attempts.insert(pathBytes, attempt);
+        // The retry of a file that changed after its upload goes with it
+        _localDiscoveryPaths.insert(pathBytes);
+        if (attempt > MaxRetries) {
+            qCInfo(lcFolder) << "Not retrying" << path << "before the next sync, it failed" << attempt << "times";
+            continue;
+        }
+
+        // The delay doubles with each attempt, the error blacklist may
+        // ask for a longer one
+        qint64 due = now + qMin(baseDelay << (attempt - 1), MaxRetryDelayMsecs);
+        const auto entry = _journal.errorBlacklistEntry(path);
+        if (entry.isValid() && entry._ignoreDuration > 0)
+            due = qMax(due, (entry._lastTryTime + entry._ignoreDuration) * 1000);
+        _retryDue[pathBytes] = due;
+    }
+    // The items that weren't part of the finished sync keep their count
+    for (auto it = _retryAttempts.constBegin(); it != _retryAttempts.constEnd(); ++it) {
+        if (!attempts.contains(it.key()) && _retryDue.count(it.key()))
+            attempts.insert(it.key(), it.value());
+    }
+    _retryAttempts = attempts;
+
+    scheduleNextRetry();
+}
+
+void Folder::scheduleNextRetry()
+{
+    if (_retryDue.empty()) {
+        _retryTimer.stop();
+        return;
+    }
+    qint64 next = std::numeric_limits<qint64>::max();
+    for (const auto &retry : _retryDue)
+        next = qMin(next, retry.second);
+    _retryTimer.start(static_cast<int>(qMax(qint64(0), next - QDateTime::currentMSecsSinceEpoch())));
+}
+
+void Folder::slotRetryTimerTimeout()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QStringList paths;
+    for (auto it = _retryDue.begin(); it != _retryDue.end();) {
+        if (it->second <= now) {
+            paths.append(QString::fromUtf8(it->first));
+            it = _retryDue.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    scheduleNextRetry();
+    if (paths.isEmpty())
+        return;
+
+    // Without an etag the remote side wasn't seen since the start
+    if (_lastEtag.isEmpty() || paths.size() > static_cast<int>(MaxTargetedSyncPaths)) {
+        slotScheduleThisFolder();
+        return;
+    }
+    qCInfo(lcFolder) << "Retrying" << paths.size() << "failed items";
+    FolderMan::instance()->scheduleFolder(this, paths);
 }
 
 void Folder::slotEmitFinishedDelayed()
@@ -882,47 +1307,53 @@ void Folder::slotTransmissionProgress(const ProgressInfo &pi)
     ProgressDispatcher::instance()->setProgressInfo(alias(), pi);
 }
 
-// a item is completed: count the errors and forward to the ProgressDispatcher
-void Folder::slotItemCompleted(const SyncFileItemPtr &item)
+// items were completed: count the errors and forward them to the ProgressDispatcher
+void Folder::slotItemsCompleted(const SyncFileItemVector &items)
 {
-    if (item->_instruction == CSYNC_INSTRUCTION_NONE || item->_instruction == CSYNC_INSTRUCTION_UPDATE_METADATA) {
-        // We only care about the updates that deserve to be shown in the UI
-        return;
-    }
+    SyncFileItemVector shownItems;
+    shownItems.reserve(items.size());
+    for (const auto &item : items) {
+        if (item->_instruction == CSYNC_INSTRUCTION_NONE || item->_instruction == CSYNC_INSTRUCTION_UPDATE_METADATA) {
+            // We only care about the updates that deserve to be shown in the UI
+            continue;
+        }
 
-    // add new directories or remove gone away dirs to the watcher
-    if (item->isDirectory() && item->_instruction == CSYNC_INSTRUCTION_NEW) {
-        if (_folderWatcher)
-            _folderWatcher->addPath(path() + item->_file);
-    }
-    if (item->isDirectory() && item->_instruction == CSYNC_INSTRUCTION_REMOVE) {
-        if (_folderWatcher)
-            _folderWatcher->removePath(path() + item->_file);
-    }
+        // add new directories or remove gone away dirs to the watcher
+        if (item->isDirectory() && item->_instruction == CSYNC_INSTRUCTION_NEW) {
+            if (_folderWatcher)
+                _folderWatcher->addPath(path() + item->_file);
+        }
+        if (item->isDirectory() && item->_instruction == CSYNC_INSTRUCTION_REMOVE) {
+            if (_folderWatcher)
+                _folderWatcher->removePath(path() + item->_file);
+        }
 
-    // Success and failure of sync items adjust what the next sync is
-    // supposed to do.
-    //
-    // For successes, we want to wipe the file from the list to ensure we don't
-    // rediscover it even if this overall sync fails.
-    //
-    // For failures, we want to add the file to the list so the next sync
-    // will be able to retry it.
-    if (item->_status == SyncFileItem::Success
-        || item->_status == SyncFileItem::FileIgnored
-        || item->_status == SyncFileItem::Restoration
-        || item->_status == SyncFileItem::Conflict) {
-        if (_previousLocalDiscoveryPaths.erase(item->_file.toUtf8()))
-            qCDebug(lcFolder) << "local discovery: wiped" << item->_file;
-    } else {
-        _localDiscoveryPaths.insert(item->_file.toUtf8());
-        qCDebug(lcFolder) << "local discovery: inserted" << item->_file << "due to sync failure";
-    }
+        // Success and failure of sync items adjust what the next sync is
+        // supposed to do.
+        //
+        // For successes, we want to wipe the file from the list to ensure we don't
+        // rediscover it even if this overall sync fails.
+        //
+        // For failures, we want to add the file to the list so the next sync
+        // will be able to retry it.
+        if (item->_status == SyncFileItem::Success
+            || item->_status == SyncFileItem::FileIgnored
+            || item->_status == SyncFileItem::Restoration
+            || item->_status == SyncFileItem::Conflict) {
+            if (_previousLocalDiscoveryPaths.erase(item->_file.toUtf8()))
+                qCDebug(lcFolder) << "local discovery: wiped" << item->_file;
+        } else {
+            _localDiscoveryPaths.insert(item->_file.toUtf8());
+            qCDebug(lcFolder) << "local discovery: inserted" << item->_file << "due to sync failure";
+        }
 
-    _syncResult.processCompletedItem(item);
+        _syncResult.processCompletedItem(item);
 
-    _fileLog->logItem(*item);
-    emit ProgressDispatcher::instance()->itemCompleted(alias(), item);
+        _fileLog->logItem(*item);
+        shownItems.append(item);
+    }
+    if (!shownItems.isEmpty())
+        emit ProgressDispatcher::instance()->itemsCompleted(alias(), shownItems);
 }
 
 void Folder::slotNewBigFolderDiscovered(const QString &newF, bool isExternal)
@@ -931,25 +1362,39 @@ void Folder::slotNewBigFolderDiscovered(const QString &newF, bool isExternal)
     if (!newFolder.endsWith(QLatin1Char('/'))) {
         newFolder += QLatin1Char('/');
     }
-    auto journal = journalDb();
 
-    // Add the entry to the blacklist if it is neither in the blacklist or whitelist already
-    bool ok1, ok2;
-    auto blacklist = journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, &ok1);
-    auto whitelist = journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncWhiteList, &ok2);
-    if (ok1 && ok2 && !blacklist.contains(newFolder) && !whitelist.contains(newFolder)) {
-        blacklist.append(newFolder);
-        journal->setSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, blacklist);
-    }
+    // The sync that discovered the folder holds the journal, so the lists
+    // are updated on its worker thread
+    struct Result
+    {
+        bool ok = false;
+        bool isNewUndecided = false;
+    };
+    auto result = QSharedPointer<Result>::create();
+    auto update = [newFolder, result](SyncJournalDb *journal) {
+        // Add the entry to the blacklist if it is neither in the blacklist or whitelist already
+        bool ok1, ok2;
+        auto blacklist = journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, &ok1);
+        auto whitelist = journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncWhiteList, &ok2);
+        if (ok1 && ok2 && !blacklist.contains(newFolder) && !whitelist.contains(newFolder)) {
+            blacklist.append(newFolder);
+            journal->setSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, blacklist);
+        }
 
-    // And add the entry to the undecided list and signal the UI
-    auto undecidedList = journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncUndecidedList, &ok1);
-    if (ok1) {
-        if (!undecidedList.contains(newFolder)) {
+        // And add the entry to the undecided list
+        auto undecidedList = journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncUndecidedList, &result->ok);
+        if (result->ok && !undecidedList.contains(newFolder)) {
             undecidedList.append(newFolder);
             journal->setSelectiveSyncList(SyncJournalDb::SelectiveSyncUndecidedList, undecidedList);
-            emit newBigFolderDiscovered(newFolder);
+            result->isNewUndecided = true;
         }
+    };
+    auto report = [this, newF, newFolder, isExternal, result] {
+        if (!result->ok)
+            return;
+        // And signal the UI
+        if (result->isNewUndecided)
+            emit newBigFolderDiscovered(newFolder);
         QString message = !isExternal ? (tr("A new folder larger than %1 MB has been added: %2.\n")
                                                 .arg(ConfigFile().newBigFolderSizeLimit().second)
                                                 .arg(newF))
@@ -958,7 +1403,8 @@ void Folder::slotNewBigFolderDiscovered(const QString &newF, bool isExternal)
 
         auto logger = Logger::instance();
         logger->postOptionalGuiLog(Theme::instance()->appNameGUI(), message);
-    }
+    };
+    _journal.runAsync(this, update, report);
 }
 
 void Folder::slotLogPropagationStart()
@@ -971,16 +1417,64 @@ void Folder::slotScheduleThisFolder()
     FolderMan::instance()->scheduleFolder(this);
 }
 
+void Folder::slotScheduleSelfTimerTimeout()
+{
+    static bool enabled = qgetenv("OWNCLOUD_TARGETED_SYNC") != "0";
+
+    // Started by scheduleThisFolderSoon() if it's invalid. Without an etag
+    // the remote side wasn't seen since the start.
+    if (!enabled || !_watchedChangesSince.isValid() || _lastEtag.isEmpty()
+        || _localDiscoveryPaths.empty() || _localDiscoveryPaths.size() > MaxTargetedSyncPaths) {
+        slotScheduleThisFolder();
+        return;
+    }
+    QStringList paths;
+    for (const auto &path : _localDiscoveryPaths)
+        paths.append(QString::fromUtf8(path));
+    FolderMan::instance()->scheduleFolder(this, paths);
+}
+
 void Folder::slotNextSyncFullLocalDiscovery()
 {
     _timeSinceLastFullLocalDiscovery.invalidate();
+    _fullLocalDiscoveryRequested = true;
 }
 
 void Folder::scheduleThisFolderSoon()
 {
     if (!_scheduleSelfTimer.isActive()) {
-        _scheduleSelfTimer.start();
+        _watchedChangesSince.invalidate();
+        _scheduleSelfTimer.start(SyncEngine::minimumFileAgeForUpload);
+    }
+}
+
+void Folder::scheduleAfterWatchedChange()
+{
+    static qint64 maxDelay = []() {
+        bool ok = false;
+        qint64 env = qgetenv("OWNCLOUD_WATCHER_MAX_DELAY").toLongLong(&ok);
+        return ok ? qMax(env, SyncEngine::minimumFileAgeForUpload) : 20 * 1000;
+    }();
+
+    // The uploads wait until the files were left alone for that long
+    const qint64 quietDelay = qMax(SyncEngine::minimumFileAgeForUpload,
+        _engine->syncOptions()._uploadStabilityMsec);
+
+    if (!_scheduleSelfTimer.isActive()) {
+        _watchedChangesSince.start();
+        _scheduleSelfTimer.start(quietDelay);
+        return;
+    }
+    if (!_watchedChangesSince.isValid()) {
+        // Scheduled by scheduleThisFolderSoon(), the changes go with it
+        return;
     }
+
+    // Still changing, wait until it's quiet but not longer than maxDelay
+    // after the first change
+    const qint64 left = maxDelay - _watchedChangesSince.elapsed();
+    if (left > 0)
+        _scheduleSelfTimer.start(qMin(left, quietDelay));
 }
 
 void Folder::setSaveBackwardsCompatible(bool save)
@@ -995,11 +1489,38 @@ void Folder::registerFolderWatcher()
     if (!QDir(path()).exists())
         return;
 
-    _folderWatcher.reset(new FolderWatcher(path(), this));
+    _folderWatcher.reset(new FolderWatcher(path(), this, _journal.watcherCursor()));
     connect(_folderWatcher.data(), &FolderWatcher::pathChanged,
         this, &Folder::slotWatchedPathChanged);
     connect(_folderWatcher.data(), &FolderWatcher::lostChanges,
         this, &Folder::slotNextSyncFullLocalDiscovery);
+    connect(_folderWatcher.data(), &FolderWatcher::changesReplayed,
+        this, &Folder::slotWatcherChangesReplayed);
+    connect(_folderWatcher.data(), &FolderWatcher::pathActivity,
+        FolderMan::instance(), &FolderMan::slotCheckFileUnlocksNear);
+}
+
+void Folder::slotWatcherChangesReplayed(bool complete)
+{
+    if (!complete || _fullLocalDiscoveryRequested || _timeSinceLastFullLocalDiscovery.isValid())
+        return;
+    // All the changes since the last successful sync are in
+    // _localDiscoveryPaths now, like after a full local discovery
+    qCInfo(lcFolder) << "The changes since the last sync were replayed, no full local discovery needed";
+    _timeSinceLastFullLocalDiscovery.start();
+}
+
+void Folder::prioritizeDirectory(const QString &relativePath)
+{
+    // The file manager asks for every file of a directory it shows
+    if (relativePath.isEmpty() || (!_priorityPaths.isEmpty() && _priorityPaths.first() == relativePath))
+        return;
+    _priorityPaths.removeOne(relativePath);
+    _priorityPaths.prepend(relativePath);
+    // Only the last few matter
+    static const int maxPriorityPaths = 20;
+    while (_priorityPaths.size() > maxPriorityPaths)
+        _priorityPaths.removeLast();
 }
 
 void Folder::slotAboutToRemoveAllFiles(SyncFileItem::Direction dir, bool *cancel)
@@ -1065,6 +1586,18 @@ void FolderDefinition::save(QSettings &settings, const FolderDefinition &folder)
     settings.setValue(QLatin1String("targetPath"), folder.targetPath);
     settings.setValue(QLatin1String("paused"), folder.paused);
     settings.setValue(QLatin1String("ignoreHiddenFiles"), folder.ignoreHiddenFiles);
+    if (folder.bandwidthWeight != 1)
+        settings.setValue(QLatin1String("bandwidthWeight"), folder.bandwidthWeight);
+    else
+        settings.remove(QLatin1String("bandwidthWeight"));
+    if (folder.newFilesAreVirtual)
+        settings.setValue(QLatin1String("newFilesAreVirtual"), true);
+    else
+        settings.remove(QLatin1String("newFilesAreVirtual"));
+    if (!folder.backgroundIo)
+        settings.setValue(QLatin1String("backgroundIo"), false);
+    else
+        settings.remove(QLatin1String("backgroundIo"));
 
     // Happens only on Windows when the explorer integration is enabled.
     if (!folder.navigationPaneClsid.isNull())
@@ -1085,6 +1618,9 @@ bool FolderDefinition::load(QSettings &settings, const QString &alias,
     folder->paused = settings.value(QLatin1String("paused")).toBool();
     folder->ignoreHiddenFiles = settings.value(QLatin1String("ignoreHiddenFiles"), QVariant(true)).toBool();
     folder->navigationPaneClsid = settings.value(QLatin1String("navigationPaneClsid")).toUuid();
+    folder->bandwidthWeight = qMax(1, settings.value(QLatin1String("bandwidthWeight"), 1).toInt());
+    folder->newFilesAreVirtual = settings.value(QLatin1String("newFilesAreVirtual"), false).toBool();
+    folder->backgroundIo = settings.value(QLatin1String("backgroundIo"), true).toBool();
     settings.endGroup();
 
     // Old settings can contain paths with native separators. In the rest of the
@@ -25,10 +25,14 @@
 
 #include <csync.h>
 
+#include <QHash>
 #include <QObject>
+#include <QSet>
 #include <QStringList>
 #include <QUuid>
+#include <map>
 #include <set>
+#include <vector>
 
 class QThread;
 class QSettings;
@@ -67,6 +71,12 @@ public:
     bool ignoreHiddenFiles;
     /// The CLSID where this folder appears in registry for the Explorer navigation pane entry.
     QUuid navigationPaneClsid;
+    /// share of the bandwidth limits while other folders sync, see SyncOptions::_bandwidthWeight
+    int bandwidthWeight = 1;
+    /// whether new remote files get a placeholder, see SyncOptions::_newFilesAreVirtual
+    bool newFilesAreVirtual = false;
+    /// whether the sync uses the disk at background priority, see SyncOptions::_backgroundIo
+    bool backgroundIo = true;
 
     /// Saves the folder definition, creating a new settings group.
     static void save(QSettings &settings, const FolderDefinition &folder);
@@ -88,6 +98,21 @@ public:
     QString defaultJournalPath(AccountPtr account);
 };
 
+/**
+ * @brief The subfolders of a remote directory, as the folder settings list them
+ * @ingroup gui
+ */
+struct RemoteFolderListing
+{
+    /// Normalized etag of the listed directory
+    QByteArray etag;
+    /// Paths of the subfolders on the server, sorted, without the directory itself
+    QStringList subfolders;
+    QHash<QString, qint64> sizes;
+    /// The subfolders with the 'M' permission, without trailing slash
+    QSet<QString> external;
+};
+
 /**
  * @brief The Folder class
  * @ingroup gui
@@ -193,11 +218,42 @@ public:
     bool ignoreHiddenFiles();
     void setIgnoreHiddenFiles(bool ignore);
 
+    /** Whether new remote files get a placeholder instead of being downloaded */
+    bool newFilesAreVirtual() const { return _definition.newFilesAreVirtual; }
+    void setNewFilesAreVirtual(bool enabled);
+
+    /**
+     * Replaces the placeholder at @a relativePath by the file with the next sync.
+     *
+     * When the placeholders of a directory are opened one after the other,
+     * its other placeholders are downloaded too, see prefetchSiblings().
+     *
+     * The journal is updated on its worker thread, nothing happens if it
+     * has no virtual file of that name.
+     */
+    void downloadVirtualFile(const QString &relativePath);
+
     // Used by the Socket API
     SyncJournalDb *journalDb() { return &_journal; }
     SyncEngine &syncEngine() { return *_engine; }
 
     RequestEtagJob *etagJob() { return _requestEtagJob; }
+
+    /**
+     * The last listing of the remote directory at @a path, relative to the
+     * folder with a trailing slash, or "/" for the root. 0 if there is none.
+     *
+     * The pointer is valid until the next setRemoteFolderListing().
+     */
+    const RemoteFolderListing *remoteFolderListing(const QString &path) const;
+    void setRemoteFolderListing(const QString &path, const RemoteFolderListing &listing);
+
+    /**
+     * The normalized etag of the remote directory at @a path, like for
+     * remoteFolderListing(): as of the last sync, or of the last etag check
+     * for the root. Empty for directories that are not synced.
+     */
+    QByteArray remoteFolderEtag(const QString &path);
     qint64 msecSinceLastSync() const { return _timeSinceLastSyncDone.elapsed(); }
     qint64 msecLastSyncDuration() const { return _lastSyncDuration; }
     int consecutiveFollowUpSyncs() const { return _consecutiveFollowUpSyncs; }
@@ -210,8 +266,11 @@ public:
 
     /**
       * Returns whether a file inside this folder should be excluded.
+      *
+      * Does not stat the path components, see ExcludedFiles::isExcludedRelative().
+      * @a filetype is a csync_ftw_type_e, -1 when not known.
       */
-    bool isFileExcludedAbsolute(const QString &fullPath) const;
+    bool isFileExcludedAbsolute(const QString &fullPath, int filetype = -1) const;
 
     /**
       * Returns whether a file inside this folder should be excluded.
@@ -229,6 +288,19 @@ public:
       */
     void scheduleThisFolderSoon();
 
+    /** Like scheduleThisFolderSoon(), for the changes the watcher reports.
+      *
+      * The delay restarts with every change, so that a burst of changes
+      * gets a single sync once it's over. The whole burst is delayed by
+      * OWNCLOUD_WATCHER_MAX_DELAY at most, 20s by default.
+      */
+    void scheduleAfterWatchedChange();
+
+    /** Like scheduleAfterWatchedChange(), for a file whose lock was
+      * released. See LockWatcher.
+      */
+    void scheduleUnlockedFile(const QString &path);
+
     /**
       * Migration: When this flag is true, this folder will save to
       * the backwards-compatible 'Folders' section in the config file.
@@ -242,6 +314,12 @@ public:
      */
     void registerFolderWatcher();
 
+    /**
+     * Remembers that the user is looking at or working in the directory
+     * @a relativePath, see SyncOptions::_priorityPaths.
+     */
+    void prioritizeDirectory(const QString &relativePath);
+
 signals:
     void syncStateChange();
     void syncStarted();
@@ -272,7 +350,9 @@ public slots:
     /**
       * Starts a sync operation
       *
-      * If the list of changed files is known, it is passed.
+      * If the list of changed files is known, it is passed, relative to the
+      * folder. Only they, their parents and their contents are then
+      * discovered, see SyncEngine::setRemoteDiscoveryPaths().
       */
     void startSync(const QStringList &pathList = QStringList());
 
@@ -281,7 +361,7 @@ public slots:
 
     int slotDiscardDownloadProgress();
     int downloadInfoCount();
-    int slotWipeErrorBlacklist();
+    void slotWipeErrorBlacklist();
     int errorBlackListEntryCount();
 
     /**
@@ -302,7 +382,7 @@ private slots:
     void slotCsyncUnavailable();
 
     void slotTransmissionProgress(const ProgressInfo &pi);
-    void slotItemCompleted(const SyncFileItemPtr &);
+    void slotItemsCompleted(const SyncFileItemVector &items);
 
     void slotRunEtagJob();
     void etagRetreived(const QString &);
@@ -319,10 +399,41 @@ private slots:
      */
     void slotScheduleThisFolder();
 
+    /** Schedules the folder for the paths the watcher reported, if these
+     *  are the only changes known of; for all paths otherwise.
+     */
+    void slotScheduleSelfTimerTimeout();
+
+    /** Aborts the sync that was paused for longer than PausedSyncTimeoutMsecs */
+    void slotPausedSyncTimeout();
+
+    /** Schedules a sync of just the failed items whose retry is due */
+    void slotRetryTimerTimeout();
+
     /** Ensures that the next sync performs a full local discovery. */
     void slotNextSyncFullLocalDiscovery();
 
+    /** The watcher reported the changes made while the client wasn't running */
+    void slotWatcherChangesReplayed(bool complete);
+
 private:
+    /** Queues the items the finished sync wants to try again, with a
+     *  back-off per item, see SyncEngine::retryPaths()
+     */
+    void queueRetries(const QSet<QString> &paths);
+    void scheduleNextRetry();
+
+    /**
+     * Picks the placeholders next to @a relativePath that are likely opened
+     * next, within ConfigFile::virtualFilePrefetchBudget().
+     *
+     * They are downloaded by the sync after the one of the requested file.
+     */
+    void prefetchSiblings(const QString &relativePath);
+    /** Adds the placeholders of @a directory that fit in @a budget to _pendingPrefetch */
+    void pickPrefetch(const QString &directory, qint64 budget, std::vector<SyncJournalFileRecord> &placeholders);
+    void startPrefetch();
+
     bool reloadExcludes();
 
     void showSyncResultPopup();
@@ -354,9 +465,14 @@ private:
     bool _proxyDirty;
     QPointer<RequestEtagJob> _requestEtagJob;
     QString _lastEtag;
+    QHash<QString, RemoteFolderListing> _remoteFolderListings;
     QElapsedTimer _timeSinceLastSyncDone;
     QElapsedTimer _timeSinceLastSyncStart;
     QElapsedTimer _timeSinceLastFullLocalDiscovery;
+    /// Set by slotNextSyncFullLocalDiscovery(), forbids DirectoryModtime discovery
+    bool _fullLocalDiscoveryRequested = false;
+    /// FolderWatcher::cursor() when the current sync started, stored if it succeeds
+    QByteArray _watcherCursorAtSyncStart;
     qint64 _lastSyncDuration;
 
     /// The number of syncs that failed in a row.
@@ -374,6 +490,30 @@ private:
     QScopedPointer<SyncRunFileLog> _fileLog;
 
     QTimer _scheduleSelfTimer;
+    /// Runs while a sync is held by setSyncPaused()
+    QTimer _pausedSyncTimer;
+    /// Since the first change of the burst scheduleAfterWatchedChange() waits for
+    QElapsedTimer _watchedChangesSince;
+
+    /// Runs until the first retry of _retryDue
+    QTimer _retryTimer;
+    /// When the items that failed are tried again, in msecs since the epoch
+    std::map<QByteArray, qint64> _retryDue;
+    /// How often each of them was retried without success
+    QHash<QByteArray, int> _retryAttempts;
+
+    /// The directory of the last placeholder downloadVirtualFile() was asked for
+    QString _lastOpenedDirectory;
+    QElapsedTimer _lastOpenedTimer;
+    /// How many of its placeholders were opened one after the other
+    int _openedInDirectory = 0;
+    /// Picked by prefetchSiblings(), for the sync after the next one, with their sizes
+    QList<QPair<QByteArray, qint64>> _pendingPrefetch;
+    qint64 _pendingPrefetchBytes = 0;
+    /// To be downloaded once the running sync is done
+    QByteArrayList _prefetchAfterSync;
+    /// Requested by startPrefetch() for the next sync, see SyncOptions::_prefetchPaths
+    QSet<QString> _prefetchDownloads;
 
     /**
      * When the same local path is synced to multiple accounts, only one
@@ -407,6 +547,9 @@ private:
      * again when the sync is done to make sure everything is retried.
      */
     std::set<QByteArray> _previousLocalDiscoveryPaths;
+
+    /// Most recent first, see prioritizeDirectory()
+    QStringList _priorityPaths;
 };
 }
 
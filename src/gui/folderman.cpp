@@ -23,6 +23,8 @@
 #include "accountmanager.h"
 #include "filesystem.h"
 #include "lockwatcher.h"
+#include "remotechangenotifier.h"
+#include "networkjobs.h"
 #include "common/asserts.h"
 #include <syncengine.h>
 
@@ -38,6 +40,8 @@
 #include <QMutableSetIterator>
 #include <QSet>
 
+#include <limits>
+
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcFolderMan, "gui.folder.manager", QtInfoMsg)
@@ -46,7 +50,6 @@ FolderMan *FolderMan::_instance = 0;
 
 FolderMan::FolderMan(QObject *parent)
     : QObject(parent)
-    , _currentSyncFolder(0)
     , _syncEnabled(true)
     , _lockWatcher(new LockWatcher)
     , _navigationPaneHelper(this)
@@ -61,6 +64,9 @@ FolderMan::FolderMan(QObject *parent)
     int polltime = cfg.remotePollInterval();
     qCInfo(lcFolderMan) << "setting remote poll timer interval to" << polltime << "msec";
     _etagPollTimer.setInterval(polltime);
+    // The periodic timers only need to be about on time, the system can
+    // wake the process for several of them at once
+    _etagPollTimer.setTimerType(Qt::VeryCoarseTimer);
     QObject::connect(&_etagPollTimer, &QTimer::timeout, this, &FolderMan::slotEtagPollTimerTimeout);
     _etagPollTimer.start();
 
@@ -68,17 +74,29 @@ FolderMan::FolderMan(QObject *parent)
     connect(&_startScheduledSyncTimer, &QTimer::timeout,
         this, &FolderMan::slotStartScheduledFolderSync);
 
-    _timeScheduler.setInterval(5000);
-    _timeScheduler.setSingleShot(false);
+    // Armed by slotScheduleFolderByTime() for the next folder that is due,
+    // and to check again when the folders change
+    _timeScheduler.setSingleShot(true);
+    _timeScheduler.setTimerType(Qt::VeryCoarseTimer);
     connect(&_timeScheduler, &QTimer::timeout,
         this, &FolderMan::slotScheduleFolderByTime);
-    _timeScheduler.start();
+    connect(this, &FolderMan::folderSyncStateChange, this, [this] { _timeScheduler.start(0); });
+    connect(this, &FolderMan::folderListChanged, this, [this] { _timeScheduler.start(0); });
+
+    _journalMaintenanceTimer.setInterval(60 * 60 * 1000);
+    _journalMaintenanceTimer.setTimerType(Qt::VeryCoarseTimer);
+    connect(&_journalMaintenanceTimer, &QTimer::timeout,
+        this, &FolderMan::slotRunJournalMaintenance);
+    _journalMaintenanceTimer.start();
 
     connect(AccountManager::instance(), &AccountManager::accountRemoved,
         this, &FolderMan::slotRemoveFoldersForAccount);
 
     connect(_lockWatcher.data(), &LockWatcher::fileUnlocked,
         this, &FolderMan::slotWatchedFileUnlocked);
+
+    connect(TransferPolicy::instance(), &TransferPolicy::constraintsChanged,
+        this, &FolderMan::slotTransferConstraintsChanged);
 }
 
 FolderMan *FolderMan::instance()
@@ -106,6 +124,11 @@ void FolderMan::unloadFolder(Folder *f)
     _socketApi->slotUnregisterPath(f->alias());
 
     _folderMap.remove(f->alias());
+    _remoteChangedDuringSync.remove(f);
+    _foldersInEtagBatch.remove(f);
+    _currentSyncFolders.removeOne(f);
+    _scheduledPaths.remove(f);
+    updateJournalCacheSizes();
 
     disconnect(f, &Folder::syncStarted,
         this, &FolderMan::slotFolderSyncStarted);
@@ -137,7 +160,7 @@ int FolderMan::unloadAndDeleteAllFolders()
     ASSERT(_folderMap.isEmpty());
 
     _lastSyncFolder = 0;
-    _currentSyncFolder = 0;
+    _currentSyncFolders.clear();
     _scheduledFolders.clear();
     emit folderListChanged(_folderMap);
     emit scheduleQueueChanged();
@@ -433,7 +456,9 @@ void FolderMan::slotFolderSyncPaused(Folder *f, bool paused)
 
     if (!paused) {
         _disabledFolders.remove(f);
-        scheduleFolder(f);
+        // A paused sync just goes on
+        if (!f->isBusy())
+            scheduleFolder(f);
     } else {
         _disabledFolders.insert(f);
     }
@@ -455,10 +480,9 @@ void FolderMan::slotFolderCanSyncChanged()
 // csync still remains in a stable state, regardless of that.
 void FolderMan::terminateSyncProcess()
 {
-    Folder *f = _currentSyncFolder;
-    if (f) {
+    foreach (Folder *f, _currentSyncFolders) {
         // This will, indirectly and eventually, call slotFolderSyncFinished
-        // and thereby clear _currentSyncFolder.
+        // and thereby remove it from _currentSyncFolders.
         f->slotTerminateSync();
     }
 }
@@ -493,11 +517,16 @@ void FolderMan::slotSyncOnceFileUnlocks(const QString &path)
     _lockWatcher->addFile(path);
 }
 
+void FolderMan::slotCheckFileUnlocksNear(const QString &path)
+{
+    _lockWatcher->checkFilesNear(path);
+}
+
 /*
   * if a folder wants to be synced, it calls this slot and is added
   * to the queue. The slot to actually start a sync is called afterwards.
   */
-void FolderMan::scheduleFolder(Folder *f)
+void FolderMan::scheduleFolder(Folder *f, const QStringList &paths)
 {
     if (!f) {
         qCCritical(lcFolderMan) << "slotScheduleSync called with null folder";
@@ -516,9 +545,19 @@ void FolderMan::scheduleFolder(Folder *f)
         f->prepareToSync();
         emit folderSyncStateChange(f);
         _scheduledFolders.enqueue(f);
+        if (paths.isEmpty()) {
+            _scheduledPaths.remove(f);
+        } else {
+            _scheduledPaths.insert(f, paths);
+        }
         emit scheduleQueueChanged();
     } else {
         qCInfo(lcFolderMan) << "Sync for folder " << alias << " already scheduled, do not enqueue!";
+        if (paths.isEmpty()) {
+            _scheduledPaths.remove(f);
+        } else if (_scheduledPaths.contains(f)) {
+            _scheduledPaths[f] += paths;
+        }
     }
 
     startScheduledSyncSoon();
@@ -535,6 +574,7 @@ void FolderMan::scheduleFolderNext(Folder *f)
     }
 
     _scheduledFolders.removeAll(f);
+    _scheduledPaths.remove(f);
 
     f->prepareToSync();
     emit folderSyncStateChange(f);
@@ -544,6 +584,16 @@ void FolderMan::scheduleFolderNext(Folder *f)
     startScheduledSyncSoon();
 }
 
+void FolderMan::forceSyncFolder(Folder *folder)
+{
+    foreach (Folder *current, syncsBlocking(folder)) {
+        qCInfo(lcFolderMan) << "Terminating the sync of" << current->alias() << "for" << folder->alias();
+        current->slotTerminateSync();
+        scheduleFolder(current);
+    }
+    scheduleFolderNext(folder);
+}
+
 void FolderMan::slotScheduleETagJob(const QString & /*alias*/, RequestEtagJob *job)
 {
     QObject::connect(job, &QObject::destroyed, this, &FolderMan::slotEtagJobDestroyed);
@@ -574,7 +624,7 @@ void FolderMan::slotRunOneEtagJob()
             //qCDebug(lcFolderMan) << "No more remote ETag check jobs to schedule.";
 
             /* now it might be a good time to check for restarting... */
-            if (_currentSyncFolder == NULL && _appRestartRequired) {
+            if (_currentSyncFolders.isEmpty() && _appRestartRequired) {
                 restartApplication();
             }
         } else {
@@ -606,9 +656,9 @@ void FolderMan::slotAccountStateChanged()
         qCInfo(lcFolderMan) << "Account" << accountName << "disconnected or paused, "
                                                            "terminating or descheduling sync folders";
 
-        if (_currentSyncFolder
-            && _currentSyncFolder->accountState() == accountState) {
-            _currentSyncFolder->slotTerminateSync();
+        foreach (Folder *f, _currentSyncFolders) {
+            if (f->accountState() == accountState)
+                f->slotTerminateSync();
         }
 
         QMutableListIterator<Folder *> it(_scheduledFolders);
@@ -643,7 +693,7 @@ void FolderMan::startScheduledSyncSoon()
     if (_scheduledFolders.empty()) {
         return;
     }
-    if (_currentSyncFolder) {
+    if (!canStartAnotherSync()) {
         return;
     }
 
@@ -681,8 +731,8 @@ void FolderMan::startScheduledSyncSoon()
   */
 void FolderMan::slotStartScheduledFolderSync()
 {
-    if (_currentSyncFolder) {
-        qCInfo(lcFolderMan) << "Currently folder " << _currentSyncFolder->remoteUrl().toString() << " is running, wait for finish!";
+    if (!canStartAnotherSync()) {
+        qCInfo(lcFolderMan) << "Currently" << _currentSyncFolders.size() << "folders are running, wait for finish!";
         return;
     }
 
@@ -696,14 +746,22 @@ void FolderMan::slotStartScheduledFolderSync()
         return;
     }
 
-    // Find the first folder in the queue that can be synced.
+    // Find the first folder in the queue that can be synced. The folders
+    // of an account that is syncing already keep their place, the next
+    // account gets its turn meanwhile.
     Folder *folder = 0;
-    while (!_scheduledFolders.isEmpty()) {
-        Folder *g = _scheduledFolders.dequeue();
-        if (g->canSync()) {
-            folder = g;
-            break;
+    QMutableListIterator<Folder *> it(_scheduledFolders);
+    while (it.hasNext()) {
+        Folder *g = it.next();
+        if (!g->canSync()) {
+            it.remove();
+            continue;
         }
+        if (isAccountSyncing(g->accountState()))
+            continue;
+        it.remove();
+        folder = g;
+        break;
     }
 
     emit scheduleQueueChanged();
@@ -715,21 +773,71 @@ void FolderMan::slotStartScheduledFolderSync()
         folder->registerFolderWatcher();
         registerFolderWithSocketApi(folder);
 
-        _currentSyncFolder = folder;
-        folder->startSync(QStringList());
+        _currentSyncFolders.append(folder);
+        if (TransferPolicy::instance()->isConstrained()) {
+            qCInfo(lcFolderMan) << "Metered connection or on battery, large transfers of"
+                                << folder->alias() << "are deferred";
+        }
+        folder->startSync(_scheduledPaths.take(folder));
+
+        // The folder of another account may start right away
+        if (canStartAnotherSync() && !_scheduledFolders.isEmpty())
+            _startScheduledSyncTimer.start(100);
     }
 }
 
+bool FolderMan::canStartAnotherSync() const
+{
+    static int maxSyncs = [] {
+        int value = ConfigFile().maxConcurrentSyncs();
+        if (value < 1) {
+            qCWarning(lcFolderMan) << "Invalid maxConcurrentSyncs" << value << ", syncing one folder at a time";
+            value = 1;
+        }
+        return value;
+    }();
+    return _currentSyncFolders.size() < maxSyncs;
+}
+
+bool FolderMan::isAccountSyncing(AccountState *accountState) const
+{
+    // Its folders share the connections and the bandwidth of the server,
+    // they sync one after the other
+    foreach (Folder *f, _currentSyncFolders) {
+        if (f->accountState() == accountState)
+            return true;
+    }
+    return false;
+}
+
+QList<Folder *> FolderMan::syncsBlocking(Folder *folder) const
+{
+    QList<Folder *> blocking;
+    foreach (Folder *f, _currentSyncFolders) {
+        if (f == folder || f->accountState() == folder->accountState())
+            blocking.append(f);
+    }
+    if (blocking.isEmpty() && !canStartAnotherSync() && !_currentSyncFolders.isEmpty())
+        blocking.append(_currentSyncFolders.last());
+    return blocking;
+}
+
+// The etag polling while the server notifies the changes, in case a
+// notification gets lost
+static const int notifiedPollInterval = 5 * 60 * 1000;
+
 void FolderMan::slotEtagPollTimerTimeout()
 {
     ConfigFile cfg;
-    int polltime = cfg.remotePollInterval();
+    const int polltime = cfg.remotePollInterval();
+    QMap<QPair<AccountState *, QString>, QList<Folder *>> dueFolders;
 
     foreach (Folder *f, _folderMap) {
         if (!f) {
             continue;
         }
-        if (_currentSyncFolder == f) {
+        const bool notified = f->accountState() && f->accountState()->remoteChangeNotifier()->isActive();
+        if (_currentSyncFolders.contains(f)) {
             continue;
         }
         if (_scheduledFolders.contains(f)) {
@@ -741,10 +849,116 @@ void FolderMan::slotEtagPollTimerTimeout()
         if (f->etagJob() || f->isBusy() || !f->canSync()) {
             continue;
         }
-        if (f->msecSinceLastSync() < polltime) {
+        if (_foldersInEtagBatch.contains(f)) {
+            continue;
+        }
+        if (f->msecSinceLastSync() < (notified ? qMax(polltime, notifiedPollInterval) : polltime)) {
+            continue;
+        }
+        if (!f->accountState()->account()->rootEtagChangesNotOnlySubFolderEtags()) {
+            // The etags of these servers are not those of the listing
+            QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
             continue;
         }
-        QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+        const QString remotePath = QDir::cleanPath(f->remotePath());
+        QString parentPath = remotePath.left(remotePath.lastIndexOf(QLatin1Char('/')));
+        if (parentPath.isEmpty())
+            parentPath = QLatin1String("/");
+        dueFolders[qMakePair(f->accountState(), parentPath)].append(f);
+    }
+
+    // The folders next to each other get their etags from one listing of
+    // their parent instead of one request each
+    for (auto it = dueFolders.constBegin(); it != dueFolders.constEnd(); ++it) {
+        if (it.value().size() == 1) {
+            QMetaObject::invokeMethod(it.value().first(), "slotRunEtagJob", Qt::QueuedConnection);
+            continue;
+        }
+        runBatchedEtagJob(it.key().first, it.key().second, it.value());
+    }
+}
+
+void FolderMan::runBatchedEtagJob(AccountState *accountState, const QString &parentPath, const QList<Folder *> &folders)
+{
+    qCInfo(lcFolderMan) << "Checking the etags of" << folders.size() << "folders in" << parentPath;
+
+    QList<QPointer<Folder>> guardedFolders;
+    foreach (Folder *f, folders) {
+        guardedFolders.append(f);
+        _foldersInEtagBatch.insert(f);
+    }
+
+    auto job = new LsColJob(accountState->account(), parentPath, this);
+    job->setProperties(QList<QByteArray>() << "getetag");
+    job->setTimeout(60 * 1000);
+    auto etags = QSharedPointer<QHash<QString, QString>>::create();
+    connect(job, &LsColJob::directoryListingEntry, this, [job, etags](const QString &name, const RemoteEntryInfo &entry) {
+        if (!entry.has(RemoteEntryInfo::Etag))
+            return;
+        QString basePath = job->reply()->request().url().path();
+        if (basePath.endsWith(QLatin1Char('/')))
+            basePath.chop(1);
+        etags->insert(name.mid(basePath.size()), QString::fromUtf8(entry._etag));
+    });
+    auto done = [this, guardedFolders, parentPath, etags](bool success) {
+        foreach (const QPointer<Folder> &f, guardedFolders) {
+            if (!f)
+                continue;
+            _foldersInEtagBatch.remove(f);
+            // The path below the listed folder, empty for the folder itself
+            QString relativePath = QDir::cleanPath(f->remotePath()).mid(parentPath.size());
+            if (!relativePath.isEmpty() && !relativePath.startsWith(QLatin1Char('/')))
+                relativePath.prepend(QLatin1Char('/'));
+            auto etag = etags->constFind(relativePath);
+            if (success && etag != etags->constEnd()) {
+                QMetaObject::invokeMethod(f, "etagRetreived", Q_ARG(QString, *etag));
+            } else {
+                QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+            }
+        }
+    };
+    connect(job, &LsColJob::finishedWithoutError, this, [done] { done(true); });
+    connect(job, &LsColJob::finishedWithError, this, [done](QNetworkReply *reply) {
+        qCWarning(lcFolderMan) << "Could not list the etags of the folders, checking them one by one" << reply->errorString();
+        done(false);
+    });
+    job->start();
+}
+
+void FolderMan::slotRemoteChanged(const QStringList &paths)
+{
+    auto notifier = qobject_cast<RemoteChangeNotifier *>(sender());
+    if (!notifier)
+        return;
+
+    foreach (Folder *f, _folderMap) {
+        if (!f || static_cast<QObject *>(f->accountState()) != notifier->parent())
+            continue;
+        if (_scheduledFolders.contains(f) || _disabledFolders.contains(f) || f->etagJob() || !f->canSync())
+            continue;
+
+        // A change below the folder, or above it: a move or a reset
+        QString folderPath = f->remotePath();
+        if (!folderPath.endsWith(QLatin1Char('/')))
+            folderPath += QLatin1Char('/');
+        bool overlaps = false;
+        foreach (QString path, paths) {
+            if (!path.endsWith(QLatin1Char('/')))
+                path += QLatin1Char('/');
+            if (path.startsWith(folderPath) || folderPath.startsWith(path)) {
+                overlaps = true;
+                break;
+            }
+        }
+        if (!overlaps)
+            continue;
+        qCInfo(lcFolderMan) << "The server notified changes for" << f->alias();
+        if (_currentSyncFolders.contains(f) || f->isBusy()) {
+            // Its discovery may be done already, check again afterwards
+            _remoteChangedDuringSync.insert(f);
+        } else {
+            QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+        }
     }
 }
 
@@ -790,16 +1004,32 @@ void FolderMan::slotServerVersionChanged(Account *account)
 void FolderMan::slotWatchedFileUnlocked(const QString &path)
 {
     if (Folder *f = folderForPath(path)) {
-        f->scheduleThisFolderSoon();
+        f->scheduleUnlockedFile(path);
     }
 }
 
+// slotScheduleFolderByTime() checks again as long as an etag job runs
+static const qint64 EtagJobRecheckMsecs = 5 * 1000;
+
 void FolderMan::slotScheduleFolderByTime()
 {
+    const qint64 forceSyncInterval = ConfigFile().forceSyncInterval();
+    // When the next folder is due, -1 if none is
+    qint64 nextCheck = -1;
+    auto checkIn = [&nextCheck](qint64 msecs) {
+        if (nextCheck < 0 || msecs < nextCheck)
+            nextCheck = msecs;
+    };
+
     foreach (auto &f, _folderMap) {
-        // Never schedule if syncing is disabled or when we're currently
-        // querying the server for etags
-        if (!f->canSync() || f->etagJob()) {
+        // Never schedule if syncing is disabled, the state change will
+        // check again
+        if (!f->canSync()) {
+            continue;
+        }
+        // Or when we're currently querying the server for etags
+        if (f->etagJob()) {
+            checkIn(EtagJobRecheckMsecs);
             continue;
         }
 
@@ -807,7 +1037,7 @@ void FolderMan::slotScheduleFolderByTime()
 
         // Possibly it's just time for a new sync run
         bool forceSyncIntervalExpired =
-            quint64(msecsSinceSync) > ConfigFile().forceSyncInterval();
+            msecsSinceSync > forceSyncInterval;
         if (forceSyncIntervalExpired) {
             qCInfo(lcFolderMan) << "Scheduling folder" << f->alias()
                                 << "because it has been" << msecsSinceSync << "ms "
@@ -837,15 +1067,97 @@ void FolderMan::slotScheduleFolderByTime()
         }
 
         // Do we want to retry failing syncs or another-sync-needed runs more often?
+
+        // Not due yet, check again when it will be
+        checkIn(forceSyncInterval - msecsSinceSync + 1);
+        if (syncAgain)
+            checkIn(syncAgainDelay - msecsSinceSync + 1);
+    }
+
+    // A scheduled folder is checked again once its sync is done
+    if (nextCheck >= 0) {
+        _timeScheduler.start(static_cast<int>(qMin<qint64>(nextCheck, std::numeric_limits<int>::max())));
+    } else {
+        _timeScheduler.stop();
+    }
+}
+
+void FolderMan::slotRunJournalMaintenance()
+{
+    // Only when idle, maintenance can take a while for big journals
+    if (!_currentSyncFolders.isEmpty() || !_scheduledFolders.isEmpty())
+        return;
+
+    foreach (auto &f, _folderMap) {
+        if (f->isBusy())
+            continue;
+        // On the journal's writer thread, a VACUUM blocks the journal for a while
+        auto reclaimed = QSharedPointer<qint64>::create(0);
+        Folder *folder = f;
+        f->journalDb()->runAsync(folder,
+            [reclaimed](SyncJournalDb *db) { *reclaimed = db->maintain(); },
+            [this, folder, reclaimed] {
+                if (*reclaimed > 0) {
+                    qCInfo(lcFolderMan) << "Journal maintenance of folder" << folder->alias()
+                                        << "reclaimed" << *reclaimed << "bytes";
+                }
+                // Also drops connections that were reopened for status queries
+                if (journalLowMemoryMode() && !folder->isBusy())
+                    folder->journalDb()->close();
+            });
+    }
+}
+
+void FolderMan::slotTransferConstraintsChanged(TransferPolicy::Constraints constraints)
+{
+    if (constraints != TransferPolicy::NoConstraint)
+        return;
+    qCInfo(lcFolderMan) << "Transfers are no longer constrained, catching up with the deferred ones";
+    scheduleAllFolders();
+}
+
+// Above this many folders the journals of idle folders get closed
+static const int JournalLowMemoryFolderCount = 8;
+// Page cache of all journals together, SQLite uses 2 MB per connection by default
+static const int JournalCacheBudgetKib = 16 * 1024;
+static const int JournalMinCacheSizeKib = 256;
+
+bool FolderMan::journalLowMemoryMode() const
+{
+    static int env = [] {
+        bool ok = false;
+        int value = qgetenv("OWNCLOUD_JOURNAL_LOW_MEMORY").toInt(&ok);
+        return ok ? value : -1;
+    }();
+    if (env >= 0)
+        return env != 0;
+    return _folderMap.size() > JournalLowMemoryFolderCount;
+}
+
+void FolderMan::updateJournalCacheSizes()
+{
+    int cacheSize = 0;
+    if (journalLowMemoryMode()) {
+        cacheSize = qMax(JournalMinCacheSizeKib, JournalCacheBudgetKib / qMax(1, _folderMap.size()));
+    }
+    ConfigFile cfg;
+    const int maxCacheSize = cfg.journalMaxCacheSize();
+    const qint64 maxMmapSize = cfg.journalMaxMmapSize();
+    foreach (auto &f, _folderMap) {
+        f->journalDb()->setCacheSize(cacheSize);
+        f->journalDb()->setAutoTuneLimits(maxCacheSize, maxMmapSize);
     }
 }
 
 void FolderMan::slotFolderSyncStarted()
 {
+    auto f = qobject_cast<Folder *>(sender());
+    if (!f)
+        return;
     qCInfo(lcFolderMan, ">========== Sync started for folder [%s] of account [%s] with remote [%s]",
-        qPrintable(_currentSyncFolder->shortGuiLocalPath()),
-        qPrintable(_currentSyncFolder->accountState()->account()->displayName()),
-        qPrintable(_currentSyncFolder->remoteUrl().toString()));
+        qPrintable(f->shortGuiLocalPath()),
+        qPrintable(f->accountState()->account()->displayName()),
+        qPrintable(f->remoteUrl().toString()));
 }
 
 /*
@@ -856,13 +1168,26 @@ void FolderMan::slotFolderSyncStarted()
   */
 void FolderMan::slotFolderSyncFinished(const SyncResult &)
 {
+    auto f = qobject_cast<Folder *>(sender());
+    if (!f)
+        return;
     qCInfo(lcFolderMan, "<========== Sync finished for folder [%s] of account [%s] with remote [%s]",
-        qPrintable(_currentSyncFolder->shortGuiLocalPath()),
-        qPrintable(_currentSyncFolder->accountState()->account()->displayName()),
-        qPrintable(_currentSyncFolder->remoteUrl().toString()));
+        qPrintable(f->shortGuiLocalPath()),
+        qPrintable(f->accountState()->account()->displayName()),
+        qPrintable(f->remoteUrl().toString()));
+
+    _lastSyncFolder = f;
+    _currentSyncFolders.removeOne(f);
 
-    _lastSyncFolder = _currentSyncFolder;
-    _currentSyncFolder = 0;
+    if (_remoteChangedDuringSync.remove(_lastSyncFolder))
+        QMetaObject::invokeMethod(_lastSyncFolder, "slotRunEtagJob", Qt::QueuedConnection);
+
+    // With many folders, don't keep the connections, statements and page
+    // caches of all the journals around between syncs. The journal is
+    // reopened on its next use.
+    if (_lastSyncFolder && !_lastSyncFolder->isBusy() && journalLowMemoryMode()) {
+        _lastSyncFolder->journalDb()->close();
+    }
 
     startScheduledSyncSoon();
 }
@@ -929,9 +1254,14 @@ Folder *FolderMan::addFolderInternal(FolderDefinition folderDefinition,
         _socketApi.data(), &SocketApi::broadcastStatusPushMessage);
     connect(folder, &Folder::watchedFileChangedExternally,
         &folder->syncEngine().syncFileStatusTracker(), &SyncFileStatusTracker::slotPathTouched);
+    if (accountState) {
+        connect(accountState->remoteChangeNotifier(), &RemoteChangeNotifier::remoteChanged,
+            this, &FolderMan::slotRemoteChanged, Qt::UniqueConnection);
+    }
 
     folder->registerFolderWatcher();
     registerFolderWithSocketApi(folder);
+    updateJournalCacheSizes();
     return folder;
 }
 
@@ -980,10 +1310,10 @@ void FolderMan::removeFolder(Folder *f)
 
     qCInfo(lcFolderMan) << "Removing " << f->alias();
 
-    const bool currentlyRunning = (_currentSyncFolder == f);
+    const bool currentlyRunning = _currentSyncFolders.contains(f);
     if (currentlyRunning) {
         // abort the sync now
-        terminateSyncProcess();
+        f->slotTerminateSync();
     }
 
     if (_scheduledFolders.removeAll(f) > 0) {
@@ -1420,7 +1750,12 @@ QQueue<Folder *> FolderMan::scheduleQueue() const
 
 Folder *FolderMan::currentSyncFolder() const
 {
-    return _currentSyncFolder;
+    return _currentSyncFolders.value(0);
+}
+
+QList<Folder *> FolderMan::currentSyncFolders() const
+{
+    return _currentSyncFolders;
 }
 
 void FolderMan::restartApplication()
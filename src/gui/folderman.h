@@ -24,6 +24,7 @@
 #include "folderwatcher.h"
 #include "navigationpanehelper.h"
 #include "syncfileitem.h"
+#include "transferpolicy.h"
 
 class TestFolderMan;
 
@@ -156,10 +157,17 @@ public:
     QQueue<Folder *> scheduleQueue() const;
 
     /**
-     * Access to the currently syncing folder.
+     * Access to the currently syncing folder, the first one if several
+     * are syncing.
      */
     Folder *currentSyncFolder() const;
 
+    /**
+     * The folders that are syncing, at most ConfigFile::maxConcurrentSyncs()
+     * of them and never two of the same account.
+     */
+    QList<Folder *> currentSyncFolders() const;
+
     /** Removes all folders */
     int unloadAndDeleteAllFolders();
 
@@ -169,12 +177,25 @@ public:
      */
     void setSyncEnabled(bool);
 
-    /** Queues a folder for syncing. */
-    void scheduleFolder(Folder *);
+    /**
+     * Queues a folder for syncing.
+     *
+     * With @a paths, relative to the folder, the sync is only for them, see
+     * Folder::startSync(). A folder that is queued for all its paths
+     * stays queued like that.
+     */
+    void scheduleFolder(Folder *, const QStringList &paths = QStringList());
 
     /** Puts a folder in the very front of the queue. */
     void scheduleFolderNext(Folder *);
 
+    /**
+     * Syncs @a folder right away: terminates and reschedules the syncs
+     * that would make it wait, see syncsBlocking(), and puts it in the
+     * front of the queue. The syncs of the other accounts keep running.
+     */
+    void forceSyncFolder(Folder *folder);
+
     /** Queues all folders for syncing. */
     void scheduleAllFolders();
 
@@ -182,7 +203,7 @@ public:
     void setDirtyNetworkLimits();
 
     /**
-     * Terminates the current folder sync.
+     * Terminates the current folder syncs.
      *
      * It does not switch the folder to paused state.
      */
@@ -227,6 +248,9 @@ public slots:
      */
     void slotSyncOnceFileUnlocks(const QString &path);
 
+    /// A folder watcher reported @a path, locks next to it may be gone
+    void slotCheckFileUnlocksNear(const QString &path);
+
     // slot to schedule an ETag job (from Folder only)
     void slotScheduleETagJob(const QString &alias, RequestEtagJob *job);
 
@@ -243,6 +267,9 @@ private slots:
     void slotStartScheduledFolderSync();
     void slotEtagPollTimerTimeout();
 
+    /// Checks the etags of the folders of the account that overlap the paths
+    void slotRemoteChanged(const QStringList &paths);
+
     void slotRemoveFoldersForAccount(AccountState *accountState);
 
     // Wraps the Folder::syncStateChange() signal into the
@@ -267,6 +294,20 @@ private slots:
      */
     void slotScheduleFolderByTime();
 
+    /**
+     * Compacts the journals of the folders while no sync is running.
+     *
+     * See SyncJournalDb::maintain().
+     */
+    void slotRunJournalMaintenance();
+
+    /**
+     * Syncs all folders again when the connection is no longer metered and
+     * the computer no longer on battery, for the transfers that were
+     * deferred. See TransferPolicy.
+     */
+    void slotTransferConstraintsChanged(TransferPolicy::Constraints constraints);
+
 private:
     /** Adds a new folder, does not add it to the account settings and
      *  does not set an account on the new folder.
@@ -280,6 +321,17 @@ private:
     /** Will start a sync after a bit of delay. */
     void startScheduledSyncSoon();
 
+    /**
+     * Whether so many folders are configured that the journals of idle
+     * folders should be closed and share a fixed page cache budget.
+     *
+     * Can be forced with OWNCLOUD_JOURNAL_LOW_MEMORY=0 or 1.
+     */
+    bool journalLowMemoryMode() const;
+
+    /** Splits the journal page cache budget between the folders. */
+    void updateJournalCacheSizes();
+
     // finds all folder configuration files
     // and create the folders
     QString getBackupName(QString fullPathName) const;
@@ -290,12 +342,27 @@ private:
     // restarts the application (Linux only)
     void restartApplication();
 
+    /// Whether another folder may start to sync next to the running ones
+    bool canStartAnotherSync() const;
+    bool isAccountSyncing(AccountState *accountState) const;
+
+    /**
+     * The running syncs @a folder would wait for: its own, the one of its
+     * account, or else the last started one if no sync slot is free.
+     */
+    QList<Folder *> syncsBlocking(Folder *folder) const;
+
+    /// Gets the etags of @a folders, all in @a parentPath, with one PROPFIND
+    void runBatchedEtagJob(AccountState *accountState, const QString &parentPath, const QList<Folder *> &folders);
+
     void setupFoldersHelper(QSettings &settings, AccountStatePtr account, bool backwardsCompatible);
 
     QSet<Folder *> _disabledFolders;
+    /// The server notified changes for them while they were syncing
+    QSet<Folder *> _remoteChangedDuringSync;
     Folder::Map _folderMap;
     QString _folderConfigPath;
-    Folder *_currentSyncFolder;
+    QList<Folder *> _currentSyncFolders;
     QPointer<Folder> _lastSyncFolder;
     bool _syncEnabled;
 
@@ -303,19 +370,27 @@ private:
     QTimer _etagPollTimer;
     /// The currently running etag query
     QPointer<RequestEtagJob> _currentEtagJob;
+    /// The folders whose etags a listing of their parent is getting
+    QSet<Folder *> _foldersInEtagBatch;
 
     /// Watches files that couldn't be synced due to locks
     QScopedPointer<LockWatcher> _lockWatcher;
 
-    /// Occasionally schedules folders
+    /// Schedules folders when their force-sync or retry delay expires, armed
+    /// for the next folder that is due instead of polling
     QTimer _timeScheduler;
 
     /// Scheduled folders that should be synced as soon as possible
     QQueue<Folder *> _scheduledFolders;
+    /// The paths of the scheduled folders that are only synced for some
+    QHash<Folder *, QStringList> _scheduledPaths;
 
     /// Picks the next scheduled folder and starts the sync
     QTimer _startScheduledSyncTimer;
 
+    /// Occasionally compacts the journals
+    QTimer _journalMaintenanceTimer;
+
     QScopedPointer<SocketApi> _socketApi;
     NavigationPaneHelper _navigationPaneHelper;
 
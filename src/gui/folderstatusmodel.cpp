@@ -31,7 +31,7 @@ namespace OCC {
 Q_LOGGING_CATEGORY(lcFolderStatus, "gui.folder.model", QtInfoMsg)
 
 static const char propertyParentIndexC[] = "oc_parentIndex";
-static const char propertyPermissionMap[] = "oc_permissionMap";
+static const char propertyRefreshC[] = "oc_refresh";
 
 static QString removeTrailingSlash(const QString &s)
 {
@@ -543,7 +543,21 @@ void FolderStatusModel::fetchMore(const QModelIndex &parent)
     if (!info || info->_fetched || info->_fetching)
         return;
     info->resetSubs(this, parent);
-    info->_fetching = true;
+
+    // The last listing is shown at once. If the directory didn't change
+    // since then, it is not listed again.
+    bool refresh = false;
+    if (auto listing = info->_folder->remoteFolderListing(info->_path)) {
+        const bool unchanged = !listing->etag.isEmpty()
+            && listing->etag == info->_folder->remoteFolderEtag(info->_path);
+        insertSubfolders(parent, info, *listing, unchanged);
+        if (unchanged)
+            return;
+        refresh = true;
+    } else {
+        info->_fetching = true;
+    }
+
     QString path = info->_folder->remotePath();
     if (info->_path != QLatin1String("/")) {
         if (!path.endsWith(QLatin1Char('/'))) {
@@ -553,6 +567,7 @@ void FolderStatusModel::fetchMore(const QModelIndex &parent)
     }
     LsColJob *job = new LsColJob(_accountState->account(), path, this);
     job->setProperties(QList<QByteArray>() << "resourcetype"
+                                           << "getetag"
                                            << "http://owncloud.org/ns:size"
                                            << "http://owncloud.org/ns:permissions");
     job->setTimeout(60 * 1000);
@@ -560,43 +575,76 @@ void FolderStatusModel::fetchMore(const QModelIndex &parent)
         this, &FolderStatusModel::slotUpdateDirectories);
     connect(job, &LsColJob::finishedWithError,
         this, &FolderStatusModel::slotLscolFinishedWithError);
-    connect(job, &LsColJob::directoryListingIterated,
-        this, &FolderStatusModel::slotGatherPermissions);
+    connect(job, &LsColJob::directoryListingEntry,
+        this, &FolderStatusModel::slotGatherListingEntry);
+    // In case an earlier job had the same address
+    _receivedListings.remove(job);
 
     job->start();
 
     QPersistentModelIndex persistentIndex(parent);
     job->setProperty(propertyParentIndexC, QVariant::fromValue(persistentIndex));
+    job->setProperty(propertyRefreshC, refresh);
+    if (refresh)
+        return;
 
     // Show 'fetching data...' hint after a while.
     _fetchingItems[persistentIndex].start();
     QTimer::singleShot(1000, this, &FolderStatusModel::slotShowFetchProgress);
 }
 
-void FolderStatusModel::slotGatherPermissions(const QString &href, const QMap<QString, QString> &map)
+void FolderStatusModel::slotGatherListingEntry(const QString &href, const RemoteEntryInfo &entry)
 {
-    auto it = map.find("permissions");
-    if (it == map.end())
-        return;
-
     auto job = sender();
-    auto permissionMap = job->property(propertyPermissionMap).toMap();
-    job->setProperty(propertyPermissionMap, QVariant()); // avoid a detach of the map while it is modified
+    auto it = _receivedListings.find(job);
+    if (it == _receivedListings.end()) {
+        // The first entry is the listed directory itself
+        RemoteFolderListing listing;
+        listing.etag = Utility::normalizeEtag(entry._etag);
+        _receivedListings.insert(job, listing);
+        return;
+    }
     ASSERT(!href.endsWith(QLatin1Char('/')), "LsColXMLParser::parse should remove the trailing slash before calling us.");
-    permissionMap[href] = *it;
-    job->setProperty(propertyPermissionMap, permissionMap);
+    if (entry._permissions.contains('M'))
+        it->external.insert(href);
 }
 
 void FolderStatusModel::slotUpdateDirectories(const QStringList &list)
 {
     auto job = qobject_cast<LsColJob *>(sender());
     ASSERT(job);
+    RemoteFolderListing listing = _receivedListings.take(job);
+    listing.subfolders = list;
+    if (!listing.subfolders.isEmpty())
+        listing.subfolders.removeFirst(); // skip the parent item (first in the list)
+    Utility::sortFilenames(listing.subfolders);
+    listing.sizes = job->_sizes;
+
     QModelIndex idx = qvariant_cast<QPersistentModelIndex>(job->property(propertyParentIndexC));
     auto parentInfo = infoForIndex(idx);
     if (!parentInfo) {
         return;
     }
-    ASSERT(parentInfo->_fetching); // we should only get a result if we were doing a fetch
+
+    if (job->property(propertyRefreshC).toBool()) {
+        // The subfolders of the last listing are shown, replace them if they changed
+        auto shown = parentInfo->_folder->remoteFolderListing(parentInfo->_path);
+        const bool changed = !shown || shown->subfolders != listing.subfolders
+            || shown->sizes != listing.sizes || shown->external != listing.external;
+        parentInfo->_folder->setRemoteFolderListing(parentInfo->_path, listing);
+        if (!changed || !parentInfo->_fetched || parentInfo->_fetching)
+            return;
+        parentInfo->resetSubs(this, idx);
+    } else {
+        ASSERT(parentInfo->_fetching); // we should only get a result if we were doing a fetch
+        parentInfo->_folder->setRemoteFolderListing(parentInfo->_path, listing);
+    }
+    insertSubfolders(idx, parentInfo, listing, true);
+}
+
+void FolderStatusModel::insertSubfolders(const QModelIndex &idx, SubFolderInfo *parentInfo,
+    const RemoteFolderListing &listing, bool current)
+{
     ASSERT(parentInfo->_subs.isEmpty());
 
     if (parentInfo->hasLabel()) {
@@ -634,18 +682,11 @@ void FolderStatusModel::slotUpdateDirectories(const QStringList &list)
             selectiveSyncUndecidedSet.insert(str);
         }
     }
-    const auto permissionMap = job->property(propertyPermissionMap).toMap();
-
-    QStringList sortedSubfolders = list;
-    if (!sortedSubfolders.isEmpty())
-        sortedSubfolders.removeFirst(); // skip the parent item (first in the list)
-    Utility::sortFilenames(sortedSubfolders);
-
     QVarLengthArray<int, 10> undecidedIndexes;
 
     QVector<SubFolderInfo> newSubs;
-    newSubs.reserve(sortedSubfolders.size());
-    foreach (const QString &path, sortedSubfolders) {
+    newSubs.reserve(listing.subfolders.size());
+    foreach (const QString &path, listing.subfolders) {
         auto relativePath = path.mid(pathToRemove.size());
         if (parentInfo->_folder->isFileExcludedRelative(relativePath)) {
             continue;
@@ -655,8 +696,8 @@ void FolderStatusModel::slotUpdateDirectories(const QStringList &list)
         newInfo._folder = parentInfo->_folder;
         newInfo._pathIdx = parentInfo->_pathIdx;
         newInfo._pathIdx << newSubs.size();
-        newInfo._size = job->_sizes.value(path);
-        newInfo._isExternal = permissionMap.value(removeTrailingSlash(path)).toString().contains("M");
+        newInfo._size = listing.sizes.value(path);
+        newInfo._isExternal = listing.external.contains(removeTrailingSlash(path));
         newInfo._path = relativePath;
         newInfo._name = removeTrailingSlash(relativePath).split('/').last();
 
@@ -711,6 +752,8 @@ void FolderStatusModel::slotUpdateDirectories(const QStringList &list)
 #if !(defined(Q_CC_GNU) && !defined(Q_CC_INTEL) && !defined(Q_CC_CLANG)) || (__GNUC__ * 100 + __GNUC_MINOR__ >= 405)
 
     /* Try to remove the the undecided lists the items that are not on the server. */
+    if (!current)
+        return;
     auto it = std::remove_if(selectiveSyncUndecidedList.begin(), selectiveSyncUndecidedList.end(),
         [&](const QString &s) { return selectiveSyncUndecidedSet.count(s); });
     if (it != selectiveSyncUndecidedList.end()) {
@@ -726,6 +769,12 @@ void FolderStatusModel::slotLscolFinishedWithError(QNetworkReply *r)
 {
     auto job = qobject_cast<LsColJob *>(sender());
     ASSERT(job);
+    _receivedListings.remove(job);
+    if (job->property(propertyRefreshC).toBool()) {
+        // The last listing stays
+        qCDebug(lcFolderStatus) << "Could not refresh the subfolders" << r->errorString();
+        return;
+    }
     QModelIndex idx = qvariant_cast<QPersistentModelIndex>(job->property(propertyParentIndexC));
     if (!idx.isValid()) {
         return;
@@ -1047,9 +1096,9 @@ void FolderStatusModel::slotFolderSyncStateChange(Folder *f)
     } else if (state == SyncResult::NotYetStarted) {
         FolderMan *folderMan = FolderMan::instance();
         int pos = folderMan->scheduleQueue().indexOf(f);
-        if (folderMan->currentSyncFolder()
-            && folderMan->currentSyncFolder() != f) {
-            pos += 1;
+        foreach (Folder *current, folderMan->currentSyncFolders()) {
+            if (current != f)
+                pos += 1;
         }
         QString message;
         if (pos <= 0) {
@@ -16,6 +16,7 @@
 #define FOLDERSTATUSMODEL_H
 
 #include <accountfwd.h>
+#include "folder.h"
 #include <QAbstractItemModel>
 #include <QLoggingCategory>
 #include <QVector>
@@ -138,7 +139,7 @@ public slots:
 
 private slots:
     void slotUpdateDirectories(const QStringList &);
-    void slotGatherPermissions(const QString &name, const QMap<QString, QString> &properties);
+    void slotGatherListingEntry(const QString &href, const RemoteEntryInfo &entry);
     void slotLscolFinishedWithError(QNetworkReply *r);
     void slotFolderSyncStateChange(Folder *f);
     void slotFolderScheduleQueueChanged();
@@ -151,6 +152,10 @@ private slots:
     void slotShowFetchProgress();
 
 private:
+    // Sets the subfolders of an item without any, @a current if the listing
+    // is of the directory as it is on the server
+    void insertSubfolders(const QModelIndex &idx, SubFolderInfo *parentInfo,
+        const RemoteFolderListing &listing, bool current);
     QStringList createBlackList(OCC::FolderStatusModel::SubFolderInfo *root,
         const QStringList &oldBlackList) const;
     const AccountState *_accountState;
@@ -163,6 +168,9 @@ private:
      */
     QMap<QPersistentModelIndex, QElapsedTimer> _fetchingItems;
 
+    // The listings the LsColJobs are receiving
+    QHash<QObject *, RemoteFolderListing> _receivedListings;
+
 signals:
     void dirtyChanged();
 
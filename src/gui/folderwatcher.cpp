@@ -38,11 +38,11 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcFolderWatcher, "gui.folderwatcher", QtInfoMsg)
 
-FolderWatcher::FolderWatcher(const QString &root, Folder *folder)
+FolderWatcher::FolderWatcher(const QString &root, Folder *folder, const QByteArray &replayCursor)
     : QObject(folder)
     , _folder(folder)
 {
-    _d.reset(new FolderWatcherPrivate(this, root));
+    _d.reset(new FolderWatcherPrivate(this, root, replayCursor));
 
     _timer.start();
 }
@@ -51,15 +51,16 @@ FolderWatcher::~FolderWatcher()
 {
 }
 
-bool FolderWatcher::pathIsIgnored(const QString &path)
+bool FolderWatcher::pathIsIgnored(const QString &path, int filetype)
 {
     if (path.isEmpty())
         return true;
     if (!_folder)
         return false;
 
-#ifndef OWNCLOUD_TEST
-    if (_folder->isFileExcludedAbsolute(path)) {
+// The tests and owncloudcmd have no Folder
+#if !defined(OWNCLOUD_TEST) && !defined(OWNCLOUDCMD_FOLDERWATCHER)
+    if (_folder->isFileExcludedAbsolute(path, filetype)) {
         qCDebug(lcFolderWatcher) << "* Ignoring file" << path;
         return true;
     }
@@ -72,6 +73,11 @@ bool FolderWatcher::isReliable() const
     return _isReliable;
 }
 
+QByteArray FolderWatcher::cursor() const
+{
+    return _d->cursor();
+}
+
 void FolderWatcher::changeDetected(const QString &path)
 {
     QStringList paths(path);
@@ -99,6 +105,7 @@ void FolderWatcher::changeDetected(const QStringList &paths)
     // ------- handle ignores:
     for (int i = 0; i < paths.size(); ++i) {
         QString path = paths[i];
+        emit pathActivity(path);
         if (pathIsIgnored(path)) {
             continue;
         }
@@ -57,8 +57,10 @@ class FolderWatcher : public QObject
 public:
     /**
      * @param root Path of the root of the folder
+     * @param replayCursor A cursor() of an earlier run: the changes since
+     *        then are reported first, followed by changesReplayed()
      */
-    FolderWatcher(const QString &root, Folder *folder = 0L);
+    FolderWatcher(const QString &root, Folder *folder = 0L, const QByteArray &replayCursor = QByteArray());
     virtual ~FolderWatcher();
 
     /**
@@ -69,8 +71,8 @@ public:
     void addPath(const QString &);
     void removePath(const QString &);
 
-    /* Check if the path is ignored. */
-    bool pathIsIgnored(const QString &path);
+    /* Check if the path is ignored. @a filetype is a csync_ftw_type_e, -1 when not known */
+    bool pathIsIgnored(const QString &path, int filetype = -1);
 
     /**
      * Returns false if the folder watcher can't be trusted to capture all
@@ -81,11 +83,21 @@ public:
      */
     bool isReliable() const;
 
+    /**
+     * The position in the change journal of the OS up to which the changes
+     * were reported: the NTFS USN journal on Windows, the FSEvents event
+     * id on macOS. Empty if there is none, like on Linux.
+     */
+    QByteArray cursor() const;
+
 signals:
     /** Emitted when one of the watched directories or one
      *  of the contained files is changed. */
     void pathChanged(const QString &path);
 
+    /** Emitted for every reported path, the ignored ones too. */
+    void pathActivity(const QString &path);
+
     /**
      * Emitted if some notifications were lost.
      *
@@ -96,6 +108,13 @@ signals:
      */
     void lostChanges();
 
+    /**
+     * Emitted once the changes since the replayCursor of the constructor
+     * were reported. @a complete is false if the journal didn't have all
+     * of them any more.
+     */
+    void changesReplayed(bool complete);
+
 protected slots:
     // called from the implementations to indicate a change in path
     void changeDetected(const QString &path);
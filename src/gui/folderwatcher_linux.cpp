@@ -15,22 +15,50 @@
 #include "config.h"
 
 #include <sys/inotify.h>
+#ifdef Q_OS_LINUX
+#include <sys/fanotify.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// FAN_REPORT_DFID_NAME is from Linux 5.9
+#if defined(Q_OS_LINUX) && defined(FAN_REPORT_DFID_NAME)
+#define OWNCLOUD_FANOTIFY
+#endif
 
 #include "folder.h"
 #include "folderwatcher_linux.h"
 
 #include <cerrno>
+#include <climits>
+#include <QFile>
 #include <QStringList>
+#include <QtConcurrent>
 #include <QObject>
 #include <QVarLengthArray>
 
 namespace OCC {
 
-FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path)
+// Folders registered per event of the main thread
+static const int folderWalkBatchSize = 200;
+
+// The files the client writes itself
+static bool isSyncMetadataFile(const QByteArray &fileName)
+{
+    return fileName.startsWith("._sync_")
+        || fileName.startsWith(".csync_journal.db")
+        || fileName.startsWith(".owncloudsync.log")
+        || fileName.startsWith(".sync_");
+}
+
+FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path, const QByteArray &)
     : QObject()
     , _parent(p)
     , _folder(path)
 {
+    if (fanotifyStart())
+        return;
+
     _fd = inotify_init();
     if (_fd != -1) {
         _socket.reset(new QSocketNotifier(_fd, QSocketNotifier::Read));
@@ -38,12 +66,21 @@ FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path
     } else {
         qCWarning(lcFolderWatcher) << "notify_init() failed: " << strerror(errno);
     }
+    connect(this, &FolderWatcherPrivate::foldersFound, this, &FolderWatcherPrivate::slotFoldersFound, Qt::QueuedConnection);
 
     QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Q_ARG(QString, path));
 }
 
 FolderWatcherPrivate::~FolderWatcherPrivate()
 {
+    _stopWalks.store(1);
+    for (auto &walk : _walks)
+        walk.waitForFinished();
+    _socket.reset();
+    if (_fanotifyFd != -1)
+        close(_fanotifyFd);
+    if (_fanotifyMountFd != -1)
+        close(_fanotifyMountFd);
 }
 
 // attention: result list passed by reference!
@@ -71,13 +108,15 @@ bool FolderWatcherPrivate::findFoldersBelow(const QDir &dir, QStringList &fullLi
     return ok;
 }
 
-void FolderWatcherPrivate::inotifyRegisterPath(const QString &path)
+bool FolderWatcherPrivate::inotifyRegisterPath(const QString &path)
 {
     if (!path.isEmpty()) {
         int wd = inotify_add_watch(_fd, path.toUtf8().constData(),
             IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR);
         if (wd > -1) {
+            // The same folder gets the same watch again
             _watches.insert(wd, path);
+            return true;
         } else {
             // If we're running out of memory or inotify watches, become
             // unreliable.
@@ -86,40 +125,71 @@ void FolderWatcherPrivate::inotifyRegisterPath(const QString &path)
             }
         }
     }
+    return false;
 }
 
 void FolderWatcherPrivate::slotAddFolderRecursive(const QString &path)
 {
-    int subdirs = 0;
     qCDebug(lcFolderWatcher) << "(+) Watcher:" << path;
 
+    // The folder itself right away, the ones below from a thread. Listing
+    // them can take minutes on big trees.
     QDir inPath(path);
     inotifyRegisterPath(inPath.absolutePath());
 
-    const QStringList watchedFolders = _watches.values();
+    // The folders of a later addPath() are new, changes in them before
+    // they are registered must not be lost. At startup the initial walk
+    // ends with lostChanges() instead, reporting every folder would be
+    // all of them.
+    const bool reportChanged = _initialWalkStarted;
+    _initialWalkStarted = true;
+    for (int i = _walks.size() - 1; i >= 0; --i) {
+        if (_walks.at(i).isFinished())
+            _walks.removeAt(i);
+    }
+    const QString root = inPath.absolutePath();
+    _walks.append(QtConcurrent::run([this, root, reportChanged] { walkFolders(root, reportChanged); }));
+}
 
-    QStringList allSubfolders;
-    if (!findFoldersBelow(QDir(path), allSubfolders)) {
-        qCWarning(lcFolderWatcher) << "Could not traverse all sub folders";
+void FolderWatcherPrivate::walkFolders(const QString &path, bool reportChanged)
+{
+    // Breadth first, the folders near the root are watched first
+    QStringList pending(path);
+    QStringList batch;
+    while (!pending.isEmpty() && !_stopWalks.load()) {
+        const QDir dir(pending.takeFirst());
+        const QStringList names = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks | QDir::Hidden);
+        for (const auto &name : names) {
+            const QString fullPath = dir.path() + QLatin1Char('/') + name;
+            pending.append(fullPath);
+            batch.append(fullPath);
+        }
+        if (batch.size() >= folderWalkBatchSize) {
+            emit foldersFound(batch, reportChanged, false);
+            batch.clear();
+        }
     }
-    QStringListIterator subfoldersIt(allSubfolders);
-    while (subfoldersIt.hasNext()) {
-        QString subfolder = subfoldersIt.next();
-        QDir folder(subfolder);
-        if (folder.exists() && !watchedFolders.contains(folder.absolutePath())) {
-            subdirs++;
-            if (_parent->pathIsIgnored(subfolder)) {
-                qCDebug(lcFolderWatcher) << "* Not adding" << folder.path();
-                continue;
-            }
-            inotifyRegisterPath(folder.absolutePath());
-        } else {
-            qCDebug(lcFolderWatcher) << "    `-> discarded:" << folder.path();
+    emit foldersFound(batch, reportChanged, true);
+}
+
+void FolderWatcherPrivate::slotFoldersFound(const QStringList &folders, bool reportChanged, bool last)
+{
+    QStringList registered;
+    for (const auto &folder : folders) {
+        if (_parent->pathIsIgnored(folder, CSYNC_FTW_TYPE_DIR)) {
+            qCDebug(lcFolderWatcher) << "* Not adding" << folder;
+            continue;
         }
+        if (inotifyRegisterPath(folder) && reportChanged)
+            registered.append(folder);
     }
+    if (!registered.isEmpty())
+        _parent->changeDetected(registered);
 
-    if (subdirs > 0) {
-        qCDebug(lcFolderWatcher) << "    `-> and" << subdirs << "subdirectories";
+    if (last && !reportChanged) {
+        qCInfo(lcFolderWatcher) << "Watching" << _folder << "with" << _watches.size() << "inotify watches";
+        // The changes made while the folders were registered
+        emit _parent->lostChanges();
     }
 }
 
@@ -166,11 +236,7 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
         // Fire event for the path that was changed.
         if (event->len > 0 && event->wd > -1) {
             QByteArray fileName(event->name);
-            if (fileName.startsWith("._sync_")
-                || fileName.startsWith(".csync_journal.db")
-                || fileName.startsWith(".owncloudsync.log")
-                || fileName.startsWith(".sync_")) {
-            } else {
+            if (!isSyncMetadataFile(fileName)) {
                 const QString p = _watches[event->wd] + '/' + fileName;
                 _parent->changeDetected(p);
             }
@@ -181,13 +247,153 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
     }
 }
 
+#ifdef OWNCLOUD_FANOTIFY
+bool FolderWatcherPrivate::fanotifyStart()
+{
+    static bool disabled = !qgetenv("OWNCLOUD_DISABLE_FANOTIFY").isEmpty();
+    if (disabled)
+        return false;
+
+    int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY | O_LARGEFILE);
+    if (fd == -1) {
+        // EPERM without CAP_SYS_ADMIN, EINVAL on older kernels
+        qCInfo(lcFolderWatcher) << "fanotify is not available, using inotify:" << strerror(errno);
+        return false;
+    }
+
+    const QByteArray folder = QFile::encodeName(_folder);
+    // Mount marks don't get the create, delete and move events
+    const uint64_t mask = FAN_CLOSE_WRITE | FAN_ATTRIB | FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO
+        | FAN_DELETE_SELF | FAN_ONDIR;
+    if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, folder.constData()) == -1) {
+        qCInfo(lcFolderWatcher) << "Could not watch" << _folder << "with fanotify, using inotify:" << strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    // The events carry directory handles, opening them needs CAP_DAC_READ_SEARCH
+    _fanotifyMountFd = open(folder.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    QByteArray handle(sizeof(file_handle) + MAX_HANDLE_SZ, 0);
+    auto *fh = reinterpret_cast<file_handle *>(handle.data());
+    fh->handle_bytes = MAX_HANDLE_SZ;
+    int mountId;
+    if (_fanotifyMountFd == -1
+        || name_to_handle_at(AT_FDCWD, folder.constData(), fh, &mountId, 0) == -1
+        || fanotifyDirectoryPath(handle.left(sizeof(file_handle) + fh->handle_bytes)).isEmpty()) {
+        qCInfo(lcFolderWatcher) << "Could not resolve the fanotify events of" << _folder << ", using inotify:" << strerror(errno);
+        if (_fanotifyMountFd != -1)
+            close(_fanotifyMountFd);
+        _fanotifyMountFd = -1;
+        close(fd);
+        return false;
+    }
+
+    _fanotifyFd = fd;
+    _socket.reset(new QSocketNotifier(_fanotifyFd, QSocketNotifier::Read));
+    connect(_socket.data(), &QSocketNotifier::activated, this, &FolderWatcherPrivate::slotReceivedFanotifyNotification);
+    qCInfo(lcFolderWatcher) << "Watching" << _folder << "with fanotify";
+    return true;
+}
+
+QString FolderWatcherPrivate::fanotifyDirectoryPath(const QByteArray &handle)
+{
+    auto it = _fanotifyDirectories.constFind(handle);
+    if (it != _fanotifyDirectories.constEnd())
+        return *it;
+
+    QByteArray handleCopy = handle; // open_by_handle_at wants it mutable
+    int dirFd = open_by_handle_at(_fanotifyMountFd, reinterpret_cast<file_handle *>(handleCopy.data()), O_PATH | O_CLOEXEC);
+    if (dirFd == -1) {
+        // Deleted since, its parent got an event too
+        return QString();
+    }
+    char target[PATH_MAX];
+    const ssize_t len = readlink(("/proc/self/fd/" + QByteArray::number(dirFd)).constData(), target, sizeof(target));
+    close(dirFd);
+    if (len <= 0 || len == sizeof(target))
+        return QString();
+
+    QString path = QFile::decodeName(QByteArray(target, len));
+    // The other directories of the file system are looked up once too
+    if (_fanotifyDirectories.size() >= 10000)
+        _fanotifyDirectories.clear();
+    _fanotifyDirectories.insert(handle, path);
+    return path;
+}
+
+void FolderWatcherPrivate::slotReceivedFanotifyNotification(int fd)
+{
+    alignas(fanotify_event_metadata) char buffer[8192];
+    const QString folder = _folder.endsWith(QLatin1Char('/')) ? _folder.left(_folder.size() - 1) : _folder;
+    QStringList paths;
+
+    forever {
+        ssize_t len = read(fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            // EAGAIN, all the events are read
+            break;
+        }
+        const auto *event = reinterpret_cast<const fanotify_event_metadata *>(buffer);
+        for (; FAN_EVENT_OK(event, len); event = FAN_EVENT_NEXT(event, len)) {
+            if (event->mask & FAN_Q_OVERFLOW) {
+                qCWarning(lcFolderWatcher) << "fanotify queue overflow, changes were lost";
+                emit _parent->lostChanges();
+                continue;
+            }
+            const auto *info = reinterpret_cast<const fanotify_event_info_fid *>(event + 1);
+            if (event->event_len < sizeof(*event) + sizeof(*info) + sizeof(file_handle)
+                || info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                continue;
+            }
+            const auto *fh = reinterpret_cast<const file_handle *>(info->handle);
+            const QByteArray handle(reinterpret_cast<const char *>(fh), sizeof(file_handle) + fh->handle_bytes);
+            const QByteArray fileName(reinterpret_cast<const char *>(fh->f_handle + fh->handle_bytes));
+
+            if ((event->mask & FAN_ONDIR) && (event->mask & (FAN_MOVED_FROM | FAN_DELETE | FAN_DELETE_SELF))) {
+                // The paths of the directories below changed
+                _fanotifyDirectories.clear();
+            }
+
+            const QString dir = fanotifyDirectoryPath(handle);
+            if (dir.isEmpty() || !(dir == folder || dir.startsWith(folder + QLatin1Char('/'))))
+                continue;
+            if (fileName.isEmpty() || fileName == "." || isSyncMetadataFile(fileName))
+                continue;
+            paths.append(dir + QLatin1Char('/') + QFile::decodeName(fileName));
+        }
+    }
+
+    if (!paths.isEmpty())
+        _parent->changeDetected(paths);
+}
+#else
+bool FolderWatcherPrivate::fanotifyStart()
+{
+    return false;
+}
+
+QString FolderWatcherPrivate::fanotifyDirectoryPath(const QByteArray &)
+{
+    return QString();
+}
+
+void FolderWatcherPrivate::slotReceivedFanotifyNotification(int)
+{
+}
+#endif
+
 void FolderWatcherPrivate::addPath(const QString &path)
 {
+    // fanotify sees the new directories already
+    if (_fanotifyFd != -1)
+        return;
     slotAddFolderRecursive(path);
 }
 
 void FolderWatcherPrivate::removePath(const QString &path)
 {
+    if (_fanotifyFd != -1)
+        return;
     int wid = -1;
     // Remove the inotify watch.
     QHash<int, QString>::const_iterator i = _watches.constBegin();
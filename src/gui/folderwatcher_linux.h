@@ -20,13 +20,22 @@
 #include <QSocketNotifier>
 #include <QHash>
 #include <QDir>
+#include <QFuture>
+#include <QAtomicInt>
 
 #include "folderwatcher.h"
 
 namespace OCC {
 
 /**
- * @brief Linux (inotify) API implementation of FolderWatcher
+ * @brief Linux (fanotify and inotify) API implementation of FolderWatcher
+ *
+ * fanotify watches the whole file system of the folder with a single mark,
+ * the events are filtered by the path of the folder. It needs a kernel with
+ * FAN_REPORT_DFID_NAME and the CAP_SYS_ADMIN and CAP_DAC_READ_SEARCH
+ * capabilities. Otherwise, or with OWNCLOUD_DISABLE_FANOTIFY set, there is
+ * one inotify watch per directory.
+ *
  * @ingroup gui
  */
 class FolderWatcherPrivate : public QObject
@@ -34,19 +43,31 @@ class FolderWatcherPrivate : public QObject
     Q_OBJECT
 public:
     FolderWatcherPrivate() {}
-    FolderWatcherPrivate(FolderWatcher *p, const QString &path);
+    FolderWatcherPrivate(FolderWatcher *p, const QString &path, const QByteArray &replayCursor = QByteArray());
     ~FolderWatcherPrivate();
 
     void addPath(const QString &path);
     void removePath(const QString &);
 
+    // Neither fanotify nor inotify have a journal
+    QByteArray cursor() const { return QByteArray(); }
+
+signals:
+    /** From the thread of a folder walk, @a last for the last batch */
+    void foldersFound(const QStringList &folders, bool reportChanged, bool last);
+
 protected slots:
     void slotReceivedNotification(int fd);
+    void slotReceivedFanotifyNotification(int fd);
     void slotAddFolderRecursive(const QString &path);
+    void slotFoldersFound(const QStringList &folders, bool reportChanged, bool last);
 
 protected:
     bool findFoldersBelow(const QDir &dir, QStringList &fullList);
-    void inotifyRegisterPath(const QString &path);
+    bool inotifyRegisterPath(const QString &path);
+    void walkFolders(const QString &path, bool reportChanged);
+    bool fanotifyStart();
+    QString fanotifyDirectoryPath(const QByteArray &handle);
 
 private:
     FolderWatcher *_parent;
@@ -54,7 +75,16 @@ private:
     QString _folder;
     QHash<int, QString> _watches;
     QScopedPointer<QSocketNotifier> _socket;
-    int _fd;
+    int _fd = -1;
+
+    // The sub folders are listed in a thread and registered in batches
+    QList<QFuture<void>> _walks;
+    QAtomicInt _stopWalks;
+    bool _initialWalkStarted = false;
+
+    int _fanotifyFd = -1;
+    int _fanotifyMountFd = -1; // the folder, to open the directory handles
+    QHash<QByteArray, QString> _fanotifyDirectories; // handle -> path
 };
 }
 
@@ -19,16 +19,37 @@
 
 
 #include <cerrno>
+#include <sys/stat.h>
+#include <QFile>
 #include <QStringList>
 
 
 namespace OCC {
 
-FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path)
+// The event ids are only meaningful with the event database they're from
+static QByteArray eventDatabaseUuid(const QString &path)
+{
+    struct stat st;
+    if (stat(QFile::encodeName(path).constData(), &st) != 0)
+        return QByteArray();
+    CFUUIDRef uuid = FSEventsCopyUUIDForDevice(st.st_dev);
+    if (!uuid)
+        return QByteArray();
+    CFStringRef uuidString = CFUUIDCreateString(NULL, uuid);
+    CFRelease(uuid);
+    char buffer[64];
+    QByteArray result;
+    if (CFStringGetCString(uuidString, buffer, sizeof(buffer), kCFStringEncodingASCII))
+        result = buffer;
+    CFRelease(uuidString);
+    return result;
+}
+
+FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path, const QByteArray &replayCursor)
     : _parent(p)
     , _folder(path)
 {
-    this->startWatching();
+    this->startWatching(replayCursor);
 }
 
 FolderWatcherPrivate::~FolderWatcherPrivate()
@@ -47,8 +68,6 @@ static void callback(
     const FSEventStreamEventId eventIds[])
 {
     Q_UNUSED(streamRef)
-    Q_UNUSED(eventFlags)
-    Q_UNUSED(eventIds)
 
     const FSEventStreamEventFlags c_interestingFlags = kFSEventStreamEventFlagItemCreated // for new folder/file
         | kFSEventStreamEventFlagItemRemoved // for rm
@@ -62,6 +81,9 @@ static void callback(
     QStringList paths;
     CFArrayRef eventPaths = (CFArrayRef)eventPathsVoid;
     for (int i = 0; i < static_cast<int>(numEvents); ++i) {
+        if (eventFlags[i] & kFSEventStreamEventFlagHistoryDone)
+            continue;
+
         CFStringRef path = reinterpret_cast<CFStringRef>(CFArrayGetValueAtIndex(eventPaths, i));
 
         QString qstring;
@@ -78,12 +100,34 @@ static void callback(
         paths.append(fn);
     }
 
-    reinterpret_cast<FolderWatcherPrivate *>(clientCallBackInfo)->doNotifyParent(paths);
+    auto d = reinterpret_cast<FolderWatcherPrivate *>(clientCallBackInfo);
+    if (!paths.isEmpty())
+        d->doNotifyParent(paths);
+    d->eventsReceived(eventFlags, eventIds, numEvents);
 }
 
-void FolderWatcherPrivate::startWatching()
+void FolderWatcherPrivate::startWatching(const QByteArray &replayCursor)
 {
     qCDebug(lcFolderWatcher) << "FolderWatcherPrivate::startWatching()" << _folder;
+
+    // The cursor is "<uuid>:<event id>"
+    _deviceUuid = eventDatabaseUuid(_folder);
+    FSEventStreamEventId sinceWhen = kFSEventStreamEventIdSinceNow;
+    _lastEventId = FSEventsGetCurrentEventId();
+    if (!replayCursor.isEmpty()) {
+        const int colon = replayCursor.lastIndexOf(':');
+        bool ok = false;
+        const FSEventStreamEventId id = replayCursor.mid(colon + 1).toULongLong(&ok);
+        _replaying = true;
+        if (colon > 0 && ok && !_deviceUuid.isEmpty() && replayCursor.left(colon) == _deviceUuid && id <= _lastEventId) {
+            qCInfo(lcFolderWatcher) << "Replaying the changes of" << _folder << "since event" << id;
+            sinceWhen = id;
+            _lastEventId = id;
+        } else {
+            qCInfo(lcFolderWatcher) << "The event database of" << _folder << "changed, can't replay the changes";
+            _replayComplete = false;
+        }
+    }
     CFStringRef folderCF = CFStringCreateWithCharacters(0, reinterpret_cast<const UniChar *>(_folder.unicode()),
         _folder.length());
     CFArrayRef pathsToWatch = CFStringCreateArrayBySeparatingStrings(NULL, folderCF, CFSTR(":"));
@@ -96,13 +140,47 @@ void FolderWatcherPrivate::startWatching()
         &callback,
         &ctx,
         pathsToWatch,
-        kFSEventStreamEventIdSinceNow,
+        sinceWhen,
         0, // latency
         kFSEventStreamCreateFlagUseCFTypes | kFSEventStreamCreateFlagFileEvents | kFSEventStreamCreateFlagIgnoreSelf);
 
     CFRelease(pathsToWatch);
     FSEventStreamScheduleWithRunLoop(_stream, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
     FSEventStreamStart(_stream);
+
+    if (_replaying && sinceWhen == kFSEventStreamEventIdSinceNow) {
+        _replaying = false;
+        QMetaObject::invokeMethod(_parent, "changesReplayed", Qt::QueuedConnection, Q_ARG(bool, false));
+    }
+}
+
+QByteArray FolderWatcherPrivate::cursor() const
+{
+    if (_deviceUuid.isEmpty())
+        return QByteArray();
+    return _deviceUuid + ':' + QByteArray::number(quint64(_lastEventId));
+}
+
+void FolderWatcherPrivate::eventsReceived(const FSEventStreamEventFlags flags[], const FSEventStreamEventId ids[], size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const FSEventStreamEventFlags flag = flags[i];
+        if (flag & (kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagEventIdsWrapped)) {
+            // The history, or the live events, are incomplete
+            if (_replaying)
+                _replayComplete = false;
+        }
+        if (flag & kFSEventStreamEventFlagHistoryDone) {
+            if (_replaying) {
+                _replaying = false;
+                qCInfo(lcFolderWatcher) << "Replayed the changes of" << _folder << "complete:" << _replayComplete;
+                emit _parent->changesReplayed(_replayComplete);
+            }
+            continue;
+        }
+        if (ids[i] > _lastEventId)
+            _lastEventId = ids[i];
+    }
 }
 
 void FolderWatcherPrivate::doNotifyParent(const QStringList &paths)
@@ -30,14 +30,18 @@ namespace OCC {
 class FolderWatcherPrivate
 {
 public:
-    FolderWatcherPrivate(FolderWatcher *p, const QString &path);
+    FolderWatcherPrivate(FolderWatcher *p, const QString &path, const QByteArray &replayCursor);
     ~FolderWatcherPrivate();
 
     void addPath(const QString &) {}
     void removePath(const QString &) {}
 
-    void startWatching();
+    /** The UUID of the event database of the volume and the last event id */
+    QByteArray cursor() const;
+
+    void startWatching(const QByteArray &replayCursor);
     void doNotifyParent(const QStringList &);
+    void eventsReceived(const FSEventStreamEventFlags flags[], const FSEventStreamEventId ids[], size_t count);
 
 private:
     FolderWatcher *_parent;
@@ -45,6 +49,11 @@ private:
     QString _folder;
 
     FSEventStreamRef _stream;
+
+    QByteArray _deviceUuid;
+    FSEventStreamEventId _lastEventId = 0;
+    bool _replaying = false;
+    bool _replayComplete = true;
 };
 }
 
@@ -14,6 +14,7 @@
 
 #include <QThread>
 #include <QDir>
+#include <QVector>
 
 #include "filesystem.h"
 #include "folderwatcher.h"
@@ -22,13 +23,89 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <tchar.h>
+#include <winioctl.h>
 
 namespace OCC {
 
-void WatcherThread::watchChanges(size_t fileNotifyBufferSize,
-    bool *increaseBufferSize)
+// FILE_NOTIFY_EXTENDED_INFORMATION and ReadDirectoryChangesExW are from
+// Windows 10 1709, not in every SDK yet
+struct FileNotifyExtendedInformation
 {
-    *increaseBufferSize = false;
+    DWORD NextEntryOffset;
+    DWORD Action;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastModificationTime;
+    LARGE_INTEGER LastChangeTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER AllocatedLength;
+    LARGE_INTEGER FileSize;
+    DWORD FileAttributes;
+    DWORD ReparsePointTag;
+    LARGE_INTEGER FileId;
+    LARGE_INTEGER ParentFileId;
+    DWORD FileNameLength;
+    WCHAR FileName[1];
+};
+
+static const int ReadDirectoryNotifyExtendedInformationClass = 2;
+
+typedef BOOL(WINAPI *ReadDirectoryChangesExWFunc)(HANDLE, LPVOID, DWORD, BOOL, DWORD, LPDWORD,
+    LPOVERLAPPED, LPOVERLAPPED_COMPLETION_ROUTINE, int);
+
+static ReadDirectoryChangesExWFunc readDirectoryChangesExW()
+{
+    static auto func = reinterpret_cast<ReadDirectoryChangesExWFunc>(
+        GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "ReadDirectoryChangesExW"));
+    return func;
+}
+
+// The volume of the folder, for its USN journal. Opening it needs
+// administrator rights.
+static HANDLE openVolume(const QString &path)
+{
+    wchar_t mountPoint[MAX_PATH];
+    wchar_t volumeName[MAX_PATH];
+    const QString nativePath = QDir::toNativeSeparators(path);
+    if (!GetVolumePathNameW(reinterpret_cast<LPCWSTR>(nativePath.utf16()), mountPoint, MAX_PATH)
+        || !GetVolumeNameForVolumeMountPointW(mountPoint, volumeName, MAX_PATH)) {
+        return INVALID_HANDLE_VALUE;
+    }
+    // "\\?\Volume{...}\", without the last backslash it's the volume itself
+    QString volume = QString::fromWCharArray(volumeName);
+    if (volume.endsWith(QLatin1Char('\\')))
+        volume.chop(1);
+    return CreateFileW(reinterpret_cast<LPCWSTR>(volume.utf16()), GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+}
+
+static bool queryUsnJournal(HANDLE volume, USN_JOURNAL_DATA_V0 *journal)
+{
+    DWORD bytes = 0;
+    return volume != INVALID_HANDLE_VALUE
+        && DeviceIoControl(volume, FSCTL_QUERY_USN_JOURNAL, NULL, 0, journal, sizeof(*journal), &bytes, NULL);
+}
+
+static bool isInFolder(const QString &path, const QString &folder)
+{
+    return path.startsWith(folder, Qt::CaseInsensitive)
+        && (path.size() == folder.size() || path.at(folder.size()) == QLatin1Char('/'));
+}
+
+static const DWORD notifyFilter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE;
+
+bool WatcherThread::readChanges(char *buffer, size_t bufferSize, OVERLAPPED *overlapped)
+{
+    ResetEvent(_resultEvent);
+    if (auto readEx = readDirectoryChangesExW()) {
+        return readEx(_directory, buffer, DWORD(bufferSize), true, notifyFilter, NULL, overlapped, NULL,
+            ReadDirectoryNotifyExtendedInformationClass);
+    }
+    return ReadDirectoryChangesW(_directory, buffer, DWORD(bufferSize), true, notifyFilter, NULL, overlapped, NULL);
+}
+
+void WatcherThread::watchChanges(size_t *fileNotifyBufferSize)
+{
+    const size_t bufferSize = *fileNotifyBufferSize;
     QString longPath = FileSystem::longWinPath(_path);
 
     _directory = CreateFileW(
@@ -47,35 +124,32 @@ void WatcherThread::watchChanges(size_t fileNotifyBufferSize,
         return;
     }
 
-    OVERLAPPED overlapped;
+    OVERLAPPED overlapped = {};
     overlapped.hEvent = _resultEvent;
 
-    // QVarLengthArray ensures the stack-buffer is aligned like double and qint64.
-    QVarLengthArray<char, 4096 * 10> fileNotifyBuffer;
-    fileNotifyBuffer.resize(fileNotifyBufferSize);
-
-    const size_t fileNameBufferSize = 4096;
-    TCHAR fileNameBuffer[fileNameBufferSize];
-
+    // The entries must be DWORD aligned
+    QVector<quint64> buffers[2];
+    buffers[0].resize(int(bufferSize / sizeof(quint64)));
+    buffers[1].resize(int(bufferSize / sizeof(quint64)));
+    int current = 0;
+    const bool extended = readDirectoryChangesExW() != nullptr;
 
+    bool pending = readChanges(reinterpret_cast<char *>(buffers[current].data()), bufferSize, &overlapped);
+    if (pending && !_replayCursor.isEmpty()) {
+        // The live changes are recorded already, nothing falls in between
+        replayChanges();
+    }
     while (!_done) {
-        ResetEvent(_resultEvent);
-
-        FILE_NOTIFY_INFORMATION *pFileNotifyBuffer =
-            (FILE_NOTIFY_INFORMATION *)fileNotifyBuffer.data();
-        DWORD dwBytesReturned = 0;
-        SecureZeroMemory(pFileNotifyBuffer, fileNotifyBufferSize);
-        if (!ReadDirectoryChangesW(_directory, (LPVOID)pFileNotifyBuffer,
-                fileNotifyBufferSize, true,
-                FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE,
-                &dwBytesReturned,
-                &overlapped,
-                NULL)) {
+        if (!pending) {
             DWORD errorCode = GetLastError();
             if (errorCode == ERROR_NOTIFY_ENUM_DIR) {
-                qCDebug(lcFolderWatcher) << "The buffer for changes overflowed! Triggering a generic change and resizing";
+                qCDebug(lcFolderWatcher) << "The buffer for changes overflowed! Triggering a generic change";
+                emit lostChanges();
                 emit changed(_path);
-                *increaseBufferSize = true;
+            } else if (errorCode == ERROR_INVALID_PARAMETER && bufferSize > 64 * 1024) {
+                // Network shares take at most 64 kB
+                qCInfo(lcFolderWatcher) << "Using a smaller notification buffer for" << _path;
+                *fileNotifyBufferSize = 64 * 1024;
             } else {
                 qCWarning(lcFolderWatcher) << "ReadDirectoryChangesW error" << errorCode;
             }
@@ -96,58 +170,215 @@ void WatcherThread::watchChanges(size_t fileNotifyBufferSize,
             break;
         }
 
+        DWORD dwBytesReturned = 0;
         bool ok = GetOverlappedResult(_directory, &overlapped, &dwBytesReturned, false);
         if (!ok) {
             DWORD errorCode = GetLastError();
             if (errorCode == ERROR_NOTIFY_ENUM_DIR) {
-                qCDebug(lcFolderWatcher) << "The buffer for changes overflowed! Triggering a generic change and resizing";
+                qCDebug(lcFolderWatcher) << "The buffer for changes overflowed! Triggering a generic change";
                 emit lostChanges();
                 emit changed(_path);
-                *increaseBufferSize = true;
-            } else {
-                qCWarning(lcFolderWatcher) << "GetOverlappedResult error" << errorCode;
+                pending = readChanges(reinterpret_cast<char *>(buffers[current].data()), bufferSize, &overlapped);
+                continue;
             }
+            qCWarning(lcFolderWatcher) << "GetOverlappedResult error" << errorCode;
             break;
         }
 
-        FILE_NOTIFY_INFORMATION *curEntry = pFileNotifyBuffer;
-        forever {
-            size_t len = curEntry->FileNameLength / 2;
-            QString file = _path + "\\" + QString::fromWCharArray(curEntry->FileName, len);
-
-            // Unless the file was removed or renamed, get its full long name
-            // TODO: We could still try expanding the path in the tricky cases...
-            QString longfile = file;
-            if (curEntry->Action != FILE_ACTION_REMOVED
-                && curEntry->Action != FILE_ACTION_RENAMED_OLD_NAME) {
-                size_t longNameSize = GetLongPathNameW(reinterpret_cast<LPCWSTR>(file.utf16()), fileNameBuffer, fileNameBufferSize);
-                if (longNameSize > 0) {
-                    longfile = QString::fromUtf16(reinterpret_cast<const ushort *>(fileNameBuffer), longNameSize);
-                } else {
-                    qCWarning(lcFolderWatcher) << "Error converting file name to full length, keeping original name.";
-                }
-            }
-            longfile = QDir::cleanPath(longfile);
+        // Wait for the next changes in the other buffer first
+        const char *filled = reinterpret_cast<const char *>(buffers[current].constData());
+        current = 1 - current;
+        pending = readChanges(reinterpret_cast<char *>(buffers[current].data()), bufferSize, &overlapped);
 
-            // Skip modifications of folders: One of these is triggered for changes
-            // and new files in a folder, probably because of the folder's mtime
-            // changing. We don't need them.
-            bool skip = curEntry->Action == FILE_ACTION_MODIFIED
-                && QFileInfo(longfile).isDir();
+        if (dwBytesReturned == 0) {
+            // The changes didn't fit in the buffer of the system
+            qCDebug(lcFolderWatcher) << "The buffer for changes overflowed! Triggering a generic change";
+            emit lostChanges();
+            emit changed(_path);
+            continue;
+        }
+        emit changesReceived(QByteArray(filled, int(dwBytesReturned)), extended);
+    }
 
-            if (!skip) {
-                emit changed(longfile);
-            }
+    CancelIo(_directory);
+    closeHandle();
+}
+
+void WatcherThread::replayChanges()
+{
+    const QByteArray replayCursor = _replayCursor;
+    _replayCursor.clear();
+
+    // The cursor is "<journal id>:<usn>"
+    const int colon = replayCursor.indexOf(':');
+    bool idOk = false;
+    bool usnOk = false;
+    const quint64 journalId = replayCursor.left(colon).toULongLong(&idOk);
+    const qint64 from = replayCursor.mid(colon + 1).toLongLong(&usnOk);
 
-            if (curEntry->NextEntryOffset == 0) {
+    bool complete = false;
+    USN_JOURNAL_DATA_V0 journal;
+    if (!idOk || !usnOk || !queryUsnJournal(_volume, &journal)) {
+        qCInfo(lcFolderWatcher) << "Can't read the USN journal of" << _path;
+    } else if (journal.UsnJournalID != journalId || from < journal.FirstUsn || from > journal.NextUsn) {
+        // Recreated, or the changes since then were dropped
+        qCInfo(lcFolderWatcher) << "The USN journal of" << _path << "doesn't have the changes since" << from;
+    } else {
+        qCInfo(lcFolderWatcher) << "Replaying the changes of" << _path << "since USN" << from;
+        complete = readUsnJournal(journalId, from, journal.NextUsn);
+    }
+    emit changesReplayed(complete);
+}
+
+bool WatcherThread::readUsnJournal(quint64 journalId, qint64 from, qint64 to)
+{
+    READ_USN_JOURNAL_DATA_V0 readData = {};
+    readData.StartUsn = from;
+    readData.ReasonMask = USN_REASON_DATA_OVERWRITE | USN_REASON_DATA_EXTEND | USN_REASON_DATA_TRUNCATION
+        | USN_REASON_FILE_CREATE | USN_REASON_FILE_DELETE | USN_REASON_RENAME_OLD_NAME
+        | USN_REASON_RENAME_NEW_NAME | USN_REASON_BASIC_INFO_CHANGE;
+    readData.UsnJournalID = journalId;
+
+    const QString folder = QDir::cleanPath(_path);
+    QHash<quint64, QString> directories;
+    QStringList paths;
+    QVector<quint64> buffer(64 * 1024 / sizeof(quint64));
+    const DWORD bufferSize = DWORD(buffer.size() * sizeof(quint64));
+
+    while (!_done && readData.StartUsn < to) {
+        DWORD bytes = 0;
+        if (!DeviceIoControl(_volume, FSCTL_READ_USN_JOURNAL, &readData, sizeof(readData),
+                buffer.data(), bufferSize, &bytes, NULL)) {
+            qCWarning(lcFolderWatcher) << "Reading the USN journal failed" << GetLastError();
+            return false;
+        }
+        if (bytes <= sizeof(USN))
+            break;
+
+        // The next USN, then the records
+        const char *data = reinterpret_cast<const char *>(buffer.constData());
+        const char *entry = data + sizeof(USN);
+        const char *end = data + bytes;
+        while (entry < end) {
+            auto record = reinterpret_cast<const USN_RECORD_V2 *>(entry);
+            if (record->RecordLength == 0)
                 break;
+            entry += record->RecordLength;
+            if (record->MajorVersion != 2 || record->Usn >= to)
+                continue;
+            // Deleted since, its own removal is recorded in its parent
+            const QString parent = directoryPath(record->ParentFileReferenceNumber, &directories);
+            if (parent.isEmpty() || !isInFolder(parent, folder))
+                continue;
+            const QString fileName = QString::fromWCharArray(
+                reinterpret_cast<const wchar_t *>(reinterpret_cast<const char *>(record) + record->FileNameOffset),
+                record->FileNameLength / 2);
+            // With the case of the folder path, the rest is the actual case
+            paths.append(folder + parent.mid(folder.size()) + QLatin1Char('/') + fileName);
+        }
+        readData.StartUsn = *reinterpret_cast<const USN *>(data);
+
+        if (paths.size() >= 1000) {
+            emit changed(paths);
+            paths.clear();
+        }
+    }
+    if (!paths.isEmpty())
+        emit changed(paths);
+    return !_done;
+}
+
+QString WatcherThread::directoryPath(quint64 fileReference, QHash<quint64, QString> *cache)
+{
+    auto it = cache->constFind(fileReference);
+    if (it != cache->constEnd())
+        return *it;
+
+    FILE_ID_DESCRIPTOR id = {};
+    id.dwSize = sizeof(id);
+    id.Type = FileIdType;
+    id.FileId.QuadPart = fileReference;
+    HANDLE handle = OpenFileById(_directory, &id, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, FILE_FLAG_BACKUP_SEMANTICS);
+    QString path;
+    if (handle != INVALID_HANDLE_VALUE) {
+        wchar_t buffer[4096];
+        DWORD len = GetFinalPathNameByHandleW(handle, buffer, 4096, FILE_NAME_NORMALIZED);
+        CloseHandle(handle);
+        if (len > 0 && len < 4096) {
+            path = QString::fromWCharArray(buffer, int(len));
+            if (path.startsWith(QLatin1String("\\\\?\\")))
+                path = path.mid(4);
+            path = QDir::cleanPath(path);
+        }
+    }
+    cache->insert(fileReference, path);
+    return path;
+}
+
+void WatcherParser::parse(const QByteArray &buffer, bool extended)
+{
+    const size_t fileNameBufferSize = 4096;
+    TCHAR fileNameBuffer[fileNameBufferSize];
+    QStringList paths;
+
+    // The buffer of a QByteArray is aligned enough for the entries
+    const char *entry = buffer.constData();
+    const char *end = entry + buffer.size();
+    while (entry < end) {
+        DWORD nextEntryOffset, action, fileNameLength, attributes = 0;
+        const WCHAR *fileName;
+        if (extended) {
+            auto info = reinterpret_cast<const FileNotifyExtendedInformation *>(entry);
+            nextEntryOffset = info->NextEntryOffset;
+            action = info->Action;
+            attributes = info->FileAttributes;
+            fileNameLength = info->FileNameLength;
+            fileName = info->FileName;
+        } else {
+            auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(entry);
+            nextEntryOffset = info->NextEntryOffset;
+            action = info->Action;
+            fileNameLength = info->FileNameLength;
+            fileName = info->FileName;
+        }
+
+        QString file = _path + "\\" + QString::fromWCharArray(fileName, fileNameLength / 2);
+
+        // Unless the file was removed or renamed, get its full long name.
+        // Only short names have a tilde.
+        // TODO: We could still try expanding the path in the tricky cases...
+        QString longfile = file;
+        if (action != FILE_ACTION_REMOVED
+            && action != FILE_ACTION_RENAMED_OLD_NAME
+            && file.contains(QLatin1Char('~'))) {
+            size_t longNameSize = GetLongPathNameW(reinterpret_cast<LPCWSTR>(file.utf16()), fileNameBuffer, fileNameBufferSize);
+            if (longNameSize > 0) {
+                longfile = QString::fromUtf16(reinterpret_cast<const ushort *>(fileNameBuffer), longNameSize);
+            } else {
+                qCWarning(lcFolderWatcher) << "Error converting file name to full length, keeping original name.";
             }
-            curEntry = (FILE_NOTIFY_INFORMATION *)((char *)curEntry + curEntry->NextEntryOffset);
         }
+        longfile = QDir::cleanPath(longfile);
+
+        // Skip modifications of folders: One of these is triggered for changes
+        // and new files in a folder, probably because of the folder's mtime
+        // changing. We don't need them.
+        bool skip = action == FILE_ACTION_MODIFIED
+            && (extended ? (attributes & FILE_ATTRIBUTE_DIRECTORY) : QFileInfo(longfile).isDir());
+
+        if (!skip) {
+            paths.append(longfile);
+        }
+
+        if (nextEntryOffset == 0) {
+            break;
+        }
+        entry += nextEntryOffset;
     }
 
-    CancelIo(_directory);
-    closeHandle();
+    if (!paths.isEmpty())
+        emit changed(paths);
 }
 
 void WatcherThread::closeHandle()
@@ -163,18 +394,17 @@ void WatcherThread::run()
     _resultEvent = CreateEvent(NULL, true, false, NULL);
     _stopEvent = CreateEvent(NULL, true, false, NULL);
 
-    // If this buffer fills up before we've extracted its data we will lose
-    // change information. Therefore start big.
-    size_t bufferSize = 4096 * 10;
-    size_t maxBuffer = 64 * 1024;
+    // If the buffer of the system fills up before we've extracted its data
+    // we will lose change information. It gets the size of ours: a bulk
+    // copy of many files needs a big one.
+    size_t bufferSize = 512 * 1024;
 
     while (!_done) {
-        bool increaseBufferSize = false;
-        watchChanges(bufferSize, &increaseBufferSize);
+        const size_t previousBufferSize = bufferSize;
+        watchChanges(&bufferSize);
 
-        if (increaseBufferSize) {
-            bufferSize = qMin(bufferSize * 2, maxBuffer);
-        } else if (!_done) {
+        // Again right away with a smaller buffer
+        if (bufferSize == previousBufferSize && !_done) {
             // Other errors shouldn't actually happen,
             // so sleep a bit to avoid running into the same error case in a
             // tight loop.
@@ -194,14 +424,28 @@ void WatcherThread::stop()
     SetEvent(_stopEvent);
 }
 
-FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path)
+FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path, const QByteArray &replayCursor)
     : _parent(p)
+    , _volume(openVolume(path))
 {
-    _thread = new WatcherThread(path);
+    _parser = new WatcherParser(path);
+    _parser->moveToThread(&_parserThread);
+    _parserThread.setObjectName(QLatin1String("FolderWatcherParser"));
+    connect(_parser, SIGNAL(changed(const QStringList &)),
+        _parent, SLOT(changeDetected(const QStringList &)));
+
+    _thread = new WatcherThread(path, _volume, replayCursor);
     connect(_thread, SIGNAL(changed(const QString &)),
         _parent, SLOT(changeDetected(const QString &)));
+    connect(_thread, SIGNAL(changed(const QStringList &)),
+        _parent, SLOT(changeDetected(const QStringList &)));
+    connect(_thread, SIGNAL(changesReplayed(bool)),
+        _parent, SIGNAL(changesReplayed(bool)));
     connect(_thread, SIGNAL(lostChanges()),
         _parent, SIGNAL(lostChanges()));
+    connect(_thread, SIGNAL(changesReceived(const QByteArray &, bool)),
+        _parser, SLOT(parse(const QByteArray &, bool)));
+    _parserThread.start();
     _thread->start();
 }
 
@@ -210,6 +454,19 @@ FolderWatcherPrivate::~FolderWatcherPrivate()
     _thread->stop();
     _thread->wait();
     delete _thread;
+    _parserThread.quit();
+    _parserThread.wait();
+    delete _parser;
+    if (_volume != INVALID_HANDLE_VALUE)
+        CloseHandle(_volume);
+}
+
+QByteArray FolderWatcherPrivate::cursor() const
+{
+    USN_JOURNAL_DATA_V0 journal;
+    if (!queryUsnJournal(_volume, &journal))
+        return QByteArray();
+    return QByteArray::number(quint64(journal.UsnJournalID)) + ':' + QByteArray::number(qint64(journal.NextUsn));
 }
 
 } // namespace OCC
@@ -17,6 +17,8 @@
 
 #include <QThread>
 #include <QAtomicInt>
+#include <QStringList>
+#include <QHash>
 #include <windows.h>
 
 namespace OCC {
@@ -24,16 +26,24 @@ namespace OCC {
 class FolderWatcher;
 
 /**
- * @brief The WatcherThread class
+ * @brief Waits for the changes of the folder
+ *
+ * There are two notification buffers: once one is filled, the next
+ * ReadDirectoryChanges call goes to the other one before the first is
+ * handed to a WatcherParser. The events that come meanwhile only have
+ * to fit in the buffer of the system, which is as big as ours.
+ *
  * @ingroup gui
  */
 class WatcherThread : public QThread
 {
     Q_OBJECT
 public:
-    WatcherThread(const QString &path)
+    WatcherThread(const QString &path, HANDLE volume, const QByteArray &replayCursor)
         : QThread()
         , _path(path)
+        , _volume(volume)
+        , _replayCursor(replayCursor)
         , _directory(0)
         , _resultEvent(0)
         , _stopEvent(0)
@@ -47,22 +57,58 @@ public:
 
 protected:
     void run();
-    void watchChanges(size_t fileNotifyBufferSize,
-        bool *increaseBufferSize);
+    void watchChanges(size_t *fileNotifyBufferSize);
+    bool readChanges(char *buffer, size_t bufferSize, OVERLAPPED *overlapped);
+    void replayChanges();
+    bool readUsnJournal(quint64 journalId, qint64 from, qint64 to);
+    QString directoryPath(quint64 fileReference, QHash<quint64, QString> *cache);
     void closeHandle();
 
 signals:
     void changed(const QString &path);
+    void changed(const QStringList &paths);
     void lostChanges();
+    /** A filled notification buffer, @a extended for FILE_NOTIFY_EXTENDED_INFORMATION */
+    void changesReceived(const QByteArray &buffer, bool extended);
+    void changesReplayed(bool complete);
 
 private:
     QString _path;
+    HANDLE _volume; // owned by the FolderWatcherPrivate
+    QByteArray _replayCursor;
     HANDLE _directory;
     HANDLE _resultEvent;
     HANDLE _stopEvent;
     QAtomicInt _done;
 };
 
+/**
+ * @brief Turns the notification buffers into paths, in its own thread
+ *
+ * Expanding the short names takes a file system call per event, the
+ * WatcherThread can't wait for that.
+ *
+ * @ingroup gui
+ */
+class WatcherParser : public QObject
+{
+    Q_OBJECT
+public:
+    explicit WatcherParser(const QString &path)
+        : _path(path)
+    {
+    }
+
+public slots:
+    void parse(const QByteArray &buffer, bool extended);
+
+signals:
+    void changed(const QStringList &paths);
+
+private:
+    QString _path;
+};
+
 /**
  * @brief Windows implementation of FolderWatcher
  * @ingroup gui
@@ -71,15 +117,21 @@ class FolderWatcherPrivate : public QObject
 {
     Q_OBJECT
 public:
-    FolderWatcherPrivate(FolderWatcher *p, const QString &path);
+    FolderWatcherPrivate(FolderWatcher *p, const QString &path, const QByteArray &replayCursor);
     ~FolderWatcherPrivate();
 
     void addPath(const QString &) {}
     void removePath(const QString &) {}
 
+    /** The id of the USN journal of the volume and its next USN */
+    QByteArray cursor() const;
+
 private:
     FolderWatcher *_parent;
+    HANDLE _volume;
     WatcherThread *_thread;
+    QThread _parserThread;
+    WatcherParser *_parser;
 };
 }
 
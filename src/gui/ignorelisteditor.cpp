@@ -130,8 +130,9 @@ void IgnoreListEditor::slotUpdateLocalIgnoreList()
     // We need to force a remote discovery after a change of the ignore list.
     // Otherwise we would not download the files/directories that are no longer
     // ignored (because the remote etag did not change)   (issue #3172)
+    // Only the directories that had ignored files can have such files.
     foreach (Folder *folder, folderMan->map()) {
-        folder->journalDb()->forceRemoteDiscoveryNextSync();
+        folder->journalDb()->forceRemoteDiscoveryOfIgnoredFilesNextSync();
         folderMan->scheduleFolder(folder);
     }
 }
@@ -31,6 +31,7 @@
 #include "accountmanager.h"
 #include "common/syncjournalfilerecord.h"
 #include "elidedlabel.h"
+#include "common/utility.h"
 
 
 #include "ui_issueswidget.h"
@@ -47,16 +48,16 @@ IssuesWidget::IssuesWidget(QWidget *parent)
 
     connect(ProgressDispatcher::instance(), &ProgressDispatcher::progressInfo,
         this, &IssuesWidget::slotProgressInfo);
-    connect(ProgressDispatcher::instance(), &ProgressDispatcher::itemCompleted,
-        this, &IssuesWidget::slotItemCompleted);
+    connect(ProgressDispatcher::instance(), &ProgressDispatcher::itemsCompleted,
+        this, &IssuesWidget::slotItemsCompleted);
     connect(ProgressDispatcher::instance(), &ProgressDispatcher::syncError,
         this, &IssuesWidget::addError);
 
-    connect(_ui->_treeWidget, &QTreeWidget::itemActivated, this, &IssuesWidget::slotOpenFile);
+    connect(_ui->_treeWidget, &QTreeView::activated, this, &IssuesWidget::slotOpenFile);
     connect(_ui->copyIssuesButton, &QAbstractButton::clicked, this, &IssuesWidget::copyToClipboard);
 
     _ui->_treeWidget->setContextMenuPolicy(Qt::CustomContextMenu);
-    connect(_ui->_treeWidget, &QTreeWidget::customContextMenuRequested, this, &IssuesWidget::slotItemContextMenu);
+    connect(_ui->_treeWidget, &QTreeView::customContextMenuRequested, this, &IssuesWidget::slotItemContextMenu);
 
     connect(_ui->showIgnores, &QAbstractButton::toggled, this, &IssuesWidget::slotRefreshIssues);
     connect(_ui->showWarnings, &QAbstractButton::toggled, this, &IssuesWidget::slotRefreshIssues);
@@ -86,14 +87,21 @@ IssuesWidget::IssuesWidget(QWidget *parent)
     timestampColumnExtra = 20; // font metrics are broken on Windows, see #4721
 #endif
 
-    _ui->_treeWidget->setHeaderLabels(header);
+    // The issue list is a state, it is not limited
+    _model = new ProtocolItemModel(header, 0, this);
+    _proxy = new ProtocolSortFilterProxyModel(_model, this);
+    _proxy->setFilter([this](const ProtocolItem &item) {
+        return shouldBeVisible(item, currentAccountFilter(), currentFolderFilter());
+    });
+    _ui->_treeWidget->setModel(_proxy);
+    _ui->_treeWidget->sortByColumn(0, Qt::DescendingOrder);
+    connect(_model, &ProtocolItemModel::itemCountChanged, this, &IssuesWidget::issueCountUpdated);
     int timestampColumnWidth =
         ActivityItemDelegate::rowHeight() // icon
         + _ui->_treeWidget->fontMetrics().width(ProtocolItem::timeString(QDateTime::currentDateTime()))
         + timestampColumnExtra;
     _ui->_treeWidget->setColumnWidth(0, timestampColumnWidth);
     _ui->_treeWidget->setColumnWidth(1, 180);
-    _ui->_treeWidget->setColumnCount(4);
     _ui->_treeWidget->setRootIsDecorated(false);
     _ui->_treeWidget->setTextElideMode(Qt::ElideMiddle);
     _ui->_treeWidget->header()->setObjectName("ActivityErrorListHeader");
@@ -133,54 +141,18 @@ void IssuesWidget::hideEvent(QHideEvent *ev)
 
 void IssuesWidget::cleanItems(const QString &folder)
 {
-    _ui->_treeWidget->setSortingEnabled(false);
-
     // The issue list is a state, clear it and let the next sync fill it
     // with ignored files and propagation errors.
-    int itemCnt = _ui->_treeWidget->topLevelItemCount();
-    for (int cnt = itemCnt - 1; cnt >= 0; cnt--) {
-        QTreeWidgetItem *item = _ui->_treeWidget->topLevelItem(cnt);
-        QString itemFolder = item->data(2, Qt::UserRole).toString();
-        if (itemFolder == folder) {
-            delete item;
-        }
-    }
-
-    _ui->_treeWidget->setSortingEnabled(true);
-
-    // update the tabtext
-    emit(issueCountUpdated(_ui->_treeWidget->topLevelItemCount()));
-}
-
-void IssuesWidget::addItem(QTreeWidgetItem *item)
-{
-    if (!item)
-        return;
-
-    int insertLoc = 0;
-
-    // Insert item specific errors behind the others
-    if (!item->text(1).isEmpty()) {
-        for (int i = 0; i < _ui->_treeWidget->topLevelItemCount(); ++i) {
-            if (_ui->_treeWidget->topLevelItem(i)->text(1).isEmpty()) {
-                insertLoc = i + 1;
-            } else {
-                break;
-            }
-        }
-    }
-
-    _ui->_treeWidget->insertTopLevelItem(insertLoc, item);
-    item->setHidden(!shouldBeVisible(item, currentAccountFilter(), currentFolderFilter()));
-    emit issueCountUpdated(_ui->_treeWidget->topLevelItemCount());
+    // This updates the tabtext too.
+    _model->removeFolder(folder);
 }
 
-void IssuesWidget::slotOpenFile(QTreeWidgetItem *item, int)
+void IssuesWidget::slotOpenFile(const QModelIndex &index)
 {
-    QString folderName = item->data(2, Qt::UserRole).toString();
-    QString fileName = item->text(1);
+    const ProtocolItem &item = _proxy->item(index);
+    QString fileName = Utility::fileNameForGuiUse(item.originalFile);
 
-    Folder *folder = FolderMan::instance()->folder(folderName);
+    Folder *folder = item.folderPtr();
     if (folder) {
         // folder->path() always comes back with trailing path
         QString fullPath = folder->path() + fileName;
@@ -198,28 +170,23 @@ void IssuesWidget::slotProgressInfo(const QString &folder, const ProgressInfo &p
     }
 }
 
-void IssuesWidget::slotItemCompleted(const QString &folder, const SyncFileItemPtr &item)
+void IssuesWidget::slotItemsCompleted(const QString &folder, const SyncFileItemVector &items)
 {
-    if (!item->hasErrorStatus())
-        return;
-    QTreeWidgetItem *line = ProtocolItem::create(folder, *item);
-    if (!line)
+    if (!FolderMan::instance()->folder(folder))
         return;
-    addItem(line);
+    for (const auto &item : items) {
+        if (!item->hasErrorStatus())
+            continue;
+        _model->addItem(ProtocolItem::create(folder, *item));
+    }
 }
 
 void IssuesWidget::slotRefreshIssues()
 {
-    auto tree = _ui->_treeWidget;
-    auto filterFolderAlias = currentFolderFilter();
-    auto filterAccount = currentAccountFilter();
+    _proxy->refilter();
+    addErrorWidgets();
 
-    for (int i = 0; i < tree->topLevelItemCount(); ++i) {
-        auto item = tree->topLevelItem(i);
-        item->setHidden(!shouldBeVisible(item, filterAccount, filterFolderAlias));
-    }
-
-    _ui->_treeWidget->setColumnHidden(2, !filterFolderAlias.isEmpty());
+    _ui->_treeWidget->setColumnHidden(2, !currentFolderFilter().isEmpty());
 }
 
 void IssuesWidget::slotAccountAdded(AccountState *account)
@@ -239,11 +206,11 @@ void IssuesWidget::slotAccountRemoved(AccountState *account)
 
 void IssuesWidget::slotItemContextMenu(const QPoint &pos)
 {
-    auto item = _ui->_treeWidget->itemAt(pos);
-    if (!item)
+    auto index = _ui->_treeWidget->indexAt(pos);
+    if (!index.isValid())
         return;
     auto globalPos = _ui->_treeWidget->viewport()->mapToGlobal(pos);
-    ProtocolItem::openContextMenu(globalPos, item, this);
+    ProtocolItem::openContextMenu(globalPos, _proxy->item(index), this);
 }
 
 void IssuesWidget::updateAccountChoiceVisibility()
@@ -264,17 +231,17 @@ QString IssuesWidget::currentFolderFilter() const
     return _ui->filterFolder->currentData().toString();
 }
 
-bool IssuesWidget::shouldBeVisible(QTreeWidgetItem *item, AccountState *filterAccount,
+bool IssuesWidget::shouldBeVisible(const ProtocolItem &item, AccountState *filterAccount,
     const QString &filterFolderAlias) const
 {
     bool visible = true;
-    auto status = item->data(3, Qt::UserRole);
+    auto status = item.status;
     visible &= (_ui->showIgnores->isChecked() || status != SyncFileItem::FileIgnored);
     visible &= (_ui->showWarnings->isChecked()
         || (status != SyncFileItem::SoftError
                && status != SyncFileItem::Restoration));
 
-    auto folderalias = item->data(2, Qt::UserRole).toString();
+    const auto &folderalias = item.folder;
     if (filterAccount) {
         auto folder = FolderMan::instance()->folder(folderalias);
         visible &= folder && folder->accountState() == filterAccount;
@@ -330,34 +297,33 @@ void IssuesWidget::slotUpdateFolderFilters()
 
 void IssuesWidget::storeSyncIssues(QTextStream &ts)
 {
-    int topLevelItems = _ui->_treeWidget->topLevelItemCount();
+    _model->flush();
+    const int rows = _proxy->rowCount();
 
-    for (int i = 0; i < topLevelItems; i++) {
-        QTreeWidgetItem *child = _ui->_treeWidget->topLevelItem(i);
-        if (child->isHidden())
-            continue;
+    for (int i = 0; i < rows; i++) {
+        auto data = [this, i](int column) { return _proxy->index(i, column).data().toString(); };
         ts << right
            // time stamp
            << qSetFieldWidth(20)
-           << child->data(0, Qt::DisplayRole).toString()
+           << data(0)
            // separator
            << qSetFieldWidth(0) << ","
 
            // file name
            << qSetFieldWidth(64)
-           << child->data(1, Qt::DisplayRole).toString()
+           << data(1)
            // separator
            << qSetFieldWidth(0) << ","
 
            // folder
            << qSetFieldWidth(30)
-           << child->data(2, Qt::DisplayRole).toString()
+           << data(2)
            // separator
            << qSetFieldWidth(0) << ","
 
            // action
            << qSetFieldWidth(15)
-           << child->data(3, Qt::DisplayRole).toString()
+           << data(3)
            << qSetFieldWidth(0)
            << endl;
     }
@@ -384,32 +350,35 @@ void IssuesWidget::addError(const QString &folderAlias, const QString &message,
     if (!folder)
         return;
 
-    QStringList columns;
-    QDateTime timestamp = QDateTime::currentDateTime();
-    const QString timeStr = ProtocolItem::timeString(timestamp);
-    const QString longTimeStr = ProtocolItem::timeString(timestamp, QLocale::LongFormat);
-
-    columns << timeStr;
-    columns << ""; // no "File" entry
-    columns << folder->shortGuiLocalPath();
-    columns << message;
-
-    QIcon icon = Theme::instance()->syncStateIcon(SyncResult::Error);
-
-    QTreeWidgetItem *twitem = new ProtocolItem(columns);
-    twitem->setData(0, Qt::SizeHintRole, QSize(0, ActivityItemDelegate::rowHeight()));
-    twitem->setData(0, Qt::UserRole, timestamp);
-    twitem->setIcon(0, icon);
-    twitem->setToolTip(0, longTimeStr);
-    twitem->setData(2, Qt::UserRole, folderAlias);
-    twitem->setToolTip(3, message);
-    twitem->setData(3, Qt::UserRole, SyncFileItem::NormalError);
-
-    addItem(twitem);
-    addErrorWidget(twitem, message, category);
+    ProtocolItem line;
+    line.timestamp = QDateTime::currentMSecsSinceEpoch();
+    line.folder = folderAlias;
+    // no "File" entry
+    line.errorString = message;
+    line.status = SyncFileItem::NormalError;
+    line.category = category;
+    _model->addItem(line);
+
+    if (category != ErrorCategory::Normal) {
+        // The widget goes on the row, so it has to exist now
+        _model->flush();
+        addErrorWidgets();
+    }
 }
 
-void IssuesWidget::addErrorWidget(QTreeWidgetItem *item, const QString &message, ErrorCategory category)
+void IssuesWidget::addErrorWidgets()
+{
+    // The view drops the widgets of the rows the filter hides
+    for (int i = 0; i < _proxy->rowCount(); ++i) {
+        auto index = _proxy->index(i, ProtocolItemModel::ActionColumn);
+        const ProtocolItem &item = _proxy->item(index);
+        if (item.category == ErrorCategory::Normal || _ui->_treeWidget->indexWidget(index))
+            continue;
+        addErrorWidget(index, item.errorString, item.category);
+    }
+}
+
+void IssuesWidget::addErrorWidget(const QModelIndex &index, const QString &message, ErrorCategory category)
 {
     QWidget *widget = 0;
     if (category == ErrorCategory::InsufficientRemoteStorage) {
@@ -423,16 +392,14 @@ void IssuesWidget::addErrorWidget(QTreeWidgetItem *item, const QString &message,
 
         auto button = new QPushButton("Retry all uploads", widget);
         button->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Expanding);
-        auto folderAlias = item->data(2, Qt::UserRole).toString();
+        auto folderAlias = _proxy->item(index).folder;
         connect(button, &QPushButton::clicked,
             this, [this, folderAlias]() { retryInsufficentRemoteStorageErrors(folderAlias); });
         layout->addWidget(button);
     }
 
-    if (widget) {
-        item->setText(3, QString());
-    }
-    _ui->_treeWidget->setItemWidget(item, 3, widget);
+    // The model shows no text under the widget
+    _ui->_treeWidget->setIndexWidget(index, widget);
 }
 
 void IssuesWidget::retryInsufficentRemoteStorageErrors(const QString &folderAlias)
@@ -442,7 +409,8 @@ void IssuesWidget::retryInsufficentRemoteStorageErrors(const QString &folderAlia
     if (!folder)
         return;
 
-    folder->journalDb()->wipeErrorBlacklistCategory(SyncJournalErrorBlacklistRecord::InsufficientRemoteStorage);
-    folderman->scheduleFolderNext(folder);
+    folder->journalDb()->runAsync(folder,
+        [](SyncJournalDb *journal) { journal->wipeErrorBlacklistCategory(SyncJournalErrorBlacklistRecord::InsufficientRemoteStorage); },
+        [folderman, folder] { folderman->scheduleFolderNext(folder); });
 }
 }
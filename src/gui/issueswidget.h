@@ -21,6 +21,7 @@
 
 #include "progressdispatcher.h"
 #include "owncloudgui.h"
+#include "protocolitemmodel.h"
 
 #include "ui_issueswidget.h"
 
@@ -52,8 +53,8 @@ public:
 public slots:
     void addError(const QString &folderAlias, const QString &message, ErrorCategory category);
     void slotProgressInfo(const QString &folder, const ProgressInfo &progress);
-    void slotItemCompleted(const QString &folder, const SyncFileItemPtr &item);
-    void slotOpenFile(QTreeWidgetItem *item, int);
+    void slotItemsCompleted(const QString &folder, const SyncFileItemVector &items);
+    void slotOpenFile(const QModelIndex &index);
 
 protected:
     void showEvent(QShowEvent *);
@@ -74,18 +75,20 @@ private:
     void updateAccountChoiceVisibility();
     AccountState *currentAccountFilter() const;
     QString currentFolderFilter() const;
-    bool shouldBeVisible(QTreeWidgetItem *item, AccountState *filterAccount,
+    bool shouldBeVisible(const ProtocolItem &item, AccountState *filterAccount,
         const QString &filterFolderAlias) const;
     void cleanItems(const QString &folder);
-    void addItem(QTreeWidgetItem *item);
 
-    /// Add the special error widget for the category, if any
-    void addErrorWidget(QTreeWidgetItem *item, const QString &message, ErrorCategory category);
+    /// Add the special error widgets for the categories, where they are missing
+    void addErrorWidgets();
+    void addErrorWidget(const QModelIndex &index, const QString &message, ErrorCategory category);
 
     /// Wipes all insufficient remote storgage blacklist entries
     void retryInsufficentRemoteStorageErrors(const QString &folderAlias);
 
     Ui::IssuesWidget *_ui;
+    ProtocolItemModel *_model;
+    ProtocolSortFilterProxyModel *_proxy;
 };
 }
 
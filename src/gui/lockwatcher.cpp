@@ -23,26 +23,73 @@ using namespace OCC;
 Q_LOGGING_CATEGORY(lcLockWatcher, "gui.lockwatcher", QtInfoMsg)
 
 static const int check_frequency = 20 * 1000; // ms
+// The regular checks slow down to this while the files stay locked
+static const int max_check_interval = 5 * 60 * 1000; // ms
+// Changes come in bursts, and the lock is released around the change
+static const int changed_directory_delay = 500; // ms
 
 LockWatcher::LockWatcher(QObject *parent)
     : QObject(parent)
 {
     connect(&_timer, &QTimer::timeout,
         this, &LockWatcher::checkFiles);
-    _timer.start(check_frequency);
+    _changedDirectoriesTimer.setSingleShot(true);
+    _changedDirectoriesTimer.setInterval(changed_directory_delay);
+    connect(&_changedDirectoriesTimer, &QTimer::timeout,
+        this, &LockWatcher::checkChangedDirectories);
 }
 
 void LockWatcher::addFile(const QString &path)
 {
     qCInfo(lcLockWatcher) << "Watching for lock of" << path << "being released";
     _watchedPaths.insert(path);
+    // Adding more files doesn't postpone the next check
+    if (!_timer.isActive())
+        _timer.start(check_frequency);
+}
+
+static QString parentPath(const QString &path)
+{
+    return path.left(path.lastIndexOf(QLatin1Char('/')));
+}
+
+void LockWatcher::checkFilesNear(const QString &path)
+{
+    if (_watchedPaths.isEmpty())
+        return;
+    // A change of the directory itself, or of a file in it
+    _changedDirectories.insert(path);
+    _changedDirectories.insert(parentPath(path));
+    if (!_changedDirectoriesTimer.isActive())
+        _changedDirectoriesTimer.start();
+}
+
+void LockWatcher::checkChangedDirectories()
+{
+    QSet<QString> paths;
+    foreach (const QString &path, _watchedPaths) {
+        if (_changedDirectories.contains(path) || _changedDirectories.contains(parentPath(path)))
+            paths.insert(path);
+    }
+    _changedDirectories.clear();
+    checkPaths(paths);
 }
 
 void LockWatcher::checkFiles()
+{
+    checkPaths(_watchedPaths);
+
+    // Every check opens the files, don't keep doing that every few seconds
+    // for documents that stay open for hours
+    if (!_watchedPaths.isEmpty())
+        _timer.start(qMin(_timer.interval() * 2, max_check_interval));
+}
+
+void LockWatcher::checkPaths(const QSet<QString> &paths)
 {
     QSet<QString> unlocked;
 
-    foreach (const QString &path, _watchedPaths) {
+    foreach (const QString &path, paths) {
         if (!FileSystem::isFileLocked(path)) {
             qCInfo(lcLockWatcher) << "Lock of" << path << "was released";
             emit fileUnlocked(path);
@@ -54,4 +101,6 @@ void LockWatcher::checkFiles()
     // ensures that calling back into addFile from connected
     // slots isn't a problem.
     _watchedPaths.subtract(unlocked);
+    if (_watchedPaths.isEmpty())
+        _timer.stop();
 }
@@ -32,8 +32,10 @@ namespace OCC {
  * client will be unable to update them while they are locked.
  *
  * In this situation we do want to start a sync run as soon as the file
- * becomes available again. To do that, we need to regularly check whether
- * the file is still being locked.
+ * becomes available again. The files are checked when the folder watcher
+ * reports a change next to them: Office removes its ~$ owner file when it
+ * closes the document. In case nothing is reported, they are also checked
+ * regularly, less often the longer they stay locked.
  *
  * @ingroup gui
  */
@@ -51,6 +53,9 @@ public:
      */
     void addFile(const QString &path);
 
+    /** Checks the watched files next to @a path soon */
+    void checkFilesNear(const QString &path);
+
 signals:
     /** Emitted when one of the watched files is no longer
      *  being locked. */
@@ -58,9 +63,15 @@ signals:
 
 private slots:
     void checkFiles();
+    void checkChangedDirectories();
 
 private:
     QSet<QString> _watchedPaths;
     QTimer _timer;
+    /// The directories checkFilesNear() was called for
+    QSet<QString> _changedDirectories;
+    QTimer _changedDirectoriesTimer;
+
+    void checkPaths(const QSet<QString> &paths);
 };
 }
@@ -110,6 +110,13 @@ LogBrowser::LogBrowser(QWidget *parent)
     btnbox->addButton(_saveBtn, QDialogButtonBox::ActionRole);
     connect(_saveBtn, &QAbstractButton::clicked, this, &LogBrowser::slotSave);
 
+    // save recent debug messages Button
+    _saveRecentBtn = new QPushButton;
+    _saveRecentBtn->setText(tr("Save &recent messages"));
+    _saveRecentBtn->setToolTip(tr("Save the most recent messages to a file on disk."));
+    btnbox->addButton(_saveRecentBtn, QDialogButtonBox::ActionRole);
+    connect(_saveRecentBtn, &QAbstractButton::clicked, this, &LogBrowser::slotSaveRecent);
+
     setLayout(mainLayout);
 
     setModal(false);
@@ -211,6 +218,18 @@ void LogBrowser::slotSave()
     _saveBtn->setEnabled(true);
 }
 
+void LogBrowser::slotSaveRecent()
+{
+    _saveRecentBtn->setEnabled(false);
+
+    QString saveFile = QFileDialog::getSaveFileName(this, tr("Save recent messages"), QDir::homePath());
+
+    if (!saveFile.isEmpty() && !Logger::instance()->dumpLogRecorder(saveFile)) {
+        QMessageBox::critical(this, tr("Error"), tr("Could not write to log file %1").arg(saveFile));
+    }
+    _saveRecentBtn->setEnabled(true);
+}
+
 void LogBrowser::slotClearLog()
 {
     _logWidget->clear();
@@ -65,6 +65,7 @@ protected slots:
     void slotDebugCheckStateChanged(int);
     void search(const QString &);
     void slotSave();
+    void slotSaveRecent();
     void slotClearLog();
 
 private:
@@ -72,6 +73,7 @@ private:
     QLineEdit *_findTermEdit;
     QCheckBox *_logDebugCheckBox;
     QPushButton *_saveBtn;
+    QPushButton *_saveRecentBtn;
     QPushButton *_clearBtn;
     QLabel *_statusLabel;
 };
@@ -47,20 +47,20 @@ namespace OCC {
 
 const char propertyAccountC[] = "oc_account";
 
+// After startup, see createSettingsDialog()
+static const int SettingsDialogDelayMs = 3 * 1000;
+// Batches the requests of updateContextMenuNeeded()
+static const int TrayUpdateDelayMs = 500;
+// After a sync run, once the folders had a chance to report their results
+static const int SyncStatusDelayMs = 2 * 1000;
+
 ownCloudGui::ownCloudGui(Application *parent)
     : QObject(parent)
     , _tray(0)
-    ,
-#if defined(Q_OS_MAC)
-    _settingsDialog(new SettingsDialogMac(this))
-    ,
-#else
-    _settingsDialog(new SettingsDialog(this))
-    ,
-#endif
-    _logBrowser(0)
+    , _logBrowser(0)
     , _contextMenuVisibleOsx(false)
     , _recentActionsMenu(0)
+    , _recentActionsMenuDirty(true)
     , _qdbusmenuWorkaround(false)
     , _app(parent)
 {
@@ -78,6 +78,21 @@ ownCloudGui::ownCloudGui(Application *parent)
 
     _tray->show();
 
+    // Its account and folder pages take a while with many of them. The
+    // tray is usable before, but the notifications are fetched by the
+    // activity page.
+    QTimer::singleShot(SettingsDialogDelayMs, this, &ownCloudGui::createSettingsDialog);
+
+    _delayedTrayUpdateTimer.setInterval(TrayUpdateDelayMs);
+    _delayedTrayUpdateTimer.setSingleShot(true);
+    connect(&_delayedTrayUpdateTimer, &QTimer::timeout, this, &ownCloudGui::slotDelayedTrayUpdate);
+
+    // One computation for all the folders that finished around the same time
+    _delayedSyncStatusTimer.setInterval(SyncStatusDelayMs);
+    _delayedSyncStatusTimer.setSingleShot(true);
+    _delayedSyncStatusTimer.setTimerType(Qt::VeryCoarseTimer);
+    connect(&_delayedSyncStatusTimer, &QTimer::timeout, this, &ownCloudGui::slotComputeOverallSyncStatus);
+
     ProgressDispatcher *pd = ProgressDispatcher::instance();
     connect(pd, &ProgressDispatcher::progressInfo, this,
         &ownCloudGui::slotUpdateProgress);
@@ -169,7 +184,7 @@ void ownCloudGui::slotSyncStateChange(Folder *folder)
         Logger::instance()->enterNextLogFile();
     }
 
-    if (result.status() == SyncResult::NotYetStarted) {
+    if (result.status() == SyncResult::NotYetStarted && _settingsDialog) {
         _settingsDialog->slotRefreshActivity(folder->accountState());
     }
 }
@@ -504,12 +519,42 @@ void ownCloudGui::setupContextMenu()
     updateContextMenu();
 }
 
+QString ownCloudGui::contextMenuState() const
+{
+    // Everything updateContextMenu() looks at, the sync results only show
+    // in _actionStatus
+    const auto accounts = AccountManager::instance()->accounts();
+    QString state = QString::number(accounts.size()) + QLatin1Char('\n');
+    foreach (const auto &a, accounts) {
+        state += a->account()->displayName();
+        state += QLatin1Char(a->isConnected() ? 'c' : '-');
+        state += QLatin1Char(a->isSignedOut() ? 'o' : '-');
+        state += QLatin1Char('\n');
+    }
+    foreach (auto f, FolderMan::instance()->map()) {
+        state += QString::number(reinterpret_cast<quintptr>(f->accountState()), 16);
+        state += f->alias();
+        state += f->shortGuiLocalPath();
+        state += QLatin1Char(f->syncPaused() ? 'p' : '-');
+        state += QLatin1Char('\n');
+    }
+    return state;
+}
+
 void ownCloudGui::updateContextMenu()
 {
     if (minimalTrayMenu()) {
         return;
     }
 
+    // Most calls come from sync state changes, which don't change the menu
+    const QString state = contextMenuState();
+    if (state == _contextMenuState && !(_qdbusmenuWorkaround && _recentActionsMenuDirty)) {
+        if (_recentActionsMenuDirty)
+            slotRebuildRecentMenus();
+        return;
+    }
+
     if (_qdbusmenuWorkaround) {
         // To make tray menu updates work with these bugs (see setupContextMenu)
         // we need to hide and show the tray icon. We don't want to do that
@@ -523,6 +568,7 @@ void ownCloudGui::updateContextMenu()
         _tray->hide();
     }
 
+    _contextMenuState = state;
     _contextMenu->clear();
     slotRebuildRecentMenus();
 
@@ -647,6 +693,13 @@ void ownCloudGui::updateContextMenuNeeded()
         return;
     }
 
+    // A sync of many folders or accounts reconnecting ask many times in a row
+    if (!_delayedTrayUpdateTimer.isActive())
+        _delayedTrayUpdateTimer.start();
+}
+
+void ownCloudGui::slotDelayedTrayUpdate()
+{
 #ifdef Q_OS_MAC
     // https://bugreports.qt.io/browse/QTBUG-54845
     // We cannot update on demand or while visible -> update when invisible.
@@ -734,6 +787,7 @@ void ownCloudGui::setupActions()
 
 void ownCloudGui::slotRebuildRecentMenus()
 {
+    _recentActionsMenuDirty = false;
     _recentActionsMenu->clear();
     if (!_recentItemsActions.isEmpty()) {
         foreach (QAction *a, _recentItemsActions) {
@@ -767,7 +821,8 @@ void ownCloudGui::slotUpdateProgress(const QString &folder, const ProgressInfo &
                                        .arg(progress._currentDiscoveredFolder));
         }
     } else if (progress.status() == ProgressInfo::Done) {
-        QTimer::singleShot(2000, this, &ownCloudGui::slotComputeOverallSyncStatus);
+        if (!_delayedSyncStatusTimer.isActive())
+            _delayedSyncStatusTimer.start();
     }
     if (progress.status() != ProgressInfo::Propagation) {
         return;
@@ -828,6 +883,7 @@ void ownCloudGui::slotUpdateProgress(const QString &folder, const ProgressInfo &
             _recentItemsActions.takeFirst()->deleteLater();
         }
         _recentItemsActions.append(action);
+        _recentActionsMenuDirty = true;
 
         // Update the "Recent" menu if the context menu is being shown,
         // otherwise it'll be updated later, when the context menu is opened.
@@ -891,9 +947,6 @@ void ownCloudGui::setPauseOnAllFoldersHelper(bool pause)
     foreach (Folder *f, FolderMan::instance()->map()) {
         if (accounts.contains(f->accountState())) {
             f->setSyncPaused(pause);
-            if (pause) {
-                f->slotTerminateSync();
-            }
         }
     }
 }
@@ -909,16 +962,25 @@ void ownCloudGui::slotShowGuiMessage(const QString &title, const QString &messag
     msgBox->open();
 }
 
-void ownCloudGui::slotShowSettings()
+void ownCloudGui::createSettingsDialog()
 {
-    if (_settingsDialog.isNull()) {
-        _settingsDialog =
+    if (!_settingsDialog.isNull())
+        return;
+    QElapsedTimer timer;
+    timer.start();
+    _settingsDialog =
 #if defined(Q_OS_MAC)
-            new SettingsDialogMac(this);
+        new SettingsDialogMac(this);
 #else
-            new SettingsDialog(this);
+        new SettingsDialog(this);
 #endif
-        _settingsDialog->setAttribute(Qt::WA_DeleteOnClose, true);
+    qCInfo(lcApplication) << "Created the settings dialog in" << timer.elapsed() << "msec";
+}
+
+void ownCloudGui::slotShowSettings()
+{
+    if (_settingsDialog.isNull()) {
+        createSettingsDialog();
         _settingsDialog->show();
     }
     raiseDialog(_settingsDialog.data());
@@ -1017,7 +1079,8 @@ void ownCloudGui::slotShowShareDialog(const QString &sharePath, const QString &l
     }
 
     // For https://github.com/owncloud/client/issues/3783
-    _settingsDialog->hide();
+    if (_settingsDialog)
+        _settingsDialog->hide();
 
     const auto accountState = folder->accountState();
 
@@ -98,6 +98,9 @@ public slots:
     void slotRemoveDestroyedShareDialogs();
 
 private slots:
+    void slotDelayedTrayUpdate();
+    /// Created a while after the start, or when it is first shown
+    void createSettingsDialog();
     void slotLogin();
     void slotLogout();
     void slotUnpauseAllFolders();
@@ -108,6 +111,8 @@ private:
     void setPauseOnAllFoldersHelper(bool pause);
     void setupActions();
     void addAccountContextMenu(AccountStatePtr accountState, QMenu *menu, bool separateMenu);
+    /// What the tray menu was built from, see updateContextMenu()
+    QString contextMenuState() const;
 
     QPointer<Systray> _tray;
 #if defined(Q_OS_MAC)
@@ -124,9 +129,13 @@ private:
     bool _contextMenuVisibleOsx;
 
     QMenu *_recentActionsMenu;
+    bool _recentActionsMenuDirty;
+    QString _contextMenuState;
     QVector<QMenu *> _accountMenus;
     bool _qdbusmenuWorkaround;
     QTimer _workaroundBatchTrayUpdate;
+    QTimer _delayedTrayUpdateTimer;
+    QTimer _delayedSyncStatusTimer;
     QMap<QString, QPointer<ShareDialog>> _shareDialogs;
 
     QAction *_actionLogin;
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "protocolitemmodel.h"
+#include "accountstate.h"
+#include "activityitemdelegate.h"
+#include "folder.h"
+#include "folderman.h"
+#include "guiutility.h"
+#include "networkjobs.h"
+#include "protocolwidget.h"
+#include "syncresult.h"
+#include "theme.h"
+#include "common/utility.h"
+
+#include <QIcon>
+#include <QMenu>
+#include <QRegExp>
+
+#include <algorithm>
+#include <iterator>
+
+namespace OCC {
+
+// The new lines of this long are inserted together
+static const int FlushIntervalMs = 100;
+
+QString ProtocolItem::timeString(QDateTime dt, QLocale::FormatType format)
+{
+    const QLocale loc = QLocale::system();
+    QString dtFormat = loc.dateTimeFormat(format);
+    static const QRegExp re("(HH|H|hh|h):mm(?!:s)");
+    dtFormat.replace(re, "\\1:mm:ss");
+    return loc.toString(dt, dtFormat);
+}
+
+ProtocolItem ProtocolItem::create(const QString &folder, const SyncFileItem &item)
+{
+    ProtocolItem line;
+    line.timestamp = QDateTime::currentMSecsSinceEpoch();
+    line.folder = folder;
+    line.file = item._file;
+    line.originalFile = item._originalFile;
+    line.renameTarget = item._renameTarget;
+    line.errorString = item._errorString;
+    line.size = item._size;
+    line.instruction = item._instruction;
+    line.direction = item._direction;
+    line.status = item._status;
+    line.sizeDependent = ProgressInfo::isSizeDependent(item);
+    return line;
+}
+
+QString ProtocolItem::message() const
+{
+    // If the error string is set, it's prefered because it is a useful user message.
+    if (!errorString.isEmpty())
+        return errorString;
+    SyncFileItem item;
+    item._instruction = instruction;
+    item._direction = direction;
+    item._renameTarget = renameTarget;
+    return Progress::asResultString(item);
+}
+
+Folder *ProtocolItem::folderPtr() const
+{
+    return FolderMan::instance()->folder(folder);
+}
+
+static void showContextMenu(QPoint globalPos, const SyncJournalFileRecord &rec, const AccountPtr &account, QWidget *parent)
+{
+    // rec might not be valid
+    auto menu = new QMenu(parent);
+
+    if (rec.isValid()) {
+        // "Open in Browser" action
+        auto openInBrowser = menu->addAction(ProtocolWidget::tr("Open in browser"));
+        QObject::connect(openInBrowser, &QAction::triggered, parent, [parent, account, rec]() {
+            fetchPrivateLinkUrl(account, rec._path, rec.numericFileId(), parent,
+                [parent](const QString &url) {
+                    Utility::openBrowser(url, parent);
+                });
+        });
+    }
+
+    // More actions will be conditionally added to the context menu here later
+
+    if (menu->actions().isEmpty()) {
+        delete menu;
+        return;
+    }
+
+    menu->setAttribute(Qt::WA_DeleteOnClose);
+    menu->popup(globalPos);
+}
+
+void ProtocolItem::openContextMenu(QPoint globalPos, const ProtocolItem &item, QWidget *parent)
+{
+    auto f = item.folderPtr();
+    if (!f)
+        return;
+    AccountPtr account = f->accountState()->account();
+    // Shows the menu once the record is read, the sync may hold the journal
+    f->journalDb()->getFileRecordAsync(item.file.toUtf8(), parent, [globalPos, parent, account](const SyncJournalFileRecord &rec) {
+        showContextMenu(globalPos, rec, account, parent);
+    });
+}
+
+ProtocolItemModel::ProtocolItemModel(const QStringList &headers, int maxRows, QObject *parent)
+    : QAbstractTableModel(parent)
+    , _headers(headers)
+    , _maxRows(maxRows)
+{
+    _flushTimer.setSingleShot(true);
+    _flushTimer.setInterval(FlushIntervalMs);
+    connect(&_flushTimer, &QTimer::timeout, this, &ProtocolItemModel::flush);
+}
+
+int ProtocolItemModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : static_cast<int>(_items.size());
+}
+
+int ProtocolItemModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : _headers.size();
+}
+
+QVariant ProtocolItemModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation == Qt::Horizontal && role == Qt::DisplayRole && section < _headers.size())
+        return _headers.at(section);
+    return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+QVariant ProtocolItemModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rowCount())
+        return QVariant();
+    const ProtocolItem &item = _items[index.row()];
+
+    switch (role) {
+    case Qt::DisplayRole:
+        switch (index.column()) {
+        case TimeColumn:
+            return ProtocolItem::timeString(QDateTime::fromMSecsSinceEpoch(item.timestamp));
+        case FileColumn:
+            return Utility::fileNameForGuiUse(item.originalFile);
+        case FolderColumn:
+            if (auto f = item.folderPtr())
+                return f->shortGuiLocalPath();
+            return QString();
+        case ActionColumn:
+            // The issues list shows a widget with the message and a button for these
+            if (item.category == ErrorCategory::InsufficientRemoteStorage)
+                return QString();
+            return item.message();
+        case SizeColumn:
+            if (item.sizeDependent)
+                return Utility::octetsToString(item.size);
+            return QString();
+        }
+        break;
+    case Qt::ToolTipRole:
+        switch (index.column()) {
+        case TimeColumn:
+            return ProtocolItem::timeString(QDateTime::fromMSecsSinceEpoch(item.timestamp), QLocale::LongFormat);
+        case FileColumn:
+            return item.file;
+        case ActionColumn:
+            return item.message();
+        }
+        break;
+    case Qt::DecorationRole:
+        if (index.column() == TimeColumn) {
+            if (item.status == SyncFileItem::NormalError
+                || item.status == SyncFileItem::FatalError
+                || item.status == SyncFileItem::DetailError
+                || item.status == SyncFileItem::BlacklistedError) {
+                return Theme::instance()->syncStateIcon(SyncResult::Error);
+            } else if (Progress::isWarningKind(item.status)) {
+                return Theme::instance()->syncStateIcon(SyncResult::Problem);
+            }
+        }
+        break;
+    case Qt::SizeHintRole:
+        if (index.column() == TimeColumn)
+            return QSize(0, ActivityItemDelegate::rowHeight());
+        break;
+    case SortRole:
+        if (index.column() == TimeColumn) {
+            // Items with empty "File" column are larger than others
+            return item.timestamp + (item.originalFile.isEmpty() ? Q_INT64_C(1) << 62 : 0);
+        }
+        return data(index, Qt::DisplayRole);
+    }
+    return QVariant();
+}
+
+void ProtocolItemModel::addItem(const ProtocolItem &item)
+{
+    _pending.push_back(item);
+    if (!_flushTimer.isActive())
+        _flushTimer.start();
+}
+
+void ProtocolItemModel::flush()
+{
+    _flushTimer.stop();
+    if (_pending.empty())
+        return;
+
+    if (_maxRows > 0 && _pending.size() > size_t(_maxRows))
+        _pending.erase(_pending.begin(), _pending.end() - _maxRows);
+    const int incoming = static_cast<int>(_pending.size());
+
+    // Like a ring buffer, the oldest lines make room for the new ones
+    if (_maxRows > 0 && rowCount() + incoming > _maxRows) {
+        const int drop = rowCount() + incoming - _maxRows;
+        beginRemoveRows(QModelIndex(), 0, drop - 1);
+        _items.erase(_items.begin(), _items.begin() + drop);
+        endRemoveRows();
+    }
+
+    const int first = rowCount();
+    beginInsertRows(QModelIndex(), first, first + incoming - 1);
+    std::move(_pending.begin(), _pending.end(), std::back_inserter(_items));
+    _pending.clear();
+    endInsertRows();
+
+    emit itemCountChanged(itemCount());
+}
+
+void ProtocolItemModel::removeFolder(const QString &folder)
+{
+    _pending.erase(std::remove_if(_pending.begin(), _pending.end(),
+                       [&folder](const ProtocolItem &item) { return item.folder == folder; }),
+        _pending.end());
+
+    // One removal per run of lines, the others keep their index widgets
+    int row = rowCount() - 1;
+    while (row >= 0) {
+        if (_items[row].folder != folder) {
+            --row;
+            continue;
+        }
+        const int last = row;
+        while (row > 0 && _items[row - 1].folder == folder)
+            --row;
+        beginRemoveRows(QModelIndex(), row, last);
+        _items.erase(_items.begin() + row, _items.begin() + last + 1);
+        endRemoveRows();
+        --row;
+    }
+
+    emit itemCountChanged(itemCount());
+}
+
+ProtocolSortFilterProxyModel::ProtocolSortFilterProxyModel(ProtocolItemModel *model, QObject *parent)
+    : QSortFilterProxyModel(parent)
+    , _model(model)
+{
+    setSourceModel(model);
+    setSortRole(ProtocolItemModel::SortRole);
+}
+
+void ProtocolSortFilterProxyModel::setFilter(const Filter &filter)
+{
+    _filter = filter;
+    invalidateFilter();
+}
+
+const ProtocolItem &ProtocolSortFilterProxyModel::item(const QModelIndex &index) const
+{
+    return _model->item(mapToSource(index).row());
+}
+
+bool ProtocolSortFilterProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex &) const
+{
+    return !_filter || _filter(_model->item(sourceRow));
+}
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef PROTOCOLITEMMODEL_H
+#define PROTOCOLITEMMODEL_H
+
+#include <QAbstractTableModel>
+#include <QDateTime>
+#include <QLocale>
+#include <QPoint>
+#include <QSortFilterProxyModel>
+#include <QTimer>
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "progressdispatcher.h"
+#include "syncfileitem.h"
+#include "common/syncjournalfilerecord.h"
+
+class QWidget;
+
+namespace OCC {
+
+class Folder;
+
+/**
+ * @brief One line of the protocol and the issues list
+ *
+ * Only what is needed to show it, the strings are made in
+ * ProtocolItemModel::data() for the lines that are on screen.
+ */
+struct ProtocolItem
+{
+    // Shared with IssueWidget
+    static ProtocolItem create(const QString &folder, const SyncFileItem &item);
+    static QString timeString(QDateTime dt, QLocale::FormatType format = QLocale::NarrowFormat);
+
+    Folder *folderPtr() const;
+    QString message() const;
+
+    static void openContextMenu(QPoint globalPos, const ProtocolItem &item, QWidget *parent);
+
+    qint64 timestamp = 0; // msecs since the epoch
+    QString folder; // the alias
+    QString file;
+    QString originalFile;
+    QString renameTarget;
+    QString errorString;
+    quint64 size = 0;
+    csync_instructions_e instruction = CSYNC_INSTRUCTION_NONE;
+    SyncFileItem::Direction direction = SyncFileItem::None;
+    SyncFileItem::Status status = SyncFileItem::NoStatus;
+    ErrorCategory category = ErrorCategory::Normal;
+    bool sizeDependent = false;
+};
+
+/**
+ * @brief The lines of the protocol or the issues list, for a QTreeView
+ *
+ * New lines are collected and inserted together a moment later, a sync
+ * completes many items per second. With a maximum the oldest lines are
+ * dropped as new ones come in.
+ *
+ * @ingroup gui
+ */
+class ProtocolItemModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    enum Column {
+        TimeColumn,
+        FileColumn,
+        FolderColumn,
+        ActionColumn,
+        SizeColumn,
+    };
+    enum Role {
+        // Time: global entries first, then by time
+        SortRole = Qt::UserRole + 1,
+    };
+
+    /** @a maxRows is 0 for no limit; the columns are the ones of @a headers */
+    ProtocolItemModel(const QStringList &headers, int maxRows, QObject *parent = 0);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
+    QVariant data(const QModelIndex &index, int role) const Q_DECL_OVERRIDE;
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const Q_DECL_OVERRIDE;
+
+    const ProtocolItem &item(int row) const { return _items[row]; }
+
+    /** Adds the line with the next batch */
+    void addItem(const ProtocolItem &item);
+    /** Inserts the lines that are waiting */
+    void flush();
+    /** Removes the lines of @a folder */
+    void removeFolder(const QString &folder);
+
+    /** The lines that are shown or will be shortly */
+    int itemCount() const { return static_cast<int>(_items.size() + _pending.size()); }
+
+signals:
+    void itemCountChanged(int count);
+
+private:
+    QStringList _headers;
+    int _maxRows;
+    std::deque<ProtocolItem> _items;
+    std::vector<ProtocolItem> _pending;
+    QTimer _flushTimer;
+};
+
+/**
+ * @brief Sorts the lines of a ProtocolItemModel and hides those the filter rejects
+ * @ingroup gui
+ */
+class ProtocolSortFilterProxyModel : public QSortFilterProxyModel
+{
+    Q_OBJECT
+public:
+    explicit ProtocolSortFilterProxyModel(ProtocolItemModel *model, QObject *parent = 0);
+
+    using Filter = std::function<bool(const ProtocolItem &)>;
+    void setFilter(const Filter &filter);
+    /** Evaluates the filter again for all lines */
+    void refilter() { invalidateFilter(); }
+
+    const ProtocolItem &item(const QModelIndex &index) const;
+    ProtocolItemModel *protocolModel() const { return _model; }
+
+protected:
+    bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const Q_DECL_OVERRIDE;
+
+private:
+    ProtocolItemModel *_model;
+    Filter _filter;
+};
+}
+
+#endif // PROTOCOLITEMMODEL_H
@@ -27,6 +27,7 @@
 #include "activityitemdelegate.h"
 #include "guiutility.h"
 #include "accountstate.h"
+#include "common/utility.h"
 
 #include "ui_protocolwidget.h"
 
@@ -34,140 +35,19 @@
 
 namespace OCC {
 
-QString ProtocolItem::timeString(QDateTime dt, QLocale::FormatType format)
-{
-    const QLocale loc = QLocale::system();
-    QString dtFormat = loc.dateTimeFormat(format);
-    static const QRegExp re("(HH|H|hh|h):mm(?!:s)");
-    dtFormat.replace(re, "\\1:mm:ss");
-    return loc.toString(dt, dtFormat);
-}
-
-ProtocolItem *ProtocolItem::create(const QString &folder, const SyncFileItem &item)
-{
-    auto f = FolderMan::instance()->folder(folder);
-    if (!f) {
-        return 0;
-    }
-
-    QStringList columns;
-    QDateTime timestamp = QDateTime::currentDateTime();
-    const QString timeStr = timeString(timestamp);
-    const QString longTimeStr = timeString(timestamp, QLocale::LongFormat);
-
-    columns << timeStr;
-    columns << Utility::fileNameForGuiUse(item._originalFile);
-    columns << f->shortGuiLocalPath();
-
-    // If the error string is set, it's prefered because it is a useful user message.
-    QString message = item._errorString;
-    if (message.isEmpty()) {
-        message = Progress::asResultString(item);
-    }
-    columns << message;
-
-    QIcon icon;
-    if (item._status == SyncFileItem::NormalError
-        || item._status == SyncFileItem::FatalError
-        || item._status == SyncFileItem::DetailError
-        || item._status == SyncFileItem::BlacklistedError) {
-        icon = Theme::instance()->syncStateIcon(SyncResult::Error);
-    } else if (Progress::isWarningKind(item._status)) {
-        icon = Theme::instance()->syncStateIcon(SyncResult::Problem);
-    }
-
-    if (ProgressInfo::isSizeDependent(item)) {
-        columns << Utility::octetsToString(item._size);
-    }
-
-    ProtocolItem *twitem = new ProtocolItem(columns);
-    // Warning: The data and tooltips on the columns define an implicit
-    // interface and can only be changed with care.
-    twitem->setData(0, Qt::SizeHintRole, QSize(0, ActivityItemDelegate::rowHeight()));
-    twitem->setData(0, Qt::UserRole, timestamp);
-    twitem->setIcon(0, icon);
-    twitem->setToolTip(0, longTimeStr);
-    twitem->setToolTip(1, item._file);
-    twitem->setData(2, Qt::UserRole, folder);
-    twitem->setToolTip(3, message);
-    twitem->setData(3, Qt::UserRole, item._status);
-    return twitem;
-}
-
-SyncJournalFileRecord ProtocolItem::syncJournalRecord(QTreeWidgetItem *item)
-{
-    SyncJournalFileRecord rec;
-    auto f = folder(item);
-    if (!f)
-        return rec;
-    f->journalDb()->getFileRecord(item->toolTip(1), &rec);
-    return rec;
-}
-
-Folder *ProtocolItem::folder(QTreeWidgetItem *item)
-{
-    return FolderMan::instance()->folder(item->data(2, Qt::UserRole).toString());
-}
-
-void ProtocolItem::openContextMenu(QPoint globalPos, QTreeWidgetItem *item, QWidget *parent)
-{
-    auto f = ProtocolItem::folder(item);
-    if (!f)
-        return;
-    AccountPtr account = f->accountState()->account();
-    auto rec = ProtocolItem::syncJournalRecord(item);
-    // rec might not be valid
-
-    auto menu = new QMenu(parent);
-
-    if (rec.isValid()) {
-        // "Open in Browser" action
-        auto openInBrowser = menu->addAction(ProtocolWidget::tr("Open in browser"));
-        QObject::connect(openInBrowser, &QAction::triggered, parent, [parent, account, rec]() {
-            fetchPrivateLinkUrl(account, rec._path, rec.numericFileId(), parent,
-                [parent](const QString &url) {
-                    Utility::openBrowser(url, parent);
-                });
-        });
-    }
-
-    // More actions will be conditionally added to the context menu here later
-
-    if (menu->actions().isEmpty()) {
-        delete menu;
-        return;
-    }
-
-    menu->setAttribute(Qt::WA_DeleteOnClose);
-    menu->popup(globalPos);
-}
-
-bool ProtocolItem::operator<(const QTreeWidgetItem &other) const
-{
-    int column = treeWidget()->sortColumn();
-    if (column != 0) {
-        return QTreeWidgetItem::operator<(other);
-    }
-
-    // Items with empty "File" column are larger than others,
-    // otherwise sort by time (this uses lexicographic ordering)
-    return std::forward_as_tuple(text(1).isEmpty(), data(0, Qt::UserRole).toDateTime())
-        < std::forward_as_tuple(other.text(1).isEmpty(), other.data(0, Qt::UserRole).toDateTime());
-}
-
 ProtocolWidget::ProtocolWidget(QWidget *parent)
     : QWidget(parent)
     , _ui(new Ui::ProtocolWidget)
 {
     _ui->setupUi(this);
 
-    connect(ProgressDispatcher::instance(), &ProgressDispatcher::itemCompleted,
-        this, &ProtocolWidget::slotItemCompleted);
+    connect(ProgressDispatcher::instance(), &ProgressDispatcher::itemsCompleted,
+        this, &ProtocolWidget::slotItemsCompleted);
 
-    connect(_ui->_treeWidget, &QTreeWidget::itemActivated, this, &ProtocolWidget::slotOpenFile);
+    connect(_ui->_treeWidget, &QTreeView::activated, this, &ProtocolWidget::slotOpenFile);
 
     _ui->_treeWidget->setContextMenuPolicy(Qt::CustomContextMenu);
-    connect(_ui->_treeWidget, &QTreeWidget::customContextMenuRequested, this, &ProtocolWidget::slotItemContextMenu);
+    connect(_ui->_treeWidget, &QTreeView::customContextMenuRequested, this, &ProtocolWidget::slotItemContextMenu);
 
     // Adjust copyToClipboard() when making changes here!
     QStringList header;
@@ -182,13 +62,16 @@ ProtocolWidget::ProtocolWidget(QWidget *parent)
     timestampColumnExtra = 20; // font metrics are broken on Windows, see #4721
 #endif
 
-    _ui->_treeWidget->setHeaderLabels(header);
+    // Limit the number of items
+    _model = new ProtocolItemModel(header, 2000, this);
+    _proxy = new ProtocolSortFilterProxyModel(_model, this);
+    _ui->_treeWidget->setModel(_proxy);
+    _ui->_treeWidget->sortByColumn(0, Qt::DescendingOrder);
     int timestampColumnWidth =
         _ui->_treeWidget->fontMetrics().width(ProtocolItem::timeString(QDateTime::currentDateTime()))
         + timestampColumnExtra;
     _ui->_treeWidget->setColumnWidth(0, timestampColumnWidth);
     _ui->_treeWidget->setColumnWidth(1, 180);
-    _ui->_treeWidget->setColumnCount(5);
     _ui->_treeWidget->setRootIsDecorated(false);
     _ui->_treeWidget->setTextElideMode(Qt::ElideMiddle);
     _ui->_treeWidget->header()->setObjectName("ActivityListHeader");
@@ -234,19 +117,19 @@ void ProtocolWidget::hideEvent(QHideEvent *ev)
 
 void ProtocolWidget::slotItemContextMenu(const QPoint &pos)
 {
-    auto item = _ui->_treeWidget->itemAt(pos);
-    if (!item)
+    auto index = _ui->_treeWidget->indexAt(pos);
+    if (!index.isValid())
         return;
     auto globalPos = _ui->_treeWidget->viewport()->mapToGlobal(pos);
-    ProtocolItem::openContextMenu(globalPos, item, this);
+    ProtocolItem::openContextMenu(globalPos, _proxy->item(index), this);
 }
 
-void ProtocolWidget::slotOpenFile(QTreeWidgetItem *item, int)
+void ProtocolWidget::slotOpenFile(const QModelIndex &index)
 {
-    QString folderName = item->data(2, Qt::UserRole).toString();
-    QString fileName = item->text(1);
+    const ProtocolItem &item = _proxy->item(index);
+    QString fileName = Utility::fileNameForGuiUse(item.originalFile);
 
-    Folder *folder = FolderMan::instance()->folder(folderName);
+    Folder *folder = item.folderPtr();
     if (folder) {
         // folder->path() always comes back with trailing path
         QString fullPath = folder->path() + fileName;
@@ -256,56 +139,52 @@ void ProtocolWidget::slotOpenFile(QTreeWidgetItem *item, int)
     }
 }
 
-void ProtocolWidget::slotItemCompleted(const QString &folder, const SyncFileItemPtr &item)
+void ProtocolWidget::slotItemsCompleted(const QString &folder, const SyncFileItemVector &items)
 {
-    if (item->hasErrorStatus())
+    if (!FolderMan::instance()->folder(folder))
         return;
-    QTreeWidgetItem *line = ProtocolItem::create(folder, *item);
-    if (line) {
-        // Limit the number of items
-        int itemCnt = _ui->_treeWidget->topLevelItemCount();
-        while (itemCnt > 2000) {
-            delete _ui->_treeWidget->takeTopLevelItem(itemCnt - 1);
-            itemCnt--;
-        }
-        _ui->_treeWidget->insertTopLevelItem(0, line);
+    for (const auto &item : items) {
+        if (item->hasErrorStatus())
+            continue;
+        _model->addItem(ProtocolItem::create(folder, *item));
     }
 }
 
 void ProtocolWidget::storeSyncActivity(QTextStream &ts)
 {
-    int topLevelItems = _ui->_treeWidget->topLevelItemCount();
+    _model->flush();
+    const int rows = _proxy->rowCount();
 
-    for (int i = 0; i < topLevelItems; i++) {
-        QTreeWidgetItem *child = _ui->_treeWidget->topLevelItem(i);
+    for (int i = 0; i < rows; i++) {
+        auto data = [this, i](int column) { return _proxy->index(i, column).data().toString(); };
         ts << right
            // time stamp
            << qSetFieldWidth(20)
-           << child->data(0, Qt::DisplayRole).toString()
+           << data(0)
            // separator
            << qSetFieldWidth(0) << ","
 
            // file name
            << qSetFieldWidth(64)
-           << child->data(1, Qt::DisplayRole).toString()
+           << data(1)
            // separator
            << qSetFieldWidth(0) << ","
 
            // folder
            << qSetFieldWidth(30)
-           << child->data(2, Qt::DisplayRole).toString()
+           << data(2)
            // separator
            << qSetFieldWidth(0) << ","
 
            // action
            << qSetFieldWidth(15)
-           << child->data(3, Qt::DisplayRole).toString()
+           << data(3)
            // separator
            << qSetFieldWidth(0) << ","
 
            // size
            << qSetFieldWidth(10)
-           << child->data(4, Qt::DisplayRole).toString()
+           << data(4)
            << qSetFieldWidth(0)
            << endl;
     }
@@ -21,6 +21,7 @@
 
 #include "progressdispatcher.h"
 #include "owncloudgui.h"
+#include "protocolitemmodel.h"
 
 #include "ui_protocolwidget.h"
 
@@ -34,30 +35,6 @@ namespace Ui {
 }
 class Application;
 
-/**
- * The items used in the protocol and issue QTreeWidget
- *
- * Special sorting: It allows items for global entries to be moved to the top if the
- * sorting section is the "Time" column.
- */
-class ProtocolItem : public QTreeWidgetItem
-{
-public:
-    using QTreeWidgetItem::QTreeWidgetItem;
-
-    // Shared with IssueWidget
-    static ProtocolItem *create(const QString &folder, const SyncFileItem &item);
-    static QString timeString(QDateTime dt, QLocale::FormatType format = QLocale::NarrowFormat);
-
-    static SyncJournalFileRecord syncJournalRecord(QTreeWidgetItem *item);
-    static Folder *folder(QTreeWidgetItem *item);
-
-    static void openContextMenu(QPoint globalPos, QTreeWidgetItem *item, QWidget *parent);
-
-private:
-    bool operator<(const QTreeWidgetItem &other) const override;
-};
-
 /**
  * @brief The ProtocolWidget class
  * @ingroup gui
@@ -73,8 +50,8 @@ public:
     void storeSyncActivity(QTextStream &ts);
 
 public slots:
-    void slotItemCompleted(const QString &folder, const SyncFileItemPtr &item);
-    void slotOpenFile(QTreeWidgetItem *item, int);
+    void slotItemsCompleted(const QString &folder, const SyncFileItemVector &items);
+    void slotOpenFile(const QModelIndex &index);
 
 protected:
     void showEvent(QShowEvent *);
@@ -88,6 +65,8 @@ signals:
 
 private:
     Ui::ProtocolWidget *_ui;
+    ProtocolItemModel *_model;
+    ProtocolSortFilterProxyModel *_proxy;
 };
 }
 #endif // PROTOCOLWIDGET_H
@@ -20,6 +20,7 @@
 #include "creds/abstractcredentials.h"
 #include <theme.h>
 
+#include <QDir>
 #include <QTimer>
 
 namespace OCC {
@@ -27,6 +28,11 @@ namespace OCC {
 namespace {
     static const int defaultIntervalT = 30 * 1000;
     static const int failIntervalT = 5 * 1000;
+
+    QString normalizedRemotePath(const QString &path)
+    {
+        return QDir::cleanPath(QLatin1Char('/') + path);
+    }
 }
 
 QuotaInfo::QuotaInfo(AccountState *accountState, QObject *parent)
@@ -38,8 +44,11 @@ QuotaInfo::QuotaInfo(AccountState *accountState, QObject *parent)
 {
     connect(accountState, &AccountState::stateChanged,
         this, &QuotaInfo::slotAccountStateChanged);
+    connect(accountState, &AccountState::quotaReported,
+        this, &QuotaInfo::slotQuotaReported);
     connect(&_jobRestartTimer, &QTimer::timeout, this, &QuotaInfo::slotCheckQuota);
     _jobRestartTimer.setSingleShot(true);
+    _jobRestartTimer.setTimerType(Qt::VeryCoarseTimer);
 }
 
 void QuotaInfo::setActive(bool active)
@@ -110,10 +119,28 @@ void QuotaInfo::slotUpdateLastQuota(const QVariantMap &result)
 {
     // The server can return fractional bytes (#1374)
     // <d:quota-available-bytes>1374532061.2</d:quota-available-bytes>
-    qint64 avail = result["quota-available-bytes"].toDouble();
-    _lastQuotaUsedBytes = result["quota-used-bytes"].toDouble();
+    updateQuota(result["quota-used-bytes"].toDouble(), result["quota-available-bytes"].toDouble());
+}
+
+void QuotaInfo::slotQuotaReported(const QString &remotePath, qint64 usedBytes, qint64 availableBytes)
+{
+    if (normalizedRemotePath(remotePath) != normalizedRemotePath(quotaBaseFolder()))
+        return;
+    // A sync just listed the folder, the request can wait
+    if (_job) {
+        _job->deleteLater();
+        _job.clear();
+    }
+    updateQuota(usedBytes, availableBytes);
+    if (!canGetQuota())
+        _jobRestartTimer.stop();
+}
+
+void QuotaInfo::updateQuota(qint64 usedBytes, qint64 availableBytes)
+{
+    _lastQuotaUsedBytes = usedBytes;
     // negative value of the available quota have special meaning (#3940)
-    _lastQuotaTotalBytes = avail >= 0 ? _lastQuotaUsedBytes + avail : avail;
+    _lastQuotaTotalBytes = availableBytes >= 0 ? _lastQuotaUsedBytes + availableBytes : availableBytes;
     emit quotaUpdated(_lastQuotaTotalBytes, _lastQuotaUsedBytes);
     _jobRestartTimer.start(defaultIntervalT);
     _lastQuotaRecieved = QDateTime::currentDateTime();
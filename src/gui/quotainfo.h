@@ -41,6 +41,10 @@ class PropfindJob;
  *
  * If the quota job is not finished within 30 seconds, it is cancelled and another one is started
  *
+ * The syncs of a folder for the quotaBaseFolder() get the quota with the listing of its root,
+ * see AccountState::quotaReported(). It is taken from there and the request is only sent when
+ * no such sync ran in the last 30 seconds.
+ *
  * @ingroup gui
  */
 class QuotaInfo : public QObject
@@ -66,12 +70,14 @@ private Q_SLOTS:
     void slotUpdateLastQuota(const QVariantMap &);
     void slotAccountStateChanged();
     void slotRequestFailed();
+    void slotQuotaReported(const QString &remotePath, qint64 usedBytes, qint64 availableBytes);
 
 Q_SIGNALS:
     void quotaUpdated(qint64 total, qint64 used);
 
 private:
     bool canGetQuota() const;
+    void updateQuota(qint64 usedBytes, qint64 availableBytes);
 
     /// Returns the folder that quota shall be retrieved for
     QString quotaBaseFolder() const;
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "remotechangenotifier.h"
+#include "accountstate.h"
+#include "account.h"
+#include "capabilities.h"
+#include "networkjobs.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcRemoteChangeNotifier, "gui.remotechangenotifier", QtInfoMsg)
+
+static const char activityPath[] = "ocs/v2.php/apps/activity/api/v2/activity/all";
+
+// More activities than this since the last poll are reported as "/"
+static const int activityPageSize = 100;
+
+static const int pollInterval = 30 * 1000;
+
+// The first retry after an error, doubled up to the maximum
+static const int minRetryDelay = 30 * 1000;
+static const int maxRetryDelay = 10 * 60 * 1000;
+
+RemoteChangeNotifier::RemoteChangeNotifier(AccountState *accountState)
+    : QObject(accountState)
+    , _accountState(accountState)
+{
+    _pollTimer.setSingleShot(true);
+    connect(&_pollTimer, &QTimer::timeout, this, &RemoteChangeNotifier::slotPoll);
+    connect(accountState, &AccountState::isConnectedChanged, this, &RemoteChangeNotifier::slotAccountStateChanged);
+}
+
+RemoteChangeNotifier::~RemoteChangeNotifier()
+{
+    stop();
+}
+
+void RemoteChangeNotifier::slotAccountStateChanged()
+{
+    if (_accountState->isConnected()) {
+        // Right away, the changes while it was disconnected are reported
+        // if the last activity is known
+        _failures = 0;
+        slotPoll();
+    } else {
+        stop();
+    }
+}
+
+void RemoteChangeNotifier::stop()
+{
+    _pollTimer.stop();
+    if (_job) {
+        disconnect(_job.data(), nullptr, this, nullptr);
+        if (_job->reply())
+            _job->reply()->abort();
+    }
+    _job.clear();
+    _active = false;
+}
+
+void RemoteChangeNotifier::slotPoll()
+{
+    if (_job || !_accountState->isConnected())
+        return;
+    AccountPtr account = _accountState->account();
+    if (!account->capabilities().activityApiAvailable()) {
+        _active = false;
+        return;
+    }
+
+    QList<QPair<QString, QString>> params;
+    if (_lastActivityId >= 0) {
+        params << qMakePair(QStringLiteral("since"), QString::number(_lastActivityId))
+               << qMakePair(QStringLiteral("sort"), QStringLiteral("asc"))
+               << qMakePair(QStringLiteral("limit"), QString::number(activityPageSize));
+    } else {
+        // Only the newest one, to start from
+        params << qMakePair(QStringLiteral("limit"), QStringLiteral("1"));
+    }
+
+    _job = new JsonApiJob(account, QLatin1String(activityPath), this);
+    _job->addQueryParams(params);
+    connect(_job.data(), &JsonApiJob::jsonReceived, this, &RemoteChangeNotifier::slotActivitiesReceived);
+    connect(_job.data(), &JsonApiJob::notModified, this, &RemoteChangeNotifier::slotNoNewActivities);
+    _job->start();
+}
+
+void RemoteChangeNotifier::slotActivitiesReceived(const QJsonDocument &json, int statusCode)
+{
+    _job.clear();
+    if (statusCode != 100 && statusCode != 200) {
+        qCWarning(lcRemoteChangeNotifier) << "Could not get the activities, status" << statusCode;
+        retryLater();
+        return;
+    }
+
+    const QJsonArray activities = json.object().value(QLatin1String("ocs")).toObject().value(QLatin1String("data")).toArray();
+    qint64 lastActivityId = _lastActivityId;
+    QStringList paths;
+    foreach (const auto &value, activities) {
+        const QJsonObject activity = value.toObject();
+        lastActivityId = qMax(lastActivityId, qint64(activity.value(QLatin1String("activity_id")).toDouble()));
+        if (activity.value(QLatin1String("object_type")).toString() != QLatin1String("files"))
+            continue;
+        // A move has the source and the target
+        const QJsonObject objects = activity.value(QLatin1String("objects")).toObject();
+        foreach (const auto &object, objects) {
+            if (!paths.contains(object.toString()))
+                paths.append(object.toString());
+        }
+        const QString name = activity.value(QLatin1String("object_name")).toString();
+        if (objects.isEmpty() && !name.isEmpty() && !paths.contains(name))
+            paths.append(name);
+    }
+
+    const bool first = _lastActivityId < 0;
+    _lastActivityId = qMax<qint64>(lastActivityId, 0);
+    if (first) {
+        // The folders sync when the account connects anyway
+        paths.clear();
+    } else if (activities.size() >= activityPageSize) {
+        // There are more, don't page through them
+        paths = QStringList(QStringLiteral("/"));
+    }
+
+    if (!_active)
+        qCInfo(lcRemoteChangeNotifier) << "Following the activities of" << _accountState->account()->displayName();
+    _active = true;
+    _failures = 0;
+    if (!paths.isEmpty()) {
+        qCInfo(lcRemoteChangeNotifier) << "Changes on the server:" << paths;
+        emit remoteChanged(paths);
+    }
+    pollLater();
+}
+
+void RemoteChangeNotifier::slotNoNewActivities()
+{
+    _job.clear();
+    // Also the answer to the first poll when there is no activity at all
+    _lastActivityId = qMax<qint64>(_lastActivityId, 0);
+    _active = true;
+    _failures = 0;
+    pollLater();
+}
+
+void RemoteChangeNotifier::pollLater()
+{
+    _pollTimer.start(pollInterval);
+}
+
+void RemoteChangeNotifier::retryLater()
+{
+    // The etag polling takes over meanwhile
+    _active = false;
+    const qint64 delay = qMin<qint64>(qint64(minRetryDelay) << qMin(_failures, 10), maxRetryDelay);
+    ++_failures;
+    _pollTimer.start(int(delay));
+}
+}
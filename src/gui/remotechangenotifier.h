@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef REMOTECHANGENOTIFIER_H
+#define REMOTECHANGENOTIFIER_H
+
+#include <QObject>
+#include <QPointer>
+#include <QStringList>
+#include <QTimer>
+
+class QJsonDocument;
+
+namespace OCC {
+
+class AccountState;
+class JsonApiJob;
+
+/**
+ * @brief Finds out from the activity stream of the server which paths of an account changed
+ *
+ * While the account is connected and its server has the activity app, see
+ * Capabilities::activityApiAvailable(), the activities after the last one
+ * seen are asked for once right after connecting and then every 30
+ * seconds. That is one request per account instead of one etag request per
+ * folder. The first answer only tells which activity was the last one.
+ *
+ * After errors it waits longer and longer before it tries again, and
+ * isActive() is false until a request succeeds: the etag polling of the
+ * FolderMan only slows down while it's true.
+ *
+ * @ingroup gui
+ */
+class RemoteChangeNotifier : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RemoteChangeNotifier(AccountState *accountState);
+    ~RemoteChangeNotifier();
+
+    /** Whether the server notifies the changes right now */
+    bool isActive() const { return _active; }
+
+signals:
+    /** Paths below the DAV root of the user, "/" if anything may have changed */
+    void remoteChanged(const QStringList &paths);
+
+private slots:
+    void slotAccountStateChanged();
+    void slotPoll();
+    void slotActivitiesReceived(const QJsonDocument &json, int statusCode);
+    void slotNoNewActivities();
+
+private:
+    void stop();
+    void pollLater();
+    void retryLater();
+
+    AccountState *_accountState;
+    QPointer<JsonApiJob> _job;
+    QTimer _pollTimer;
+    // The id of the newest activity seen, -1 before the first answer
+    qint64 _lastActivityId = -1;
+    int _failures = 0;
+    bool _active = false;
+};
+}
+
+#endif
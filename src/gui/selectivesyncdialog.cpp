@@ -26,6 +26,7 @@
 #include <QHeaderView>
 #include <QSettings>
 #include <QScopedValueRollback>
+#include <QSharedPointer>
 #include <QTreeWidgetItem>
 #include <QLabel>
 #include <QVBoxLayout>
@@ -433,14 +434,21 @@ SelectiveSyncDialog::SelectiveSyncDialog(AccountPtr account, Folder *folder, QWi
     , _folder(folder)
     , _okButton(0) // defined in init()
 {
-    bool ok;
     init(account);
-    QStringList selectiveSyncList = _folder->journalDb()->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, &ok);
-    if (ok) {
-        _selectiveSync->setFolderInfo(_folder->remotePath(), _folder->alias(), selectiveSyncList);
-    } else {
-        _okButton->setEnabled(false);
-    }
+    // Enabled once the list is read, a running sync may hold the journal
+    _okButton->setEnabled(false);
+    auto ok = QSharedPointer<bool>::create(false);
+    auto selectiveSyncList = QSharedPointer<QStringList>::create();
+    _folder->journalDb()->runAsync(this,
+        [ok, selectiveSyncList](SyncJournalDb *journal) {
+            *selectiveSyncList = journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, ok.data());
+        },
+        [this, ok, selectiveSyncList] {
+            if (*ok) {
+                _selectiveSync->setFolderInfo(_folder->remotePath(), _folder->alias(), *selectiveSyncList);
+                _okButton->setEnabled(true);
+            }
+        });
     // Make sure we don't get crashes if the folder is destroyed while we are still open
     connect(_folder, &QObject::destroyed, this, &QObject::deleteLater);
 }
@@ -472,28 +480,32 @@ void SelectiveSyncDialog::init(const AccountPtr &account)
 void SelectiveSyncDialog::accept()
 {
     if (_folder) {
-        bool ok;
-        auto oldBlackListSet = _folder->journalDb()->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, &ok).toSet();
-        if (!ok) {
-            return;
-        }
         QStringList blackList = _selectiveSync->createBlackList();
-        _folder->journalDb()->setSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, blackList);
 
-        FolderMan *folderMan = FolderMan::instance();
         if (_folder->isBusy()) {
             _folder->slotTerminateSync();
         }
 
-        //The part that changed should not be read from the DB on next sync because there might be new folders
-        // (the ones that are no longer in the blacklist)
-        auto blackListSet = blackList.toSet();
-        auto changes = (oldBlackListSet - blackListSet) + (blackListSet - oldBlackListSet);
-        foreach (const auto &it, changes) {
-            _folder->journalDb()->avoidReadFromDbOnNextSync(it);
-        }
-
-        folderMan->scheduleFolder(_folder);
+        // The dialog is gone once the journal is updated
+        Folder *folder = _folder;
+        folder->journalDb()->runAsync(folder,
+            [blackList](SyncJournalDb *journal) {
+                bool ok;
+                auto oldBlackListSet = journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, &ok).toSet();
+                if (!ok) {
+                    return;
+                }
+                journal->setSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, blackList);
+
+                //The part that changed should not be read from the DB on next sync because there might be new folders
+                // (the ones that are no longer in the blacklist)
+                auto blackListSet = blackList.toSet();
+                auto changes = (oldBlackListSet - blackListSet) + (blackListSet - oldBlackListSet);
+                foreach (const auto &it, changes) {
+                    journal->avoidReadFromDbOnNextSync(it);
+                }
+            },
+            [folder] { FolderMan::instance()->scheduleFolder(folder); });
     }
     QDialog::accept();
 }
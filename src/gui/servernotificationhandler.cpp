@@ -50,6 +50,9 @@ void ServerNotificationHandler::slotFetchNotifications(AccountState *ptr)
     _notificationJob = new JsonApiJob(ptr->account(), QLatin1String("ocs/v2.php/apps/notifications/api/v1/notifications"), this);
     QObject::connect(_notificationJob.data(), &JsonApiJob::jsonReceived,
         this, &ServerNotificationHandler::slotNotificationsReceived);
+    QObject::connect(_notificationJob.data(), &JsonApiJob::notModified,
+        this, &ServerNotificationHandler::slotNotificationsNotModified);
+    _notificationJob->setIfNoneMatch(_ifNoneMatch);
     _notificationJob->setProperty("AccountStatePtr", QVariant::fromValue<AccountState *>(ptr));
 
     _notificationJob->start();
@@ -66,6 +69,7 @@ void ServerNotificationHandler::slotNotificationsReceived(const QJsonDocument &j
     auto notifies = json.object().value("ocs").toObject().value("data").toArray();
 
     AccountState *ai = qvariant_cast<AccountState *>(sender()->property("AccountStatePtr"));
+    _etag = qobject_cast<JsonApiJob *>(sender())->etag();
 
     ActivityList list;
 
@@ -100,4 +104,10 @@ void ServerNotificationHandler::slotNotificationsReceived(const QJsonDocument &j
 
     deleteLater();
 }
+
+void ServerNotificationHandler::slotNotificationsNotModified()
+{
+    // The shown notifications are still current
+    deleteLater();
+}
 }
@@ -29,6 +29,11 @@ class ServerNotificationHandler : public QObject
 public:
     explicit ServerNotificationHandler(QObject *parent = 0);
 
+    /** The list is only sent if the notifications differ from the ones of @a etag */
+    void setIfNoneMatch(const QByteArray &etag) { _ifNoneMatch = etag; }
+    /** The ETag of the list that was sent */
+    QByteArray etag() const { return _etag; }
+
 signals:
     void newNotificationList(ActivityList);
 
@@ -37,9 +42,12 @@ public slots:
 
 private slots:
     void slotNotificationsReceived(const QJsonDocument &json, int statusCode);
+    void slotNotificationsNotModified();
 
 private:
     QPointer<JsonApiJob> _notificationJob;
+    QByteArray _ifNoneMatch;
+    QByteArray _etag;
 };
 }
 
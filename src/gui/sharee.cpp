@@ -14,15 +14,41 @@
 
 #include "sharee.h"
 #include "ocsshareejob.h"
+#include "account.h"
 
+#include <QCache>
+#include <QElapsedTimer>
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QJsonArray>
+#include <QTimer>
 
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcSharing, "gui.sharing", QtInfoMsg)
 
+// Opening the share dialog again or typing the same name doesn't ask the server again
+static const qint64 ShareeCacheMs = 2 * 60 * 1000;
+static const int ShareeCacheSize = 50;
+
+namespace {
+    struct CachedSharees
+    {
+        QJsonDocument reply;
+        QElapsedTimer age;
+    };
+
+    struct ShareeCache : QCache<QString, CachedSharees>
+    {
+        ShareeCache()
+            : QCache<QString, CachedSharees>(ShareeCacheSize)
+        {
+        }
+    };
+
+    Q_GLOBAL_STATIC(ShareeCache, shareeCache)
+}
+
 Sharee::Sharee(const QString shareWith,
     const QString displayName,
     const Type type)
@@ -71,7 +97,21 @@ void ShareeModel::fetch(const QString &search, const ShareeSet &blacklist)
 {
     _search = search;
     _shareeBlacklist = blacklist;
+
+    const QString key = _account->id() + QLatin1Char('/') + _type + QLatin1Char('/') + _search;
+    CachedSharees *cached = shareeCache()->object(key);
+    if (cached && cached->age.elapsed() < ShareeCacheMs) {
+        const QJsonDocument reply = cached->reply;
+        QTimer::singleShot(0, this, [this, reply] { shareesFetched(reply); });
+        return;
+    }
+
     OcsShareeJob *job = new OcsShareeJob(_account);
+    connect(job, &OcsShareeJob::shareeJobFinished, this, [key](const QJsonDocument &reply) {
+        auto cached = new CachedSharees{ reply, QElapsedTimer() };
+        cached->age.start();
+        shareeCache()->insert(key, cached);
+    });
     connect(job, &OcsShareeJob::shareeJobFinished, this, &ShareeModel::shareesFetched);
     connect(job, &OcsJob::ocsError, this, &ShareeModel::displayErrorMessage);
     job->getSharees(_search, _type, 1, 50);
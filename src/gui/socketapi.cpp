@@ -35,6 +35,8 @@
 
 #include <array>
 #include <QBitArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QUrl>
 #include <QMetaMethod>
 #include <QMetaObject>
@@ -56,7 +58,7 @@
 // This is the version that is returned when the client asks for the VERSION.
 // The first number should be changed if there is an incompatible change that breaks old clients.
 // The second number should be changed when there are new features.
-#define MIRALL_SOCKET_API_VERSION "1.0"
+#define MIRALL_SOCKET_API_VERSION "1.2"
 
 static inline QString removeTrailingSlash(QString path)
 {
@@ -85,6 +87,12 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcSocketApi, "gui.socketapi", QtInfoMsg)
 
+// The STATUS messages are collected this long, so that the shell extensions
+// get the latest status of a file rather than every step on the way.
+static const int StatusPushDelayMsec = 100;
+// Above this many changed files in a directory it gets an UPDATE_VIEW
+static const int StatusPushUpdateViewThreshold = 50;
+
 class BloomFilter
 {
     // Initialize with m=1024 bits and k=2 (high and low 16 bits of a qHash).
@@ -115,10 +123,12 @@ private:
 class SocketListener
 {
 public:
-    QIODevice *socket;
+    QIODevice *socket; // in the socket thread, only a key here
+    SocketApiWorker *worker;
 
-    SocketListener(QIODevice *socket = 0)
+    SocketListener(QIODevice *socket = 0, SocketApiWorker *worker = 0)
         : socket(socket)
+        , worker(worker)
     {
     }
 
@@ -129,21 +139,27 @@ public:
         if (!localMessage.endsWith(QLatin1Char('\n'))) {
             localMessage.append(QLatin1Char('\n'));
         }
+        worker->send(socket, localMessage.toUtf8(), doWait);
+    }
 
-        QByteArray bytesToSend = localMessage.toUtf8();
-        qint64 sent = socket->write(bytesToSend);
-        if (doWait) {
-            socket->waitForBytesWritten(1000);
-        }
-        if (sent != bytesToSend.length()) {
-            qCWarning(lcSocketApi) << "Could not send all data on socket for " << localMessage;
+    /// Writes all @a messages at once
+    void sendMessages(const QStringList &messages) const
+    {
+        if (messages.isEmpty())
+            return;
+        qCInfo(lcSocketApi) << "Sending" << messages.size() << "SocketAPI messages to" << socket;
+        QByteArray bytesToSend;
+        foreach (const QString &message, messages) {
+            qCDebug(lcSocketApi) << "-->" << message;
+            bytesToSend += message.toUtf8();
+            bytesToSend += '\n';
         }
+        worker->send(socket, bytesToSend, false);
     }
 
-    void sendMessageIfDirectoryMonitored(const QString &message, uint systemDirectoryHash) const
+    bool isDirectoryMonitored(uint systemDirectoryHash) const
     {
-        if (_monitoredDirectoriesBloomFilter.isHashMaybeStored(systemDirectoryHash))
-            sendMessage(message, false);
+        return _monitoredDirectoriesBloomFilter.isHashMaybeStored(systemDirectoryHash);
     }
 
     void registerMonitoredDirectory(uint systemDirectoryHash)
@@ -165,9 +181,135 @@ struct ListenerHasSocketPred
     bool operator()(const SocketListener &listener) const { return listener.socket == socket; }
 };
 
+SocketApiWorker::SocketApiWorker(const SocketApiStatusCache *statusCache)
+    : _statusCache(statusCache)
+{
+    connect(this, &SocketApiWorker::sendRequested, this, &SocketApiWorker::writeToSocket, Qt::QueuedConnection);
+    connect(this, &SocketApiWorker::sendAndWaitRequested, this, &SocketApiWorker::writeToSocket, Qt::BlockingQueuedConnection);
+}
+
+SocketApiWorker::~SocketApiWorker()
+{
+    foreach (QIODevice *socket, _sockets)
+        disconnect(socket, nullptr, this, nullptr);
+    _sockets.clear();
+    if (_localServer)
+        _localServer->close();
+    // All remaining sockets will be destroyed with _localServer, their parent
+}
+
+void SocketApiWorker::start(const QString &socketPath)
+{
+    _localServer.reset(new SocketApiServer);
+    SocketApiServer::removeServer(socketPath);
+    if (!_localServer->listen(socketPath)) {
+        qCWarning(lcSocketApi) << "can't start server" << socketPath;
+    } else {
+        qCInfo(lcSocketApi) << "server started, listening at " << socketPath;
+    }
+
+    connect(_localServer.data(), &SocketApiServer::newConnection, this, &SocketApiWorker::slotNewConnection);
+}
+
+void SocketApiWorker::send(QIODevice *socket, const QByteArray &bytes, bool doWait)
+{
+    if (QThread::currentThread() == thread()) {
+        writeToSocket(socket, bytes, doWait);
+    } else if (doWait) {
+        emit sendAndWaitRequested(socket, bytes, doWait);
+    } else {
+        emit sendRequested(socket, bytes, doWait);
+    }
+}
+
+void SocketApiWorker::writeToSocket(QIODevice *socket, const QByteArray &bytes, bool doWait)
+{
+    // It may have disconnected since the message was queued
+    if (!_sockets.contains(socket))
+        return;
+    qint64 sent = socket->write(bytes);
+    if (doWait) {
+        socket->waitForBytesWritten(1000);
+    }
+    if (sent != bytes.length()) {
+        qCWarning(lcSocketApi) << "Could not send all data on socket" << socket;
+    }
+}
+
+void SocketApiWorker::slotNewConnection()
+{
+    QIODevice *socket = _localServer->nextPendingConnection();
+
+    if (!socket) {
+        return;
+    }
+    qCInfo(lcSocketApi) << "New connection" << socket;
+    connect(socket, &QIODevice::readyRead, this, &SocketApiWorker::slotReadSocket);
+    connect(socket, SIGNAL(disconnected()), this, SLOT(onLostConnection()));
+    connect(socket, &QObject::destroyed, this, &SocketApiWorker::slotSocketDestroyed);
+    ASSERT(socket->readAll().isEmpty());
+
+    _sockets.insert(socket);
+    emit connected(socket);
+}
+
+void SocketApiWorker::onLostConnection()
+{
+    qCInfo(lcSocketApi) << "Lost connection " << sender();
+    sender()->deleteLater();
+}
+
+void SocketApiWorker::slotSocketDestroyed(QObject *obj)
+{
+    QIODevice *socket = static_cast<QIODevice *>(obj);
+    _sockets.remove(socket);
+    emit disconnected(socket);
+}
+
+void SocketApiWorker::slotReadSocket()
+{
+    QIODevice *socket = qobject_cast<QIODevice *>(sender());
+    ASSERT(socket);
+
+    while (socket->canReadLine()) {
+        // Make sure to normalize the input from the socket to
+        // make sure that the path will match, especially on OS X.
+        QString line = QString::fromUtf8(socket->readLine()).normalized(QString::NormalizationForm_C);
+        line.chop(1); // remove the '\n'
+        qCInfo(lcSocketApi) << "Received SocketAPI message <--" << line << "from" << socket;
+        const int colon = line.indexOf(QLatin1Char(':'));
+        QByteArray command = line.left(colon).toLatin1();
+
+        QString argument = colon == -1 ? QString() : line.mid(colon + 1);
+        if (!answerFromCache(socket, command, argument))
+            emit commandReceived(socket, command, argument);
+    }
+}
+
+bool SocketApiWorker::answerFromCache(QIODevice *socket, const QByteArray &command, const QString &argument)
+{
+    if (command != "RETRIEVE_FILE_STATUS" && command != "RETRIEVE_FOLDER_STATUS")
+        return false;
+
+    QString systemPath = QDir::cleanPath(argument);
+    if (systemPath.endsWith(QLatin1Char('/')))
+        systemPath.truncate(systemPath.length() - 1);
+    SyncFileStatus fileStatus;
+    if (!_statusCache->status(systemPath, &fileStatus))
+        return false;
+
+    const QString message = QLatin1String("STATUS:") % fileStatus.toSocketAPIString()
+        % QLatin1Char(':') % QDir::toNativeSeparators(argument) % QLatin1Char('\n');
+    writeToSocket(socket, message.toUtf8(), false);
+    emit statusAnswered(socket, command, systemPath);
+    return true;
+}
+
 SocketApi::SocketApi(QObject *parent)
     : QObject(parent)
 {
+    _uptime.start();
+
     QString socketPath;
 
     if (Utility::isWindows()) {
@@ -191,7 +333,6 @@ SocketApi::SocketApi(QObject *parent)
         qCWarning(lcSocketApi) << "An unexpected system detected, this probably won't work.";
     }
 
-    SocketApiServer::removeServer(socketPath);
     QFileInfo info(socketPath);
     if (!info.dir().exists()) {
         bool result = info.dir().mkpath(".");
@@ -201,41 +342,56 @@ SocketApi::SocketApi(QObject *parent)
                 QFile::Permissions(QFile::ReadOwner + QFile::WriteOwner + QFile::ExeOwner));
         }
     }
-    if (!_localServer.listen(socketPath)) {
-        qCWarning(lcSocketApi) << "can't start server" << socketPath;
-    } else {
-        qCInfo(lcSocketApi) << "server started, listening at " << socketPath;
-    }
 
-    connect(&_localServer, &SocketApiServer::newConnection, this, &SocketApi::slotNewConnection);
+    // Next to the socket where the extensions can read it. The sandbox of
+    // the FinderSync extension does not allow that for now, there it is
+    // only for the socket thread.
+    QString statusCacheFile;
+    if (Utility::isLinux() || Utility::isBSD()) {
+        statusCacheFile = info.dir().filePath("statuscache");
+    } else if (Utility::isWindows()) {
+        statusCacheFile = QDir(ConfigFile().configPath()).filePath("statuscache");
+    }
+    _statusCache.reset(new SocketApiStatusCache(statusCacheFile));
+
+    _worker = new SocketApiWorker(_statusCache.data());
+    connect(_worker, &SocketApiWorker::connected, this, &SocketApi::slotNewConnection);
+    connect(_worker, &SocketApiWorker::disconnected, this, &SocketApi::slotLostConnection);
+    connect(_worker, &SocketApiWorker::commandReceived, this, &SocketApi::slotCommandReceived);
+    connect(_worker, &SocketApiWorker::statusAnswered, this, &SocketApi::slotStatusAnswered);
+#if !defined(Q_OS_MAC)
+    _socketThread.setObjectName("SocketApi_Thread");
+    _worker->moveToThread(&_socketThread);
+    connect(&_socketThread, &QThread::finished, _worker, &QObject::deleteLater);
+    _socketThread.start();
+#endif
+    QMetaObject::invokeMethod(_worker, "start", Q_ARG(QString, socketPath));
 
     // folder watcher
     connect(FolderMan::instance(), &FolderMan::folderSyncStateChange, this, &SocketApi::slotUpdateFolderView);
+
+    _statusPushTimer.setSingleShot(true);
+    _statusPushTimer.setInterval(StatusPushDelayMsec);
+    connect(&_statusPushTimer, &QTimer::timeout, this, &SocketApi::flushStatusPushMessages);
 }
 
 SocketApi::~SocketApi()
 {
     qCDebug(lcSocketApi) << "dtor";
-    _localServer.close();
-    // All remaining sockets will be destroyed with _localServer, their parent
-    ASSERT(_listeners.isEmpty() || _listeners.first().socket->parent() == &_localServer);
+    disconnect(_worker, nullptr, this, nullptr);
     _listeners.clear();
+    if (_socketThread.isRunning()) {
+        // The worker is deleted in its thread when it finishes
+        _socketThread.quit();
+        _socketThread.wait();
+    } else {
+        delete _worker;
+    }
 }
 
-void SocketApi::slotNewConnection()
+void SocketApi::slotNewConnection(QIODevice *socket)
 {
-    QIODevice *socket = _localServer.nextPendingConnection();
-
-    if (!socket) {
-        return;
-    }
-    qCInfo(lcSocketApi) << "New connection" << socket;
-    connect(socket, &QIODevice::readyRead, this, &SocketApi::slotReadSocket);
-    connect(socket, SIGNAL(disconnected()), this, SLOT(onLostConnection()));
-    connect(socket, &QObject::destroyed, this, &SocketApi::slotSocketDestroyed);
-    ASSERT(socket->readAll().isEmpty());
-
-    _listeners.append(SocketListener(socket));
+    _listeners.append(SocketListener(socket, _worker));
     SocketListener &listener = _listeners.last();
 
     foreach (Folder *f, FolderMan::instance()->map()) {
@@ -246,43 +402,61 @@ void SocketApi::slotNewConnection()
     }
 }
 
-void SocketApi::onLostConnection()
+void SocketApi::slotLostConnection(QIODevice *socket)
 {
-    qCInfo(lcSocketApi) << "Lost connection " << sender();
-    sender()->deleteLater();
+    _listeners.erase(std::remove_if(_listeners.begin(), _listeners.end(), ListenerHasSocketPred(socket)), _listeners.end());
 }
 
-void SocketApi::slotSocketDestroyed(QObject *obj)
+SocketListener *SocketApi::listenerForSocket(QIODevice *socket)
 {
-    QIODevice *socket = static_cast<QIODevice *>(obj);
-    _listeners.erase(std::remove_if(_listeners.begin(), _listeners.end(), ListenerHasSocketPred(socket)), _listeners.end());
+    auto it = std::find_if(_listeners.begin(), _listeners.end(), ListenerHasSocketPred(socket));
+    return it == _listeners.end() ? nullptr : &*it;
 }
 
-void SocketApi::slotReadSocket()
+/// The command_ methods by command name, instead of a lookup by signature for every message
+static const QHash<QByteArray, QMetaMethod> &commands()
 {
-    QIODevice *socket = qobject_cast<QIODevice *>(sender());
-    ASSERT(socket);
-    SocketListener *listener = &*std::find_if(_listeners.begin(), _listeners.end(), ListenerHasSocketPred(socket));
+    static const QHash<QByteArray, QMetaMethod> table = [] {
+        QHash<QByteArray, QMetaMethod> t;
+        const QMetaObject &mo = SocketApi::staticMetaObject;
+        const QByteArray prefix = "command_";
+        const QByteArray suffix = "(QString,SocketListener*)";
+        for (int i = mo.methodOffset(); i < mo.methodCount(); ++i) {
+            const QMetaMethod method = mo.method(i);
+            const QByteArray signature = method.methodSignature();
+            if (signature.startsWith(prefix) && signature.endsWith(suffix))
+                t.insert(signature.mid(prefix.size(), signature.size() - prefix.size() - suffix.size()), method);
+        }
+        return t;
+    }();
+    return table;
+}
 
-    while (socket->canReadLine()) {
-        // Make sure to normalize the input from the socket to
-        // make sure that the path will match, especially on OS X.
-        QString line = QString::fromUtf8(socket->readLine()).normalized(QString::NormalizationForm_C);
-        line.chop(1); // remove the '\n'
-        qCInfo(lcSocketApi) << "Received SocketAPI message <--" << line << "from" << socket;
-        QByteArray command = line.split(":").value(0).toAscii();
-        QByteArray functionWithArguments = "command_" + command + "(QString,SocketListener*)";
-        int indexOfMethod = staticMetaObject.indexOfMethod(functionWithArguments);
+void SocketApi::slotCommandReceived(QIODevice *socket, const QByteArray &command, const QString &argument)
+{
+    SocketListener *listener = listenerForSocket(socket);
+    if (!listener)
+        return;
 
-        QString argument = line.remove(0, command.length() + 1);
-        if (indexOfMethod != -1) {
-            staticMetaObject.method(indexOfMethod).invoke(this, Q_ARG(QString, argument), Q_ARG(SocketListener *, listener));
-        } else {
-            qCWarning(lcSocketApi) << "The command is not supported by this version of the client:" << command << "with argument:" << argument;
-        }
+    const auto method = commands().constFind(command);
+    if (method != commands().constEnd()) {
+        ++_commandCounts[command];
+        method->invoke(this, Q_ARG(QString, argument), Q_ARG(SocketListener *, listener));
+    } else {
+        qCWarning(lcSocketApi) << "The command is not supported by this version of the client:" << command << "with argument:" << argument;
     }
 }
 
+void SocketApi::slotStatusAnswered(QIODevice *socket, const QByteArray &command, const QString &systemPath)
+{
+    // Counted like the commands the worker hands over
+    ++_commandCounts[command];
+    SocketListener *listener = listenerForSocket(socket);
+    Folder *syncFolder = FolderMan::instance()->folderForPath(systemPath);
+    if (listener && syncFolder)
+        directoryShown(systemPath, syncFolder, listener);
+}
+
 void SocketApi::slotRegisterPath(const QString &alias)
 {
     // Make sure not to register twice to each connected client
@@ -309,6 +483,9 @@ void SocketApi::slotUnregisterPath(const QString &alias)
     if (f)
         broadcastMessage(buildMessage(QLatin1String("UNREGISTER_PATH"), removeTrailingSlash(f->path()), QString::null), true);
 
+    // Not worth finding the paths of the folder in it
+    _statusCache->clear();
+
     _registeredAliases.remove(alias);
 }
 
@@ -338,6 +515,8 @@ void SocketApi::slotUpdateFolderView(Folder *f)
 
 void SocketApi::broadcastMessage(const QString &msg, bool doWait)
 {
+    // Keep the order with the STATUS messages that came before
+    flushStatusPushMessages();
     foreach (auto &listener, _listeners) {
         listener.sendMessage(msg, doWait);
     }
@@ -345,12 +524,63 @@ void SocketApi::broadcastMessage(const QString &msg, bool doWait)
 
 void SocketApi::broadcastStatusPushMessage(const QString &systemPath, SyncFileStatus fileStatus)
 {
-    QString msg = buildMessage(QLatin1String("STATUS"), systemPath, fileStatus.toSocketAPIString());
     Q_ASSERT(!systemPath.endsWith('/'));
-    uint directoryHash = qHash(systemPath.left(systemPath.lastIndexOf('/')));
-    foreach (auto &listener, _listeners) {
-        listener.sendMessageIfDirectoryMonitored(msg, directoryHash);
+    // Right away, the STATUS message only tells the extensions to look again
+    _statusCache->setStatus(systemPath, fileStatus);
+    if (_listeners.isEmpty())
+        return;
+    auto it = _pendingStatusPushes.find(systemPath);
+    if (it != _pendingStatusPushes.end()) {
+        *it = fileStatus;
+        return;
     }
+    _pendingStatusPushes.insert(systemPath, fileStatus);
+    _pendingStatusPushOrder.append(systemPath);
+    if (!_statusPushTimer.isActive())
+        _statusPushTimer.start();
+}
+
+void SocketApi::flushStatusPushMessages()
+{
+    _statusPushTimer.stop();
+    if (_pendingStatusPushOrder.isEmpty())
+        return;
+
+    // The changes by directory, in the order they came
+    QHash<QString, QStringList> changesByDirectory;
+    QStringList directories;
+    foreach (const QString &systemPath, _pendingStatusPushOrder) {
+        const QString directory = systemPath.left(systemPath.lastIndexOf('/'));
+        auto &changes = changesByDirectory[directory];
+        if (changes.isEmpty())
+            directories.append(directory);
+        changes.append(systemPath);
+    }
+
+    QVector<QStringList> messages(_listeners.size());
+    foreach (const QString &directory, directories) {
+        const QStringList &changes = changesByDirectory[directory];
+        QStringList directoryMessages;
+        if (changes.size() > StatusPushUpdateViewThreshold) {
+            qCDebug(lcSocketApi) << "Sending UPDATE_VIEW for" << changes.size() << "changes in" << directory;
+            directoryMessages.append(buildMessage(QLatin1String("UPDATE_VIEW"), directory));
+        } else {
+            foreach (const QString &systemPath, changes) {
+                directoryMessages.append(buildMessage(QLatin1String("STATUS"), systemPath,
+                    _pendingStatusPushes.value(systemPath).toSocketAPIString()));
+            }
+        }
+        const uint directoryHash = qHash(directory);
+        for (int i = 0; i < _listeners.size(); ++i) {
+            if (_listeners.at(i).isDirectoryMonitored(directoryHash))
+                messages[i] += directoryMessages;
+        }
+    }
+    _pendingStatusPushes.clear();
+    _pendingStatusPushOrder.clear();
+
+    for (int i = 0; i < _listeners.size(); ++i)
+        _listeners.at(i).sendMessages(messages.at(i));
 }
 
 void SocketApi::command_RETRIEVE_FOLDER_STATUS(const QString &argument, SocketListener *listener)
@@ -360,6 +590,20 @@ void SocketApi::command_RETRIEVE_FOLDER_STATUS(const QString &argument, SocketLi
 }
 
 void SocketApi::command_RETRIEVE_FILE_STATUS(const QString &argument, SocketListener *listener)
+{
+    listener->sendMessage(fileStatusMessage(argument, listener));
+}
+
+void SocketApi::command_RETRIEVE_FILE_STATUS_BATCH(const QString &argument, SocketListener *listener)
+{
+    QStringList messages;
+    foreach (const QString &path, argument.split(QLatin1Char('\x1e'), QString::SkipEmptyParts))
+        messages.append(fileStatusMessage(path, listener));
+    messages.append(QLatin1String("STATUS_BATCH_END:") + QString::number(messages.size()));
+    listener->sendMessages(messages);
+}
+
+QString SocketApi::fileStatusMessage(const QString &argument, SocketListener *listener)
 {
     QString statusString;
 
@@ -373,18 +617,26 @@ void SocketApi::command_RETRIEVE_FILE_STATUS(const QString &argument, SocketList
             systemPath.truncate(systemPath.length() - 1);
             qCWarning(lcSocketApi) << "Removed trailing slash for directory: " << systemPath << "Status pushes won't have one.";
         }
-        // The user probably visited this directory in the file shell.
-        // Let the listener know that it should now send status pushes for sibblings of this file.
-        QString directory = systemPath.left(systemPath.lastIndexOf('/'));
-        listener->registerMonitoredDirectory(qHash(directory));
+        directoryShown(systemPath, syncFolder, listener);
 
         QString relativePath = systemPath.mid(syncFolder->cleanPath().length() + 1);
         SyncFileStatus fileStatus = syncFolder->syncEngine().syncFileStatusTracker().fileStatus(relativePath);
         statusString = fileStatus.toSocketAPIString();
+        _statusCache->setStatus(systemPath, fileStatus);
     }
 
-    const QString message = QLatin1String("STATUS:") % statusString % QLatin1Char(':') % QDir::toNativeSeparators(argument);
-    listener->sendMessage(message);
+    return QLatin1String("STATUS:") % statusString % QLatin1Char(':') % QDir::toNativeSeparators(argument);
+}
+
+void SocketApi::directoryShown(const QString &systemPath, Folder *syncFolder, SocketListener *listener)
+{
+    // The user probably visited this directory in the file shell.
+    // Let the listener know that it should now send status pushes for sibblings of this file.
+    QString directory = systemPath.left(systemPath.lastIndexOf('/'));
+    listener->registerMonitoredDirectory(qHash(directory));
+
+    if (directory.length() > syncFolder->cleanPath().length())
+        syncFolder->prioritizeDirectory(directory.mid(syncFolder->cleanPath().length() + 1));
 }
 
 void SocketApi::command_SHARE(const QString &localFile, SocketListener *listener)
@@ -431,6 +683,11 @@ void SocketApi::command_SHARE(const QString &localFile, SocketListener *listener
     }
 }
 
+void SocketApi::command_STATUS_CACHE(const QString &, SocketListener *listener)
+{
+    listener->sendMessage(QLatin1String("STATUS_CACHE:") + QDir::toNativeSeparators(_statusCache->fileName()));
+}
+
 void SocketApi::command_VERSION(const QString &, SocketListener *listener)
 {
     listener->sendMessage(QLatin1String("VERSION:" MIRALL_VERSION_STRING ":" MIRALL_SOCKET_API_VERSION));
@@ -505,12 +762,12 @@ static void fetchPrivateLinkUrlHelper(const QString &localFile, SocketApi *targe
 
     AccountPtr account = shareFolder->accountState()->account();
 
-    SyncJournalFileRecord rec;
-    if (!shareFolder->journalDb()->getFileRecord(file, &rec) || !rec.isValid())
-        return;
-
-    fetchPrivateLinkUrl(account, file, rec.numericFileId(), target, [=](const QString &url) {
-        (target->*targetFun)(url);
+    shareFolder->journalDb()->getFileRecordAsync(file.toUtf8(), target, [=](const SyncJournalFileRecord &rec) {
+        if (!rec.isValid())
+            return;
+        fetchPrivateLinkUrl(account, file, rec.numericFileId(), target, [=](const QString &url) {
+            (target->*targetFun)(url);
+        });
     });
 }
 
@@ -524,6 +781,15 @@ void SocketApi::command_EMAIL_PRIVATE_LINK(const QString &localFile, SocketListe
     fetchPrivateLinkUrlHelper(localFile, this, &SocketApi::emailPrivateLink);
 }
 
+void SocketApi::command_DOWNLOAD_VIRTUAL_FILE(const QString &localFile, SocketListener *)
+{
+    Folder *folder = FolderMan::instance()->folderForPath(localFile);
+    if (!folder)
+        return;
+    const QString file = QDir::cleanPath(localFile).mid(folder->cleanPath().length() + 1);
+    folder->downloadVirtualFile(file);
+}
+
 void SocketApi::copyPrivateLinkToClipboard(const QString &link) const
 {
     QApplication::clipboard()->setText(link);
@@ -539,11 +805,13 @@ void SocketApi::emailPrivateLink(const QString &link) const
 
 void SocketApi::command_GET_STRINGS(const QString &, SocketListener *listener)
 {
-    static std::array<std::pair<const char *, QString>, 5> strings { {
+    static std::array<std::pair<const char *, QString>, 6> strings { {
         { "SHARE_MENU_TITLE", tr("Share...") },
         { "CONTEXT_MENU_TITLE", Theme::instance()->appNameGUI() },
         { "COPY_PRIVATE_LINK_MENU_TITLE", tr("Copy private link to clipboard") },
         { "EMAIL_PRIVATE_LINK_MENU_TITLE", tr("Send private link by email...") },
+        { "DOWNLOAD_VIRTUAL_FILE_MENU_TITLE", tr("Download file") },
+        { "VIRTUAL_FILE_SUFFIX", QStringLiteral(APPLICATION_DOTVIRTUALFILE_SUFFIX) },
     } };
     listener->sendMessage(QString("GET_STRINGS:BEGIN"));
     for (auto key_value : strings) {
@@ -552,6 +820,32 @@ void SocketApi::command_GET_STRINGS(const QString &, SocketListener *listener)
     listener->sendMessage(QString("GET_STRINGS:END"));
 }
 
+void SocketApi::command_GET_METRICS(const QString &, SocketListener *listener)
+{
+    QJsonObject folders;
+    foreach (Folder *folder, FolderMan::instance()->map()) {
+        folders.insert(folder->alias(), folder->syncEngine().liveMetrics());
+    }
+
+    QJsonObject commands;
+    qint64 total = 0;
+    for (auto it = _commandCounts.constBegin(); it != _commandCounts.constEnd(); ++it) {
+        commands.insert(QString::fromLatin1(it.key()), it.value());
+        total += it.value();
+    }
+    QJsonObject socketApi;
+    socketApi.insert(QStringLiteral("listeners"), _listeners.size());
+    socketApi.insert(QStringLiteral("commands"), commands);
+    socketApi.insert(QStringLiteral("commandsPerMinute"), total * 60 * 1000 / qMax<qint64>(1, _uptime.elapsed()));
+
+    QJsonObject result;
+    result.insert(QStringLiteral("uptimeMs"), _uptime.elapsed());
+    result.insert(QStringLiteral("folders"), folders);
+    result.insert(QStringLiteral("socketApi"), socketApi);
+    listener->sendMessage(QLatin1String("METRICS:")
+        + QString::fromUtf8(QJsonDocument(result).toJson(QJsonDocument::Compact)));
+}
+
 QString SocketApi::buildRegisterPathMessage(const QString &path)
 {
     QFileInfo fi(path);
@@ -18,6 +18,14 @@
 
 #include "syncfileitem.h"
 #include "syncfilestatus.h"
+#include "socketapistatuscache.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QScopedPointer>
+#include <QSet>
+#include <QThread>
+#include <QTimer>
 // #include "ownsql.h"
 
 #if defined(Q_OS_MAC)
@@ -37,6 +45,57 @@ class SyncFileStatus;
 class Folder;
 class SocketListener;
 
+/**
+ * @brief The sockets of the SocketApi, in their own thread
+ *
+ * The shell extensions ask for the status of every file they show, so that
+ * thread answers RETRIEVE_FILE_STATUS from the SocketApiStatusCache when it
+ * can, instead of waiting for the main thread. Everything else goes to the
+ * SocketApi.
+ *
+ * On macOS the sockets need the run loop of the main thread, there it is
+ * in the main thread too.
+ *
+ * @ingroup gui
+ */
+class SocketApiWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SocketApiWorker(const SocketApiStatusCache *statusCache);
+    ~SocketApiWorker();
+
+    /** Writes @a bytes to @a socket, from any thread */
+    void send(QIODevice *socket, const QByteArray &bytes, bool doWait);
+
+public slots:
+    void start(const QString &socketPath);
+
+signals:
+    void connected(QIODevice *socket);
+    void disconnected(QIODevice *socket);
+    void commandReceived(QIODevice *socket, const QByteArray &command, const QString &argument);
+    /** The @a command for the status of @a systemPath was answered from the cache */
+    void statusAnswered(QIODevice *socket, const QByteArray &command, const QString &systemPath);
+
+    void sendRequested(QIODevice *socket, const QByteArray &bytes, bool doWait);
+    void sendAndWaitRequested(QIODevice *socket, const QByteArray &bytes, bool doWait);
+
+private slots:
+    void slotNewConnection();
+    void onLostConnection();
+    void slotReadSocket();
+    void slotSocketDestroyed(QObject *obj);
+    void writeToSocket(QIODevice *socket, const QByteArray &bytes, bool doWait);
+
+private:
+    bool answerFromCache(QIODevice *socket, const QByteArray &command, const QString &argument);
+
+    const SocketApiStatusCache *_statusCache;
+    QScopedPointer<SocketApiServer> _localServer;
+    QSet<QIODevice *> _sockets;
+};
+
 /**
  * @brief The SocketApi class
  * @ingroup gui
@@ -53,16 +112,25 @@ public slots:
     void slotUpdateFolderView(Folder *f);
     void slotUnregisterPath(const QString &alias);
     void slotRegisterPath(const QString &alias);
+    /** Queues a STATUS message, see flushStatusPushMessages() */
     void broadcastStatusPushMessage(const QString &systemPath, SyncFileStatus fileStatus);
 
 signals:
     void shareCommandReceived(const QString &sharePath, const QString &localPath);
 
 private slots:
-    void slotNewConnection();
-    void onLostConnection();
-    void slotSocketDestroyed(QObject *obj);
-    void slotReadSocket();
+    void slotNewConnection(QIODevice *socket);
+    void slotLostConnection(QIODevice *socket);
+    void slotCommandReceived(QIODevice *socket, const QByteArray &command, const QString &argument);
+    void slotStatusAnswered(QIODevice *socket, const QByteArray &command, const QString &systemPath);
+
+    /** Sends the queued STATUS messages, the latest one per path.
+     *
+     * A directory with many of them gets a single UPDATE_VIEW instead, the
+     * shell extensions then ask for the statuses they show. The messages
+     * for a listener are written at once.
+     */
+    void flushStatusPushMessages();
 
     void copyPrivateLinkToClipboard(const QString &link) const;
     void emailPrivateLink(const QString &link) const;
@@ -72,6 +140,18 @@ private:
 
     Q_INVOKABLE void command_RETRIEVE_FOLDER_STATUS(const QString &argument, SocketListener *listener);
     Q_INVOKABLE void command_RETRIEVE_FILE_STATUS(const QString &argument, SocketListener *listener);
+    /** The paths are separated by the ASCII record separator (0x1e).
+     *
+     * The answer is a STATUS message per path, like for RETRIEVE_FILE_STATUS,
+     * followed by STATUS_BATCH_END with the number of paths.
+     */
+    Q_INVOKABLE void command_RETRIEVE_FILE_STATUS_BATCH(const QString &argument, SocketListener *listener);
+
+    /** Answers with the file name of the status cache, empty if there is none
+     *
+     * See SocketApiStatusCache for its layout.
+     */
+    Q_INVOKABLE void command_STATUS_CACHE(const QString &argument, SocketListener *listener);
 
     Q_INVOKABLE void command_VERSION(const QString &argument, SocketListener *listener);
 
@@ -82,15 +162,39 @@ private:
     Q_INVOKABLE void command_SHARE(const QString &localFile, SocketListener *listener);
     Q_INVOKABLE void command_COPY_PRIVATE_LINK(const QString &localFile, SocketListener *listener);
     Q_INVOKABLE void command_EMAIL_PRIVATE_LINK(const QString &localFile, SocketListener *listener);
+    /// Downloads the file of a placeholder, see Folder::downloadVirtualFile()
+    Q_INVOKABLE void command_DOWNLOAD_VIRTUAL_FILE(const QString &localFile, SocketListener *listener);
 
     /** Sends translated/branded strings that may be useful to the integration */
     Q_INVOKABLE void command_GET_STRINGS(const QString &argument, SocketListener *listener);
 
+    /** Answers with a METRICS message holding a JSON object on one line
+     *
+     * It has the SyncEngine::liveMetrics() of every folder by alias and
+     * the number of commands this API answered, for monitoring.
+     */
+    Q_INVOKABLE void command_GET_METRICS(const QString &argument, SocketListener *listener);
+
     QString buildRegisterPathMessage(const QString &path);
+    /// The STATUS message for the RETRIEVE_FILE_STATUS of @a argument
+    QString fileStatusMessage(const QString &argument, SocketListener *listener);
+    /// The extension shows the directory of @a systemPath, in @a folder
+    void directoryShown(const QString &systemPath, Folder *folder, SocketListener *listener);
+    SocketListener *listenerForSocket(QIODevice *socket);
 
     QSet<QString> _registeredAliases;
     QList<SocketListener> _listeners;
-    SocketApiServer _localServer;
+
+    QHash<QString, SyncFileStatus> _pendingStatusPushes;
+    QStringList _pendingStatusPushOrder;
+    QTimer _statusPushTimer;
+
+    QScopedPointer<SocketApiStatusCache> _statusCache;
+    /// How many times each command was received, see command_GET_METRICS()
+    QHash<QByteArray, qint64> _commandCounts;
+    QElapsedTimer _uptime;
+    SocketApiWorker *_worker;
+    QThread _socketThread;
 };
 }
 #endif // SOCKETAPI_H
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "socketapistatuscache.h"
+#include "common/utility.h"
+
+#include <QDir>
+#include <QLoggingCategory>
+#include <QThread>
+
+#include <atomic>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcStatusCache, "gui.socketapi.statuscache", QtInfoMsg)
+
+static const quint32 StatusCacheMagic = 0x4353434f;
+static const quint32 StatusCacheVersion = 1;
+
+// 1 MB, much more than the statuses a file manager shows at once
+static const quint32 StatusCacheCapacity = 1 << 16;
+
+static const quint32 SharedStatusFlag = 0x100;
+
+// The socket thread reads the entries while the main thread writes them,
+// they are atomics of the same size and layout as the plain integers.
+struct SocketApiStatusCache::Header
+{
+    quint32 magic;
+    quint32 version;
+    std::atomic<quint32> sequence;
+    quint32 capacity;
+};
+
+struct SocketApiStatusCache::Entry
+{
+    std::atomic<quint64> hash;
+    std::atomic<quint32> status;
+    quint32 reserved;
+};
+
+Q_STATIC_ASSERT(sizeof(std::atomic<quint32>) == sizeof(quint32));
+Q_STATIC_ASSERT(sizeof(std::atomic<quint64>) == sizeof(quint64));
+
+SocketApiStatusCache::SocketApiStatusCache(const QString &fileName)
+{
+    const qint64 size = sizeof(Header) + qint64(StatusCacheCapacity) * sizeof(Entry);
+    if (!fileName.isEmpty()) {
+        _file.setFileName(fileName);
+        if (!_file.open(QIODevice::ReadWrite | QIODevice::Truncate) || !_file.resize(size)) {
+            qCWarning(lcStatusCache) << "Could not create the status cache" << fileName << _file.errorString();
+        } else {
+            _data = _file.map(0, size);
+            if (!_data)
+                qCWarning(lcStatusCache) << "Could not map the status cache" << fileName << _file.errorString();
+        }
+    }
+    _mapped = _data;
+    if (!_data) {
+        _memory.resize(size);
+        _data = reinterpret_cast<uchar *>(_memory.data());
+    }
+    memset(_data, 0, size);
+    header()->version = StatusCacheVersion;
+    header()->capacity = StatusCacheCapacity;
+    // Last, the extensions don't use the file before the magic is there
+    header()->magic = StatusCacheMagic;
+    if (_mapped)
+        qCInfo(lcStatusCache) << "Publishing the file statuses in" << fileName;
+}
+
+SocketApiStatusCache::~SocketApiStatusCache()
+{
+    if (_mapped) {
+        header()->magic = 0;
+        _file.unmap(_data);
+    }
+    if (_file.isOpen())
+        _file.remove();
+}
+
+SocketApiStatusCache::Header *SocketApiStatusCache::header() const
+{
+    return reinterpret_cast<Header *>(_data);
+}
+
+SocketApiStatusCache::Entry *SocketApiStatusCache::entries() const
+{
+    return reinterpret_cast<Entry *>(_data + sizeof(Header));
+}
+
+void SocketApiStatusCache::beginWrite()
+{
+    // Odd, the readers retry until endWrite(). The fence keeps the entry
+    // writes after it.
+    auto &sequence = header()->sequence;
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SocketApiStatusCache::endWrite()
+{
+    auto &sequence = header()->sequence;
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+quint64 SocketApiStatusCache::pathHash(const QString &systemPath)
+{
+    const QString path = QDir::toNativeSeparators(systemPath);
+    const bool caseInsensitive = Utility::fsCasePreserving();
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    for (QChar c : path) {
+        if (caseInsensitive)
+            c = c.toLower();
+        hash ^= c.unicode();
+        hash *= Q_UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+void SocketApiStatusCache::setStatus(const QString &systemPath, SyncFileStatus status)
+{
+    const quint64 hash = pathHash(systemPath);
+    const quint32 value = (status.tag() + 1) | (status.shared() ? SharedStatusFlag : 0);
+
+    const quint32 mask = StatusCacheCapacity - 1;
+    Entry *table = entries();
+    quint32 index = hash & mask;
+    // Only this thread writes, it needs no ordering for its own reads
+    while (table[index].status.load(std::memory_order_relaxed) != 0
+        && table[index].hash.load(std::memory_order_relaxed) != hash)
+        index = (index + 1) & mask;
+    Entry &entry = table[index];
+    const quint32 oldValue = entry.status.load(std::memory_order_relaxed);
+    if (oldValue == value)
+        return;
+
+    if (oldValue == 0 && _used >= StatusCacheCapacity / 4 * 3) {
+        // Too full for quick lookups, start over with the paths that are
+        // asked for from now on
+        qCInfo(lcStatusCache) << "The status cache is full, clearing it";
+        clear();
+        setStatus(systemPath, status);
+        return;
+    }
+
+    beginWrite();
+    if (oldValue == 0) {
+        entry.hash.store(hash, std::memory_order_relaxed);
+        ++_used;
+    }
+    entry.status.store(value, std::memory_order_relaxed);
+    endWrite();
+}
+
+bool SocketApiStatusCache::status(const QString &systemPath, SyncFileStatus *status) const
+{
+    const quint64 hash = pathHash(systemPath);
+    const quint32 mask = StatusCacheCapacity - 1;
+    const Entry *table = entries();
+    const auto &sequence = header()->sequence;
+    forever {
+        const quint32 before = sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            // The main thread is in the middle of a write, let it finish
+            QThread::yieldCurrentThread();
+            continue;
+        }
+        quint32 value = 0;
+        quint32 entryStatus;
+        for (quint32 index = hash & mask;
+             (entryStatus = table[index].status.load(std::memory_order_relaxed)) != 0;
+             index = (index + 1) & mask) {
+            if (table[index].hash.load(std::memory_order_relaxed) == hash) {
+                value = entryStatus;
+                break;
+            }
+        }
+        // The entry reads must not move after the second sequence read
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) != before) {
+            QThread::yieldCurrentThread();
+            continue;
+        }
+        if (value == 0)
+            return false;
+        status->set(static_cast<SyncFileStatus::SyncFileStatusTag>((value & 0xff) - 1));
+        status->setShared(value & SharedStatusFlag);
+        return true;
+    }
+}
+
+void SocketApiStatusCache::clear()
+{
+    if (_used == 0)
+        return;
+    beginWrite();
+    memset(entries(), 0, StatusCacheCapacity * sizeof(Entry));
+    endWrite();
+    _used = 0;
+}
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef SOCKETAPISTATUSCACHE_H
+#define SOCKETAPISTATUSCACHE_H
+
+#include "syncfilestatus.h"
+
+#include <QByteArray>
+#include <QFile>
+
+namespace OCC {
+
+/**
+ * @brief The file statuses, in a file the shell extensions can map
+ *
+ * The extensions look the statuses up there without a round trip through
+ * the socket and the event loop of the client. A path that is not in the
+ * cache must still be asked for with RETRIEVE_FILE_STATUS; the socket also
+ * keeps carrying the STATUS and UPDATE_VIEW messages, they tell the
+ * extensions when to look again.
+ *
+ * The layout, in native byte order:
+ *
+ *   offset 0   quint32 magic, 0x4353434f
+ *   offset 4   quint32 version, 1
+ *   offset 8   quint32 sequence
+ *   offset 12  quint32 capacity, a power of two
+ *   offset 16  capacity entries of { quint64 hash; quint32 status; quint32 reserved; }
+ *
+ * The hash is the 64 bit FNV-1a of the UTF-16 code units of the path, as
+ * sent in the STATUS messages (native separators, no trailing slash). On
+ * Windows and macOS the code units are lower cased first. An entry is at
+ * index hash & (capacity - 1) or in one of the next ones, the lookup stops
+ * at an entry with status 0. The status is SyncFileStatusTag + 1, with
+ * 0x100 set for shared files.
+ *
+ * Only the client writes, from the main thread. The sequence is odd while
+ * it does, a reader reads it before and after the lookup and retries if
+ * it was odd or changed. The socket thread of the client reads it the
+ * same way; without a file name, or if the file can't be created, the
+ * table is only in memory for it.
+ *
+ * @ingroup gui
+ */
+class SocketApiStatusCache
+{
+public:
+    explicit SocketApiStatusCache(const QString &fileName);
+    ~SocketApiStatusCache();
+
+    /** Whether the extensions can map it, otherwise fileName() is empty */
+    bool isShared() const { return _mapped; }
+    QString fileName() const { return _mapped ? _file.fileName() : QString(); }
+
+    /** Stores the status of @a systemPath, with or without native separators */
+    void setStatus(const QString &systemPath, SyncFileStatus status);
+
+    /** Looks @a systemPath up, safe from any thread */
+    bool status(const QString &systemPath, SyncFileStatus *status) const;
+
+    /** Removes all the entries, the extensions then ask the socket again */
+    void clear();
+
+    static quint64 pathHash(const QString &systemPath);
+
+private:
+    struct Header;
+    struct Entry;
+
+    Header *header() const;
+    Entry *entries() const;
+    void beginWrite();
+    void endWrite();
+
+    QFile _file;
+    QByteArray _memory; // when the file could not be mapped
+    bool _mapped = false;
+    uchar *_data = nullptr;
+    quint32 _used = 0;
+};
+}
+
+#endif
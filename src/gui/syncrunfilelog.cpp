@@ -17,12 +17,52 @@
 #include "syncrunfilelog.h"
 #include "common/utility.h"
 #include "filesystem.h"
+#include "theme.h"
 #include <qfileinfo.h>
+#include <QJsonDocument>
+#include <QtConcurrent>
 
 namespace OCC {
 
+// When a log file is renamed to an old name
+static const qint64 logfileMaxSize = 1024 * 1024; // 1MiB
+
+// The lines of this many items are written together
+static const int itemsPerBatch = 100;
+
+static QString csvField(const QString &value)
+{
+    if (!value.contains(QLatin1Char(',')) && !value.contains(QLatin1Char('"')) && !value.contains(QLatin1Char('\n')))
+        return value;
+    QString quoted = value;
+    quoted.replace(QLatin1Char('"'), QLatin1String("\"\""));
+    return QLatin1Char('"') + quoted + QLatin1Char('"');
+}
+
 SyncRunFileLog::SyncRunFileLog()
+    : _csv(qgetenv("OWNCLOUD_SYNC_LOG_FORMAT") == "csv")
+    , _bufferedItems(0)
+{
+    _writer.setMaxThreadCount(1);
+    _out.setString(&_buffer);
+}
+
+SyncRunFileLog::~SyncRunFileLog()
+{
+    flush();
+    _writer.waitForDone();
+}
+
+QString SyncRunFileLog::header() const
 {
+    if (_csv) {
+        return QLatin1String("timestamp,file,instruction,dir,modtime,etag,size,fileId,status,"
+                             "errorString,http result code,other size,other modtime");
+    }
+    return QLatin1String("# timestamp | duration | file | instruction | dir | modtime | etag | "
+                         "size | fileId | status | errorString | http result code | "
+                         "other size | other modtime | other etag | other fileId | "
+                         "other instruction");
 }
 
 QString SyncRunFileLog::dateTimeStr(const QDateTime &dt)
@@ -93,41 +133,72 @@ QString SyncRunFileLog::instructionToStr(csync_instructions_e inst)
 
 void SyncRunFileLog::start(const QString &folderPath)
 {
-    const qint64 logfileMaxSize = 1024 * 1024; // 1MiB
-
     // Note; this name is ignored in csync_exclude.c
-    const QString filename = folderPath + QLatin1String(".owncloudsync.log");
+    // The writer gets its own copy, the next run may set another name meanwhile
+    _filename = folderPath + QLatin1String(_csv ? ".owncloudsync.log.csv" : ".owncloudsync.log");
+    const QString fileName = _filename;
+    QtConcurrent::run(&_writer, [this, fileName] { openFile(fileName); });
+
+    _totalDuration.start();
+    _lapDuration.start();
+    if (!_csv)
+        _out << "#=#=#=# Syncrun started " << dateTimeStr(QDateTime::currentDateTimeUtc()) << '\n';
+}
 
+void SyncRunFileLog::flush()
+{
+    _out.flush();
+    _bufferedItems = 0;
+    if (_buffer.isEmpty())
+        return;
+    QString batch;
+    batch.swap(_buffer);
+    QtConcurrent::run(&_writer, [this, batch] { writeBatch(batch); });
+}
+
+void SyncRunFileLog::openFile(const QString &fileName)
+{
     // When the file is too big, just rename it to an old name.
-    QFileInfo info(filename);
+    QFileInfo info(fileName);
     bool exists = info.exists();
     if (exists && info.size() > logfileMaxSize) {
         exists = false;
-        QString newFilename = filename + QLatin1String(".1");
+        QString newFilename = fileName + QLatin1String(".1");
         QFile::remove(newFilename);
-        QFile::rename(filename, newFilename);
+        QFile::rename(fileName, newFilename);
     }
-    _file.reset(new QFile(filename));
-
-    _file->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text);
-    _out.setDevice(_file.data());
+    _file.reset(new QFile(fileName));
 
+    if (!_file->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        return;
 
     if (!exists) {
         // We are creating a new file, add the note.
-        _out << "# timestamp | duration | file | instruction | dir | modtime | etag | "
-                "size | fileId | status | errorString | http result code | "
-                "other size | other modtime | other etag | other fileId | "
-                "other instruction"
-             << endl;
+        _file->write(header().toUtf8() + '\n');
 
-        FileSystem::setFileHidden(filename, true);
+        FileSystem::setFileHidden(fileName, true);
     }
+}
 
+void SyncRunFileLog::writeBatch(const QString &batch)
+{
+    if (!_file || !_file->isOpen())
+        return;
+    _file->write(batch.toUtf8());
+    _file->flush();
 
-    _totalDuration.start();
-    _lapDuration.start();
-    _out << "#=#=#=# Syncrun started " << dateTimeStr(QDateTime::currentDateTimeUtc()) << endl;
+    // A large sync continues in a new file
+    if (_file->size() > logfileMaxSize) {
+        const QString fileName = _file->fileName();
+        _file->close();
+        openFile(fileName);
+    }
+}
+
+void SyncRunFileLog::closeFile()
+{
+    if (_file)
+        _file->close();
 }
 
 void SyncRunFileLog::logItem(const SyncFileItem &item)
@@ -144,6 +215,35 @@ void SyncRunFileLog::logItem(const SyncFileItem &item)
         }
     }
 
+    if (_csv) {
+        const QChar C = QLatin1Char(',');
+        _out << ts << C;
+        if (item._instruction != CSYNC_INSTRUCTION_RENAME) {
+            _out << csvField(item._file) << C;
+        } else {
+            _out << csvField(item._file + QLatin1String(" -> ") + item._renameTarget) << C;
+        }
+        _out << instructionToStr(item._instruction) << C
+             << directionToStr(item._direction) << C
+             << item._modtime << C
+             << csvField(QString::fromUtf8(item._etag)) << C
+             << item._size << C
+             << csvField(QString::fromUtf8(item._fileId)) << C
+             << item._status << C
+             << csvField(item._errorString) << C
+             << item._httpErrorCode << C
+             << item._previousSize << C
+             << item._previousModtime << '\n';
+    } else {
+        writeTextItem(item, ts);
+    }
+
+    if (++_bufferedItems >= itemsPerBatch)
+        flush();
+}
+
+void SyncRunFileLog::writeTextItem(const SyncFileItem &item, const QString &ts)
+{
     const QChar L = QLatin1Char('|');
     _out << ts << L;
     _out << L;
@@ -167,21 +267,64 @@ void SyncRunFileLog::logItem(const SyncFileItem &item)
     _out /* << other fileId (removed) */ << L;
     _out /* << other instruction (removed) */ << L;
 
-    _out << endl;
+    _out << '\n';
 }
 
 void SyncRunFileLog::logLap(const QString &name)
 {
+    if (_csv) {
+        _lapDuration.restart();
+        return;
+    }
     _out << "#=#=#=#=# " << name << " " << dateTimeStr(QDateTime::currentDateTimeUtc())
          << " (last step: " << _lapDuration.restart() << " msec"
-         << ", total: " << _totalDuration.elapsed() << " msec)" << endl;
+         << ", total: " << _totalDuration.elapsed() << " msec)" << '\n';
+    flush();
+}
+
+void SyncRunFileLog::logMetrics(const QString &folderPath, const SyncRunMetrics &metrics)
+{
+    static bool enabled = !qEnvironmentVariableIsEmpty("OWNCLOUD_SYNC_METRICS_LOG");
+    if (!enabled)
+        return;
+
+    const qint64 logfileMaxSize = 1024 * 1024; // 1MiB
+
+    // Note; this name is ignored in csync_exclude.c, like the log
+    const QString filename = folderPath + QLatin1String(".owncloudsync.log.metrics");
+
+    QFileInfo info(filename);
+    bool exists = info.exists();
+    if (exists && info.size() > logfileMaxSize) {
+        exists = false;
+        QString newFilename = filename + QLatin1String(".1");
+        QFile::remove(newFilename);
+        QFile::rename(filename, newFilename);
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        return;
+    }
+    if (!exists) {
+        FileSystem::setFileHidden(filename, true);
+    }
+
+    QJsonObject json = metrics.toJson();
+    json.insert(QStringLiteral("finished"), QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    json.insert(QStringLiteral("clientVersion"), Theme::instance()->version());
+    file.write(QJsonDocument(json).toJson(QJsonDocument::Compact));
+    file.write("\n");
 }
 
 void SyncRunFileLog::finish()
 {
-    _out << "#=#=#=# Syncrun finished " << dateTimeStr(QDateTime::currentDateTimeUtc())
-         << " (last step: " << _lapDuration.elapsed() << " msec"
-         << ", total: " << _totalDuration.elapsed() << " msec)" << endl;
-    _file->close();
+    if (!_csv) {
+        _out << "#=#=#=# Syncrun finished " << dateTimeStr(QDateTime::currentDateTimeUtc())
+             << " (last step: " << _lapDuration.elapsed() << " msec"
+             << ", total: " << _totalDuration.elapsed() << " msec)" << '\n';
+    }
+    flush();
+    QtConcurrent::run(&_writer, [this] { closeFile(); });
 }
 }
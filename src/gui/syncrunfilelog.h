@@ -19,33 +19,66 @@
 #include <QTextStream>
 #include <QScopedPointer>
 #include <QElapsedTimer>
+#include <QThreadPool>
 
 #include "syncfileitem.h"
+#include "syncrunmetrics.h"
 
 namespace OCC {
 class SyncFileItem;
 
 /**
  * @brief The SyncRunFileLog class
+ *
+ * The lines are collected and written in batches by a thread of the log,
+ * the items of a sync are completed in the GUI thread. Beyond 1 MiB the
+ * file is renamed to an old name and a new one started, also during a run.
+ *
+ * With OWNCLOUD_SYNC_LOG_FORMAT=csv the items are written to
+ * .owncloudsync.log.csv instead, as comma separated values without the
+ * columns that are always empty.
+ *
  * @ingroup gui
  */
 class SyncRunFileLog
 {
 public:
     SyncRunFileLog();
+    ~SyncRunFileLog();
     void start(const QString &folderPath);
     void logItem(const SyncFileItem &item);
     void logLap(const QString &name);
     void finish();
 
+    /**
+     * Appends @a metrics as a line of JSON to a file next to the log.
+     *
+     * Only done if OWNCLOUD_SYNC_METRICS_LOG is set.
+     */
+    static void logMetrics(const QString &folderPath, const SyncRunMetrics &metrics);
+
 protected:
 private:
     QString dateTimeStr(const QDateTime &dt);
     QString instructionToStr(csync_instructions_e inst);
     QString directionToStr(SyncFileItem::Direction dir);
+    QString header() const;
+    void writeTextItem(const SyncFileItem &item, const QString &ts);
+
+    /** Hands the collected lines to the writer */
+    void flush();
+    // In the writer thread
+    void openFile(const QString &fileName);
+    void writeBatch(const QString &batch);
+    void closeFile();
 
-    QScopedPointer<QFile> _file;
-    QTextStream _out;
+    bool _csv;
+    QString _filename; // only used by the GUI thread
+    QScopedPointer<QFile> _file; // only used by the writer
+    QString _buffer;
+    QTextStream _out; // into _buffer
+    int _bufferedItems;
+    QThreadPool _writer; // one thread, the batches stay in order
     QElapsedTimer _totalDuration;
     QElapsedTimer _lapDuration;
 };
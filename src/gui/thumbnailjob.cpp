@@ -26,13 +26,37 @@ ThumbnailJob::ThumbnailJob(const QString &path, AccountPtr account, QObject *par
 
 void ThumbnailJob::start()
 {
-    sendRequest("GET", makeAccountUrl(path()));
-    AbstractNetworkJob::start();
+    _url = makeAccountUrl(path());
+    ImageCache::lookup(*account(), _url, this, [this](bool found, const ImageCache::Entry &entry, bool fresh) {
+        if (found && fresh) {
+            emit jobFinished(200, entry.data);
+            deleteLater();
+            return;
+        }
+        _cached = entry;
+        ImageCache::enqueueFetch(this, [this] {
+            QNetworkRequest req;
+            req.setPriority(QNetworkRequest::LowPriority);
+            if (!_cached.etag.isEmpty())
+                req.setRawHeader("If-None-Match", _cached.etag);
+            sendRequest("GET", _url, req);
+            AbstractNetworkJob::start();
+        });
+    });
 }
 
 bool ThumbnailJob::finished()
 {
-    emit jobFinished(reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), reply()->readAll());
+    int statusCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QByteArray data = reply()->readAll();
+    if (statusCode == 304) {
+        ImageCache::insert(*account(), _url, ImageCache::Entry());
+        statusCode = 200;
+        data = _cached.data;
+    } else if (statusCode == 200) {
+        ImageCache::insert(*account(), _url, ImageCache::Entry{ reply()->rawHeader("ETag"), data });
+    }
+    emit jobFinished(statusCode, data);
     return true;
 }
 }
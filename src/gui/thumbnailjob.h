@@ -17,6 +17,7 @@
 
 #include "networkjobs.h"
 #include "accountfwd.h"
+#include "imagecache.h"
 
 namespace OCC {
 
@@ -26,6 +27,7 @@ namespace OCC {
  *
  * Job that allows fetching a preview (of 150x150 for now) of a given file.
  * Once the job has finished the jobFinished signal will be emitted.
+ * The preview is kept in the ImageCache.
  */
 class ThumbnailJob : public AbstractNetworkJob
 {
@@ -46,6 +48,10 @@ signals:
     void jobFinished(int statusCode, QByteArray reply);
 private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
+
+private:
+    QUrl _url;
+    ImageCache::Entry _cached;
 };
 }
 
@@ -16,6 +16,8 @@
 #include "configfile.h"
 #include "common/utility.h"
 #include "accessmanager.h"
+#include "bandwidthbudget.h"
+#include "progressdispatcher.h"
 
 #include "updater/ocupdater.h"
 
@@ -34,6 +36,15 @@ static const char updateTargetVersionC[] = "Updater/updateTargetVersion";
 static const char seenVersionC[] = "Updater/seenVersion";
 static const char autoUpdateFailedVersionC[] = "Updater/autoUpdateFailedVersion";
 static const char autoUpdateAttemptedC[] = "Updater/autoUpdateAttempted";
+static const char partialDownloadEtagC[] = "Updater/partialDownloadEtag";
+
+// The installer download reads this much at a time, see NSISUpdater::slotWriteFile()
+static const qint64 DownloadReadBufferSize = 64 * 1024;
+static const int DownloadThrottleIntervalMs = 100;
+// While folders sync, see NSISUpdater::downloadRate()
+static const qint64 DownloadRateWhileSyncing = 50 * 1000;
+// The syncs report their progress at least this often
+static const qint64 SyncActivityMs = 5 * 1000;
 
 
 UpdaterScheduler::UpdaterScheduler(QObject *parent)
@@ -246,34 +257,176 @@ void OCUpdater::slotTimedOut()
 
 NSISUpdater::NSISUpdater(const QUrl &url)
     : OCUpdater(url)
+    , _downloadAllowance(0)
+    , _configuredDownloadLimit(0)
     , _showFallbackMessage(false)
 {
+    _downloadThrottleTimer.setInterval(DownloadThrottleIntervalMs);
+    connect(&_downloadThrottleTimer, &QTimer::timeout, this, &NSISUpdater::slotRefillDownloadAllowance);
+
+    connect(ProgressDispatcher::instance(), &ProgressDispatcher::progressInfo, this,
+        [this](const QString &, const ProgressInfo &progress) {
+            if (progress.status() != ProgressInfo::Done)
+                _lastSyncActivity.start();
+        });
+}
+
+// The first byte of a 206 reply, -1 if there is none
+static qint64 contentRangeStart(QNetworkReply *reply)
+{
+    // "bytes 100-999/1000"
+    const QByteArray range = reply->rawHeader("Content-Range");
+    if (!range.startsWith("bytes "))
+        return -1;
+    bool ok = false;
+    const qint64 start = range.mid(6, range.indexOf('-') - 6).toLongLong(&ok);
+    return ok ? start : -1;
+}
+
+void NSISUpdater::startDownload(const QUrl &url)
+{
+    _file.setFileName(_targetFile + QLatin1String(".part"));
+
+    QNetworkRequest request(url);
+    request.setPriority(QNetworkRequest::LowPriority);
+    if (_file.size() > 0) {
+        ConfigFile cfg;
+        QSettings settings(cfg.configFile(), QSettings::IniFormat);
+        const QByteArray etag = settings.value(partialDownloadEtagC).toByteArray();
+        if (etag.isEmpty()) {
+            // Without the etag a changed installer on the server can't be told apart
+            qCInfo(lcUpdater) << "Dropping the partial download" << _file.fileName() << "without an etag";
+            _file.remove();
+        } else {
+            qCInfo(lcUpdater) << "Continuing the download of" << url.toString() << "at" << _file.size();
+            request.setRawHeader("Range", "bytes=" + QByteArray::number(_file.size()) + '-');
+            // The server sends the whole file with a 200 if it changed since
+            request.setRawHeader("If-Range", etag);
+        }
+    }
+
+    ConfigFile cfg;
+    _configuredDownloadLimit = cfg.useDownloadLimit() >= 1 ? cfg.downloadLimit() * 1000 : 0;
+    BandwidthBudget::instance()->setWeight(this, BandwidthBudget::Download, 1);
+    _downloadAllowance = 0;
+
+    _reply = qnam()->get(request);
+    // Data that isn't read stays with the server, that is what throttles
+    _reply->setReadBufferSize(DownloadReadBufferSize);
+    connect(_reply.data(), &QIODevice::readyRead, this, &NSISUpdater::slotWriteFile);
+    connect(_reply.data(), &QNetworkReply::finished, this, &NSISUpdater::slotDownloadFinished);
+    setDownloadState(Downloading);
+}
+
+qint64 NSISUpdater::downloadRate()
+{
+    // The relative limits need the speed that only the syncs measure
+    auto budget = BandwidthBudget::instance();
+    const qint64 limit = budget->limit(BandwidthBudget::Download, _configuredDownloadLimit);
+    qint64 rate = limit > 0 ? budget->share(this, BandwidthBudget::Download, limit) : 0;
+    if (_lastSyncActivity.isValid() && _lastSyncActivity.elapsed() < SyncActivityMs)
+        rate = rate > 0 ? qMin(rate, DownloadRateWhileSyncing) : DownloadRateWhileSyncing;
+    return rate;
+}
+
+void NSISUpdater::slotRefillDownloadAllowance()
+{
+    const qint64 rate = downloadRate();
+    if (rate <= 0) {
+        _downloadThrottleTimer.stop();
+    } else {
+        // At most a second worth of data at once
+        _downloadAllowance = qMin(rate, _downloadAllowance + rate * DownloadThrottleIntervalMs / 1000);
+    }
+    slotWriteFile();
 }
 
 void NSISUpdater::slotWriteFile()
 {
-    QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
-    if (_file->isOpen()) {
-        _file->write(reply->readAll());
+    if (!_reply || _reply->bytesAvailable() <= 0)
+        return;
+
+    const int httpStatus = _reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (httpStatus != 200 && httpStatus != 206)
+        return; // an error page
+
+    if (!_file.isOpen()) {
+        // 206 continues the partial file, 200 starts over
+        QIODevice::OpenMode mode = QIODevice::WriteOnly | QIODevice::Truncate;
+        if (httpStatus == 206) {
+            if (contentRangeStart(_reply) != _file.size()) {
+                qCWarning(lcUpdater) << "Unexpected range" << _reply->rawHeader("Content-Range") << "for" << _file.size();
+                _file.remove();
+                _reply->abort();
+                return;
+            }
+            mode = QIODevice::Append;
+        } else if (_file.size() > 0) {
+            qCInfo(lcUpdater) << "The installer changed, restarting its download";
+        }
+        if (!_file.open(mode)) {
+            qCWarning(lcUpdater) << "Could not write" << _file.fileName() << _file.errorString();
+            _reply->abort();
+            return;
+        }
+        if (httpStatus == 200) {
+            // The partial file is only continued if it is still the same installer
+            ConfigFile cfg;
+            QSettings settings(cfg.configFile(), QSettings::IniFormat);
+            const QByteArray etag = _reply->rawHeader("ETag");
+            if (etag.isEmpty())
+                settings.remove(partialDownloadEtagC);
+            else
+                settings.setValue(partialDownloadEtagC, etag);
+        }
+    }
+
+    qint64 bytes = _reply->bytesAvailable();
+    if (downloadRate() > 0) {
+        // The rest when slotRefillDownloadAllowance() allows it
+        if (!_downloadThrottleTimer.isActive())
+            _downloadThrottleTimer.start();
+        bytes = qMin(bytes, _downloadAllowance);
+        _downloadAllowance -= bytes;
     }
+    if (bytes > 0)
+        _file.write(_reply->read(bytes));
 }
 
 void NSISUpdater::slotDownloadFinished()
 {
     QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
     reply->deleteLater();
+
+    // What is left is at most the read buffer, the partial file keeps it for the next attempt
+    _downloadAllowance = reply->bytesAvailable();
+    slotWriteFile();
+    _reply.clear();
+    _file.close();
+    _downloadThrottleTimer.stop();
+    BandwidthBudget::instance()->setWeight(this, BandwidthBudget::Download, 0);
+
     if (reply->error() != QNetworkReply::NoError) {
+        qCWarning(lcUpdater) << "Downloading" << reply->url().toString() << "failed:" << reply->errorString();
+        // The partial file is complete already or does not match anymore
+        if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 416)
+            _file.remove();
         setDownloadState(DownloadFailed);
         return;
     }
 
     QUrl url(reply->url());
-    _file->close();
-    QFile::copy(_file->fileName(), _targetFile);
+    QFile::remove(_targetFile);
+    if (!_file.rename(_targetFile)) {
+        qCWarning(lcUpdater) << "Could not move" << _file.fileName() << "to" << _targetFile << _file.errorString();
+        setDownloadState(DownloadFailed);
+        return;
+    }
     setDownloadState(DownloadComplete);
     qCInfo(lcUpdater) << "Downloaded" << url.toString() << "to" << _targetFile;
     ConfigFile cfg;
     QSettings settings(cfg.configFile(), QSettings::IniFormat);
+    settings.remove(partialDownloadEtagC);
     settings.setValue(updateTargetVersionC, updateInfo().version());
     settings.setValue(updateAvailableC, _targetFile);
 }
@@ -302,13 +455,7 @@ void NSISUpdater::versionInfoArrived(const UpdateInfo &info)
             if (QFile(_targetFile).exists()) {
                 setDownloadState(DownloadComplete);
             } else {
-                QNetworkReply *reply = qnam()->get(QNetworkRequest(QUrl(url)));
-                connect(reply, &QIODevice::readyRead, this, &NSISUpdater::slotWriteFile);
-                connect(reply, &QNetworkReply::finished, this, &NSISUpdater::slotDownloadFinished);
-                setDownloadState(Downloading);
-                _file.reset(new QTemporaryFile);
-                _file->setAutoRemove(true);
-                _file->open();
+                startDownload(QUrl(url));
             }
         }
     }
@@ -15,9 +15,11 @@
 #ifndef OCUPDATER_H
 #define OCUPDATER_H
 
+#include <QElapsedTimer>
+#include <QFile>
 #include <QObject>
+#include <QPointer>
 #include <QUrl>
-#include <QTemporaryFile>
 #include <QTimer>
 
 #include "updater/updateinfo.h"
@@ -140,6 +142,15 @@ private:
 /**
  * @brief Windows Updater Using NSIS
  * @ingroup gui
+ *
+ * The installer is downloaded in the background next to the config file.
+ * A download that fails or is interrupted by a restart is continued from
+ * where it stopped with the next update check, as long as the installer on
+ * the server still has the same etag (If-Range).
+ *
+ * The download has a low priority: it takes a share of the absolute download
+ * limit like a folder would, see BandwidthBudget, and while folders sync it is
+ * slowed down to DownloadRateWhileSyncing.
  */
 class NSISUpdater : public OCUpdater
 {
@@ -154,12 +165,24 @@ private slots:
     void slotSetSeenVersion();
     void slotDownloadFinished();
     void slotWriteFile();
+    void slotRefillDownloadAllowance();
 
 private:
     NSISUpdater::UpdateState updateStateOnStart();
     void showDialog(const UpdateInfo &info);
     void versionInfoArrived(const UpdateInfo &info) Q_DECL_OVERRIDE;
-    QScopedPointer<QTemporaryFile> _file;
+
+    /** Downloads @a url to _targetFile, continuing the partial file of an earlier attempt */
+    void startDownload(const QUrl &url);
+    /** Bytes per second the download may use now, 0 for no limit */
+    qint64 downloadRate();
+
+    QFile _file; // the partial download, renamed to _targetFile when complete
+    QPointer<QNetworkReply> _reply;
+    QTimer _downloadThrottleTimer;
+    qint64 _downloadAllowance;
+    qint64 _configuredDownloadLimit;
+    QElapsedTimer _lastSyncActivity;
     QString _targetFile;
     bool _showFallbackMessage;
 };
@@ -33,6 +33,7 @@
 #include "owncloudpropagator.h"
 
 #include "creds/abstractcredentials.h"
+#include "common/tracing.h"
 
 Q_DECLARE_METATYPE(QTimer *)
 
@@ -43,9 +44,24 @@ Q_LOGGING_CATEGORY(lcNetworkJob, "sync.networkjob", QtInfoMsg)
 // If not set, it is overwritten by the Application constructor with the value from the config
 int AbstractNetworkJob::httpTimeout = qEnvironmentVariableIntValue("OWNCLOUD_TIMEOUT");
 
+// Enough for a request that still moves data to show it, short compared
+// to waiting for the regular timeout on a connection of the old network
+qint64 AbstractNetworkJob::networkChangeTimeoutMsec = 15 * 1000;
+
+// A connection that moves data doesn't pause for long, a stuck one shouldn't
+// hold the transfer slot for the whole regular timeout
+qint64 AbstractNetworkJob::stallTimeoutMsec = (qEnvironmentVariableIsSet("OWNCLOUD_STALL_TIMEOUT")
+                                                  ? qEnvironmentVariableIntValue("OWNCLOUD_STALL_TIMEOUT")
+                                                  : 60)
+    * 1000;
+
+// What the server gets through at the least when it works on the uploaded data
+static const qint64 MinProcessingBytesPerMsec = 1000;
+
 AbstractNetworkJob::AbstractNetworkJob(AccountPtr account, const QString &path, QObject *parent)
     : QObject(parent)
     , _timedout(false)
+    , _traceStart(-1)
     , _followRedirects(true)
     , _account(account)
     , _ignoreCredentialFailure(false)
@@ -53,8 +69,9 @@ AbstractNetworkJob::AbstractNetworkJob(AccountPtr account, const QString &path,
     , _path(path)
     , _redirectCount(0)
 {
+    _timeoutMsec = (httpTimeout ? httpTimeout : 300) * 1000; // default to 5 minutes.
     _timer.setSingleShot(true);
-    _timer.setInterval((httpTimeout ? httpTimeout : 300) * 1000); // default to 5 minutes.
+    _timer.setInterval(_timeoutMsec);
     connect(&_timer, &QTimer::timeout, this, &AbstractNetworkJob::slotTimeout);
 
     connect(this, &AbstractNetworkJob::networkActivity, this, &AbstractNetworkJob::resetTimeout);
@@ -63,7 +80,8 @@ AbstractNetworkJob::AbstractNetworkJob(AccountPtr account, const QString &path,
     // This is a workaround for OC instances which only support one
     // parallel up and download
     if (_account) {
-        connect(_account.data(), &Account::propagatorNetworkActivity, this, &AbstractNetworkJob::resetTimeout);
+        connect(_account.data(), &Account::propagatorNetworkActivity, this, &AbstractNetworkJob::slotAccountNetworkActivity);
+        connect(_account.data(), &Account::networkChanged, this, &AbstractNetworkJob::slotNetworkChanged);
     }
 }
 
@@ -79,14 +97,60 @@ void AbstractNetworkJob::setReply(QNetworkReply *reply)
 
 void AbstractNetworkJob::setTimeout(qint64 msec)
 {
-    _timer.start(msec);
+    _timeoutMsec = msec;
+    _networkChangeTimeout = false;
+    _timer.start(currentTimeoutMsec());
 }
 
 void AbstractNetworkJob::resetTimeout()
 {
-    qint64 interval = _timer.interval();
+    // The request still works, also after a network change
+    _networkChangeTimeout = false;
     _timer.stop();
-    _timer.start(interval);
+    _timer.start(currentTimeoutMsec());
+}
+
+void AbstractNetworkJob::setProcessingSize(qint64 bytes)
+{
+    _processingSize = bytes;
+}
+
+qint64 AbstractNetworkJob::currentTimeoutMsec() const
+{
+    if (_transferring && stallTimeoutMsec > 0)
+        return qMin(_timeoutMsec, stallTimeoutMsec);
+    return qMax(_timeoutMsec, _processingSize / MinProcessingBytesPerMsec);
+}
+
+void AbstractNetworkJob::slotUploadProgress(qint64 sent, qint64 total)
+{
+    _transferring = sent > 0 && sent < total;
+    if (total > 0 && sent == total)
+        _processingSize = qMax(_processingSize, total);
+    emit networkActivity();
+}
+
+void AbstractNetworkJob::slotDownloadProgress(qint64 received, qint64 total)
+{
+    _transferring = received > 0 && received != total;
+    emit networkActivity();
+}
+
+void AbstractNetworkJob::slotNetworkChanged()
+{
+    // The connection may be gone without anything telling us; only the
+    // requests that get data in the meantime keep their regular timeout
+    if (!_timer.isActive() || _timer.remainingTime() <= networkChangeTimeoutMsec)
+        return;
+    _networkChangeTimeout = true;
+    _timer.start(networkChangeTimeoutMsec);
+}
+
+void AbstractNetworkJob::slotAccountNetworkActivity()
+{
+    // The other requests, likely on new connections, don't vouch for this one
+    if (!_networkChangeTimeout)
+        resetTimeout();
 }
 
 void AbstractNetworkJob::setIgnoreCredentialFailure(bool ignore)
@@ -111,8 +175,8 @@ void AbstractNetworkJob::setupConnections(QNetworkReply *reply)
     connect(reply->manager(), &QNetworkAccessManager::proxyAuthenticationRequired, this, &AbstractNetworkJob::networkActivity);
     connect(reply, &QNetworkReply::sslErrors, this, &AbstractNetworkJob::networkActivity);
     connect(reply, &QNetworkReply::metaDataChanged, this, &AbstractNetworkJob::networkActivity);
-    connect(reply, &QNetworkReply::downloadProgress, this, &AbstractNetworkJob::networkActivity);
-    connect(reply, &QNetworkReply::uploadProgress, this, &AbstractNetworkJob::networkActivity);
+    connect(reply, &QNetworkReply::downloadProgress, this, &AbstractNetworkJob::slotDownloadProgress);
+    connect(reply, &QNetworkReply::uploadProgress, this, &AbstractNetworkJob::slotUploadProgress);
 }
 
 QNetworkReply *AbstractNetworkJob::addTimer(QNetworkReply *reply)
@@ -124,6 +188,8 @@ QNetworkReply *AbstractNetworkJob::addTimer(QNetworkReply *reply)
 QNetworkReply *AbstractNetworkJob::sendRequest(const QByteArray &verb, const QUrl &url,
     QNetworkRequest req, QIODevice *requestBody)
 {
+    _traceStart = Tracing::isEnabled() ? Tracing::now() : -1;
+    _transferring = false;
     auto reply = _account->sendRawRequest(verb, url, req, requestBody);
     _requestBody = requestBody;
     if (_requestBody) {
@@ -155,10 +221,30 @@ void AbstractNetworkJob::slotFinished()
 {
     _timer.stop();
 
+    if (_traceStart >= 0) {
+        Tracing::addAsyncSpan("network",
+            QString::fromLatin1(metaObject()->className()) + QLatin1Char(' ') + QString::fromLatin1(requestVerb(*_reply)),
+            _traceStart,
+            path() + QLatin1String(" HTTP ") + _reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toString());
+    }
+
     if (_reply->error() == QNetworkReply::SslHandshakeFailedError) {
         qCWarning(lcNetworkJob) << "SslHandshakeFailedError: " << errorString() << " : can be caused by a webserver wanting SSL client certificates";
     }
 
+    AbstractCredentials *creds = _account->credentials();
+    if (!_resentAfterRefresh && creds->retryAfterRefresh(_reply)
+        && !(_requestBody && _requestBody->isSequential()) && !requestVerb(*_reply).isEmpty()) {
+        _resentAfterRefresh = true;
+        qCInfo(lcNetworkJob) << "Sending" << path() << "again with the renewed access token";
+        if (creds->isRefreshing()) {
+            connect(creds, &AbstractCredentials::fetched, this, &AbstractNetworkJob::slotResendAfterRefresh);
+        } else {
+            QMetaObject::invokeMethod(this, "slotResendAfterRefresh", Qt::QueuedConnection);
+        }
+        return;
+    }
+
     if (_reply->error() != QNetworkReply::NoError) {
         if (!_ignoreCredentialFailure || _reply->error() != QNetworkReply::AuthenticationRequiredError) {
             qCWarning(lcNetworkJob) << _reply->error() << errorString()
@@ -225,7 +311,6 @@ void AbstractNetworkJob::slotFinished()
         }
     }
 
-    AbstractCredentials *creds = _account->credentials();
     if (!creds->stillValid(_reply) && !_ignoreCredentialFailure) {
         _account->handleInvalidCredentials();
     }
@@ -237,6 +322,19 @@ void AbstractNetworkJob::slotFinished()
     }
 }
 
+void AbstractNetworkJob::slotResendAfterRefresh()
+{
+    disconnect(_account->credentials(), &AbstractCredentials::fetched, this, &AbstractNetworkJob::slotResendAfterRefresh);
+    if (!_reply)
+        return;
+    resetTimeout();
+    if (_requestBody) {
+        _requestBody->seek(0);
+    }
+    // The credentials put the new token on the copy of the request
+    sendRequest(requestVerb(*_reply), _reply->request().url(), _reply->request(), _requestBody);
+}
+
 QByteArray AbstractNetworkJob::responseTimestamp()
 {
     return _responseTimestamp;
@@ -283,7 +381,7 @@ AbstractNetworkJob::~AbstractNetworkJob()
 
 void AbstractNetworkJob::start()
 {
-    _timer.start();
+    _timer.start(currentTimeoutMsec());
 
     const QUrl url = account()->url();
     const QString displayUrl = QString("%1://%2%3").arg(url.scheme()).arg(url.host()).arg(url.path());
@@ -294,6 +392,13 @@ void AbstractNetworkJob::start()
 
 void AbstractNetworkJob::slotTimeout()
 {
+    if (_transferring && !_networkChangeTimeout) {
+        if (isTransferHeld()) {
+            _timer.start(currentTimeoutMsec());
+            return;
+        }
+        qCWarning(lcNetworkJob) << "Transfer stalled for" << _timer.interval() << "ms";
+    }
     _timedout = true;
     qCWarning(lcNetworkJob) << "Network job timeout" << (reply() ? reply()->request().url() : path());
     onTimedOut();
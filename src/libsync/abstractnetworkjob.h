@@ -70,9 +70,17 @@ public:
 
     QByteArray responseTimestamp();
 
-    qint64 timeoutMsec() const { return _timer.interval(); }
+    qint64 timeoutMsec() const { return _timeoutMsec; }
     bool timedOut() const { return _timedout; }
 
+    /** The server works on this many bytes after the request was sent,
+     * like when it assembles the chunks of a file.
+     *
+     * The timeout for the reply grows with it. Uploads set it by themselves
+     * once their body is sent.
+     */
+    void setProcessingSize(qint64 bytes);
+
     /** Returns an error message, if any. */
     QString errorString() const;
 
@@ -92,6 +100,14 @@ public:
      */
     static int httpTimeout;
 
+    /** How long a request may go without any data after Account::networkChanged() */
+    static qint64 networkChangeTimeoutMsec;
+
+    /** How long a transfer may go without progress while it moves data,
+     * OWNCLOUD_STALL_TIMEOUT in seconds. 0 disables the stall detection.
+     */
+    static qint64 stallTimeoutMsec;
+
 public slots:
     void setTimeout(qint64 msec);
     void resetTimeout();
@@ -166,8 +182,14 @@ protected:
      */
     virtual void onTimedOut();
 
+    /** Whether the data is held back on purpose, like by the bandwidth
+     * manager, then no progress isn't a stall.
+     */
+    virtual bool isTransferHeld() const { return false; }
+
     QByteArray _responseTimestamp;
     bool _timedout; // set to true when the timeout slot is received
+    qint64 _traceStart; // of the current request, -1 when not tracing
 
     // Automatically follows redirects. Note that this only works for
     // GET requests that don't set up any HTTP body or other flags.
@@ -176,17 +198,31 @@ protected:
 private slots:
     void slotFinished();
     void slotTimeout();
+    void slotNetworkChanged();
+    void slotAccountNetworkActivity();
+    void slotResendAfterRefresh();
+    void slotUploadProgress(qint64 sent, qint64 total);
+    void slotDownloadProgress(qint64 received, qint64 total);
 
 protected:
     AccountPtr _account;
 
 private:
     QNetworkReply *addTimer(QNetworkReply *reply);
+    qint64 currentTimeoutMsec() const;
     bool _ignoreCredentialFailure;
     QPointer<QNetworkReply> _reply; // (QPointer because the NetworkManager may be destroyed before the jobs at exit)
     QString _path;
     QTimer _timer;
+    qint64 _timeoutMsec;
+    // While the short timeout of slotNetworkChanged() runs
+    bool _networkChangeTimeout = false;
+    // Between the first and the last byte of a body, the stall timeout applies
+    bool _transferring = false;
+    qint64 _processingSize = 0;
     int _redirectCount;
+    // A request that ran into the renewal of the access token is sent once more
+    bool _resentAfterRefresh = false;
 
     // Set by the xyzRequest() functions and needed to be able to redirect
     // requests, should it be required.
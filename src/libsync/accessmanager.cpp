@@ -12,6 +12,7 @@
  * for more details.
  */
 
+#include <QElapsedTimer>
 #include <QLoggingCategory>
 #include <QNetworkRequest>
 #include <QNetworkReply>
@@ -21,11 +22,13 @@
 #include <QNetworkCookie>
 #include <QNetworkCookieJar>
 #include <QNetworkConfiguration>
+#include <QSharedPointer>
 #include <QUuid>
 
 #include "cookiejar.h"
 #include "accessmanager.h"
 #include "common/utility.h"
+#include "common/sessionrecorder.h"
 
 namespace OCC {
 
@@ -96,12 +99,111 @@ QNetworkReply *AccessManager::createRequest(QNetworkAccessManager::Operation op,
 #if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
     // only enable HTTP2 with Qt 5.9 because Qt 5.8.0 has too many bugs
     // (only use one connection if the server does not support HTTP2)
-    if (newRequest.url().scheme() == "https") { // Not for "http": QTBUG-61397
+    if (newRequest.url().scheme() == "https" && http2Allowed()) { // Not for "http": QTBUG-61397
         newRequest.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
     }
 #endif
 
-    return QNetworkAccessManager::createRequest(op, newRequest, outgoingData);
+    auto reply = QNetworkAccessManager::createRequest(op, newRequest, outgoingData);
+
+    ++_stats.requests;
+    ++_activeRequests;
+    _stats.peakActiveRequests = qMax(_stats.peakActiveRequests, _activeRequests);
+    connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        --_activeRequests;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+        if (reply->attribute(QNetworkRequest::HTTP2WasUsedAttribute).toBool())
+            ++_stats.http2Requests;
+#else
+        Q_UNUSED(reply);
+#endif
+    });
+    connect(reply, &QNetworkReply::encrypted, this, [this]() { ++_stats.newConnections; });
+    const QByteArray requestVerb = verb.isEmpty() ? operationVerb(op) : verb;
+    timeRequest(reply, requestVerb);
+    if (SessionRecorder::isEnabled())
+        recordRequest(reply, requestVerb);
+    return reply;
+}
+
+QByteArray AccessManager::operationVerb(QNetworkAccessManager::Operation op)
+{
+    switch (op) {
+    case HeadOperation:
+        return "HEAD";
+    case GetOperation:
+        return "GET";
+    case PutOperation:
+        return "PUT";
+    case PostOperation:
+        return "POST";
+    case DeleteOperation:
+        return "DELETE";
+    default:
+        return "CUSTOM";
+    }
+}
+
+void AccessManager::timeRequest(QNetworkReply *reply, const QByteArray &verb)
+{
+    struct Phases
+    {
+        QElapsedTimer timer;
+        qint64 sentMs = -1;
+        qint64 headersMs = -1;
+    };
+    auto phases = QSharedPointer<Phases>::create();
+    phases->timer.start();
+    connect(reply, &QNetworkReply::uploadProgress, this, [phases](qint64 sent, qint64 total) {
+        if (phases->sentMs < 0 && total > 0 && sent == total)
+            phases->sentMs = phases->timer.elapsed();
+    });
+    connect(reply, &QNetworkReply::metaDataChanged, this, [phases]() {
+        if (phases->headersMs < 0)
+            phases->headersMs = phases->timer.elapsed();
+    });
+    connect(reply, &QNetworkReply::finished, this, [this, reply, verb, phases]() {
+        const qint64 totalMs = phases->timer.elapsed();
+        const qint64 headersMs = phases->headersMs < 0 ? totalMs : phases->headersMs;
+        const qint64 sendMs = qBound(qint64(0), phases->sentMs, headersMs);
+        _stats.timings[RequestTimings::key(verb, reply->url().path())].add(sendMs, headersMs - sendMs, totalMs - headersMs);
+    });
+}
+
+void AccessManager::recordRequest(QNetworkReply *reply, const QByteArray &verb)
+{
+    struct Transfer
+    {
+        qint64 start;
+        qint64 sent;
+        qint64 received;
+    };
+    auto transfer = QSharedPointer<Transfer>::create(Transfer{ SessionRecorder::now(), 0, 0 });
+    connect(reply, &QNetworkReply::uploadProgress, this, [transfer](qint64 sent, qint64) {
+        transfer->sent = sent;
+    });
+    connect(reply, &QNetworkReply::downloadProgress, this, [transfer](qint64 received, qint64) {
+        transfer->received = received;
+    });
+    connect(reply, &QNetworkReply::finished, this, [reply, verb, transfer]() {
+        SessionRecorder::addRequest(verb, reply->url().path(),
+            reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(),
+            transfer->start, transfer->sent, transfer->received);
+    });
+}
+
+AccessManager::RequestStats AccessManager::takeRequestStats()
+{
+    RequestStats stats = _stats;
+    _stats = RequestStats();
+    _stats.peakActiveRequests = _activeRequests;
+    return stats;
+}
+
+bool AccessManager::http2Allowed()
+{
+    static bool allowed = qgetenv("OWNCLOUD_HTTP2_ENABLED") != "0";
+    return allowed;
 }
 
 } // namespace OCC
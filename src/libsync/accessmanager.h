@@ -16,6 +16,7 @@
 #define MIRALL_ACCESS_MANAGER_H
 
 #include "owncloudlib.h"
+#include "requesttimings.h"
 #include <QNetworkAccessManager>
 
 class QByteArray;
@@ -36,8 +37,43 @@ public:
 
     void setRawCookie(const QByteArray &rawCookie, const QUrl &url);
 
+    /** Counts of the requests sent since the last call to takeRequestStats() */
+    struct RequestStats
+    {
+        qint64 requests = 0;
+        qint64 http2Requests = 0; // answered over a HTTP/2 stream
+        int peakActiveRequests = 0; // the most requests that were in flight at the same time
+        qint64 newConnections = 0; // opened an encrypted connection, the others reused one
+        RequestTimingsMap timings; // of the finished requests
+    };
+    RequestStats takeRequestStats();
+    /** The counts since the last takeRequestStats(), without resetting them */
+    const RequestStats &requestStats() const { return _stats; }
+    int activeRequests() const { return _activeRequests; }
+
+    /**
+     * Whether requests may use HTTP/2.
+     *
+     * Only for https and with Qt >= 5.9. Can be disabled with
+     * OWNCLOUD_HTTP2_ENABLED=0.
+     */
+    static bool http2Allowed();
+
+    // Qt opens at most 6 connections per host, it is not configurable: HTTP/2
+    // multiplexes the requests over a single one instead
+
 protected:
     QNetworkReply *createRequest(QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *outgoingData = 0) Q_DECL_OVERRIDE;
+
+private:
+    static QByteArray operationVerb(QNetworkAccessManager::Operation op);
+    /** Adds the phases of the request to the RequestTimings of its verb and endpoint */
+    void timeRequest(QNetworkReply *reply, const QByteArray &verb);
+    /** Adds the request to the SessionRecorder when it is finished */
+    void recordRequest(QNetworkReply *reply, const QByteArray &verb);
+
+    RequestStats _stats;
+    int _activeRequests = 0;
 };
 
 } // namespace OCC
@@ -165,6 +165,7 @@ void Account::setCredentials(AbstractCredentials *cred)
         SLOT(slotHandleSslErrors(QNetworkReply *, QList<QSslError>)));
     connect(_am.data(), &QNetworkAccessManager::proxyAuthenticationRequired,
         this, &Account::proxyAuthenticationRequired);
+    connect(_am.data(), &QNetworkAccessManager::encrypted, this, &Account::slotEncrypted);
     connect(_credentials.data(), &AbstractCredentials::fetched,
         this, &Account::slotCredentialsFetched);
     connect(_credentials.data(), &AbstractCredentials::asked,
@@ -227,6 +228,7 @@ void Account::resetNetworkAccessManager()
         SLOT(slotHandleSslErrors(QNetworkReply *, QList<QSslError>)));
     connect(_am.data(), &QNetworkAccessManager::proxyAuthenticationRequired,
         this, &Account::proxyAuthenticationRequired);
+    connect(_am.data(), &QNetworkAccessManager::encrypted, this, &Account::slotEncrypted);
 }
 
 QNetworkAccessManager *Account::networkAccessManager()
@@ -289,6 +291,18 @@ QSslConfiguration Account::getOrCreateSslConfig()
     return sslConfig;
 }
 
+void Account::slotEncrypted(QNetworkReply *reply)
+{
+    // The next connections resume the TLS session instead of a full handshake,
+    // also the ones of a new QNAM after resetNetworkAccessManager()
+    const QByteArray ticket = reply->sslConfiguration().sessionTicket();
+    if (ticket.isEmpty() || ticket == _sslConfiguration.sessionTicket())
+        return;
+    QSslConfiguration sslConfig = getOrCreateSslConfig();
+    sslConfig.setSessionTicket(ticket);
+    _sslConfiguration = sslConfig;
+}
+
 void Account::setApprovedCerts(const QList<QSslCertificate> certs)
 {
     _approvedCerts = certs;
@@ -428,6 +442,32 @@ void Account::clearQNAMCache()
     _am->clearAccessCache();
 }
 
+void Account::handleNetworkChange()
+{
+    qCInfo(lcAccount) << "Network changed, dropping the idle connections to" << url().host();
+    if (_am) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+        _am->clearConnectionCache();
+#else
+        _am->clearAccessCache();
+#endif
+    }
+    emit networkChanged();
+}
+
+void Account::warmUpConnection()
+{
+    if (!_am)
+        return;
+    // The TCP and TLS handshakes are done while the connection is validated
+    const QUrl serverUrl = url();
+    if (serverUrl.scheme() == QLatin1String("https")) {
+        _am->connectToHostEncrypted(serverUrl.host(), serverUrl.port(443), getOrCreateSslConfig());
+    } else {
+        _am->connectToHost(serverUrl.host(), serverUrl.port(80));
+    }
+}
+
 const Capabilities &Account::capabilities() const
 {
     return _capabilities;
@@ -438,6 +478,11 @@ void Account::setCapabilities(const QVariantMap &caps)
     _capabilities = Capabilities(caps);
 }
 
+bool Account::hasCapabilities() const
+{
+    return !_capabilities.toVariantMap().isEmpty();
+}
+
 QString Account::serverVersion() const
 {
     return _serverVersion;
@@ -457,6 +502,38 @@ int Account::makeServerVersion(int majorVersion, int minorVersion, int patchVers
     return (majorVersion << 16) + (minorVersion << 8) + patchVersion;
 }
 
+void Account::reportChunkUpload(quint64 bytes, qint64 msec)
+{
+    const quint64 sample = bytes * 1000 / qMax<qint64>(1, msec);
+    if (_chunkUploadThroughput == 0) {
+        _chunkUploadThroughput = sample;
+    } else {
+        // A moving average, so that a single slow chunk doesn't decide
+        _chunkUploadThroughput = (3 * _chunkUploadThroughput + sample) / 4;
+    }
+}
+
+void Account::reportTransfer(quint64 bytes, qint64 msec)
+{
+    if (msec <= 0)
+        return;
+    const quint64 sample = bytes * 1000 / msec;
+    if (_transferThroughput == 0) {
+        _transferThroughput = sample;
+    } else {
+        _transferThroughput = (3 * _transferThroughput + sample) / 4;
+    }
+}
+
+void Account::reportRequestLatency(qint64 msec)
+{
+    if (_requestLatency < 0) {
+        _requestLatency = msec;
+    } else {
+        _requestLatency = (3 * _requestLatency + msec) / 4;
+    }
+}
+
 bool Account::serverVersionUnsupported() const
 {
     if (serverVersionInt() == 0) {
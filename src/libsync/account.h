@@ -183,6 +183,8 @@ public:
     /** Access the server capabilities */
     const Capabilities &capabilities() const;
     void setCapabilities(const QVariantMap &caps);
+    /** Whether capabilities were received, in this run or the last one */
+    bool hasCapabilities() const;
 
     /** Access the server version
      *
@@ -222,12 +224,47 @@ public:
     bool isHttp2Supported() { return _http2Supported; }
     void setHttp2Supported(bool value) { _http2Supported = value; }
 
+    /** The smoothed throughput of the chunk uploads to this server, in bytes per second.
+     *
+     * 0 until a chunk was uploaded. The chunked uploads size their chunks from
+     * it, also right when they start. It is kept in the account settings.
+     */
+    quint64 chunkUploadThroughput() const { return _chunkUploadThroughput; }
+    void setChunkUploadThroughput(quint64 bytesPerSecond) { _chunkUploadThroughput = bytesPerSecond; }
+    /** A chunk of @a bytes was uploaded in @a msec */
+    void reportChunkUpload(quint64 bytes, qint64 msec);
+
+    /** The smoothed throughput of a single transfer to or from this server, in bytes per second.
+     *
+     * 0 until a large enough file was transferred. Together with requestLatency()
+     * it tells how long the propagator expects a file to take.
+     */
+    quint64 transferThroughput() const { return _transferThroughput; }
+    /** A file of @a bytes took @a msec, without the request latency. Ignored unless @a msec is positive */
+    void reportTransfer(quint64 bytes, qint64 msec);
+
+    /** The smoothed duration of a request that transfers next to no data, in milliseconds.
+     *
+     * -1 until such a request finished.
+     */
+    qint64 requestLatency() const { return _requestLatency; }
+    void reportRequestLatency(qint64 msec);
+
     void clearCookieJar();
     void lendCookieJarTo(QNetworkAccessManager *guest);
     QString cookieJarPath();
 
     void resetNetworkAccessManager();
     QNetworkAccessManager *networkAccessManager();
+
+    /**
+     * Drops the idle connections and has the running requests time out soon
+     * unless they still get data, see networkChanged().
+     */
+    void handleNetworkChange();
+
+    /** Opens a connection to the server already, for the requests that follow */
+    void warmUpConnection();
     QSharedPointer<QNetworkAccessManager> sharedNetworkAccessManager();
 
     /// Called by network jobs on credential errors, emits invalidCredentials()
@@ -242,6 +279,9 @@ signals:
     /// Emitted whenever there's network activity
     void propagatorNetworkActivity();
 
+    /// The network of the computer changed, see handleNetworkChange()
+    void networkChanged();
+
     /// Triggered by handleInvalidCredentials()
     void invalidCredentials();
 
@@ -262,6 +302,7 @@ signals:
 protected Q_SLOTS:
     void slotCredentialsFetched();
     void slotCredentialsAsked();
+    void slotEncrypted(QNetworkReply *reply);
 
 private:
     Account(QObject *parent = 0);
@@ -294,6 +335,9 @@ private:
     QSharedPointer<QNetworkAccessManager> _am;
     QScopedPointer<AbstractCredentials> _credentials;
     bool _http2Supported = false;
+    quint64 _chunkUploadThroughput = 0;
+    quint64 _transferThroughput = 0;
+    qint64 _requestLatency = -1;
 
     /// Certificates that were explicitly rejected by the user
     QList<QSslCertificate> _rejectedCertificates;
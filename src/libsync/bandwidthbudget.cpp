@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "bandwidthbudget.h"
+
+#include <QLoggingCategory>
+#include <QRegularExpression>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcBandwidthBudget, "sync.bandwidthbudget", QtInfoMsg)
+
+BandwidthBudget *BandwidthBudget::instance()
+{
+    static BandwidthBudget budget;
+    return &budget;
+}
+
+void BandwidthBudget::setSchedule(const QVector<ScheduleEntry> &schedule)
+{
+    _schedule = schedule;
+}
+
+qint64 BandwidthBudget::limit(Direction direction, qint64 configuredLimit, const QTime &now) const
+{
+    for (const auto &entry : _schedule) {
+        const bool covered = entry.start <= entry.end
+            ? (now >= entry.start && now < entry.end)
+            : (now >= entry.start || now < entry.end);
+        if (covered)
+            return direction == Upload ? entry.uploadLimit : entry.downloadLimit;
+    }
+    return configuredLimit;
+}
+
+void BandwidthBudget::setWeight(const void *user, Direction direction, int weight)
+{
+    auto &weights = _weights[direction];
+    _totalWeight[direction] -= weights.value(user, 0);
+    if (weight > 0) {
+        weights[user] = weight;
+        _totalWeight[direction] += weight;
+    } else {
+        weights.remove(user);
+    }
+}
+
+qint64 BandwidthBudget::share(const void *user, Direction direction, qint64 rate) const
+{
+    const int weight = _weights[direction].value(user, 0);
+    if (weight <= 0 || _totalWeight[direction] <= weight)
+        return rate;
+    return rate * weight / _totalWeight[direction];
+}
+
+static bool parseScheduleLimit(const QString &text, qint64 *limit)
+{
+    bool ok = false;
+    if (text.endsWith(QLatin1Char('%'))) {
+        const int percent = text.leftRef(text.size() - 1).toInt(&ok);
+        *limit = -percent;
+        return ok && percent > 0 && percent <= 100;
+    }
+    const qint64 kbytes = text.toLongLong(&ok);
+    *limit = kbytes * 1000;
+    return ok && kbytes >= 0;
+}
+
+QVector<BandwidthBudget::ScheduleEntry> BandwidthBudget::parseSchedule(const QString &text)
+{
+    static const QRegularExpression entryRe(QStringLiteral(
+        "^(\\d{1,2}:\\d{2})-(\\d{1,2}:\\d{2})\\s+(\\d+%?)/(\\d+%?)$"));
+
+    QVector<ScheduleEntry> schedule;
+    foreach (const QString &part, text.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        const auto match = entryRe.match(part.trimmed());
+        ScheduleEntry entry;
+        if (match.hasMatch()) {
+            entry.start = QTime::fromString(match.captured(1), QStringLiteral("H:mm"));
+            entry.end = QTime::fromString(match.captured(2), QStringLiteral("H:mm"));
+        }
+        if (!match.hasMatch() || !entry.start.isValid() || !entry.end.isValid()
+            || !parseScheduleLimit(match.captured(3), &entry.uploadLimit)
+            || !parseScheduleLimit(match.captured(4), &entry.downloadLimit)) {
+            qCWarning(lcBandwidthBudget) << "Ignoring invalid bandwidth schedule entry" << part;
+            continue;
+        }
+        schedule.append(entry);
+    }
+    return schedule;
+}
+}
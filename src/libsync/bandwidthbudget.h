@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef BANDWIDTHBUDGET_H
+#define BANDWIDTHBUDGET_H
+
+#include "owncloudlib.h"
+
+#include <QHash>
+#include <QTime>
+#include <QVector>
+
+namespace OCC {
+
+/**
+ * @brief Shares the bandwidth limits between all the syncing folders
+ *
+ * Every BandwidthManager refills its quota from the share of the limit
+ * this gives it, so that the configured limit holds for the whole
+ * process and not for each folder. The share is proportional to the
+ * weight of the folder, among the folders that are transferring in
+ * that direction.
+ *
+ * The threads of the local file operations are shared the same way,
+ * in the LocalIo direction, see OwncloudPropagator::localOperationsPool().
+ *
+ * The limits can also depend on the time of the day, see setSchedule().
+ * The budget is only used from the main thread.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT BandwidthBudget
+{
+public:
+    enum Direction {
+        Upload,
+        Download,
+        LocalIo
+    };
+
+    /** Limits that apply from @a start to @a end, which may be past midnight.
+     *
+     * The limits are in bytes per second, negative for percent and 0 for
+     * no limit, like OwncloudPropagator::_uploadLimit.
+     */
+    struct ScheduleEntry
+    {
+        QTime start;
+        QTime end;
+        qint64 uploadLimit = 0;
+        qint64 downloadLimit = 0;
+    };
+
+    static BandwidthBudget *instance();
+
+    void setSchedule(const QVector<ScheduleEntry> &schedule);
+
+    /** The limit of the first schedule entry that covers @a now, @a configuredLimit if there is none */
+    qint64 limit(Direction direction, qint64 configuredLimit, const QTime &now = QTime::currentTime()) const;
+
+    /** @a user transfers in @a direction with @a weight, or stopped if @a weight is 0 */
+    void setWeight(const void *user, Direction direction, int weight);
+
+    /** The part of @a rate that @a user may use */
+    qint64 share(const void *user, Direction direction, qint64 rate) const;
+
+    /**
+     * Reads a schedule like "08:00-18:00 100/500, 22:00-06:00 0/0": the
+     * upload and download limits in kB/s, with a % for a relative limit.
+     * Entries that can't be parsed are skipped with a warning.
+     */
+    static QVector<ScheduleEntry> parseSchedule(const QString &text);
+
+private:
+    BandwidthBudget() = default;
+
+    QVector<ScheduleEntry> _schedule;
+    QHash<const void *, int> _weights[3];
+    int _totalWeight[3] = { 0, 0, 0 };
+};
+}
+
+#endif
@@ -13,6 +13,7 @@
  */
 
 #include "owncloudpropagator.h"
+#include "bandwidthbudget.h"
 #include "propagatedownload.h"
 #include "propagateupload.h"
 #include "propagatorjobs.h"
@@ -26,370 +27,254 @@
 #include <QLoggingCategory>
 #include <QTimer>
 #include <QObject>
+#include <QVector>
+
+#include <algorithm>
+#include <limits>
 
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcBandwidthManager, "sync.bandwidthmanager", QtInfoMsg)
 
-// Because of the many layers of buffering inside Qt (and probably the OS and the network)
-// we cannot lower this value much more. If we do, the estimated bw will be very high
-// because the buffers fill fast while the actual network algorithms are not relevant yet.
-static qint64 relativeLimitMeasuringTimerIntervalMsec = 1000 * 2;
-// See also WritingState in http://code.woboq.org/qt5/qtbase/src/network/access/qhttpprotocolhandler.cpp.html#_ZN20QHttpProtocolHandler11sendRequestEv
+// Short enough for a steady flow, long enough that the refills don't use
+// much CPU. The buffers inside Qt and the OS smooth out the rest.
+static const int RefillIntervalMsec = 50;
+
+// The bucket holds at most this much of the rate, so that a late refill
+// doesn't lose anything, but there are no long bursts after an idle time.
+static const qint64 BurstMsec = 250;
+static const qint64 MinBurstBytes = 16 * 1024;
+
+// A transfer that didn't use all of its quota gets what it used plus this
+// much, more if it then uses all of it again.
+static const qint64 MinQuotaBytes = 4 * 1024;
 
-// FIXME At some point:
-//  * Register device only after the QNR received its metaDataChanged() signal
-//  * Incorporate Qt buffer fill state (it's a negative absolute delta).
-//  * Incorporate SSL overhead (percentage)
-//  * For relative limiting, do less measuring and more delaying+giving quota
-//  * For relative limiting, smoothen measurements
+// For the relative limits, the speed is measured this long, this often
+static const qint64 ProbeDurationMsec = 2000;
+static const qint64 ProbeIntervalMsec = 30 * 1000;
+static const qint64 ProbeQuotaBytes = 1024 * 1024 * 1024;
+static const qint64 MinRelativeRate = 16 * 1024;
 
 BandwidthManager::BandwidthManager(OwncloudPropagator *p)
     : QObject()
     , _propagator(p)
-    , _relativeLimitCurrentMeasuredDevice(0)
-    , _relativeUploadLimitProgressAtMeasuringRestart(0)
-    , _currentUploadLimit(0)
-    , _relativeLimitCurrentMeasuredJob(0)
-    , _currentDownloadLimit(0)
 {
-    _currentUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
-    _currentDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
-
-    QObject::connect(&_switchingTimer, &QTimer::timeout, this, &BandwidthManager::switchingTimerExpired);
-    _switchingTimer.setInterval(10 * 1000);
-    _switchingTimer.start();
-    QMetaObject::invokeMethod(this, "switchingTimerExpired", Qt::QueuedConnection);
-
-    // absolute uploads/downloads
-    QObject::connect(&_absoluteLimitTimer, &QTimer::timeout, this, &BandwidthManager::absoluteLimitTimerExpired);
-    _absoluteLimitTimer.setInterval(1000);
-    _absoluteLimitTimer.start();
-
-    // Relative uploads
-    QObject::connect(&_relativeUploadMeasuringTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeUploadMeasuringTimerExpired);
-    _relativeUploadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeUploadMeasuringTimer.start();
-    _relativeUploadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
-    QObject::connect(&_relativeUploadDelayTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeUploadDelayTimerExpired);
-    _relativeUploadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
-
-    // Relative downloads
-    QObject::connect(&_relativeDownloadMeasuringTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeDownloadMeasuringTimerExpired);
-    _relativeDownloadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeDownloadMeasuringTimer.start();
-    _relativeDownloadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
-    QObject::connect(&_relativeDownloadDelayTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeDownloadDelayTimerExpired);
-    _relativeDownloadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
+    auto budget = BandwidthBudget::instance();
+    _upload.limit = budget->limit(BandwidthBudget::Upload, _propagator->_uploadLimit.fetchAndAddAcquire(0));
+    _download.limit = budget->limit(BandwidthBudget::Download, _propagator->_downloadLimit.fetchAndAddAcquire(0));
+
+    QObject::connect(&_refillTimer, &QTimer::timeout, this, &BandwidthManager::refillTimerExpired);
+    _refillTimer.setInterval(RefillIntervalMsec);
+    _clock.start();
 }
 
 BandwidthManager::~BandwidthManager()
 {
+    BandwidthBudget::instance()->setWeight(this, BandwidthBudget::Upload, 0);
+    BandwidthBudget::instance()->setWeight(this, BandwidthBudget::Download, 0);
 }
 
-void BandwidthManager::registerUploadDevice(UploadDevice *p)
+template <typename Transfer>
+void BandwidthManager::applyLimit(const TokenBucket &bucket, Transfer *transfer)
 {
-    _absoluteUploadDeviceList.append(p);
-    _relativeUploadDeviceList.append(p);
-    QObject::connect(p, &QObject::destroyed, this, &BandwidthManager::unregisterUploadDevice);
+    // A limited transfer waits for its quota from the next refill
+    transfer->setBandwidthLimited(bucket.limit != 0);
+    transfer->setChoked(_paused);
+}
+
+void BandwidthManager::setPaused(bool paused)
+{
+    if (paused == _paused)
+        return;
+    qCInfo(lcBandwidthManager) << (paused ? "Pausing" : "Resuming") << _uploadDeviceList.size() << "uploads and"
+                               << _downloadJobList.size() << "downloads";
+    _paused = paused;
+    Q_FOREACH (UploadDevice *ud, _uploadDeviceList) {
+        applyLimit(_upload, ud);
+    }
+    Q_FOREACH (GETFileJob *j, _downloadJobList) {
+        applyLimit(_download, j);
+    }
+    updateWeights();
+    if (_paused) {
+        _refillTimer.stop();
+    } else if (!_uploadDeviceList.isEmpty() || !_downloadJobList.isEmpty()) {
+        startRefillTimer();
+    }
+}
 
-    if (usingAbsoluteUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(false);
-    } else if (usingRelativeUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(true);
-    } else {
-        p->setBandwidthLimited(false);
-        p->setChoked(false);
+void BandwidthManager::updateLimits()
+{
+    auto budget = BandwidthBudget::instance();
+    qint64 newUploadLimit = budget->limit(BandwidthBudget::Upload, _propagator->_uploadLimit.fetchAndAddAcquire(0));
+    if (newUploadLimit != _upload.limit) {
+        qCInfo(lcBandwidthManager) << "Upload Bandwidth limit changed" << _upload.limit << newUploadLimit;
+        _upload = TokenBucket();
+        _upload.limit = newUploadLimit;
+        Q_FOREACH (UploadDevice *ud, _uploadDeviceList) {
+            applyLimit(_upload, ud);
+        }
     }
+    qint64 newDownloadLimit = budget->limit(BandwidthBudget::Download, _propagator->_downloadLimit.fetchAndAddAcquire(0));
+    if (newDownloadLimit != _download.limit) {
+        qCInfo(lcBandwidthManager) << "Download Bandwidth limit changed" << _download.limit << newDownloadLimit;
+        _download = TokenBucket();
+        _download.limit = newDownloadLimit;
+        Q_FOREACH (GETFileJob *j, _downloadJobList) {
+            applyLimit(_download, j);
+        }
+    }
+    updateWeights();
+}
+
+void BandwidthManager::updateWeights()
+{
+    // Only the folders that are transferring under a limit take a share of it
+    const int weight = _paused ? 0 : qMax(1, _propagator->syncOptions()._bandwidthWeight);
+    auto budget = BandwidthBudget::instance();
+    budget->setWeight(this, BandwidthBudget::Upload,
+        _upload.limit != 0 && !_uploadDeviceList.isEmpty() ? weight : 0);
+    budget->setWeight(this, BandwidthBudget::Download,
+        _download.limit != 0 && !_downloadJobList.isEmpty() ? weight : 0);
+}
+
+void BandwidthManager::startRefillTimer()
+{
+    if (_refillTimer.isActive() || _paused)
+        return;
+    _lastRefillMsec = _clock.elapsed();
+    _refillTimer.start();
+}
+
+void BandwidthManager::registerUploadDevice(UploadDevice *p)
+{
+    updateLimits();
+    _uploadDeviceList.append(p);
+    QObject::connect(p, &QObject::destroyed, this, &BandwidthManager::unregisterUploadDevice);
+    applyLimit(_upload, p);
+    updateWeights();
+    startRefillTimer();
 }
 
 void BandwidthManager::unregisterUploadDevice(QObject *o)
 {
     auto p = reinterpret_cast<UploadDevice *>(o); // note, we might already be in the ~QObject
-    _absoluteUploadDeviceList.removeAll(p);
-    _relativeUploadDeviceList.removeAll(p);
-    if (p == _relativeLimitCurrentMeasuredDevice) {
-        _relativeLimitCurrentMeasuredDevice = 0;
-        _relativeUploadLimitProgressAtMeasuringRestart = 0;
-    }
+    _uploadDeviceList.removeAll(p);
+    _upload.granted.remove(o);
+    updateWeights();
 }
 
 void BandwidthManager::registerDownloadJob(GETFileJob *j)
 {
+    updateLimits();
     _downloadJobList.append(j);
     QObject::connect(j, &QObject::destroyed, this, &BandwidthManager::unregisterDownloadJob);
-
-    if (usingAbsoluteDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(false);
-    } else if (usingRelativeDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(true);
-    } else {
-        j->setBandwidthLimited(false);
-        j->setChoked(false);
-    }
+    applyLimit(_download, j);
+    updateWeights();
+    startRefillTimer();
 }
 
 void BandwidthManager::unregisterDownloadJob(QObject *o)
 {
     GETFileJob *j = reinterpret_cast<GETFileJob *>(o); // note, we might already be in the ~QObject
     _downloadJobList.removeAll(j);
-    if (_relativeLimitCurrentMeasuredJob == j) {
-        _relativeLimitCurrentMeasuredJob = 0;
-        _relativeDownloadLimitProgressAtMeasuringRestart = 0;
-    }
+    _download.granted.remove(o);
+    updateWeights();
 }
 
-void BandwidthManager::relativeUploadMeasuringTimerExpired()
+qint64 BandwidthManager::bucketRate(TokenBucket &bucket, qint64 nowMsec)
 {
-    if (!usingRelativeUploadLimit() || _relativeUploadDeviceList.count() == 0) {
-        // Not in this limiting mode, just wait 1 sec to continue the cycle
-        _relativeUploadDelayTimer.setInterval(1000);
-        _relativeUploadDelayTimer.start();
-        return;
+    if (bucket.limit > 0)
+        return bucket.limit;
+
+    if (bucket.probeStartMsec >= 0) {
+        const qint64 probeMsec = nowMsec - bucket.probeStartMsec;
+        if (probeMsec < ProbeDurationMsec)
+            return -1;
+        // Don't trust a single measurement that found the transfers idle
+        bucket.capacity = qMax(bucket.probedBytes * 1000 / probeMsec, bucket.capacity / 2);
+        bucket.probeStartMsec = -1;
+        bucket.nextProbeMsec = nowMsec + ProbeIntervalMsec;
+        qCInfo(lcBandwidthManager) << "Measured" << bucket.capacity / 1024 << "kB/s at full speed";
+    } else if (nowMsec >= bucket.nextProbeMsec) {
+        bucket.probeStartMsec = nowMsec;
+        bucket.probedBytes = 0;
+        return -1;
     }
-    if (_relativeLimitCurrentMeasuredDevice == 0) {
-        qCDebug(lcBandwidthManager) << "No device set, just waiting 1 sec";
-        _relativeUploadDelayTimer.setInterval(1000);
-        _relativeUploadDelayTimer.start();
-        return;
-    }
-
-    qCDebug(lcBandwidthManager) << _relativeUploadDeviceList.count() << "Starting Delay";
 
-    qint64 relativeLimitProgressMeasured = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                               + _relativeLimitCurrentMeasuredDevice->_read)
-        / 2;
-    qint64 relativeLimitProgressDifference = relativeLimitProgressMeasured - _relativeUploadLimitProgressAtMeasuringRestart;
-    qCDebug(lcBandwidthManager) << _relativeUploadLimitProgressAtMeasuringRestart
-                                << relativeLimitProgressMeasured << relativeLimitProgressDifference;
-
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec * 1000.0) / 1024.0;
-    qCDebug(lcBandwidthManager) << relativeLimitProgressDifference / 1024 << "kB =>" << speedkBPerSec << "kB/sec on full speed ("
-                                << _relativeLimitCurrentMeasuredDevice->_readWithProgress << _relativeLimitCurrentMeasuredDevice->_read
-                                << qAbs(_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                       - _relativeLimitCurrentMeasuredDevice->_read)
-                                << ")";
-
-    qint64 uploadLimitPercent = -_currentUploadLimit;
     // don't use too extreme values
-    uploadLimitPercent = qMin(uploadLimitPercent, qint64(90));
-    uploadLimitPercent = qMax(qint64(10), uploadLimitPercent);
-    qint64 wholeTimeMsec = (100.0 / uploadLimitPercent) * relativeLimitMeasuringTimerIntervalMsec;
-    qint64 waitTimeMsec = wholeTimeMsec - relativeLimitMeasuringTimerIntervalMsec;
-    qint64 realWaitTimeMsec = waitTimeMsec + wholeTimeMsec;
-    qCDebug(lcBandwidthManager) << waitTimeMsec << " - " << realWaitTimeMsec << " msec for " << uploadLimitPercent << "%";
-
-    // We want to wait twice as long since we want to give all
-    // devices the same quota we used now since we don't want
-    // any upload to timeout
-    _relativeUploadDelayTimer.setInterval(realWaitTimeMsec);
-    _relativeUploadDelayTimer.start();
-
-    int deviceCount = _relativeUploadDeviceList.count();
-    qint64 quotaPerDevice = relativeLimitProgressDifference * (uploadLimitPercent / 100.0) / deviceCount + 1.0;
-    Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-        ud->setBandwidthLimited(true);
-        ud->setChoked(false);
-        ud->giveBandwidthQuota(quotaPerDevice);
-        qCDebug(lcBandwidthManager) << "Gave" << quotaPerDevice / 1024.0 << "kB to" << ud;
-    }
-    _relativeLimitCurrentMeasuredDevice = 0;
+    const double percent = qBound<qint64>(10, -bucket.limit, 90) / 100.0;
+    // Make up for the full speed while measuring, so that the average is the limit
+    const double factor = (percent * (ProbeIntervalMsec + ProbeDurationMsec) - ProbeDurationMsec) / ProbeIntervalMsec;
+    return qMax<qint64>(MinRelativeRate, bucket.capacity * qMax(0.01, factor));
 }
 
-void BandwidthManager::relativeUploadDelayTimerExpired()
+template <typename Transfer>
+void BandwidthManager::refillBucket(TokenBucket &bucket, BandwidthBudget::Direction direction,
+    const QLinkedList<Transfer *> &transfers, qint64 elapsedMsec)
 {
-    // Switch to measuring state
-    _relativeUploadMeasuringTimer.start(); // always start to continue the cycle
-
-    if (!usingRelativeUploadLimit()) {
-        return; // oh, not actually needed
-    }
-
-    if (_relativeUploadDeviceList.isEmpty()) {
+    if (bucket.limit == 0 || transfers.isEmpty())
         return;
-    }
-
-    qCDebug(lcBandwidthManager) << _relativeUploadDeviceList.count() << "Starting measuring";
 
-    // Take first device and then append it again (= we round robin all devices)
-    _relativeLimitCurrentMeasuredDevice = _relativeUploadDeviceList.takeFirst();
-    _relativeUploadDeviceList.append(_relativeLimitCurrentMeasuredDevice);
-
-    _relativeUploadLimitProgressAtMeasuringRestart = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                                         + _relativeLimitCurrentMeasuredDevice->_read)
-        / 2;
-    _relativeLimitCurrentMeasuredDevice->setBandwidthLimited(false);
-    _relativeLimitCurrentMeasuredDevice->setChoked(false);
-
-    // choke all other UploadDevices
-    Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-        if (ud != _relativeLimitCurrentMeasuredDevice) {
-            ud->setBandwidthLimited(true);
-            ud->setChoked(true);
-        }
+    // Take back the quota that wasn't used since the last refill and
+    // estimate what each transfer needs.
+    QVector<QPair<qint64, Transfer *>> demands;
+    qint64 usedBytes = 0;
+    Q_FOREACH (Transfer *transfer, transfers) {
+        const qint64 granted = bucket.granted.value(transfer, 0);
+        const qint64 left = qBound<qint64>(0, transfer->_bandwidthQuota, granted);
+        usedBytes += granted - left;
+        bucket.tokens += left;
+        // The new ones and the ones that used everything get an equal share
+        // of what the others don't need
+        const bool hungry = granted == 0 || left == 0;
+        demands.append(qMakePair(hungry ? std::numeric_limits<qint64>::max() : 2 * (granted - left) + MinQuotaBytes, transfer));
     }
 
-    // now we're in measuring state
-}
-
-// for downloads:
-void BandwidthManager::relativeDownloadMeasuringTimerExpired()
-{
-    if (!usingRelativeDownloadLimit() || _downloadJobList.count() == 0) {
-        // Not in this limiting mode, just wait 1 sec to continue the cycle
-        _relativeDownloadDelayTimer.setInterval(1000);
-        _relativeDownloadDelayTimer.start();
-        return;
+    qint64 rate = bucketRate(bucket, _clock.elapsed());
+    if (bucket.limit > 0) {
+        // The relative limits already measure what the other folders leave
+        rate = BandwidthBudget::instance()->share(this, direction, rate);
     }
-    if (_relativeLimitCurrentMeasuredJob == 0) {
-        qCDebug(lcBandwidthManager) << "No job set, just waiting 1 sec";
-        _relativeDownloadDelayTimer.setInterval(1000);
-        _relativeDownloadDelayTimer.start();
+    if (rate < 0) {
+        // Measuring the speed of the connection
+        bucket.probedBytes += usedBytes;
+        bucket.tokens = 0;
+        for (const auto &demand : demands) {
+            bucket.granted[demand.second] = ProbeQuotaBytes;
+            demand.second->giveBandwidthQuota(ProbeQuotaBytes);
+        }
         return;
     }
 
-    qCDebug(lcBandwidthManager) << _downloadJobList.count() << "Starting Delay";
-
-    qint64 relativeLimitProgressMeasured = _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-    qint64 relativeLimitProgressDifference = relativeLimitProgressMeasured - _relativeDownloadLimitProgressAtMeasuringRestart;
-    qCDebug(lcBandwidthManager) << _relativeDownloadLimitProgressAtMeasuringRestart
-                                << relativeLimitProgressMeasured << relativeLimitProgressDifference;
-
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec * 1000.0) / 1024.0;
-    qCDebug(lcBandwidthManager) << relativeLimitProgressDifference / 1024 << "kB =>" << speedkBPerSec << "kB/sec on full speed ("
-                                << _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-
-    qint64 downloadLimitPercent = -_currentDownloadLimit;
-    // don't use too extreme values
-    downloadLimitPercent = qMin(downloadLimitPercent, qint64(90));
-    downloadLimitPercent = qMax(qint64(10), downloadLimitPercent);
-    qint64 wholeTimeMsec = (100.0 / downloadLimitPercent) * relativeLimitMeasuringTimerIntervalMsec;
-    qint64 waitTimeMsec = wholeTimeMsec - relativeLimitMeasuringTimerIntervalMsec;
-    qint64 realWaitTimeMsec = waitTimeMsec + wholeTimeMsec;
-    qCDebug(lcBandwidthManager) << waitTimeMsec << " - " << realWaitTimeMsec << " msec for " << downloadLimitPercent << "%";
-
-    // We want to wait twice as long since we want to give all
-    // devices the same quota we used now since we don't want
-    // any download to timeout
-    _relativeDownloadDelayTimer.setInterval(realWaitTimeMsec);
-    _relativeDownloadDelayTimer.start();
-
-    int jobCount = _downloadJobList.count();
-    qint64 quota = relativeLimitProgressDifference * (downloadLimitPercent / 100.0);
-    if (quota > 20 * 1024) {
-        qCInfo(lcBandwidthManager) << "ADJUSTING QUOTA FROM " << quota << " TO " << quota - 20 * 1024;
-        quota -= 20 * 1024;
-    }
-    qint64 quotaPerJob = quota / jobCount + 1.0;
-    Q_FOREACH (GETFileJob *gfj, _downloadJobList) {
-        gfj->setBandwidthLimited(true);
-        gfj->setChoked(false);
-        gfj->giveBandwidthQuota(quotaPerJob);
-        qCDebug(lcBandwidthManager) << "Gave" << quotaPerJob / 1024.0 << "kB to" << gfj;
+    bucket.tokens = qMin(bucket.tokens + rate * elapsedMsec / 1000.0,
+        qMax(rate * BurstMsec / 1000.0, double(MinBurstBytes)));
+
+    // Max-min fair: the transfers that need little get it, the rest is
+    // split evenly between the others.
+    std::sort(demands.begin(), demands.end(),
+        [](const QPair<qint64, Transfer *> &a, const QPair<qint64, Transfer *> &b) { return a.first < b.first; });
+    int remaining = demands.size();
+    for (const auto &demand : demands) {
+        const qint64 quota = qMin<qint64>(demand.first, bucket.tokens / remaining);
+        bucket.tokens -= quota;
+        --remaining;
+        bucket.granted[demand.second] = quota;
+        demand.second->giveBandwidthQuota(quota);
     }
-    _relativeLimitCurrentMeasuredDevice = 0;
 }
 
-void BandwidthManager::relativeDownloadDelayTimerExpired()
+void BandwidthManager::refillTimerExpired()
 {
-    // Switch to measuring state
-    _relativeDownloadMeasuringTimer.start(); // always start to continue the cycle
-
-    if (!usingRelativeDownloadLimit()) {
-        return; // oh, not actually needed
-    }
-
-    if (_downloadJobList.isEmpty()) {
-        qCDebug(lcBandwidthManager) << _downloadJobList.count() << "No jobs?";
-        return;
-    }
-
-    qCDebug(lcBandwidthManager) << _downloadJobList.count() << "Starting measuring";
+    const qint64 nowMsec = _clock.elapsed();
+    const qint64 elapsedMsec = nowMsec - _lastRefillMsec;
+    _lastRefillMsec = nowMsec;
 
-    // Take first device and then append it again (= we round robin all devices)
-    _relativeLimitCurrentMeasuredJob = _downloadJobList.takeFirst();
-    _downloadJobList.append(_relativeLimitCurrentMeasuredJob);
+    updateLimits();
+    refillBucket(_upload, BandwidthBudget::Upload, _uploadDeviceList, elapsedMsec);
+    refillBucket(_download, BandwidthBudget::Download, _downloadJobList, elapsedMsec);
 
-    _relativeDownloadLimitProgressAtMeasuringRestart = _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-    _relativeLimitCurrentMeasuredJob->setBandwidthLimited(false);
-    _relativeLimitCurrentMeasuredJob->setChoked(false);
-
-    // choke all other download jobs
-    Q_FOREACH (GETFileJob *gfj, _downloadJobList) {
-        if (gfj != _relativeLimitCurrentMeasuredJob) {
-            gfj->setBandwidthLimited(true);
-            gfj->setChoked(true);
-        }
-    }
-
-    // now we're in measuring state
-}
-
-// end downloads
-
-void BandwidthManager::switchingTimerExpired()
-{
-    qint64 newUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
-    if (newUploadLimit != _currentUploadLimit) {
-        qCInfo(lcBandwidthManager) << "Upload Bandwidth limit changed" << _currentUploadLimit << newUploadLimit;
-        _currentUploadLimit = newUploadLimit;
-        Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-            if (newUploadLimit == 0) {
-                ud->setBandwidthLimited(false);
-                ud->setChoked(false);
-            } else if (newUploadLimit > 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(false);
-            } else if (newUploadLimit < 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(true);
-            }
-        }
-    }
-    qint64 newDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
-    if (newDownloadLimit != _currentDownloadLimit) {
-        qCInfo(lcBandwidthManager) << "Download Bandwidth limit changed" << _currentDownloadLimit << newDownloadLimit;
-        _currentDownloadLimit = newDownloadLimit;
-        Q_FOREACH (GETFileJob *j, _downloadJobList) {
-            if (usingAbsoluteDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(false);
-            } else if (usingRelativeDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(true);
-            } else {
-                j->setBandwidthLimited(false);
-                j->setChoked(false);
-            }
-        }
-    }
-}
-
-void BandwidthManager::absoluteLimitTimerExpired()
-{
-    if (usingAbsoluteUploadLimit() && _absoluteUploadDeviceList.count() > 0) {
-        qint64 quotaPerDevice = _currentUploadLimit / qMax(1, _absoluteUploadDeviceList.count());
-        qCDebug(lcBandwidthManager) << quotaPerDevice << _absoluteUploadDeviceList.count() << _currentUploadLimit;
-        Q_FOREACH (UploadDevice *device, _absoluteUploadDeviceList) {
-            device->giveBandwidthQuota(quotaPerDevice);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerDevice / 1024.0 << " kB to" << device;
-        }
-    }
-    if (usingAbsoluteDownloadLimit() && _downloadJobList.count() > 0) {
-        qint64 quotaPerJob = _currentDownloadLimit / qMax(1, _downloadJobList.count());
-        qCDebug(lcBandwidthManager) << quotaPerJob << _downloadJobList.count() << _currentDownloadLimit;
-        Q_FOREACH (GETFileJob *j, _downloadJobList) {
-            j->giveBandwidthQuota(quotaPerJob);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerJob / 1024.0 << " kB to" << j;
-        }
-    }
+    if (_uploadDeviceList.isEmpty() && _downloadJobList.isEmpty())
+        _refillTimer.stop();
 }
 }
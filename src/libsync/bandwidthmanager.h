@@ -19,6 +19,10 @@
 #include <QLinkedList>
 #include <QTimer>
 #include <QIODevice>
+#include <QElapsedTimer>
+#include <QHash>
+
+#include "bandwidthbudget.h"
 
 namespace OCC {
 
@@ -28,6 +32,16 @@ class OwncloudPropagator;
 
 /**
  * @brief The BandwidthManager class
+ *
+ * Every few milliseconds, a token bucket per direction is refilled at the
+ * rate of the limit. Its tokens are shared out as quota to all the running
+ * transfers: the ones that used all of theirs get an equal share of what
+ * the others don't need.
+ *
+ * For the relative limits the speed of the connection is measured from time
+ * to time by giving out unlimited quota for a moment. The absolute limits
+ * are shared with the other folders through the BandwidthBudget.
+ *
  * @ingroup libsync
  */
 class BandwidthManager : public QObject
@@ -37,11 +51,14 @@ public:
     BandwidthManager(OwncloudPropagator *p);
     ~BandwidthManager();
 
-    bool usingAbsoluteUploadLimit() { return _currentUploadLimit > 0; }
-    bool usingRelativeUploadLimit() { return _currentUploadLimit < 0; }
-    bool usingAbsoluteDownloadLimit() { return _currentDownloadLimit > 0; }
-    bool usingRelativeDownloadLimit() { return _currentDownloadLimit < 0; }
+    bool usingAbsoluteUploadLimit() { return _upload.limit > 0; }
+    bool usingRelativeUploadLimit() { return _upload.limit < 0; }
+    bool usingAbsoluteDownloadLimit() { return _download.limit > 0; }
+    bool usingRelativeDownloadLimit() { return _download.limit < 0; }
 
+    /** Chokes all the transfers, they stay connected but don't move any data */
+    void setPaused(bool paused);
+    bool isPaused() const { return _paused; }
 
 public slots:
     void registerUploadDevice(UploadDevice *);
@@ -50,55 +67,54 @@ public slots:
     void registerDownloadJob(GETFileJob *);
     void unregisterDownloadJob(QObject *);
 
-    void absoluteLimitTimerExpired();
-    void switchingTimerExpired();
-
-    void relativeUploadMeasuringTimerExpired();
-    void relativeUploadDelayTimerExpired();
-
-    void relativeDownloadMeasuringTimerExpired();
-    void relativeDownloadDelayTimerExpired();
+private slots:
+    void refillTimerExpired();
 
 private:
-    // for switching between absolute and relative bw limiting
-    QTimer _switchingTimer;
+    struct TokenBucket
+    {
+        qint64 limit = 0; // bytes per second, negative for percent, 0 for none
+        double tokens = 0;
+        // The quota given to each transfer at the last refill
+        QHash<QObject *, qint64> granted;
+
+        // For the relative limits: the measured speed in bytes per second
+        qint64 capacity = 0;
+        qint64 probeStartMsec = -1; // while measuring
+        qint64 nextProbeMsec = 0;
+        qint64 probedBytes = 0;
+    };
+
+    /** Picks up changes of OwncloudPropagator::_uploadLimit and _downloadLimit */
+    void updateLimits();
+    /** Tells the BandwidthBudget in which directions this is transferring */
+    void updateWeights();
+    void startRefillTimer();
+
+    /** The rate a bucket is refilled with, in bytes per second. -1 while measuring */
+    qint64 bucketRate(TokenBucket &bucket, qint64 nowMsec);
+
+    template <typename Transfer>
+    void refillBucket(TokenBucket &bucket, BandwidthBudget::Direction direction,
+        const QLinkedList<Transfer *> &transfers, qint64 elapsedMsec);
+
+    template <typename Transfer>
+    void applyLimit(const TokenBucket &bucket, Transfer *transfer);
 
     // FIXME this timer and this variable should be replaced
     // by the propagator emitting the changed limit values to us as signal
     OwncloudPropagator *_propagator;
 
-    // for absolute up/down bw limiting
-    QTimer _absoluteLimitTimer;
-
-    // FIXME merge these two lists
-    QLinkedList<UploadDevice *> _absoluteUploadDeviceList;
-    QLinkedList<UploadDevice *> _relativeUploadDeviceList;
+    QTimer _refillTimer;
+    QElapsedTimer _clock;
+    qint64 _lastRefillMsec = 0;
+    bool _paused = false;
 
-    QTimer _relativeUploadMeasuringTimer;
-
-    // for relative bw limiting, we need to wait this amount before measuring again
-    QTimer _relativeUploadDelayTimer;
-
-    // the device measured
-    UploadDevice *_relativeLimitCurrentMeasuredDevice;
-
-    // for measuring how much progress we made at start
-    qint64 _relativeUploadLimitProgressAtMeasuringRestart;
-    qint64 _currentUploadLimit;
+    QLinkedList<UploadDevice *> _uploadDeviceList;
+    TokenBucket _upload;
 
     QLinkedList<GETFileJob *> _downloadJobList;
-    QTimer _relativeDownloadMeasuringTimer;
-
-    // for relative bw limiting, we need to wait this amount before measuring again
-    QTimer _relativeDownloadDelayTimer;
-
-    // the device measured
-    GETFileJob *_relativeLimitCurrentMeasuredJob;
-
-    // for measuring how much progress we made at start
-    qint64 _relativeDownloadLimitProgressAtMeasuringRestart;
-
-    qint64 _currentDownloadLimit;
+    TokenBucket _download;
 };
 }
 
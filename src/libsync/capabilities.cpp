@@ -13,6 +13,7 @@
  */
 
 #include "capabilities.h"
+#include "common/checksums.h"
 
 #include <QVariantMap>
 
@@ -107,11 +108,12 @@ QByteArray Capabilities::preferredUploadChecksumType() const
 QByteArray Capabilities::uploadChecksumType() const
 {
     QByteArray preferred = preferredUploadChecksumType();
-    if (!preferred.isEmpty())
+    if (isChecksumTypeSupported(preferred))
         return preferred;
-    QList<QByteArray> supported = supportedChecksumTypes();
-    if (!supported.isEmpty())
-        return supported.first();
+    foreach (const auto &type, supportedChecksumTypes()) {
+        if (isChecksumTypeSupported(type))
+            return type;
+    }
     return QByteArray();
 }
 
@@ -130,6 +132,52 @@ bool Capabilities::chunkingParallelUploadDisabled() const
     return _capabilities["dav"].toMap()["chunkingParallelUploadDisabled"].toBool();
 }
 
+bool Capabilities::bulkUpload() const
+{
+    static const auto bulkUpload = qgetenv("OWNCLOUD_BULK_UPLOAD");
+    if (bulkUpload == "0")
+        return false;
+    if (bulkUpload == "1")
+        return true;
+    return _capabilities["dav"].toMap()["bulkupload"].toByteArray() >= "1.0";
+}
+
+bool Capabilities::deltaUpload() const
+{
+    static const auto deltaUpload = qgetenv("OWNCLOUD_DELTA_UPLOAD");
+    if (deltaUpload == "0")
+        return false;
+    if (deltaUpload == "1")
+        return true;
+    return _capabilities["dav"].toMap()["chunking-delta"].toByteArray() >= "1.0";
+}
+
+bool Capabilities::uploadCompression() const
+{
+    static const auto uploadCompression = qgetenv("OWNCLOUD_UPLOAD_COMPRESSION");
+    if (uploadCompression == "0")
+        return false;
+    if (uploadCompression == "1")
+        return true;
+    return _capabilities["dav"].toMap()["upload-compression"].toStringList().contains(QLatin1String("gzip"));
+}
+
+bool Capabilities::propfindDepthInfinity() const
+{
+    static const auto depthInfinity = qgetenv("OWNCLOUD_PROPFIND_DEPTH_INFINITY");
+    if (depthInfinity == "0")
+        return false;
+    if (depthInfinity == "1")
+        return true;
+    return _capabilities["dav"].toMap()["propfind"].toMap()["depth_infinity"].toBool();
+}
+
+bool Capabilities::activityApiAvailable() const
+{
+    return _capabilities.contains("activity")
+        && _capabilities["activity"].toMap().contains("apiv2");
+}
+
 bool Capabilities::privateLinkPropertyAvailable() const
 {
     return _capabilities["files"].toMap()["privateLinks"].toBool();
@@ -47,9 +47,53 @@ public:
     /// disable parallel upload in chunking
     bool chunkingParallelUploadDisabled() const;
 
+    /**
+     * Whether many small files can be uploaded with one multipart request.
+     *
+     * Path: dav/bulkupload
+     * Default: false, can be forced with OWNCLOUD_BULK_UPLOAD
+     */
+    bool bulkUpload() const;
+
+    /**
+     * Whether a chunked upload may only contain the changed parts of a file.
+     *
+     * The final MOVE then has an OC-Delta-Base header with the etag of the
+     * version the other parts are taken from, and every chunk is placed
+     * at its OC-Chunk-Offset.
+     *
+     * Path: dav/chunking-delta
+     * Default: false, can be forced with OWNCLOUD_DELTA_UPLOAD
+     */
+    bool deltaUpload() const;
+
+    /**
+     * Whether the chunks of an upload may be sent with Content-Encoding gzip.
+     *
+     * Path: dav/upload-compression, a list of encodings
+     * Default: false, can be forced with OWNCLOUD_UPLOAD_COMPRESSION
+     */
+    bool uploadCompression() const;
+
     /// Whether the "privatelink" DAV property is available
     bool privateLinkPropertyAvailable() const;
 
+    /**
+     * Whether PROPFIND requests with "Depth: infinity" are allowed.
+     *
+     * Path: dav/propfind/depth_infinity
+     * Default: false, can be forced with OWNCLOUD_PROPFIND_DEPTH_INFINITY
+     */
+    bool propfindDepthInfinity() const;
+
+    /**
+     * Whether the activity app of the server has its v2 OCS API,
+     * ocs/v2.php/apps/activity/api/v2/activity.
+     *
+     * See RemoteChangeNotifier.
+     */
+    bool activityApiAvailable() const;
+
     /// returns true if the capabilities report notifications
     bool notificationsAvailable() const;
 
@@ -80,9 +124,10 @@ public:
     QByteArray preferredUploadChecksumType() const;
 
     /**
-     * Helper that returns the preferredUploadChecksumType() if set, or one
-     * of the supportedChecksumTypes() if it isn't. May return an empty
-     * QByteArray if no checksum types are supported.
+     * Helper that returns the preferredUploadChecksumType() if set, or the
+     * first of the supportedChecksumTypes() if it isn't. Types the client
+     * can't compute are skipped. May return an empty QByteArray if no
+     * checksum types are supported.
      */
     QByteArray uploadChecksumType() const;
 
@@ -116,6 +161,9 @@ public:
      */
     QString invalidFilenameRegex() const;
 
+    /** All the capabilities, as received from the server */
+    const QVariantMap &toVariantMap() const { return _capabilities; }
+
 private:
     QVariantMap _capabilities;
 };
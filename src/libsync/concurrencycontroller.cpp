@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "concurrencycontroller.h"
+
+#include <QLoggingCategory>
+#include <QtGlobal>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcConcurrency, "sync.propagator.concurrency", QtInfoMsg)
+
+// The base latency is the minimum over this many samples, so that it can
+// follow a network that became slower.
+static const int BaseLatencyWindow = 100;
+
+// The latency is considered inflated above twice the base latency, but
+// never below this much over it: on a LAN a few ms more are just noise.
+static const qint64 LatencySlackMs = 50;
+
+ConcurrencyController::ConcurrencyController(int initialLimit, int minLimit, int maxLimit)
+    : _limit(qBound(minLimit, initialLimit, maxLimit))
+    , _minLimit(minLimit)
+    , _maxLimit(maxLimit)
+    , _completionsSinceDecrease(initialLimit)
+{
+    _transferTimer.start();
+}
+
+int ConcurrencyController::limit() const
+{
+    return qBound(_minLimit, static_cast<int>(_limit), _maxLimit);
+}
+
+void ConcurrencyController::reportLatency(qint64 ms)
+{
+    ++_completionsSinceDecrease;
+
+    if (_windowMinLatencyMs < 0 || ms < _windowMinLatencyMs)
+        _windowMinLatencyMs = ms;
+    if (_baseLatencyMs < 0 || ms < _baseLatencyMs)
+        _baseLatencyMs = ms;
+    if (++_windowSamples >= BaseLatencyWindow) {
+        _baseLatencyMs = _windowMinLatencyMs;
+        _windowMinLatencyMs = -1;
+        _windowSamples = 0;
+    }
+
+    if (_smoothedLatencyMs == 0) {
+        _smoothedLatencyMs = ms;
+    } else {
+        _smoothedLatencyMs = _smoothedLatencyMs * 7 / 8 + ms / 8.;
+    }
+
+    if (_smoothedLatencyMs > qMax(2 * _baseLatencyMs, _baseLatencyMs + LatencySlackMs)) {
+        // The requests start to queue up somewhere
+        decrease(0.75);
+        return;
+    }
+
+    if (_slowStart) {
+        _limit += 1;
+    } else {
+        _limit += 1 / _limit;
+    }
+    _limit = qMin<double>(_limit, _maxLimit);
+}
+
+void ConcurrencyController::reportTransfer(quint64 bytes)
+{
+    _transferredBytes += bytes;
+}
+
+void ConcurrencyController::reportFailure()
+{
+    ++_failures;
+    ++_completionsSinceDecrease;
+    decrease(0.5);
+}
+
+void ConcurrencyController::decrease(double factor)
+{
+    // Requests that were started before the last decrease don't count
+    if (_completionsSinceDecrease < limit())
+        return;
+    _limit = qMax<double>(_minLimit, _limit * factor);
+    _slowStart = false;
+    _completionsSinceDecrease = 0;
+    qCInfo(lcConcurrency) << "Reducing the number of parallel jobs to" << limit()
+                          << "latency:" << qRound64(_smoothedLatencyMs) << "base:" << _baseLatencyMs
+                          << "failures:" << _failures;
+}
+
+ConcurrencyController::State ConcurrencyController::state() const
+{
+    State s;
+    s.limit = limit();
+    s.slowStart = _slowStart;
+    s.baseLatencyMs = qMax<qint64>(0, _baseLatencyMs);
+    s.smoothedLatencyMs = qRound64(_smoothedLatencyMs);
+    const qint64 elapsed = _transferTimer.elapsed();
+    s.goodput = elapsed > 0 ? _transferredBytes * 1000 / elapsed : 0;
+    s.failures = _failures;
+    return s;
+}
+}
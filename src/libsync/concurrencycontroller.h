@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef CONCURRENCYCONTROLLER_H
+#define CONCURRENCYCONTROLLER_H
+
+#include "owncloudlib.h"
+
+#include <QElapsedTimer>
+
+namespace OCC {
+
+/**
+ * @brief Tunes the number of jobs the propagator runs in parallel
+ *
+ * An additive-increase/multiplicative-decrease controller, as used for TCP
+ * congestion windows. The limit grows while the quick requests (MKCOL,
+ * DELETE, small up- and downloads) answer about as fast as the fastest
+ * ones seen, and shrinks when their latency goes up or the server answers
+ * with an overload error.
+ *
+ * It starts with a slow start phase that grows the limit by one for every
+ * completed request, so that fast networks quickly get to the maximum.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ConcurrencyController
+{
+public:
+    struct State
+    {
+        int limit = 0;
+        bool slowStart = false;
+        qint64 baseLatencyMs = 0; // the fastest recent quick request
+        qint64 smoothedLatencyMs = 0;
+        quint64 goodput = 0; // bytes of completed transfers per second
+        qint64 failures = 0;
+    };
+
+    ConcurrencyController(int initialLimit, int minLimit, int maxLimit);
+
+    /** The number of jobs that may be active at the same time */
+    int limit() const;
+
+    /** A quick request completed successfully after @a ms milliseconds */
+    void reportLatency(qint64 ms);
+
+    /** A transfer of @a bytes completed */
+    void reportTransfer(quint64 bytes);
+
+    /** A request failed in a way that hints at an overloaded server or network */
+    void reportFailure();
+
+    State state() const;
+
+private:
+    void decrease(double factor);
+
+    double _limit;
+    int _minLimit;
+    int _maxLimit;
+    bool _slowStart = true;
+
+    // Completions since the last decrease, the limit is only reduced once
+    // per round of requests.
+    int _completionsSinceDecrease;
+
+    qint64 _baseLatencyMs = -1;
+    qint64 _windowMinLatencyMs = -1;
+    int _windowSamples = 0;
+    double _smoothedLatencyMs = 0;
+
+    quint64 _transferredBytes = 0;
+    QElapsedTimer _transferTimer; // since the start of the propagation
+    qint64 _failures = 0;
+};
+}
+
+#endif
@@ -29,10 +29,14 @@
 #endif
 
 #include <QCoreApplication>
+#include <QDateTime>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
 #include <QLoggingCategory>
+#include <QMutex>
 #include <QSettings>
 #include <QNetworkProxy>
 #include <QStandardPaths>
@@ -59,10 +63,15 @@ static const char skipUpdateCheckC[] = "skipUpdateCheck";
 static const char updateCheckIntervalC[] = "updateCheckInterval";
 static const char geometryC[] = "geometry";
 static const char timeoutC[] = "timeout";
+static const char maxConcurrentSyncsC[] = "maxConcurrentSyncs";
 static const char chunkSizeC[] = "chunkSize";
 static const char minChunkSizeC[] = "minChunkSize";
 static const char maxChunkSizeC[] = "maxChunkSize";
 static const char targetChunkUploadDurationC[] = "targetChunkUploadDuration";
+static const char uploadStabilityIntervalC[] = "uploadStabilityInterval";
+static const char virtualFilePrefetchBudgetC[] = "virtualFilePrefetchBudget";
+static const char journalMaxCacheSizeC[] = "journalMaxCacheSize";
+static const char journalMaxMmapSizeC[] = "journalMaxMmapSize";
 
 static const char proxyHostC[] = "Proxy/host";
 static const char proxyTypeC[] = "Proxy/type";
@@ -75,6 +84,7 @@ static const char useUploadLimitC[] = "BWLimit/useUploadLimit";
 static const char useDownloadLimitC[] = "BWLimit/useDownloadLimit";
 static const char uploadLimitC[] = "BWLimit/uploadLimit";
 static const char downloadLimitC[] = "BWLimit/downloadLimit";
+static const char bandwidthScheduleC[] = "BWLimit/schedule";
 
 static const char newBigFolderSizeLimitC[] = "newBigFolderSizeLimit";
 static const char useNewBigFolderSizeLimitC[] = "useNewBigFolderSizeLimit";
@@ -87,18 +97,92 @@ const char certPasswd[] = "http_certificatePasswd";
 QString ConfigFile::_confDir = QString::null;
 bool ConfigFile::_askedUser = false;
 
+// Edits from outside of ConfigFile are noticed after at most that long
+static const qint64 SettingsCheckIntervalMsecs = 1000;
+
+namespace {
+    struct CachedSettings
+    {
+        bool loaded = false;
+        QDateTime modified;
+        qint64 size = -1;
+        qint64 checkedMsecs = 0;
+        QHash<QString, QVariant> values;
+    };
+
+    // The parsed settings files by file name, reading a value neither
+    // parses nor locks the file
+    struct SettingsCache
+    {
+        SettingsCache() { timer.start(); }
+
+        QMutex mutex;
+        QElapsedTimer timer;
+        QHash<QString, CachedSettings> files;
+    };
+
+    Q_GLOBAL_STATIC(SettingsCache, settingsCache)
+
+    // Like QSettings, which ignores the case of the ini keys on Windows
+    QString settingsCacheKey(const QString &key)
+    {
+        return Utility::isWindows() ? key.toLower() : key;
+    }
+
+    QVariant cachedSettingsValue(const QString &fileName, QSettings::Format format,
+        const QString &key, const QVariant &defaultValue)
+    {
+        auto cache = settingsCache();
+        QMutexLocker locker(&cache->mutex);
+        CachedSettings &file = cache->files[fileName];
+        const qint64 now = cache->timer.elapsed();
+        if (!file.loaded || now - file.checkedMsecs >= SettingsCheckIntervalMsecs) {
+            file.checkedMsecs = now;
+            // The user, another instance or a QSettings of settingsWithGroup() may have written it
+            QFileInfo info(fileName);
+            if (!file.loaded || info.lastModified() != file.modified || info.size() != file.size) {
+                file.loaded = true;
+                file.modified = info.lastModified();
+                file.size = info.size();
+                file.values.clear();
+                QSettings settings(fileName, format);
+                foreach (const QString &settingsKey, settings.allKeys()) {
+                    file.values.insert(settingsCacheKey(settingsKey), settings.value(settingsKey));
+                }
+            }
+        }
+        return file.values.value(settingsCacheKey(key), defaultValue);
+    }
+
+    void invalidateCachedSettings(const QString &fileName)
+    {
+        auto cache = settingsCache();
+        QMutexLocker locker(&cache->mutex);
+        cache->files.remove(fileName);
+    }
+
+    // Writes the config file and has the cache read it again
+    class SettingsWriter : public QSettings
+    {
+    public:
+        explicit SettingsWriter(const QString &fileName)
+            : QSettings(fileName, QSettings::IniFormat)
+        {
+        }
+        ~SettingsWriter()
+        {
+            sync();
+            invalidateCachedSettings(fileName());
+        }
+    };
+}
+
 ConfigFile::ConfigFile()
 {
     // QDesktopServices uses the application name to create a config path
     qApp->setApplicationName(Theme::instance()->appNameGUI());
 
     QSettings::setDefaultFormat(QSettings::IniFormat);
-
-    const QString config = configFile();
-
-
-    QSettings settings(config, QSettings::IniFormat);
-    settings.beginGroup(defaultConnection());
 }
 
 bool ConfigFile::setConfDir(const QString &value)
@@ -123,8 +207,7 @@ bool ConfigFile::setConfDir(const QString &value)
 
 bool ConfigFile::optionalDesktopNotifications() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(optionalDesktopNoficationsC), true).toBool();
+    return cachedValue(QLatin1String(optionalDesktopNoficationsC), QString(), true).toBool();
 }
 
 bool ConfigFile::showInExplorerNavigationPane() const
@@ -136,62 +219,78 @@ bool ConfigFile::showInExplorerNavigationPane() const
         false
 #endif
         ;
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(showInExplorerNavigationPaneC), defaultValue).toBool();
+    return cachedValue(QLatin1String(showInExplorerNavigationPaneC), QString(), defaultValue).toBool();
 }
 
 void ConfigFile::setShowInExplorerNavigationPane(bool show)
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.setValue(QLatin1String(showInExplorerNavigationPaneC), show);
-    settings.sync();
 }
 
 int ConfigFile::timeout() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(timeoutC), 300).toInt(); // default to 5 min
+    return cachedValue(QLatin1String(timeoutC), QString(), 300).toInt(); // default to 5 min
+}
+
+int ConfigFile::maxConcurrentSyncs() const
+{
+    return cachedValue(QLatin1String(maxConcurrentSyncsC), QString(), 2).toInt();
 }
 
 quint64 ConfigFile::chunkSize() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(chunkSizeC), 10 * 1000 * 1000).toLongLong(); // default to 10 MB
+    return cachedValue(QLatin1String(chunkSizeC), QString(), 10 * 1000 * 1000).toLongLong(); // default to 10 MB
 }
 
 quint64 ConfigFile::maxChunkSize() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(maxChunkSizeC), 100 * 1000 * 1000).toLongLong(); // default to 100 MB
+    return cachedValue(QLatin1String(maxChunkSizeC), QString(), 100 * 1000 * 1000).toLongLong(); // default to 100 MB
 }
 
 quint64 ConfigFile::minChunkSize() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(minChunkSizeC), 1000 * 1000).toLongLong(); // default to 1 MB
+    return cachedValue(QLatin1String(minChunkSizeC), QString(), 1000 * 1000).toLongLong(); // default to 1 MB
 }
 
 quint64 ConfigFile::targetChunkUploadDuration() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(targetChunkUploadDurationC), 60 * 1000).toLongLong(); // default to 1 minute
+    return cachedValue(QLatin1String(targetChunkUploadDurationC), QString(), 60 * 1000).toLongLong(); // default to 1 minute
+}
+
+qint64 ConfigFile::uploadStabilityInterval() const
+{
+    return cachedValue(QLatin1String(uploadStabilityIntervalC), QString(), 5 * 1000).toLongLong(); // default to 5 seconds
+}
+
+qint64 ConfigFile::virtualFilePrefetchBudget() const
+{
+    return cachedValue(QLatin1String(virtualFilePrefetchBudgetC), QString(), 100 * 1000 * 1000).toLongLong(); // default to 100 MB
+}
+
+int ConfigFile::journalMaxCacheSize() const
+{
+    return cachedValue(QLatin1String(journalMaxCacheSizeC), QString(), 64 * 1024).toInt(); // default to 64 MiB
+}
+
+qint64 ConfigFile::journalMaxMmapSize() const
+{
+    return cachedValue(QLatin1String(journalMaxMmapSizeC), QString(), 256 * 1000 * 1000).toLongLong(); // default to 256 MB
 }
 
 void ConfigFile::setOptionalDesktopNotifications(bool show)
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.setValue(QLatin1String(optionalDesktopNoficationsC), show);
-    settings.sync();
 }
 
 void ConfigFile::saveGeometry(QWidget *w)
 {
 #ifndef TOKEN_AUTH_ONLY
     ASSERT(!w->objectName().isNull());
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.beginGroup(w->objectName());
     settings.setValue(QLatin1String(geometryC), w->saveGeometry());
-    settings.sync();
 #endif
 }
 
@@ -209,10 +308,9 @@ void ConfigFile::saveGeometryHeader(QHeaderView *header)
         return;
     ASSERT(!header->objectName().isEmpty());
 
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.beginGroup(header->objectName());
     settings.setValue(QLatin1String(geometryC), header->saveState());
-    settings.sync();
 #endif
 }
 
@@ -223,9 +321,7 @@ void ConfigFile::restoreGeometryHeader(QHeaderView *header)
         return;
     ASSERT(!header->objectName().isNull());
 
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(header->objectName());
-    header->restoreState(settings.value(geometryC).toByteArray());
+    header->restoreState(cachedValue(geometryC, header->objectName()).toByteArray());
 #endif
 }
 
@@ -337,26 +433,22 @@ QString ConfigFile::defaultConnection() const
 void ConfigFile::storeData(const QString &group, const QString &key, const QVariant &value)
 {
     const QString con(group.isEmpty() ? defaultConnection() : group);
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
 
     settings.beginGroup(con);
     settings.setValue(key, value);
-    settings.sync();
 }
 
 QVariant ConfigFile::retrieveData(const QString &group, const QString &key) const
 {
     const QString con(group.isEmpty() ? defaultConnection() : group);
-    QSettings settings(configFile(), QSettings::IniFormat);
-
-    settings.beginGroup(con);
-    return settings.value(key);
+    return cachedValue(key, con);
 }
 
 void ConfigFile::removeData(const QString &group, const QString &key)
 {
     const QString con(group.isEmpty() ? defaultConnection() : group);
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
 
     settings.beginGroup(con);
     settings.remove(key);
@@ -365,10 +457,7 @@ void ConfigFile::removeData(const QString &group, const QString &key)
 bool ConfigFile::dataExists(const QString &group, const QString &key) const
 {
     const QString con(group.isEmpty() ? defaultConnection() : group);
-    QSettings settings(configFile(), QSettings::IniFormat);
-
-    settings.beginGroup(con);
-    return settings.contains(key);
+    return cachedValue(key, con).isValid();
 }
 
 int ConfigFile::remotePollInterval(const QString &connection) const
@@ -377,10 +466,7 @@ int ConfigFile::remotePollInterval(const QString &connection) const
     if (connection.isEmpty())
         con = defaultConnection();
 
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(con);
-
-    int remoteInterval = settings.value(QLatin1String(remotePollIntervalC), DEFAULT_REMOTE_POLL_INTERVAL).toInt();
+    int remoteInterval = cachedValue(QLatin1String(remotePollIntervalC), con, DEFAULT_REMOTE_POLL_INTERVAL).toInt();
     if (remoteInterval < 5000) {
         qCWarning(lcConfigFile) << "Remote Interval is less than 5 seconds, reverting to" << DEFAULT_REMOTE_POLL_INTERVAL;
         remoteInterval = DEFAULT_REMOTE_POLL_INTERVAL;
@@ -398,10 +484,9 @@ void ConfigFile::setRemotePollInterval(int interval, const QString &connection)
         qCWarning(lcConfigFile) << "Remote Poll interval of " << interval << " is below five seconds.";
         return;
     }
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.beginGroup(con);
     settings.setValue(QLatin1String(remotePollIntervalC), interval);
-    settings.sync();
 }
 
 quint64 ConfigFile::forceSyncInterval(const QString &connection) const
@@ -411,11 +496,8 @@ quint64 ConfigFile::forceSyncInterval(const QString &connection) const
     QString con(connection);
     if (connection.isEmpty())
         con = defaultConnection();
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(con);
-
     quint64 defaultInterval = 2 * 60 * 60 * 1000ull; // 2h
-    quint64 interval = settings.value(QLatin1String(forceSyncIntervalC), defaultInterval).toULongLong();
+    quint64 interval = cachedValue(QLatin1String(forceSyncIntervalC), con, defaultInterval).toULongLong();
     if (interval < pollInterval) {
         qCWarning(lcConfigFile) << "Force sync interval is less than the remote poll inteval, reverting to" << pollInterval;
         interval = pollInterval;
@@ -425,9 +507,7 @@ quint64 ConfigFile::forceSyncInterval(const QString &connection) const
 
 qint64 ConfigFile::fullLocalDiscoveryInterval() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(defaultConnection());
-    return settings.value(QLatin1String(fullLocalDiscoveryIntervalC), DEFAULT_FULL_LOCAL_DISCOVERY_INTERVAL).toLongLong();
+    return cachedValue(QLatin1String(fullLocalDiscoveryIntervalC), defaultConnection(), DEFAULT_FULL_LOCAL_DISCOVERY_INTERVAL).toLongLong();
 }
 
 quint64 ConfigFile::notificationRefreshInterval(const QString &connection) const
@@ -435,11 +515,8 @@ quint64 ConfigFile::notificationRefreshInterval(const QString &connection) const
     QString con(connection);
     if (connection.isEmpty())
         con = defaultConnection();
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(con);
-
     quint64 defaultInterval = 5 * 60 * 1000ull; // 5 minutes
-    quint64 interval = settings.value(QLatin1String(notificationRefreshIntervalC), defaultInterval).toULongLong();
+    quint64 interval = cachedValue(QLatin1String(notificationRefreshIntervalC), con, defaultInterval).toULongLong();
     if (interval < 60 * 1000ull) {
         qCWarning(lcConfigFile) << "Notification refresh interval smaller than one minute, setting to one minute";
         interval = 60 * 1000ull;
@@ -452,11 +529,8 @@ int ConfigFile::updateCheckInterval(const QString &connection) const
     QString con(connection);
     if (connection.isEmpty())
         con = defaultConnection();
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(con);
-
     int defaultInterval = 1000 * 60 * 60 * 10; // ten hours
-    int interval = settings.value(QLatin1String(updateCheckIntervalC), defaultInterval).toInt();
+    int interval = cachedValue(QLatin1String(updateCheckIntervalC), con, defaultInterval).toInt();
 
     int minInterval = 1000 * 60 * 5;
     if (interval < minInterval) {
@@ -485,24 +559,21 @@ void ConfigFile::setSkipUpdateCheck(bool skip, const QString &connection)
     if (connection.isEmpty())
         con = defaultConnection();
 
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.beginGroup(con);
 
     settings.setValue(QLatin1String(skipUpdateCheckC), QVariant(skip));
-    settings.sync();
 }
 
 int ConfigFile::maxLogLines() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(maxLogLinesC), DEFAULT_MAX_LOG_LINES).toInt();
+    return cachedValue(QLatin1String(maxLogLinesC), QString(), DEFAULT_MAX_LOG_LINES).toInt();
 }
 
 void ConfigFile::setMaxLogLines(int lines)
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.setValue(QLatin1String(maxLogLinesC), lines);
-    settings.sync();
 }
 
 void ConfigFile::setProxyType(int proxyType,
@@ -511,7 +582,7 @@ void ConfigFile::setProxyType(int proxyType,
     const QString &user,
     const QString &pass)
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
 
     settings.setValue(QLatin1String(proxyTypeC), proxyType);
 
@@ -522,26 +593,20 @@ void ConfigFile::setProxyType(int proxyType,
         settings.setValue(QLatin1String(proxyUserC), user);
         settings.setValue(QLatin1String(proxyPassC), pass.toUtf8().toBase64());
     }
-    settings.sync();
 }
 
 QVariant ConfigFile::getValue(const QString &param, const QString &group,
     const QVariant &defaultValue) const
 {
+    const QString key = group.isEmpty() ? param : group + QLatin1Char('/') + param;
     QVariant systemSetting;
     if (Utility::isMac()) {
-        QSettings systemSettings(QLatin1String("/Library/Preferences/" APPLICATION_REV_DOMAIN ".plist"), QSettings::NativeFormat);
-        if (!group.isEmpty()) {
-            systemSettings.beginGroup(group);
-        }
-        systemSetting = systemSettings.value(param, defaultValue);
+        systemSetting = cachedSettingsValue(QLatin1String("/Library/Preferences/" APPLICATION_REV_DOMAIN ".plist"),
+            QSettings::NativeFormat, key, defaultValue);
     } else if (Utility::isUnix()) {
-        QSettings systemSettings(QString(SYSCONFDIR "/%1/%1.conf").arg(Theme::instance()->appName()), QSettings::NativeFormat);
-        if (!group.isEmpty()) {
-            systemSettings.beginGroup(group);
-        }
-        systemSetting = systemSettings.value(param, defaultValue);
-    } else { // Windows
+        systemSetting = cachedSettingsValue(QString(SYSCONFDIR "/%1/%1.conf").arg(Theme::instance()->appName()),
+            QSettings::NativeFormat, key, defaultValue);
+    } else { // Windows, the registry is not parsed
         QSettings systemSettings(QString::fromLatin1("HKEY_LOCAL_MACHINE\\Software\\%1\\%2")
                                      .arg(APPLICATION_VENDOR, Theme::instance()->appName()),
             QSettings::NativeFormat);
@@ -551,16 +616,19 @@ QVariant ConfigFile::getValue(const QString &param, const QString &group,
         systemSetting = systemSettings.value(param, defaultValue);
     }
 
-    QSettings settings(configFile(), QSettings::IniFormat);
-    if (!group.isEmpty())
-        settings.beginGroup(group);
+    return cachedValue(param, group, systemSetting);
+}
 
-    return settings.value(param, systemSetting);
+QVariant ConfigFile::cachedValue(const QString &param, const QString &group,
+    const QVariant &defaultValue) const
+{
+    const QString key = group.isEmpty() ? param : group + QLatin1Char('/') + param;
+    return cachedSettingsValue(configFile(), QSettings::IniFormat, key, defaultValue);
 }
 
 void ConfigFile::setValue(const QString &key, const QVariant &value)
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
 
     settings.setValue(key, value);
 }
@@ -639,6 +707,11 @@ void ConfigFile::setDownloadLimit(int kbytes)
     setValue(downloadLimitC, kbytes);
 }
 
+QString ConfigFile::bandwidthSchedule() const
+{
+    return getValue(bandwidthScheduleC).toString();
+}
+
 QPair<bool, quint64> ConfigFile::newBigFolderSizeLimit() const
 {
     auto defaultValue = Theme::instance()->newBigFolderSizeLimit();
@@ -665,42 +738,39 @@ void ConfigFile::setConfirmExternalStorage(bool isChecked)
 
 bool ConfigFile::promptDeleteFiles() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(promptDeleteC), true).toBool();
+    return cachedValue(QLatin1String(promptDeleteC), QString(), true).toBool();
 }
 
 void ConfigFile::setPromptDeleteFiles(bool promptDeleteFiles)
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.setValue(QLatin1String(promptDeleteC), promptDeleteFiles);
 }
 
 bool ConfigFile::monoIcons() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
     bool monoDefault = false; // On Mac we want bw by default
 #ifdef Q_OS_MAC
     // OEM themes are not obliged to ship mono icons
     monoDefault = (0 == (strcmp("ownCloud", APPLICATION_NAME)));
 #endif
-    return settings.value(QLatin1String(monoIconsC), monoDefault).toBool();
+    return cachedValue(QLatin1String(monoIconsC), QString(), monoDefault).toBool();
 }
 
 void ConfigFile::setMonoIcons(bool useMonoIcons)
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.setValue(QLatin1String(monoIconsC), useMonoIcons);
 }
 
 bool ConfigFile::crashReporter() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(crashReporterC), true).toBool();
+    return cachedValue(QLatin1String(crashReporterC), QString(), true).toBool();
 }
 
 void ConfigFile::setCrashReporter(bool enabled)
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.setValue(QLatin1String(crashReporterC), enabled);
 }
 
@@ -711,9 +781,8 @@ QString ConfigFile::certificatePath() const
 
 void ConfigFile::setCertificatePath(const QString &cPath)
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.setValue(QLatin1String(certPath), cPath);
-    settings.sync();
 }
 
 QString ConfigFile::certificatePasswd() const
@@ -723,9 +792,8 @@ QString ConfigFile::certificatePasswd() const
 
 void ConfigFile::setCertificatePasswd(const QString &cPasswd)
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
+    SettingsWriter settings(configFile());
     settings.setValue(QLatin1String(certPasswd), cPasswd);
-    settings.sync();
 }
 
 Q_GLOBAL_STATIC(QString, g_configFileName)
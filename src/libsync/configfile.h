@@ -112,6 +112,8 @@ public:
     int downloadLimit() const;
     void setUploadLimit(int kbytes);
     void setDownloadLimit(int kbytes);
+    /** Limits by the time of the day, see BandwidthBudget::parseSchedule() */
+    QString bandwidthSchedule() const;
     /** [checked, size in MB] **/
     QPair<bool, quint64> newBigFolderSizeLimit() const;
     void setNewBigFolderSizeLimit(bool isChecked, quint64 mbytes);
@@ -127,10 +129,19 @@ public:
     void setShowInExplorerNavigationPane(bool show);
 
     int timeout() const;
+    /** How many folders of different accounts may sync at the same time */
+    int maxConcurrentSyncs() const;
     quint64 chunkSize() const;
     quint64 maxChunkSize() const;
     quint64 minChunkSize() const;
     quint64 targetChunkUploadDuration() const;
+    /** Milliseconds a changed file must be left alone before it is uploaded, see SyncOptions::_uploadStabilityMsec */
+    qint64 uploadStabilityInterval() const;
+    /** Bytes of placeholders Folder::downloadVirtualFile() may download ahead, 0 to disable */
+    qint64 virtualFilePrefetchBudget() const;
+    /** Upper limits for sizing the journals by their size, see SyncJournalDb::setAutoTuneLimits() */
+    int journalMaxCacheSize() const; // KiB
+    qint64 journalMaxMmapSize() const; // bytes
 
     void saveGeometry(QWidget *w);
     void restoreGeometry(QWidget *w);
@@ -167,6 +178,9 @@ private:
     QVariant getValue(const QString &param, const QString &group = QString::null,
         const QVariant &defaultValue = QVariant()) const;
     void setValue(const QString &key, const QVariant &value);
+    // The value of the config file only, from the process-wide cache
+    QVariant cachedValue(const QString &param, const QString &group = QString(),
+        const QVariant &defaultValue = QVariant()) const;
 
 private:
     typedef QSharedPointer<AbstractCredentials> SharedCreds;
@@ -12,6 +12,8 @@
  * for more details.
  */
 
+#include <QElapsedTimer>
+#include <QHash>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QLoggingCategory>
@@ -33,10 +35,33 @@ Q_LOGGING_CATEGORY(lcConnectionValidator, "sync.connectionvalidator", QtInfoMsg)
 // This makes sure we get tried often enough without "ConnectionValidator already running"
 static qint64 timeoutToUseMsec = qMax(1000, ConnectionValidator::DefaultCallingIntervalMsec - 5 * 1000);
 
+namespace {
+    /** The last status.php reply of a server, see ConnectionValidator::serverStatusReuseMsec */
+    struct ServerStatus
+    {
+        QUrl _url;
+        QJsonObject _info;
+        QElapsedTimer _age;
+    };
+
+    // The accounts of one server run their checks at the same interval,
+    // only one of them needs to ask the server for its status.
+    // Keyed by the url of the accounts, before redirections.
+    QHash<QString, ServerStatus> &recentServerStatus()
+    {
+        static QHash<QString, ServerStatus> statuses;
+        return statuses;
+    }
+}
+
+qint64 ConnectionValidator::serverStatusReuseMsec = DefaultCallingIntervalMsec / 2;
+
 ConnectionValidator::ConnectionValidator(AccountPtr account, QObject *parent)
     : QObject(parent)
     , _account(account)
     , _isCheckingServerAndAuth(false)
+    , _refreshingInBackground(false)
+    , _timeoutMsec(timeoutToUseMsec)
 {
 }
 
@@ -113,21 +138,40 @@ void ConnectionValidator::systemProxyLookupDone(const QNetworkProxy &proxy)
 // The actual check
 void ConnectionValidator::slotCheckServerAndAuth()
 {
+    // The authentication is still checked with this account's own request
+    const auto cached = recentServerStatus().constFind(_account->url().toString());
+    if (cached != recentServerStatus().constEnd() && cached->_age.elapsed() < serverStatusReuseMsec) {
+        qCDebug(lcConnectionValidator) << "Reusing the status of" << cached->_url << "checked" << cached->_age.elapsed() << "ms ago";
+        slotStatusFound(cached->_url, cached->_info);
+        return;
+    }
+
     CheckServerJob *checkJob = new CheckServerJob(_account, this);
-    checkJob->setTimeout(timeoutToUseMsec);
+    checkJob->setTimeout(_timeoutMsec);
     checkJob->setIgnoreCredentialFailure(true);
-    connect(checkJob, &CheckServerJob::instanceFound, this, &ConnectionValidator::slotStatusFound);
+    connect(checkJob, &CheckServerJob::instanceFound, this, &ConnectionValidator::slotStatusChecked);
     connect(checkJob, &CheckServerJob::instanceNotFound, this, &ConnectionValidator::slotNoStatusFound);
     connect(checkJob, &CheckServerJob::timeout, this, &ConnectionValidator::slotJobTimeout);
     checkJob->start();
 }
 
+void ConnectionValidator::slotStatusChecked(const QUrl &url, const QJsonObject &info)
+{
+    ServerStatus &status = recentServerStatus()[_account->url().toString()];
+    status._url = url;
+    status._info = info;
+    status._age.start();
+
+    slotStatusFound(url, info);
+}
+
 void ConnectionValidator::slotStatusFound(const QUrl &url, const QJsonObject &info)
 {
     // Newer servers don't disclose any version in status.php anymore
     // https://github.com/owncloud/core/pull/27473/files
     // so this string can be empty.
     QString serverVersion = CheckServerJob::version(info);
+    const QString previousServerVersion = _account->serverVersion();
 
     // status.php was found.
     qCInfo(lcConnectionValidator) << "** Application: ownCloud found: "
@@ -153,6 +197,13 @@ void ConnectionValidator::slotStatusFound(const QUrl &url, const QJsonObject &in
         return;
     }
 
+    // The last known capabilities are used until the server changes its version,
+    // the folders can sync once the authentication works
+    if (_account->hasCapabilities() && (serverVersion.isEmpty() || serverVersion == previousServerVersion)) {
+        qCInfo(lcConnectionValidator) << "Using the last known capabilities, refreshing them once connected";
+        _refreshingInBackground = true;
+    }
+
     // now check the authentication
     QTimer::singleShot(0, this, &ConnectionValidator::checkAuthentication);
 }
@@ -199,7 +250,7 @@ void ConnectionValidator::checkAuthentication()
     // continue in slotAuthCheck here :-)
     qCDebug(lcConnectionValidator) << "# Check whether authenticated propfind works.";
     PropfindJob *job = new PropfindJob(_account, "/", this);
-    job->setTimeout(timeoutToUseMsec);
+    job->setTimeout(_timeoutMsec);
     job->setProperties(QList<QByteArray>() << "getlastmodified");
     connect(job, &PropfindJob::result, this, &ConnectionValidator::slotAuthSuccess);
     connect(job, &PropfindJob::finishedWithError, this, &ConnectionValidator::slotAuthFailed);
@@ -238,6 +289,13 @@ void ConnectionValidator::slotAuthFailed(QNetworkReply *reply)
 void ConnectionValidator::slotAuthSuccess()
 {
     _errors.clear();
+    if (_refreshingInBackground) {
+        // Only with working credentials, the OCS requests would fail otherwise
+        AccountPtr account = _account;
+        reportResult(Connected);
+        refreshInBackground(account);
+        return;
+    }
     if (!_isCheckingServerAndAuth) {
         reportResult(Connected);
         return;
@@ -267,12 +325,7 @@ void ConnectionValidator::checkServerCapabilities()
 
 void ConnectionValidator::slotCapabilitiesRecieved(const QJsonDocument &json)
 {
-    auto caps = json.object().value("ocs").toObject().value("data").toObject().value("capabilities").toObject();
-    qCInfo(lcConnectionValidator) << "Server capabilities" << caps;
-    _account->setCapabilities(caps.toVariantMap());
-
-    // New servers also report the version in the capabilities
-    QString serverVersion = caps["core"].toObject()["status"].toObject()["version"].toString();
+    QString serverVersion = applyCapabilities(json, _account);
     if (!serverVersion.isEmpty() && !setAndCheckServerVersion(serverVersion)) {
         return;
     }
@@ -280,6 +333,62 @@ void ConnectionValidator::slotCapabilitiesRecieved(const QJsonDocument &json)
     fetchUser();
 }
 
+QString ConnectionValidator::applyCapabilities(const QJsonDocument &json, AccountPtr account)
+{
+    auto caps = json.object().value("ocs").toObject().value("data").toObject().value("capabilities").toObject();
+    qCInfo(lcConnectionValidator) << "Server capabilities" << caps;
+    const QVariantMap capsMap = caps.toVariantMap();
+    if (capsMap != account->capabilities().toVariantMap()) {
+        account->setCapabilities(capsMap);
+        // They are kept for the next start
+        emit account->wantsAccountSaved(account.data());
+    }
+
+    // New servers also report the version in the capabilities
+    return caps["core"].toObject()["status"].toObject()["version"].toString();
+}
+
+void ConnectionValidator::refreshInBackground(AccountPtr account)
+{
+    // Not parented, the validator is gone once the authentication is checked
+    auto capsJob = new JsonApiJob(account, QLatin1String("ocs/v1.php/cloud/capabilities"));
+    capsJob->setTimeout(timeoutToUseMsec);
+    QObject::connect(capsJob, &JsonApiJob::jsonReceived, account.data(),
+        [=](const QJsonDocument &json) {
+            const QString serverVersion = applyCapabilities(json, account);
+            // The folders react to serverVersionChanged()
+            if (!serverVersion.isEmpty() && serverVersion != account->serverVersion()) {
+                qCInfo(lcConnectionValidator) << account->url() << "changed its version to" << serverVersion;
+                account->setServerVersion(serverVersion);
+                emit account->wantsAccountSaved(account.data());
+            }
+        });
+    capsJob->start();
+
+    auto configJob = new JsonApiJob(account, QLatin1String("ocs/v1.php/config"));
+    configJob->setTimeout(timeoutToUseMsec);
+    QObject::connect(configJob, &JsonApiJob::jsonReceived, account.data(),
+        [=](const QJsonDocument &json) {
+            ocsConfigReceived(json, account);
+        });
+    configJob->start();
+
+    auto userJob = new JsonApiJob(account, QLatin1String("ocs/v1.php/cloud/user"));
+    userJob->setTimeout(timeoutToUseMsec);
+    QObject::connect(userJob, &JsonApiJob::jsonReceived, account.data(),
+        [=](const QJsonDocument &json) {
+            applyUser(json, account);
+#ifndef TOKEN_AUTH_ONLY
+            AvatarJob *job = new AvatarJob(account, account->davUser(), 128);
+            job->setTimeout(20 * 1000);
+            QObject::connect(job, &AvatarJob::avatarPixmap, account.data(),
+                [=](const QImage &img) { account->setAvatar(img); });
+            job->start();
+#endif
+        });
+    userJob->start();
+}
+
 void ConnectionValidator::ocsConfigReceived(const QJsonDocument &json, AccountPtr account)
 {
     QString host = json.object().value("ocs").toObject().value("data").toObject().value("host").toString();
@@ -327,16 +436,23 @@ bool ConnectionValidator::setAndCheckServerVersion(const QString &version)
     return true;
 }
 
-void ConnectionValidator::slotUserFetched(const QJsonDocument &json)
+void ConnectionValidator::applyUser(const QJsonDocument &json, AccountPtr account)
 {
     QString user = json.object().value("ocs").toObject().value("data").toObject().value("id").toString();
-    if (!user.isEmpty()) {
-        _account->setDavUser(user);
+    if (!user.isEmpty() && user != account->davUser()) {
+        account->setDavUser(user);
+        // The dav path of the next start depends on it
+        emit account->wantsAccountSaved(account.data());
     }
     QString displayName = json.object().value("ocs").toObject().value("data").toObject().value("display-name").toString();
     if (!displayName.isEmpty()) {
-        _account->setDavDisplayName(displayName);
+        account->setDavDisplayName(displayName);
     }
+}
+
+void ConnectionValidator::slotUserFetched(const QJsonDocument &json)
+{
+    applyUser(json, _account);
 #ifndef TOKEN_AUTH_ONLY
     AvatarJob *job = new AvatarJob(_account, _account->davUser(), 128, this);
     job->setTimeout(20 * 1000);
@@ -74,6 +74,13 @@ namespace OCC {
               +-> slotAvatarImage --> reportResult()
 
     \endcode
+
+ * When the account has the capabilities of the last connection and status.php
+ * reports the same server version, refreshInBackground() fetches the
+ * capabilities, the config, the user and the avatar once checkAuthentication
+ * succeeds, slotAuthSuccess reports the result without waiting for them.
+ * A changed server version in the fresh capabilities is announced with
+ * Account::serverVersionChanged().
  */
 class OWNCLOUDSYNC_EXPORT ConnectionValidator : public QObject
 {
@@ -100,6 +107,15 @@ public:
     // How often should the Application ask this object to check for the connection?
     enum { DefaultCallingIntervalMsec = 32 * 1000 };
 
+    /** How long the status.php of a server is reused for the checks of its other accounts
+     *
+     * Half the calling interval by default.
+     */
+    static qint64 serverStatusReuseMsec;
+
+    /** The timeout of the status and authentication requests, to be set before the check */
+    void setTimeout(qint64 msec) { _timeoutMsec = msec; }
+
 public slots:
     /// Checks the server and the authentication.
     void checkServerAndAuth();
@@ -114,6 +130,7 @@ signals:
 protected slots:
     void slotCheckServerAndAuth();
 
+    void slotStatusChecked(const QUrl &url, const QJsonObject &info);
     void slotStatusFound(const QUrl &url, const QJsonObject &info);
     void slotNoStatusFound(QNetworkReply *reply);
     void slotJobTimeout(const QUrl &url);
@@ -132,6 +149,10 @@ private:
     void checkServerCapabilities();
     void fetchUser();
     static void ocsConfigReceived(const QJsonDocument &json, AccountPtr account);
+    static void refreshInBackground(AccountPtr account);
+    /** Sets the capabilities of the reply, returns the server version they have */
+    static QString applyCapabilities(const QJsonDocument &json, AccountPtr account);
+    static void applyUser(const QJsonDocument &json, AccountPtr account);
 
     /** Sets the account's server version
      *
@@ -142,6 +163,8 @@ private:
     QStringList _errors;
     AccountPtr _account;
     bool _isCheckingServerAndAuth;
+    bool _refreshingInBackground;
+    qint64 _timeoutMsec;
 };
 }
 
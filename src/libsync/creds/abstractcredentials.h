@@ -66,6 +66,19 @@ public:
     virtual bool stillValid(QNetworkReply *reply) = 0;
     virtual void persist() = 0;
 
+    /** Whether the request of the failed @a reply is worth sending again when
+     * the credentials are ready(), because it went out with credentials that
+     * were being replaced.
+     *
+     * fetched() is emitted when that happened, if isRefreshing().
+     */
+    virtual bool retryAfterRefresh(QNetworkReply *reply) const
+    {
+        Q_UNUSED(reply);
+        return false;
+    }
+    virtual bool isRefreshing() const { return false; }
+
     /** Invalidates token used to authorize requests, it will no longer be used.
      *
      * For http auth, this would be the session cookie.
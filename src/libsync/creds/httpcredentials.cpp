@@ -22,6 +22,8 @@
 #include <QJsonDocument>
 #include <QBuffer>
 
+#include <limits>
+
 #include <keychain.h>
 
 #include "account.h"
@@ -39,6 +41,11 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcHttpCredentials, "sync.credentials.http", QtInfoMsg)
 
+// The lifetime of the access tokens of the oauth2 app, if the server doesn't say
+static const qint64 DefaultTokenLifetimeSecs = 60 * 60;
+// After a failed refresh, while the access token may still work
+static const int TokenRefreshRetryMsecs = 60 * 1000;
+
 namespace {
     const char userC[] = "user";
     const char isOAuthC[] = "oauth";
@@ -107,6 +114,8 @@ HttpCredentials::HttpCredentials()
     : _ready(false)
     , _keychainMigration(false)
 {
+    _refreshTimer.setSingleShot(true);
+    connect(&_refreshTimer, &QTimer::timeout, this, [this] { refreshAccessToken(); });
 }
 
 // From wizard
@@ -118,6 +127,8 @@ HttpCredentials::HttpCredentials(const QString &user, const QString &password, c
     , _clientSslCertificate(certificate)
     , _keychainMigration(false)
 {
+    _refreshTimer.setSingleShot(true);
+    connect(&_refreshTimer, &QTimer::timeout, this, [this] { refreshAccessToken(); });
 }
 
 QString HttpCredentials::authType() const
@@ -313,6 +324,9 @@ void HttpCredentials::slotReadJobDone(QKeychain::Job *incomingJob)
     }
 
     if (!_refreshToken.isEmpty() && error == NoError) {
+        // The access token isn't stored, refresh right away. The next refresh
+        // is scheduled from the lifetime of the new token, or retried if this
+        // one fails.
         refreshAccessToken();
     } else if (!_password.isEmpty() && error == NoError) {
         // All cool, the keychain did not come back with error.
@@ -339,10 +353,36 @@ void HttpCredentials::slotReadJobDone(QKeychain::Job *incomingJob)
     }
 }
 
+bool HttpCredentials::retryAfterRefresh(QNetworkReply *reply) const
+{
+    if (!isUsingOAuth() || reply->error() != QNetworkReply::AuthenticationRequiredError
+        || reply->request().attribute(DontAddCredentialsAttribute).toBool())
+        return false;
+    // The server drops the old access token when it hands out the new one,
+    // the requests that were still running with it fail
+    return _isRenewingOAuthToken
+        || (!_password.isEmpty() && reply->request().rawHeader("Authorization") != "Bearer " + _password.toUtf8());
+}
+
+void HttpCredentials::scheduleTokenRefresh(qint64 expiresInSecs)
+{
+    if (expiresInSecs <= 0)
+        expiresInSecs = DefaultTokenLifetimeSecs;
+    // Early enough that the running requests don't see the token expire
+    const qint64 msecs = qMax<qint64>(30 * 1000, expiresInSecs * 1000 * 4 / 5);
+    qCInfo(lcHttpCredentials) << "Refreshing the access token in" << msecs / 1000 << "s";
+    _refreshTimer.start(int(qMin<qint64>(msecs, std::numeric_limits<int>::max())));
+}
+
 bool HttpCredentials::refreshAccessToken()
 {
     if (_refreshToken.isEmpty())
         return false;
+    // The refresh token is only good once
+    if (_isRenewingOAuthToken)
+        return true;
+    _isRenewingOAuthToken = true;
+    _refreshTimer.stop();
 
     QUrl requestToken = Utility::concatUrlPath(_account->url(), QLatin1String("/index.php/apps/oauth2/api/v1/token"));
     QNetworkRequest req;
@@ -351,6 +391,8 @@ bool HttpCredentials::refreshAccessToken()
     QString basicAuth = QString("%1:%2").arg(
         Theme::instance()->oauthClientId(), Theme::instance()->oauthClientSecret());
     req.setRawHeader("Authorization", "Basic " + basicAuth.toUtf8().toBase64());
+    // Not the bearer token, it is still set when the refresh is ahead of the expiry
+    req.setAttribute(DontAddCredentialsAttribute, true);
 
     auto requestBody = new QBuffer;
     QUrlQuery arguments(QString("grant_type=refresh_token&refresh_token=%1").arg(_refreshToken));
@@ -359,6 +401,7 @@ bool HttpCredentials::refreshAccessToken()
     auto job = _account->sendRequest("POST", requestToken, req, requestBody);
     job->setTimeout(qMin(30 * 1000ll, job->timeoutMsec()));
     QObject::connect(job, &SimpleNetworkJob::finishedSignal, this, [this](QNetworkReply *reply) {
+        _isRenewingOAuthToken = false;
         auto jsonData = reply->readAll();
         QJsonParseError jsonParseError;
         QJsonObject json = QJsonDocument::fromJson(jsonData, &jsonParseError).object();
@@ -366,6 +409,9 @@ bool HttpCredentials::refreshAccessToken()
         if (reply->error() != QNetworkReply::NoError || jsonParseError.error != QJsonParseError::NoError || json.isEmpty()) {
             // Network error maybe?
             qCWarning(lcHttpCredentials) << "Error while refreshing the token" << reply->errorString() << jsonData << jsonParseError.errorString();
+            // Also when the first refresh after the keychain read failed, the
+            // refresh token is still good and the account can't connect without
+            _refreshTimer.start(TokenRefreshRetryMsecs);
         } else if (accessToken.isEmpty()) {
             // The token is no longer valid.
             qCDebug(lcHttpCredentials) << "Expired refresh token. Logging out";
@@ -374,6 +420,7 @@ bool HttpCredentials::refreshAccessToken()
             _ready = true;
             _password = accessToken;
             _refreshToken = json["refresh_token"].toString();
+            scheduleTokenRefresh(json["expires_in"].toVariant().toLongLong());
             persist();
         }
         emit fetched();
@@ -426,6 +473,7 @@ void HttpCredentials::forgetSensitiveData()
 {
     // need to be done before invalidateToken, so it actually deletes the refresh_token from the keychain
     _refreshToken.clear();
+    _refreshTimer.stop();
 
     invalidateToken();
     _previousPassword.clear();
@@ -20,6 +20,7 @@
 #include <QSslCertificate>
 #include <QSslKey>
 #include <QNetworkRequest>
+#include <QTimer>
 #include "creds/abstractcredentials.h"
 
 class QNetworkReply;
@@ -88,6 +89,8 @@ public:
     void fetchFromKeychain() Q_DECL_OVERRIDE;
     bool stillValid(QNetworkReply *reply) Q_DECL_OVERRIDE;
     void persist() Q_DECL_OVERRIDE;
+    bool retryAfterRefresh(QNetworkReply *reply) const Q_DECL_OVERRIDE;
+    bool isRefreshing() const Q_DECL_OVERRIDE { return _isRenewingOAuthToken; }
     QString user() const Q_DECL_OVERRIDE;
     // the password or token
     QString password() const;
@@ -131,6 +134,9 @@ protected:
     /// Wipes legacy keychain locations
     void deleteOldKeychainEntries();
 
+    /** Has the access token refreshed before it expires in @a expiresInSecs */
+    void scheduleTokenRefresh(qint64 expiresInSecs);
+
     QString _user;
     QString _password; // user's password, or access_token for OAuth
     QString _refreshToken; // OAuth _refreshToken, set if OAuth is used.
@@ -141,6 +147,8 @@ protected:
     QSslKey _clientSslKey;
     QSslCertificate _clientSslCertificate;
     bool _keychainMigration;
+    bool _isRenewingOAuthToken = false;
+    QTimer _refreshTimer;
 };
 
 
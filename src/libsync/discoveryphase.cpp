@@ -18,14 +18,18 @@
 #include "theme.h"
 #include "common/asserts.h"
 #include "common/checksums.h"
+#include "common/tracing.h"
 
 #include <csync_private.h>
 #include <csync_rename.h>
+#include <csync_update.h>
 #include <csync_exclude.h>
 
+#include <QDataStream>
 #include <QLoggingCategory>
 #include <QUrl>
 #include <QFileInfo>
+#include <algorithm>
 #include <cstring>
 
 
@@ -33,43 +37,107 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcDiscovery, "sync.discovery", QtInfoMsg)
 
-/* Given a sorted list of paths ending with '/', return whether or not the given path is within one of the paths of the list*/
-static bool findPathInList(const QStringList &list, const QString &path)
+SelectiveSyncPathTrie::SelectiveSyncPathTrie()
+    : _nodes(1)
 {
-    Q_ASSERT(std::is_sorted(list.begin(), list.end()));
+}
 
-    if (list.size() == 1 && list.first() == QLatin1String("/")) {
-        // Special case for the case "/" is there, it matches everything
-        return true;
+void SelectiveSyncPathTrie::insert(const QString &folder)
+{
+    int node = 0;
+    foreach (const QByteArray &name, folder.toUtf8().split('/')) {
+        if (name.isEmpty())
+            continue;
+        auto it = _nodes[node].children.constFind(name);
+        if (it != _nodes[node].children.constEnd()) {
+            node = *it;
+            continue;
+        }
+        const int child = static_cast<int>(_nodes.size());
+        _nodes[node].children.insert(name, child);
+        _nodes.emplace_back();
+        node = child;
     }
+    _nodes[node].isFolder = true;
+}
 
-    QString pathSlash = path + QLatin1Char('/');
-
-    // Since the list is sorted, we can do a binary search.
-    // If the path is a prefix of another item or right after in the lexical order.
-    auto it = std::lower_bound(list.begin(), list.end(), pathSlash);
+void SelectiveSyncPathTrie::remove(const QString &folder)
+{
+    // The nodes on the way, with the name of the next one
+    std::vector<std::pair<int, QByteArray>> parents;
+    int node = 0;
+    foreach (const QByteArray &name, folder.toUtf8().split('/')) {
+        if (name.isEmpty())
+            continue;
+        auto it = _nodes[node].children.constFind(name);
+        if (it == _nodes[node].children.constEnd())
+            return;
+        parents.emplace_back(node, name);
+        node = *it;
+    }
+    _nodes[node].isFolder = false;
 
-    if (it != list.end() && *it == pathSlash) {
-        return true;
+    // Unlink the nodes that lead to no folder anymore, for containsPathOrChild()
+    while (!parents.empty() && !_nodes[node].isFolder && _nodes[node].children.isEmpty()) {
+        node = parents.back().first;
+        _nodes[node].children.remove(parents.back().second);
+        parents.pop_back();
     }
+}
 
-    if (it == list.begin()) {
-        return false;
+bool SelectiveSyncPathTrie::isEmpty() const
+{
+    return !_nodes[0].isFolder && _nodes[0].children.isEmpty();
+}
+
+int SelectiveSyncPathTrie::find(const QByteArray &path, bool stopAtFolder) const
+{
+    int node = 0;
+    int start = 0;
+    while (!(stopAtFolder && _nodes[node].isFolder) && start < path.size()) {
+        int end = path.indexOf('/', start);
+        if (end < 0)
+            end = path.size();
+        if (end > start) {
+            const auto &children = _nodes[node].children;
+            // Only looks up, no need to copy the name
+            auto it = children.constFind(QByteArray::fromRawData(path.constData() + start, end - start));
+            if (it == children.constEnd())
+                return -1;
+            node = *it;
+        }
+        start = end + 1;
     }
-    --it;
-    Q_ASSERT(it->endsWith(QLatin1Char('/'))); // Folder::setSelectiveSyncBlackList makes sure of that
-    return pathSlash.startsWith(*it);
+    return node;
+}
+
+bool SelectiveSyncPathTrie::containsPathOrParent(const QByteArray &path) const
+{
+    const int node = find(path, true);
+    return node >= 0 && _nodes[node].isFolder;
+}
+
+bool SelectiveSyncPathTrie::containsExactly(const QByteArray &path) const
+{
+    const int node = find(path, false);
+    return node >= 0 && _nodes[node].isFolder;
+}
+
+bool SelectiveSyncPathTrie::containsPathOrChild(const QByteArray &path) const
+{
+    const int node = find(path, false);
+    return node >= 0 && (_nodes[node].isFolder || !_nodes[node].children.isEmpty());
 }
 
 bool DiscoveryJob::isInSelectiveSyncBlackList(const QByteArray &path) const
 {
-    if (_selectiveSyncBlackList.isEmpty()) {
+    if (_blackList.isEmpty()) {
         // If there is no black list, everything is allowed
         return false;
     }
 
     // Block if it is in the black list
-    if (findPathInList(_selectiveSyncBlackList, QString::fromUtf8(path))) {
+    if (_blackList.containsPathOrParent(path)) {
         return true;
     }
 
@@ -77,7 +145,7 @@ bool DiscoveryJob::isInSelectiveSyncBlackList(const QByteArray &path) const
     if (csync_rename_count(_csync_ctx)) {
         QByteArray adjusted = csync_rename_adjust_parent_path_source(_csync_ctx, path);
         if (adjusted != path) {
-            return findPathInList(_selectiveSyncBlackList, QString::fromUtf8(adjusted));
+            return _blackList.containsPathOrParent(adjusted);
         }
     }
 
@@ -89,27 +157,27 @@ int DiscoveryJob::isInSelectiveSyncBlackListCallback(void *data, const QByteArra
     return static_cast<DiscoveryJob *>(data)->isInSelectiveSyncBlackList(path);
 }
 
-bool DiscoveryJob::checkSelectiveSyncNewFolder(const QString &path, RemotePermissions remotePerm)
+bool DiscoveryJob::checkSelectiveSyncNewFolder(const QByteArray &path, RemotePermissions remotePerm)
 {
     if (_syncOptions._confirmExternalStorage
         && remotePerm.hasPermission(RemotePermissions::IsMounted)) {
         // external storage.
 
-        /* Note: DiscoverySingleDirectoryJob::directoryListingIteratedSlot make sure that only the
+        /* Note: DiscoverySingleDirectoryJob::directoryListingEntrySlot make sure that only the
          * root of a mounted storage has 'M', all sub entries have 'm' */
 
         // Only allow it if the white list contains exactly this path (not parents)
         // We want to ask confirmation for external storage even if the parents where selected
-        if (_selectiveSyncWhiteList.contains(path + QLatin1Char('/'))) {
+        if (_whiteList.containsExactly(path)) {
             return false;
         }
 
-        emit newBigFolder(path, true);
+        emit newBigFolder(QString::fromUtf8(path), true);
         return true;
     }
 
     // If this path or the parent is in the white list, then we do not block this file
-    if (findPathInList(_selectiveSyncWhiteList, path)) {
+    if (_whiteList.containsPathOrParent(path)) {
         return false;
     }
 
@@ -124,24 +192,18 @@ bool DiscoveryJob::checkSelectiveSyncNewFolder(const QString &path, RemotePermis
 
     {
         QMutexLocker locker(&_vioMutex);
-        emit doGetSizeSignal(path, &result);
+        emit doGetSizeSignal(QString::fromUtf8(path), &result);
         _vioWaitCondition.wait(&_vioMutex);
     }
 
     if (result >= limit) {
         // we tell the UI there is a new folder
-        emit newBigFolder(path, false);
+        emit newBigFolder(QString::fromUtf8(path), false);
         return true;
     } else {
         // it is not too big, put it in the white list (so we will not do more query for the children)
         // and and do not block.
-        auto p = path;
-        if (!p.endsWith(QLatin1Char('/'))) {
-            p += QLatin1Char('/');
-        }
-        _selectiveSyncWhiteList.insert(std::upper_bound(_selectiveSyncWhiteList.begin(),
-                                           _selectiveSyncWhiteList.end(), p),
-            p);
+        _whiteList.insert(QString::fromUtf8(path));
 
         return false;
     }
@@ -149,9 +211,208 @@ bool DiscoveryJob::checkSelectiveSyncNewFolder(const QString &path, RemotePermis
 
 int DiscoveryJob::checkSelectiveSyncNewFolderCallback(void *data, const QByteArray &path, RemotePermissions remotePerm)
 {
-    return static_cast<DiscoveryJob *>(data)->checkSelectiveSyncNewFolder(QString::fromUtf8(path), remotePerm);
+    auto job = static_cast<DiscoveryJob *>(data);
+    if (job->deferToNextBatch(path))
+        return true;
+    return job->checkSelectiveSyncNewFolder(path, remotePerm);
+}
+
+bool DiscoveryJob::deferToNextBatch(const QByteArray &path)
+{
+    const auto batchSize = _syncOptions._discoveryBatchSize;
+    if (batchSize <= 0) {
+        return false;
+    }
+    // Count from the first new folder on, it is never deferred. That way
+    // every sync makes progress even if the known part of the tree alone
+    // exceeds the batch size.
+    const auto discovered = static_cast<qint64>(_csync_ctx->remote.files.size());
+    if (_remoteEntriesAtBatchStart < 0) {
+        _remoteEntriesAtBatchStart = discovered;
+        return false;
+    }
+    if (discovered - _remoteEntriesAtBatchStart < batchSize) {
+        return false;
+    }
+
+    // The folder is new on the server, so it is not the target of a move.
+    // If it doesn't exist locally either, nothing else in this sync refers
+    // to it and it can safely be skipped.
+    if (QFileInfo::exists(QString::fromUtf8(_csync_ctx->local.uri) + QLatin1Char('/') + QString::fromUtf8(path))) {
+        return false;
+    }
+
+    // The parents must be listed again next time instead of being read from the db
+    if (!_syncOptions._dryRun)
+        _csync_ctx->statedb->avoidReadFromDbOnNextSync(path);
+
+    qCInfo(lcDiscovery) << "Leaving new folder" << path << "for the next sync";
+    emit deferredToNextBatch(QString::fromUtf8(path));
+    return true;
+}
+
+
+void DiscoveryJob::prefetchRemoteSubdirectories(const QString &path, const DiscoveryDirectoryResult &result)
+{
+    // New folders may still be held back by the selective sync checks,
+    // only list them ahead if none of these apply. If they get listed
+    // recursively when they are opened, a prefetch would only be in the way.
+    const bool prefetchNewFolders = newFoldersAreAlwaysSynced() && !_listNewFoldersRecursively;
+    const QByteArray parent = path.toUtf8();
+
+    QStringList subPaths;
+    for (const auto &entry : result.list) {
+        if (entry->type != CSYNC_FTW_TYPE_DIR || entry->path.isEmpty())
+            continue;
+        if (_csync_ctx->ignore_hidden_files && entry->path.startsWith('.'))
+            continue;
+        const QByteArray relPath = parent.isEmpty() ? entry->path : parent + '/' + entry->path;
+        if (_csync_ctx->exclude_traversal_fn
+            && _csync_ctx->exclude_traversal_fn(relPath.constData(), CSYNC_FTW_TYPE_DIR) != CSYNC_NOT_EXCLUDED)
+            continue;
+        if (isInSelectiveSyncBlackList(relPath))
+            continue;
+        if (!csync_remote_dir_wanted(_csync_ctx, relPath))
+            continue;
+
+        // Same check as _csync_detect_update(): unchanged directories are
+        // read from the database instead of being listed.
+        SyncJournalFileRecord base;
+        if (!_csync_ctx->statedb->getFileRecord(relPath, &base))
+            continue;
+        if (!base.isValid()) {
+            if (!prefetchNewFolders)
+                continue;
+        } else if (_csync_ctx->read_remote_from_db
+            && base._etag == entry->etag
+            && base._fileId == entry->file_id
+            && base._remotePerm == entry->remotePerm) {
+            continue;
+        }
+        if (_checkpointListings) {
+            // An interrupted sync already listed it
+            auto listing = _csync_ctx->statedb->getDiscoveryListing(relPath, entry->etag);
+            if (!listing.isEmpty()) {
+                _restoredListings.insert(relPath, listing);
+                continue;
+            }
+        }
+        subPaths.append(QString::fromUtf8(relPath));
+    }
+    if (!subPaths.isEmpty())
+        emit doPrefetchSignal(subPaths);
+}
+
+// Bump when the fields written by storeListing() change
+static const qint32 ListingFormatVersion = 1;
+
+bool DiscoveryJob::restoreListing(const QByteArray &path, DiscoveryDirectoryResult *result)
+{
+    QByteArray listing = _restoredListings.take(path);
+    if (listing.isEmpty()) {
+        auto dir = _csync_ctx->remote.files.findFile(path);
+        if (!dir)
+            return false;
+        listing = _csync_ctx->statedb->getDiscoveryListing(path, dir->etag);
+        if (listing.isEmpty())
+            return false;
+    }
+
+    QDataStream stream(listing);
+    qint32 version = 0;
+    quint32 count = 0;
+    stream >> version >> count;
+    if (version != ListingFormatVersion)
+        return false;
+
+    std::deque<std::unique_ptr<csync_file_stat_t>> list;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        std::unique_ptr<csync_file_stat_t> file_stat(new csync_file_stat_t);
+        qint32 type = 0;
+        qint64 modtime = 0;
+        qint64 size = 0;
+        QByteArray remotePerm;
+        stream >> file_stat->path >> type >> modtime >> size >> file_stat->etag >> file_stat->file_id
+            >> remotePerm >> file_stat->checksumHeader
+            >> file_stat->directDownloadUrl >> file_stat->directDownloadCookies;
+        file_stat->type = static_cast<csync_ftw_type_e>(type);
+        file_stat->modtime = modtime;
+        file_stat->size = size;
+        if (!remotePerm.isNull())
+            file_stat->remotePerm = RemotePermissions(remotePerm.constData());
+        list.push_back(std::move(file_stat));
+    }
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(lcDiscovery) << "Could not read the stored listing of" << path;
+        return false;
+    }
+
+    result->list = std::move(list);
+    result->code = 0;
+    qCInfo(lcDiscovery) << "Using the listing of" << path << "from an interrupted sync";
+    return true;
 }
 
+void DiscoveryJob::storeListing(const QByteArray &path, const DiscoveryDirectoryResult &result)
+{
+    auto dir = _csync_ctx->remote.files.findFile(path);
+    if (!dir || dir->etag.isEmpty())
+        return;
+
+    QByteArray listing;
+    QDataStream stream(&listing, QIODevice::WriteOnly);
+    stream << ListingFormatVersion << static_cast<quint32>(result.list.size());
+    for (const auto &file_stat : result.list) {
+        stream << file_stat->path << static_cast<qint32>(file_stat->type)
+               << static_cast<qint64>(file_stat->modtime) << static_cast<qint64>(file_stat->size)
+               << file_stat->etag << file_stat->file_id
+               << file_stat->remotePerm.toString() << file_stat->checksumHeader
+               << file_stat->directDownloadUrl << file_stat->directDownloadCookies;
+    }
+    _csync_ctx->statedb->setDiscoveryListing(path, dir->etag, listing);
+}
+
+void DiscoveryJob::prioritizeEntries(const QString &path, DiscoveryDirectoryResult *result)
+{
+    const QString prefix = path.isEmpty() ? QString() : path + QLatin1Char('/');
+    auto isPriority = [&](const std::unique_ptr<csync_file_stat_t> &entry) {
+        if (entry->type != CSYNC_FTW_TYPE_DIR)
+            return false;
+        const QString dir = prefix + QString::fromUtf8(entry->path);
+        const QString dirSlash = dir + QLatin1Char('/');
+        for (const auto &priorityPath : _syncOptions._priorityPaths) {
+            if (priorityPath == dir || priorityPath.startsWith(dirSlash))
+                return true;
+        }
+        return false;
+    };
+    // The walker visits the entries in this order
+    std::stable_partition(result->list.begin(), result->list.end(), isPriority);
+}
+
+bool DiscoveryJob::newFoldersAreAlwaysSynced() const
+{
+    return _syncOptions._newBigFolderSizeLimit < 0
+        && !_syncOptions._confirmExternalStorage
+        && _syncOptions._discoveryBatchSize <= 0;
+}
+
+bool DiscoveryJob::listRecursively(const QByteArray &path)
+{
+    if (!_listNewFoldersRecursively || path.isEmpty() || !newFoldersAreAlwaysSynced())
+        return false;
+
+    // Parts of the subtree are not going to be synced
+    if (_blackList.containsPathOrChild(path))
+        return false;
+
+    // Only new folders: for known ones most subdirectories are usually
+    // unchanged and read from the database.
+    SyncJournalFileRecord record;
+    if (!_csync_ctx->statedb->getFileRecord(path, &record) || record.isValid())
+        return false;
+    return true;
+}
 
 void DiscoveryJob::update_job_update_callback(bool local,
     const char *dirUrl,
@@ -254,15 +515,22 @@ int get_errno_from_http_errcode(int err, const QString &reason)
 DiscoverySingleDirectoryJob::DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent)
     : QObject(parent)
     , _subPath(path)
+    , _traceStart(-1)
     , _account(account)
     , _ignoredFirst(false)
     , _isRootPath(false)
     , _isExternalStorage(false)
+    , _recursive(false)
+    , _hasQuota(false)
+    , _quotaUsedBytes(0)
+    , _quotaAvailableBytes(0)
 {
 }
 
 void DiscoverySingleDirectoryJob::start()
 {
+    _traceStart = Tracing::isEnabled() ? Tracing::now() : -1;
+
     // Start the actual HTTP job
     LsColJob *lsColJob = new LsColJob(_account, _subPath, this);
 
@@ -275,18 +543,25 @@ void DiscoverySingleDirectoryJob::start()
           << "http://owncloud.org/ns:downloadURL"
           << "http://owncloud.org/ns:dDC"
           << "http://owncloud.org/ns:permissions"
-          << "http://owncloud.org/ns:checksums";
-    if (_isRootPath)
+          << "http://owncloud.org/ns:checksums"
+          << "http://owncloud.org/ns:size";
+    if (_isRootPath) {
         props << "http://owncloud.org/ns:data-fingerprint";
+        // Saves the quota requests of the GUI while syncs run, see QuotaInfo
+        props << "quota-available-bytes"
+              << "quota-used-bytes";
+    }
     if (_account->serverVersionInt() >= Account::makeServerVersion(10, 0, 0)) {
         // Server older than 10.0 have performances issue if we ask for the share-types on every PROPFIND
         props << "http://owncloud.org/ns:share-types";
     }
 
     lsColJob->setProperties(props);
+    if (_recursive)
+        lsColJob->setDepth("infinity");
 
-    QObject::connect(lsColJob, &LsColJob::directoryListingIterated,
-        this, &DiscoverySingleDirectoryJob::directoryListingIteratedSlot);
+    QObject::connect(lsColJob, &LsColJob::directoryListingEntry,
+        this, &DiscoverySingleDirectoryJob::directoryListingEntrySlot);
     QObject::connect(lsColJob, &LsColJob::finishedWithError, this, &DiscoverySingleDirectoryJob::lsJobFinishedWithErrorSlot);
     QObject::connect(lsColJob, &LsColJob::finishedWithoutError, this, &DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot);
     lsColJob->start();
@@ -301,67 +576,84 @@ void DiscoverySingleDirectoryJob::abort()
     }
 }
 
-static std::unique_ptr<csync_file_stat_t> propertyMapToFileStat(const QMap<QString, QString> &map)
+static RemotePermissions remotePermissions(const RemoteEntryInfo &entry)
+{
+    // Like RemotePermissions(QString), an empty value is null
+    if (entry._permissions.isEmpty())
+        return RemotePermissions();
+    return RemotePermissions(entry._permissions.constData());
+}
+
+static std::unique_ptr<csync_file_stat_t> remoteEntryToFileStat(const RemoteEntryInfo &entry)
 {
     std::unique_ptr<csync_file_stat_t> file_stat(new csync_file_stat_t);
 
-    for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
-        QString property = it.key();
-        QString value = it.value();
-        if (property == "resourcetype") {
-            if (value.contains("collection")) {
-                file_stat->type = CSYNC_FTW_TYPE_DIR;
-            } else {
-                file_stat->type = CSYNC_FTW_TYPE_FILE;
-            }
-        } else if (property == "getlastmodified") {
-            file_stat->modtime = oc_httpdate_parse(value.toUtf8());
-        } else if (property == "getcontentlength") {
-            bool ok = false;
-            qlonglong ll = value.toLongLong(&ok);
-            if (ok && ll >= 0) {
-                file_stat->size = ll;
-            }
-        } else if (property == "getetag") {
-            file_stat->etag = Utility::normalizeEtag(value.toUtf8());
-        } else if (property == "id") {
-            file_stat->file_id = value.toUtf8();
-        } else if (property == "downloadURL") {
-            file_stat->directDownloadUrl = value.toUtf8();
-        } else if (property == "dDC") {
-            file_stat->directDownloadCookies = value.toUtf8();
-        } else if (property == "permissions") {
-            file_stat->remotePerm = RemotePermissions(value);
-        } else if (property == "checksums") {
-            file_stat->checksumHeader = findBestChecksum(value.toUtf8());
-        } else if (property == "share-types" && !value.isEmpty()) {
-            // Since QMap is sorted, "share-types" is always after "permissions".
-            if (file_stat->remotePerm.isNull()) {
-                qWarning() << "Server returned a share type, but no permissions?";
-            } else {
-                // S means shared with me.
-                // But for our purpose, we want to know if the file is shared. It does not matter
-                // if we are the owner or not.
-                // Piggy back on the persmission field
-                file_stat->remotePerm.setPermission(RemotePermissions::IsShared);
-            }
+    if (entry.has(RemoteEntryInfo::ResourceType)) {
+        file_stat->type = entry._isDirectory ? CSYNC_FTW_TYPE_DIR : CSYNC_FTW_TYPE_FILE;
+    }
+    if (entry.has(RemoteEntryInfo::LastModified)) {
+        file_stat->modtime = oc_httpdate_parse(entry._lastModified.constData());
+    }
+    if (entry.has(RemoteEntryInfo::ContentLength)) {
+        bool ok = false;
+        qlonglong ll = entry._contentLength.toLongLong(&ok);
+        if (ok && ll >= 0) {
+            file_stat->size = ll;
+        }
+    }
+    if (entry.has(RemoteEntryInfo::Etag)) {
+        file_stat->etag = Utility::normalizeEtag(entry._etag);
+    }
+    // The values are implicitly shared, not copied
+    if (entry.has(RemoteEntryInfo::FileId)) {
+        file_stat->file_id = entry._fileId;
+    }
+    if (entry.has(RemoteEntryInfo::DownloadUrl)) {
+        file_stat->directDownloadUrl = entry._downloadUrl;
+    }
+    if (entry.has(RemoteEntryInfo::DownloadCookies)) {
+        file_stat->directDownloadCookies = entry._downloadCookies;
+    }
+    if (entry.has(RemoteEntryInfo::Permissions)) {
+        file_stat->remotePerm = remotePermissions(entry);
+    }
+    if (entry.has(RemoteEntryInfo::Checksums)) {
+        file_stat->checksumHeader = findBestChecksum(entry._checksums);
+    }
+    if (entry.has(RemoteEntryInfo::ShareTypes) && !entry._shareTypes.isEmpty()) {
+        if (file_stat->remotePerm.isNull()) {
+            qWarning() << "Server returned a share type, but no permissions?";
+        } else {
+            // S means shared with me.
+            // But for our purpose, we want to know if the file is shared. It does not matter
+            // if we are the owner or not.
+            // Piggy back on the persmission field
+            file_stat->remotePerm.setPermission(RemotePermissions::IsShared);
         }
     }
     return file_stat;
 }
 
-void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, const QMap<QString, QString> &map)
+void DiscoverySingleDirectoryJob::directoryListingEntrySlot(QString file, const RemoteEntryInfo &entry)
 {
     if (!_ignoredFirst) {
         // The first entry is for the folder itself, we should process it differently.
         _ignoredFirst = true;
-        if (map.contains("permissions")) {
-            RemotePermissions perm(map.value("permissions"));
+        if (entry.has(RemoteEntryInfo::Permissions)) {
+            RemotePermissions perm = remotePermissions(entry);
             emit firstDirectoryPermissions(perm);
             _isExternalStorage = perm.hasPermission(RemotePermissions::IsMounted);
         }
-        if (map.contains("data-fingerprint")) {
-            _dataFingerprint = map.value("data-fingerprint").toUtf8();
+        if (entry.has(RemoteEntryInfo::DataFingerprint)) {
+            _dataFingerprint = entry._dataFingerprint;
+        }
+        if (entry.has(RemoteEntryInfo::QuotaAvailableBytes) && entry.has(RemoteEntryInfo::QuotaUsedBytes)) {
+            // The server can return fractional bytes (#1374)
+            bool availableOk = false;
+            bool usedOk = false;
+            _quotaAvailableBytes = entry._quotaAvailableBytes.toDouble(&availableOk);
+            _quotaUsedBytes = entry._quotaUsedBytes.toDouble(&usedOk);
+            _hasQuota = availableOk && usedOk;
         }
     } else {
         // Remove <webDAV-Url>/folder/ from <webDAV-Url>/folder/subfile.txt
@@ -376,12 +668,41 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
         }
 
 
-        std::unique_ptr<csync_file_stat_t> file_stat(propertyMapToFileStat(map));
+        // In a recursive listing the entries of all subdirectories come in one
+        // reply, each one is sorted into the listing of its parent.
+        QString parent;
+        if (_recursive) {
+            int slashPos = file.lastIndexOf(QLatin1Char('/'));
+            if (slashPos > -1) {
+                parent = file.left(slashPos);
+                file = file.mid(slashPos + 1);
+            }
+        }
+        bool parentIsExternalStorage = parent.isEmpty()
+            ? _isExternalStorage
+            : _externalStorageDirectories.contains(parent);
+
+        std::unique_ptr<csync_file_stat_t> file_stat(remoteEntryToFileStat(entry));
         file_stat->path = file.toUtf8();
         if (file_stat->etag.isEmpty()) {
             qCCritical(lcDiscovery) << "etag of" << file_stat->path << "is" << file_stat->etag << "This must not happen.";
         }
-        if (_isExternalStorage && file_stat->remotePerm.hasPermission(RemotePermissions::IsMounted)) {
+        if (file_stat->type == CSYNC_FTW_TYPE_DIR) {
+            QString relative = parent.isEmpty() ? file : parent + QLatin1Char('/') + file;
+            if (entry.has(RemoteEntryInfo::Size)) {
+                bool ok = false;
+                qint64 size = entry._size.toLongLong(&ok);
+                if (ok)
+                    _folderSizes.insert(relative, size);
+            }
+            if (_recursive) {
+                if (file_stat->remotePerm.hasPermission(RemotePermissions::IsMounted))
+                    _externalStorageDirectories.insert(relative);
+                // Make sure that empty directories get an (empty) listing too
+                _subdirectoryResults[relative];
+            }
+        }
+        if (parentIsExternalStorage && file_stat->remotePerm.hasPermission(RemotePermissions::IsMounted)) {
             /* All the entries in a external storage have 'M' in their permission. However, for all
                purposes in the desktop client, we only need to know about the mount points.
                So replace the 'M' by a 'm' for every sub entries in an external storage */
@@ -394,15 +715,20 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
         if (slashPos > -1) {
             fileRef = file.midRef(slashPos + 1);
         }
-        _results.push_back(std::move(file_stat));
+        if (parent.isEmpty()) {
+            _results.push_back(std::move(file_stat));
+        } else {
+            _subdirectoryResults[parent].push_back(std::move(file_stat));
+        }
     }
 
     //This works in concerto with the RequestEtagJob and the Folder object to check if the remote folder changed.
-    if (map.contains("getetag")) {
-        _etagConcatenation += map.value("getetag");
+    if (entry.has(RemoteEntryInfo::Etag)) {
+        const QString etag = QString::fromUtf8(entry._etag);
+        _etagConcatenation += etag;
 
         if (_firstEtag.isEmpty()) {
-            _firstEtag = map.value("getetag"); // for directory itself
+            _firstEtag = etag; // for directory itself
         }
     }
 }
@@ -416,6 +742,8 @@ void DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot()
         deleteLater();
         return;
     }
+    if (_traceStart >= 0)
+        Tracing::addAsyncSpan("discovery", QLatin1String("list ") + _subPath, _traceStart, QString::number(_results.size()) + QLatin1String(" entries"));
     emit etag(_firstEtag);
     emit etagConcatenation(_etagConcatenation);
     emit finishedWithResult();
@@ -445,6 +773,15 @@ void DiscoverySingleDirectoryJob::lsJobFinishedWithErrorSlot(QNetworkReply *r)
     deleteLater();
 }
 
+struct DiscoveryMainThread::PrefetchedListing
+{
+    QPointer<DiscoverySingleDirectoryJob> job;
+    bool finished = false;
+    int code = EIO;
+    QString msg;
+    std::deque<std::unique_ptr<csync_file_stat_t>> list;
+};
+
 void DiscoveryMainThread::setupHooks(DiscoveryJob *discoveryJob, const QString &pathPrefix)
 {
     _discoveryJob = discoveryJob;
@@ -456,10 +793,15 @@ void DiscoveryMainThread::setupHooks(DiscoveryJob *discoveryJob, const QString &
     connect(discoveryJob, &DiscoveryJob::doGetSizeSignal,
         this, &DiscoveryMainThread::doGetSizeSlot,
         Qt::QueuedConnection);
+    connect(discoveryJob, &DiscoveryJob::doPrefetchSignal,
+        this, &DiscoveryMainThread::doPrefetchSlot,
+        Qt::QueuedConnection);
+
+    // The discovery thread was not started yet
+    _parallelism = qMax(1, discoveryJob->_syncOptions._remoteDiscoveryParallelism);
 }
 
-// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
-void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+QString DiscoveryMainThread::fullRemotePath(const QString &subPath) const
 {
     QString fullPath = _pathPrefix;
     if (!_pathPrefix.endsWith('/')) {
@@ -470,6 +812,13 @@ void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirecto
     while (fullPath.endsWith('/')) {
         fullPath.chop(1);
     }
+    return fullPath;
+}
+
+// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
+void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+{
+    QString fullPath = fullRemotePath(subPath);
 
     // emit _discoveryJob->folderDiscovered(false, subPath);
     _discoveryJob->update_job_update_callback(false, subPath.toUtf8(), _discoveryJob);
@@ -478,6 +827,27 @@ void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirecto
     _currentDiscoveryDirectoryResult = r;
     _currentDiscoveryDirectoryResult->path = fullPath;
 
+    if (auto prefetch = _prefetches.take(subPath)) {
+        if (prefetch->finished) {
+            deliverPrefetched(*prefetch);
+            return;
+        }
+        if (prefetch->job) {
+            _awaitedPrefetch = prefetch;
+            return;
+        }
+        // Not started yet, list it right away below
+        auto it = std::find(_prefetchQueue.begin(), _prefetchQueue.end(), subPath);
+        if (it != _prefetchQueue.end())
+            _prefetchQueue.erase(it);
+    }
+
+    _currentSubPath = subPath;
+    startSingleDirectoryJob(fullPath, r->listRecursively && !_recursiveListingFailed);
+}
+
+void DiscoveryMainThread::startSingleDirectoryJob(const QString &fullPath, bool recursive)
+{
     // Schedule the DiscoverySingleDirectoryJob
     _singleDirJob = new DiscoverySingleDirectoryJob(_account, fullPath, this);
     QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithResult,
@@ -494,11 +864,88 @@ void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirecto
     if (!_firstFolderProcessed) {
         _singleDirJob->setIsRootPath();
     }
+    if (recursive) {
+        _singleDirJob->setRecursive();
+    }
 
     _singleDirJob->start();
 }
 
 
+void DiscoveryMainThread::doPrefetchSlot(const QStringList &subPaths)
+{
+    if (!_discoveryJob)
+        return; // possibly aborted
+
+    // The discovery thread walks depth first: the subdirectories of the
+    // directory it just opened are needed before the ones queued earlier.
+    auto pos = _prefetchQueue.begin();
+    for (const auto &subPath : subPaths) {
+        if (_prefetches.contains(subPath))
+            continue;
+        _prefetches.insert(subPath, QSharedPointer<PrefetchedListing>::create());
+        pos = _prefetchQueue.insert(pos, subPath) + 1;
+    }
+    startPrefetches();
+}
+
+void DiscoveryMainThread::startPrefetches()
+{
+    // One request is left for the directory the discovery thread waits for
+    while (_runningPrefetches < _parallelism - 1 && !_prefetchQueue.empty()) {
+        const QString subPath = _prefetchQueue.front();
+        _prefetchQueue.pop_front();
+        auto prefetch = _prefetches.value(subPath);
+        if (!prefetch)
+            continue;
+
+        auto job = new DiscoverySingleDirectoryJob(_account, fullRemotePath(subPath), this);
+        QObject::connect(job, &DiscoverySingleDirectoryJob::finishedWithResult, this, [this, prefetch, subPath]() {
+            prefetch->list = prefetch->job->takeResults();
+            rememberFolderSizes(subPath, prefetch->job);
+            prefetchFinished(prefetch, 0, QString());
+        });
+        QObject::connect(job, &DiscoverySingleDirectoryJob::finishedWithError, this,
+            [this, prefetch](int csyncErrnoCode, const QString &msg) {
+                prefetchFinished(prefetch, csyncErrnoCode, msg);
+            });
+        prefetch->job = job;
+        ++_runningPrefetches;
+        job->start();
+    }
+}
+
+void DiscoveryMainThread::prefetchFinished(const QSharedPointer<PrefetchedListing> &prefetch, int code, const QString &msg)
+{
+    --_runningPrefetches;
+    prefetch->finished = true;
+    prefetch->code = code;
+    prefetch->msg = msg;
+    if (prefetch == _awaitedPrefetch) {
+        _awaitedPrefetch.reset();
+        deliverPrefetched(*prefetch);
+    }
+    startPrefetches();
+}
+
+void DiscoveryMainThread::deliverPrefetched(PrefetchedListing &prefetch)
+{
+    if (!_currentDiscoveryDirectoryResult) {
+        return; // possibly aborted
+    }
+
+    _currentDiscoveryDirectoryResult->list = std::move(prefetch.list);
+    _currentDiscoveryDirectoryResult->code = prefetch.code;
+    _currentDiscoveryDirectoryResult->msg = prefetch.msg;
+    qCDebug(lcDiscovery) << "Have" << _currentDiscoveryDirectoryResult->list.size() << "prefetched results for"
+                         << _currentDiscoveryDirectoryResult->path << prefetch.code;
+    _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
+
+    _discoveryJob->_vioMutex.lock();
+    _discoveryJob->_vioWaitCondition.wakeAll();
+    _discoveryJob->_vioMutex.unlock();
+}
+
 void DiscoveryMainThread::singleDirectoryJobResultSlot()
 {
     if (!_currentDiscoveryDirectoryResult) {
@@ -507,6 +954,24 @@ void DiscoveryMainThread::singleDirectoryJobResultSlot()
 
     _currentDiscoveryDirectoryResult->list = _singleDirJob->takeResults();
     _currentDiscoveryDirectoryResult->code = 0;
+    rememberFolderSizes(_currentSubPath, _singleDirJob);
+
+    if (_singleDirJob->isRecursive()) {
+        // The listings of all subdirectories came with this reply, keep them
+        // until the discovery thread opens these directories.
+        auto subdirectoryResults = _singleDirJob->takeSubdirectoryResults();
+        for (auto &it : subdirectoryResults) {
+            const QString subPath = _currentSubPath + QLatin1Char('/') + it.first;
+            auto prefetch = QSharedPointer<PrefetchedListing>::create();
+            prefetch->finished = true;
+            prefetch->code = 0;
+            prefetch->list = std::move(it.second);
+            _prefetches.insert(subPath, prefetch);
+            auto queued = std::find(_prefetchQueue.begin(), _prefetchQueue.end(), subPath);
+            if (queued != _prefetchQueue.end())
+                _prefetchQueue.erase(queued);
+        }
+    }
 
     qCDebug(lcDiscovery) << "Have" << _currentDiscoveryDirectoryResult->list.size() << "results for " << _currentDiscoveryDirectoryResult->path;
 
@@ -515,6 +980,9 @@ void DiscoveryMainThread::singleDirectoryJobResultSlot()
     if (!_firstFolderProcessed) {
         _firstFolderProcessed = true;
         _dataFingerprint = _singleDirJob->_dataFingerprint;
+        _hasRootQuota = _singleDirJob->_hasQuota;
+        _rootQuotaUsedBytes = _singleDirJob->_quotaUsedBytes;
+        _rootQuotaAvailableBytes = _singleDirJob->_quotaAvailableBytes;
     }
 
     _discoveryJob->_vioMutex.lock();
@@ -529,6 +997,15 @@ void DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot(int csyncErrno
     }
     qCDebug(lcDiscovery) << csyncErrnoCode << msg;
 
+    if (_singleDirJob && _singleDirJob->isRecursive()) {
+        // Servers may refuse Depth: infinity, list the folders one by one then
+        qCWarning(lcDiscovery) << "Recursive listing of" << _currentDiscoveryDirectoryResult->path
+                               << "failed, falling back to listing each folder" << csyncErrnoCode << msg;
+        _recursiveListingFailed = true;
+        startSingleDirectoryJob(_currentDiscoveryDirectoryResult->path, false);
+        return;
+    }
+
     _currentDiscoveryDirectoryResult->code = csyncErrnoCode;
     _currentDiscoveryDirectoryResult->msg = msg;
     _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
@@ -547,18 +1024,28 @@ void DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot(Remote
     }
 }
 
-void DiscoveryMainThread::doGetSizeSlot(const QString &path, qint64 *result)
+void DiscoveryMainThread::rememberFolderSizes(const QString &subPath, DiscoverySingleDirectoryJob *job)
 {
-    QString fullPath = _pathPrefix;
-    if (!_pathPrefix.endsWith('/')) {
-        fullPath += '/';
+    const auto sizes = job->takeFolderSizes();
+    for (auto it = sizes.begin(); it != sizes.end(); ++it) {
+        _folderSizes.insert(subPath.isEmpty() ? it.key() : subPath + QLatin1Char('/') + it.key(), it.value());
     }
-    fullPath += path;
-    // remove trailing slash
-    while (fullPath.endsWith('/')) {
-        fullPath.chop(1);
+}
+
+void DiscoveryMainThread::doGetSizeSlot(const QString &path, qint64 *result)
+{
+    auto cached = _folderSizes.constFind(path);
+    if (cached != _folderSizes.constEnd()) {
+        // The size came with the listing of the parent folder
+        *result = *cached;
+        qCDebug(lcDiscovery) << "Size of folder:" << path << *result << "(from the listing)";
+        QMutexLocker locker(&_discoveryJob->_vioMutex);
+        _discoveryJob->_vioWaitCondition.wakeAll();
+        return;
     }
 
+    QString fullPath = fullRemotePath(path);
+
     _currentGetSizeResult = result;
 
     // Schedule the DiscoverySingleDirectoryJob
@@ -608,6 +1095,16 @@ void DiscoveryMainThread::abort()
         disconnect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithResult, this, nullptr);
         _singleDirJob->abort();
     }
+    _prefetchQueue.clear();
+    _awaitedPrefetch.reset();
+    for (const auto &prefetch : _prefetches) {
+        if (prefetch->job && !prefetch->finished) {
+            disconnect(prefetch->job.data(), nullptr, this, nullptr);
+            prefetch->job->abort();
+        }
+    }
+    _prefetches.clear();
+    _runningPrefetches = 0;
     if (_currentDiscoveryDirectoryResult) {
         if (_discoveryJob->_vioMutex.tryLock()) {
             _currentDiscoveryDirectoryResult->msg = tr("Aborted by the user"); // Actually also created somewhere else by sync engine
@@ -634,13 +1131,24 @@ csync_vio_handle_t *DiscoveryJob::remote_vio_opendir_hook(const char *url,
         QScopedPointer<DiscoveryDirectoryResult> directoryResult(new DiscoveryDirectoryResult());
         directoryResult->code = EIO;
 
-        discoveryJob->_vioMutex.lock();
         const QString qurl = QString::fromUtf8(url);
-        emit discoveryJob->doOpendirSignal(qurl, directoryResult.data());
-        discoveryJob->_vioWaitCondition.wait(&discoveryJob->_vioMutex, ULONG_MAX); // FIXME timeout?
-        discoveryJob->_vioMutex.unlock();
-
-        qCDebug(lcDiscovery) << discoveryJob << url << "...Returned from main thread";
+        const QByteArray path(url);
+        // The root is always listed: its etag is only known from that request
+        const bool checkpoint = discoveryJob->_checkpointListings && !path.isEmpty();
+        if (!checkpoint || !discoveryJob->restoreListing(path, directoryResult.data())) {
+            // How long the discovery thread waits for the listing
+            TraceSpan span("discovery", QLatin1String("wait for ") + qurl);
+            discoveryJob->_vioMutex.lock();
+            directoryResult->listRecursively = discoveryJob->listRecursively(url);
+            emit discoveryJob->doOpendirSignal(qurl, directoryResult.data());
+            discoveryJob->_vioWaitCondition.wait(&discoveryJob->_vioMutex, ULONG_MAX); // FIXME timeout?
+            discoveryJob->_vioMutex.unlock();
+
+            qCDebug(lcDiscovery) << discoveryJob << url << "...Returned from main thread";
+
+            if (checkpoint && directoryResult->code == 0)
+                discoveryJob->storeListing(path, *directoryResult);
+        }
 
         // Upon awakening from the _vioWaitCondition, iterator should be a valid iterator.
         if (directoryResult->code != 0) {
@@ -651,6 +1159,12 @@ csync_vio_handle_t *DiscoveryJob::remote_vio_opendir_hook(const char *url,
             return NULL;
         }
 
+        if (!discoveryJob->_syncOptions._priorityPaths.isEmpty()) {
+            discoveryJob->prioritizeEntries(qurl, directoryResult.data());
+        }
+        if (discoveryJob->_syncOptions._remoteDiscoveryParallelism > 1) {
+            discoveryJob->prefetchRemoteSubdirectories(qurl, *directoryResult);
+        }
         return directoryResult.take();
     }
     return NULL;
@@ -686,8 +1200,10 @@ void DiscoveryJob::remote_vio_closedir_hook(csync_vio_handle_t *dhandle, void *u
 
 void DiscoveryJob::start()
 {
-    _selectiveSyncBlackList.sort();
-    _selectiveSyncWhiteList.sort();
+    foreach (const QString &folder, _selectiveSyncBlackList)
+        _blackList.insert(folder);
+    foreach (const QString &folder, _selectiveSyncWhiteList)
+        _whiteList.insert(folder);
     _csync_ctx->callbacks.update_callback_userdata = this;
     _csync_ctx->callbacks.update_callback = update_job_update_callback;
     _csync_ctx->callbacks.checkSelectiveSyncBlackListHook = isInSelectiveSyncBlackListCallback;
@@ -23,7 +23,11 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <QLinkedList>
+#include <QSet>
+#include <QSharedPointer>
 #include <deque>
+#include <map>
+#include <vector>
 #include "syncoptions.h"
 
 namespace OCC {
@@ -42,8 +46,12 @@ struct DiscoveryDirectoryResult
     QString msg;
     int code;
     std::deque<std::unique_ptr<csync_file_stat_t>> list;
+    // Set by the discovery thread if the whole subtree is going to be
+    // walked, see DiscoveryJob::listRecursively()
+    bool listRecursively;
     DiscoveryDirectoryResult()
         : code(EIO)
+        , listRecursively(false)
     {
     }
 };
@@ -60,11 +68,21 @@ class DiscoverySingleDirectoryJob : public QObject
     Q_OBJECT
 public:
     explicit DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent = 0);
-    // Specify thgat this is the root and we need to check the data-fingerprint
+    // Specify thgat this is the root and we need to check the data-fingerprint and the quota
     void setIsRootPath() { _isRootPath = true; }
+    // List the whole subtree with a single Depth: infinity PROPFIND
+    void setRecursive() { _recursive = true; }
+    bool isRecursive() const { return _recursive; }
     void start();
     void abort();
     std::deque<std::unique_ptr<csync_file_stat_t>> &&takeResults() { return std::move(_results); }
+    /// For recursive listings: the entries of the subdirectories, by path relative to this one
+    std::map<QString, std::deque<std::unique_ptr<csync_file_stat_t>>> &&takeSubdirectoryResults()
+    {
+        return std::move(_subdirectoryResults);
+    }
+    /// The sizes of the listed folders, by path relative to this one
+    QHash<QString, qint64> takeFolderSizes() { return std::move(_folderSizes); }
 
     // This is not actually a network job, it is just a job
 signals:
@@ -74,13 +92,14 @@ signals:
     void finishedWithResult();
     void finishedWithError(int csyncErrnoCode, const QString &msg);
 private slots:
-    void directoryListingIteratedSlot(QString, const QMap<QString, QString> &);
+    void directoryListingEntrySlot(QString, const RemoteEntryInfo &);
     void lsJobFinishedWithoutErrorSlot();
     void lsJobFinishedWithErrorSlot(QNetworkReply *);
 
 private:
     std::deque<std::unique_ptr<csync_file_stat_t>> _results;
     QString _subPath;
+    qint64 _traceStart; // -1 when not tracing
     QString _etagConcatenation;
     QString _firstEtag;
     AccountPtr _account;
@@ -91,10 +110,19 @@ private:
     bool _isRootPath;
     // If this directory is an external storage (The first item has 'M' in its permission)
     bool _isExternalStorage;
+    bool _recursive;
+    std::map<QString, std::deque<std::unique_ptr<csync_file_stat_t>>> _subdirectoryResults;
+    // Subdirectories of a recursive listing that are external storages
+    QSet<QString> _externalStorageDirectories;
+    QHash<QString, qint64> _folderSizes;
     QPointer<LsColJob> _lsColJob;
 
 public:
     QByteArray _dataFingerprint;
+    // The quota of the root path, if the server reported it
+    bool _hasQuota;
+    qint64 _quotaUsedBytes;
+    qint64 _quotaAvailableBytes;
 };
 
 // Lives in main thread. Deleted by the SyncEngine
@@ -108,21 +136,51 @@ class DiscoveryMainThread : public QObject
     QString _pathPrefix; // remote path
     AccountPtr _account;
     DiscoveryDirectoryResult *_currentDiscoveryDirectoryResult;
+    QString _currentSubPath;
+    // The server refused a recursive listing, don't try again in this sync
+    bool _recursiveListingFailed;
     qint64 *_currentGetSizeResult;
+    // Sizes of the folders listed in this sync, for the big folder check
+    QHash<QString, qint64> _folderSizes;
     bool _firstFolderProcessed;
 
+    // Listings requested ahead of the discovery thread, see doPrefetchSlot()
+    struct PrefetchedListing;
+    QHash<QString, QSharedPointer<PrefetchedListing>> _prefetches;
+    std::deque<QString> _prefetchQueue; // not started yet, in walk order
+    QSharedPointer<PrefetchedListing> _awaitedPrefetch; // the discovery thread waits for it
+    int _runningPrefetches;
+    int _parallelism;
+
+    QString fullRemotePath(const QString &subPath) const;
+    void startSingleDirectoryJob(const QString &fullPath, bool recursive);
+    void rememberFolderSizes(const QString &subPath, DiscoverySingleDirectoryJob *job);
+    void startPrefetches();
+    void prefetchFinished(const QSharedPointer<PrefetchedListing> &prefetch, int code, const QString &msg);
+    void deliverPrefetched(PrefetchedListing &prefetch);
+
 public:
     DiscoveryMainThread(AccountPtr account)
         : QObject()
         , _account(account)
         , _currentDiscoveryDirectoryResult(0)
+        , _recursiveListingFailed(false)
         , _currentGetSizeResult(0)
         , _firstFolderProcessed(false)
+        , _runningPrefetches(0)
+        , _parallelism(1)
+        , _hasRootQuota(false)
+        , _rootQuotaUsedBytes(0)
+        , _rootQuotaAvailableBytes(0)
     {
     }
     void abort();
 
     QByteArray _dataFingerprint;
+    // From the listing of the root, see DiscoverySingleDirectoryJob::_hasQuota
+    bool _hasRootQuota;
+    qint64 _rootQuotaUsedBytes;
+    qint64 _rootQuotaAvailableBytes;
 
 
 public slots:
@@ -130,6 +188,15 @@ public slots:
     void doOpendirSlot(const QString &url, DiscoveryDirectoryResult *);
     void doGetSizeSlot(const QString &path, qint64 *result);
 
+    /**
+     * Starts listing directories that the discovery thread is about to open.
+     *
+     * Up to SyncOptions::_remoteDiscoveryParallelism listings run at the
+     * same time, doOpendirSlot() then uses the result of a prefetch instead
+     * of waiting for a full round trip per directory.
+     */
+    void doPrefetchSlot(const QStringList &subPaths);
+
     // From Job:
     void singleDirectoryJobResultSlot();
     void singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg);
@@ -145,6 +212,48 @@ public:
     void setupHooks(DiscoveryJob *discoveryJob, const QString &pathPrefix);
 };
 
+/**
+ * @brief The folders of a selective sync list as a tree of path components
+ *
+ * The lookups take the UTF-8 paths of csync as they are and cost one hash
+ * lookup per path component, independently of the size of the list.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT SelectiveSyncPathTrie
+{
+public:
+    SelectiveSyncPathTrie();
+
+    /** Adds a folder of the list, with or without the trailing '/'. "/" stands for everything. */
+    void insert(const QString &folder);
+    /** Removes a folder of the list, the folders below it stay */
+    void remove(const QString &folder);
+    bool isEmpty() const;
+
+    /** Whether @a path is one of the folders or inside one of them */
+    bool containsPathOrParent(const QByteArray &path) const;
+    /** Whether @a path is exactly one of the folders */
+    bool containsExactly(const QByteArray &path) const;
+    /** Whether @a path or one of its subfolders is one of the folders */
+    bool containsPathOrChild(const QByteArray &path) const;
+
+private:
+    /**
+     * Returns the node of @a path, or -1 if there is none.
+     * With @a stopAtFolder the first node that is a folder of the list on the way is returned.
+     */
+    int find(const QByteArray &path, bool stopAtFolder) const;
+
+    struct Node
+    {
+        QHash<QByteArray, int> children;
+        bool isFolder = false;
+    };
+    // The root is the first node
+    std::vector<Node> _nodes;
+};
+
 /**
  * @brief The DiscoveryJob class
  *
@@ -167,9 +276,51 @@ class DiscoveryJob : public QObject
      */
     bool isInSelectiveSyncBlackList(const QByteArray &path) const;
     static int isInSelectiveSyncBlackListCallback(void *, const QByteArray &);
-    bool checkSelectiveSyncNewFolder(const QString &path, RemotePermissions rp);
+    bool checkSelectiveSyncNewFolder(const QByteArray &path, RemotePermissions rp);
     static int checkSelectiveSyncNewFolderCallback(void *data, const QByteArray &path, RemotePermissions rm);
 
+    /**
+     * return true if the new remote folder should be left for the next sync
+     * because this sync already has enough to do, see SyncOptions::_discoveryBatchSize
+     */
+    bool deferToNextBatch(const QByteArray &path);
+    qint64 _remoteEntriesAtBatchStart = -1;
+
+    /**
+     * Asks the main thread to list the subdirectories of @a path that csync
+     * will descend into because their etag changed, see doPrefetchSignal().
+     */
+    void prefetchRemoteSubdirectories(const QString &path, const DiscoveryDirectoryResult &result);
+
+    /**
+     * Moves the subdirectories of @a path that lead to one of the
+     * SyncOptions::_priorityPaths to the front of the listing.
+     */
+    void prioritizeEntries(const QString &path, DiscoveryDirectoryResult *result);
+
+    /** Whether csync descends into every new folder, see checkSelectiveSyncNewFolder() */
+    bool newFoldersAreAlwaysSynced() const;
+
+    /**
+     * Whether the remote folder @a path is new and is going to be walked
+     * completely, so that it can be listed with a single request.
+     */
+    bool listRecursively(const QByteArray &path);
+
+    /**
+     * Fills @a result with the listing of @a path stored by an interrupted
+     * sync, see SyncJournalDb::getDiscoveryListing().
+     * Returns false if there is none for the current etag of the directory.
+     */
+    bool restoreListing(const QByteArray &path, DiscoveryDirectoryResult *result);
+    void storeListing(const QByteArray &path, const DiscoveryDirectoryResult &result);
+    // Loaded by prefetchRemoteSubdirectories() before the directory is opened
+    QHash<QByteArray, QByteArray> _restoredListings;
+
+    // Built by start() from _selectiveSyncBlackList and _selectiveSyncWhiteList
+    SelectiveSyncPathTrie _blackList;
+    SelectiveSyncPathTrie _whiteList;
+
     // Just for progress
     static void update_job_update_callback(bool local,
         const char *dirname,
@@ -200,6 +351,11 @@ public:
     QStringList _selectiveSyncBlackList;
     QStringList _selectiveSyncWhiteList;
     SyncOptions _syncOptions;
+    // See Capabilities::propfindDepthInfinity()
+    bool _listNewFoldersRecursively = false;
+    // Store the remote listings in the journal so that an interrupted sync
+    // can resume the discovery, set as long as no sync completed
+    bool _checkpointListings = false;
     Q_INVOKABLE void start();
 signals:
     void finished(int result);
@@ -208,8 +364,13 @@ signals:
     // After the discovery job has been woken up again (_vioWaitCondition)
     void doOpendirSignal(QString url, DiscoveryDirectoryResult *);
     void doGetSizeSignal(const QString &path, qint64 *result);
+    // Doesn't wait, see DiscoveryMainThread::doPrefetchSlot()
+    void doPrefetchSignal(const QStringList &subPaths);
 
     // A new folder was discovered and was not synced because of the confirmation feature
     void newBigFolder(const QString &folder, bool isExternal);
+
+    // A new folder was discovered and is left for the next sync, see deferToNextBatch()
+    void deferredToNextBatch(const QString &folder);
 };
 }
@@ -17,6 +17,27 @@
 #include "common/utility.h"
 #include <QFile>
 #include <QFileInfo>
+#include <QSet>
+#include <QVector>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#ifdef Q_OS_MAC
+#include <sys/clonefile.h>
+#endif
 
 // We use some internals of csync:
 extern "C" int c_utimes(const char *, const struct timeval *);
@@ -114,6 +135,198 @@ bool FileSystem::verifyFileUnchanged(const QString &fileName,
     return true;
 }
 
+bool FileSystem::preallocate(QFile *file, qint64 size)
+{
+    const qint64 missing = size - file->size();
+    if (missing <= 0 || !file->isOpen())
+        return false;
+
+#if defined(Q_OS_WIN)
+    // Sets the allocation size, the end of file stays where it is
+    HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(file->handle()));
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = size;
+    if (handle == INVALID_HANDLE_VALUE
+        || !SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info))) {
+        qCInfo(lcFileSystem) << "Could not preallocate" << file->fileName() << GetLastError();
+        return false;
+    }
+    return true;
+#elif defined(Q_OS_LINUX)
+    // Not posix_fallocate(), it writes zeros where the file system can't do it
+    if (fallocate(file->handle(), FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+        qCInfo(lcFileSystem) << "Could not preallocate" << file->fileName() << strerror(errno);
+        return false;
+    }
+    return true;
+#elif defined(Q_OS_MAC)
+    // Contiguous if possible, the allocation starts at the physical end of the file
+    fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, missing, 0 };
+    if (fcntl(file->handle(), F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        if (fcntl(file->handle(), F_PREALLOCATE, &store) == -1) {
+            qCInfo(lcFileSystem) << "Could not preallocate" << file->fileName() << strerror(errno);
+            return false;
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool FileSystem::flushToDisk(const QStringList &fileNames)
+{
+    bool ok = true;
+#ifdef Q_OS_WIN
+    foreach (const QString &fileName, fileNames) {
+        // FlushFileBuffers needs a handle with write access
+        HANDLE handle = CreateFileW(reinterpret_cast<const wchar_t *>(longWinPath(fileName).utf16()),
+            GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            // Read-only files can't be opened like that, leave them to the OS
+            qCInfo(lcFileSystem) << "Could not open" << fileName << "to flush it" << GetLastError();
+            continue;
+        }
+        if (!FlushFileBuffers(handle)) {
+            qCWarning(lcFileSystem) << "Could not flush" << fileName << GetLastError();
+            ok = false;
+        }
+        CloseHandle(handle);
+    }
+#else
+    QVector<int> fds;
+    QStringList openedFiles;
+    QSet<QString> dirs;
+    foreach (const QString &fileName, fileNames) {
+        int fd = ::open(QFile::encodeName(fileName).constData(), O_RDONLY);
+        if (fd == -1) {
+            qCWarning(lcFileSystem) << "Could not open" << fileName << "to flush it" << strerror(errno);
+            ok = false;
+            continue;
+        }
+#ifdef Q_OS_LINUX
+        // Only starts the writeback, the waiting is done below
+        sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+        fds.append(fd);
+        openedFiles.append(fileName);
+        dirs.insert(QFileInfo(fileName).absolutePath());
+    }
+    for (int i = 0; i < fds.size(); ++i) {
+#ifdef Q_OS_LINUX
+        int rc = fdatasync(fds[i]);
+#else
+        int rc = fsync(fds[i]);
+#endif
+        if (rc != 0) {
+            qCWarning(lcFileSystem) << "Could not flush" << openedFiles.at(i) << strerror(errno);
+            ok = false;
+        }
+        ::close(fds[i]);
+    }
+    // The renames are only durable once the directories are
+    foreach (const QString &dir, dirs) {
+        int fd = ::open(QFile::encodeName(dir).constData(), O_RDONLY | O_DIRECTORY);
+        if (fd == -1)
+            continue;
+        if (fsync(fd) != 0) {
+            qCWarning(lcFileSystem) << "Could not flush the directory" << dir << strerror(errno);
+            ok = false;
+        }
+        ::close(fd);
+    }
+#endif
+    return ok;
+}
+
+#ifdef Q_OS_LINUX
+// Shares the blocks with FICLONE or lets the kernel copy them. Returns false,
+// with the target removed, when the data has to go through user space.
+static bool kernelCopy(const QString &source, const QString &target, QString *errorString, bool *fallback)
+{
+    *fallback = false;
+    int in = ::open(QFile::encodeName(source).constData(), O_RDONLY | O_CLOEXEC);
+    if (in == -1) {
+        if (errorString)
+            *errorString = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(in, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(in);
+        *fallback = true;
+        return false;
+    }
+    int out = ::open(QFile::encodeName(target).constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+    if (out == -1) {
+        if (errorString)
+            *errorString = QString::fromLocal8Bit(strerror(errno));
+        ::close(in);
+        return false;
+    }
+
+    bool ok = st.st_size == 0;
+#ifdef FICLONE
+    // Older kernel headers don't have it
+    ok = ok || ioctl(out, FICLONE, in) == 0;
+#endif
+#ifdef __NR_copy_file_range
+    // Without reflinks the kernel still saves the round trip through user
+    // space, and NFS or SMB copy on the server
+    for (qint64 left = st.st_size; !ok;) {
+        ssize_t copied = syscall(__NR_copy_file_range, in, nullptr, out, nullptr, size_t(qMin<qint64>(left, 1 << 30)), 0u);
+        if (copied <= 0)
+            break;
+        left -= copied;
+        ok = left <= 0;
+    }
+#endif
+    if (!ok) {
+        qCDebug(lcFileSystem) << "No kernel copy of" << source << strerror(errno);
+        *fallback = true;
+    }
+    if (::close(out) != 0 && ok) {
+        if (errorString)
+            *errorString = QString::fromLocal8Bit(strerror(errno));
+        ok = false;
+    }
+    ::close(in);
+    if (!ok)
+        ::unlink(QFile::encodeName(target).constData());
+    return ok;
+}
+#endif
+
+bool FileSystem::copyFast(const QString &source, const QString &target, QString *errorString)
+{
+#if defined(Q_OS_LINUX)
+    bool fallback = false;
+    if (kernelCopy(source, target, errorString, &fallback))
+        return true;
+    if (!fallback)
+        return false;
+#elif defined(Q_OS_MAC)
+    // Also copies the mode and the extended attributes, like QFile::copy doesn't
+    if (clonefile(QFile::encodeName(source).constData(), QFile::encodeName(target).constData(), 0) == 0)
+        return true;
+    if (errno == EEXIST || errno == ENOENT) {
+        if (errorString)
+            *errorString = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+#endif
+    // On Windows this is CopyFile, which clones the blocks where the volume can
+    QFile file(source);
+    if (!file.copy(target)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
+
 #ifdef Q_OS_WIN
 static qint64 getSizeWithCsync(const QString &filename)
 {
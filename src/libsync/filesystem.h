@@ -77,6 +77,35 @@ namespace FileSystem {
     bool verifyFileUnchanged(const QString &fileName,
         qint64 previousSize,
         time_t previousMtime);
+
+    /**
+     * @brief Reserves the disk space for \a size bytes of the open \a file
+     *
+     * The size of the file doesn't change, but the file system can place
+     * the data in one piece instead of growing the file with every write.
+     * Returns false where the platform or the file system can't do it.
+     */
+    bool OWNCLOUDSYNC_EXPORT preallocate(QFile *file, qint64 size);
+
+    /**
+     * @brief Makes sure the data of \a fileNames and their directory entries are on the disk
+     *
+     * The writeback of all the files is started before waiting for any of
+     * them, so that the disk can write them in one go. Each parent directory
+     * is only flushed once.
+     *
+     * Returns false if any of the files could not be flushed.
+     */
+    bool OWNCLOUDSYNC_EXPORT flushToDisk(const QStringList &fileNames);
+
+    /**
+     * @brief Copies \a source to the new file \a target like QFile::copy
+     *
+     * Where the file system supports it the copy shares the blocks of the
+     * source (reflink on Linux, clonefile on APFS) or is done by the kernel,
+     * otherwise the data goes through a buffer. Fails if \a target exists.
+     */
+    bool OWNCLOUDSYNC_EXPORT copyFast(const QString &source, const QString &target, QString *errorString = nullptr);
 }
 
 /** @} */
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "imagecache.h"
+#include "account.h"
+#include "filesystem.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QLoggingCategory>
+#include <QPointer>
+#include <QQueue>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <ctime>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcImageCache, "sync.imagecache", QtInfoMsg)
+
+// Avatars and thumbnails are a few KB each
+static const qint64 MaxCacheSize = 20 * 1000 * 1000;
+// Opening the share dialog again doesn't ask for the same images
+static const qint64 FreshMs = 10 * 60 * 1000;
+
+namespace {
+    struct Fetch
+    {
+        QPointer<QObject> job;
+        std::function<void()> start;
+    };
+
+    struct Cache
+    {
+        Cache()
+        {
+            directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QLatin1String("/images");
+            timer.start();
+            // One thread keeps the reads and writes of a file in order
+            pool.setMaxThreadCount(1);
+        }
+
+        QString directory;
+        QElapsedTimer timer;
+        // When the images were last validated with the server, by key
+        QHash<QByteArray, qint64> validated;
+        QQueue<Fetch> pending;
+        int active = 0;
+        QThreadPool pool;
+    };
+
+    Q_GLOBAL_STATIC(Cache, cache)
+
+    // The thumbnail urls are relative to the user, the key has the account
+    QByteArray cacheKey(const Account &account, const QUrl &url)
+    {
+        return QCryptographicHash::hash(account.id().toUtf8() + ' ' + url.toEncoded(), QCryptographicHash::Sha1).toHex();
+    }
+
+    QString cacheFile(const QString &directory, const QByteArray &key)
+    {
+        return directory + QLatin1Char('/') + QString::fromLatin1(key);
+    }
+
+    // The disk operations below run in the pool, they get the directory
+    // from the GUI thread
+
+    ImageCache::Entry readEntry(const QString &fileName)
+    {
+        ImageCache::Entry entry;
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+            return entry;
+        QDataStream stream(&file);
+        stream >> entry.etag >> entry.data;
+        file.close();
+        if (stream.status() != QDataStream::Ok || entry.data.isEmpty()) {
+            qCWarning(lcImageCache) << "Removing the unreadable" << fileName;
+            QFile::remove(fileName);
+            return ImageCache::Entry();
+        }
+        // The modtime orders the files for removeLeastRecentlyUsed()
+        FileSystem::setModTime(fileName, time(nullptr));
+        return entry;
+    }
+
+    void removeLeastRecentlyUsed(const QString &directory)
+    {
+        QDir dir(directory);
+        qint64 size = 0;
+        foreach (const QFileInfo &info, dir.entryInfoList(QDir::Files, QDir::Time)) {
+            size += info.size();
+            if (size > MaxCacheSize) {
+                qCDebug(lcImageCache) << "Removing" << info.fileName() << "from the cache";
+                QFile::remove(info.filePath());
+            }
+        }
+    }
+
+    void writeEntry(const QString &directory, const QByteArray &key, const ImageCache::Entry &entry)
+    {
+        if (!QDir().mkpath(directory)) {
+            qCWarning(lcImageCache) << "Could not create" << directory;
+            return;
+        }
+        QSaveFile file(cacheFile(directory, key));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCWarning(lcImageCache) << "Could not write" << file.fileName() << file.errorString();
+            return;
+        }
+        QDataStream stream(&file);
+        stream << entry.etag << entry.data;
+        if (!file.commit()) {
+            qCWarning(lcImageCache) << "Could not write" << file.fileName() << file.errorString();
+            return;
+        }
+        removeLeastRecentlyUsed(directory);
+    }
+
+    void startNextFetches()
+    {
+        auto c = cache();
+        while (c->active < ImageCache::MaxActiveFetches && !c->pending.isEmpty()) {
+            Fetch fetch = c->pending.dequeue();
+            if (!fetch.job)
+                continue;
+            c->active++;
+            QObject::connect(fetch.job.data(), &QObject::destroyed, [] {
+                if (cache.isDestroyed())
+                    return;
+                cache()->active--;
+                startNextFetches();
+            });
+            fetch.start();
+        }
+    }
+}
+
+void ImageCache::lookup(const Account &account, const QUrl &url, QObject *context, const LookupCallback &callback)
+{
+    const QByteArray key = cacheKey(account, url);
+    auto c = cache();
+    // Deleted with the context, the callback doesn't run for a dead job
+    auto watcher = new QFutureWatcher<Entry>(context);
+    QObject::connect(watcher, &QFutureWatcherBase::finished, context, [watcher, key, callback] {
+        watcher->deleteLater();
+        const Entry entry = watcher->result();
+        if (entry.data.isEmpty()) {
+            callback(false, entry, false);
+            return;
+        }
+        auto c = cache();
+        auto it = c->validated.constFind(key);
+        const bool fresh = it != c->validated.constEnd() && c->timer.elapsed() - *it < FreshMs;
+        callback(true, entry, fresh);
+    });
+    watcher->setFuture(QtConcurrent::run(&c->pool, readEntry, cacheFile(c->directory, key)));
+}
+
+void ImageCache::insert(const Account &account, const QUrl &url, const Entry &entry)
+{
+    const QByteArray key = cacheKey(account, url);
+    auto c = cache();
+    c->validated.insert(key, c->timer.elapsed());
+    if (entry.data.isEmpty())
+        return;
+    QtConcurrent::run(&c->pool, writeEntry, c->directory, key, entry);
+}
+
+void ImageCache::enqueueFetch(QObject *job, const std::function<void()> &start)
+{
+    cache()->pending.enqueue(Fetch{ job, start });
+    startNextFetches();
+}
+
+void ImageCache::setDirectory(const QString &dir)
+{
+    cache()->directory = dir;
+    cache()->validated.clear();
+}
+
+void ImageCache::waitForDone()
+{
+    cache()->pool.waitForDone();
+}
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QUrl>
+
+#include <functional>
+
+class QObject;
+
+namespace OCC {
+
+class Account;
+
+/**
+ * @brief Disk cache and scheduling of the images shown by the GUI
+ *
+ * The avatars and the thumbnails are kept on disk with their etag, a cached
+ * image is revalidated with If-None-Match and shown without asking the
+ * server again for a while. The least recently used images are removed
+ * when the cache grows beyond its size.
+ *
+ * Their requests are low priority and only a few run at once, the sync's
+ * requests keep the connections.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ImageCache
+{
+public:
+    struct Entry
+    {
+        QByteArray etag;
+        QByteArray data;
+    };
+
+    typedef std::function<void(bool found, const Entry &entry, bool fresh)> LookupCallback;
+
+    /**
+     * Reads the image of @a url for @a account from the disk in a worker
+     * thread and calls @a callback with it in the thread of @a context.
+     *
+     * @a fresh tells whether it was validated recently enough to skip
+     * the request. The callback isn't called if @a context is destroyed
+     * first.
+     */
+    static void lookup(const Account &account, const QUrl &url, QObject *context, const LookupCallback &callback);
+
+    /**
+     * Stores the image of a 200 reply, or only its validation for a 304.
+     *
+     * The file is written in the worker thread, a later lookup() finds it.
+     */
+    static void insert(const Account &account, const QUrl &url, const Entry &entry);
+
+    /**
+     * Calls @a start once fewer than MaxActiveFetches image requests run.
+     *
+     * The slot is free again when @a job is destroyed, @a start isn't called
+     * if that happens first.
+     */
+    static void enqueueFetch(QObject *job, const std::function<void()> &start);
+
+    /** The directory of the cache, the default is in the cache location */
+    static void setDirectory(const QString &dir);
+
+    /** Waits for the pending reads and writes of the worker thread, for the tests */
+    static void waitForDone();
+
+    static const int MaxActiveFetches = 2;
+};
+}
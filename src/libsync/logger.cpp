@@ -12,13 +12,20 @@
  * for more details.
  */
 
+#include "config.h"
 #include "logger.h"
 
 #include <QDir>
 #include <QStringList>
 #include <QThread>
+#include <QVector>
+#include <QtConcurrent>
 #include <qmetaobject.h>
 
+#ifdef ZLIB_FOUND
+#include <zlib.h>
+#endif
+
 #include "csync.h"
 #include "csync_log.h"
 
@@ -26,12 +33,209 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcCsync, "sync.csync", QtInfoMsg)
 
+// Lines beyond this wait for the writer thread are dropped
+static const int MaxBufferedLines = 20000;
+
+// Default number of messages of the recorder
+static const int DefaultRecorderSize = 5000;
+
+// Defaults of the sizes for the files of the log dir
+static const qint64 DefaultLogMaxSize = 100 * 1024 * 1024;
+static const qint64 DefaultLogDirMaxSize = 1024 * 1024 * 1024;
+
+static const char logFilePatternC[] = "owncloud\\.log\\.(\\d+)(\\.gz)?";
+
+#ifdef ZLIB_FOUND
+/** Replaces @a fileName by fileName.gz */
+static bool compressLogFile(const QString &fileName)
+{
+    QFile original(fileName);
+    if (!original.open(QIODevice::ReadOnly))
+        return false;
+    const QString compressedName = fileName + QLatin1String(".gz");
+    gzFile compressed = gzopen(QFile::encodeName(compressedName).constData(), "wb");
+    if (!compressed)
+        return false;
+
+    bool ok = true;
+    QByteArray buf(64 * 1024, Qt::Uninitialized);
+    qint64 size;
+    while (ok && (size = original.read(buf.data(), buf.size())) > 0) {
+        ok = gzwrite(compressed, buf.constData(), static_cast<unsigned>(size)) == size;
+    }
+    ok = gzclose(compressed) == Z_OK && ok && size == 0;
+    original.close();
+
+    if (!ok) {
+        QFile::remove(compressedName);
+        return false;
+    }
+    return QFile::remove(fileName);
+}
+#endif
+
+/**
+ * Compresses the log files of @a dirPath except @a currentLog, the one
+ * being written, and removes the ones that are expired or beyond the
+ * size limit, oldest first. Runs in the background.
+ */
+static void cleanUpLogDir(const QString &dirPath, const QString &currentLog, int expireHours, qint64 maxDirSize)
+{
+    // Two rotations in a short time must not work on the same files
+    static QMutex mutex;
+    QMutexLocker lock(&mutex);
+
+    QDir dir(dirPath);
+    QRegExp rx(QLatin1String(logFilePatternC));
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+
+    // By number, the newest first
+    QMap<uint, QString> logs;
+    foreach (const QString &s, dir.entryList(QStringList("owncloud.log.*"), QDir::Files)) {
+        if (!rx.exactMatch(s))
+            continue;
+        const QString path = dir.absoluteFilePath(s);
+        if (path == currentLog)
+            continue;
+        if (expireHours > 0 && QFileInfo(path).lastModified().addSecs(60 * 60 * expireHours) < now) {
+            dir.remove(s);
+            continue;
+        }
+#ifdef ZLIB_FOUND
+        if (rx.cap(2).isEmpty() && compressLogFile(path)) {
+            logs.insert(rx.cap(1).toUInt(), path + QLatin1String(".gz"));
+            continue;
+        }
+#endif
+        logs.insert(rx.cap(1).toUInt(), path);
+    }
+
+    if (maxDirSize <= 0)
+        return;
+    qint64 total = QFileInfo(currentLog).size();
+    QMapIterator<uint, QString> it(logs);
+    it.toBack();
+    while (it.hasPrevious()) {
+        it.previous();
+        total += QFileInfo(it.value()).size();
+        if (total > maxDirSize)
+            QFile::remove(it.value());
+    }
+}
+
+/**
+ * The last messages, in a ring. The category and function of a message
+ * context are static strings, only the pointers are kept, and the line
+ * is only formatted when the recorder is written to a file.
+ */
+class LogRecorder
+{
+public:
+    struct Line
+    {
+        qint64 time; // msecs since the epoch
+        QtMsgType type;
+        const char *category;
+        const char *function;
+        QString message;
+    };
+
+    explicit LogRecorder(int size)
+        : _lines(size)
+        , _next(0)
+        , _full(false)
+    {
+    }
+
+    void record(QtMsgType type, const QMessageLogContext &ctx, const QString &message)
+    {
+        QMutexLocker lock(&_mutex);
+        Line &line = _lines[_next];
+        line.time = QDateTime::currentMSecsSinceEpoch();
+        line.type = type;
+        line.category = ctx.category;
+        line.function = ctx.function;
+        line.message = message;
+        if (++_next == _lines.size()) {
+            _next = 0;
+            _full = true;
+        }
+    }
+
+    bool write(QIODevice *device)
+    {
+        QVector<Line> lines;
+        {
+            QMutexLocker lock(&_mutex);
+            if (_full)
+                lines = _lines.mid(_next) + _lines.mid(0, _next);
+            else
+                lines = _lines.mid(0, _next);
+        }
+
+        QTextStream stream(device);
+        foreach (const Line &line, lines) {
+            stream << QDateTime::fromMSecsSinceEpoch(line.time).toString(QLatin1String("MM-dd hh:mm:ss:zzz"))
+                   << " [ " << typeName(line.type) << ' ' << (line.category ? line.category : "default") << " ]";
+            if (line.type == QtDebugMsg && line.function)
+                stream << "\t[ " << line.function << " ]";
+            stream << ":\t" << line.message << '\n';
+        }
+        stream.flush();
+        return stream.status() == QTextStream::Ok;
+    }
+
+private:
+    static const char *typeName(QtMsgType type)
+    {
+        switch (type) {
+        case QtDebugMsg:
+            return "debug";
+        case QtInfoMsg:
+            return "info";
+        case QtWarningMsg:
+            return "warning";
+        case QtCriticalMsg:
+            return "critical";
+        case QtFatalMsg:
+            return "fatal";
+        }
+        return "";
+    }
+
+    QMutex _mutex;
+    QVector<Line> _lines;
+    int _next;
+    bool _full;
+};
+
+class LogWriterThread : public QThread
+{
+public:
+    explicit LogWriterThread(Logger *logger)
+        : _logger(logger)
+    {
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE { _logger->writeLogs(); }
+
+private:
+    Logger *_logger;
+};
+
 static void mirallLogCatcher(QtMsgType type, const QMessageLogContext &ctx, const QString &message)
 {
     auto logger = Logger::instance();
+    logger->recordLog(type, ctx, message);
     if (!logger->isNoop()) {
         logger->doLog(qFormatLogMessage(type, ctx, message));
     }
+    // The process is about to abort, the lines must be in the files
+    if (type == QtFatalMsg) {
+        logger->flushLog();
+        logger->dumpLogRecorder();
+    }
 }
 
 static void csyncLogCatcher(int verbosity,
@@ -67,7 +271,12 @@ Logger::Logger(QObject *parent)
     , _logWindowActivated(false)
     , _doFileFlush(false)
     , _logExpire(0)
+    , _logMaxSize(DefaultLogMaxSize)
+    , _logDirMaxSize(DefaultLogDirMaxSize)
     , _logDebug(false)
+    , _droppedLines(0)
+    , _stopWriter(false)
+    , _writer(0)
 {
     qSetMessagePattern("%{time MM-dd hh:mm:ss:zzz} [ %{type} %{category} ]%{if-debug}\t[ %{function} ]%{endif}:\t%{message}");
 #ifndef NO_MSG_HANDLER
@@ -80,6 +289,12 @@ Logger::Logger(QObject *parent)
 
     // Setup CSYNC logging to forward to our own logger
     csync_set_log_callback(csyncLogCatcher);
+
+#ifndef NO_MSG_HANDLER
+    bool ok = false;
+    int recorderSize = qEnvironmentVariableIntValue("OWNCLOUD_LOG_RECORDER_LINES", &ok);
+    setLogRecorderSize(ok ? recorderSize : DefaultRecorderSize);
+#endif
 }
 
 Logger::~Logger()
@@ -87,6 +302,7 @@ Logger::~Logger()
 #ifndef NO_MSG_HANDLER
     qInstallMessageHandler(0);
 #endif
+    stopWriter();
 }
 
 
@@ -130,24 +346,90 @@ void Logger::log(Log log)
  */
 bool Logger::isNoop() const
 {
-    QMutexLocker lock(const_cast<QMutex *>(&_mutex));
-    return !_logstream && !_logWindowActivated;
+    // Without the mutex: it is held while the writer thread writes
+    return !_logFileOpen.load() && !_logWindowActivated;
 }
 
 
 void Logger::doLog(const QString &msg)
 {
-    {
-        QMutexLocker lock(&_mutex);
-        if (_logstream) {
-            (*_logstream) << msg << endl;
-            if (_doFileFlush)
-                _logstream->flush();
+    if (_logFileOpen.load()) {
+        {
+            QMutexLocker lock(&_bufferMutex);
+            if (_buffer.size() < MaxBufferedLines) {
+                _buffer.append(msg);
+                if (_buffer.size() == 1)
+                    _bufferNotEmpty.wakeOne();
+            } else {
+                ++_droppedLines;
+            }
         }
+        if (_doFileFlush)
+            flushLog();
     }
     emit logWindowLog(msg);
 }
 
+void Logger::flushLog()
+{
+    if (writeBuffered())
+        enterNextLogFile();
+}
+
+void Logger::writeLogs()
+{
+    QMutexLocker lock(&_bufferMutex);
+    forever {
+        while (_buffer.isEmpty() && !_stopWriter)
+            _bufferNotEmpty.wait(&_bufferMutex);
+        if (_buffer.isEmpty())
+            return;
+        lock.unlock();
+        if (writeBuffered())
+            enterNextLogFile();
+        lock.relock();
+    }
+}
+
+bool Logger::writeBuffered()
+{
+    QMutexLocker lock(&_mutex);
+    QStringList lines;
+    int dropped = 0;
+    {
+        QMutexLocker bufferLock(&_bufferMutex);
+        lines.swap(_buffer);
+        std::swap(dropped, _droppedLines);
+    }
+    if (!_logstream)
+        return false;
+
+    foreach (const QString &line, lines) {
+        (*_logstream) << line << '\n';
+    }
+    if (dropped > 0) {
+        (*_logstream) << "[ " << dropped << " log lines were dropped, they could not be written fast enough ]\n";
+    }
+    // One write for the batch, the lines are in the file if the process crashes
+    _logstream->flush();
+
+    return _logMaxSize > 0 && !_logDirectory.isEmpty() && _logFile.size() > _logMaxSize;
+}
+
+void Logger::stopWriter()
+{
+    if (!_writer)
+        return;
+    {
+        QMutexLocker lock(&_bufferMutex);
+        _stopWriter = true;
+        _bufferNotEmpty.wakeOne();
+    }
+    _writer->wait();
+    delete _writer;
+    _writer = 0;
+}
+
 void Logger::mirallLog(const QString &message)
 {
     Log log_;
@@ -169,11 +451,15 @@ void Logger::setLogWindowActivated(bool activated)
 
 void Logger::setLogFile(const QString &name)
 {
+    // The lines so far belong to the previous file
+    writeBuffered();
+
     QMutexLocker locker(&_mutex);
 
     csync_set_log_level(11);
 
     if (_logstream) {
+        _logFileOpen.store(0);
         _logstream.reset(0);
         _logFile.close();
     }
@@ -200,15 +486,23 @@ void Logger::setLogFile(const QString &name)
     }
 
     _logstream.reset(new QTextStream(&_logFile));
+    _logFileOpen.store(1);
+
+    if (!_writer) {
+        _writer = new LogWriterThread(this);
+        _writer->start();
+    }
 }
 
 void Logger::setLogExpire(int expire)
 {
+    QMutexLocker locker(&_mutex);
     _logExpire = expire;
 }
 
 void Logger::setLogDir(const QString &dir)
 {
+    QMutexLocker locker(&_mutex);
     _logDirectory = dir;
 }
 
@@ -219,39 +513,80 @@ void Logger::setLogFlush(bool flush)
 
 void Logger::setLogDebug(bool debug)
 {
-    QLoggingCategory::setFilterRules(debug ? QStringLiteral("qt.*=true\n*.debug=true") : QString());
     _logDebug = debug;
+    updateFilterRules();
+}
+
+void Logger::updateFilterRules()
+{
+    // Enabling the debug messages for the recorder alone would format all
+    // of them in every process, they stay off unless debug logging is on
+    QLoggingCategory::setFilterRules(_logDebug ? QStringLiteral("qt.*=true\n*.debug=true") : QString());
+}
+
+void Logger::setLogRecorderSize(int lines)
+{
+    // Only set up while starting, the message handler reads _recorder unlocked
+    _recorder.reset(lines > 0 ? new LogRecorder(lines) : 0);
+    updateFilterRules();
+}
+
+void Logger::recordLog(QtMsgType type, const QMessageLogContext &ctx, const QString &message)
+{
+    if (_recorder)
+        _recorder->record(type, ctx, message);
+}
+
+QString Logger::recentLogFilePath() const
+{
+    const QString dir = _logDirectory.isEmpty() ? QDir::tempPath() : _logDirectory;
+    return dir + QLatin1String("/owncloud.recent.log");
+}
+
+bool Logger::dumpLogRecorder(const QString &fileName)
+{
+    if (!_recorder)
+        return false;
+
+    QFile file(fileName.isEmpty() ? recentLogFilePath() : fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    return _recorder->write(&file);
 }
 
 void Logger::enterNextLogFile()
 {
-    if (!_logDirectory.isEmpty()) {
-        QDir dir(_logDirectory);
-        if (!dir.exists()) {
-            dir.mkpath(".");
-        }
+    // The writer thread rotates the files too, the settings and the scan
+    // go under the lock; setLogFile() takes it itself
+    QMutexLocker locker(&_mutex);
+    if (_logDirectory.isEmpty())
+        return;
 
-        // Find out what is the file with the highest number if any
-        QStringList files = dir.entryList(QStringList("owncloud.log.*"),
-            QDir::Files);
-        QRegExp rx("owncloud.log.(\\d+)");
-        uint maxNumber = 0;
-        QDateTime now = QDateTime::currentDateTimeUtc();
-        foreach (const QString &s, files) {
-            if (rx.exactMatch(s)) {
-                maxNumber = qMax(maxNumber, rx.cap(1).toUInt());
-                if (_logExpire > 0) {
-                    QFileInfo fileInfo = dir.absoluteFilePath(s);
-                    if (fileInfo.lastModified().addSecs(60 * 60 * _logExpire) < now) {
-                        dir.remove(s);
-                    }
-                }
-            }
-        }
+    QDir dir(_logDirectory);
+    if (!dir.exists()) {
+        dir.mkpath(".");
+    }
 
-        QString filename = _logDirectory + "/owncloud.log." + QString::number(maxNumber + 1);
-        setLogFile(filename);
+    // Find out what is the file with the highest number if any
+    QStringList files = dir.entryList(QStringList("owncloud.log.*"),
+        QDir::Files);
+    QRegExp rx(QLatin1String(logFilePatternC));
+    uint maxNumber = 0;
+    foreach (const QString &s, files) {
+        if (rx.exactMatch(s)) {
+            maxNumber = qMax(maxNumber, rx.cap(1).toUInt());
+        }
     }
+
+    const QString filename = dir.absoluteFilePath("owncloud.log." + QString::number(maxNumber + 1));
+    const int expire = _logExpire;
+    const qint64 dirMaxSize = _logDirMaxSize;
+    locker.unlock();
+
+    setLogFile(filename);
+
+    // The previous files are compressed and expired while logging goes on
+    QtConcurrent::run(cleanUpLogDir, dir.absolutePath(), filename, expire, dirMaxSize);
 }
 
 } // namespace OCC
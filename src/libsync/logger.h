@@ -20,6 +20,9 @@
 #include <QDateTime>
 #include <QFile>
 #include <QTextStream>
+#include <QAtomicInt>
+#include <QStringList>
+#include <QWaitCondition>
 #include <qmutex.h>
 
 #include "common/utility.h"
@@ -28,6 +31,8 @@
 
 namespace OCC {
 
+class LogRecorder;
+
 struct Log
 {
     typedef enum {
@@ -42,6 +47,16 @@ struct Log
 
 /**
  * @brief The Logger class
+ *
+ * The lines for the log file are written by a thread of the logger, the
+ * threads that log only append them to a buffer. If the writing can't
+ * keep up the buffer is bounded: further lines are dropped and their
+ * number is noted in the log.
+ *
+ * Independent of the log file, the last messages are kept in memory by a
+ * recorder, the debug messages only with setLogDebug(). They can be written
+ * to a file when something went wrong, to see what led there.
+ *
  * @ingroup libsync
  */
 class OWNCLOUDSYNC_EXPORT Logger : public QObject
@@ -51,6 +66,8 @@ public:
     bool isNoop() const;
     void log(Log log);
     void doLog(const QString &log);
+    /** Writes the lines that are still in the buffer, before returning */
+    void flushLog();
 
     static void mirallLog(const QString &message);
 
@@ -67,10 +84,23 @@ public:
     void setLogExpire(int expire);
     void setLogDir(const QString &dir);
     void setLogFlush(bool flush);
+    /** With a log dir, a new file is started when the current one exceeds @a bytes, 0 for no limit */
+    void setLogMaxSize(qint64 bytes) { _logMaxSize = bytes; }
+    /** The oldest files of the log dir are removed beyond @a bytes in total, 0 for no limit */
+    void setLogDirMaxSize(qint64 bytes) { _logDirMaxSize = bytes; }
 
     bool logDebug() const { return _logDebug; }
     void setLogDebug(bool debug);
 
+    /** The number of recent messages kept in memory, 0 to keep none */
+    void setLogRecorderSize(int lines);
+    /** Records the message for the recorder, not formatted yet */
+    void recordLog(QtMsgType type, const QMessageLogContext &ctx, const QString &message);
+    /** Writes the recent messages to @a fileName, the default is recentLogFilePath() */
+    bool dumpLogRecorder(const QString &fileName = QString());
+    /** Where a sync error or a fatal message leaves the recent messages */
+    QString recentLogFilePath() const;
+
 signals:
     void logWindowLog(const QString &);
 
@@ -84,16 +114,34 @@ public slots:
 private:
     Logger(QObject *parent = 0);
     ~Logger();
+    friend class LogWriterThread;
+    void writeLogs();
+    bool writeBuffered(); // true if the file is due to be rotated
+    void stopWriter();
+    void updateFilterRules();
+
     QList<Log> _logs;
     bool _showTime;
     bool _logWindowActivated;
     QFile _logFile;
     bool _doFileFlush;
     int _logExpire;
+    qint64 _logMaxSize;
+    qint64 _logDirMaxSize;
     bool _logDebug;
     QScopedPointer<QTextStream> _logstream;
-    QMutex _mutex;
+    QMutex _mutex; // for the file and stream, taken before _bufferMutex
     QString _logDirectory;
+
+    QAtomicInt _logFileOpen; // whether doLog() needs to buffer the lines
+    QMutex _bufferMutex;
+    QWaitCondition _bufferNotEmpty;
+    QStringList _buffer;
+    int _droppedLines;
+    bool _stopWriter;
+    QThread *_writer;
+
+    QScopedPointer<LogRecorder> _recorder;
 };
 
 } // namespace OCC
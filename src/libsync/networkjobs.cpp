@@ -21,6 +21,7 @@
 #include <QSslConfiguration>
 #include <QSslCipher>
 #include <QBuffer>
+#include <QMetaMethod>
 #include <QXmlStreamReader>
 #include <QStringList>
 #include <QStack>
@@ -156,134 +157,288 @@ bool MkColJob::finished()
 }
 
 /*********************************************************************************************/
-// supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
-static QString readContentsAsString(QXmlStreamReader &reader)
-{
-    QString result;
-    int level = 0;
-    do {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        if (type == QXmlStreamReader::StartElement) {
-            level++;
-            result += "<" + reader.name().toString() + ">";
-        } else if (type == QXmlStreamReader::Characters) {
-            result += reader.text();
-        } else if (type == QXmlStreamReader::EndElement) {
-            level--;
-            if (level < 0) {
-                break;
-            }
-            result += "</" + reader.name().toString() + ">";
-        }
 
-    } while (!reader.atEnd());
-    return result;
+RemoteEntryInfo::Property RemoteEntryInfo::propertyFromName(const QString &name)
+{
+    static const QHash<QString, Property> properties = {
+        { QStringLiteral("resourcetype"), ResourceType },
+        { QStringLiteral("getlastmodified"), LastModified },
+        { QStringLiteral("getcontentlength"), ContentLength },
+        { QStringLiteral("getetag"), Etag },
+        { QStringLiteral("id"), FileId },
+        { QStringLiteral("downloadURL"), DownloadUrl },
+        { QStringLiteral("dDC"), DownloadCookies },
+        { QStringLiteral("permissions"), Permissions },
+        { QStringLiteral("checksums"), Checksums },
+        { QStringLiteral("share-types"), ShareTypes },
+        { QStringLiteral("data-fingerprint"), DataFingerprint },
+        { QStringLiteral("size"), Size },
+        { QStringLiteral("quota-available-bytes"), QuotaAvailableBytes },
+        { QStringLiteral("quota-used-bytes"), QuotaUsedBytes },
+    };
+    return properties.value(name, Property(0));
 }
 
+QByteArray *RemoteEntryInfo::field(Property property)
+{
+    switch (property) {
+    case ResourceType:
+        return nullptr;
+    case LastModified:
+        return &_lastModified;
+    case ContentLength:
+        return &_contentLength;
+    case Etag:
+        return &_etag;
+    case FileId:
+        return &_fileId;
+    case DownloadUrl:
+        return &_downloadUrl;
+    case DownloadCookies:
+        return &_downloadCookies;
+    case Permissions:
+        return &_permissions;
+    case Checksums:
+        return &_checksums;
+    case ShareTypes:
+        return &_shareTypes;
+    case DataFingerprint:
+        return &_dataFingerprint;
+    case Size:
+        return &_size;
+    case QuotaAvailableBytes:
+        return &_quotaAvailableBytes;
+    case QuotaUsedBytes:
+        return &_quotaUsedBytes;
+    }
+    return nullptr;
+}
 
 LsColXMLParser::LsColXMLParser()
+    : _sizes(0)
+    , _failed(false)
+    , _wantPropertyMaps(false)
+    , _currentPropsHaveHttp200(false)
+    , _insidePropstat(false)
+    , _insideProp(false)
+    , _insideMultiStatus(false)
+    , _multiStatusDone(false)
+    , _textElement(NoText)
+    , _propertyLevel(0)
 {
 }
 
 bool LsColXMLParser::parse(const QByteArray &xml, QHash<QString, qint64> *sizes, const QString &expectedPath)
 {
-    // Parse DAV response
-    QXmlStreamReader reader(xml);
-    reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
-
-    QStringList folders;
-    QString currentHref;
-    QMap<QString, QString> currentTmpProperties;
-    QMap<QString, QString> currentHttp200Properties;
-    bool currentPropsHaveHttp200 = false;
-    bool insidePropstat = false;
-    bool insideProp = false;
-    bool insideMultiStatus = false;
-
-    while (!reader.atEnd()) {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        QString name = reader.name().toString();
-        // Start elements with DAV:
-        if (type == QXmlStreamReader::StartElement && reader.namespaceUri() == QLatin1String("DAV:")) {
-            if (name == QLatin1String("href")) {
-                // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
-                // but the result will have URL encoding..
-                QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(reader.readElementText().toUtf8()));
-                if (!hrefString.startsWith(expectedPath)) {
-                    qCWarning(lcLsColJob) << "Invalid href" << hrefString << "expected starting with" << expectedPath;
-                    return false;
-                }
-                currentHref = hrefString;
-            } else if (name == QLatin1String("response")) {
-            } else if (name == QLatin1String("propstat")) {
-                insidePropstat = true;
-            } else if (name == QLatin1String("status") && insidePropstat) {
-                QString httpStatus = reader.readElementText();
-                if (httpStatus.startsWith("HTTP/1.1 200")) {
-                    currentPropsHaveHttp200 = true;
+    begin(sizes, expectedPath);
+    if (!addData(xml)) {
+        qCWarning(lcLsColJob) << "ERROR" << xml;
+        return false;
+    }
+    if (!finish()) {
+        qCWarning(lcLsColJob) << "ERROR" << xml;
+        return false;
+    }
+    return true;
+}
+
+void LsColXMLParser::begin(QHash<QString, qint64> *sizes, const QString &expectedPath)
+{
+    _reader.clear();
+    _reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
+    _sizes = sizes;
+    _expectedPath = expectedPath;
+    _failed = false;
+
+    _folders.clear();
+    _currentHref.clear();
+    _currentTmpProperties.clear();
+    _currentHttp200Properties.clear();
+    _wantPropertyMaps = isSignalConnected(QMetaMethod::fromSignal(&LsColXMLParser::directoryListingIterated));
+    _currentTmpEntry = RemoteEntryInfo();
+    _currentHttp200Entry = RemoteEntryInfo();
+    _currentPropsHaveHttp200 = false;
+    _insidePropstat = false;
+    _insideProp = false;
+    _insideMultiStatus = false;
+    _multiStatusDone = false;
+    _textElement = NoText;
+    _text.clear();
+    _propertyLevel = 0;
+}
+
+bool LsColXMLParser::addData(const QByteArray &data)
+{
+    if (_failed)
+        return false;
+    _reader.addData(data);
+    if (!parseAvailableData())
+        _failed = true;
+    return !_failed;
+}
+
+bool LsColXMLParser::finish()
+{
+    if (_failed)
+        return false;
+
+    // The reader can't know that nothing follows the root element
+    if (_reader.hasError()
+        && !(_reader.error() == QXmlStreamReader::PrematureEndOfDocumentError && _multiStatusDone)) {
+        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
+        qCWarning(lcLsColJob) << "ERROR" << _reader.errorString();
+        _failed = true;
+        return false;
+    } else if (!_insideMultiStatus) {
+        qCWarning(lcLsColJob) << "ERROR no WebDAV response?";
+        _failed = true;
+        return false;
+    }
+    emit directoryListingSubfolders(_folders);
+    emit finishedWithoutError();
+    return true;
+}
+
+bool LsColXMLParser::parseAvailableData()
+{
+    while (!_reader.atEnd()) {
+        QXmlStreamReader::TokenType type = _reader.readNext();
+        if (type == QXmlStreamReader::Invalid) {
+            // Continues with the next chunk
+            return _reader.error() == QXmlStreamReader::PrematureEndOfDocumentError;
+        }
+
+        // Inside of a property: collect its contents as string, e.g.
+        // <collection></collection> for <d:resourcetype><d:collection/></d:resourcetype>
+        if (_propertyLevel > 0) {
+            if (type == QXmlStreamReader::StartElement) {
+                _propertyLevel++;
+                _propertyContent += "<" + _reader.name().toString() + ">";
+            } else if (type == QXmlStreamReader::Characters) {
+                _propertyContent += _reader.text();
+            } else if (type == QXmlStreamReader::EndElement) {
+                if (--_propertyLevel == 0) {
+                    finishProperty();
                 } else {
-                    currentPropsHaveHttp200 = false;
+                    _propertyContent += "</" + _reader.name().toString() + ">";
                 }
-            } else if (name == QLatin1String("prop")) {
-                insideProp = true;
-                continue;
-            } else if (name == QLatin1String("multistatus")) {
-                insideMultiStatus = true;
-                continue;
             }
+            continue;
         }
 
-        if (type == QXmlStreamReader::StartElement && insidePropstat && insideProp) {
-            // All those elements are properties
-            QString propertyContent = readContentsAsString(reader);
-            if (name == QLatin1String("resourcetype") && propertyContent.contains("collection")) {
-                folders.append(currentHref);
-            } else if (name == QLatin1String("size")) {
-                bool ok = false;
-                auto s = propertyContent.toLongLong(&ok);
-                if (ok && sizes) {
-                    sizes->insert(currentHref, s);
+        if (_textElement != NoText) {
+            if (type == QXmlStreamReader::Characters) {
+                _text += _reader.text();
+            } else if (type == QXmlStreamReader::EndElement) {
+                finishText();
+                if (_failed)
+                    return false;
+            }
+            continue;
+        }
+
+        const QStringRef name = _reader.name();
+        // Start elements with DAV:
+        if (type == QXmlStreamReader::StartElement) {
+            if (_reader.namespaceUri() == QLatin1String("DAV:")) {
+                if (name == QLatin1String("href")) {
+                    _textElement = HrefText;
+                    _text.clear();
+                    continue;
+                } else if (name == QLatin1String("propstat")) {
+                    _insidePropstat = true;
+                } else if (name == QLatin1String("status") && _insidePropstat) {
+                    _textElement = StatusText;
+                    _text.clear();
+                    continue;
+                } else if (name == QLatin1String("prop")) {
+                    _insideProp = true;
+                    continue;
+                } else if (name == QLatin1String("multistatus")) {
+                    _insideMultiStatus = true;
+                    continue;
                 }
             }
-            currentTmpProperties.insert(reader.name().toString(), propertyContent);
+
+            if (_insidePropstat && _insideProp) {
+                // All those elements are properties
+                _propertyLevel = 1;
+                _propertyName = name.toString();
+                _propertyContent.clear();
+            }
+            continue;
         }
 
         // End elements with DAV:
-        if (type == QXmlStreamReader::EndElement) {
-            if (reader.namespaceUri() == QLatin1String("DAV:")) {
-                if (reader.name() == "response") {
-                    if (currentHref.endsWith('/')) {
-                        currentHref.chop(1);
-                    }
-                    emit directoryListingIterated(currentHref, currentHttp200Properties);
-                    currentHref.clear();
-                    currentHttp200Properties.clear();
-                } else if (reader.name() == "propstat") {
-                    insidePropstat = false;
-                    if (currentPropsHaveHttp200) {
-                        currentHttp200Properties = QMap<QString, QString>(currentTmpProperties);
-                    }
-                    currentTmpProperties.clear();
-                    currentPropsHaveHttp200 = false;
-                } else if (reader.name() == "prop") {
-                    insideProp = false;
+        if (type == QXmlStreamReader::EndElement && _reader.namespaceUri() == QLatin1String("DAV:")) {
+            if (name == QLatin1String("response")) {
+                if (_currentHref.endsWith('/')) {
+                    _currentHref.chop(1);
+                }
+                emit directoryListingEntry(_currentHref, _currentHttp200Entry);
+                if (_wantPropertyMaps)
+                    emit directoryListingIterated(_currentHref, _currentHttp200Properties);
+                _currentHref.clear();
+                _currentHttp200Properties.clear();
+                _currentHttp200Entry = RemoteEntryInfo();
+            } else if (name == QLatin1String("propstat")) {
+                _insidePropstat = false;
+                if (_currentPropsHaveHttp200) {
+                    _currentHttp200Properties = _currentTmpProperties;
+                    _currentHttp200Entry = std::move(_currentTmpEntry);
                 }
+                _currentTmpProperties.clear();
+                _currentTmpEntry = RemoteEntryInfo();
+                _currentPropsHaveHttp200 = false;
+            } else if (name == QLatin1String("prop")) {
+                _insideProp = false;
+            } else if (name == QLatin1String("multistatus")) {
+                _multiStatusDone = true;
             }
         }
     }
+    return true;
+}
 
-    if (reader.hasError()) {
-        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
-        qCWarning(lcLsColJob) << "ERROR" << reader.errorString() << xml;
-        return false;
-    } else if (!insideMultiStatus) {
-        qCWarning(lcLsColJob) << "ERROR no WebDAV response?" << xml;
-        return false;
-    } else {
-        emit directoryListingSubfolders(folders);
-        emit finishedWithoutError();
+void LsColXMLParser::finishText()
+{
+    if (_textElement == HrefText) {
+        // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
+        // but the result will have URL encoding..
+        QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(_text.toUtf8()));
+        if (!hrefString.startsWith(_expectedPath)) {
+            qCWarning(lcLsColJob) << "Invalid href" << hrefString << "expected starting with" << _expectedPath;
+            _failed = true;
+        } else {
+            _currentHref = hrefString;
+        }
+    } else if (_textElement == StatusText) {
+        _currentPropsHaveHttp200 = _text.startsWith("HTTP/1.1 200");
     }
-    return true;
+    _textElement = NoText;
+    _text.clear();
+}
+
+void LsColXMLParser::finishProperty()
+{
+    const auto property = RemoteEntryInfo::propertyFromName(_propertyName);
+    if (property == RemoteEntryInfo::ResourceType) {
+        _currentTmpEntry._isDirectory = _propertyContent.contains("collection");
+        if (_currentTmpEntry._isDirectory)
+            _folders.append(_currentHref);
+    } else if (property) {
+        *_currentTmpEntry.field(property) = _propertyContent.toUtf8();
+    }
+    if (property == RemoteEntryInfo::Size) {
+        bool ok = false;
+        auto s = _propertyContent.toLongLong(&ok);
+        if (ok && _sizes) {
+            _sizes->insert(_currentHref, s);
+        }
+    }
+    _currentTmpEntry._present |= property;
+    if (_wantPropertyMaps)
+        _currentTmpProperties.insert(_propertyName, _propertyContent);
 }
 
 /*********************************************************************************************/
@@ -332,7 +487,7 @@ void LsColJob::start()
     }
 
     QNetworkRequest req;
-    req.setRawHeader("Depth", "1");
+    req.setRawHeader("Depth", _depth);
     QByteArray xml("<?xml version=\"1.0\" ?>\n"
                    "<d:propfind xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">\n"
                    "  <d:prop>\n"
@@ -349,30 +504,61 @@ void LsColJob::start()
     AbstractNetworkJob::start();
 }
 
-// TODO: Instead of doing all in this slot, we should iteratively parse in readyRead(). This
-// would allow us to be more asynchronous in processing while data is coming from the network,
-// not all in one big blob at the end.
-bool LsColJob::finished()
+static bool isMultiStatusReply(QNetworkReply *reply)
 {
-    qCInfo(lcLsColJob) << "LSCOL of" << reply()->request().url() << "FINISHED WITH STATUS"
-                       << reply()->error()
-                       << (reply()->error() == QNetworkReply::NoError ? QLatin1String("") : errorString());
+    QString contentType = reply->header(QNetworkRequest::ContentTypeHeader).toString();
+    int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    return httpCode == 207 && contentType.contains("application/xml; charset=utf-8");
+}
 
-    QString contentType = reply()->header(QNetworkRequest::ContentTypeHeader).toString();
-    int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-    if (httpCode == 207 && contentType.contains("application/xml; charset=utf-8")) {
-        LsColXMLParser parser;
-        connect(&parser, &LsColXMLParser::directoryListingSubfolders,
+void LsColJob::newReplyHook(QNetworkReply *reply)
+{
+    // After a redirect the listing starts over
+    _parser.reset();
+    _parseFailed = false;
+    connect(reply, &QIODevice::readyRead, this, &LsColJob::slotReadyRead);
+}
+
+void LsColJob::slotReadyRead()
+{
+    if (_parseFailed || !reply())
+        return;
+    if (!_parser) {
+        // Leave error bodies and redirects to finished()
+        if (!isMultiStatusReply(reply()))
+            return;
+        _parser.reset(new LsColXMLParser);
+        connect(_parser.data(), &LsColXMLParser::directoryListingSubfolders,
             this, &LsColJob::directoryListingSubfolders);
-        connect(&parser, &LsColXMLParser::directoryListingIterated,
-            this, &LsColJob::directoryListingIterated);
-        connect(&parser, &LsColXMLParser::finishedWithError,
+        if (isSignalConnected(QMetaMethod::fromSignal(&LsColJob::directoryListingIterated))) {
+            connect(_parser.data(), &LsColXMLParser::directoryListingIterated,
+                this, &LsColJob::directoryListingIterated);
+        }
+        connect(_parser.data(), &LsColXMLParser::directoryListingEntry,
+            this, &LsColJob::directoryListingEntry);
+        connect(_parser.data(), &LsColXMLParser::finishedWithError,
             this, &LsColJob::finishedWithError);
-        connect(&parser, &LsColXMLParser::finishedWithoutError,
+        connect(_parser.data(), &LsColXMLParser::finishedWithoutError,
             this, &LsColJob::finishedWithoutError);
 
         QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/webdav/folder"
-        if (!parser.parse(reply()->readAll(), &_sizes, expectedPath)) {
+        _parser->begin(&_sizes, expectedPath);
+    }
+    if (!_parser->addData(reply()->readAll()))
+        _parseFailed = true;
+}
+
+bool LsColJob::finished()
+{
+    qCInfo(lcLsColJob) << "LSCOL of" << reply()->request().url() << "FINISHED WITH STATUS"
+                       << reply()->error()
+                       << (reply()->error() == QNetworkReply::NoError ? QLatin1String("") : errorString());
+
+    int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (isMultiStatusReply(reply())) {
+        // Whatever is left since the last readyRead
+        slotReadyRead();
+        if (_parseFailed || !_parser || !_parser->finish()) {
             // XML parse error
             emit finishedWithError(reply());
         }
@@ -635,9 +821,22 @@ AvatarJob::AvatarJob(AccountPtr account, const QString &userId, int size, QObjec
 
 void AvatarJob::start()
 {
-    QNetworkRequest req;
-    sendRequest("GET", _avatarUrl, req);
-    AbstractNetworkJob::start();
+    ImageCache::lookup(*account(), _avatarUrl, this, [this](bool found, const ImageCache::Entry &entry, bool fresh) {
+        if (found && fresh) {
+            emitAvatar(entry.data);
+            deleteLater();
+            return;
+        }
+        _cached = entry;
+        ImageCache::enqueueFetch(this, [this] {
+            QNetworkRequest req;
+            req.setPriority(QNetworkRequest::LowPriority);
+            if (!_cached.etag.isEmpty())
+                req.setRawHeader("If-None-Match", _cached.etag);
+            sendRequest("GET", _avatarUrl, req);
+            AbstractNetworkJob::start();
+        });
+    });
 }
 
 QImage AvatarJob::makeCircularAvatar(const QImage &baseAvatar)
@@ -664,18 +863,27 @@ bool AvatarJob::finished()
 {
     int http_result_code = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-    QImage avImage;
+    QByteArray pngData;
+    if (http_result_code == 304) {
+        ImageCache::insert(*account(), _avatarUrl, ImageCache::Entry());
+        pngData = _cached.data;
+    } else if (http_result_code == 200) {
+        pngData = reply()->readAll();
+        ImageCache::insert(*account(), _avatarUrl, ImageCache::Entry{ reply()->rawHeader("ETag"), pngData });
+    }
+    emitAvatar(pngData);
+    return true;
+}
 
-    if (http_result_code == 200) {
-        QByteArray pngData = reply()->readAll();
-        if (pngData.size()) {
-            if (avImage.loadFromData(pngData)) {
-                qCDebug(lcAvatarJob) << "Retrieved Avatar pixmap!";
-            }
+void AvatarJob::emitAvatar(const QByteArray &pngData)
+{
+    QImage avImage;
+    if (pngData.size()) {
+        if (avImage.loadFromData(pngData)) {
+            qCDebug(lcAvatarJob) << "Retrieved Avatar pixmap!";
         }
     }
     emit(avatarPixmap(avImage));
-    return true;
 }
 #endif
 
@@ -789,6 +997,8 @@ void JsonApiJob::start()
 {
     QNetworkRequest req;
     req.setRawHeader("OCS-APIREQUEST", "true");
+    if (!_ifNoneMatch.isEmpty())
+        req.setRawHeader("If-None-Match", _ifNoneMatch);
     QUrl url = Utility::concatUrlPath(account()->url(), path());
     QList<QPair<QString, QString>> params = _additionalParams;
     params << qMakePair(QString::fromLatin1("format"), QString::fromLatin1("json"));
@@ -811,6 +1021,12 @@ bool JsonApiJob::finished()
         return true;
     }
 
+    if (reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304) {
+        emit notModified();
+        return true;
+    }
+    _etag = reply()->rawHeader("ETag");
+
     QString jsonStr = QString::fromUtf8(reply()->readAll());
     if (jsonStr.contains("<?xml version=\"1.0\"?>")) {
         QRegExp rex("<statuscode>(\\d+)</statuscode>");
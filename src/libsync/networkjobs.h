@@ -17,6 +17,9 @@
 #define NETWORKJOBS_H
 
 #include "abstractnetworkjob.h"
+#include "imagecache.h"
+
+#include <QXmlStreamReader>
 
 #include <functional>
 
@@ -43,6 +46,57 @@ private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
 };
 
+/**
+ * @brief The properties of one entry of a PROPFIND reply
+ *
+ * Only the properties the discovery uses have a field. The values are kept
+ * as received so they can be shared with csync_file_stat_t without being
+ * converted again.
+ *
+ * @ingroup libsync
+ */
+struct OWNCLOUDSYNC_EXPORT RemoteEntryInfo
+{
+    enum Property {
+        ResourceType = 1 << 0,
+        LastModified = 1 << 1,
+        ContentLength = 1 << 2,
+        Etag = 1 << 3,
+        FileId = 1 << 4,
+        DownloadUrl = 1 << 5,
+        DownloadCookies = 1 << 6,
+        Permissions = 1 << 7,
+        Checksums = 1 << 8,
+        ShareTypes = 1 << 9,
+        DataFingerprint = 1 << 10,
+        Size = 1 << 11,
+        QuotaAvailableBytes = 1 << 12,
+        QuotaUsedBytes = 1 << 13
+    };
+
+    /// Returns 0 for properties without a field
+    static Property propertyFromName(const QString &name);
+    QByteArray *field(Property property);
+
+    bool has(Property property) const { return _present & property; }
+
+    int _present = 0; // the received properties
+    bool _isDirectory = false;
+    QByteArray _lastModified;
+    QByteArray _contentLength;
+    QByteArray _etag;
+    QByteArray _fileId;
+    QByteArray _downloadUrl;
+    QByteArray _downloadCookies;
+    QByteArray _permissions;
+    QByteArray _checksums;
+    QByteArray _shareTypes;
+    QByteArray _dataFingerprint;
+    QByteArray _size;
+    QByteArray _quotaAvailableBytes;
+    QByteArray _quotaUsedBytes;
+};
+
 /**
  * @brief The LsColJob class
  * @ingroup libsync
@@ -55,11 +109,62 @@ public:
 
     bool parse(const QByteArray &xml, QHash<QString, qint64> *sizes, const QString &expectedPath);
 
+    /**
+     * Parses a reply while it is being received.
+     *
+     * Call begin(), then addData() for every chunk and finish() at the end.
+     * directoryListingIterated() is emitted as soon as an entry is complete.
+     * addData() and finish() return false if the reply is not valid, the
+     * entries emitted until then should be discarded.
+     */
+    void begin(QHash<QString, qint64> *sizes, const QString &expectedPath);
+    bool addData(const QByteArray &data);
+    bool finish();
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
+    /// Only emitted if something is connected to it when begin() is called
     void directoryListingIterated(const QString &name, const QMap<QString, QString> &properties);
+    void directoryListingEntry(const QString &name, const RemoteEntryInfo &entry);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
+
+private:
+    bool parseAvailableData();
+    void finishText();
+    void finishProperty();
+
+    QXmlStreamReader _reader;
+    QHash<QString, qint64> *_sizes;
+    QString _expectedPath;
+    bool _failed;
+
+    QStringList _folders;
+    QString _currentHref;
+    QMap<QString, QString> _currentTmpProperties;
+    QMap<QString, QString> _currentHttp200Properties;
+    bool _wantPropertyMaps;
+    RemoteEntryInfo _currentTmpEntry;
+    RemoteEntryInfo _currentHttp200Entry;
+    bool _currentPropsHaveHttp200;
+    bool _insidePropstat;
+    bool _insideProp;
+    bool _insideMultiStatus;
+    bool _multiStatusDone;
+
+    // Element whose text is collected across chunks
+    enum TextElement {
+        NoText,
+        HrefText,
+        StatusText
+    };
+    TextElement _textElement;
+    QString _text;
+
+    // Nesting level inside the current property, 0 outside of properties
+    int _propertyLevel;
+    QString _propertyName;
+    QString _propertyContent;
 };
 
 class OWNCLOUDSYNC_EXPORT LsColJob : public AbstractNetworkJob
@@ -82,18 +187,37 @@ public:
     void setProperties(QList<QByteArray> properties);
     QList<QByteArray> properties() const;
 
+    /**
+     * The Depth header of the request, "1" by default.
+     *
+     * With "infinity" the entries of all subdirectories are listed too,
+     * this needs Capabilities::propfindDepthInfinity().
+     */
+    void setDepth(const QByteArray &depth) { _depth = depth; }
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
+    /// Building the map costs a lot with many entries, prefer directoryListingEntry()
     void directoryListingIterated(const QString &name, const QMap<QString, QString> &properties);
+    void directoryListingEntry(const QString &name, const RemoteEntryInfo &entry);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
 
+protected:
+    void newReplyHook(QNetworkReply *reply) Q_DECL_OVERRIDE;
+
 private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
+    void slotReadyRead();
 
 private:
     QList<QByteArray> _properties;
     QUrl _url; // Used instead of path() if the url is specified in the constructor
+    QByteArray _depth = "1";
+
+    // Parses the reply as it arrives instead of buffering it until finished()
+    QScopedPointer<LsColXMLParser> _parser;
+    bool _parseFailed = false;
 };
 
 /**
@@ -140,6 +264,7 @@ private:
  * @brief Retrieves the account users avatar from the server using a GET request.
  *
  * If the server does not have the avatar, the result Pixmap is empty.
+ * The avatar is kept in the ImageCache.
  *
  * @ingroup libsync
  */
@@ -169,7 +294,10 @@ private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
 
 private:
+    void emitAvatar(const QByteArray &pngData);
+
     QUrl _avatarUrl;
+    ImageCache::Entry _cached;
 };
 #endif
 
@@ -342,6 +470,17 @@ public:
      */
     void addQueryParams(QList<QPair<QString, QString>> params);
 
+    /**
+     * Sends @a etag, the etag() of an earlier answer, as If-None-Match.
+     *
+     * If the server answers that nothing changed since then, notModified()
+     * is emitted instead of jsonReceived().
+     */
+    void setIfNoneMatch(const QByteArray &etag) { _ifNoneMatch = etag; }
+
+    /// The ETag header of the answer, empty if the server sent none
+    QByteArray etag() const { return _etag; }
+
 public slots:
     void start() Q_DECL_OVERRIDE;
 
@@ -356,8 +495,13 @@ signals:
      */
     void jsonReceived(const QJsonDocument &json, int statusCode);
 
+    /// The answer is the same as the one setIfNoneMatch() refers to
+    void notModified();
+
 private:
     QList<QPair<QString, QString>> _additionalParams;
+    QByteArray _ifNoneMatch;
+    QByteArray _etag;
 };
 
 /**
@@ -22,9 +22,12 @@
 #include "propagateremotemove.h"
 #include "propagateremotemkdir.h"
 #include "propagatorjobs.h"
+#include "progressdispatcher.h"
 #include "common/utility.h"
 #include "account.h"
 #include "common/asserts.h"
+#include "filesystem.h"
+#include "bandwidthbudget.h"
 
 #ifdef Q_OS_WIN
 #include <windef.h>
@@ -32,12 +35,14 @@
 #endif
 
 #include <QStack>
+#include <QSet>
 #include <QFileInfo>
 #include <QDir>
 #include <QLoggingCategory>
 #include <QTimer>
 #include <QObject>
 #include <QTimerEvent>
+#include <QtConcurrent>
 #include <qmath.h>
 
 namespace OCC {
@@ -74,15 +79,16 @@ qint64 freeSpaceLimit()
 
 OwncloudPropagator::~OwncloudPropagator()
 {
+    _diskFlushWatcher.waitForFinished();
+    BandwidthBudget::instance()->setWeight(this, BandwidthBudget::LocalIo, 0);
+    // The jobs are deleted after this, the running operations still use them
+    _localOperationsPool.waitForDone();
 }
 
 
 int OwncloudPropagator::maximumActiveTransferJob()
 {
-    if (_downloadLimit.fetchAndAddAcquire(0) != 0
-        || _uploadLimit.fetchAndAddAcquire(0) != 0
-        || !_syncOptions._parallelNetworkJobs) {
-        // disable parallelism when there is a network limit.
+    if (!_syncOptions._parallelNetworkJobs || _syncOptions._constrainedNetwork) {
         return 1;
     }
     return qMin(3, qCeil(hardMaximumActiveJob() / 2.));
@@ -96,11 +102,187 @@ int OwncloudPropagator::hardMaximumActiveJob()
     static int max = qgetenv("OWNCLOUD_MAX_PARALLEL").toUInt();
     if (max)
         return max;
+    if (_concurrency)
+        return _concurrency->limit();
     if (_account->isHttp2Supported())
         return 20;
     return 6; // (Qt cannot do more anyway)
 }
 
+/* Whether the job of @a item is an upload or a download */
+static bool isTransfer(const SyncFileItem &item)
+{
+    if (item.isDirectory() || item._type == SyncFileItem::VirtualFile)
+        return false;
+    switch (item._instruction) {
+    case CSYNC_INSTRUCTION_NEW:
+    case CSYNC_INSTRUCTION_SYNC:
+    case CSYNC_INSTRUCTION_CONFLICT:
+    case CSYNC_INSTRUCTION_TYPE_CHANGE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool OwncloudPropagator::isBulkTransfer(const SyncFileItem &item) const
+{
+    const quint64 minSize = _syncOptions._minBulkTransferSize;
+    if (!isTransfer(item))
+        return false;
+    return (minSize != 0 && item._size >= minSize) || _syncOptions._prefetchPaths.contains(item._file);
+}
+
+int OwncloudPropagator::maximumBulkTransferJob()
+{
+    // Keep at least one transfer slot for the small files
+    return qMax(1, maximumActiveTransferJob() - 1);
+}
+
+bool OwncloudPropagator::isMetadataOnly(const SyncFileItem &item) const
+{
+    switch (item._instruction) {
+    case CSYNC_INSTRUCTION_REMOVE:
+    case CSYNC_INSTRUCTION_RENAME:
+        return true;
+    case CSYNC_INSTRUCTION_NEW:
+    case CSYNC_INSTRUCTION_TYPE_CHANGE:
+        return item.isDirectory();
+    default:
+        return false;
+    }
+}
+
+int OwncloudPropagator::maximumActiveMetadataJob()
+{
+    if (!_syncOptions._parallelNetworkJobs)
+        return 1;
+    // They wait in the network layer for a free connection rather than in our
+    // queue, and the adaptive limit still reduces them when the server slows down.
+    return 4 * hardMaximumActiveJob();
+}
+
+/* Whether hardMaximumActiveJob() follows the measured latency and errors */
+static bool adaptiveConcurrencyEnabled()
+{
+    static bool enabled = qgetenv("OWNCLOUD_ADAPTIVE_PARALLELISM") != "0"
+        && qgetenv("OWNCLOUD_MAX_PARALLEL").toUInt() == 0;
+    return enabled;
+}
+
+// Transfers below this mostly measure the request latency, above it the throughput
+static const quint64 LatencySampleMaxSize = 16 * 1024;
+static const quint64 ThroughputSampleMinSize = 64 * 1024;
+
+void OwncloudPropagator::adaptConcurrency(PropagateItemJob *job, qint64 durationMs)
+{
+    const SyncFileItem &item = *job->_item;
+    if (item._status == SyncFileItem::Success && durationMs >= 0) {
+        const bool sizeDependent = ProgressInfo::isSizeDependent(item);
+        const bool remoteMetadata = !sizeDependent && item._direction == SyncFileItem::Up
+            && (item._instruction == CSYNC_INSTRUCTION_REMOVE
+                   || item._instruction == CSYNC_INSTRUCTION_RENAME
+                   || (item._instruction == CSYNC_INSTRUCTION_NEW && item.isDirectory()));
+        if (remoteMetadata || (sizeDependent && item._size < LatencySampleMaxSize)) {
+            _account->reportRequestLatency(durationMs);
+        } else if (sizeDependent && item._size >= ThroughputSampleMinSize) {
+            // A file that took no longer than the latency says nothing about the throughput
+            const qint64 transferMs = durationMs - qMax<qint64>(0, _account->requestLatency());
+            if (transferMs > 0)
+                _account->reportTransfer(item._size, transferMs);
+        }
+    }
+
+    if (!_concurrency)
+        return;
+    switch (item._status) {
+    case SyncFileItem::Success:
+    case SyncFileItem::Conflict:
+    case SyncFileItem::Restoration:
+        if (job->isLikelyFinishedQuickly() && durationMs >= 0)
+            _concurrency->reportLatency(durationMs);
+        if (ProgressInfo::isSizeDependent(item))
+            _concurrency->reportTransfer(item._size);
+        break;
+    case SyncFileItem::NormalError:
+    case SyncFileItem::SoftError:
+    case SyncFileItem::FatalError:
+        // Errors that the server sends when it or a proxy is overloaded
+        if (item._httpErrorCode == 408 || item._httpErrorCode == 429
+            || item._httpErrorCode == 502 || item._httpErrorCode == 504) {
+            _concurrency->reportFailure();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+ConcurrencyController::State OwncloudPropagator::concurrencyState() const
+{
+    if (!_concurrency)
+        return ConcurrencyController::State();
+    return _concurrency->state();
+}
+
+void ActiveJobList::append(PropagateItemJob *job)
+{
+    appendEntry(job, _propagator->isMetadataOnly(*job->_item));
+}
+
+void ActiveJobList::appendMetadataOnly(PropagateItemJob *job)
+{
+    appendEntry(job, true);
+}
+
+void ActiveJobList::appendEntry(PropagateItemJob *job, bool metadataOnly)
+{
+    Entry &entry = _entries[job];
+    if (entry.count == 0) {
+        entry.metadataOnly = metadataOnly;
+        entry.likelyFinishedQuickly = !entry.metadataOnly && job->isLikelyFinishedQuickly();
+        entry.bulkTransfer = !entry.metadataOnly && _propagator->isBulkTransfer(*job->_item);
+        if (entry.bulkTransfer)
+            ++_bulkTransferCount;
+    }
+    ++entry.count;
+    ++_count;
+    if (entry.likelyFinishedQuickly)
+        ++_likelyFinishedQuicklyCount;
+    if (entry.metadataOnly)
+        ++_metadataOnlyCount;
+}
+
+bool ActiveJobList::removeOne(PropagateItemJob *job)
+{
+    return removeEntries(job, 1) == 1;
+}
+
+int ActiveJobList::removeAll(PropagateItemJob *job)
+{
+    return removeEntries(job, _entries.value(job).count);
+}
+
+int ActiveJobList::removeEntries(PropagateItemJob *job, int count)
+{
+    auto it = _entries.find(job);
+    if (it == _entries.end() || count <= 0)
+        return 0;
+    count = qMin(count, it->count);
+    it->count -= count;
+    _count -= count;
+    if (it->likelyFinishedQuickly)
+        _likelyFinishedQuicklyCount -= count;
+    if (it->metadataOnly)
+        _metadataOnlyCount -= count;
+    if (it->count == 0) {
+        if (it->bulkTransfer)
+            --_bulkTransferCount;
+        _entries.erase(it);
+    }
+    return count;
+}
+
 PropagateItemJob::~PropagateItemJob()
 {
     if (auto p = propagator()) {
@@ -225,6 +407,11 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
     _item->_status = statusArg;
 
     _state = Finished;
+    if (_traceStart >= 0) {
+        Tracing::addAsyncSpan("propagation",
+            QString::fromLatin1(metaObject()->className()) + QLatin1Char(' ') + _item->_file,
+            _traceStart, QString::number(statusArg));
+    }
     if (_item->_isRestoration) {
         if (_item->_status == SyncFileItem::Success
             || _item->_status == SyncFileItem::Conflict) {
@@ -268,6 +455,7 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
     case SyncFileItem::FileIgnored:
     case SyncFileItem::NoStatus:
     case SyncFileItem::BlacklistedError:
+    case SyncFileItem::Deferred:
         // nothing
         break;
     }
@@ -276,6 +464,8 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
         qCWarning(lcPropagator) << "Could not complete propagation of" << _item->destination() << "by" << this << "with status" << _item->_status << "and error:" << _item->_errorString;
     else
         qCInfo(lcPropagator) << "Completed propagation of" << _item->destination() << "by" << this << "with status" << _item->_status;
+    propagator()->adaptConcurrency(this, _runningSince.isValid() ? _runningSince.elapsed() : -1);
+    propagator()->prerequisiteDone(*_item);
     emit propagator()->itemCompleted(_item);
     emit finished(_item->_status);
 
@@ -359,6 +549,17 @@ void PropagateItemJob::slotRestoreJobFinished(SyncFileItem::Status status)
 
 PropagateItemJob *OwncloudPropagator::createJob(const SyncFileItemPtr &item)
 {
+    if (_syncOptions._constrainedNetwork && _syncOptions._minDeferredTransferSize > 0
+        && isTransfer(*item) && item->_size >= _syncOptions._minDeferredTransferSize) {
+        // Not an error: it isn't shown as one and doesn't get blacklisted.
+        // The parent directories don't store their new etags, so that the
+        // next sync finds the file again.
+        qCInfo(lcPropagator) << "Deferring the transfer of" << item->_file << "on a constrained network";
+        _journal->avoidReadFromDbOnNextSync(item->_file);
+        item->_status = SyncFileItem::Deferred;
+        return new PropagateIgnoreJob(this, item);
+    }
+
     bool deleteExisting = item->_instruction == CSYNC_INSTRUCTION_TYPE_CHANGE;
     switch (item->_instruction) {
     case CSYNC_INSTRUCTION_REMOVE:
@@ -411,10 +612,61 @@ PropagateItemJob *OwncloudPropagator::createJob(const SyncFileItemPtr &item)
     return 0;
 }
 
+// Limits for the files of one PropagateUploadBundle
+static const int BundleMaxFiles = 100;
+static const quint64 BundleMaxBytes = 10 * 1000 * 1000;
+// Kept fixed, the server side of the bulk upload is tuned for it
+static const quint64 BundleSmallFileSize = 100 * 1024;
+
+bool OwncloudPropagator::isBundledUpload(const SyncFileItem &item)
+{
+    return !_bundledUploadsFailed
+        && item._instruction == CSYNC_INSTRUCTION_NEW
+        && item._direction == SyncFileItem::Up
+        && !item.isDirectory()
+        && item._size < BundleSmallFileSize
+        // the admin recall needs its own OC-Tag header
+        && !item._file.contains(".sys.admin#recall#")
+        // the bandwidth manager only throttles the regular uploads
+        && _uploadLimit.fetchAndAddAcquire(0) == 0
+        && _account->capabilities().bulkUpload();
+}
+
+PropagatorJob *OwncloudPropagator::createUploadBundle(const SyncFileItemPtr &first, SyncFileItemVector *tasks)
+{
+    SyncFileItemVector items;
+    items.append(first);
+    quint64 size = first->_size;
+    for (auto it = tasks->begin(); it != tasks->end() && items.size() < BundleMaxFiles;) {
+        if (isBundledUpload(**it) && size + (*it)->_size <= BundleMaxBytes && !isWaitingForPrerequisites(**it)) {
+            size += (*it)->_size;
+            items.append(*it);
+            it = tasks->erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (items.size() == 1)
+        return createJob(first);
+    return new PropagateUploadBundle(this, items);
+}
+
+// How long a transfer may take to count as finishing quickly
+static const qint64 QuickTransferMsecs = 1000;
+static const quint64 DefaultSmallFileSize = 100 * 1024;
+static const quint64 MinSmallFileSize = 16 * 1024;
+static const quint64 MaxSmallFileSize = 10 * 1000 * 1000;
+
 quint64 OwncloudPropagator::smallFileSize()
 {
-    const quint64 smallFileSize = 100 * 1024; //default to 1 MB. Not dynamic right now.
-    return smallFileSize;
+    const quint64 throughput = _account->transferThroughput();
+    const qint64 latency = _account->requestLatency();
+    if (throughput == 0 || latency < 0)
+        return DefaultSmallFileSize;
+    // What still fits into the second after the request latency
+    const qint64 remainingMsecs = qMax<qint64>(0, QuickTransferMsecs - latency);
+    const quint64 size = throughput * remainingMsecs / 1000;
+    return qBound(MinSmallFileSize, size, MaxSmallFileSize);
 }
 
 void OwncloudPropagator::start(const SyncFileItemVector &items)
@@ -426,6 +678,12 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
      * In order to do that we loop over the items. (which are sorted by destination)
      * When we enter a directory, we can create the directory job and push it on the stack. */
 
+    if (_syncOptions._parallelNetworkJobs && adaptiveConcurrencyEnabled()) {
+        // Without HTTP/2 Qt opens at most 6 connections to a server anyway
+        const int maxLimit = _account->isHttp2Supported() ? 32 : 6;
+        _concurrency.reset(new ConcurrencyController(6, 2, maxLimit));
+    }
+
     _rootJob.reset(new PropagateDirectory(this));
     QStack<QPair<QString /* directory name */, PropagateDirectory * /* job */>> directories;
     directories.push(qMakePair(QString(), _rootJob.data()));
@@ -519,21 +777,180 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
     foreach (PropagatorJob *it, directoriesToRemove) {
         _rootJob->appendJob(it);
     }
+    addPrerequisites(items);
 
     connect(_rootJob.data(), &PropagatorJob::finished, this, &OwncloudPropagator::emitFinished);
 
     scheduleNextJob();
 }
 
+/** Calls @a visit for @a path and each of its parent directories, until it returns true */
+template <typename F>
+static void forEachParent(const QString &path, F visit)
+{
+    if (visit(path))
+        return;
+    int slashPos = path.size();
+    while ((slashPos = path.lastIndexOf(QLatin1Char('/'), slashPos - 1)) > 0) {
+        if (visit(path.left(slashPos)))
+            return;
+    }
+}
+
+void OwncloudPropagator::addPrerequisites(const SyncFileItemVector &items)
+{
+    QVector<const SyncFileItem *> renames;
+    QHash<QString, const SyncFileItem *> renamedFrom;
+    QHash<QString, const SyncFileItem *> renamedTo;
+    QHash<QString, const SyncFileItem *> removedDirectories;
+    foreach (const SyncFileItemPtr &item, items) {
+        if (item->_instruction == CSYNC_INSTRUCTION_RENAME) {
+            renames.append(item.data());
+            if (item->isDirectory()) {
+                renamedFrom.insert(item->_file, item.data());
+                renamedTo.insert(item->_renameTarget, item.data());
+            }
+        } else if (item->_instruction == CSYNC_INSTRUCTION_REMOVE && item->isDirectory()) {
+            removedDirectories.insert(item->_file, item.data());
+        }
+    }
+    if (renamedFrom.isEmpty() && removedDirectories.isEmpty())
+        return;
+
+    auto add = [this](const SyncFileItem *item, const SyncFileItem *prerequisite) {
+        // Items that wait for each other would never start, like two swapped
+        // directories. They run in the tree order then, as before.
+        if (dependsOn(prerequisite, item)) {
+            qCWarning(lcPropagator) << item->destination() << "and" << prerequisite->destination() << "depend on each other";
+            return;
+        }
+        _prerequisites.insert(item, prerequisite);
+        _pendingPrerequisites.insert(prerequisite);
+    };
+
+    // The paths of the items are the ones after the renames of their
+    // parents, see SyncEngine::adjustRenamedPath()
+    if (!renamedFrom.isEmpty()) {
+        foreach (const SyncFileItemPtr &item, items) {
+            // Takes the place a directory was renamed from
+            forEachParent(item->destination(), [&](const QString &path) {
+                const SyncFileItem *dir = renamedFrom.value(path);
+                if (!dir || dir == item.data())
+                    return false;
+                add(item.data(), dir);
+                return true;
+            });
+        }
+    }
+    foreach (const SyncFileItem *rename, renames) {
+        const QString destination = rename->destination();
+        forEachParent(rename->_file, [&](const QString &path) {
+            if (path == rename->_file)
+                return false;
+            // Moved out of a directory once it was renamed
+            const SyncFileItem *dir = renamedTo.value(path);
+            if (dir && dir != rename && !destination.startsWith(path + QLatin1Char('/'))) {
+                add(rename, dir);
+                return true;
+            }
+            // Moved out of a directory before it's removed
+            dir = removedDirectories.value(path);
+            if (dir) {
+                add(dir, rename);
+                return true;
+            }
+            return false;
+        });
+    }
+    if (!_prerequisites.isEmpty())
+        qCInfo(lcPropagator) << _prerequisites.size() << "jobs wait for jobs of other directories";
+}
+
+bool OwncloudPropagator::dependsOn(const SyncFileItem *item, const SyncFileItem *prerequisite) const
+{
+    QVector<const SyncFileItem *> toVisit{ item };
+    QSet<const SyncFileItem *> visited;
+    while (!toVisit.isEmpty()) {
+        const SyncFileItem *current = toVisit.takeLast();
+        if (current == prerequisite)
+            return true;
+        if (visited.contains(current))
+            continue;
+        visited.insert(current);
+        for (auto it = _prerequisites.constFind(current); it != _prerequisites.constEnd() && it.key() == current; ++it)
+            toVisit.append(it.value());
+    }
+    return false;
+}
+
+bool OwncloudPropagator::isWaitingForPrerequisites(const SyncFileItem &item) const
+{
+    if (_pendingPrerequisites.isEmpty())
+        return false;
+    for (auto it = _prerequisites.constFind(&item); it != _prerequisites.constEnd() && it.key() == &item; ++it) {
+        if (_pendingPrerequisites.contains(it.value()))
+            return true;
+    }
+    return false;
+}
+
+void OwncloudPropagator::prerequisitesBelowDone(const SyncFileItem &directory)
+{
+    if (_pendingPrerequisites.isEmpty())
+        return;
+    // The jobs are in the tree of the destinations
+    const QString prefix = directory.destination() + QLatin1Char('/');
+    for (auto it = _pendingPrerequisites.begin(); it != _pendingPrerequisites.end();) {
+        const QString path = (*it)->destination();
+        if (path.startsWith(prefix)) {
+            qCInfo(lcPropagator) << "The jobs waiting for" << path << "don't wait anymore";
+            it = _pendingPrerequisites.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 const SyncOptions &OwncloudPropagator::syncOptions() const
 {
     return _syncOptions;
 }
 
+qint64 OwncloudPropagator::msecsSinceLocalChange(const QString &file) const
+{
+    auto it = _localChanges.constFind(file);
+    if (it == _localChanges.constEnd() || !_localChangeClock.isValid())
+        return -1;
+    return _localChangeClock.elapsed() - *it;
+}
+
 void OwncloudPropagator::setSyncOptions(const SyncOptions &syncOptions)
 {
     _syncOptions = syncOptions;
     _chunkSize = syncOptions._initialChunkSize;
+    // Start where the previous uploads to this server left off
+    adjustChunkSize();
+    BandwidthBudget::instance()->setWeight(this, BandwidthBudget::LocalIo, _syncOptions._bandwidthWeight);
+    adjustLocalOperationThreads();
+}
+
+const int OwncloudPropagator::localOperationThreads;
+
+void OwncloudPropagator::adjustLocalOperationThreads()
+{
+    const auto threads = BandwidthBudget::instance()->share(this, BandwidthBudget::LocalIo, localOperationThreads);
+    _localOperationsPool.setMaxThreadCount(qMax<int>(1, threads));
+}
+
+void OwncloudPropagator::adjustChunkSize()
+{
+    const quint64 targetDuration = _syncOptions._targetChunkUploadDuration;
+    const quint64 throughput = _account->chunkUploadThroughput();
+    if (targetDuration == 0 || throughput == 0)
+        return;
+    _chunkSize = qBound(_syncOptions._minChunkSize,
+        throughput * targetDuration / 1000,
+        _syncOptions._maxChunkSize);
 }
 
 // ownCloud server  < 7.0 did not had permissions so we need some other euristics
@@ -553,12 +970,75 @@ bool OwncloudPropagator::isInSharedDirectory(const QString &file)
     return re;
 }
 
+void LocalCaseClashIndex::insert(Directory &dir, const QString &name)
+{
+    const QString folded = name.toCaseFolded();
+    auto it = dir.names.find(folded);
+    if (it == dir.names.end()) {
+        dir.names.insert(folded, name);
+    } else if (*it != name) {
+        it->clear();
+    }
+}
+
+LocalCaseClashIndex::Directory &LocalCaseClashIndex::directory(const QString &relDir)
+{
+    Directory &dir = _directories[relDir];
+    if (dir.listed)
+        return dir;
+    dir.listed = true;
+
+    // Keeps the lock: a file added meanwhile could be missing from the listing
+    const auto names = QDir(_localDir + relDir).entryList(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+    for (const auto &name : names) {
+#ifdef Q_OS_MAC
+        // Like the paths of the items, see QTBUG-39622
+        insert(dir, name.normalized(QString::NormalizationForm_C));
+#else
+        insert(dir, name);
+#endif
+    }
+    return dir;
+}
+
+bool LocalCaseClashIndex::mayClash(const QString &path)
+{
+    const QString relFile = QDir::fromNativeSeparators(path);
+    QMutexLocker lock(&_mutex);
+    int start = 0;
+    while (start < relFile.size()) {
+        int end = relFile.indexOf(QLatin1Char('/'), start);
+        if (end < 0)
+            end = relFile.size();
+        const QString name = relFile.mid(start, end - start);
+        const Directory &dir = directory(start > 0 ? relFile.left(start - 1) : QString());
+        auto it = dir.names.constFind(name.toCaseFolded());
+        if (it != dir.names.constEnd() && *it != name)
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+void LocalCaseClashIndex::add(const QString &path)
+{
+    const QString fileName = QDir::fromNativeSeparators(path);
+    if (!fileName.startsWith(_localDir))
+        return;
+    const QString relFile = fileName.mid(_localDir.size());
+    const int slash = relFile.lastIndexOf(QLatin1Char('/'));
+    QMutexLocker lock(&_mutex);
+    // Also if the directory wasn't listed yet, the file may not exist by then
+    insert(_directories[slash < 0 ? QString() : relFile.left(slash)], relFile.mid(slash + 1));
+}
+
 bool OwncloudPropagator::localFileNameClash(const QString &relFile)
 {
     bool re = false;
     const QString file(_localDir + relFile);
 
-    if (!file.isEmpty() && Utility::fsCasePreserving()) {
+    // A name the index knows in one case only needs no look at the disk
+    if (!file.isEmpty() && Utility::fsCasePreserving() && _caseClashIndex.mayClash(relFile)) {
 #ifdef Q_OS_MAC
         QFileInfo fileInfo(file);
         if (!fileInfo.exists()) {
@@ -607,6 +1087,8 @@ bool OwncloudPropagator::hasCaseClashAccessibilityProblem(const QString &relfile
 {
 #ifdef Q_OS_WIN
     bool result = false;
+    if (!_caseClashIndex.mayClash(relfile))
+        return result;
     const QString file(_localDir + relfile);
     WIN32_FIND_DATA FindFileData;
     HANDLE hFind;
@@ -638,40 +1120,123 @@ QString OwncloudPropagator::getFilePath(const QString &tmp_file_name) const
     return _localDir + tmp_file_name;
 }
 
+// With that many completed downloads waiting, they are flushed right away
+static const int DiskFlushBatchSize = 50;
+
+void OwncloudPropagator::flushToDisk(const QString &fileName, QObject *context, const std::function<void()> &callback)
+{
+    _pendingDiskFlushes.append({ fileName, context, callback });
+    if (_pendingDiskFlushes.size() >= DiskFlushBatchSize) {
+        startDiskFlush();
+    } else if (!_diskFlushTimer.isActive()) {
+        _diskFlushTimer.start();
+    }
+}
+
+void OwncloudPropagator::startDiskFlush()
+{
+    if (_diskFlushWatcher.isRunning() || _pendingDiskFlushes.isEmpty())
+        return; // restarted by slotDiskFlushFinished
+    _diskFlushTimer.stop();
+
+    _runningDiskFlushes.swap(_pendingDiskFlushes);
+    QStringList fileNames;
+    foreach (const auto &flush, _runningDiskFlushes)
+        fileNames.append(flush.fileName);
+    qCInfo(lcPropagator) << "Flushing" << fileNames.size() << "downloaded files to the disk";
+    _diskFlushWatcher.setFuture(QtConcurrent::run([fileNames] {
+        FileSystem::flushToDisk(fileNames);
+    }));
+}
+
+void OwncloudPropagator::slotDiskFlushFinished()
+{
+    QVector<DiskFlush> flushes;
+    flushes.swap(_runningDiskFlushes);
+    foreach (const auto &flush, flushes) {
+        if (flush.context)
+            flush.callback();
+    }
+    if (_pendingDiskFlushes.size() >= DiskFlushBatchSize || !_diskFlushTimer.isActive())
+        startDiskFlush();
+}
+
 void OwncloudPropagator::scheduleNextJob()
 {
+    // All the jobs that finish in one event loop pass share a scheduling pass
+    if (_jobScheduled)
+        return;
+    _jobScheduled = true;
     QTimer::singleShot(0, this, &OwncloudPropagator::scheduleNextJobImpl);
 }
 
-void OwncloudPropagator::scheduleNextJobImpl()
+bool OwncloudPropagator::canStartJob()
 {
     // TODO: If we see that the automatic up-scaling has a bad impact we
     // need to check how to avoid this.
     // Down-scaling on slow networks? https://github.com/owncloud/client/issues/3382
     // Making sure we do up/down at same time? https://github.com/owncloud/client/issues/1633
 
-    if (_activeJobList.count() < maximumActiveTransferJob()) {
-        if (_rootJob->scheduleSelfOrChild()) {
-            scheduleNextJob();
-        }
-    } else if (_activeJobList.count() < hardMaximumActiveJob()) {
-        int likelyFinishedQuicklyCount = 0;
-        // NOTE: Only counts the first 3 jobs! Then for each
-        // one that is likely finished quickly, we can launch another one.
-        // When a job finishes another one will "move up" to be one of the first 3 and then
-        // be counted too.
-        for (int i = 0; i < maximumActiveTransferJob() && i < _activeJobList.count(); i++) {
-            if (_activeJobList.at(i)->isLikelyFinishedQuickly()) {
-                likelyFinishedQuicklyCount++;
-            }
-        }
-        if (_activeJobList.count() < maximumActiveTransferJob() + likelyFinishedQuicklyCount) {
-            qCDebug(lcPropagator) << "Can pump in another request! activeJobs =" << _activeJobList.count();
-            if (_rootJob->scheduleSelfOrChild()) {
-                scheduleNextJob();
-            }
+    // The bulk transfers only get some of the transfer slots, so that a few
+    // big files don't hold up all the small ones behind them.
+    _bulkLaneFull = maximumActiveTransferJob() > 1
+        && _activeJobList.bulkTransferCount() >= maximumBulkTransferJob();
+
+    // The DELETEs and MKCOLs don't take transfer slots, they are only
+    // limited by their own maximum.
+    _onlyMetadataJobs = false;
+    if (_activeJobList.metadataOnlyCount() >= maximumActiveMetadataJob())
+        return false;
+    const int activeJobs = _activeJobList.count() - _activeJobList.metadataOnlyCount();
+
+    if (activeJobs < maximumActiveTransferJob()) {
+        return true;
+    } else if (_bulkLaneFull && activeJobs < hardMaximumActiveJob()) {
+        // The other jobs don't wait for the bulk transfers to make progress
+        return true;
+    } else if (activeJobs < hardMaximumActiveJob()) {
+        // NOTE: Only counts up to maximumActiveTransferJob() quick jobs! For each
+        // of them we can launch another one.
+        // Over HTTP/2 the requests share one connection, so all quick jobs are
+        // counted: only the big transfers are limited then.
+        int likelyFinishedQuicklyCount = _activeJobList.likelyFinishedQuicklyCount();
+        if (!_account->isHttp2Supported())
+            likelyFinishedQuicklyCount = qMin(likelyFinishedQuicklyCount, maximumActiveTransferJob());
+        if (activeJobs < maximumActiveTransferJob() + likelyFinishedQuicklyCount) {
+            qCDebug(lcPropagator) << "Can pump in another request! activeJobs =" << activeJobs;
+            return true;
         }
     }
+    _onlyMetadataJobs = true;
+    return true;
+}
+
+void OwncloudPropagator::setPaused(bool paused)
+{
+    if (paused == _paused)
+        return;
+    _paused = paused;
+    _bandwidthManager.setPaused(paused);
+    if (!paused)
+        scheduleNextJob();
+}
+
+void OwncloudPropagator::scheduleNextJobImpl()
+{
+    _jobScheduled = false;
+    if (_paused)
+        return;
+
+    // The jobs start synchronously and are in the _activeJobList when they
+    // wait for the network, so several can be started in one pass. Jobs that
+    // first wait for something else (like a checksum) are not counted yet,
+    // which is why the pass is bounded.
+    const int maxStarts = hardMaximumActiveJob();
+    for (int started = 0; started < maxStarts; ++started) {
+        if (!canStartJob() || !_rootJob->scheduleSelfOrChild())
+            return;
+    }
+    scheduleNextJob();
 }
 
 void OwncloudPropagator::reportProgress(const SyncFileItem &item, quint64 bytes)
@@ -720,9 +1285,9 @@ OwncloudPropagator *PropagatorJob::propagator() const
 PropagatorJob::JobParallelism PropagatorCompositeJob::parallelism()
 {
     // If any of the running sub jobs is not parallel, we have to wait
-    for (int i = 0; i < _runningJobs.count(); ++i) {
-        if (_runningJobs.at(i)->parallelism() != FullParallelism) {
-            return _runningJobs.at(i)->parallelism();
+    for (int i = 0; i < _runningSchedulingJobs.count(); ++i) {
+        if (_runningSchedulingJobs.at(i)->parallelism() != FullParallelism) {
+            return _runningSchedulingJobs.at(i)->parallelism();
         }
     }
     return FullParallelism;
@@ -751,16 +1316,23 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
     }
 
     // Ask all the running composite jobs if they have something new to schedule.
-    for (int i = 0; i < _runningJobs.size(); ++i) {
-        ASSERT(_runningJobs.at(i)->_state == Running);
+    for (int i = 0; i < _runningSchedulingJobs.size(); ++i) {
+        ASSERT(_runningSchedulingJobs.at(i)->_state == Running);
 
-        if (possiblyRunNextJob(_runningJobs.at(i))) {
+        if (possiblyRunNextJob(_runningSchedulingJobs.at(i))) {
             return true;
         }
 
+        // Don't visit subtrees that have started everything again
+        if (_runningSchedulingJobs.at(i)->isDispatched()) {
+            _runningSchedulingJobs.remove(i);
+            --i;
+            continue;
+        }
+
         // If any of the running sub jobs is not parallel, we have to cancel the scheduling
         // of the rest of the list and wait for the blocking job to finish and schedule the next one.
-        auto paral = _runningJobs.at(i)->parallelism();
+        auto paral = _runningSchedulingJobs.at(i)->parallelism();
         if (paral == WaitForFinished) {
             return false;
         }
@@ -769,20 +1341,44 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
     // Now it's our turn, check if we have something left to do.
     if (!_jobsToDo.isEmpty()) {
         PropagatorJob *nextJob = _jobsToDo.first();
+        // The directories start with a local operation or a metadata-only one
+        auto itemJob = qobject_cast<PropagateItemJob *>(nextJob);
+        if (propagator()->_onlyMetadataJobs && itemJob && !propagator()->isMetadataOnly(*itemJob->_item))
+            return false;
+        if (itemJob && propagator()->isWaitingForPrerequisites(*itemJob->_item))
+            return false;
         _jobsToDo.remove(0);
-        _runningJobs.append(nextJob);
+        addRunningJob(nextJob);
         return possiblyRunNextJob(nextJob);
     }
     while (!_tasksToDo.isEmpty()) {
-        SyncFileItemPtr nextTask = _tasksToDo.first();
-        _tasksToDo.remove(0);
-        PropagatorJob *job = propagator()->createJob(nextTask);
+        int next = 0;
+        if (propagator()->_onlyMetadataJobs) {
+            if (!propagator()->isMetadataOnly(*_tasksToDo.first()))
+                return false;
+        } else if (propagator()->_bulkLaneFull) {
+            // Start the transfers behind the bulk ones first. Nothing else
+            // is moved, to keep the order of deletes and renames
+            while (next < _tasksToDo.size() && propagator()->isBulkTransfer(*_tasksToDo.at(next)))
+                ++next;
+            if (next > 0 && (next == _tasksToDo.size() || !isTransfer(*_tasksToDo.at(next))))
+                return false;
+        }
+        // The tasks after it keep their order
+        if (propagator()->isWaitingForPrerequisites(*_tasksToDo.at(next)))
+            return false;
+        SyncFileItemPtr nextTask = _tasksToDo.at(next);
+        _tasksToDo.remove(next);
+        PropagatorJob *job = propagator()->isBundledUpload(*nextTask)
+            ? propagator()->createUploadBundle(nextTask, &_tasksToDo)
+            : propagator()->createJob(nextTask);
         if (!job) {
             qCWarning(lcDirectory) << "Useless task found for file" << nextTask->destination() << "instruction" << nextTask->_instruction;
+            propagator()->prerequisiteDone(*nextTask);
             continue;
         }
 
-        _runningJobs.append(job);
+        addRunningJob(job);
         return possiblyRunNextJob(job);
     }
 
@@ -796,6 +1392,19 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
     return false;
 }
 
+bool PropagatorCompositeJob::isDispatched() const
+{
+    return _state == Running && _jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningSchedulingJobs.isEmpty();
+}
+
+void PropagatorCompositeJob::addRunningJob(PropagatorJob *job)
+{
+    _runningJobs.insert(job);
+    // A started item job has nothing more to schedule
+    if (!qobject_cast<PropagateItemJob *>(job) || job->parallelism() != FullParallelism)
+        _runningSchedulingJobs.append(job);
+}
+
 void PropagatorCompositeJob::slotSubJobFinished(SyncFileItem::Status status)
 {
     PropagatorJob *subJob = static_cast<PropagatorJob *>(sender());
@@ -803,9 +1412,9 @@ void PropagatorCompositeJob::slotSubJobFinished(SyncFileItem::Status status)
 
     // Delete the job and remove it from our list of jobs.
     subJob->deleteLater();
-    int i = _runningJobs.indexOf(subJob);
-    ASSERT(i >= 0);
-    _runningJobs.remove(i);
+    bool wasRunning = _runningJobs.remove(subJob);
+    ASSERT(wasRunning);
+    _runningSchedulingJobs.removeOne(subJob);
 
     if (status == SyncFileItem::FatalError
         || status == SyncFileItem::NormalError
@@ -848,6 +1457,7 @@ PropagateDirectory::PropagateDirectory(OwncloudPropagator *propagator, const Syn
     , _item(item)
     , _firstJob(propagator->createJob(item))
     , _subJobs(propagator)
+    , _moveRecordsPending(false)
 {
     if (_firstJob) {
         connect(_firstJob.data(), &PropagatorJob::finished, this, &PropagateDirectory::slotFirstJobFinished);
@@ -868,6 +1478,11 @@ PropagatorJob::JobParallelism PropagateDirectory::parallelism()
 }
 
 
+bool PropagateDirectory::isDispatched() const
+{
+    return _state == Running && !_firstJob && _subJobs.isDispatched();
+}
+
 bool PropagateDirectory::scheduleSelfOrChild()
 {
     if (_state == Finished) {
@@ -879,6 +1494,12 @@ bool PropagateDirectory::scheduleSelfOrChild()
     }
 
     if (_firstJob && _firstJob->_state == NotYetStarted) {
+        // Its siblings don't wait for it meanwhile
+        if (propagator()->isWaitingForPrerequisites(*_item))
+            return false;
+        // When the transfer slots are full only the metadata-only jobs start
+        if (propagator()->_onlyMetadataJobs && !propagator()->isMetadataOnly(*_item))
+            return false;
         return _firstJob->scheduleSelfOrChild();
     }
 
@@ -896,6 +1517,8 @@ void PropagateDirectory::slotFirstJobFinished(SyncFileItem::Status status)
 
     if (status != SyncFileItem::Success && status != SyncFileItem::Restoration) {
         if (_state != Finished) {
+            // The jobs of other directories don't wait for the contents
+            propagator()->prerequisitesBelowDone(*_item);
             // Synchronously abort
             abort(AbortType::Synchronous);
             _state = Finished;
@@ -904,19 +1527,37 @@ void PropagateDirectory::slotFirstJobFinished(SyncFileItem::Status status)
         return;
     }
 
+    // The contents moved with the directory, whatever happens to their jobs
+    _moveRecordsPending = _item->_instruction == CSYNC_INSTRUCTION_RENAME
+        && !_item->_renameTarget.isEmpty()
+        && _item->_originalFile != _item->_renameTarget;
+
     propagator()->scheduleNextJob();
 }
 
+void PropagateDirectory::moveRecordsWithParent()
+{
+    if (!_moveRecordsPending)
+        return;
+    _moveRecordsPending = false;
+
+    // The contents that only moved with the directory have no item of their
+    // own, see SyncEngine::slotDiscoveryJobFinished()
+    if (!propagator()->_journal->moveSubtree(
+            _item->_originalFile.toUtf8(), _item->_renameTarget.toUtf8())) {
+        qCWarning(lcDirectory) << "Could not move the records below" << _item->_originalFile;
+    }
+    propagator()->_journal->deleteFileRecord(_item->_originalFile);
+}
+
 void PropagateDirectory::slotSubJobsFinished(SyncFileItem::Status status)
 {
+    // Also after a failed or aborted child, the records must follow the
+    // directory that was already moved
+    moveRecordsWithParent();
+
     if (!_item->isEmpty() && status == SyncFileItem::Success) {
         if (!_item->_renameTarget.isEmpty()) {
-            if (_item->_instruction == CSYNC_INSTRUCTION_RENAME
-                && _item->_originalFile != _item->_renameTarget) {
-                // Remove the stale entries from the database.
-                propagator()->_journal->deleteFileRecord(_item->_originalFile, true);
-            }
-
             _item->_file = _item->_renameTarget;
         }
 
@@ -15,6 +15,7 @@
 #ifndef OWNCLOUDPROPAGATOR_H
 #define OWNCLOUDPROPAGATOR_H
 
+#include <QDir>
 #include <QHash>
 #include <QObject>
 #include <QMap>
@@ -24,11 +25,18 @@
 #include <QPointer>
 #include <QIODevice>
 #include <QMutex>
+#include <QSet>
+#include <QFutureWatcher>
+#include <QThreadPool>
+
+#include <functional>
 
 #include "csync_util.h"
 #include "syncfileitem.h"
 #include "common/syncjournaldb.h"
+#include "common/tracing.h"
 #include "bandwidthmanager.h"
+#include "concurrencycontroller.h"
 #include "accountfwd.h"
 #include "syncoptions.h"
 
@@ -116,6 +124,14 @@ public slots:
      * returns true if a job was started.
      */
     virtual bool scheduleSelfOrChild() = 0;
+
+    /** Whether the job is running, has started all its subjobs and doesn't
+     * block the jobs after it.
+     *
+     * Its parent then stops asking it for jobs to schedule. Always false
+     * for the jobs that don't have subjobs.
+     */
+    virtual bool isDispatched() const { return false; }
 signals:
     /**
      * Emitted when the job is fully finished
@@ -158,6 +174,12 @@ protected:
 protected slots:
     void slotRestoreJobFinished(SyncFileItem::Status status);
 
+    // For the ConcurrencyController, invalidated when the time until done()
+    // is not the latency of a request
+    QElapsedTimer _runningSince;
+
+    qint64 _traceStart = -1; // for the trace of the propagation
+
 private:
     QScopedPointer<PropagateItemJob> _restoreJob;
 
@@ -178,6 +200,8 @@ public:
         qCInfo(lcPropagator) << "Starting" << instruction_str << "propagation of" << _item->_file << "by" << this;
 
         _state = Running;
+        _runningSince.start();
+        _traceStart = Tracing::isEnabled() ? Tracing::now() : -1;
         QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
         return true;
     }
@@ -188,6 +212,67 @@ public slots:
     virtual void start() = 0;
 };
 
+/**
+ * @brief The jobs that currently use resources, see OwncloudPropagator::_activeJobList
+ *
+ * The entries are counted per job, together with the numbers the scheduler
+ * needs, so that neither the updates nor the scheduler walk the list.
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ActiveJobList
+{
+public:
+    explicit ActiveJobList(OwncloudPropagator *propagator)
+        : _propagator(propagator)
+    {
+    }
+
+    void append(PropagateItemJob *job);
+    /** Like append(), but the entry counts as metadata-only whatever the item is.
+     *
+     * For the requests of a transfer that only wait for the server, like the
+     * assembly of the chunks, so that the next transfer can start meanwhile.
+     * Only applies if the job has no other entries.
+     */
+    void appendMetadataOnly(PropagateItemJob *job);
+    /// Removes one entry of @a job, returns false if it had none
+    bool removeOne(PropagateItemJob *job);
+    /// Removes all entries of @a job and returns how many there were
+    int removeAll(PropagateItemJob *job);
+
+    /// The number of entries, a job with several parallel requests counts several times
+    int count() const { return _count; }
+    int count(PropagateItemJob *job) const { return _entries.value(job).count; }
+    bool isEmpty() const { return _count == 0; }
+
+    /// The number of entries of jobs that are likely finished quickly, without the metadata-only ones
+    int likelyFinishedQuicklyCount() const { return _likelyFinishedQuicklyCount; }
+    /// The number of entries of metadata-only jobs
+    int metadataOnlyCount() const { return _metadataOnlyCount; }
+    /// The number of jobs, not entries, that are bulk transfers
+    int bulkTransferCount() const { return _bulkTransferCount; }
+
+private:
+    void appendEntry(PropagateItemJob *job, bool metadataOnly);
+    /// Removes up to @a count entries of @a job, returns how many were removed
+    int removeEntries(PropagateItemJob *job, int count);
+
+    struct Entry
+    {
+        int count = 0;
+        // Decided when the job is added, so that the counters stay consistent
+        bool likelyFinishedQuickly = false;
+        bool metadataOnly = false;
+        bool bulkTransfer = false;
+    };
+    OwncloudPropagator *_propagator;
+    QHash<PropagateItemJob *, Entry> _entries;
+    int _count = 0;
+    int _likelyFinishedQuicklyCount = 0;
+    int _metadataOnlyCount = 0;
+    int _bulkTransferCount = 0;
+};
+
 /**
  * @brief Job that runs subjobs. It becomes finished only when all subjobs are finished.
  * @ingroup libsync
@@ -198,7 +283,12 @@ class PropagatorCompositeJob : public PropagatorJob
 public:
     QVector<PropagatorJob *> _jobsToDo;
     SyncFileItemVector _tasksToDo;
-    QVector<PropagatorJob *> _runningJobs;
+    QSet<PropagatorJob *> _runningJobs;
+    /** The running jobs that may still start jobs or block the ones after
+     * them, in the order they were started. That's all of them except the
+     * plain item jobs, so scheduling doesn't depend on the number of transfers.
+     */
+    QVector<PropagatorJob *> _runningSchedulingJobs;
     SyncFileItem::Status _hasError; // NoStatus,  or NormalError / SoftError if there was an error
     quint64 _abortsCount;
 
@@ -225,6 +315,7 @@ public:
 
     virtual bool scheduleSelfOrChild() Q_DECL_OVERRIDE;
     virtual JobParallelism parallelism() Q_DECL_OVERRIDE;
+    bool isDispatched() const Q_DECL_OVERRIDE;
 
     /*
      * Abort synchronously or asynchronously - some jobs
@@ -249,6 +340,9 @@ public:
 
     qint64 committedDiskSpace() const Q_DECL_OVERRIDE;
 
+private:
+    void addRunningJob(PropagatorJob *job);
+
 private slots:
     void slotSubJobAbortFinished();
     bool possiblyRunNextJob(PropagatorJob *next)
@@ -291,6 +385,7 @@ public:
 
     virtual bool scheduleSelfOrChild() Q_DECL_OVERRIDE;
     virtual JobParallelism parallelism() Q_DECL_OVERRIDE;
+    bool isDispatched() const Q_DECL_OVERRIDE;
     virtual void abort(PropagatorJob::AbortType abortType) Q_DECL_OVERRIDE
     {
         if (_firstJob)
@@ -302,6 +397,7 @@ public:
             connect(&_subJobs, &PropagatorCompositeJob::abortFinished, this, &PropagateDirectory::abortFinished);
         }
         _subJobs.abort(abortType);
+        moveRecordsWithParent();
     }
 
     void increaseAffectedCount()
@@ -320,6 +416,11 @@ private slots:
     void slotFirstJobFinished(SyncFileItem::Status status);
     void slotSubJobsFinished(SyncFileItem::Status status);
 
+private:
+    /** Moves the records below a renamed directory, once it was moved */
+    void moveRecordsWithParent();
+
+    bool _moveRecordsPending;
 };
 
 
@@ -342,6 +443,48 @@ public:
     }
 };
 
+/**
+ * @brief The case folded names of the local directories, for localFileNameClash()
+ *
+ * Each directory is listed once per sync, when the first item in it is
+ * checked; the files the propagator creates are added as it goes, see
+ * OwncloudPropagator::touchedFile(). A name without a case variant in the
+ * index can't clash, the others still go through the file system check.
+ *
+ * The paths may have native separators, they are indexed with '/'.
+ * Used from the threads of the local operations as well.
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT LocalCaseClashIndex
+{
+public:
+    explicit LocalCaseClashIndex(const QString &localDir)
+        : _localDir(QDir::fromNativeSeparators(localDir))
+    {
+    }
+
+    /** Whether a component of @a relFile may exist locally in a different case */
+    bool mayClash(const QString &relFile);
+
+    /** The propagator is about to create @a fileName, an absolute path */
+    void add(const QString &fileName);
+
+private:
+    struct Directory
+    {
+        bool listed = false;
+        QHash<QString, QString> names; // folded -> the name, empty if there are several
+    };
+
+    /** The entry of @a relDir, listed if it wasn't yet. Called with the mutex locked */
+    Directory &directory(const QString &relDir);
+    static void insert(Directory &dir, const QString &name);
+
+    const QString _localDir;
+    QMutex _mutex;
+    QHash<QString, Directory> _directories; // by relative path, "" for the root
+};
+
 class OwncloudPropagator : public QObject
 {
     Q_OBJECT
@@ -360,11 +503,22 @@ public:
         , _journal(progressDb)
         , _finishedEmited(false)
         , _bandwidthManager(this)
+        , _activeJobList(this)
         , _anotherSyncNeeded(false)
         , _chunkSize(10 * 1000 * 1000) // 10 MB, overridden in setSyncOptions
         , _account(account)
+        , _caseClashIndex(_localDir)
     {
         qRegisterMetaType<PropagatorJob::AbortType>("PropagatorJob::AbortType");
+        _diskFlushTimer.setSingleShot(true);
+        _diskFlushTimer.setInterval(200);
+        connect(&_diskFlushTimer, &QTimer::timeout, this, &OwncloudPropagator::startDiskFlush);
+        connect(&_diskFlushWatcher, &QFutureWatcherBase::finished, this, &OwncloudPropagator::slotDiskFlushFinished);
+        // A few threads hide the latency of network drives and virus scanners
+        _localOperationsPool.setMaxThreadCount(localOperationThreads);
+        connect(this, &OwncloudPropagator::touchedFile, this, [this](const QString &fileName) {
+            _caseClashIndex.add(fileName);
+        });
     }
 
     ~OwncloudPropagator();
@@ -386,14 +540,23 @@ public:
         Jobs add themself to the list when they do an assynchronous operation.
         Jobs can be several time on the list (example, when several chunks are uploaded in parallel)
      */
-    QList<PropagateItemJob *> _activeJobList;
+    ActiveJobList _activeJobList;
 
     /** We detected that another sync is required after this one */
     bool _anotherSyncNeeded;
 
+    /** The item at @a file needs another attempt.
+     *
+     * Unlike _anotherSyncNeeded a follow-up sync of just these paths is
+     * enough, see SyncEngine::retryPaths().
+     */
+    void retryInNextSync(const QString &file) { _retryPaths.insert(file); }
+    QSet<QString> _retryPaths;
+
     /** Per-folder quota guesses.
      *
-     * This starts out empty. When an upload in a folder fails due to insufficent
+     * This starts out with the quota of the root folder if the discovery got it,
+     * see SyncEngine::rootQuota(). When an upload in a folder fails due to insufficent
      * remote quota, the quota guess is updated to be attempted_size-1 at maximum.
      *
      * Note that it will usually just an upper limit for the actual quota - but
@@ -404,6 +567,13 @@ public:
      */
     QHash<QString, quint64> _folderQuota;
 
+    /** The recent changes the file watcher saw, see SyncEngine::noteLocalChange() */
+    QHash<QString, qint64> _localChanges;
+    QElapsedTimer _localChangeClock;
+
+    /** Milliseconds since the watcher saw @a file change, -1 if it didn't recently */
+    qint64 msecsSinceLocalChange(const QString &file) const;
+
     /* the maximum number of jobs using bandwidth (uploads or downloads, in parallel) */
     int maximumActiveTransferJob();
 
@@ -414,11 +584,42 @@ public:
      * chunk-upload duration set.
      */
     quint64 _chunkSize;
+    /** Sizes the chunks for the target duration at the throughput the
+     * account measured, see Account::chunkUploadThroughput() */
+    void adjustChunkSize();
+    /** The size below which a transfer is expected to finish within a second.
+     *
+     * Follows Account::transferThroughput() and Account::requestLatency() once
+     * they were measured. Decides isLikelyFinishedQuickly() of the transfers.
+     */
     quint64 smallFileSize();
 
     /* The maximum number of active jobs in parallel  */
     int hardMaximumActiveJob();
 
+    /** Whether @a item is an up- or download that goes to the bulk lane,
+     * see SyncOptions::_minBulkTransferSize and SyncOptions::_prefetchPaths */
+    bool isBulkTransfer(const SyncFileItem &item) const;
+    /** The number of active jobs that bulk transfers may take */
+    int maximumBulkTransferJob();
+    /** Whether the job of @a item doesn't transfer file data: the remote
+     * DELETEs, MKCOLs and MOVEs and the local removes, mkdirs and renames.
+     *
+     * They don't take any of the transfer slots, see maximumActiveMetadataJob().
+     */
+    bool isMetadataOnly(const SyncFileItem &item) const;
+    /** The number of metadata-only jobs that may be active, on top of the other jobs */
+    int maximumActiveMetadataJob();
+    /** The transfer slots are all taken, only metadata-only jobs should start */
+    bool _onlyMetadataJobs = false;
+    /** All the slots for bulk transfers are taken, only other jobs should start */
+    bool _bulkLaneFull = false;
+
+    /** Feeds the result of a finished job to the ConcurrencyController */
+    void adaptConcurrency(PropagateItemJob *job, qint64 durationMs);
+    /** The current state of the ConcurrencyController, empty if the limit is fixed */
+    ConcurrencyController::State concurrencyState() const;
+
     bool isInSharedDirectory(const QString &file);
 
     /** Check whether a download would clash with an existing file
@@ -440,9 +641,50 @@ public:
     QString getFilePath(const QString &tmp_file_name) const;
 
     PropagateItemJob *createJob(const SyncFileItemPtr &item);
+
+    /** Whether @a item is a small new file that can be uploaded in a PropagateUploadBundle */
+    bool isBundledUpload(const SyncFileItem &item);
+    /**
+     * Creates the job that uploads @a first together with the other
+     * files in @a tasks that can be bundled with it. These are removed
+     * from @a tasks.
+     */
+    PropagatorJob *createUploadBundle(const SyncFileItemPtr &first, SyncFileItemVector *tasks);
+    /** The server can't do bundled uploads, see Capabilities::bulkUpload() */
+    bool _bundledUploadsFailed = false;
+    /** The server can't copy files for the uploads, see PropagateUploadFileCommon::startServerSideCopy() */
+    bool _serverSideCopyFailed = false;
+    /** The uploads of new files of this sync that may be copied, by their content checksum header */
+    QHash<QByteArray, QPointer<PropagatorJob>> _serverSideCopySources;
+
+    /**
+     * Flushes @a fileName to the disk together with the other downloads that
+     * complete around the same time, then calls @a callback.
+     *
+     * The callback is dropped if @a context is deleted in the meantime.
+     * See SyncOptions::DurabilityBatched.
+     */
+    void flushToDisk(const QString &fileName, QObject *context, const std::function<void()> &callback);
+
+    /** The threads for the file system operations of the PropagateLocalJobs */
+    QThreadPool *localOperationsPool() { return &_localOperationsPool; }
+
+    /** The threads of all the folders' pools, shared by their weights */
+    static const int localOperationThreads = 4;
+
+    /**
+     * Sizes localOperationsPool() to this folder's share of the threads,
+     * while other folders sync, see BandwidthBudget::LocalIo.
+     */
+    void adjustLocalOperationThreads();
+
     void scheduleNextJob();
     void reportProgress(const SyncFileItem &, quint64 bytes);
 
+    /** No jobs are started and the running transfers are choked while paused */
+    void setPaused(bool paused);
+    bool isPaused() const { return _paused; }
+
     void abort()
     {
         bool alreadyAborting = _abortRequested.fetchAndStoreOrdered(true);
@@ -477,6 +719,21 @@ public:
      */
     DiskSpaceResult diskSpaceCheck() const;
 
+    /** Whether the job of @a item must wait for jobs of other subtrees.
+     *
+     * The jobs run in the order of the directory tree, which isn't enough
+     * for the items moved out of a renamed or a removed directory and for
+     * the ones that take the place of a renamed directory. See
+     * addPrerequisites().
+     */
+    bool isWaitingForPrerequisites(const SyncFileItem &item) const;
+
+    /** The job of @a item finished or won't run, the items waiting for it may start */
+    void prerequisiteDone(const SyncFileItem &item) { _pendingPrerequisites.remove(&item); }
+
+    /** The jobs below @a directory won't run, the items waiting for them may start */
+    void prerequisitesBelowDone(const SyncFileItem &directory);
+
 private slots:
 
     void abortTimeout()
@@ -496,6 +753,9 @@ private slots:
 
     void scheduleNextJobImpl();
 
+    void startDiskFlush();
+    void slotDiskFlushFinished();
+
 signals:
     void itemCompleted(const SyncFileItemPtr &);
     void progress(const SyncFileItem &, quint64 bytes);
@@ -518,6 +778,34 @@ private:
     AccountPtr _account;
     QScopedPointer<PropagateDirectory> _rootJob;
     SyncOptions _syncOptions;
+    QScopedPointer<ConcurrencyController> _concurrency; // unset if the limit is fixed
+    bool _jobScheduled = false; // a scheduleNextJobImpl() is pending
+    bool _paused = false;
+
+    /** Whether the limits allow one more job to start, updates _bulkLaneFull */
+    bool canStartJob();
+
+    /** Records which of the @a items wait for which others to finish */
+    void addPrerequisites(const SyncFileItemVector &items);
+    /// Whether @a item waits for @a prerequisite, directly or through other items
+    bool dependsOn(const SyncFileItem *item, const SyncFileItem *prerequisite) const;
+    /// The items each item waits for
+    QMultiHash<const SyncFileItem *, const SyncFileItem *> _prerequisites;
+    /// The prerequisites whose job didn't finish yet
+    QSet<const SyncFileItem *> _pendingPrerequisites;
+
+    struct DiskFlush
+    {
+        QString fileName;
+        QPointer<QObject> context;
+        std::function<void()> callback;
+    };
+    QVector<DiskFlush> _pendingDiskFlushes;
+    QVector<DiskFlush> _runningDiskFlushes;
+    QTimer _diskFlushTimer; // collects the downloads that complete together
+    QFutureWatcher<void> _diskFlushWatcher;
+    QThreadPool _localOperationsPool;
+    LocalCaseClashIndex _caseClashIndex;
 };
 
 
@@ -15,6 +15,7 @@
 
 #pragma once
 
+#include "config.h"
 #include "owncloudpropagator.h"
 #include "syncfileitem.h"
 #include <QLoggingCategory>
@@ -55,6 +56,19 @@ inline QByteArray getEtagFromReply(QNetworkReply *reply)
     return ret;
 }
 
+/**
+ * The path on the server for @a path of @a item, without the suffix of a placeholder
+ */
+inline QString itemRemotePath(const SyncFileItem &item, const QString &path)
+{
+    static const QLatin1String suffix(APPLICATION_DOTVIRTUALFILE_SUFFIX);
+    if ((item._type == SyncFileItem::VirtualFile || item._type == SyncFileItem::VirtualFileDownload)
+        && path.endsWith(suffix)) {
+        return path.left(path.size() - suffix.size());
+    }
+    return path;
+}
+
 /**
  * Given an error from the network, map to a SyncFileItem::Status error
  */
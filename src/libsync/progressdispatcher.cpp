@@ -130,7 +130,6 @@ void ProgressDispatcher::setProgressInfo(const QString &folder, const ProgressIn
 
 ProgressInfo::ProgressInfo()
 {
-    connect(&_updateEstimatesTimer, &QTimer::timeout, this, &ProgressInfo::updateEstimates);
     reset();
 }
 
@@ -140,16 +139,18 @@ void ProgressInfo::reset()
 
     _currentItems.clear();
     _currentDiscoveredFolder.clear();
+    _concurrency = ConcurrencyController::State();
     _sizeProgress = Progress();
     _fileProgress = Progress();
     _totalSizeOfCompletedJobs = 0;
+    _sizeOfRunningJobs = 0;
 
     // Historically, these starting estimates were way lower, but that lead
     // to gross overestimation of ETA when a good estimate wasn't available.
     _maxBytesPerSecond = 2000000.0; // 2 MB/s
     _maxFilesPerSecond = 10.0;
 
-    _updateEstimatesTimer.stop();
+    _updatingEstimates = false;
     _lastCompletedItem = SyncFileItem();
 }
 
@@ -160,12 +161,12 @@ ProgressInfo::Status ProgressInfo::status() const
 
 void ProgressInfo::startEstimateUpdates()
 {
-    _updateEstimatesTimer.start(1000);
+    _updatingEstimates = true;
 }
 
 bool ProgressInfo::isUpdatingEstimates() const
 {
-    return _updateEstimatesTimer.isActive();
+    return _updatingEstimates;
 }
 
 static bool shouldCountProgress(const SyncFileItem &item)
@@ -226,12 +227,17 @@ void ProgressInfo::setProgressComplete(const SyncFileItem &item)
         return;
     }
 
-    _currentItems.remove(item._file);
+    auto it = _currentItems.find(item._file);
+    if (it != _currentItems.end()) {
+        if (isSizeDependent(it->_item))
+            _sizeOfRunningJobs -= it->_progress._completed;
+        _currentItems.erase(it);
+    }
     _fileProgress.setCompleted(_fileProgress._completed + item._affectedItems);
     if (ProgressInfo::isSizeDependent(item)) {
         _totalSizeOfCompletedJobs += item._size;
     }
-    recomputeCompletedSize();
+    _sizeProgress.setCompleted(_totalSizeOfCompletedJobs + _sizeOfRunningJobs);
     _lastCompletedItem = item;
 }
 
@@ -241,10 +247,16 @@ void ProgressInfo::setProgressItem(const SyncFileItem &item, quint64 completed)
         return;
     }
 
-    _currentItems[item._file]._item = item;
-    _currentItems[item._file]._progress._total = item._size;
-    _currentItems[item._file]._progress.setCompleted(completed);
-    recomputeCompletedSize();
+    // Only the difference to the previous progress of the item is added
+    ProgressItem &running = _currentItems[item._file];
+    if (isSizeDependent(running._item))
+        _sizeOfRunningJobs -= running._progress._completed;
+    running._item = item;
+    running._progress._total = item._size;
+    running._progress.setCompleted(completed);
+    if (isSizeDependent(running._item))
+        _sizeOfRunningJobs += running._progress._completed;
+    _sizeProgress.setCompleted(_totalSizeOfCompletedJobs + _sizeOfRunningJobs);
 
     // This seems dubious!
     _lastCompletedItem = SyncFileItem();
@@ -348,16 +360,6 @@ void ProgressInfo::updateEstimates()
         _maxBytesPerSecond);
 }
 
-void ProgressInfo::recomputeCompletedSize()
-{
-    quint64 r = _totalSizeOfCompletedJobs;
-    foreach (const ProgressItem &i, _currentItems) {
-        if (isSizeDependent(i._item))
-            r += i._progress._completed;
-    }
-    _sizeProgress.setCompleted(r);
-}
-
 ProgressInfo::Estimates ProgressInfo::Progress::estimates() const
 {
     Estimates est;
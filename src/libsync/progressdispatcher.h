@@ -24,16 +24,21 @@
 #include <QTimer>
 
 #include "syncfileitem.h"
+#include "concurrencycontroller.h"
 
 namespace OCC {
 
 /**
  * @brief The ProgressInfo class
+ *
+ * A value that the signals hand around and that can be queued to other
+ * threads. The hash of the running items is implicitly shared, copies
+ * don't duplicate it.
+ *
  * @ingroup libsync
  */
-class OWNCLOUDSYNC_EXPORT ProgressInfo : public QObject
+class OWNCLOUDSYNC_EXPORT ProgressInfo
 {
-    Q_OBJECT
 public:
     ProgressInfo();
 
@@ -73,7 +78,8 @@ public:
     /**
      * Called when propagation starts.
      *
-     * isUpdatingEstimates() will return true afterwards.
+     * isUpdatingEstimates() will return true afterwards. The owner then
+     * calls updateEstimates() every second.
      */
     void startEstimateUpdates();
 
@@ -103,10 +109,12 @@ public:
     /** Return true if the size needs to be taken in account in the total amount of time */
     static inline bool isSizeDependent(const SyncFileItem &item)
     {
-        return !item.isDirectory() && (item._instruction == CSYNC_INSTRUCTION_CONFLICT
-                                         || item._instruction == CSYNC_INSTRUCTION_SYNC
-                                         || item._instruction == CSYNC_INSTRUCTION_NEW
-                                         || item._instruction == CSYNC_INSTRUCTION_TYPE_CHANGE);
+        // Only the placeholder is written for a virtual file
+        return !item.isDirectory() && item._type != SyncFileItem::VirtualFile
+            && (item._instruction == CSYNC_INSTRUCTION_CONFLICT
+                   || item._instruction == CSYNC_INSTRUCTION_SYNC
+                   || item._instruction == CSYNC_INSTRUCTION_NEW
+                   || item._instruction == CSYNC_INSTRUCTION_TYPE_CHANGE);
     }
 
     /**
@@ -171,7 +179,7 @@ public:
 
     Status _status;
 
-    struct OWNCLOUDSYNC_EXPORT ProgressItem
+    struct OWNCLOUDSYNC_EXPORT ProgressItem : private InstanceCounted<InstanceCounts::ProgressItems>
     {
         SyncFileItem _item;
         Progress _progress;
@@ -183,6 +191,9 @@ public:
     // Used during local and remote update phase
     QString _currentDiscoveredFolder;
 
+    // State of the propagator's parallelism during propagation
+    ConcurrencyController::State _concurrency;
+
     void setProgressComplete(const SyncFileItem &item);
 
     void setProgressItem(const SyncFileItem &item, quint64 completed);
@@ -213,7 +224,6 @@ public:
      */
     Estimates fileProgress(const SyncFileItem &item) const;
 
-private slots:
     /**
      * Called every second once started, this function updates the
      * estimates.
@@ -221,12 +231,7 @@ private slots:
     void updateEstimates();
 
 private:
-    // Sets the completed size by summing finished jobs with the progress
-    // of active ones.
-    void recomputeCompletedSize();
-
-    // Triggers the update() slot every second once propagation started.
-    QTimer _updateEstimatesTimer;
+    bool _updatingEstimates;
 
     Progress _sizeProgress;
     Progress _fileProgress;
@@ -234,6 +239,9 @@ private:
     // All size from completed jobs only.
     quint64 _totalSizeOfCompletedJobs;
 
+    // The completed size of the active jobs, adjusted with their progress.
+    quint64 _sizeOfRunningJobs;
+
     // The fastest observed rate of files per second in this sync.
     double _maxFilesPerSecond;
     double _maxBytesPerSecond;
@@ -286,9 +294,9 @@ signals:
      */
     void progressInfo(const QString &folder, const ProgressInfo &progress);
     /**
-     * @brief: the item was completed by a job
+     * @brief: the items were completed by a job, in the order of completion
      */
-    void itemCompleted(const QString &folder, const SyncFileItemPtr &item);
+    void itemsCompleted(const QString &folder, const SyncFileItemVector &items);
 
     /**
      * @brief A new folder-wide sync error was seen.
@@ -305,4 +313,7 @@ private:
     static ProgressDispatcher *_instance;
 };
 }
+
+Q_DECLARE_METATYPE(OCC::ProgressInfo)
+
 #endif // PROGRESSDISPATCHER_H
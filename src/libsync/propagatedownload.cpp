@@ -30,6 +30,7 @@
 #include <QFileInfo>
 #include <QDir>
 #include <cmath>
+#include <cstring>
 
 #ifdef Q_OS_UNIX
 #include <unistd.h>
@@ -107,8 +108,9 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl &url, QFile *device,
 
 void GETFileJob::start()
 {
-    if (_resumeStart > 0) {
-        _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-';
+    if (_resumeStart > 0 || _rangeEnd >= 0) {
+        _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-'
+            + (_rangeEnd >= 0 ? QByteArray::number(_rangeEnd) : QByteArray());
         _headers["Accept-Ranges"] = "bytes";
         qCDebug(lcGetJob) << "Retry with range " << _headers["Range"];
     }
@@ -201,6 +203,14 @@ void GETFileJob::slotMetaDataChanged()
             start = rx.cap(1).toULongLong();
         }
     }
+    if (_rangeEnd >= 0 && ranges.isEmpty()) {
+        // Writing the whole file would overwrite the other segments
+        qCWarning(lcGetJob) << "No content-range for the segment starting at" << _resumeStart;
+        _errorString = tr("Server does not support range requests");
+        _errorStatus = SyncFileItem::NormalError;
+        reply()->abort();
+        return;
+    }
     if (start != _resumeStart) {
         qCWarning(lcGetJob) << "Wrong content-range: " << ranges << " while expecting start was" << _resumeStart;
         if (ranges.isEmpty()) {
@@ -227,6 +237,47 @@ void GETFileJob::slotMetaDataChanged()
     }
 
     _saveBodyToFile = true;
+
+    // The checksums can be computed on the fly if the whole file comes through here
+    _checksumCalculators.clear();
+    if (_resumeStart == 0 && _rangeEnd < 0) {
+        foreach (const auto &type, _checksumTypes) {
+            std::unique_ptr<ChecksumCalculator> calculator(new ChecksumCalculator(type));
+            if (calculator->isValid())
+                _checksumCalculators.push_back(std::move(calculator));
+        }
+    }
+    _compareFile.reset();
+    _compareDiffers = false;
+    if (_resumeStart == 0 && _rangeEnd < 0 && !_compareFileName.isEmpty()) {
+        _compareFile.reset(new QFile(_compareFileName));
+        if (!_compareFile->open(QIODevice::ReadOnly)) {
+            qCWarning(lcGetJob) << "Could not open" << _compareFileName << "for the comparison" << _compareFile->errorString();
+            _compareFile.reset();
+        }
+    }
+}
+
+GETFileJob::ContentComparison GETFileJob::contentComparison()
+{
+    if (_compareDiffers)
+        return ContentDiffers;
+    if (!_compareFile)
+        return NotCompared;
+    // The local file may be longer
+    const auto result = _compareFile->atEnd() ? ContentEqual : ContentDiffers;
+    _compareFile.reset();
+    _compareDiffers = result == ContentDiffers;
+    return result;
+}
+
+QMap<QByteArray, QByteArray> GETFileJob::computedChecksums()
+{
+    QMap<QByteArray, QByteArray> result;
+    for (const auto &calculator : _checksumCalculators)
+        result[calculator->checksumType()] = calculator->result();
+    _checksumCalculators.clear();
+    return result;
 }
 
 void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
@@ -261,12 +312,18 @@ qint64 GETFileJob::currentDownloadPosition()
     return _resumeStart;
 }
 
+static const qint64 ReadBufferSize = 256 * 1024;
+
 void GETFileJob::slotReadyRead()
 {
     if (!reply())
         return;
-    int bufferSize = qMin(1024 * 8ll, reply()->bytesAvailable());
-    QByteArray buffer(bufferSize, Qt::Uninitialized);
+    // Large reads mean few large writes to the file; the buffer grows up to
+    // the largest amount that was available at once and is kept for the
+    // next calls.
+    const qint64 bufferSize = qMin(ReadBufferSize, reply()->bytesAvailable());
+    if (_readBuffer.size() < bufferSize)
+        _readBuffer.resize(bufferSize);
 
     while (reply()->bytesAvailable() > 0) {
         if (_bandwidthChoked) {
@@ -275,15 +332,15 @@ void GETFileJob::slotReadyRead()
         }
         qint64 toRead = bufferSize;
         if (_bandwidthLimited) {
-            toRead = qMin(qint64(bufferSize), _bandwidthQuota);
+            toRead = qMin(bufferSize, _bandwidthQuota);
             if (toRead == 0) {
-                qCWarning(lcGetJob) << "Out of quota";
+                // The bandwidth manager refills it soon
+                qCDebug(lcGetJob) << "Out of quota";
                 break;
             }
-            _bandwidthQuota -= toRead;
         }
 
-        qint64 r = reply()->read(buffer.data(), toRead);
+        qint64 r = reply()->read(_readBuffer.data(), toRead);
         if (r < 0) {
             _errorString = networkReplyErrorString(*reply());
             _errorStatus = SyncFileItem::NormalError;
@@ -291,9 +348,11 @@ void GETFileJob::slotReadyRead()
             reply()->abort();
             return;
         }
+        if (_bandwidthLimited)
+            _bandwidthQuota -= r;
 
         if (_device->isOpen() && _saveBodyToFile) {
-            qint64 w = _device->write(buffer.constData(), r);
+            qint64 w = _device->write(_readBuffer.constData(), r);
             if (w != r) {
                 _errorString = _device->errorString();
                 _errorStatus = SyncFileItem::NormalError;
@@ -301,6 +360,17 @@ void GETFileJob::slotReadyRead()
                 reply()->abort();
                 return;
             }
+            for (const auto &calculator : _checksumCalculators)
+                calculator->addData(_readBuffer.constData(), r);
+            if (_compareFile) {
+                if (_compareBuffer.size() < r)
+                    _compareBuffer.resize(r);
+                if (_compareFile->read(_compareBuffer.data(), r) != r
+                    || memcmp(_compareBuffer.constData(), _readBuffer.constData(), r) != 0) {
+                    _compareFile.reset();
+                    _compareDiffers = true;
+                }
+            }
         }
     }
 
@@ -357,6 +427,11 @@ void PropagateDownloadFile::start()
         }
     }
 
+    if (_item->_type == SyncFileItem::VirtualFile) {
+        createVirtualFile();
+        return;
+    }
+
     // If we have a conflict where size of the file is unchanged,
     // compare the remote checksum to the local one.
     // Maybe it's not a real conflict and no download is necessary!
@@ -369,6 +444,7 @@ void PropagateDownloadFile::start()
             || _item->_modtime == _item->_previousModtime)) {
         qCDebug(lcPropagateDownload) << _item->_file << "may not need download, computing checksum";
         auto computeChecksum = new ComputeChecksum(this);
+        computeChecksum->setBackgroundIo(propagator()->syncOptions()._backgroundIo);
         computeChecksum->setChecksumType(parseChecksumHeaderType(_item->_checksumHeader));
         connect(computeChecksum, &ComputeChecksum::done,
             this, &PropagateDownloadFile::conflictChecksumComputed);
@@ -379,6 +455,27 @@ void PropagateDownloadFile::start()
     startDownload();
 }
 
+void PropagateDownloadFile::createVirtualFile()
+{
+    if (propagator()->localFileNameClash(_item->_file)) {
+        done(SyncFileItem::NormalError, tr("File %1 can not be downloaded because of a local file name clash!").arg(QDir::toNativeSeparators(_item->_file)));
+        return;
+    }
+
+    const QString fn = propagator()->getFilePath(_item->_file);
+    qCDebug(lcPropagateDownload) << "Creating the placeholder" << fn;
+    emit propagator()->touchedFile(fn);
+    QFile file(fn);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        done(SyncFileItem::NormalError, file.errorString());
+        return;
+    }
+    file.close();
+    FileSystem::setModTime(fn, _item->_modtime);
+    _item->_modtime = FileSystem::getModTime(fn);
+    updateMetadata(/*isConflict=*/false);
+}
+
 void PropagateDownloadFile::conflictChecksumComputed(const QByteArray &checksumType, const QByteArray &checksum)
 {
     if (makeChecksumHeader(checksumType, checksum) == _item->_checksumHeader) {
@@ -396,6 +493,14 @@ void PropagateDownloadFile::conflictChecksumComputed(const QByteArray &checksumT
         updateMetadata(/*isConflict=*/false);
         return;
     }
+    // Only two checksums of the same type tell that the content is different
+    QByteArray remoteType, remoteChecksum;
+    if (!checksum.isEmpty()
+        && parseChecksumHeader(_item->_checksumHeader, &remoteType, &remoteChecksum)
+        && !remoteChecksum.isEmpty()
+        && remoteType == checksumType) {
+        _contentComparison = GETFileJob::ContentDiffers;
+    }
     startDownload();
 }
 
@@ -426,8 +531,11 @@ void PropagateDownloadFile::startDownload()
         }
     }
 
+    QVector<QPair<quint64, quint64>> segmentRanges;
     if (tmpFileName.isEmpty()) {
         tmpFileName = createDownloadTmpFileName(_item->_file);
+    } else {
+        segmentRanges = progressInfo._segments;
     }
 
     _tmpFile.setFileName(propagator()->getFilePath(tmpFileName));
@@ -439,7 +547,16 @@ void PropagateDownloadFile::startDownload()
     FileSystem::setFileHidden(_tmpFile.fileName(), true);
 
     _resumeStart = _tmpFile.size();
-    if (_resumeStart > 0) {
+    if (!segmentRanges.isEmpty() && _resumeStart != _item->_size) {
+        // The preallocated file is gone, the downloaded segments too
+        segmentRanges.clear();
+        if (!_tmpFile.resize(0)) {
+            done(SyncFileItem::NormalError, _tmpFile.errorString());
+            return;
+        }
+        _resumeStart = 0;
+    }
+    if (_resumeStart > 0 && segmentRanges.isEmpty()) {
         if (_resumeStart == _item->_size) {
             qCInfo(lcPropagateDownload) << "File is already complete, no need to download";
             _tmpFile.close();
@@ -471,6 +588,17 @@ void PropagateDownloadFile::startDownload()
         return;
     }
 
+    if (segmentRanges.isEmpty() && _resumeStart == 0 && !_segmentsRefused && _item->directDownloadUrl().isEmpty())
+        segmentRanges = downloadSegmentRanges();
+    if (!segmentRanges.isEmpty()) {
+        startSegmentedDownload(tmpFileName, segmentRanges);
+        return;
+    }
+
+    // Keeps the file in one piece. The size of the file stays what was
+    // downloaded, a resume starts from there.
+    FileSystem::preallocate(&_tmpFile, _item->_size);
+
     {
         SyncJournalDb::DownloadInfo pi;
         pi._etag = _item->_etag;
@@ -482,25 +610,38 @@ void PropagateDownloadFile::startDownload()
 
     QMap<QByteArray, QByteArray> headers;
 
-    if (_item->_directDownloadUrl.isEmpty()) {
+    if (_item->directDownloadUrl().isEmpty()) {
         // Normal job, download from oC instance
         _job = new GETFileJob(propagator()->account(),
             propagator()->_remoteFolder + _item->_file,
             &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
     } else {
         // We were provided a direct URL, use that one
-        qCInfo(lcPropagateDownload) << "directDownloadUrl given for " << _item->_file << _item->_directDownloadUrl;
+        qCInfo(lcPropagateDownload) << "directDownloadUrl given for " << _item->_file << _item->directDownloadUrl();
 
-        if (!_item->_directDownloadCookies.isEmpty()) {
-            headers["Cookie"] = _item->_directDownloadCookies.toUtf8();
+        if (!_item->directDownloadCookies().isEmpty()) {
+            headers["Cookie"] = _item->directDownloadCookies().toUtf8();
         }
 
-        QUrl url = QUrl::fromUserInput(_item->_directDownloadUrl);
+        QUrl url = QUrl::fromUserInput(_item->directDownloadUrl());
         _job = new GETFileJob(propagator()->account(),
             url,
             &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
     }
     _job->setBandwidthManager(&propagator()->_bandwidthManager);
+    // The checksum of the discovery is usually the type the server sends in the reply
+    QByteArrayList checksumTypes;
+    checksumTypes.append(contentChecksumType());
+    const auto remoteChecksumType = parseChecksumHeaderType(_item->_checksumHeader);
+    if (remoteChecksumType != checksumTypes.first())
+        checksumTypes.append(remoteChecksumType);
+    _job->setChecksumTypes(checksumTypes);
+    // Saves reading both files after the download to find out whether it is a real conflict
+    if (_item->_instruction == CSYNC_INSTRUCTION_CONFLICT
+        && _contentComparison == GETFileJob::NotCompared
+        && _item->_size == _item->_previousSize) {
+        _job->setCompareFile(propagator()->getFilePath(_item->_file));
+    }
     connect(_job.data(), &GETFileJob::finishedSignal, this, &PropagateDownloadFile::slotGetFinished);
     connect(_job.data(), &GETFileJob::downloadProgress, this, &PropagateDownloadFile::slotDownloadProgress);
     propagator()->_activeJobList.append(this);
@@ -537,7 +678,7 @@ void PropagateDownloadFile::slotGetFinished()
         const bool badRangeHeader = job->resumeStart() > 0 && _item->_httpErrorCode == 416;
         if (badRangeHeader) {
             qCWarning(lcPropagateDownload) << "server replied 416 to our range request, trying again without";
-            propagator()->_anotherSyncNeeded = true;
+            propagator()->retryInNextSync(_item->_file);
         }
 
         // Getting a 404 probably means that the file was deleted on the server.
@@ -554,10 +695,10 @@ void PropagateDownloadFile::slotGetFinished()
             propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
         }
 
-        if (!_item->_directDownloadUrl.isEmpty() && err != QNetworkReply::OperationCanceledError) {
+        if (!_item->directDownloadUrl().isEmpty() && err != QNetworkReply::OperationCanceledError) {
             // If this was with a direct download, retry without direct download
-            qCWarning(lcPropagateDownload) << "Direct download of" << _item->_directDownloadUrl << "failed. Retrying through owncloud.";
-            _item->_directDownloadUrl.clear();
+            qCWarning(lcPropagateDownload) << "Direct download of" << _item->directDownloadUrl() << "failed. Retrying through owncloud.";
+            _item->setDirectDownload(QString(), QString());
             start();
             return;
         }
@@ -604,6 +745,9 @@ void PropagateDownloadFile::slotGetFinished()
         _item->_modtime = job->lastModified();
     }
     _item->_responseTimeStamp = job->responseTimestamp();
+    _computedChecksums = job->computedChecksums();
+    if (_contentComparison == GETFileJob::NotCompared)
+        _contentComparison = job->contentComparison();
 
     _tmpFile.close();
     _tmpFile.flush();
@@ -626,7 +770,7 @@ void PropagateDownloadFile::slotGetFinished()
 
     if (bodySize > 0 && bodySize != _tmpFile.size() - job->resumeStart()) {
         qCDebug(lcPropagateDownload) << bodySize << _tmpFile.size() << job->resumeStart();
-        propagator()->_anotherSyncNeeded = true;
+        propagator()->retryInNextSync(_item->_file);
         done(SyncFileItem::SoftError, tr("The file could not be downloaded completely."));
         return;
     }
@@ -639,25 +783,233 @@ void PropagateDownloadFile::slotGetFinished()
         return;
     }
 
+    auto checksumHeader = findBestChecksum(job->reply()->rawHeader(checkSumHeaderC));
+    auto contentMd5Header = job->reply()->rawHeader(contentMd5HeaderC);
+    if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty())
+        checksumHeader = "MD5:" + contentMd5Header;
+    validateTransmissionChecksum(checksumHeader);
+}
+
+void PropagateDownloadFile::validateTransmissionChecksum(const QByteArray &checksumHeader)
+{
     // Do checksum validation for the download. If there is no checksum header, the validator
     // will also emit the validated() signal to continue the flow in slot transmissionChecksumValidated()
     // as this is (still) also correct.
     ValidateChecksumHeader *validator = new ValidateChecksumHeader(this);
+    validator->setBackgroundIo(propagator()->syncOptions()._backgroundIo);
     connect(validator, &ValidateChecksumHeader::validated,
         this, &PropagateDownloadFile::transmissionChecksumValidated);
     connect(validator, &ValidateChecksumHeader::validationFailed,
         this, &PropagateDownloadFile::slotChecksumFail);
-    auto checksumHeader = findBestChecksum(job->reply()->rawHeader(checkSumHeaderC));
-    auto contentMd5Header = job->reply()->rawHeader(contentMd5HeaderC);
-    if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty())
-        checksumHeader = "MD5:" + contentMd5Header;
+    validator->setKnownChecksums(_computedChecksums);
     validator->start(_tmpFile.fileName(), checksumHeader);
 }
 
+QVector<QPair<quint64, quint64>> PropagateDownloadFile::downloadSegmentRanges() const
+{
+    QVector<QPair<quint64, quint64>> ranges;
+    const auto &options = propagator()->syncOptions();
+    const int count = options._downloadSegments;
+    if (options._minSegmentedDownloadSize == 0 || count < 2
+        || _item->_size < qMax<quint64>(options._minSegmentedDownloadSize, count)) {
+        return ranges;
+    }
+    const quint64 segmentSize = _item->_size / count;
+    for (int i = 0; i < count; ++i) {
+        const quint64 first = i * segmentSize;
+        const quint64 last = i == count - 1 ? _item->_size - 1 : first + segmentSize - 1;
+        ranges.append(qMakePair(first, last));
+    }
+    return ranges;
+}
+
+void PropagateDownloadFile::startSegmentedDownload(const QString &tmpFileName, const QVector<QPair<quint64, quint64>> &ranges)
+{
+    // Every segment writes into its part of the preallocated file. Without
+    // the allocation the resized file is sparse and the segments end up
+    // interleaved on the disk.
+    FileSystem::preallocate(&_tmpFile, _item->_size);
+    if (_tmpFile.size() != qint64(_item->_size) && !_tmpFile.resize(_item->_size)) {
+        done(SyncFileItem::NormalError, _tmpFile.errorString());
+        return;
+    }
+    _tmpFile.close();
+    _resumeStart = 0;
+    _segmentsTmpFileName = tmpFileName;
+    _segmentsChecksumHeader.clear();
+
+    for (const auto &range : ranges) {
+        Segment segment;
+        segment.start = range.first;
+        segment.end = range.second;
+        segment.file = new QFile(_tmpFile.fileName(), this);
+        if (!segment.file->open(QIODevice::ReadWrite | QIODevice::Unbuffered) || !segment.file->seek(range.first)) {
+            done(SyncFileItem::NormalError, segment.file->errorString());
+            return;
+        }
+        _segments.append(segment);
+    }
+    _downloadProgress = _item->_size - segmentBytesMissing();
+    propagator()->reportProgress(*_item, _downloadProgress);
+    saveSegmentProgress();
+
+    qCInfo(lcPropagateDownload) << "Downloading" << _item->_file << "in" << _segments.size() << "segments";
+    for (auto &segment : _segments) {
+        // The expected etag makes sure that all segments are from the same version of the file
+        segment.job = new GETFileJob(propagator()->account(),
+            propagator()->_remoteFolder + _item->_file,
+            segment.file, QMap<QByteArray, QByteArray>(), _item->_etag, segment.start, this);
+        segment.job->setRangeEnd(segment.end);
+        segment.job->setBandwidthManager(&propagator()->_bandwidthManager);
+        connect(segment.job.data(), &GETFileJob::finishedSignal, this, &PropagateDownloadFile::slotSegmentFinished);
+        connect(segment.job.data(), &GETFileJob::downloadProgress, this, &PropagateDownloadFile::slotSegmentProgress);
+        propagator()->_activeJobList.append(this);
+        segment.job->start();
+    }
+}
+
+quint64 PropagateDownloadFile::segmentBytesMissing() const
+{
+    quint64 missing = 0;
+    foreach (const auto &segment, _segments) {
+        // The GETFileJob closes the file when the reply is an error
+        const quint64 pos = segment.file->isOpen() ? segment.file->pos() : segment.start;
+        if (pos <= segment.end)
+            missing += segment.end + 1 - pos;
+    }
+    return missing;
+}
+
+void PropagateDownloadFile::saveSegmentProgress()
+{
+    SyncJournalDb::DownloadInfo pi;
+    pi._etag = _item->_etag;
+    pi._tmpfile = _segmentsTmpFileName;
+    pi._valid = true;
+    foreach (const auto &segment, _segments) {
+        const quint64 pos = segment.file->isOpen() ? segment.file->pos() : segment.start;
+        if (pos <= segment.end)
+            pi._segments.append(qMakePair(pos, segment.end));
+    }
+    propagator()->_journal->setDownloadInfo(_item->_file, pi);
+    propagator()->_journal->commitIfNeededAndStartNewTransaction("download segments");
+}
+
+void PropagateDownloadFile::abortSegments()
+{
+    for (auto &segment : _segments) {
+        if (GETFileJob *job = segment.job) {
+            segment.job = nullptr;
+            disconnect(job, nullptr, this, nullptr);
+            propagator()->_activeJobList.removeOne(this);
+            if (job->reply())
+                job->reply()->abort();
+        }
+        segment.file->close();
+    }
+}
+
+void PropagateDownloadFile::slotSegmentProgress()
+{
+    _downloadProgress = _item->_size - segmentBytesMissing();
+    propagator()->reportProgress(*_item, _downloadProgress);
+}
+
+void PropagateDownloadFile::slotSegmentFinished()
+{
+    propagator()->_activeJobList.removeOne(this);
+
+    GETFileJob *job = qobject_cast<GETFileJob *>(sender());
+    ASSERT(job);
+
+    bool othersRunning = false;
+    Segment *finishedSegment = nullptr;
+    for (auto &segment : _segments) {
+        if (segment.job == job) {
+            segment.job = nullptr;
+            finishedSegment = &segment;
+        } else if (segment.job) {
+            othersRunning = true;
+        }
+    }
+    ASSERT(finishedSegment);
+    if (finishedSegment->file->isOpen())
+        finishedSegment->start = finishedSegment->file->pos();
+
+    QNetworkReply::NetworkError err = job->reply()->error();
+    if (err != QNetworkReply::NoError) {
+        _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+        if (_item->_httpErrorCode == 200 && !propagator()->_abortRequested.fetchAndAddRelaxed(0)) {
+            // The server ignored the Range header
+            qCWarning(lcPropagateDownload) << "Server does not support range requests, downloading" << _item->_file << "in one piece";
+            abortSegments();
+            _segments.clear();
+            _segmentsRefused = true;
+            FileSystem::remove(_tmpFile.fileName());
+            propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+            startDownload();
+            return;
+        }
+
+        // Keep what was downloaded so far for the next try
+        saveSegmentProgress();
+        abortSegments();
+
+        if (_item->_httpErrorCode == 404) {
+            qCWarning(lcPropagateDownload) << "server replied 404, assuming file was deleted";
+            FileSystem::remove(_tmpFile.fileName());
+            propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+            propagator()->_journal->avoidReadFromDbOnNextSync(_item->_file);
+            job->setErrorString(tr("File was deleted from server"));
+            job->setErrorStatus(SyncFileItem::SoftError);
+        }
+
+        SyncFileItem::Status status = job->errorStatus();
+        if (status == SyncFileItem::NoStatus) {
+            status = classifyError(err, _item->_httpErrorCode,
+                &propagator()->_anotherSyncNeeded);
+        }
+        done(status, job->errorString());
+        return;
+    }
+
+    if (finishedSegment->start != finishedSegment->end + 1) {
+        qCWarning(lcPropagateDownload) << "Segment of" << _item->_file << "ends at" << finishedSegment->start
+                                       << "instead of" << finishedSegment->end + 1;
+        saveSegmentProgress();
+        abortSegments();
+        propagator()->retryInNextSync(_item->_file);
+        done(SyncFileItem::SoftError, tr("The file could not be downloaded completely."));
+        return;
+    }
+
+    if (!job->etag().isEmpty())
+        _item->_etag = parseEtag(job->etag());
+    if (job->lastModified())
+        _item->_modtime = job->lastModified();
+    _item->_responseTimeStamp = job->responseTimestamp();
+    // The checksum header is the one of the whole file
+    if (_segmentsChecksumHeader.isEmpty())
+        _segmentsChecksumHeader = findBestChecksum(job->reply()->rawHeader(checkSumHeaderC));
+
+    saveSegmentProgress();
+    if (othersRunning)
+        return;
+
+    foreach (const auto &segment, _segments)
+        segment.file->close();
+    _segments.clear();
+
+    // Without a header in the replies, the checksum from the discovery
+    // is the one of the same version since the etags match
+    validateTransmissionChecksum(_segmentsChecksumHeader.isEmpty() ? _item->_checksumHeader : _segmentsChecksumHeader);
+}
+
 void PropagateDownloadFile::slotChecksumFail(const QString &errMsg)
 {
     FileSystem::remove(_tmpFile.fileName());
-    propagator()->_anotherSyncNeeded = true;
+    propagator()->retryInNextSync(_item->_file);
     done(SyncFileItem::SoftError, errMsg); // tr("The file downloaded with a broken checksum, will be redownloaded."));
 }
 
@@ -743,9 +1095,11 @@ namespace { // Anonymous namespace for the recall feature
             QString targetPath = makeRecallFileName(recalledFile);
 
             qCDebug(lcPropagateDownload) << "Copy recall file: " << recalledFile << " -> " << targetPath;
-            // Remove the target first, QFile::copy will not overwrite it.
+            // Remove the target first, copyFast will not overwrite it.
             FileSystem::remove(targetPath);
-            QFile::copy(recalledFile, targetPath);
+            QString error;
+            if (!FileSystem::copyFast(recalledFile, targetPath, &error))
+                qCWarning(lcPropagateDownload) << "Could not copy the recall file" << recalledFile << error;
         }
     }
 
@@ -772,8 +1126,15 @@ void PropagateDownloadFile::transmissionChecksumValidated(const QByteArray &chec
         return contentChecksumComputed(checksumType, checksum);
     }
 
+    // Computed during the download?
+    const auto computed = _computedChecksums.value(theContentChecksumType);
+    if (!computed.isEmpty()) {
+        return contentChecksumComputed(theContentChecksumType, computed);
+    }
+
     // Compute the content checksum.
     auto computeChecksum = new ComputeChecksum(this);
+    computeChecksum->setBackgroundIo(propagator()->syncOptions()._backgroundIo);
     computeChecksum->setChecksumType(theContentChecksumType);
 
     connect(computeChecksum, &ComputeChecksum::done,
@@ -801,8 +1162,19 @@ void PropagateDownloadFile::downloadFinished()
 
     // In case of conflict, make a backup of the old file
     // Ignore conflicts where both files are binary equal
-    bool isConflict = _item->_instruction == CSYNC_INSTRUCTION_CONFLICT
-        && !FileSystem::fileEquals(fn, _tmpFile.fileName());
+    bool isConflict = false;
+    if (_item->_instruction == CSYNC_INSTRUCTION_CONFLICT) {
+        switch (_contentComparison) {
+        case GETFileJob::ContentDiffers:
+            isConflict = true;
+            break;
+        case GETFileJob::ContentEqual:
+            break;
+        case GETFileJob::NotCompared:
+            isConflict = !FileSystem::fileEquals(fn, _tmpFile.fileName());
+            break;
+        }
+    }
     if (isConflict) {
         QString renameError;
         QString conflictFileName = FileSystem::makeConflictFileName(
@@ -842,7 +1214,7 @@ void PropagateDownloadFile::downloadFinished()
         const qint64 expectedSize = _item->_previousSize;
         const time_t expectedMtime = _item->_previousModtime;
         if (!FileSystem::verifyFileUnchanged(fn, expectedSize, expectedMtime)) {
-            propagator()->_anotherSyncNeeded = true;
+            propagator()->retryInNextSync(_item->_file);
             done(SyncFileItem::SoftError, tr("File has changed since discovery"));
             return;
         }
@@ -866,7 +1238,7 @@ void PropagateDownloadFile::downloadFinished()
         // it.
         if (isConflict) {
             propagator()->_journal->deleteFileRecord(fn);
-            propagator()->_journal->commit("download finished");
+            propagator()->_journal->commitIfNeededAndStartNewTransaction("download finished");
         }
 
         // If the file is locked, we want to retry this sync when it
@@ -874,7 +1246,7 @@ void PropagateDownloadFile::downloadFinished()
         if (FileSystem::isFileLocked(fn)) {
             emit propagator()->seenLockedFile(fn);
         } else {
-            propagator()->_anotherSyncNeeded = true;
+            propagator()->retryInNextSync(_item->_file);
         }
 
         done(SyncFileItem::SoftError, error);
@@ -886,6 +1258,18 @@ void PropagateDownloadFile::downloadFinished()
     // Get up to date information for the journal.
     _item->_size = FileSystem::getSize(fn);
 
+    switch (propagator()->syncOptions()._downloadDurability) {
+    case SyncOptions::DurabilityNone:
+        break;
+    case SyncOptions::DurabilityPerFile:
+        FileSystem::flushToDisk(QStringList(fn));
+        break;
+    case SyncOptions::DurabilityBatched:
+        // The journal record is only written once the data is on the disk
+        propagator()->flushToDisk(fn, this, [this, isConflict] { updateMetadata(isConflict); });
+        return;
+    }
+
     updateMetadata(isConflict);
 }
 
@@ -893,12 +1277,25 @@ void PropagateDownloadFile::updateMetadata(bool isConflict)
 {
     QString fn = propagator()->getFilePath(_item->_file);
 
-    if (!propagator()->_journal->setFileRecord(_item->toSyncJournalFileRecordWithInode(fn))) {
+    if (_item->_type == SyncFileItem::VirtualFileDownload) {
+        // The file replaces its placeholder, see SyncEngine::treewalkFile()
+        const QString virtualFile = _item->_file + QLatin1String(APPLICATION_DOTVIRTUALFILE_SUFFIX);
+        emit propagator()->touchedFile(propagator()->getFilePath(virtualFile));
+        FileSystem::remove(propagator()->getFilePath(virtualFile));
+        propagator()->_journal->deleteFileRecord(virtualFile);
+        _item->_type = SyncFileItem::File;
+    }
+
+    const auto record = _item->toSyncJournalFileRecordWithInode(fn);
+    if (!propagator()->_journal->setFileRecord(record)) {
         done(SyncFileItem::FatalError, tr("Error writing metadata to the database"));
         return;
     }
+    // A rename of the file doesn't need to hash it again, a placeholder has no content
+    if (_item->_type != SyncFileItem::VirtualFile)
+        propagator()->_journal->setCachedChecksum(record._inode, FileSystem::getModTimeNsecs(fn), record._fileSize, record._checksumHeader);
     propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
-    propagator()->_journal->commit("download file start2");
+    propagator()->_journal->commitIfNeededAndStartNewTransaction("download file start2");
     done(isConflict ? SyncFileItem::Conflict : SyncFileItem::Success);
 
     // handle the special recall file
@@ -927,6 +1324,13 @@ void PropagateDownloadFile::abort(PropagatorJob::AbortType abortType)
 {
     if (_job && _job->reply())
         _job->reply()->abort();
+    // The first aborted segment stops the others
+    for (const auto &segment : _segments) {
+        if (segment.job && segment.job->reply()) {
+            segment.job->reply()->abort();
+            break;
+        }
+    }
 
     if (abortType == AbortType::Asynchronous) {
         emit abortFinished();
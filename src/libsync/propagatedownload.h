@@ -15,10 +15,14 @@
 
 #include "owncloudpropagator.h"
 #include "networkjobs.h"
+#include "common/checksums.h"
 
 #include <QBuffer>
 #include <QFile>
 
+#include <memory>
+#include <vector>
+
 namespace OCC {
 
 /**
@@ -42,10 +46,20 @@ class GETFileJob : public AbstractNetworkJob
     QPointer<BandwidthManager> _bandwidthManager;
     bool _hasEmittedFinishedSignal;
     time_t _lastModified;
+    QByteArray _readBuffer; // reused by slotReadyRead()
+    qint64 _rangeEnd = -1; // last byte to request, -1 for the end of the file
+    QByteArrayList _checksumTypes;
+    std::vector<std::unique_ptr<ChecksumCalculator>> _checksumCalculators;
+    QString _compareFileName;
+    std::unique_ptr<QFile> _compareFile; // while the body matches it so far
+    QByteArray _compareBuffer;
+    bool _compareDiffers = false;
 
     /// Will be set to true once we've seen a 2xx response header
     bool _saveBodyToFile = false;
 
+    friend class BandwidthManager;
+
 public:
     // DOES NOT take ownership of the device.
     explicit GETFileJob(AccountPtr account, const QString &path, QFile *device,
@@ -94,9 +108,44 @@ public:
     void setErrorStatus(const SyncFileItem::Status &s) { _errorStatus = s; }
 
     void onTimedOut() Q_DECL_OVERRIDE;
+    bool isTransferHeld() const Q_DECL_OVERRIDE { return _bandwidthChoked; }
 
     QByteArray &etag() { return _etag; }
     quint64 resumeStart() { return _resumeStart; }
+
+    /**
+     * Only download up to and including the byte @a end, for a segment of a file.
+     *
+     * The request fails if the server does not answer with that range.
+     */
+    void setRangeEnd(quint64 end) { _rangeEnd = end; }
+
+    /**
+     * Compute checksums of these types while the body is written.
+     *
+     * Only done when the whole file is downloaded by this job, see
+     * computedChecksums().
+     */
+    void setChecksumTypes(const QByteArrayList &types) { _checksumTypes = types; }
+
+    /// The checksums of the downloaded file by type, empty if they couldn't be computed
+    QMap<QByteArray, QByteArray> computedChecksums();
+
+    /**
+     * Compare the body to the file @a fileName while it is written.
+     *
+     * Like the checksums, only done when the whole file is downloaded by
+     * this job. The local file is not read further once they differ.
+     */
+    void setCompareFile(const QString &fileName) { _compareFileName = fileName; }
+
+    enum ContentComparison {
+        NotCompared,
+        ContentEqual,
+        ContentDiffers
+    };
+    /// The result of the comparison with the setCompareFile() once the job finished
+    ContentComparison contentComparison();
     time_t lastModified() { return _lastModified; }
 
 
@@ -126,7 +175,9 @@ private slots:
     |                         checksum differs?    |
     +-> startDownload() <--------------------------+
           |                                        |
-          +-> run a GETFileJob                     | checksum identical?
+          +-> run a GETFileJob, or one per segment | checksum identical?
+                                                   |
+      (a conflict also compares the body to the local file on the way)
                                                    |
       done?-> slotGetFinished()                    |
                 |                                  |
@@ -194,8 +245,25 @@ private slots:
     void slotDownloadProgress(qint64, qint64);
     void slotChecksumFail(const QString &errMsg);
 
+    /// Called when the GETFileJob of a segment finishes
+    void slotSegmentFinished();
+    void slotSegmentProgress();
+
 private:
     void deleteExistingFolder();
+    /// Writes the empty placeholder of a VirtualFile item
+    void createVirtualFile();
+
+    /// Starts the GETFileJobs of a download in parallel segments
+    void startSegmentedDownload(const QString &tmpFileName, const QVector<QPair<quint64, quint64>> &ranges);
+    /// The ranges of the segments for a new download, empty to download in one piece
+    QVector<QPair<quint64, quint64>> downloadSegmentRanges() const;
+    /// Stores the missing ranges of the segments in the DownloadInfo
+    void saveSegmentProgress();
+    /// Stops the running segments without waiting for their replies
+    void abortSegments();
+    quint64 segmentBytesMissing() const;
+    void validateTransmissionChecksum(const QByteArray &checksumHeader);
 
     quint64 _resumeStart;
     qint64 _downloadProgress;
@@ -203,6 +271,21 @@ private:
     QFile _tmpFile;
     bool _deleteExisting;
 
+    struct Segment
+    {
+        quint64 start; // the first byte of the current job
+        quint64 end; // the last byte of the segment
+        QFile *file; // opened on the temporary file, at the position of the job
+        QPointer<GETFileJob> job;
+    };
+    QVector<Segment> _segments;
+    QString _segmentsTmpFileName;
+    QMap<QByteArray, QByteArray> _computedChecksums; // by the GETFileJob
+    // For conflicts: whether the local file has the same content as the download
+    GETFileJob::ContentComparison _contentComparison = GETFileJob::NotCompared;
+    QByteArray _segmentsChecksumHeader;
+    bool _segmentsRefused = false; // the server does not support range requests
+
     QElapsedTimer _stopwatch;
 };
 }
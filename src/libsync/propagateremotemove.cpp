@@ -108,9 +108,9 @@ void PropagateRemoteMove::start()
     }
 
     QString destination = QDir::cleanPath(propagator()->account()->url().path() + QLatin1Char('/')
-        + propagator()->account()->davPath() + propagator()->_remoteFolder + _item->_renameTarget);
+        + propagator()->account()->davPath() + propagator()->_remoteFolder + itemRemotePath(*_item, _item->_renameTarget));
     _job = new MoveJob(propagator()->account(),
-        propagator()->_remoteFolder + _item->_file,
+        propagator()->_remoteFolder + itemRemotePath(*_item, _item->_file),
         destination, this);
     connect(_job.data(), &MoveJob::finishedSignal, this, &PropagateRemoteMove::slotMoveJobFinished);
     propagator()->_activeJobList.append(this);
@@ -198,7 +198,7 @@ void PropagateRemoteMove::finalize()
         }
     }
 
-    propagator()->_journal->commit("Remote Rename");
+    propagator()->_journal->commitIfNeededAndStartNewTransaction("Remote Rename");
     done(SyncFileItem::Success);
 }
 
@@ -57,7 +57,6 @@ public:
     }
     void start() Q_DECL_OVERRIDE;
     void abort(PropagatorJob::AbortType abortType) Q_DECL_OVERRIDE;
-    JobParallelism parallelism() Q_DECL_OVERRIDE { return _item->isDirectory() ? WaitForFinished : FullParallelism; }
 
     /**
      * Rename the directory in the selective sync list
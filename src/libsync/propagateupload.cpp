@@ -26,14 +26,19 @@
 #include "syncengine.h"
 #include "propagateremotedelete.h"
 #include "common/asserts.h"
+#include "csync/vio/csync_vio_local.h"
 
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QSet>
+#include <QTimer>
+#include <QtConcurrent>
 #include <cmath>
 #include <cstring>
+#include <zlib.h>
 
 namespace OCC {
 
@@ -67,6 +72,29 @@ PUTFileJob::~PUTFileJob()
 }
 
 void PUTFileJob::start()
+{
+    auto device = qobject_cast<UploadDevice *>(_device);
+    if (!device || !device->isCompressionWanted() || device->isCompressed()) {
+        sendPut();
+        return;
+    }
+    // Deflating a chunk of several MiB takes too long for the main thread.
+    // The thread only reads the file, the device may be gone by the end.
+    connect(&_compressWatcher, &QFutureWatcherBase::finished, this, &PUTFileJob::slotCompressed);
+    _compressWatcher.setFuture(QtConcurrent::run(&UploadDevice::compressRange,
+        device->fileName(), device->rangeStart(), device->rangeSize()));
+}
+
+void PUTFileJob::slotCompressed()
+{
+    auto device = static_cast<UploadDevice *>(_device);
+    device->setCompressionWanted(false);
+    if (device->setCompressed(_compressWatcher.result()))
+        _headers["Content-Encoding"] = "gzip";
+    sendPut();
+}
+
+void PUTFileJob::sendPut()
 {
     QNetworkRequest req;
     for (QMap<QByteArray, QByteArray>::const_iterator it = _headers.begin(); it != _headers.end(); ++it) {
@@ -85,12 +113,47 @@ void PUTFileJob::start()
         qCWarning(lcPutJob) << " Network error: " << reply()->errorString();
     }
 
-    connect(reply(), &QNetworkReply::uploadProgress, this, &PUTFileJob::uploadProgress);
+    connect(reply(), &QNetworkReply::uploadProgress, this, &PUTFileJob::slotReplyUploadProgress);
     connect(this, &AbstractNetworkJob::networkActivity, account().data(), &Account::propagatorNetworkActivity);
     _requestTimer.start();
     AbstractNetworkJob::start();
 }
 
+void PUTFileJob::slotReplyUploadProgress(qint64 sent, qint64 total)
+{
+    auto device = qobject_cast<UploadDevice *>(_device);
+    if (device && device->isCompressed() && total > 0) {
+        sent = sent * device->rangeSize() / total;
+        total = device->rangeSize();
+    }
+    emit uploadProgress(sent, total);
+}
+
+void CopyJob::start()
+{
+    QNetworkRequest req;
+    req.setRawHeader("Destination", QUrl::toPercentEncoding(_destination, "/"));
+    for (auto it = _extraHeaders.constBegin(); it != _extraHeaders.constEnd(); ++it) {
+        req.setRawHeader(it.key(), it.value());
+    }
+    sendRequest("COPY", makeDavUrl(path()), req);
+
+    if (reply()->error() != QNetworkReply::NoError) {
+        qCWarning(lcPutJob) << " Network error: " << reply()->errorString();
+    }
+    AbstractNetworkJob::start();
+}
+
+bool CopyJob::finished()
+{
+    qCInfo(lcPutJob) << "COPY of" << reply()->request().url() << "FINISHED WITH STATUS"
+                     << reply()->error()
+                     << (reply()->error() == QNetworkReply::NoError ? QLatin1String("") : errorString());
+
+    emit finishedSignal();
+    return true;
+}
+
 void PollJob::start()
 {
     setTimeout(120 * 1000);
@@ -102,8 +165,42 @@ void PollJob::start()
     AbstractNetworkJob::start();
 }
 
+// The first polls are quick for the small files, the later ones back off
+static const int PollInitialDelayMsecs = 500;
+static const int PollMaxDelayMsecs = 30 * 1000;
+
+void PollJob::pollAgain()
+{
+    int delay = PollMaxDelayMsecs;
+    if (_pollCount < 16)
+        delay = qMin(PollMaxDelayMsecs, PollInitialDelayMsecs << _pollCount);
+    // The server knows best how long the assembly takes
+    bool ok = false;
+    const int retryAfter = reply()->rawHeader("Retry-After").toInt(&ok);
+    if (ok && retryAfter > 0)
+        delay = qBound(delay, retryAfter * 1000, PollMaxDelayMsecs);
+    ++_pollCount;
+    qCDebug(lcPollJob) << "Polling" << path() << "again in" << delay << "ms";
+    _pollTimer.start(delay);
+}
+
+void PollJob::abort()
+{
+    _aborted = true;
+    _pollTimer.stop();
+    if (reply() && reply()->isRunning()) {
+        // finished() deletes the job
+        reply()->abort();
+    } else {
+        deleteLater();
+    }
+}
+
 bool PollJob::finished()
 {
+    if (_aborted)
+        return true;
+
     QNetworkReply::NetworkError err = reply()->error();
     if (err != QNetworkReply::NoError) {
         _item->_httpErrorCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
@@ -122,7 +219,7 @@ bool PollJob::finished()
             emit finishedSignal();
             return true;
         }
-        start();
+        pollAgain();
         return false;
     }
 
@@ -138,7 +235,7 @@ bool PollJob::finished()
     }
 
     if (status["unfinished"].toBool()) {
-        start();
+        pollAgain();
         return false;
     }
 
@@ -176,6 +273,15 @@ void PropagateUploadFileCommon::start()
         return;
     }
 
+    // A file that is still being written would have to be uploaded again
+    const qint64 msecsSinceChange = propagator()->msecsSinceLocalChange(_item->_file);
+    if (msecsSinceChange >= 0 && msecsSinceChange < propagator()->syncOptions()._uploadStabilityMsec) {
+        qCInfo(lcPropagateUpload) << _item->_file << "changed" << msecsSinceChange << "ms ago, waiting until it is stable";
+        // No follow-up sync: the folder schedules one once the watcher is quiet
+        done(SyncFileItem::SoftError, tr("The file is still being written, it will be uploaded once it's unchanged for a while"));
+        return;
+    }
+
     // Check if we believe that the upload will fail due to remote quota limits
     const quint64 quotaGuess = propagator()->_folderQuota.value(
         QFileInfo(_item->_file).path(), std::numeric_limits<quint64>::max());
@@ -228,17 +334,41 @@ void PropagateUploadFileCommon::slotComputeContentChecksum()
         return;
     }
 
+    // Or an earlier attempt, if the file is still the same
+    csync_file_stat_t stat;
+    _contentModtime = FileSystem::getModTimeNsecs(filePath);
+    if (_contentModtime != -1 && csync_vio_local_stat(filePath.toUtf8().constData(), &stat) == 0) {
+        _contentInode = stat.inode;
+        _contentSize = stat.size;
+        const QByteArray cached = propagator()->_journal->getCachedChecksum(_contentInode, _contentModtime, _contentSize, checksumType);
+        if (parseChecksumHeader(cached, &existingChecksumType, &existingChecksum) && !existingChecksum.isEmpty()) {
+            qCDebug(lcPropagateUpload) << "Using the cached content checksum of" << _item->_file;
+            slotComputeTransmissionChecksum(existingChecksumType, existingChecksum);
+            return;
+        }
+    }
+
     // Compute the content checksum.
     auto computeChecksum = new ComputeChecksum(this);
+    computeChecksum->setBackgroundIo(propagator()->syncOptions()._backgroundIo);
     computeChecksum->setChecksumType(checksumType);
 
     connect(computeChecksum, &ComputeChecksum::done,
-        this, &PropagateUploadFileCommon::slotComputeTransmissionChecksum);
+        this, &PropagateUploadFileCommon::slotContentChecksumComputed);
     connect(computeChecksum, &ComputeChecksum::done,
         computeChecksum, &QObject::deleteLater);
     computeChecksum->start(filePath);
 }
 
+void PropagateUploadFileCommon::slotContentChecksumComputed(const QByteArray &contentChecksumType, const QByteArray &contentChecksum)
+{
+    if (_contentInode != 0) {
+        propagator()->_journal->setCachedChecksum(_contentInode, _contentModtime, _contentSize,
+            makeChecksumHeader(contentChecksumType, contentChecksum));
+    }
+    slotComputeTransmissionChecksum(contentChecksumType, contentChecksum);
+}
+
 void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray &contentChecksumType, const QByteArray &contentChecksum)
 {
     _item->_checksumHeader = makeChecksumHeader(contentChecksumType, contentChecksum);
@@ -248,6 +378,12 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
     _stopWatch.start();
 #endif
 
+    if (finishIfContentUnchanged())
+        return;
+
+    if (startServerSideCopy())
+        return;
+
     // Reuse the content checksum as the transmission checksum if possible
     const auto supportedTransmissionChecksums =
         propagator()->account()->capabilities().supportedChecksumTypes();
@@ -258,6 +394,7 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
 
     // Compute the transmission checksum.
     auto computeChecksum = new ComputeChecksum(this);
+    computeChecksum->setBackgroundIo(propagator()->syncOptions()._backgroundIo);
     if (uploadChecksumEnabled()) {
         computeChecksum->setChecksumType(propagator()->account()->capabilities().uploadChecksumType());
     } else {
@@ -272,6 +409,145 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
     computeChecksum->start(filePath);
 }
 
+bool PropagateUploadFileCommon::finishIfContentUnchanged()
+{
+    if (_item->_instruction != CSYNC_INSTRUCTION_SYNC || _deleteExisting || _item->_checksumHeader.isEmpty())
+        return false;
+
+    SyncJournalFileRecord record;
+    if (!propagator()->_journal->getFileRecord(_item->_file, &record) || !record.isValid()
+        || record._type != SyncFileItem::File || record._fileSize != qint64(_item->_size)
+        || record._checksumHeader != _item->_checksumHeader || record._etag.isEmpty()) {
+        return false;
+    }
+
+    // Only the metadata changed, like with CSYNC_INSTRUCTION_UPDATE_METADATA.
+    // The server keeps its modtime, as it does for those.
+    qCInfo(lcPropagateUpload) << "The content of" << _item->_file << "did not change, not uploading it";
+    _item->_etag = record._etag;
+    _item->_fileId = record._fileId;
+    _item->_remotePerm = record._remotePerm;
+    _finished = true;
+    if (!propagator()->_journal->setFileRecord(_item->toSyncJournalFileRecordWithInode(propagator()->getFilePath(_item->_file)))) {
+        done(SyncFileItem::FatalError, tr("Error writing metadata to the database"));
+        return true;
+    }
+    propagator()->_journal->setUploadInfo(_item->_file, SyncJournalDb::UploadInfo());
+    propagator()->_journal->commitIfNeededAndStartNewTransaction("upload file unchanged");
+    done(SyncFileItem::Success);
+    return true;
+}
+
+bool PropagateUploadFileCommon::startServerSideCopy()
+{
+    const quint64 minSize = propagator()->syncOptions()._minServerSideCopySize;
+    if (_serverSideCopyTried || propagator()->_serverSideCopyFailed
+        || minSize == 0 || _item->_size < minSize
+        || _item->_instruction != CSYNC_INSTRUCTION_NEW || _deleteExisting
+        || _item->_checksumHeader.isEmpty()
+        // the admin recall needs its own OC-Tag header
+        || _item->_file.contains(".sys.admin#recall#")) {
+        return false;
+    }
+    _serverSideCopyTried = true;
+
+    SyncJournalFileRecord source;
+    propagator()->_journal->getFileRecordsByChecksum(_item->_checksumHeader, [&](const SyncJournalFileRecord &rec) {
+        if (!source.isValid() && rec._type == SyncFileItem::File && rec._fileSize == qint64(_item->_size)
+            && !rec._etag.isEmpty() && rec._path != _item->_file.toUtf8()) {
+            source = rec;
+        }
+    });
+    if (!source.isValid()) {
+        auto &pending = propagator()->_serverSideCopySources[_item->_checksumHeader];
+        if (pending && pending != this) {
+            qCInfo(lcPropagateUpload) << "Waiting for the upload of the same content to copy it to" << _item->_file;
+            connect(pending.data(), &PropagatorJob::finished, this, &PropagateUploadFileCommon::slotCopySourceFinished);
+            return true;
+        }
+        // The later files with this content get copied from this one
+        pending = this;
+        connect(this, &PropagatorJob::finished, this, [this]() {
+            auto &sources = propagator()->_serverSideCopySources;
+            auto it = sources.find(_item->_checksumHeader);
+            if (it != sources.end() && it.value() == this)
+                sources.erase(it);
+        });
+        return false;
+    }
+
+    const QString davPath = propagator()->account()->url().path() + QLatin1Char('/') + propagator()->account()->davPath();
+    const QString sourcePath = QDir::cleanPath(davPath + propagator()->_remoteFolder + QString::fromUtf8(source._path));
+    const QString destination = QDir::cleanPath(davPath + propagator()->_remoteFolder + _item->_file);
+    QMap<QByteArray, QByteArray> headers;
+    // Fail if the source changed since, or if the destination was created meanwhile
+    headers["If"] = "<" + sourcePath.toUtf8() + "> ([\"" + source._etag + "\"])";
+    headers["Overwrite"] = "F";
+    headers["X-OC-Mtime"] = QByteArray::number(qint64(_item->_modtime));
+
+    qCInfo(lcPropagateUpload) << "Copying" << source._path << "on the server instead of uploading" << _item->_file;
+    auto job = new CopyJob(propagator()->account(), propagator()->_remoteFolder + QString::fromUtf8(source._path),
+        destination, headers, this);
+    _jobs.append(job);
+    connect(job, &CopyJob::finishedSignal, this, &PropagateUploadFileCommon::slotCopyFinished);
+    connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
+    job->start();
+    return true;
+}
+
+void PropagateUploadFileCommon::slotCopySourceFinished(SyncFileItem::Status status)
+{
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0) || _state == Finished)
+        return;
+    // The journal has the record of the uploaded file now, look it up again
+    if (status == SyncFileItem::Success)
+        _serverSideCopyTried = false;
+    QByteArray checksumType, checksum;
+    parseChecksumHeader(_item->_checksumHeader, &checksumType, &checksum);
+    slotComputeTransmissionChecksum(checksumType, checksum);
+}
+
+void PropagateUploadFileCommon::slotCopyFinished()
+{
+    auto job = qobject_cast<CopyJob *>(sender());
+    ASSERT(job);
+    slotJobDestroyed(job); // remove it from the _jobs list
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    QNetworkReply *reply = job->reply();
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const QByteArray etag = getEtagFromReply(reply);
+    const QByteArray fileId = reply->rawHeader("OC-FileID");
+    if (reply->error() == QNetworkReply::NoError && !etag.isEmpty() && !fileId.isEmpty()
+        && reply->rawHeader("X-OC-MTime") == "accepted") {
+        propagator()->_activeJobList.removeOne(this);
+        _item->_etag = etag;
+        _item->_fileId = fileId;
+        _item->_responseTimeStamp = job->responseTimestamp();
+
+        // The copy is done, any change since the checksum is for the next sync
+        const QString fullFilePath = propagator()->getFilePath(_item->_file);
+        if (!FileSystem::fileExists(fullFilePath)
+            || !FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
+            propagator()->retryInNextSync(_item->_file);
+        }
+        finalize();
+        return;
+    }
+
+    // Uploading the file replaces a copy that has no usable etag or mtime
+    qCWarning(lcPropagateUpload) << "Server-side copy failed, uploading" << _item->_file
+                                 << httpCode << reply->errorString();
+    if (reply->error() == QNetworkReply::NoError || httpCode == 405 || httpCode == 501) {
+        // The server can't do it at all, don't try again with the next files
+        propagator()->_serverSideCopyFailed = true;
+    }
+    QByteArray checksumType, checksum;
+    parseChecksumHeader(_item->_checksumHeader, &checksumType, &checksum);
+    slotComputeTransmissionChecksum(checksumType, checksum);
+}
+
 void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionChecksumType, const QByteArray &transmissionChecksum)
 {
     // Remove ourselfs from the list of active job, before any posible call to done()
@@ -301,7 +577,7 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
 
     _item->_modtime = FileSystem::getModTime(fullFilePath);
     if (prevModtime != _item->_modtime) {
-        propagator()->_anotherSyncNeeded = true;
+        propagator()->retryInNextSync(_item->_file);
         done(SyncFileItem::SoftError, tr("Local file changed during syncing. It will be resumed."));
         return;
     }
@@ -313,7 +589,7 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
     // That usually indicates a file that is still being changed
     // or not yet fully copied to the destination.
     if (fileIsStillChanging(*_item)) {
-        propagator()->_anotherSyncNeeded = true;
+        propagator()->retryInNextSync(_item->_file);
         done(SyncFileItem::SoftError, tr("Local file changed during sync."));
         return;
     }
@@ -321,8 +597,19 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
     doStartUpload();
 }
 
+// Smaller files hardly get faster to send
+static const qint64 MinimumCompressSize = 4 * 1024;
+// The compressed range is held in memory
+static const qint64 MaximumCompressSize = 16 * 1024 * 1024;
+// The first block tells whether the rest is worth compressing
+static const qint64 CompressBlockSize = 64 * 1024;
+
 UploadDevice::UploadDevice(BandwidthManager *bwm)
-    : _read(0)
+    : _start(0)
+    , _rangeSize(0)
+    , _size(0)
+    , _compressionWanted(false)
+    , _read(0)
     , _bandwidthManager(bwm)
     , _bandwidthQuota(0)
     , _readWithProgress(0)
@@ -342,25 +629,95 @@ UploadDevice::~UploadDevice()
 
 bool UploadDevice::prepareAndOpen(const QString &fileName, qint64 start, qint64 size)
 {
-    _data.clear();
+    _file.close();
+    _file.setFileName(fileName);
+    _compressed.clear();
     _read = 0;
 
-    QFile file(fileName);
     QString openError;
-    if (!FileSystem::openAndSeekFileSharedRead(&file, &openError, start)) {
+    if (!FileSystem::openAndSeekFileSharedRead(&_file, &openError, start)) {
         setErrorString(openError);
         return false;
     }
 
-    size = qBound(0ll, size, FileSystem::getSize(fileName) - start);
-    _data.resize(size);
-    auto read = file.read(_data.data(), size);
-    if (read != size) {
-        setErrorString(file.errorString());
-        return false;
+    _start = start;
+    _size = qBound(0ll, size, _file.size() - start);
+    _rangeSize = _size;
+    return QIODevice::open(QIODevice::ReadOnly);
+}
+
+QByteArray UploadDevice::compressRange(const QString &fileName, qint64 start, qint64 size)
+{
+    if (size < MinimumCompressSize || size > MaximumCompressSize)
+        return QByteArray();
+
+    QFile file(fileName);
+    QString openError;
+    if (!FileSystem::openAndSeekFileSharedRead(&file, &openError, start))
+        return QByteArray();
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 16 more window bits for a gzip header, the server may not take raw deflate
+    if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return QByteArray();
+
+    QByteArray compressed(static_cast<int>(deflateBound(&stream, size)), Qt::Uninitialized);
+    QByteArray block(CompressBlockSize, Qt::Uninitialized);
+    stream.next_out = reinterpret_cast<Bytef *>(compressed.data());
+    stream.avail_out = compressed.size();
+
+    bool ok = true;
+    qint64 done = 0;
+    while (ok && done < size) {
+        const qint64 read = file.read(block.data(), qMin<qint64>(block.size(), size - done));
+        if (read <= 0) {
+            ok = false;
+            break;
+        }
+        done += read;
+        stream.next_in = reinterpret_cast<Bytef *>(block.data());
+        stream.avail_in = read;
+        // The first block is flushed to see how well it compressed
+        const int flush = done == size ? Z_FINISH : done == read ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+        const int result = deflate(&stream, flush);
+        ok = result == (flush == Z_FINISH ? Z_STREAM_END : Z_OK) && stream.avail_in == 0
+            && stream.total_out < stream.total_in / 10 * 9;
     }
+    deflateEnd(&stream);
 
-    return QIODevice::open(QIODevice::ReadOnly);
+    if (!ok)
+        return QByteArray();
+    compressed.resize(stream.total_out);
+    qCDebug(lcPropagateUpload) << "Compressed" << fileName << "from" << size << "to" << compressed.size();
+    return compressed;
+}
+
+bool UploadDevice::setCompressed(const QByteArray &compressed)
+{
+    if (compressed.isNull())
+        return false;
+    _compressed = compressed;
+    _size = _compressed.size();
+    _read = 0;
+    _file.close();
+    return true;
+}
+
+bool UploadDevice::isLikelyCompressible(const QString &fileName, qint64 size)
+{
+    if (size < MinimumCompressSize)
+        return false;
+    // Formats that are compressed already
+    static const QSet<QString> compressedSuffixes = {
+        "7z", "aac", "avi", "bz2", "docx", "epub", "flac", "gif", "gz", "heic", "jar", "jpeg", "jpg",
+        "m4a", "m4v", "mkv", "mov", "mp3", "mp4", "odp", "ods", "odt", "ogg", "opus", "pdf", "png",
+        "pptx", "rar", "tgz", "webm", "webp", "xlsx", "xz", "zip", "zst"
+    };
+    const int dot = fileName.lastIndexOf(QLatin1Char('.'));
+    if (dot < 0 || dot < fileName.lastIndexOf(QLatin1Char('/')))
+        return true;
+    return !compressedSuffixes.contains(fileName.mid(dot + 1).toLower());
 }
 
 
@@ -372,14 +729,14 @@ qint64 UploadDevice::writeData(const char *, qint64)
 
 qint64 UploadDevice::readData(char *data, qint64 maxlen)
 {
-    if (_data.size() - _read <= 0) {
+    if (_size - _read <= 0) {
         // at end
         if (_bandwidthManager) {
             _bandwidthManager->unregisterUploadDevice(this);
         }
         return -1;
     }
-    maxlen = qMin(maxlen, _data.size() - _read);
+    maxlen = qMin(maxlen, _size - _read);
     if (maxlen == 0) {
         return 0;
     }
@@ -391,11 +748,31 @@ qint64 UploadDevice::readData(char *data, qint64 maxlen)
         if (maxlen <= 0) { // no quota
             return 0;
         }
-        _bandwidthQuota -= maxlen;
     }
-    std::memcpy(data, _data.data() + _read, maxlen);
-    _read += maxlen;
-    return maxlen;
+    if (isCompressed()) {
+        std::memcpy(data, _compressed.constData() + _read, maxlen);
+        if (isBandwidthLimited()) {
+            _bandwidthQuota -= maxlen;
+        }
+        _read += maxlen;
+        return maxlen;
+    }
+    // After a seek() for a resend of the request
+    if (_file.pos() != _start + _read && !_file.seek(_start + _read)) {
+        setErrorString(_file.errorString());
+        return -1;
+    }
+    auto read = _file.read(data, maxlen);
+    if (read <= 0) {
+        // The file got shorter since the upload started
+        setErrorString(read < 0 ? _file.errorString() : tr("The file was truncated during the upload"));
+        return -1;
+    }
+    if (isBandwidthLimited()) {
+        _bandwidthQuota -= read;
+    }
+    _read += read;
+    return read;
 }
 
 void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
@@ -403,22 +780,25 @@ void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
     if (sent == 0 || t == 0) {
         return;
     }
+    // The job reports the progress in the range, the bandwidth is what is sent
+    if (isCompressed())
+        sent = sent * _size / _rangeSize;
     _readWithProgress = sent;
 }
 
 bool UploadDevice::atEnd() const
 {
-    return _read >= _data.size();
+    return _read >= _size;
 }
 
 qint64 UploadDevice::size() const
 {
-    return _data.size();
+    return _size;
 }
 
 qint64 UploadDevice::bytesAvailable() const
 {
-    return _data.size() - _read + QIODevice::bytesAvailable();
+    return _size - _read + QIODevice::bytesAvailable();
 }
 
 // random access, we can seek
@@ -432,7 +812,7 @@ bool UploadDevice::seek(qint64 pos)
     if (!QIODevice::seek(pos)) {
         return false;
     }
-    if (pos < 0 || pos > _data.size()) {
+    if (pos < 0 || pos > _size) {
         return false;
     }
     _read = pos;
@@ -465,6 +845,7 @@ void PropagateUploadFileCommon::startPollJob(const QString &path)
 {
     PollJob *job = new PollJob(propagator()->account(), path, _item,
         propagator()->_journal, propagator()->_localDir, this);
+    _pollJob = job;
     connect(job, &PollJob::finishedSignal, this, &PropagateUploadFileCommon::slotPollFinished);
     SyncJournalDb::PollInfo info;
     info._file = _item->_file;
@@ -472,7 +853,9 @@ void PropagateUploadFileCommon::startPollJob(const QString &path)
     info._modtime = _item->_modtime;
     propagator()->_journal->setPollInfo(info);
     propagator()->_journal->commit("add poll info");
-    propagator()->_activeJobList.append(this);
+    // The upload is done, only waiting for the server
+    propagator()->_activeJobList.appendMetadataOnly(this);
+    propagator()->scheduleNextJob();
     job->start();
 }
 
@@ -508,7 +891,7 @@ void PropagateUploadFileCommon::checkResettingErrors()
                                       << "is" << uploadInfo._errorCount;
         }
         propagator()->_journal->setUploadInfo(_item->_file, uploadInfo);
-        propagator()->_journal->commit("Upload info");
+        propagator()->_journal->commitIfNeededAndStartNewTransaction("Upload info");
     }
 }
 
@@ -558,8 +941,20 @@ void PropagateUploadFileCommon::slotJobDestroyed(QObject *job)
     _jobs.erase(std::remove(_jobs.begin(), _jobs.end(), job), _jobs.end());
 }
 
+void PropagateUploadFileCommon::deleteUnsentJobs()
+{
+    // The PUTs of the chunks that are still being compressed
+    foreach (auto *job, _jobs) {
+        if (!job->reply())
+            delete job;
+    }
+}
+
 void PropagateUploadFileCommon::abort(PropagatorJob::AbortType abortType)
 {
+    if (_pollJob)
+        _pollJob->abort();
+    deleteUnsentJobs();
     foreach (auto *job, _jobs) {
         if (job->reply()) {
             job->reply()->abort();
@@ -625,12 +1020,15 @@ void PropagateUploadFileCommon::finalize()
 
     // Remove from the progress database:
     propagator()->_journal->setUploadInfo(_item->_file, SyncJournalDb::UploadInfo());
-    propagator()->_journal->commit("upload file start");
+    propagator()->_journal->commitIfNeededAndStartNewTransaction("upload file start");
 
     done(SyncFileItem::Success);
 }
 
 void PropagateUploadFileCommon::prepareAbort(PropagatorJob::AbortType abortType) {
+    if (_pollJob)
+        _pollJob->abort();
+    deleteUnsentJobs();
     if (!_jobs.empty()) {
         // Count number of jobs to be aborted asynchronously
         _abortCount = _jobs.size();
@@ -19,6 +19,8 @@
 #include <QBuffer>
 #include <QFile>
 #include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QTimer>
 
 
 namespace OCC {
@@ -39,9 +41,42 @@ public:
     UploadDevice(BandwidthManager *bwm);
     ~UploadDevice();
 
-    /** Reads the data from the file and opens the device */
+    /**
+     * Opens the device on the range of the file.
+     *
+     * The data is read from the file as the network needs it, so that a
+     * chunk is never held in memory as a whole.
+     */
     bool prepareAndOpen(const QString &fileName, qint64 start, qint64 size);
 
+    /**
+     * The range of @a fileName compressed with gzip, or a null array if
+     * that doesn't make it notably smaller or it can't be read.
+     *
+     * Used from a thread of the PUTFileJob, see setCompressionWanted().
+     */
+    static QByteArray compressRange(const QString &fileName, qint64 start, qint64 size);
+
+    /**
+     * Sends @a compressed instead of the range, size() is then its size.
+     * Returns false and leaves the device as it is for a null array.
+     */
+    bool setCompressed(const QByteArray &compressed);
+    bool isCompressed() const { return !_compressed.isNull(); }
+
+    /** The PUTFileJob compresses the range before it sends it, if that makes it smaller */
+    void setCompressionWanted(bool wanted) { _compressionWanted = wanted; }
+    bool isCompressionWanted() const { return _compressionWanted; }
+
+    QString fileName() const { return _file.fileName(); }
+    qint64 rangeStart() const { return _start; }
+
+    /** The size of the range in the file, the same as size() unless compressed */
+    qint64 rangeSize() const { return _rangeSize; }
+
+    /** Whether a file is worth compressing, judged by its name and size */
+    static bool isLikelyCompressible(const QString &fileName, qint64 size);
+
     qint64 writeData(const char *, qint64) Q_DECL_OVERRIDE;
     qint64 readData(char *data, qint64 maxlen) Q_DECL_OVERRIDE;
     bool atEnd() const Q_DECL_OVERRIDE;
@@ -53,15 +88,22 @@ public:
     void setBandwidthLimited(bool);
     bool isBandwidthLimited() { return _bandwidthLimited; }
     void setChoked(bool);
-    bool isChoked() { return _choked; }
+    bool isChoked() const { return _choked; }
     void giveBandwidthQuota(qint64 bwq);
 
 signals:
 
 private:
-    // The file data
-    QByteArray _data;
-    // Position in the data
+    // The file, open while the device is
+    QFile _file;
+    // The range of the file to upload
+    qint64 _start;
+    qint64 _rangeSize;
+    // What is sent: the range or its compressed form
+    qint64 _size;
+    QByteArray _compressed;
+    bool _compressionWanted;
+    // Position in what is sent
     qint64 _read;
 
     // Bandwidth manager related
@@ -89,6 +131,10 @@ private:
     QString _errorString;
     QUrl _url;
     QElapsedTimer _requestTimer;
+    QFutureWatcher<QByteArray> _compressWatcher;
+
+    /** Sends the request, once the body is compressed if that was wanted */
+    void sendPut();
 
 public:
     // Takes ownership of the device
@@ -144,10 +190,21 @@ public:
         return _requestTimer.elapsed();
     }
 
+protected:
+    bool isTransferHeld() const Q_DECL_OVERRIDE
+    {
+        auto device = qobject_cast<UploadDevice *>(_device);
+        return device && device->isChoked();
+    }
+
 signals:
     void finishedSignal();
+    /** The progress in bytes of the file range, also when the body is compressed */
     void uploadProgress(qint64, qint64);
 
+private slots:
+    void slotReplyUploadProgress(qint64 sent, qint64 total);
+    void slotCompressed();
 };
 
 /**
@@ -162,6 +219,12 @@ class PollJob : public AbstractNetworkJob
     Q_OBJECT
     SyncJournalDb *_journal;
     QString _localPath;
+    int _pollCount = 0;
+    QTimer _pollTimer; // until the next poll, see pollAgain()
+    bool _aborted = false;
+
+    /** Polls again after a delay that doubles with every unfinished reply */
+    void pollAgain();
 
 public:
     SyncFileItemPtr _item;
@@ -172,6 +235,44 @@ public:
         , _journal(journal)
         , _localPath(localPath)
         , _item(item)
+    {
+        _pollTimer.setSingleShot(true);
+        connect(&_pollTimer, &QTimer::timeout, this, &PollJob::start);
+    }
+
+    void start() Q_DECL_OVERRIDE;
+    bool finished() Q_DECL_OVERRIDE;
+
+    /**
+     * Stops polling without emitting finishedSignal().
+     *
+     * The poll info stays in the journal, the CleanupPollsJob of the next sync polls again.
+     */
+    void abort();
+
+signals:
+    void finishedSignal();
+};
+
+/**
+ * @brief Copies a file on the server, for the uploads of content the server already has
+ *
+ * The If header makes sure that the source still is the version the
+ * journal knows about.
+ * @ingroup libsync
+ */
+class CopyJob : public AbstractNetworkJob
+{
+    Q_OBJECT
+    const QString _destination;
+    QMap<QByteArray, QByteArray> _extraHeaders;
+
+public:
+    explicit CopyJob(AccountPtr account, const QString &path, const QString &destination,
+        const QMap<QByteArray, QByteArray> &extraHeaders, QObject *parent = 0)
+        : AbstractNetworkJob(account, path, parent)
+        , _destination(destination)
+        , _extraHeaders(extraHeaders)
     {
     }
 
@@ -193,9 +294,9 @@ signals:
  *   +--> slotComputeContentChecksum()  <---+
  *                   |
  *                   v
- *    slotComputeTransmissionChecksum()
- *         |
- *         v
+ *    slotComputeTransmissionChecksum()  --> (copy job) --> slotCopyFinished()
+ *         |                                                |           |
+ *         v                                           failed       finalize()
  *    slotStartUpload()  -> doStartUpload()
  *                                  .
  *                                  .
@@ -208,8 +309,10 @@ class PropagateUploadFileCommon : public PropagateItemJob
 
 protected:
     QVector<AbstractNetworkJob *> _jobs; /// network jobs that are currently in transit
+    QPointer<PollJob> _pollJob; /// while waiting for the server to assemble the upload
     bool _finished BITFIELD(1); /// Tells that all the jobs have been finished
     bool _deleteExisting BITFIELD(1);
+    bool _serverSideCopyTried BITFIELD(1);
     quint64 _abortCount; /// Keep track of number of aborted items
 
 // measure the performance of checksum calc and upload
@@ -219,11 +322,17 @@ protected:
 
     QByteArray _transmissionChecksumHeader;
 
+    // The file as it was when the content checksum was computed, for the checksum cache
+    quint64 _contentInode = 0;
+    qint64 _contentModtime = 0; // in nanoseconds, see FileSystem::getModTimeNsecs()
+    qint64 _contentSize = -1;
+
 public:
     PropagateUploadFileCommon(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
         : PropagateItemJob(propagator, item)
         , _finished(false)
         , _deleteExisting(false)
+        , _serverSideCopyTried(false)
         , _abortCount(0)
     {
     }
@@ -242,10 +351,15 @@ public:
 
 private slots:
     void slotComputeContentChecksum();
-    // Content checksum computed, compute the transmission checksum
+    // Content checksum computed, remember it in the journal
+    void slotContentChecksumComputed(const QByteArray &contentChecksumType, const QByteArray &contentChecksum);
+    // Content checksum known, compute the transmission checksum
     void slotComputeTransmissionChecksum(const QByteArray &contentChecksumType, const QByteArray &contentChecksum);
     // transmission checksum computed, prepare the upload
     void slotStartUpload(const QByteArray &transmissionChecksumType, const QByteArray &transmissionChecksum);
+    void slotCopyFinished();
+    // The upload of a new file with the same content finished, try copying it
+    void slotCopySourceFinished(SyncFileItem::Status status);
 
 public:
     virtual void doStartUpload() = 0;
@@ -262,6 +376,22 @@ private slots:
     void slotReplyAbortFinished();
     void slotPollFinished();
 
+private:
+    /**
+     * Finishes the job without an upload if the content checksum is the
+     * one in the journal, the file was only touched. Returns false otherwise.
+     */
+    bool finishIfContentUnchanged();
+
+    /**
+     * Copies a file the journal knows to have the same content on the
+     * server instead of uploading it. Returns false if there is none.
+     *
+     * A new file of this sync with the same content that is still being
+     * uploaded is waited for, then it is copied.
+     */
+    bool startServerSideCopy();
+
 protected:
     /**
      * Prepares the abort e.g. connects proper signals and slots
@@ -269,6 +399,9 @@ protected:
      */
     void prepareAbort(PropagatorJob::AbortType abortType);
 
+    /** Deletes the jobs that didn't send their request yet */
+    void deleteUnsentJobs();
+
     /**
      * Checks whether the current error is one that should reset the whole
      * transfer if it happens too often. If so: Bump UploadInfo::errorCount
@@ -342,12 +475,20 @@ class PropagateUploadFileNG : public PropagateUploadFileCommon
 {
     Q_OBJECT
 private:
-    quint64 _sent = 0; /// amount of data (bytes) that was already sent
+    quint64 _sent = 0; /// amount of data (bytes) that was already sent or is being sent
     uint _transferId = 0; /// transfer id (part of the url)
     int _currentChunk = 0; /// Id of the next chunk that will be sent
     quint64 _currentChunkSize = 0; /// current chunk size
     bool _removeJobError = false; /// If not null, there was an error removing the job
 
+    // The chunks that are being uploaded, by chunk id
+    struct RunningChunk
+    {
+        quint64 size;
+        quint64 sent;
+    };
+    QMap<int, RunningChunk> _runningChunks;
+
     // Map chunk number with its size  from the PROPFIND on resume.
     // (Only used from slotPropfindIterate/slotPropfindFinished because the LsColJob use signals to report data.)
     struct ServerChunkInfo
@@ -357,6 +498,15 @@ private:
     };
     QMap<int, ServerChunkInfo> _serverChunks;
 
+    // For a delta upload only the changed parts of the file are sent, as
+    // offset and size. See Capabilities::deltaUpload().
+    bool _deltaUpload = false;
+    QVector<QPair<quint64, quint64>> _deltaRanges;
+
+    // The block checksums of the uploaded file, stored once it is on the server
+    QByteArray _blockChecksums;
+    QFutureWatcher<QByteArray> _blockChecksumsWatcher;
+
     /**
      * Return the URL of a chunk.
      * If chunk == -1, returns the URL of the parent folder containing the chunks
@@ -372,11 +522,22 @@ public:
     void doStartUpload() Q_DECL_OVERRIDE;
 
 private:
+    void startUploadOrResume();
     void startNewUpload();
     void startNextChunk();
+    bool hasMoreChunks() const;
+
+    /**
+     * How many chunks of this file may be uploaded at the same time.
+     *
+     * Set OWNCLOUD_PARALLEL_CHUNK to a number to change it, or to 0 to
+     * upload one chunk after the other.
+     */
+    int maximumParallelChunks() const;
 public slots:
     void abort(AbortType abortType) Q_DECL_OVERRIDE;
 private slots:
+    void slotBlockChecksumsComputed();
     void slotPropfindFinished();
     void slotPropfindFinishedWithError();
     void slotPropfindIterate(const QString &name, const QMap<QString, QString> &properties);
@@ -386,4 +547,97 @@ private slots:
     void slotMoveJobFinished();
     void slotUploadProgress(qint64, qint64);
 };
+/**
+ * @brief Uploads several files with one multipart POST
+ *
+ * The body has one part per file with X-File-Path, X-File-Mtime and
+ * X-File-MD5 headers, the server answers with a JSON object that maps
+ * every path to its etag and file id or to an error.
+ * See Capabilities::bulkUpload().
+ *
+ * @ingroup libsync
+ */
+class BundleUploadJob : public AbstractNetworkJob
+{
+    Q_OBJECT
+    QByteArray _body;
+    QByteArray _boundary;
+
+public:
+    explicit BundleUploadJob(AccountPtr account, const QByteArray &body, const QByteArray &boundary, QObject *parent = 0)
+        : AbstractNetworkJob(account, QString(), parent)
+        , _body(body)
+        , _boundary(boundary)
+    {
+    }
+
+    void start() Q_DECL_OVERRIDE;
+    bool finished() Q_DECL_OVERRIDE;
+
+signals:
+    void finishedSignal();
+};
+
+class PropagateUploadBundle;
+
+/**
+ * @ingroup libsync
+ *
+ * Upload of a small new file as part of a PropagateUploadBundle.
+ *
+ * Everything up to the upload itself is done like for the other uploads.
+ * If the file could not be uploaded in the bundle it is uploaded alone,
+ * so that the error handling of a regular upload applies.
+ */
+class PropagateUploadFileBundled : public PropagateUploadFileV1
+{
+    Q_OBJECT
+    QPointer<PropagateUploadBundle> _bundle;
+
+public:
+    PropagateUploadFileBundled(OwncloudPropagator *propagator, const SyncFileItemPtr &item, PropagateUploadBundle *bundle)
+        : PropagateUploadFileV1(propagator, item)
+        , _bundle(bundle)
+    {
+    }
+
+    void doStartUpload() Q_DECL_OVERRIDE;
+
+    /** The path of the file relative to the user's root, used in X-File-Path */
+    QString remotePath() const;
+
+    /** Appends the part of the multipart body for this file */
+    bool appendBundlePart(QByteArray *body, const QByteArray &boundary);
+
+    void bundleUploadFinished(const QByteArray &etag, const QByteArray &fileId, const QByteArray &responseTimestamp);
+    void uploadIndividually();
+};
+
+/**
+ * @ingroup libsync
+ *
+ * Uploads many small new files with few requests.
+ *
+ * The files are prepared in parallel by their PropagateUploadFileBundled
+ * jobs. Once all of them are ready, a single BundleUploadJob sends them.
+ */
+class PropagateUploadBundle : public PropagatorCompositeJob
+{
+    Q_OBJECT
+    QVector<PropagateUploadFileBundled *> _readyFiles;
+    QPointer<BundleUploadJob> _job;
+    bool _sent = false;
+
+public:
+    PropagateUploadBundle(OwncloudPropagator *propagator, const SyncFileItemVector &items);
+
+    /** Called by the file jobs when they are ready, returns false if the bundle was already sent */
+    bool addFile(PropagateUploadFileBundled *job);
+
+    void abort(PropagatorJob::AbortType abortType) Q_DECL_OVERRIDE;
+
+private slots:
+    void sendIfReady();
+    void slotBundleFinished();
+};
 }
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "propagateupload.h"
+#include "owncloudpropagator_p.h"
+#include "account.h"
+#include "common/utility.h"
+#include "filesystem.h"
+#include "propagatorjobs.h"
+#include "common/asserts.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+namespace OCC {
+
+void BundleUploadJob::start()
+{
+    QNetworkRequest req;
+    req.setRawHeader("Content-Type", "multipart/related; boundary=" + _boundary);
+    req.setPriority(QNetworkRequest::LowPriority);
+
+    QBuffer *buf = new QBuffer(this);
+    buf->setData(_body);
+    buf->open(QIODevice::ReadOnly);
+    // assumes ownership
+    sendRequest("POST", Utility::concatUrlPath(account()->url(), QLatin1String("remote.php/dav/bulk")), req, buf);
+
+    if (reply()->error() != QNetworkReply::NoError) {
+        qCWarning(lcPutJob) << "Network error on bundle upload:" << reply()->errorString();
+    }
+    connect(this, &AbstractNetworkJob::networkActivity, account().data(), &Account::propagatorNetworkActivity);
+    AbstractNetworkJob::start();
+}
+
+bool BundleUploadJob::finished()
+{
+    qCInfo(lcPutJob) << "Bundle upload finished" << reply()->request().url()
+                     << reply()->error() << reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+    emit finishedSignal();
+    return true;
+}
+
+void PropagateUploadFileBundled::doStartUpload()
+{
+    if (_bundle && _bundle->addFile(this))
+        return;
+    PropagateUploadFileV1::doStartUpload();
+}
+
+QString PropagateUploadFileBundled::remotePath() const
+{
+    return QDir::cleanPath(QLatin1Char('/') + propagator()->_remoteFolder + _item->_file);
+}
+
+bool PropagateUploadFileBundled::appendBundlePart(QByteArray *body, const QByteArray &boundary)
+{
+    QFile file(propagator()->getFilePath(_item->_file));
+    QString openError;
+    if (!FileSystem::openAndSeekFileSharedRead(&file, &openError, 0)) {
+        qCWarning(lcPropagateUpload) << "Could not open" << _item->_file << "for the bundle:" << openError;
+        return false;
+    }
+    const QByteArray data = file.readAll();
+    if (data.size() != qint64(_item->_size)) {
+        // Changed since the discovery, the regular upload deals with that
+        return false;
+    }
+
+    QMap<QByteArray, QByteArray> headers;
+    headers["X-File-Path"] = remotePath().toUtf8();
+    headers["X-File-Mtime"] = QByteArray::number(qint64(_item->_modtime));
+    headers["X-File-MD5"] = QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+    if (!_transmissionChecksumHeader.isEmpty())
+        headers[checkSumHeaderC] = _transmissionChecksumHeader;
+    headers["Content-Length"] = QByteArray::number(data.size());
+
+    body->append("--" + boundary + "\r\n");
+    for (auto it = headers.constBegin(); it != headers.constEnd(); ++it)
+        body->append(it.key() + ": " + it.value() + "\r\n");
+    body->append("\r\n");
+    body->append(data);
+    body->append("\r\n");
+    return true;
+}
+
+void PropagateUploadFileBundled::bundleUploadFinished(const QByteArray &etag, const QByteArray &fileId, const QByteArray &responseTimestamp)
+{
+    // The time since start() is the time of the whole bundle
+    _runningSince.invalidate();
+
+    _item->_etag = etag;
+    if (!fileId.isEmpty())
+        _item->_fileId = fileId;
+    _item->_responseTimeStamp = responseTimestamp;
+
+    // The upload is done, any change since the discovery is for the next sync
+    const QString fullFilePath = propagator()->getFilePath(_item->_file);
+    if (!FileSystem::fileExists(fullFilePath)
+        || !FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
+        propagator()->retryInNextSync(_item->_file);
+    }
+
+    finalize();
+}
+
+void PropagateUploadFileBundled::uploadIndividually()
+{
+    _runningSince.invalidate();
+    PropagateUploadFileV1::doStartUpload();
+}
+
+PropagateUploadBundle::PropagateUploadBundle(OwncloudPropagator *propagator, const SyncFileItemVector &items)
+    : PropagatorCompositeJob(propagator)
+{
+    foreach (const auto &item, items) {
+        auto job = new PropagateUploadFileBundled(propagator, item, this);
+        // Queued so that the job is already removed from _runningJobs
+        connect(job, &PropagatorJob::finished, this, &PropagateUploadBundle::sendIfReady, Qt::QueuedConnection);
+        appendJob(job);
+    }
+}
+
+bool PropagateUploadBundle::addFile(PropagateUploadFileBundled *job)
+{
+    if (_sent)
+        return false;
+    _readyFiles.append(job);
+    // The job left the _activeJobList, the next files may start
+    propagator()->scheduleNextJob();
+    sendIfReady();
+    return true;
+}
+
+void PropagateUploadBundle::sendIfReady()
+{
+    if (_sent || _readyFiles.isEmpty() || !_jobsToDo.isEmpty())
+        return;
+    foreach (auto *job, _runningJobs) {
+        if (!_readyFiles.contains(static_cast<PropagateUploadFileBundled *>(job)))
+            return;
+    }
+    _sent = true;
+
+    if (_readyFiles.size() == 1) {
+        _readyFiles.first()->uploadIndividually();
+        return;
+    }
+
+    const QByteArray boundary = "boundary_" + QByteArray::number(qrand()) + QByteArray::number(qrand());
+    QByteArray body;
+    QVector<PropagateUploadFileBundled *> sentFiles;
+    foreach (auto *job, _readyFiles) {
+        if (job->appendBundlePart(&body, boundary)) {
+            sentFiles.append(job);
+        } else {
+            job->uploadIndividually();
+        }
+    }
+    _readyFiles = sentFiles;
+    if (_readyFiles.isEmpty())
+        return;
+    body.append("--" + boundary + "--\r\n");
+
+    qCInfo(lcPropagateUpload) << "Uploading" << _readyFiles.size() << "files in a bundle of" << body.size() << "bytes";
+    _job = new BundleUploadJob(propagator()->account(), body, boundary, this);
+    connect(_job.data(), &BundleUploadJob::finishedSignal, this, &PropagateUploadBundle::slotBundleFinished);
+    propagator()->_activeJobList.append(_readyFiles.first());
+    _job->start();
+}
+
+void PropagateUploadBundle::slotBundleFinished()
+{
+    ASSERT(_job);
+    propagator()->_activeJobList.removeOne(_readyFiles.first());
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    QNetworkReply *reply = _job->reply();
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QJsonObject results;
+    if (reply->error() == QNetworkReply::NoError) {
+        results = QJsonDocument::fromJson(reply->readAll()).object();
+    } else {
+        qCWarning(lcPropagateUpload) << "Bundle upload failed, uploading the files one by one"
+                                     << httpCode << reply->errorString();
+        if (httpCode == 404 || httpCode == 405 || httpCode == 501) {
+            // The server does not know the endpoint after all
+            propagator()->_bundledUploadsFailed = true;
+        }
+    }
+
+    const QByteArray responseTimestamp = _job->responseTimestamp();
+    foreach (auto *job, _readyFiles) {
+        const QJsonObject result = results.value(job->remotePath()).toObject();
+        const QByteArray etag = parseEtag(result.value(QLatin1String("etag")).toString().toUtf8().constData());
+        if (result.isEmpty() || result.value(QLatin1String("error")).toBool() || etag.isEmpty()) {
+            job->uploadIndividually();
+            continue;
+        }
+        job->bundleUploadFinished(etag, result.value(QLatin1String("fileid")).toString().toUtf8(), responseTimestamp);
+    }
+    _readyFiles.clear();
+}
+
+void PropagateUploadBundle::abort(PropagatorJob::AbortType abortType)
+{
+    if (_job && _job->reply())
+        _job->reply()->abort();
+    PropagatorCompositeJob::abort(abortType);
+}
+}
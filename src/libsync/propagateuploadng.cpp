@@ -26,10 +26,12 @@
 #include "propagateremotemove.h"
 #include "propagateremotedelete.h"
 #include "common/asserts.h"
+#include "common/checksums.h"
 
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
+#include <QtConcurrent>
 #include <cmath>
 #include <cstring>
 
@@ -51,6 +53,9 @@ QUrl PropagateUploadFileNG::chunkUrl(int chunk)
   State machine:
 
      *----> doStartUpload()
+            Compute the block checksums for a delta upload?
+                  |
+            startUploadOrResume()
             Check the db: is there an entry?
               /               \
              no                yes
@@ -82,8 +87,56 @@ void PropagateUploadFileNG::doStartUpload()
 {
     propagator()->_activeJobList.append(this);
 
+    const auto &options = propagator()->syncOptions();
+    if (propagator()->account()->capabilities().deltaUpload()
+        && options._minDeltaUploadSize > 0 && _item->_size >= options._minDeltaUploadSize) {
+        // Reading the whole file to find the changed blocks takes a while
+        qCInfo(lcPropagateUpload) << "Computing the block checksums of" << _item->_file << "in a thread";
+        connect(&_blockChecksumsWatcher, &QFutureWatcherBase::finished,
+            this, &PropagateUploadFileNG::slotBlockChecksumsComputed, Qt::UniqueConnection);
+        _blockChecksumsWatcher.setFuture(QtConcurrent::run(computeBlockChecksums,
+            propagator()->getFilePath(_item->_file), qint64(options._deltaBlockSize)));
+        return;
+    }
+    startUploadOrResume();
+}
+
+void PropagateUploadFileNG::slotBlockChecksumsComputed()
+{
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    _blockChecksums = _blockChecksumsWatcher.result();
+    const quint64 blockSize = propagator()->syncOptions()._deltaBlockSize;
+    const QByteArray previousChecksums = _blockChecksums.isEmpty() ? QByteArray()
+        : propagator()->_journal->getBlockChecksums(_item->_file.toUtf8(), _item->_etag, blockSize);
+
+    // The parts that are not sent are taken from the version on the server, the one
+    // the If header of the MOVE is about.
+    if (!previousChecksums.isEmpty() && PropagateUploadFileCommon::headers().contains("If-Match")) {
+        _deltaUpload = true;
+        for (quint64 offset = 0; offset < _item->_size; offset += blockSize) {
+            const int index = offset / blockSize * blockChecksumSize;
+            if (previousChecksums.mid(index, blockChecksumSize) == _blockChecksums.mid(index, blockChecksumSize))
+                continue;
+            const quint64 size = qMin(blockSize, _item->_size - offset);
+            if (!_deltaRanges.isEmpty() && _deltaRanges.last().first + _deltaRanges.last().second == offset) {
+                _deltaRanges.last().second += size;
+            } else {
+                _deltaRanges.append(qMakePair(offset, size));
+            }
+        }
+        qCInfo(lcPropagateUpload) << "Delta upload of" << _item->_file << ":" << _deltaRanges.size()
+                                  << "changed parts";
+    }
+    startUploadOrResume();
+}
+
+void PropagateUploadFileNG::startUploadOrResume()
+{
     const SyncJournalDb::UploadInfo progressInfo = propagator()->_journal->getUploadInfo(_item->_file);
-    if (progressInfo._valid && progressInfo._modtime == _item->_modtime) {
+    // The chunks of a delta upload are small and not in a sequence, it is not resumed
+    if (progressInfo._valid && progressInfo._modtime == _item->_modtime && !_deltaUpload) {
         _transferId = progressInfo._transferid;
         auto url = chunkUrl();
         auto job = new LsColJob(propagator()->account(), url, this);
@@ -99,7 +152,7 @@ void PropagateUploadFileNG::doStartUpload()
         job->start();
         return;
     } else if (progressInfo._valid) {
-        // The upload info is stale. remove the stale chunks on the server
+        // The upload info is stale or not used. remove the stale chunks on the server
         _transferId = progressInfo._transferid;
         // Fire and forget. Any error will be ignored.
         (new DeleteJob(propagator()->account(), chunkUrl(), this))->start();
@@ -259,6 +312,21 @@ void PropagateUploadFileNG::slotMkColFinished(QNetworkReply::NetworkError)
     startNextChunk();
 }
 
+int PropagateUploadFileNG::maximumParallelChunks() const
+{
+    if (propagator()->account()->capabilities().chunkingParallelUploadDisabled())
+        return 1;
+    static int max = [] {
+        QByteArray env = qgetenv("OWNCLOUD_PARALLEL_CHUNK");
+        if (env == "false" || env == "0")
+            return 1;
+        int value = env.toInt();
+        // More than that only helps against a very high latency
+        return value > 0 ? value : 3;
+    }();
+    return max;
+}
+
 void PropagateUploadFileNG::startNextChunk()
 {
     if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
@@ -267,10 +335,24 @@ void PropagateUploadFileNG::startNextChunk()
     quint64 fileSize = _item->_size;
     ENFORCE(fileSize >= _sent, "Sent data exceeds file size");
 
-    // prevent situation that chunk size is bigger then required one to send
-    _currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
+    quint64 offset = _sent;
+    if (_deltaUpload) {
+        // The server puts every chunk at its offset in the previous version
+        _currentChunkSize = 0;
+        if (!_deltaRanges.isEmpty()) {
+            offset = _deltaRanges.first().first;
+            _currentChunkSize = qMin(propagator()->_chunkSize, _deltaRanges.first().second);
+        }
+    } else {
+        // prevent situation that chunk size is bigger then required one to send
+        _currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
+    }
 
     if (_currentChunkSize == 0) {
+        if (!_runningChunks.isEmpty()) {
+            // The MOVE has to wait until the server has all the chunks
+            return;
+        }
         Q_ASSERT(_jobs.isEmpty()); // There should be no running job anymore
         _finished = true;
         // Finish with a MOVE
@@ -288,13 +370,20 @@ void PropagateUploadFileNG::startNextChunk()
             headers[checkSumHeaderC] = _transmissionChecksumHeader;
         }
         headers["OC-Total-Length"] = QByteArray::number(fileSize);
+        if (_deltaUpload) {
+            headers["OC-Delta-Base"] = _item->_etag;
+        }
 
         auto job = new MoveJob(propagator()->account(), Utility::concatUrlPath(chunkUrl(), "/.file"),
             destination, headers, this);
         _jobs.append(job);
         connect(job, &MoveJob::finishedSignal, this, &PropagateUploadFileNG::slotMoveJobFinished);
         connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
-        propagator()->_activeJobList.append(this);
+        job->setProcessingSize(fileSize);
+        // The server may take long to assemble a big file: the next
+        // transfer uses the slot meanwhile.
+        propagator()->_activeJobList.appendMetadataOnly(this);
+        propagator()->scheduleNextJob();
         job->start();
         return;
     }
@@ -302,7 +391,7 @@ void PropagateUploadFileNG::startNextChunk()
     auto device = new UploadDevice(&propagator()->_bandwidthManager);
     const QString fileName = propagator()->getFilePath(_item->_file);
 
-    if (!device->prepareAndOpen(fileName, _sent, _currentChunkSize)) {
+    if (!device->prepareAndOpen(fileName, offset, _currentChunkSize)) {
         qCWarning(lcPropagateUpload) << "Could not prepare upload device: " << device->errorString();
 
         // If the file is currently locked, we want to retry the sync
@@ -316,9 +405,19 @@ void PropagateUploadFileNG::startNextChunk()
     }
 
     QMap<QByteArray, QByteArray> headers;
-    headers["OC-Chunk-Offset"] = QByteArray::number(_sent);
+    headers["OC-Chunk-Offset"] = QByteArray::number(offset);
+    device->setCompressionWanted(propagator()->account()->capabilities().uploadCompression()
+        && UploadDevice::isLikelyCompressible(fileName, _item->_size));
 
     _sent += _currentChunkSize;
+    if (_deltaUpload) {
+        auto &range = _deltaRanges.first();
+        range.first += _currentChunkSize;
+        range.second -= _currentChunkSize;
+        if (range.second == 0)
+            _deltaRanges.removeFirst();
+    }
+    _runningChunks.insert(_currentChunk, RunningChunk{ _currentChunkSize, 0 });
     QUrl url = chunkUrl(_currentChunk);
 
     // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
@@ -333,6 +432,22 @@ void PropagateUploadFileNG::startNextChunk()
     job->start();
     propagator()->_activeJobList.append(this);
     _currentChunk++;
+
+    // A single connection rarely uses all the bandwidth of a link with a
+    // high latency, upload the next chunks at the same time. The server
+    // puts them together in the order of their ids on the final MOVE.
+    if (hasMoreChunks()
+        && _runningChunks.size() < maximumParallelChunks()
+        && propagator()->_activeJobList.count() < propagator()->maximumActiveTransferJob()) {
+        startNextChunk();
+    }
+}
+
+bool PropagateUploadFileNG::hasMoreChunks() const
+{
+    if (_deltaUpload)
+        return !_deltaRanges.isEmpty();
+    return _sent < _item->_size;
 }
 
 void PropagateUploadFileNG::slotPutFinished()
@@ -343,6 +458,7 @@ void PropagateUploadFileNG::slotPutFinished()
     slotJobDestroyed(job); // remove it from the _jobs list
 
     propagator()->_activeJobList.removeOne(this);
+    const quint64 chunkSize = _runningChunks.take(job->_chunk).size;
 
     if (_finished) {
         // We have sent the finished signal already. We don't need to handle any remaining jobs
@@ -365,32 +481,24 @@ void PropagateUploadFileNG::slotPutFinished()
     // target duration for each chunk upload.
     double targetDuration = propagator()->syncOptions()._targetChunkUploadDuration;
     if (targetDuration > 0) {
-        double uploadTime = job->msSinceStart() + 1; // add one to avoid div-by-zero
+        qint64 uploadTime = job->msSinceStart();
 
-        auto predictedGoodSize = static_cast<quint64>(
-            _currentChunkSize / uploadTime * targetDuration);
-
-        // The whole targeting is heuristic. The predictedGoodSize will fluctuate
-        // quite a bit because of external factors (like available bandwidth)
-        // and internal factors (like number of parallel uploads).
-        //
-        // We use an exponential moving average here as a cheap way of smoothing
-        // the chunk sizes a bit.
-        quint64 targetSize = (propagator()->_chunkSize + predictedGoodSize) / 2;
+        // The short last chunk of a file mostly measures the latency.
+        // The throughput is kept per account, so that the next files and
+        // syncs start with a good size, see Account::chunkUploadThroughput().
+        if (chunkSize >= propagator()->syncOptions()._minChunkSize)
+            propagator()->account()->reportChunkUpload(chunkSize, uploadTime);
 
         // Adjust the dynamic chunk size _chunkSize used for sizing of the item's chunks to be send
-        propagator()->_chunkSize = qBound(
-            propagator()->syncOptions()._minChunkSize,
-            targetSize,
-            propagator()->syncOptions()._maxChunkSize);
-
-        qCInfo(lcPropagateUpload) << "Chunked upload of" << _currentChunkSize << "bytes took" << uploadTime
-                                  << "ms, desired is" << targetDuration << "ms, expected good chunk size is"
-                                  << predictedGoodSize << "bytes and nudged next chunk size to "
-                                  << propagator()->_chunkSize << "bytes";
+        propagator()->adjustChunkSize();
+
+        qCInfo(lcPropagateUpload) << "Chunked upload of" << chunkSize << "bytes took" << uploadTime
+                                  << "ms, desired is" << targetDuration << "ms, smoothed throughput is"
+                                  << propagator()->account()->chunkUploadThroughput()
+                                  << "B/s and nudged next chunk size to" << propagator()->_chunkSize << "bytes";
     }
 
-    bool finished = _sent == _item->_size;
+    bool finished = !hasMoreChunks() && _runningChunks.isEmpty();
 
     // Check if the file still exists
     const QString fullFilePath(propagator()->getFilePath(_item->_file));
@@ -399,13 +507,13 @@ void PropagateUploadFileNG::slotPutFinished()
             abortWithError(SyncFileItem::SoftError, tr("The local file was removed during sync."));
             return;
         } else {
-            propagator()->_anotherSyncNeeded = true;
+            propagator()->retryInNextSync(_item->_file);
         }
     }
 
     // Check whether the file changed since discovery.
     if (!FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
-        propagator()->_anotherSyncNeeded = true;
+        propagator()->retryInNextSync(_item->_file);
         if (!finished) {
             abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
             return;
@@ -423,7 +531,7 @@ void PropagateUploadFileNG::slotPutFinished()
         auto uploadInfo = propagator()->_journal->getUploadInfo(_item->_file);
         uploadInfo._errorCount = 0;
         propagator()->_journal->setUploadInfo(_item->_file, uploadInfo);
-        propagator()->_journal->commit("Upload info");
+        propagator()->_journal->commitIfNeededAndStartNewTransaction("Upload info");
     }
     startNextChunk();
 }
@@ -467,6 +575,13 @@ void PropagateUploadFileNG::slotMoveJobFinished()
     }
     _item->_responseTimeStamp = job->responseTimestamp();
 
+    // Unless it changed while being uploaded, the file on the server has these blocks now
+    if (!_blockChecksums.isEmpty()
+        && FileSystem::verifyFileUnchanged(propagator()->getFilePath(_item->_file), _item->_size, _item->_modtime)) {
+        propagator()->_journal->setBlockChecksums(_item->_file.toUtf8(), _item->_etag,
+            propagator()->syncOptions()._deltaBlockSize, _blockChecksums);
+    }
+
 #ifdef WITH_TESTING
     // performance logging
     quint64 duration = _stopWatch.stop();
@@ -489,7 +604,17 @@ void PropagateUploadFileNG::slotUploadProgress(qint64 sent, qint64 total)
     if (sent == 0 && total == 0) {
         return;
     }
-    propagator()->reportProgress(*_item, _sent + sent - total);
+    auto job = qobject_cast<PUTFileJob *>(sender());
+    auto chunk = job ? _runningChunks.find(job->_chunk) : _runningChunks.end();
+    if (chunk == _runningChunks.end())
+        return;
+    chunk->sent = qMin<quint64>(sent, chunk->size);
+
+    // Only count what the server has of the chunks that are still running
+    quint64 progress = _sent;
+    for (const auto &running : _runningChunks)
+        progress -= running.size - running.sent;
+    propagator()->reportProgress(*_item, progress);
 }
 
 void PropagateUploadFileNG::abort(PropagatorJob::AbortType abortType)
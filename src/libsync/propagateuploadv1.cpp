@@ -122,6 +122,8 @@ void PropagateUploadFileV1::startNextChunk()
         delete device;
         return;
     }
+    device->setCompressionWanted(propagator()->account()->capabilities().uploadCompression()
+        && UploadDevice::isLikelyCompressible(fileName, fileSize));
 
     // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
     PUTFileJob *job = new PUTFileJob(propagator()->account(), propagator()->_remoteFolder + path, device, headers, _currentChunk, this);
@@ -228,13 +230,13 @@ void PropagateUploadFileV1::slotPutFinished()
             abortWithError(SyncFileItem::SoftError, tr("The local file was removed during sync."));
             return;
         } else {
-            propagator()->_anotherSyncNeeded = true;
+            propagator()->retryInNextSync(_item->_file);
         }
     }
 
     // Check whether the file changed since discovery.
     if (!FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
-        propagator()->_anotherSyncNeeded = true;
+        propagator()->retryInNextSync(_item->_file);
         if (!finished) {
             abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
             // FIXME:  the legacy code was retrying for a few seconds.
@@ -275,7 +277,7 @@ void PropagateUploadFileV1::slotPutFinished()
         pi._modtime = _item->_modtime;
         pi._errorCount = 0; // successful chunk upload resets
         propagator()->_journal->setUploadInfo(_item->_file, pi);
-        propagator()->_journal->commit("Upload info");
+        propagator()->_journal->commitIfNeededAndStartNewTransaction("Upload info");
         startNextChunk();
         return;
     }
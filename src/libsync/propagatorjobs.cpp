@@ -28,6 +28,7 @@
 #include <QDateTime>
 #include <qstack.h>
 #include <QCoreApplication>
+#include <QtConcurrent>
 
 #include <time.h>
 
@@ -45,7 +46,7 @@ QByteArray localFileIdFromFullId(const QByteArray &id)
 
 /**
  * Code inspired from Qt5's QDir::removeRecursively
- * The code will update the database in case of error.
+ * Runs in a thread of the pool, so the database entries are collected in _removedRecords.
  * If everything goes well (no error, returns true), the caller is responsible for removing the entries
  * in the database.  But in case of error, we need to remove the entries from the database of the files
  * that were deleted.
@@ -80,8 +81,8 @@ bool PropagateLocalRemove::removeRecursively(const QString &path)
         if (success && !ok) {
             // We need to delete the entries from the database now from the deleted vector
             foreach (const auto &it, deleted) {
-                propagator()->_journal->deleteFileRecord(_item->_originalFile + path + QLatin1Char('/') + it.first,
-                    it.second);
+                _removedRecords.append(qMakePair(_item->_originalFile + path + QLatin1Char('/') + it.first,
+                    it.second));
             }
             success = false;
             deleted.clear();
@@ -91,8 +92,8 @@ bool PropagateLocalRemove::removeRecursively(const QString &path)
         }
         if (!success && ok) {
             // This succeeded, so we need to delete it from the database now because the caller won't
-            propagator()->_journal->deleteFileRecord(_item->_originalFile + path + QLatin1Char('/') + di.fileName(),
-                isDir);
+            _removedRecords.append(qMakePair(_item->_originalFile + path + QLatin1Char('/') + di.fileName(),
+                isDir));
         }
     }
     if (success) {
@@ -107,36 +108,87 @@ bool PropagateLocalRemove::removeRecursively(const QString &path)
     return success;
 }
 
+PropagateLocalJob::PropagateLocalJob(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
+    : PropagateItemJob(propagator, item)
+{
+    connect(&_watcher, &QFutureWatcherBase::finished, this, &PropagateLocalJob::slotOperationFinished);
+}
+
+void PropagateLocalJob::runLocalOperation(const std::function<bool()> &operation)
+{
+    propagator()->_activeJobList.append(this);
+    // The other folders may have started or finished syncing since
+    propagator()->adjustLocalOperationThreads();
+    if (!propagator()->syncOptions()._backgroundIo) {
+        _watcher.setFuture(QtConcurrent::run(propagator()->localOperationsPool(), operation));
+        return;
+    }
+    // The threads of the pool belong to the propagator, they can stay in the background
+    _watcher.setFuture(QtConcurrent::run(propagator()->localOperationsPool(), [operation] {
+        Utility::setThreadBackgroundIo(true);
+        return operation();
+    }));
+}
+
+void PropagateLocalJob::slotOperationFinished()
+{
+    propagator()->_activeJobList.removeOne(this);
+    operationFinished(_watcher.result());
+    if (_abortPending)
+        emit abortFinished();
+}
+
+void PropagateLocalJob::abort(PropagatorJob::AbortType abortType)
+{
+    if (abortType == AbortType::Asynchronous && _watcher.isRunning()) {
+        _abortPending = true;
+        return;
+    }
+    PropagateItemJob::abort(abortType);
+}
+
 void PropagateLocalRemove::start()
 {
     if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
         return;
 
-    QString filename = propagator()->_localDir + _item->_file;
+    OwncloudPropagator *propagator = this->propagator();
+    QString filename = propagator->_localDir + _item->_file;
 
     qCDebug(lcPropagateLocalRemove) << filename;
 
-    if (propagator()->localFileNameClash(_item->_file)) {
+    // The clash checks look at other files, they stay in the main thread
+    if (propagator->localFileNameClash(_item->_file)) {
         done(SyncFileItem::NormalError, tr("Could not remove %1 because of a local file name clash").arg(QDir::toNativeSeparators(filename)));
         return;
     }
 
-    if (_item->isDirectory()) {
-        if (QDir(filename).exists() && !removeRecursively(QString())) {
-            done(SyncFileItem::NormalError, _error);
-            return;
-        }
-    } else {
-        QString removeError;
-        if (FileSystem::fileExists(filename)
-            && !FileSystem::remove(filename, &removeError)) {
-            done(SyncFileItem::NormalError, removeError);
-            return;
+    runLocalOperation([this, filename] {
+        if (_item->isDirectory()) {
+            if (QDir(filename).exists() && !removeRecursively(QString()))
+                return false;
+        } else {
+            if (FileSystem::fileExists(filename)
+                && !FileSystem::remove(filename, &_error)) {
+                return false;
+            }
         }
+        return true;
+    });
+}
+
+void PropagateLocalRemove::operationFinished(bool ok)
+{
+    foreach (const auto &it, _removedRecords) {
+        propagator()->_journal->deleteFileRecord(it.first, it.second);
+    }
+    if (!ok) {
+        done(SyncFileItem::NormalError, _error);
+        return;
     }
     propagator()->reportProgress(*_item, 0);
     propagator()->_journal->deleteFileRecord(_item->_originalFile, _item->isDirectory());
-    propagator()->_journal->commit("Local remove");
+    propagator()->_journal->commitIfNeededAndStartNewTransaction("Local remove");
     done(SyncFileItem::Success);
 }
 
@@ -145,31 +197,42 @@ void PropagateLocalMkdir::start()
     if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
         return;
 
-    QDir newDir(propagator()->getFilePath(_item->_file));
-    QString newDirStr = QDir::toNativeSeparators(newDir.path());
-
-    // When turning something that used to be a file into a directory
-    // we need to delete the file first.
-    QFileInfo fi(newDirStr);
-    if (_deleteExistingFile && fi.exists() && fi.isFile()) {
-        QString removeError;
-        if (!FileSystem::remove(newDirStr, &removeError)) {
-            done(SyncFileItem::NormalError,
-                tr("could not delete file %1, error: %2")
-                    .arg(newDirStr, removeError));
-            return;
-        }
-    }
-
-    if (Utility::fsCasePreserving() && propagator()->localFileNameClash(_item->_file)) {
+    OwncloudPropagator *propagator = this->propagator();
+    QString newDirStr = QDir::toNativeSeparators(QDir(propagator->getFilePath(_item->_file)).path());
+    if (Utility::fsCasePreserving() && propagator->localFileNameClash(_item->_file)) {
         qCWarning(lcPropagateLocalMkdir) << "New folder to create locally already exists with different case:" << _item->_file;
         done(SyncFileItem::NormalError, tr("Attention, possible case sensitivity clash with %1").arg(newDirStr));
         return;
     }
-    emit propagator()->touchedFile(newDirStr);
-    QDir localDir(propagator()->_localDir);
-    if (!localDir.mkpath(_item->_file)) {
-        done(SyncFileItem::NormalError, tr("could not create folder %1").arg(newDirStr));
+    emit propagator->touchedFile(newDirStr);
+
+    runLocalOperation([this, propagator, newDirStr] {
+        // When turning something that used to be a file into a directory
+        // we need to delete the file first.
+        QFileInfo fi(newDirStr);
+        if (_deleteExistingFile && fi.exists() && fi.isFile()) {
+            QString removeError;
+            if (!FileSystem::remove(newDirStr, &removeError)) {
+                _error = tr("could not delete file %1, error: %2")
+                             .arg(newDirStr, removeError);
+                return false;
+            }
+        }
+
+        QDir localDir(propagator->_localDir);
+        if (!localDir.mkpath(_item->_file)) {
+            _error = tr("could not create folder %1").arg(newDirStr);
+            return false;
+        }
+        _record = _item->toSyncJournalFileRecordWithInode(newDirStr);
+        return true;
+    });
+}
+
+void PropagateLocalMkdir::operationFinished(bool ok)
+{
+    if (!ok) {
+        done(SyncFileItem::NormalError, _error);
         return;
     }
 
@@ -178,9 +241,8 @@ void PropagateLocalMkdir::start()
     // Adding an entry with a dummy etag to the database still makes sense here
     // so the database is aware that this folder exists even if the sync is aborted
     // before the correct etag is stored.
-    SyncJournalFileRecord record = _item->toSyncJournalFileRecordWithInode(newDirStr);
-    record._etag = "_invalid_";
-    if (!propagator()->_journal->setFileRecord(record)) {
+    _record._etag = "_invalid_";
+    if (!propagator()->_journal->setFileRecord(_record)) {
         done(SyncFileItem::FatalError, tr("Error writing metadata to the database"));
         return;
     }
@@ -199,38 +261,50 @@ void PropagateLocalRename::start()
     if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
         return;
 
-    QString existingFile = propagator()->getFilePath(_item->_file);
-    QString targetFile = propagator()->getFilePath(_item->_renameTarget);
-
     // if the file is a file underneath a moved dir, the _item->file is equal
     // to _item->renameTarget and the file is not moved as a result.
-    if (_item->_file != _item->_renameTarget) {
-        propagator()->reportProgress(*_item, 0);
-        qCDebug(lcPropagateLocalRename) << "MOVE " << existingFile << " => " << targetFile;
-
-        if (QString::compare(_item->_file, _item->_renameTarget, Qt::CaseInsensitive) != 0
-            && propagator()->localFileNameClash(_item->_renameTarget)) {
-            // Only use localFileNameClash for the destination if we know that the source was not
-            // the one conflicting  (renaming  A.txt -> a.txt is OK)
-
-            // Fixme: the file that is the reason for the clash could be named here,
-            // it would have to come out the localFileNameClash function
-            done(SyncFileItem::NormalError,
-                tr("File %1 can not be renamed to %2 because of a local file name clash")
-                    .arg(QDir::toNativeSeparators(_item->_file))
-                    .arg(QDir::toNativeSeparators(_item->_renameTarget)));
-            return;
-        }
+    if (_item->_file == _item->_renameTarget) {
+        operationFinished(true);
+        return;
+    }
 
-        emit propagator()->touchedFile(existingFile);
-        emit propagator()->touchedFile(targetFile);
-        QString renameError;
-        if (!FileSystem::rename(existingFile, targetFile, &renameError)) {
-            done(SyncFileItem::NormalError, renameError);
-            return;
-        }
+    OwncloudPropagator *propagator = this->propagator();
+    QString existingFile = propagator->getFilePath(_item->_file);
+    QString targetFile = propagator->getFilePath(_item->_renameTarget);
+
+    propagator->reportProgress(*_item, 0);
+    qCDebug(lcPropagateLocalRename) << "MOVE " << existingFile << " => " << targetFile;
+    emit propagator->touchedFile(existingFile);
+    emit propagator->touchedFile(targetFile);
+
+    if (QString::compare(_item->_file, _item->_renameTarget, Qt::CaseInsensitive) != 0
+        && propagator->localFileNameClash(_item->_renameTarget)) {
+        // Only use localFileNameClash for the destination if we know that the source was not
+        // the one conflicting  (renaming  A.txt -> a.txt is OK)
+
+        // Fixme: the file that is the reason for the clash could be named here,
+        // it would have to come out the localFileNameClash function
+        done(SyncFileItem::NormalError,
+            tr("File %1 can not be renamed to %2 because of a local file name clash")
+                .arg(QDir::toNativeSeparators(_item->_file))
+                .arg(QDir::toNativeSeparators(_item->_renameTarget)));
+        return;
+    }
+
+    runLocalOperation([this, existingFile, targetFile] {
+        return FileSystem::rename(existingFile, targetFile, &_error);
+    });
+}
+
+void PropagateLocalRename::operationFinished(bool ok)
+{
+    if (!ok) {
+        done(SyncFileItem::NormalError, _error);
+        return;
     }
 
+    QString targetFile = propagator()->getFilePath(_item->_renameTarget);
+
     SyncJournalFileRecord oldRecord;
     propagator()->_journal->getFileRecord(_item->_originalFile, &oldRecord);
     propagator()->_journal->deleteFileRecord(_item->_originalFile);
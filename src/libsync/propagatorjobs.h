@@ -16,7 +16,11 @@
 #pragma once
 
 #include "owncloudpropagator.h"
+#include "common/syncjournalfilerecord.h"
 #include <QFile>
+#include <QFutureWatcher>
+
+#include <functional>
 
 namespace OCC {
 
@@ -27,35 +31,71 @@ namespace OCC {
 static const char checkSumHeaderC[] = "OC-Checksum";
 static const char contentMd5HeaderC[] = "Content-MD5";
 
+/**
+ * @brief Base class of the jobs that work on the local file system
+ *
+ * The file system operations run on OwncloudPropagator::localOperationsPool(),
+ * so that slow disks, network drives or virus scanners don't block the event
+ * loop. The journal is only used in the main thread.
+ * @ingroup libsync
+ */
+class PropagateLocalJob : public PropagateItemJob
+{
+    Q_OBJECT
+public:
+    PropagateLocalJob(OwncloudPropagator *propagator, const SyncFileItemPtr &item);
+
+    /// A running operation can't be stopped, an asynchronous abort waits for it
+    void abort(PropagatorJob::AbortType abortType) Q_DECL_OVERRIDE;
+
+protected:
+    /** Runs @a operation in a thread of the pool, then operationFinished() with its result */
+    void runLocalOperation(const std::function<bool()> &operation);
+
+    /** Called in the main thread once the operation is done */
+    virtual void operationFinished(bool ok) = 0;
+
+private slots:
+    void slotOperationFinished();
+
+private:
+    QFutureWatcher<bool> _watcher;
+    bool _abortPending = false;
+};
+
 /**
  * @brief Declaration of the other propagation jobs
  * @ingroup libsync
  */
-class PropagateLocalRemove : public PropagateItemJob
+class PropagateLocalRemove : public PropagateLocalJob
 {
     Q_OBJECT
 public:
     PropagateLocalRemove(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
-        : PropagateItemJob(propagator, item)
+        : PropagateLocalJob(propagator, item)
     {
     }
     void start() Q_DECL_OVERRIDE;
 
 private:
+    void operationFinished(bool ok) Q_DECL_OVERRIDE;
     bool removeRecursively(const QString &path);
     QString _error;
+    // Removed entries of a directory that could not be removed completely,
+    // their records are deleted in the main thread.
+    QVector<QPair<QString, bool>> _removedRecords;
 };
 
 /**
  * @brief The PropagateLocalMkdir class
  * @ingroup libsync
  */
-class PropagateLocalMkdir : public PropagateItemJob
+class PropagateLocalMkdir : public PropagateLocalJob
 {
     Q_OBJECT
 public:
     PropagateLocalMkdir(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
-        : PropagateItemJob(propagator, item)
+        : PropagateLocalJob(propagator, item)
         , _deleteExistingFile(false)
     {
     }
@@ -70,22 +110,28 @@ public:
     void setDeleteExistingFile(bool enabled);
 
 private:
+    void operationFinished(bool ok) Q_DECL_OVERRIDE;
     bool _deleteExistingFile;
+    QString _error;
+    SyncJournalFileRecord _record;
 };
 
 /**
  * @brief The PropagateLocalRename class
  * @ingroup libsync
  */
-class PropagateLocalRename : public PropagateItemJob
+class PropagateLocalRename : public PropagateLocalJob
 {
     Q_OBJECT
 public:
     PropagateLocalRename(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
-        : PropagateItemJob(propagator, item)
+        : PropagateLocalJob(propagator, item)
     {
     }
     void start() Q_DECL_OVERRIDE;
-    JobParallelism parallelism() Q_DECL_OVERRIDE { return _item->isDirectory() ? WaitForFinished : FullParallelism; }
+
+private:
+    void operationFinished(bool ok) Q_DECL_OVERRIDE;
+    QString _error;
 };
 }
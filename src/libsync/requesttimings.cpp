@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "requesttimings.h"
+
+#include <QJsonArray>
+
+namespace OCC {
+
+void RequestTimings::add(qint64 sendMs, qint64 waitMs, qint64 receiveMs)
+{
+    const qint64 totalMs = sendMs + waitMs + receiveMs;
+    int bucket = 0;
+    while (bucket < BucketCount - 1 && totalMs >= (qint64(1) << bucket))
+        ++bucket;
+    ++_buckets[bucket];
+    ++_count;
+    _sendMs += sendMs;
+    _waitMs += waitMs;
+    _receiveMs += receiveMs;
+    _maxMs = qMax(_maxMs, totalMs);
+}
+
+void RequestTimings::merge(const RequestTimings &other)
+{
+    for (int i = 0; i < BucketCount; ++i)
+        _buckets[i] += other._buckets[i];
+    _count += other._count;
+    _sendMs += other._sendMs;
+    _waitMs += other._waitMs;
+    _receiveMs += other._receiveMs;
+    _maxMs = qMax(_maxMs, other._maxMs);
+}
+
+qint64 RequestTimings::quantileMs(double q) const
+{
+    if (_count == 0)
+        return 0;
+    const qint64 rank = qMax(qint64(1), qint64(q * _count + 0.5));
+    qint64 seen = 0;
+    for (int i = 0; i < BucketCount - 1; ++i) {
+        seen += _buckets[i];
+        if (seen >= rank)
+            return qMin(_maxMs, (qint64(1) << i) - 1);
+    }
+    return _maxMs;
+}
+
+QJsonObject RequestTimings::toJson() const
+{
+    QJsonObject result;
+    result.insert(QStringLiteral("count"), double(_count));
+    if (_count == 0)
+        return result;
+    result.insert(QStringLiteral("meanSendMs"), double(_sendMs / _count));
+    result.insert(QStringLiteral("meanWaitMs"), double(_waitMs / _count));
+    result.insert(QStringLiteral("meanReceiveMs"), double(_receiveMs / _count));
+    result.insert(QStringLiteral("p50Ms"), double(quantileMs(0.5)));
+    result.insert(QStringLiteral("p90Ms"), double(quantileMs(0.9)));
+    result.insert(QStringLiteral("p99Ms"), double(quantileMs(0.99)));
+    result.insert(QStringLiteral("maxMs"), double(_maxMs));
+    // Up to the last non empty bucket, bucket i counts the durations below 2^i ms
+    int last = BucketCount - 1;
+    while (last > 0 && _buckets[last] == 0)
+        --last;
+    QJsonArray buckets;
+    for (int i = 0; i <= last; ++i)
+        buckets.append(double(_buckets[i]));
+    result.insert(QStringLiteral("buckets"), buckets);
+    return result;
+}
+
+QByteArray RequestTimings::key(const QByteArray &verb, const QString &urlPath)
+{
+    const char *endpoint = "other";
+    if (urlPath.contains(QLatin1String("/remote.php/dav/uploads/"))) {
+        endpoint = "uploads";
+    } else if (urlPath.contains(QLatin1String("/remote.php/webdav"))
+        || urlPath.contains(QLatin1String("/remote.php/dav/files/"))) {
+        endpoint = "files";
+    } else if (urlPath.contains(QLatin1String("/ocs/"))) {
+        endpoint = "ocs";
+    } else if (urlPath.endsWith(QLatin1String("/status.php"))) {
+        endpoint = "status";
+    }
+    return verb + ' ' + endpoint;
+}
+}
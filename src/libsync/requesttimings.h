@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QMap>
+#include <QString>
+
+#include <array>
+
+namespace OCC {
+
+/**
+ * @brief The latencies of the requests of one verb to one kind of endpoint
+ *
+ * A request is split into three phases:
+ *  - send: until its body was uploaded, zero without a body,
+ *  - wait: until the headers of the reply arrived, the time the server took
+ *    and the round trip,
+ *  - receive: until the body of the reply was downloaded.
+ * Qt doesn't tell the time of the name lookup and of the connection, they
+ * are part of the first phase.
+ *
+ * The total durations go to buckets of powers of two milliseconds.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT RequestTimings
+{
+public:
+    void add(qint64 sendMs, qint64 waitMs, qint64 receiveMs);
+    void merge(const RequestTimings &other);
+
+    qint64 count() const { return _count; }
+    qint64 maxMs() const { return _maxMs; }
+
+    /** The upper bound of the bucket holding the quantile @a q of the total durations */
+    qint64 quantileMs(double q) const;
+
+    QJsonObject toJson() const;
+
+    /** "GET files" for a download: the verb and the kind of the endpoint of @a urlPath */
+    static QByteArray key(const QByteArray &verb, const QString &urlPath);
+
+private:
+    // The last bucket holds everything from 2^16 ms, about a minute
+    static const int BucketCount = 18;
+
+    qint64 _count = 0;
+    qint64 _sendMs = 0;
+    qint64 _waitMs = 0;
+    qint64 _receiveMs = 0;
+    qint64 _maxMs = 0;
+    std::array<qint64, BucketCount> _buckets = {};
+};
+
+/** By RequestTimings::key() */
+typedef QMap<QByteArray, RequestTimings> RequestTimingsMap;
+}
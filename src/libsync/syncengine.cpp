@@ -13,9 +13,12 @@
  * for more details.
  */
 
+#include "config.h"
 #include "syncengine.h"
 #include "account.h"
+#include "accessmanager.h"
 #include "owncloudpropagator.h"
+#include "owncloudpropagator_p.h"
 #include "common/syncjournaldb.h"
 #include "common/syncjournalfilerecord.h"
 #include "discoveryphase.h"
@@ -26,6 +29,9 @@
 #include "propagateremotedelete.h"
 #include "propagatedownload.h"
 #include "common/asserts.h"
+#include "common/tracing.h"
+#include "common/instancecounter.h"
+#include "common/sessionrecorder.h"
 
 #ifdef Q_OS_WIN
 #include <windows.h>
@@ -33,6 +39,7 @@
 #include <unistd.h>
 #endif
 
+#include <algorithm>
 #include <climits>
 #include <assert.h>
 
@@ -49,6 +56,8 @@
 #include <QSslCertificate>
 #include <QProcess>
 #include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QtConcurrent>
 #include <qtextcodec.h>
 
 namespace OCC {
@@ -56,7 +65,10 @@ namespace OCC {
 Q_LOGGING_CATEGORY(lcEngine, "sync.engine", QtInfoMsg)
 
 static const int s_touchedFilesMaxAgeMs = 15 * 1000;
-bool SyncEngine::s_anySyncRunning = false;
+
+// The batches of itemsCompleted, whatever is reached first
+static const int CompletedItemsBatchMsecs = 200;
+static const int CompletedItemsBatchSize = 500;
 
 qint64 SyncEngine::minimumFileAgeForUpload = 2000;
 
@@ -83,6 +95,7 @@ SyncEngine::SyncEngine(AccountPtr account, const QString &localPath,
     qRegisterMetaType<SyncFileStatus>("SyncFileStatus");
     qRegisterMetaType<SyncFileItemVector>("SyncFileItemVector");
     qRegisterMetaType<SyncFileItem::Direction>("SyncFileItem::Direction");
+    qRegisterMetaType<SyncRunMetrics>("SyncRunMetrics");
 
     // Everything in the SyncEngine expects a trailing slash for the localPath.
     ASSERT(localPath.endsWith(QLatin1Char('/')));
@@ -94,11 +107,27 @@ SyncEngine::SyncEngine(AccountPtr account, const QString &localPath,
 
     _syncFileStatusTracker.reset(new SyncFileStatusTracker(this));
 
+    _localChangeClock.start();
+
     _clearTouchedFilesTimer.setSingleShot(true);
     _clearTouchedFilesTimer.setInterval(30 * 1000);
     connect(&_clearTouchedFilesTimer, &QTimer::timeout, this, &SyncEngine::slotClearTouchedFiles);
 
+    _progressTimer.setSingleShot(true);
+    connect(&_progressTimer, &QTimer::timeout, this, &SyncEngine::emitProgress);
+    _updateEstimatesTimer.setInterval(1000);
+    connect(&_updateEstimatesTimer, &QTimer::timeout, this, [this] { _progressInfo->updateEstimates(); });
+    _completedItemsTimer.setSingleShot(true);
+    _completedItemsTimer.setInterval(CompletedItemsBatchMsecs);
+    connect(&_completedItemsTimer, &QTimer::timeout, this, &SyncEngine::flushCompletedItems);
+
     _thread.setObjectName("SyncEngine_Thread");
+    // The discovery stats the whole folder and computes checksums on this thread
+    connect(&_thread, &QThread::started, this, [this] {
+        if (_syncOptions._backgroundIo)
+            Utility::setThreadBackgroundIo(true);
+    }, Qt::DirectConnection);
+    _teardownPool.setMaxThreadCount(1);
 }
 
 SyncEngine::~SyncEngine()
@@ -107,6 +136,28 @@ SyncEngine::~SyncEngine()
     _thread.quit();
     _thread.wait();
     _excludedFiles.reset();
+    _teardownPool.waitForDone();
+}
+
+void SyncEngine::reinitializeCsync()
+{
+    // Only the maps are handed over, the file stats don't reference the
+    // context and FileStatPool is locked
+    struct Trees
+    {
+        csync_s::FileMap local;
+        csync_s::FileMap remote;
+    };
+    auto trees = std::make_shared<Trees>();
+    trees->local.swap(_csync_ctx->local.files);
+    trees->remote.swap(_csync_ctx->remote.files);
+    _csync_ctx->reinitialize();
+    if (trees->local.empty() && trees->remote.empty())
+        return;
+    QtConcurrent::run(&_teardownPool, [trees] {
+        trees->local.clear();
+        trees->remote.clear();
+    });
 }
 
 //Convert an error code from csync to a user readable string.
@@ -278,7 +329,7 @@ void SyncEngine::deleteStaleDownloadInfos(const SyncFileItemVector &syncItems)
     QSet<QString> download_file_paths;
     foreach (const SyncFileItemPtr &it, syncItems) {
         if (it->_direction == SyncFileItem::Down
-            && it->_type == SyncFileItem::File) {
+            && (it->_type == SyncFileItem::File || it->_type == SyncFileItem::VirtualFileDownload)) {
             download_file_paths.insert(it->_file);
         }
     }
@@ -376,10 +427,29 @@ int SyncEngine::treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other,
         }
     }
 
-    // Gets a default-constructed SyncFileItemPtr or the one from the first walk (=local walk)
-    SyncFileItemPtr item = _syncItemMap.value(key);
-    if (!item)
-        item = SyncFileItemPtr(new SyncFileItem);
+    // Gets a new SyncFileItemPtr or the one from the first walk (=local walk)
+    SyncFileItemPtr item;
+    const auto indexIt = _syncItemIndex.constFind(key);
+    const bool known = indexIt != _syncItemIndex.constEnd();
+
+    // Most entries of a large folder are unchanged and need no item, only the
+    // bookkeeping of the NONE case below
+    if (!known && file->instruction == CSYNC_INSTRUCTION_NONE && file->error_status == CSYNC_STATUS_OK
+        && file->type != CSYNC_FTW_TYPE_VIRTUAL_FILE_DOWNLOAD && file->rename_path.isEmpty()) {
+        // The local walk recorded the same path already
+        if (!remote || !other || other->path != file->path)
+            _seenFiles.push_back(file->phash);
+        if (file->type != CSYNC_FTW_TYPE_DIR
+            && (!other || other->instruction == CSYNC_INSTRUCTION_NONE || other->instruction == CSYNC_INSTRUCTION_UPDATE_METADATA)) {
+            _hasNoneFiles = true;
+        }
+        return 0;
+    }
+
+    if (known)
+        item = _syncItems.at(*indexIt);
+    else
+        item = SyncFileItemPtr::create(); // one allocation for the item and its reference count
 
     if (item->_file.isEmpty() || instruction == CSYNC_INSTRUCTION_RENAME) {
         item->_file = fileUtf8;
@@ -406,11 +476,8 @@ int SyncEngine::treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other,
     if (!file->file_id.isEmpty()) {
         item->_fileId = file->file_id;
     }
-    if (!file->directDownloadUrl.isEmpty()) {
-        item->_directDownloadUrl = QString::fromUtf8(file->directDownloadUrl);
-    }
-    if (!file->directDownloadCookies.isEmpty()) {
-        item->_directDownloadCookies = QString::fromUtf8(file->directDownloadCookies);
+    if (!file->directDownloadUrl.isEmpty() || !file->directDownloadCookies.isEmpty()) {
+        item->setDirectDownload(QString::fromUtf8(file->directDownloadUrl), QString::fromUtf8(file->directDownloadCookies));
     }
     if (!file->remotePerm.isNull()) {
         item->_remotePerm = file->remotePerm;
@@ -432,10 +499,10 @@ int SyncEngine::treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other,
     }
 
     // record the seen files to be able to clean the journal later
-    _seenFiles.insert(item->_file);
+    _seenFiles.push_back(file->phash);
     if (!renameTarget.isEmpty()) {
         // Yes, this records both the rename renameTarget and the original so we keep both in case of a rename
-        _seenFiles.insert(renameTarget);
+        _seenFiles.push_back(SyncJournalDb::getPHash(file->rename_path));
     }
 
     switch (file->error_status) {
@@ -481,6 +548,9 @@ int SyncEngine::treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other,
     case CSYNC_STATUS_INDIVIDUAL_CANNOT_ENCODE:
         item->_errorString = tr("The filename cannot be encoded on your file system.");
         break;
+    case CSYNC_STATUS_INDIVIDUAL_IS_VIRTUAL_FILE:
+        item->_errorString = tr("The placeholder of a virtual file is not uploaded.");
+        break;
     case CSYNC_STATUS_INDIVIDUAL_IS_CONFLICT_FILE:
         item->_status = SyncFileItem::Conflict;
         if (Utility::shouldUploadConflictFiles()) {
@@ -550,10 +620,22 @@ int SyncEngine::treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other,
     case CSYNC_FTW_TYPE_SLINK:
         item->_type = SyncFileItem::SoftLink;
         break;
+    case CSYNC_FTW_TYPE_VIRTUAL_FILE:
+        item->_type = SyncFileItem::VirtualFile;
+        break;
+    case CSYNC_FTW_TYPE_VIRTUAL_FILE_DOWNLOAD:
+        item->_type = SyncFileItem::VirtualFileDownload;
+        break;
     default:
         item->_type = SyncFileItem::UnknownType;
     }
 
+    // The download replaces the placeholder by the file without the suffix
+    if (item->_type == SyncFileItem::VirtualFileDownload) {
+        item->_file = itemRemotePath(*item, fileUtf8);
+        _seenFiles.push_back(SyncJournalDb::getPHash(item->_file.toUtf8()));
+    }
+
     SyncFileItem::Direction dir = SyncFileItem::None;
 
     int re = 0;
@@ -598,27 +680,32 @@ int SyncEngine::treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other,
                     // Even if the mtime is different on the server, we always want to keep the mtime from
                     // the file system in the DB, this is to avoid spurious upload on the next sync
                     item->_modtime = other->modtime;
-                    // same for the size
-                    item->_size = other->size;
+                    // same for the size, a placeholder keeps the size of the remote file
+                    if (item->_type != SyncFileItem::VirtualFile)
+                        item->_size = other->size;
                 }
 
-                // If the 'W' remote permission changed, update the local filesystem
-                SyncJournalFileRecord prev;
-                if (_journal->getFileRecord(item->_file, &prev)
-                    && prev.isValid()
-                    && prev._remotePerm.hasPermission(RemotePermissions::CanWrite) != item->_remotePerm.hasPermission(RemotePermissions::CanWrite)) {
-                    const bool isReadOnly = !item->_remotePerm.isNull() && !item->_remotePerm.hasPermission(RemotePermissions::CanWrite);
-                    FileSystem::setFileReadOnlyWeak(filePath, isReadOnly);
-                }
+                // A dry run leaves the files and the journal as they are
+                if (!_syncOptions._dryRun) {
+                    // If the 'W' remote permission changed, update the local filesystem
+                    SyncJournalFileRecord prev;
+                    if (_journal->getFileRecord(item->_file, &prev)
+                        && prev.isValid()
+                        && prev._remotePerm.hasPermission(RemotePermissions::CanWrite) != item->_remotePerm.hasPermission(RemotePermissions::CanWrite)) {
+                        const bool isReadOnly = !item->_remotePerm.isNull() && !item->_remotePerm.hasPermission(RemotePermissions::CanWrite);
+                        FileSystem::setFileReadOnlyWeak(filePath, isReadOnly);
+                    }
 
-                _journal->setFileRecordMetadata(item->toSyncJournalFileRecordWithInode(filePath));
+                    _journal->setFileRecordMetadata(item->toSyncJournalFileRecordWithInode(filePath));
+                }
 
                 // This might have changed the shared flag, so we must notify SyncFileStatusTracker for example
-                emit itemCompleted(item);
+                appendCompletedItem(item);
             } else {
                 // The local tree is walked first and doesn't have all the info from the server.
                 // Update only outdated data from the disk.
-                _journal->updateLocalMetadata(item->_file, item->_modtime, item->_size, item->_inode);
+                if (!_syncOptions._dryRun)
+                    _journal->updateLocalMetadata(item->_file, item->_modtime, item->_size, item->_inode);
             }
 
             if (!other || other->instruction == CSYNC_INSTRUCTION_NONE || other->instruction == CSYNC_INSTRUCTION_UPDATE_METADATA) {
@@ -689,7 +776,10 @@ int SyncEngine::treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other,
         item->_previousSize = other->size;
     }
 
-    _syncItemMap.insert(key, item);
+    if (!known) {
+        _syncItemIndex.insert(key, _syncItems.size());
+        _syncItems.append(item);
+    }
     return re;
 }
 
@@ -735,6 +825,12 @@ void SyncEngine::csyncError(const QString &message)
 
 void SyncEngine::startSync()
 {
+    _metrics = SyncRunMetrics();
+    _discoveredFolders = 0;
+    InstanceCounts::resetPeaks();
+    if (SessionRecorder::isEnabled())
+        SessionRecorder::beginSync();
+
     if (_journal->exists()) {
         QVector<SyncJournalDb::PollInfo> pollInfos = _journal->getPollInfos();
         if (!pollInfos.isEmpty()) {
@@ -748,17 +844,19 @@ void SyncEngine::startSync()
         }
     }
 
-    if (s_anySyncRunning || _syncRunning) {
+    if (_syncRunning) {
         ASSERT(false);
         return;
     }
 
-    s_anySyncRunning = true;
     _syncRunning = true;
     _anotherSyncNeeded = NoFollowUpSync;
+    _retryPaths.clear();
+    _remoteRootEtag.clear();
     _clearTouchedFilesTimer.stop();
 
     _progressInfo->reset();
+    _updateEstimatesTimer.stop();
 
     if (!QDir(_localPath).exists()) {
         _anotherSyncNeeded = DelayedFollowUp;
@@ -790,7 +888,8 @@ void SyncEngine::startSync()
         qCWarning(lcEngine) << "Could not determine free space available at" << _localPath;
     }
 
-    _syncItemMap.clear();
+    _syncItems.clear();
+    _syncItemIndex.clear();
     _needsUpdate = false;
 
     csync_resume(_csync_ctx.data());
@@ -818,6 +917,9 @@ void SyncEngine::startSync()
     }
 
     _csync_ctx->read_remote_from_db = true;
+    _csync_ctx->max_tree_memory = _syncOptions._maxDiscoveryMemory;
+    _csync_ctx->new_files_are_virtual = _syncOptions._newFilesAreVirtual;
+    _csync_ctx->virtual_file_suffix = APPLICATION_DOTVIRTUALFILE_SUFFIX;
     _lastLocalDiscoveryStyle = _csync_ctx->local_discovery_style;
 
     bool ok;
@@ -834,16 +936,22 @@ void SyncEngine::startSync()
     csync_set_userdata(_csync_ctx.data(), this);
 
     // Set up checksumming hook
+    _checksum_hook.setJournal(_journal);
+    _checksum_hook.setBudget(_syncOptions._discoveryChecksumBudget);
     _csync_ctx->callbacks.checksum_hook = &CSyncChecksumHook::hook;
     _csync_ctx->callbacks.checksum_userdata = &_checksum_hook;
 
     _stopWatch.start();
+    _journalQueriesAtStart = _journal->executedQueryCount();
+    if (auto am = qobject_cast<AccessManager *>(account()->networkAccessManager()))
+        am->takeRequestStats();
+    _phaseTimer.start();
     _progressInfo->_status = ProgressInfo::Starting;
-    emit transmissionProgress(*_progressInfo);
+    emitProgress();
 
     qCInfo(lcEngine) << "#### Discovery start ####################################################";
     _progressInfo->_status = ProgressInfo::Discovery;
-    emit transmissionProgress(*_progressInfo);
+    emitProgress();
 
     // Usually the discovery runs in the background: We want to avoid
     // stealing too much time from other processes that the user might
@@ -874,6 +982,9 @@ void SyncEngine::startSync()
     }
 
     discoveryJob->_syncOptions = _syncOptions;
+    discoveryJob->_listNewFoldersRecursively = account()->capabilities().propfindDepthInfinity();
+    discoveryJob->_checkpointListings = !_syncOptions._dryRun
+        && (!_journal->hasFileRecords() || _journal->hasDiscoveryListings());
     discoveryJob->moveToThread(&_thread);
     connect(discoveryJob, &DiscoveryJob::finished, this, &SyncEngine::slotDiscoveryJobFinished);
     connect(discoveryJob, &DiscoveryJob::folderDiscovered,
@@ -881,6 +992,8 @@ void SyncEngine::startSync()
 
     connect(discoveryJob, &DiscoveryJob::newBigFolder,
         this, &SyncEngine::newBigFolder);
+    connect(discoveryJob, &DiscoveryJob::deferredToNextBatch,
+        this, [this]() { _anotherSyncNeeded = BatchFollowUp; });
 
 
     // This is used for the DiscoveryJob to be able to request the main thread/
@@ -894,7 +1007,8 @@ void SyncEngine::startSync()
 void SyncEngine::slotFolderDiscovered(bool /*local*/, const QString &folder)
 {
     _progressInfo->_currentDiscoveredFolder = folder;
-    emit transmissionProgress(*_progressInfo);
+    ++_discoveredFolders;
+    scheduleProgress();
 }
 
 void SyncEngine::slotRootEtagReceived(const QString &e)
@@ -902,7 +1016,9 @@ void SyncEngine::slotRootEtagReceived(const QString &e)
     if (_remoteRootEtag.isEmpty()) {
         qCDebug(lcEngine) << "Root etag:" << e;
         _remoteRootEtag = e;
-        emit rootEtag(_remoteRootEtag);
+        // With paths, only once it's known that nothing was left out
+        if (_csync_ctx->remote_discovery_paths.empty())
+            emit rootEtag(_remoteRootEtag);
     }
 }
 
@@ -913,6 +1029,21 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
         return;
     }
     qCInfo(lcEngine) << "#### Discovery end #################################################### " << _stopWatch.addLapTime(QLatin1String("Discovery Finished")) << "ms";
+    _metrics._localDiscoveryMs = _csync_ctx->update_metrics.local_walk_ms;
+    _metrics._remoteDiscoveryMs = _csync_ctx->update_metrics.remote_walk_ms;
+    _metrics._localStats = _csync_ctx->update_metrics.local_stats;
+    _metrics._remoteListings = _csync_ctx->update_metrics.remote_listings;
+    _metrics._discoveredEntries = _csync_ctx->local.files.size() + _csync_ctx->remote.files.size();
+    _phaseTimer.restart();
+
+    if (!_csync_ctx->remote_discovery_paths.empty()) {
+        if (_csync_ctx->remote_changes_deferred) {
+            qCInfo(lcEngine) << "Remote changes outside of the" << _csync_ctx->remote_discovery_paths.size()
+                             << "paths of this sync are left for the next one";
+        } else if (!_remoteRootEtag.isEmpty()) {
+            emit rootEtag(_remoteRootEtag);
+        }
+    }
 
     // Sanity check
     if (!_journal->isConnected()) {
@@ -927,7 +1058,7 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
 
     _progressInfo->_currentDiscoveredFolder.clear();
     _progressInfo->_status = ProgressInfo::Reconcile;
-    emit transmissionProgress(*_progressInfo);
+    emitProgress();
 
     if (csync_reconcile(_csync_ctx.data()) < 0) {
         handleSyncError(_csync_ctx.data(), "csync_reconcile");
@@ -935,6 +1066,7 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     }
 
     qCInfo(lcEngine) << "#### Reconcile end #################################################### " << _stopWatch.addLapTime(QLatin1String("Reconcile Finished")) << "ms";
+    _metrics._reconcileMs = _phaseTimer.restart();
 
     _hasNoneFiles = false;
     _hasRemoveFile = false;
@@ -943,7 +1075,12 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     bool walkOk = true;
     _seenFiles.clear();
     _temporarilyUnavailablePaths.clear();
+    _unchangedSubtrees.clear();
     _renamedFolders.clear();
+    const int expectedItems = int(std::max(_csync_ctx->local.files.size(), _csync_ctx->remote.files.size()));
+    _syncItems.reserve(expectedItems);
+    _syncItemIndex.reserve(expectedItems);
+    _seenFiles.reserve(_csync_ctx->local.files.size() + _csync_ctx->remote.files.size());
 
     if (csync_walk_local_tree(_csync_ctx.data(), &treewalkLocal, 0) < 0) {
         qCWarning(lcEngine) << "Error in local treewalk.";
@@ -955,9 +1092,19 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
 
     qCInfo(lcEngine) << "Permissions of the root folder: " << _csync_ctx->remote.root_perms.toString();
 
-    // The map was used for merging trees, convert it to a list:
-    SyncFileItemVector syncItems = _syncItemMap.values().toVector();
-    _syncItemMap.clear(); // free memory
+    // Subtrees without changes may have been dropped from the trees during discovery
+    if (_csync_ctx->dropped_unchanged_files)
+        _hasNoneFiles = true;
+    for (const auto &dir : _csync_ctx->dropped_subtrees) {
+        _seenFiles.push_back(SyncJournalDb::getPHash(dir));
+        _unchangedSubtrees.append(QString::fromUtf8(dir) + QLatin1Char('/'));
+    }
+    std::sort(_unchangedSubtrees.begin(), _unchangedSubtrees.end());
+
+    // The index was only needed for merging the trees
+    SyncFileItemVector syncItems;
+    syncItems.swap(_syncItems);
+    _syncItemIndex = QHash<QString, int>(); // free memory
 
     // Adjust the paths for the renames.
     for (SyncFileItemVector::iterator it = syncItems.begin();
@@ -1025,16 +1172,57 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // make sure everything is allowed
     checkForPermission(syncItems);
 
+    // The contents of a renamed directory that have no change of their own
+    // need no job, PropagateDirectory moves their records with one query.
+    // The ones whose metadata differs from their record keep their job, it
+    // writes the new record.
+    if (!_renamedFolders.isEmpty()) {
+        auto movedWithParent = [this](const SyncFileItemPtr &item) {
+            if (item->_instruction != CSYNC_INSTRUCTION_RENAME
+                || item->_file != item->_renameTarget
+                || item->_originalFile == item->_renameTarget) {
+                return false;
+            }
+            SyncJournalFileRecord record;
+            if (!_journal->getFileRecord(item->_originalFile, &record) || !record.isValid())
+                return false;
+            return record._type == item->_type
+                && record._modtime == item->_modtime
+                && record._fileSize == qint64(item->_size)
+                && (item->_etag.isEmpty() || record._etag == item->_etag)
+                && (item->_fileId.isEmpty() || record._fileId == item->_fileId)
+                && (item->_remotePerm.isNull() || record._remotePerm == item->_remotePerm);
+        };
+        const auto end = std::remove_if(syncItems.begin(), syncItems.end(), movedWithParent);
+        if (end != syncItems.end()) {
+            qCInfo(lcEngine) << "Moving" << (syncItems.end() - end) << "records with their renamed directories";
+            syncItems.erase(end, syncItems.end());
+        }
+    }
+
+    for (const auto &dir : _csync_ctx->local.listed_directories) {
+        _localDirectoryInfos.insert(dir.first, dir.second);
+    }
+
     // Re-init the csync context to free memory
-    _csync_ctx->reinitialize();
+    reinitializeCsync();
 
     // To announce the beginning of the sync
     emit aboutToPropagate(syncItems);
 
+    if (_syncOptions._dryRun) {
+        qCInfo(lcEngine) << "Dry run, not propagating" << syncItems.size() << "items";
+        _metrics._peakItemCount = syncItems.size();
+        _metrics._treewalkMs = _phaseTimer.restart();
+        finalize(true);
+        return;
+    }
+
     // it's important to do this before ProgressInfo::start(), to announce start of new sync
     _progressInfo->_status = ProgressInfo::Propagation;
-    emit transmissionProgress(*_progressInfo);
+    emitProgress();
     _progressInfo->startEstimateUpdates();
+    _updateEstimatesTimer.start();
 
     // post update phase script: allow to tweak stuff by a custom script in debug mode.
     if (!qEnvironmentVariableIsEmpty("OWNCLOUD_POST_UPDATE_SCRIPT")) {
@@ -1054,6 +1242,19 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     _propagator = QSharedPointer<OwncloudPropagator>(
         new OwncloudPropagator(_account, _localPath, _remotePath, _journal));
     _propagator->setSyncOptions(_syncOptions);
+    _propagator->setPaused(_paused);
+
+    // Only the recent changes can still hold an upload
+    for (auto it = _localChanges.begin(); it != _localChanges.end();) {
+        if (_localChangeClock.elapsed() - *it >= _syncOptions._uploadStabilityMsec) {
+            it = _localChanges.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    _propagator->_localChanges = _localChanges;
+    _propagator->_localChangeClock = _localChangeClock;
+
     connect(_propagator.data(), &OwncloudPropagator::itemCompleted,
         this, &SyncEngine::slotItemCompleted);
     connect(_propagator.data(), &OwncloudPropagator::progress,
@@ -1064,6 +1265,15 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     connect(_propagator.data(), &OwncloudPropagator::insufficientLocalStorage, this, &SyncEngine::slotInsufficientLocalStorage);
     connect(_propagator.data(), &OwncloudPropagator::insufficientRemoteStorage, this, &SyncEngine::slotInsufficientRemoteStorage);
 
+    // The listing of the root had the quota, uploads to it that can't fit are skipped.
+    // Negative values mean that the quota is unknown or unlimited.
+    if (_discoveryMainThread->_hasRootQuota) {
+        auto available = _discoveryMainThread->_rootQuotaAvailableBytes;
+        if (available >= 0)
+            _propagator->_folderQuota.insert(QStringLiteral("."), available);
+        emit rootQuota(_discoveryMainThread->_rootQuotaUsedBytes, available);
+    }
+
     // apply the network limits to the propagator
     setNetworkLimits(_uploadLimit, _downloadLimit);
 
@@ -1076,6 +1286,18 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     if (_needsUpdate)
         emit(started());
 
+    _metrics._peakItemCount = syncItems.size();
+    _metrics._treewalkMs = _phaseTimer.restart();
+    if (SessionRecorder::isEnabled()) {
+        for (const auto &item : syncItems) {
+            const char *direction = item->_direction == SyncFileItem::Up
+                ? "up"
+                : item->_direction == SyncFileItem::Down ? "down" : "none";
+            SessionRecorder::addItem(item->_file, item->_renameTarget, item->isDirectory(),
+                csync_instruction_str(item->_instruction), direction, item->_size);
+        }
+    }
+    _propagatedItems = syncItems;
     _propagator->start(syncItems);
 
     qCInfo(lcEngine) << "#### Post-Reconcile end #################################################### " << _stopWatch.addLapTime(QLatin1String("Post-Reconcile Finished")) << "ms";
@@ -1109,27 +1331,95 @@ void SyncEngine::setNetworkLimits(int upload, int download)
 void SyncEngine::slotItemCompleted(const SyncFileItemPtr &item)
 {
     _progressInfo->setProgressComplete(*item);
+    if (_propagator)
+        _progressInfo->_concurrency = _propagator->concurrencyState();
+
+    if (item->_status == SyncFileItem::Success && ProgressInfo::isSizeDependent(*item)) {
+        _metrics._bytesTransferred += item->_size;
+    }
 
     if (item->_status == SyncFileItem::FatalError) {
         csyncError(item->_errorString);
     }
 
-    emit transmissionProgress(*_progressInfo);
+    switch (item->_status) {
+    case SyncFileItem::FatalError:
+    case SyncFileItem::NormalError:
+    case SyncFileItem::SoftError:
+    case SyncFileItem::DetailError:
+    case SyncFileItem::BlacklistedError:
+    case SyncFileItem::Deferred: {
+        // The directories containing the item need to be listed again
+        QByteArray path = item->_file.toUtf8();
+        _localDirectoryInfos.remove(path);
+        int slash;
+        while ((slash = path.lastIndexOf('/')) > 0) {
+            path.truncate(slash);
+            _localDirectoryInfos.remove(path);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    emitProgress();
+    appendCompletedItem(item);
+}
+
+void SyncEngine::appendCompletedItem(const SyncFileItemPtr &item)
+{
     emit itemCompleted(item);
+
+    _completedItems.append(item);
+    if (_completedItems.size() >= CompletedItemsBatchSize) {
+        flushCompletedItems();
+    } else if (!_completedItemsTimer.isActive()) {
+        _completedItemsTimer.start();
+    }
+}
+
+void SyncEngine::flushCompletedItems()
+{
+    _completedItemsTimer.stop();
+    if (_completedItems.isEmpty())
+        return;
+    SyncFileItemVector items;
+    items.swap(_completedItems);
+    emit itemsCompleted(items);
 }
 
 void SyncEngine::slotFinished(bool success)
 {
+    _metrics._propagationMs = _phaseTimer.elapsed();
+
     if (_propagator->_anotherSyncNeeded && _anotherSyncNeeded == NoFollowUpSync) {
         _anotherSyncNeeded = ImmediateFollowUp;
     }
+    _retryPaths = _propagator->_retryPaths;
+    if (!_retryPaths.isEmpty() && _anotherSyncNeeded == NoFollowUpSync) {
+        _anotherSyncNeeded = RetryFollowUp;
+    }
 
     if (success) {
         _journal->setDataFingerprint(_discoveryMainThread->_dataFingerprint);
+
+        for (auto it = _localDirectoryInfos.constBegin(); it != _localDirectoryInfos.constEnd(); ++it) {
+            _journal->setLocalDirectoryInfo(it.key(), it.value());
+        }
+    }
+    _localDirectoryInfos.clear();
+
+    // The records of the last items may still be queued, or failed in the writer
+    if (!_journal->flushFileRecords()) {
+        emit syncError(tr("Error writing metadata to the database"), ErrorCategory::Normal);
+        success = false;
     }
 
     // emit the treewalk results.
-    if (!_journal->postSyncCleanup(_seenFiles, _temporarilyUnavailablePaths)) {
+    std::sort(_seenFiles.begin(), _seenFiles.end());
+    _seenFiles.erase(std::unique(_seenFiles.begin(), _seenFiles.end()), _seenFiles.end());
+    if (!_journal->postSyncCleanup(_seenFiles, _temporarilyUnavailablePaths, _unchangedSubtrees)) {
         qCDebug(lcEngine) << "Cleaning of synced ";
     }
 
@@ -1140,32 +1430,85 @@ void SyncEngine::slotFinished(bool success)
     // so we don't count this twice (like Recent Files)
     _progressInfo->_lastCompletedItem = SyncFileItem();
     _progressInfo->_status = ProgressInfo::Done;
-    emit transmissionProgress(*_progressInfo);
+    emitProgress();
 
     finalize(success);
 }
 
 void SyncEngine::finalize(bool success)
 {
+    _progressTimer.stop();
+    _updateEstimatesTimer.stop();
     _thread.quit();
     _thread.wait();
 
-    _csync_ctx->reinitialize();
-    _journal->close();
+    if (InstanceCounts::isEnabled()) {
+        _metrics._peakFileStats = InstanceCounts::peak(InstanceCounts::FileStats);
+        _metrics._peakSyncFileItems = InstanceCounts::peak(InstanceCounts::SyncFileItems);
+        _metrics._peakProgressItems = InstanceCounts::peak(InstanceCounts::ProgressItems);
+    }
+    const auto cacheStats = _journal->lookupCacheStatistics();
+    _metrics._journalCachedRecords = cacheStats._cachedFileRecords + cacheStats._cachedErrorBlacklistEntries
+        + cacheStats._pendingFileRecords;
 
-    qCInfo(lcEngine) << "CSync run took " << _stopWatch.addLapTime(QLatin1String("Sync Finished")) << "ms";
+    reinitializeCsync();
+    if (success && !_syncOptions._dryRun) {
+        // Everything that was listed is in the file records now
+        _journal->clearDiscoveryListings();
+    }
+
+    _metrics._totalMs = _stopWatch.addLapTime(QLatin1String("Sync Finished"));
+    qCInfo(lcEngine) << "CSync run took " << _metrics._totalMs << "ms";
     _stopWatch.stop();
 
-    s_anySyncRunning = false;
+    _metrics._journalQueries = _journal->executedQueryCount() - _journalQueriesAtStart;
+    if (auto am = qobject_cast<AccessManager *>(account()->networkAccessManager())) {
+        const auto stats = am->takeRequestStats();
+        _metrics._networkRequests = stats.requests;
+        _metrics._http2Requests = stats.http2Requests;
+        _metrics._peakActiveRequests = stats.peakActiveRequests;
+        _metrics._newConnections = stats.newConnections;
+        _metrics._requestTimings = stats.timings;
+        // The wait is the server, the send and the receive the transfers
+        for (auto it = stats.timings.constBegin(); it != stats.timings.constEnd(); ++it) {
+            const QJsonObject timing = it.value().toJson();
+            qCInfo(lcEngine) << it.key().constData() << ":" << it.value().count() << "requests, median"
+                             << it.value().quantileMs(0.5) << "ms, p90" << it.value().quantileMs(0.9)
+                             << "ms, mean wait" << timing.value("meanWaitMs").toInt() << "ms";
+        }
+    }
+    _metrics._success = success;
+    // The history shows whether the syncs of the folder get slower
+    if (_journal->exists() && !_syncOptions._dryRun)
+        _journal->addSyncMetrics(QJsonDocument(_metrics.toJson()).toJson(QJsonDocument::Compact));
+    _journal->close();
+
+    // The spans of this sync go after the earlier ones, a trace covers the syncs of the process
+    if (Tracing::isEnabled())
+        Tracing::writeFile();
+    if (SessionRecorder::isEnabled())
+        SessionRecorder::writeFile(_metrics.toJson());
+
     _syncRunning = false;
+    flushCompletedItems();
+    emit syncMetrics(_metrics);
     emit finished(success);
 
     // Delete the propagator only after emitting the signal.
+    // Its jobs are QObjects and have to go on this thread, the items
+    // they held are the last references of _propagatedItems.
     _propagator.clear();
+    if (!_propagatedItems.isEmpty()) {
+        auto items = std::make_shared<SyncFileItemVector>();
+        items->swap(_propagatedItems);
+        QtConcurrent::run(&_teardownPool, [items] { items->clear(); });
+    }
     _seenFiles.clear();
     _temporarilyUnavailablePaths.clear();
+    _unchangedSubtrees.clear();
     _renamedFolders.clear();
     _uniqueErrors.clear();
+    _localDirectoryInfos.clear();
 
     _clearTouchedFilesTimer.start();
 }
@@ -1173,6 +1516,25 @@ void SyncEngine::finalize(bool success)
 void SyncEngine::slotProgress(const SyncFileItem &item, quint64 current)
 {
     _progressInfo->setProgressItem(item, current);
+    scheduleProgress();
+}
+
+void SyncEngine::scheduleProgress()
+{
+    const qint64 interval = _syncOptions._progressInterval;
+    if (interval <= 0 || !_lastProgressTime.isValid() || _lastProgressTime.elapsed() >= interval) {
+        emitProgress();
+    } else if (!_progressTimer.isActive()) {
+        // The newest state goes out when the interval is over
+        _progressTimer.start(int(interval - _lastProgressTime.elapsed()));
+    }
+}
+
+void SyncEngine::emitProgress()
+{
+    // Includes whatever was waiting for the timer
+    _progressTimer.stop();
+    _lastProgressTime.start();
     emit transmissionProgress(*_progressInfo);
 }
 
@@ -1180,6 +1542,9 @@ void SyncEngine::slotProgress(const SyncFileItem &item, quint64 current)
 /* Given a path on the remote, give the path as it is when the rename is done */
 QString SyncEngine::adjustRenamedPath(const QString &original)
 {
+    // Keeps sharing the string of the csync walk, and no lookup per parent
+    if (_renamedFolders.isEmpty())
+        return original;
     int slashPos = original.size();
     while ((slashPos = original.lastIndexOf('/', slashPos - 1)) > 0) {
         QHash<QString, QString>::const_iterator it = _renamedFolders.constFind(original.left(slashPos));
@@ -1200,7 +1565,20 @@ void SyncEngine::checkForPermission(SyncFileItemVector &syncItems)
     bool selectiveListOk;
     auto selectiveSyncBlackList = _journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList, &selectiveListOk);
     std::sort(selectiveSyncBlackList.begin(), selectiveSyncBlackList.end());
-    SyncFileItemPtr needle;
+
+    // The items are sorted, the items of a directory follow each other:
+    // the permissions of the last parent are looked up once for all of them
+    QString lastParentDir;
+    RemotePermissions lastParentPerms;
+    bool hasLastParent = false;
+    auto parentPermissions = [&](const QString &parentDir) {
+        if (!hasLastParent || parentDir != lastParentDir) {
+            lastParentDir = parentDir;
+            lastParentPerms = getPermissions(parentDir);
+            hasLastParent = true;
+        }
+        return lastParentPerms;
+    };
 
     for (SyncFileItemVector::iterator it = syncItems.begin(); it != syncItems.end(); ++it) {
         if ((*it)->_direction != SyncFileItem::Up) {
@@ -1219,44 +1597,34 @@ void SyncEngine::checkForPermission(SyncFileItemVector &syncItems)
             (*it)->_errorString = tr("Ignored because of the \"choose what to sync\" blacklist");
 
             if ((*it)->isDirectory()) {
-                auto it_base = it;
+                // The directories above the current item, the excluded one at the bottom:
+                // a directory is followed by its contents in the sorted vector
+                std::vector<SyncFileItemPtr> parents{ *it };
                 for (SyncFileItemVector::iterator it_next = it + 1; it_next != syncItems.end() && (*it_next)->_file.startsWith(path); ++it_next) {
                     it = it_next;
+                    while (parents.size() > 1 && !(*it)->_file.startsWith(parents.back()->destination() + QLatin1Char('/')))
+                        parents.pop_back();
+
                     // We want to ignore almost all instructions for items inside selective-sync excluded folders.
                     //The exception are DOWN/REMOVE actions that remove local files and folders that are
                     //guaranteed to be up-to-date with their server copies.
                     if ((*it)->_direction == SyncFileItem::Down && (*it)->_instruction == CSYNC_INSTRUCTION_REMOVE) {
                         // We need to keep the "delete" items. So we need to un-ignore parent directories
-                        QString parentDir = (*it)->_file;
-                        do {
-                            parentDir = QFileInfo(parentDir).path();
-                            if (parentDir.isEmpty() || !parentDir.startsWith((*it_base)->destination())) {
-                                break;
-                            }
-                            // Find the parent directory in the syncItems vector. Since the vector
-                            // is sorted we can use a lower_bound, but we need a fake
-                            // SyncFileItemPtr needle to compare against
-                            if (!needle)
-                                needle = SyncFileItemPtr::create();
-                            needle->_file = parentDir;
-                            auto parent_it = std::lower_bound(it_base, it, needle);
-                            if (parent_it == syncItems.end() || (*parent_it)->destination() != parentDir) {
-                                break;
-                            }
-                            ASSERT((*parent_it)->isDirectory());
-                            if ((*parent_it)->_instruction != CSYNC_INSTRUCTION_IGNORE) {
+                        for (auto parent = parents.rbegin(); parent != parents.rend(); ++parent) {
+                            if ((*parent)->_instruction != CSYNC_INSTRUCTION_IGNORE) {
                                 break; // already changed
                             }
-                            (*parent_it)->_instruction = CSYNC_INSTRUCTION_UPDATE_METADATA;
-                            (*parent_it)->_status = SyncFileItem::NoStatus;
-                            (*parent_it)->_errorString.clear();
-
-                        } while (true);
-                        continue;
+                            (*parent)->_instruction = CSYNC_INSTRUCTION_UPDATE_METADATA;
+                            (*parent)->_status = SyncFileItem::NoStatus;
+                            (*parent)->_errorString.clear();
+                        }
+                    } else {
+                        (*it)->_instruction = CSYNC_INSTRUCTION_IGNORE;
+                        (*it)->_status = SyncFileItem::FileIgnored;
+                        (*it)->_errorString = tr("Ignored because of the \"choose what to sync\" blacklist");
                     }
-                    (*it)->_instruction = CSYNC_INSTRUCTION_IGNORE;
-                    (*it)->_status = SyncFileItem::FileIgnored;
-                    (*it)->_errorString = tr("Ignored because of the \"choose what to sync\" blacklist");
+                    if ((*it)->isDirectory())
+                        parents.push_back(*it);
                 }
             }
             continue;
@@ -1267,7 +1635,7 @@ void SyncEngine::checkForPermission(SyncFileItemVector &syncItems)
         case CSYNC_INSTRUCTION_NEW: {
             int slashPos = (*it)->_file.lastIndexOf('/');
             QString parentDir = slashPos <= 0 ? "" : (*it)->_file.mid(0, slashPos);
-            const auto perms = getPermissions(parentDir);
+            const auto perms = parentPermissions(parentDir);
             if (perms.isNull()) {
                 // No permissions set
                 break;
@@ -1284,7 +1652,8 @@ void SyncEngine::checkForPermission(SyncFileItemVector &syncItems)
                         // If the file was read only or could not be moved or removed, it should
                         // be restored. Do that in the next sync by not considering as a rename
                         // but delete and upload. It will then be restored if needed.
-                        _journal->avoidRenamesOnNextSync((*it)->_file);
+                        if (!_syncOptions._dryRun)
+                            _journal->avoidRenamesOnNextSync((*it)->_file);
                         _anotherSyncNeeded = ImmediateFollowUp;
                         qCWarning(lcEngine) << "Moving of " << (*it)->_file << " canceled because no permission to add parent folder";
                     }
@@ -1386,7 +1755,7 @@ void SyncEngine::checkForPermission(SyncFileItemVector &syncItems)
         case CSYNC_INSTRUCTION_RENAME: {
             int slashPos = (*it)->_renameTarget.lastIndexOf('/');
             const QString parentDir = slashPos <= 0 ? "" : (*it)->_renameTarget.mid(0, slashPos);
-            const auto destPerms = getPermissions(parentDir);
+            const auto destPerms = parentPermissions(parentDir);
             const auto filePerms = getPermissions((*it)->_file);
 
             //true when it is just a rename in the same directory. (not a move)
@@ -1429,7 +1798,8 @@ void SyncEngine::checkForPermission(SyncFileItemVector &syncItems)
                 (*it)->_isRestoration = true;
                 qCWarning(lcEngine) << "checkForPermission: MOVING BACK" << (*it)->_file;
                 // in case something does wrong, we will not do it next time
-                _journal->avoidRenamesOnNextSync((*it)->_file);
+                if (!_syncOptions._dryRun)
+                    _journal->avoidRenamesOnNextSync((*it)->_file);
             } else
 #endif
                 if (!sourceOK || !destinationOK) {
@@ -1445,7 +1815,8 @@ void SyncEngine::checkForPermission(SyncFileItemVector &syncItems)
                 // TODO:  do the resolution now already so we don't need two sync
                 //  At this point we would need to go back to the propagate phase on both remote to take
                 //  the decision.
-                _journal->avoidRenamesOnNextSync((*it)->_file);
+                if (!_syncOptions._dryRun)
+                    _journal->avoidRenamesOnNextSync((*it)->_file);
                 _anotherSyncNeeded = ImmediateFollowUp;
 
 
@@ -1554,6 +1925,54 @@ void SyncEngine::slotClearTouchedFiles()
     _touchedFiles.clear();
 }
 
+QJsonObject SyncEngine::liveMetrics() const
+{
+    static const char *const phases[] = { "starting", "discovery", "reconcile", "propagation", "done" };
+    static_assert(sizeof(phases) / sizeof(phases[0]) == ProgressInfo::Done + 1,
+        "One name for each ProgressInfo::Status");
+
+    QJsonObject result;
+    result.insert(QStringLiteral("running"), _syncRunning);
+    result.insert(QStringLiteral("phase"), QLatin1String(phases[_progressInfo->_status]));
+    result.insert(QStringLiteral("elapsedMs"), _syncRunning ? _stopWatch.startTime().msecsTo(QDateTime::currentDateTime()) : 0);
+    result.insert(QStringLiteral("discoveredFolders"), _discoveredFolders);
+
+    // The queue of the propagator is what is left of the items
+    QJsonObject propagation;
+    propagation.insert(QStringLiteral("totalFiles"), double(_progressInfo->totalFiles()));
+    propagation.insert(QStringLiteral("completedFiles"), double(_progressInfo->completedFiles()));
+    propagation.insert(QStringLiteral("totalBytes"), double(_progressInfo->totalSize()));
+    propagation.insert(QStringLiteral("completedBytes"), double(_progressInfo->completedSize()));
+    if (_progressInfo->isUpdatingEstimates())
+        propagation.insert(QStringLiteral("bytesPerSecond"), double(_progressInfo->totalProgress().estimatedBandwidth));
+    propagation.insert(QStringLiteral("concurrencyLimit"), _progressInfo->_concurrency.limit);
+    if (_propagator) {
+        propagation.insert(QStringLiteral("activeJobs"), _propagator->_activeJobList.count());
+        propagation.insert(QStringLiteral("activeBulkTransfers"), _propagator->_activeJobList.bulkTransferCount());
+    }
+    result.insert(QStringLiteral("propagation"), propagation);
+
+    if (auto am = qobject_cast<AccessManager *>(account()->networkAccessManager())) {
+        const auto &stats = am->requestStats();
+        QJsonObject network;
+        network.insert(QStringLiteral("activeRequests"), am->activeRequests());
+        network.insert(QStringLiteral("requests"), stats.requests);
+        network.insert(QStringLiteral("http2Requests"), stats.http2Requests);
+        network.insert(QStringLiteral("newConnections"), stats.newConnections);
+        result.insert(QStringLiteral("network"), network);
+    }
+
+    const auto cacheStats = _journal->lookupCacheStatistics();
+    QJsonObject journal;
+    journal.insert(QStringLiteral("queries"), _journal->executedQueryCount() - _journalQueriesAtStart);
+    journal.insert(QStringLiteral("fileRecordHits"), cacheStats._fileRecordHits);
+    journal.insert(QStringLiteral("fileRecordMisses"), cacheStats._fileRecordMisses);
+    journal.insert(QStringLiteral("cachedFileRecords"), cacheStats._cachedFileRecords);
+    journal.insert(QStringLiteral("pendingFileRecords"), cacheStats._pendingFileRecords);
+    result.insert(QStringLiteral("journal"), journal);
+    return result;
+}
+
 bool SyncEngine::wasFileTouched(const QString &fn) const
 {
     // Start from the end (most recent) and look for our path. Check the time just in case.
@@ -1565,6 +1984,14 @@ bool SyncEngine::wasFileTouched(const QString &fn) const
     return false;
 }
 
+void SyncEngine::noteLocalChange(const QString &relativePath)
+{
+    const qint64 now = _localChangeClock.elapsed();
+    _localChanges.insert(relativePath, now);
+    if (_propagator)
+        _propagator->_localChanges.insert(relativePath, now);
+}
+
 AccountPtr SyncEngine::account() const
 {
     return _account;
@@ -1576,6 +2003,11 @@ void SyncEngine::setLocalDiscoveryOptions(LocalDiscoveryStyle style, std::set<QB
     _csync_ctx->locally_touched_dirs = std::move(dirs);
 }
 
+void SyncEngine::setRemoteDiscoveryPaths(std::set<QByteArray> paths)
+{
+    _csync_ctx->remote_discovery_paths = std::move(paths);
+}
+
 void SyncEngine::abort()
 {
     if (_propagator)
@@ -1594,6 +2026,15 @@ void SyncEngine::abort()
     }
 }
 
+void SyncEngine::setPaused(bool paused)
+{
+    if (paused == _paused)
+        return;
+    _paused = paused;
+    if (_propagator)
+        _propagator->setPaused(paused);
+}
+
 void SyncEngine::slotSummaryError(const QString &message)
 {
     if (_uniqueErrors.contains(message))
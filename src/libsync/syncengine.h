@@ -23,9 +23,12 @@
 #include <QString>
 #include <QSet>
 #include <QMap>
+#include <QHash>
 #include <QStringList>
 #include <QSharedPointer>
+#include <QThreadPool>
 #include <set>
+#include <vector>
 
 #include <csync.h>
 
@@ -38,6 +41,7 @@
 #include "syncfilestatustracker.h"
 #include "accountfwd.h"
 #include "discoveryphase.h"
+#include "syncrunmetrics.h"
 #include "common/checksums.h"
 
 class QProcess;
@@ -51,7 +55,9 @@ class OwncloudPropagator;
 enum AnotherSyncNeeded {
     NoFollowUpSync,
     ImmediateFollowUp, // schedule this again immediately (limited amount of times)
-    DelayedFollowUp // regularly schedule this folder again (around 1/minute, unlimited)
+    DelayedFollowUp, // regularly schedule this folder again (around 1/minute, unlimited)
+    BatchFollowUp, // discovery left folders for the next sync, schedule it immediately (unlimited)
+    RetryFollowUp // only the items of SyncEngine::retryPaths() need another attempt
 };
 
 /**
@@ -74,9 +80,17 @@ public:
     /* Abort the sync.  Called from the main thread */
     void abort();
 
+    /**
+     * Holds the propagation without aborting it: no jobs are started and the
+     * transfers stay connected without moving data. The discovery goes on.
+     */
+    void setPaused(bool paused);
+    bool isPaused() const { return _paused; }
+
     bool isSyncRunning() const { return _syncRunning; }
 
     void setSyncOptions(const SyncOptions &options) { _syncOptions = options; }
+    const SyncOptions &syncOptions() const { return _syncOptions; }
     bool ignoreHiddenFiles() const { return _csync_ctx->ignore_hidden_files; }
     void setIgnoreHiddenFiles(bool ignore) { _csync_ctx->ignore_hidden_files = ignore; }
 
@@ -87,11 +101,30 @@ public:
     /* Returns whether another sync is needed to complete the sync */
     AnotherSyncNeeded isAnotherSyncNeeded() { return _anotherSyncNeeded; }
 
+    /** The files the last sync wants to try again, see OwncloudPropagator::retryInNextSync() */
+    const QSet<QString> &retryPaths() const { return _retryPaths; }
+
+    /**
+     * The counters of the running sync, for monitoring.
+     *
+     * Unlike the SyncRunMetrics of syncMetrics(), they can be read at any
+     * time. The network and journal counters are since the sync started.
+     */
+    QJsonObject liveMetrics() const;
+
     bool wasFileTouched(const QString &fn) const;
 
+    /**
+     * The file watcher saw the file at @a relativePath change. Its upload
+     * waits until it was left alone for SyncOptions::_uploadStabilityMsec,
+     * also in a sync that is already running.
+     */
+    void noteLocalChange(const QString &relativePath);
+
     AccountPtr account() const;
     SyncJournalDb *journal() const { return _journal; }
     QString localPath() const { return _localPath; }
+    QString remotePath() const { return _remotePath; }
 
     /**
      * Minimum age, in milisecond, of a file that can be uploaded.
@@ -113,21 +146,45 @@ public:
      */
     void setLocalDiscoveryOptions(LocalDiscoveryStyle style, std::set<QByteArray> dirs = {});
 
+    /**
+     * Restricts the remote discovery of the next sync to @a paths, relative
+     * to the synced folder, their parents and their contents.
+     *
+     * The changes elsewhere are left for a later sync without paths. The
+     * rootEtag() is then not emitted, the etag of the folder doesn't
+     * look up to date.
+     */
+    void setRemoteDiscoveryPaths(std::set<QByteArray> paths);
+
     /** Access the last sync run's local discovery style */
     LocalDiscoveryStyle lastLocalDiscoveryStyle() const { return _lastLocalDiscoveryStyle; }
 
+    /** Timings and counters of the last or current sync run */
+    const SyncRunMetrics &syncRunMetrics() const { return _metrics; }
+
 signals:
     void csyncUnavailable();
 
     // During update, before reconcile
     void rootEtag(QString);
 
+    // After the update, if the listing of the remote root had the quota properties
+    void rootQuota(qint64 usedBytes, qint64 availableBytes);
+
     // after the above signals. with the items that actually need propagating
     void aboutToPropagate(SyncFileItemVector &);
 
     // after each item completed by a job (successful or not)
     void itemCompleted(const SyncFileItemPtr &);
 
+    /** The items of itemCompleted() in batches, for the consumers that don't need each
+     * right away. The last batch is delivered before syncMetrics() and finished().
+     */
+    void itemsCompleted(const SyncFileItemVector &items);
+
+    // right before finished(), with the timings and counters of the run
+    void syncMetrics(const SyncRunMetrics &metrics);
+
     void transmissionProgress(const ProgressInfo &progress);
 
     /// We've produced a new sync error of a type.
@@ -203,15 +260,30 @@ private:
     // cleanup and emit the finished signal
     void finalize(bool success);
 
-    static bool s_anySyncRunning; //true when one sync is running somewhere (for debugging)
+    // Reinitializes the csync context, its trees are freed on _teardownPool
+    void reinitializeCsync();
+
+    // Emits transmissionProgress, at most once per SyncOptions::_progressInterval
+    void scheduleProgress();
+    // Emits transmissionProgress now
+    void emitProgress();
+
+    // Emits itemCompleted, and itemsCompleted once enough items were collected
+    void appendCompletedItem(const SyncFileItemPtr &item);
+    // Emits itemsCompleted with the collected items
+    void flushCompletedItems();
 
-    // Must only be acessed during update and reconcile
-    QMap<QString, SyncFileItemPtr> _syncItemMap;
+
+    // Must only be acessed during update and reconcile: the items of the tree
+    // walks, and their index by path for merging the remote walk into the local one
+    SyncFileItemVector _syncItems;
+    QHash<QString, int> _syncItemIndex;
 
     AccountPtr _account;
     QScopedPointer<CSYNC> _csync_ctx;
     bool _needsUpdate;
     bool _syncRunning;
+    bool _paused = false;
     QString _localPath;
     QString _remotePath;
     QString _remoteRootEtag;
@@ -219,9 +291,18 @@ private:
     QPointer<DiscoveryMainThread> _discoveryMainThread;
     QSharedPointer<OwncloudPropagator> _propagator;
 
-    // After a sync, only the syncdb entries whose filenames appear in this
-    // set will be kept. See _temporarilyUnavailablePaths.
-    QSet<QString> _seenFiles;
+    // The items of the run, freed on _teardownPool after the propagator
+    SyncFileItemVector _propagatedItems;
+
+    // Frees the trees and items of the finished runs, millions of
+    // allocations would block the main thread for seconds
+    QThreadPool _teardownPool;
+
+    // After a sync, only the syncdb entries whose phash appears in this
+    // list will be kept. See _temporarilyUnavailablePaths.
+    // Just the hashes since with millions of files a set of the paths
+    // would take hundreds of MB.
+    std::vector<qint64> _seenFiles;
 
     // Some paths might be temporarily unavailable on the server, for
     // example due to 503 Storage not available. Deleting information
@@ -233,6 +314,10 @@ private:
     // while the remote says storage not available.
     QSet<QString> _temporarilyUnavailablePaths;
 
+    // Sorted folder paths with a trailing slash whose contents were
+    // unchanged and dropped during discovery. Their syncdb entries are kept.
+    QStringList _unchangedSubtrees;
+
     QThread _thread;
 
     QScopedPointer<ProgressInfo> _progressInfo;
@@ -241,6 +326,12 @@ private:
     QScopedPointer<SyncFileStatusTracker> _syncFileStatusTracker;
     Utility::StopWatch _stopWatch;
 
+    SyncRunMetrics _metrics;
+    QElapsedTimer _phaseTimer; // restarted when a phase of _metrics begins
+    int _journalQueriesAtStart = 0;
+    /// The folders the discovery finished so far, see liveMetrics()
+    qint64 _discoveredFolders = 0;
+
     // maps the origin and the target of the folders that have been renamed
     QHash<QString, QString> _renamedFolders;
     QString adjustRenamedPath(const QString &original);
@@ -278,18 +369,41 @@ private:
     CSyncChecksumHook _checksum_hook;
 
     AnotherSyncNeeded _anotherSyncNeeded;
+    QSet<QString> _retryPaths;
 
     /** Stores the time since a job touched a file. */
     QMultiMap<QElapsedTimer, QString> _touchedFiles;
 
+    /** When noteLocalChange() was last called for a path, in msecs of _localChangeClock */
+    QHash<QString, qint64> _localChanges;
+    QElapsedTimer _localChangeClock;
+
     /** For clearing the _touchedFiles variable after sync finished */
     QTimer _clearTouchedFilesTimer;
 
+    /** Delivers the progress that scheduleProgress() held back */
+    QTimer _progressTimer;
+    /** Updates the estimates of _progressInfo every second during propagation */
+    QTimer _updateEstimatesTimer;
+    QElapsedTimer _lastProgressTime;
+
+    /** The completed items that itemsCompleted didn't deliver yet */
+    SyncFileItemVector _completedItems;
+    QTimer _completedItemsTimer;
+
     /** List of unique errors that occurred in a sync run. */
     QSet<QString> _uniqueErrors;
 
     /** The kind of local discovery the last sync run used */
     LocalDiscoveryStyle _lastLocalDiscoveryStyle = LocalDiscoveryStyle::DatabaseAndFilesystem;
+
+    /**
+     * Local directories that were listed from the filesystem in this run.
+     *
+     * Stored in the journal if the sync succeeds, except for the parents of
+     * items that failed. See LocalDiscoveryStyle::DirectoryModtime.
+     */
+    QHash<QByteArray, SyncJournalDb::LocalDirectoryInfo> _localDirectoryInfos;
 };
 }
 
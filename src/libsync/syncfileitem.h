@@ -19,9 +19,11 @@
 #include <QString>
 #include <QDateTime>
 #include <QMetaType>
+#include <QSharedDataPointer>
 #include <QSharedPointer>
 
 #include <csync.h>
+#include "common/instancecounter.h"
 
 namespace OCC {
 
@@ -33,7 +35,7 @@ typedef QSharedPointer<SyncFileItem> SyncFileItemPtr;
  * @brief The SyncFileItem class
  * @ingroup libsync
  */
-class SyncFileItem
+class SyncFileItem : private InstanceCounted<InstanceCounts::SyncFileItems>
 {
 public:
     enum Direction {
@@ -46,7 +48,9 @@ public:
         UnknownType = 0,
         File = CSYNC_FTW_TYPE_FILE,
         Directory = CSYNC_FTW_TYPE_DIR,
-        SoftLink = CSYNC_FTW_TYPE_SLINK
+        SoftLink = CSYNC_FTW_TYPE_SLINK,
+        VirtualFile = CSYNC_FTW_TYPE_VIRTUAL_FILE,
+        VirtualFileDownload = CSYNC_FTW_TYPE_VIRTUAL_FILE_DOWNLOAD
     };
 
     enum Status { // stored in 4 bits
@@ -87,7 +91,14 @@ public:
          *
          * A DetailError that doesn't cause sync failure.
          */
-        BlacklistedError
+        BlacklistedError,
+
+        /** The transfer was left for a later sync, see SyncOptions::_constrainedNetwork
+         *
+         * Neither an error nor a success: the file keeps its old record and the
+         * next sync finds it again.
+         */
+        Deferred
     };
 
     SyncJournalFileRecord toSyncJournalFileRecordWithInode(const QString &localFileName);
@@ -176,6 +187,27 @@ public:
         return _type == SyncFileItem::Directory;
     }
 
+    /** The url the server gave to download the file from, most items have none */
+    QString directDownloadUrl() const
+    {
+        return _directDownload ? _directDownload->url : QString();
+    }
+    QString directDownloadCookies() const
+    {
+        return _directDownload ? _directDownload->cookies : QString();
+    }
+    void setDirectDownload(const QString &url, const QString &cookies)
+    {
+        if (url.isEmpty() && cookies.isEmpty()) {
+            _directDownload = QSharedDataPointer<DirectDownload>();
+            return;
+        }
+        if (!_directDownload)
+            _directDownload = new DirectDownload;
+        _directDownload->url = url;
+        _directDownload->cookies = cookies;
+    }
+
     /**
      * True if the item had any kind of error.
      *
@@ -242,8 +274,14 @@ public:
     quint64 _previousSize;
     time_t _previousModtime;
 
-    QString _directDownloadUrl;
-    QString _directDownloadCookies;
+private:
+    // Rarely set, allocated on demand to keep the items of a large sync small
+    struct DirectDownload : public QSharedData
+    {
+        QString url;
+        QString cookies;
+    };
+    QSharedDataPointer<DirectDownload> _directDownload;
 };
 
 inline bool operator<(const SyncFileItemPtr &item1, const SyncFileItemPtr &item2)
@@ -37,46 +37,100 @@ static int pathCompare( const QString& lhs, const QString& rhs )
         );
 }
 
-static bool pathStartsWith( const QString& lhs, const QString& rhs )
-{
-    return lhs.startsWith(rhs,
-#if defined(Q_OS_WIN) || defined(Q_OS_MAC)
-        Qt::CaseInsensitive
-#else
-        Qt::CaseSensitive
-#endif
-        );
-}
-
 bool SyncFileStatusTracker::PathComparator::operator()( const QString& lhs, const QString& rhs ) const
 {
     // This will make sure that the std::map is ordered and queried case-insensitively on macOS and Windows.
     return pathCompare(lhs, rhs) < 0;
 }
 
-SyncFileStatus::SyncFileStatusTag SyncFileStatusTracker::lookupProblem(const QString &pathToMatch, const SyncFileStatusTracker::ProblemsMap &problemMap)
+/// Calls @a f with every node of the tree below @a node and its path, parents first
+template <typename Node, typename F>
+static void forEachNode(Node *node, const QString &path, F f)
+{
+    f(node, path);
+    for (const auto &child : node->children) {
+        forEachNode(child.second.get(), path.isEmpty() ? child.first : path + QLatin1Char('/') + child.first, f);
+    }
+}
+
+SyncFileStatusTracker::PathNode *SyncFileStatusTracker::findNode(const QString &path)
 {
-    auto lower = problemMap.lower_bound(pathToMatch);
-    for (auto it = lower; it != problemMap.cend(); ++it) {
-        const QString &problemPath = it->first;
-        SyncFileStatus::SyncFileStatusTag severity = it->second;
-
-        if (pathCompare(problemPath, pathToMatch) == 0) {
-            return severity;
-        } else if (severity == SyncFileStatus::StatusError
-            && pathStartsWith(problemPath, pathToMatch)
-            && (pathToMatch.isEmpty() || problemPath.at(pathToMatch.size()) == '/')) {
-            return SyncFileStatus::StatusWarning;
-        } else if (!pathStartsWith(problemPath, pathToMatch)) {
-            // Starting at lower_bound we get the first path that is not smaller,
-            // since: "a/" < "a/aa" < "a/aa/aaa" < "a/ab/aba"
-            // If problemMap keys are ["a/aa/aaa", "a/ab/aba"] and pathToMatch == "a/aa",
-            // lower_bound(pathToMatch) will point to "a/aa/aaa", and the moment that
-            // problemPath.startsWith(pathToMatch) == false, we know that we've looked
-            // at everything that interest us.
-            break;
+    PathNode *node = &_root;
+    int start = 0;
+    while (node && start < path.size()) {
+        int end = path.indexOf(QLatin1Char('/'), start);
+        if (end == -1)
+            end = path.size();
+        // Only for the lookup, no need to copy the name
+        auto it = node->children.find(QString::fromRawData(path.constData() + start, end - start));
+        node = it == node->children.end() ? nullptr : it->second.get();
+        start = end + 1;
+    }
+    return node;
+}
+
+SyncFileStatusTracker::PathNode *SyncFileStatusTracker::findOrCreateNode(const QString &path)
+{
+    PathNode *node = &_root;
+    int start = 0;
+    while (start < path.size()) {
+        int end = path.indexOf(QLatin1Char('/'), start);
+        if (end == -1)
+            end = path.size();
+        const QString rawName = QString::fromRawData(path.constData() + start, end - start);
+        auto it = node->children.find(rawName);
+        if (it == node->children.end()) {
+            // The node keeps a copy, the raw name points into path
+            const QString name(rawName.constData(), rawName.size());
+            auto child = new PathNode;
+            child->name = name;
+            child->parent = node;
+            it = node->children.emplace(name, std::unique_ptr<PathNode>(child)).first;
         }
+        node = it->second.get();
+        start = end + 1;
     }
+    return node;
+}
+
+QString SyncFileStatusTracker::nodePath(const PathNode *node) const
+{
+    QStringList names;
+    for (; node != &_root; node = node->parent)
+        names.prepend(node->name);
+    return names.join(QLatin1Char('/'));
+}
+
+void SyncFileStatusTracker::pruneNode(PathNode *node)
+{
+    while (node != &_root && node->isUnused()) {
+        PathNode *parent = node->parent;
+        parent->children.erase(node->name);
+        node = parent;
+    }
+}
+
+void SyncFileStatusTracker::setProblem(const QString &path, SyncFileStatus::SyncFileStatusTag problem)
+{
+    PathNode *node = problem == SyncFileStatus::StatusNone ? findNode(path) : findOrCreateNode(path);
+    if (!node || node->problem == problem)
+        return;
+    const int errorDelta = (problem == SyncFileStatus::StatusError) - (node->problem == SyncFileStatus::StatusError);
+    node->problem = problem;
+    for (PathNode *parent = node->parent; parent; parent = parent->parent)
+        parent->errorsBelow += errorDelta;
+    pruneNode(node);
+}
+
+SyncFileStatus::SyncFileStatusTag SyncFileStatusTracker::lookupProblem(const QString &pathToMatch)
+{
+    const PathNode *node = findNode(pathToMatch);
+    if (!node)
+        return SyncFileStatus::StatusNone;
+    if (node->problem != SyncFileStatus::StatusNone)
+        return node->problem;
+    if (node->errorsBelow > 0)
+        return SyncFileStatus::StatusWarning;
     return SyncFileStatus::StatusNone;
 }
 
@@ -135,8 +189,8 @@ SyncFileStatus SyncFileStatusTracker::fileStatus(const QString &relativePath)
     // update the exclude list at runtime and doing it statically here removes
     // our ability to notify changes through the fileStatusChanged signal,
     // it's an acceptable compromize to treat all exclude types the same.
-    if (_syncEngine->excludedFiles().isExcluded(_syncEngine->localPath() + relativePath,
-            _syncEngine->localPath(),
+    if (_syncEngine->excludedFiles().isExcludedRelative(_syncEngine->localPath(),
+            relativePath,
             _syncEngine->ignoreHiddenFiles())) {
         return SyncFileStatus(SyncFileStatus::StatusWarning);
     }
@@ -146,7 +200,7 @@ SyncFileStatus SyncFileStatusTracker::fileStatus(const QString &relativePath)
 
     // First look it up in the database to know if it's shared
     SyncJournalFileRecord rec;
-    if (_syncEngine->journal()->getFileRecord(relativePath, &rec) && rec.isValid()) {
+    if (_syncEngine->journal()->getFileRecordReadOnly(relativePath, &rec) && rec.isValid()) {
         return resolveSyncAndErrorStatus(relativePath, rec._remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared);
     }
 
@@ -162,100 +216,164 @@ void SyncFileStatusTracker::slotPathTouched(const QString &fileName)
     QString localPath = fileName.mid(folderPath.size());
     _dirtyPaths.insert(localPath);
 
-    emit fileStatusChanged(fileName, SyncFileStatus::StatusSync);
+    emitStatus(localPath, SyncFileStatus::StatusSync);
 }
 
-void SyncFileStatusTracker::incSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedFlag)
+void SyncFileStatusTracker::emitStatus(const QString &relativePath, SyncFileStatus status, PathKind kind)
 {
-    // Will return 0 (and increase to 1) if the path wasn't in the map yet
-    int count = _syncCount[relativePath]++;
-    if (!count) {
-        SyncFileStatus status = sharedFlag == UnknownShared
-            ? fileStatus(relativePath)
-            : resolveSyncAndErrorStatus(relativePath, sharedFlag);
-        emit fileStatusChanged(getSystemDestination(relativePath), status);
-
-        // We passed from OK to SYNC, increment the parent to keep it marked as
-        // SYNC while we propagate ourselves and our own children.
-        ASSERT(!relativePath.endsWith('/'));
-        int lastSlashIndex = relativePath.lastIndexOf('/');
-        if (lastSlashIndex != -1)
-            incSyncCountAndEmitStatusChanged(relativePath.left(lastSlashIndex), UnknownShared);
-        else if (!relativePath.isEmpty())
-            incSyncCountAndEmitStatusChanged(QString(), UnknownShared);
+    auto it = _directoryStatuses.find(relativePath);
+    if (it != _directoryStatuses.end()) {
+        if (*it == status)
+            return;
+        *it = status;
+    } else if (kind == DirectoryPath && _propagating) {
+        _directoryStatuses.insert(relativePath, status);
     }
+    emit fileStatusChanged(getSystemDestination(relativePath), status);
 }
 
-void SyncFileStatusTracker::decSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedFlag)
+static QString parentPath(const QString &path)
 {
-    int count = --_syncCount[relativePath];
-    if (!count) {
-        // Remove from the map, same as 0
-        _syncCount.remove(relativePath);
+    int lastSlashIndex = path.lastIndexOf(QLatin1Char('/'));
+    return lastSlashIndex == -1 ? QString() : path.left(lastSlashIndex);
+}
 
+void SyncFileStatusTracker::decSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedFlag)
+{
+    ASSERT(!relativePath.endsWith('/'));
+    PathNode *leaf = findOrCreateNode(relativePath);
+    PathNode *node = leaf;
+    QString path = relativePath;
+    // We passed from SYNC to OK, decrement our parent.
+    while (node && --node->syncCount == 0) {
         SyncFileStatus status = sharedFlag == UnknownShared
-            ? fileStatus(relativePath)
-            : resolveSyncAndErrorStatus(relativePath, sharedFlag);
-        emit fileStatusChanged(getSystemDestination(relativePath), status);
-
-        // We passed from SYNC to OK, decrement our parent.
-        ASSERT(!relativePath.endsWith('/'));
-        int lastSlashIndex = relativePath.lastIndexOf('/');
-        if (lastSlashIndex != -1)
-            decSyncCountAndEmitStatusChanged(relativePath.left(lastSlashIndex), UnknownShared);
-        else if (!relativePath.isEmpty())
-            decSyncCountAndEmitStatusChanged(QString(), UnknownShared);
+            ? fileStatus(path)
+            : resolveSyncAndErrorStatus(path, sharedFlag);
+        emitStatus(path, status, node == leaf ? FilePath : DirectoryPath);
+
+        node = node->parent;
+        path = parentPath(path);
+        sharedFlag = UnknownShared;
     }
+    pruneNode(leaf);
 }
 
 void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector &items)
 {
-    ASSERT(_syncCount.isEmpty());
-
-    ProblemsMap oldProblems;
-    std::swap(_syncProblems, oldProblems);
+    ASSERT(_root.syncCount == 0);
+    _directoryStatuses.clear();
+    _propagating = true;
+
+    // Start over with the problems of this sync
+    QVector<QPair<QString, SyncFileStatus::SyncFileStatusTag>> oldProblems;
+    forEachNode(&_root, QString(), [&](PathNode *node, const QString &path) {
+        if (node->problem != SyncFileStatus::StatusNone)
+            oldProblems.append(qMakePair(path, node->problem));
+        node->problem = SyncFileStatus::StatusNone;
+        node->errorsBelow = 0;
+    });
+    for (const auto &problem : oldProblems) {
+        if (PathNode *node = findNode(problem.first))
+            pruneNode(node);
+    }
 
+    // The sync counts are aggregated first, so that every path is reported
+    // once with its final status rather than for every item below it.
+    QVector<QPair<const SyncFileItem *, PathNode *>> propagatedItems;
+    QVector<const SyncFileItem *> otherItems;
+    QVector<const SyncFileItem *> errorItems;
+    QVector<PathNode *> syncingNodes;
     foreach (const SyncFileItemPtr &item, items) {
         qCDebug(lcStatusTracker) << "Investigating" << item->destination() << item->_status << item->_instruction;
         _dirtyPaths.remove(item->destination());
 
         if (showErrorInSocketApi(*item)) {
-            _syncProblems[item->_file] = SyncFileStatus::StatusError;
-            invalidateParentPaths(item->destination());
+            setProblem(item->_file, SyncFileStatus::StatusError);
+            errorItems.append(item.data());
         } else if (showWarningInSocketApi(*item)) {
-            _syncProblems[item->_file] = SyncFileStatus::StatusWarning;
+            setProblem(item->_file, SyncFileStatus::StatusWarning);
         }
 
-        SharedFlag sharedFlag = item->_remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared;
         if (item->_instruction != CSYNC_INSTRUCTION_NONE
             && item->_instruction != CSYNC_INSTRUCTION_UPDATE_METADATA
             && item->_instruction != CSYNC_INSTRUCTION_IGNORE
             && item->_instruction != CSYNC_INSTRUCTION_ERROR) {
             // Mark this path as syncing for instructions that will result in propagation.
-            incSyncCountAndEmitStatusChanged(item->destination(), sharedFlag);
+            PathNode *node = findOrCreateNode(item->destination());
+            if (node->syncCount++ == 0)
+                syncingNodes.append(node);
+            propagatedItems.append(qMakePair(item.data(), node));
         } else {
-            emit fileStatusChanged(getSystemDestination(item->destination()), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
+            otherItems.append(item.data());
         }
     }
 
+    // A count that was 0 means we passed from OK to SYNC, increment the parent
+    // to keep it marked as SYNC while we propagate ourselves and our own children.
+    // Every node is in the list once, the ones added are handled in turn.
+    for (int i = 0; i < syncingNodes.size(); ++i) {
+        PathNode *parent = syncingNodes.at(i)->parent;
+        if (parent && parent->syncCount++ == 0)
+            syncingNodes.append(parent);
+    }
+
+    QSet<const PathNode *> reportedNodes;
+    for (const auto &propagated : propagatedItems) {
+        if (reportedNodes.contains(propagated.second))
+            continue;
+        reportedNodes.insert(propagated.second);
+        const SyncFileItem *item = propagated.first;
+        SyncFileStatus status(SyncFileStatus::StatusSync);
+        status.setShared(item->_remotePerm.hasPermission(RemotePermissions::IsShared));
+        emitStatus(item->destination(), status);
+    }
+    for (const SyncFileItem *item : otherItems) {
+        const QString &destination = item->destination();
+        const PathNode *node = findNode(destination);
+        const bool hasSyncingChildren = node && node->syncCount > 0;
+        if (hasSyncingChildren) {
+            if (reportedNodes.contains(node))
+                continue;
+            reportedNodes.insert(node);
+        }
+        SharedFlag sharedFlag = item->_remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared;
+        emitStatus(destination, resolveSyncAndErrorStatus(destination, sharedFlag),
+            hasSyncingChildren ? DirectoryPath : FilePath);
+    }
+    // The parent directories that have no item of their own
+    for (const PathNode *node : syncingNodes) {
+        if (reportedNodes.contains(node))
+            continue;
+        const QString path = nodePath(node);
+        emitStatus(path, fileStatus(path), DirectoryPath);
+    }
+    for (const SyncFileItem *item : errorItems)
+        invalidateParentPaths(item->destination());
+
     // Some metadata status won't trigger files to be synced, make sure that we
     // push the OK status for dirty files that don't need to be propagated.
     // Swap into a copy since fileStatus() reads _dirtyPaths to determine the status
     QSet<QString> oldDirtyPaths;
     std::swap(_dirtyPaths, oldDirtyPaths);
-    for (auto it = oldDirtyPaths.constBegin(); it != oldDirtyPaths.constEnd(); ++it)
-        emit fileStatusChanged(getSystemDestination(*it), fileStatus(*it));
+    for (auto it = oldDirtyPaths.constBegin(); it != oldDirtyPaths.constEnd(); ++it) {
+        // They were shown as SYNC since they were touched
+        const SyncFileStatus status = fileStatus(*it);
+        if (status.tag() != SyncFileStatus::StatusSync)
+            emitStatus(*it, status);
+    }
 
     // Make sure to push any status that might have been resolved indirectly since the last sync
     // (like an error file being deleted from disk)
-    for (auto it = _syncProblems.begin(); it != _syncProblems.end(); ++it)
-        oldProblems.erase(it->first);
-    for (auto it = oldProblems.begin(); it != oldProblems.end(); ++it) {
-        const QString &path = it->first;
-        SyncFileStatus::SyncFileStatusTag severity = it->second;
-        if (severity == SyncFileStatus::StatusError)
+    for (const auto &problem : oldProblems) {
+        const QString &path = problem.first;
+        const PathNode *node = findNode(path);
+        if (node && node->problem != SyncFileStatus::StatusNone)
+            continue;
+        if (problem.second == SyncFileStatus::StatusError)
             invalidateParentPaths(path);
-        emit fileStatusChanged(getSystemDestination(path), fileStatus(path));
+        const SyncFileStatus status = fileStatus(path);
+        if (status.tag() != problem.second)
+            emitStatus(path, status);
     }
 }
 
@@ -264,12 +382,12 @@ void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
     qCDebug(lcStatusTracker) << "Item completed" << item->destination() << item->_status << item->_instruction;
 
     if (showErrorInSocketApi(*item)) {
-        _syncProblems[item->_file] = SyncFileStatus::StatusError;
+        setProblem(item->_file, SyncFileStatus::StatusError);
         invalidateParentPaths(item->destination());
     } else if (showWarningInSocketApi(*item)) {
-        _syncProblems[item->_file] = SyncFileStatus::StatusWarning;
+        setProblem(item->_file, SyncFileStatus::StatusWarning);
     } else {
-        _syncProblems.erase(item->_file);
+        setProblem(item->_file, SyncFileStatus::StatusNone);
     }
 
     SharedFlag sharedFlag = item->_remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared;
@@ -277,25 +395,36 @@ void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
         && item->_instruction != CSYNC_INSTRUCTION_UPDATE_METADATA
         && item->_instruction != CSYNC_INSTRUCTION_IGNORE
         && item->_instruction != CSYNC_INSTRUCTION_ERROR) {
-        // decSyncCount calls *must* be symetric with incSyncCount calls in slotAboutToPropagate
+        // decSyncCount calls *must* be symetric with the sync counts of slotAboutToPropagate
         decSyncCountAndEmitStatusChanged(item->destination(), sharedFlag);
     } else {
-        emit fileStatusChanged(getSystemDestination(item->destination()), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
+        emitStatus(item->destination(), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
     }
 }
 
 void SyncFileStatusTracker::slotSyncFinished()
 {
     // Clear the sync counts to reduce the impact of unsymetrical inc/dec calls (e.g. when directory job abort)
-    QHash<QString, int> oldSyncCount;
-    std::swap(_syncCount, oldSyncCount);
-    for (auto it = oldSyncCount.begin(); it != oldSyncCount.end(); ++it)
-        emit fileStatusChanged(getSystemDestination(it.key()), fileStatus(it.key()));
+    QStringList syncingPaths;
+    forEachNode(&_root, QString(), [&](PathNode *node, const QString &path) {
+        if (node->syncCount != 0)
+            syncingPaths.append(path);
+        node->syncCount = 0;
+    });
+    for (const QString &path : syncingPaths) {
+        if (PathNode *node = findNode(path))
+            pruneNode(node);
+    }
+    for (const QString &path : syncingPaths)
+        emitStatus(path, fileStatus(path));
+
+    _propagating = false;
+    _directoryStatuses.clear();
 }
 
 void SyncFileStatusTracker::slotSyncEngineRunningChanged()
 {
-    emit fileStatusChanged(getSystemDestination(QString()), resolveSyncAndErrorStatus(QString(), NotShared));
+    emitStatus(QString(), resolveSyncAndErrorStatus(QString(), NotShared), DirectoryPath);
 }
 
 SyncFileStatus SyncFileStatusTracker::resolveSyncAndErrorStatus(const QString &relativePath, SharedFlag sharedFlag, PathKnownFlag isPathKnown)
@@ -303,12 +432,13 @@ SyncFileStatus SyncFileStatusTracker::resolveSyncAndErrorStatus(const QString &r
     // If it's a new file and that we're not syncing it yet,
     // don't show any icon and wait for the filesystem watcher to trigger a sync.
     SyncFileStatus status(isPathKnown ? SyncFileStatus::StatusUpToDate : SyncFileStatus::StatusNone);
-    if (_syncCount.value(relativePath)) {
+    const PathNode *node = findNode(relativePath);
+    if (node && node->syncCount) {
         status.set(SyncFileStatus::StatusSync);
     } else {
         // After a sync finished, we need to show the users issues from that last sync like the activity list does.
         // Also used for parent directories showing a warning for an error child.
-        SyncFileStatus::SyncFileStatusTag problemStatus = lookupProblem(relativePath, _syncProblems);
+        SyncFileStatus::SyncFileStatusTag problemStatus = lookupProblem(relativePath);
         if (problemStatus != SyncFileStatus::StatusNone)
             status.set(problemStatus);
     }
@@ -323,11 +453,13 @@ SyncFileStatus SyncFileStatusTracker::resolveSyncAndErrorStatus(const QString &r
 
 void SyncFileStatusTracker::invalidateParentPaths(const QString &path)
 {
-    QStringList splitPath = path.split('/', QString::SkipEmptyParts);
-    for (int i = 0; i < splitPath.size(); ++i) {
-        QString parentPath = QStringList(splitPath.mid(0, i)).join(QLatin1String("/"));
-        emit fileStatusChanged(getSystemDestination(parentPath), fileStatus(parentPath));
-    }
+    // From the root down, like the sync counts are resolved
+    int end = -1;
+    do {
+        const QString parentPath = path.left(qMax(0, end));
+        emitStatus(parentPath, fileStatus(parentPath), DirectoryPath);
+        end = path.indexOf(QLatin1Char('/'), end + 1);
+    } while (end != -1);
 }
 
 QString SyncFileStatusTracker::getSystemDestination(const QString &relativePath)
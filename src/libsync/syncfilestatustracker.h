@@ -20,6 +20,8 @@
 #include "syncfileitem.h"
 #include "syncfilestatus.h"
 #include <map>
+#include <memory>
+#include <QHash>
 #include <QSet>
 
 namespace OCC {
@@ -54,8 +56,37 @@ private:
     struct PathComparator {
         bool operator()( const QString& lhs, const QString& rhs ) const;
     };
-    typedef std::map<QString, SyncFileStatus::SyncFileStatusTag, PathComparator> ProblemsMap;
-    SyncFileStatus::SyncFileStatusTag lookupProblem(const QString &pathToMatch, const ProblemsMap &problemMap);
+
+    /** A component of the tracked paths, so that the status of a path and of
+     * its parents is found by walking down the tree rather than by scanning
+     * all the paths. Nodes that track nothing are removed. */
+    struct PathNode
+    {
+        QString name;
+        PathNode *parent = nullptr;
+        std::map<QString, std::unique_ptr<PathNode>, PathComparator> children;
+
+        // Counts the number direct children currently being synced (has unfinished propagation jobs).
+        // We'll show a file/directory as SYNC as long as its sync count is > 0.
+        // A directory that starts/ends propagation will in turn increase/decrease its own parent by 1.
+        int syncCount = 0;
+        SyncFileStatus::SyncFileStatusTag problem = SyncFileStatus::StatusNone;
+        // The number of errors anywhere below this node, they give it a warning
+        int errorsBelow = 0;
+
+        bool isUnused() const
+        {
+            return syncCount == 0 && problem == SyncFileStatus::StatusNone
+                && errorsBelow == 0 && children.empty();
+        }
+    };
+    PathNode *findNode(const QString &path);
+    PathNode *findOrCreateNode(const QString &path);
+    QString nodePath(const PathNode *node) const;
+    /// Removes @a node and its parents as long as they are unused
+    void pruneNode(PathNode *node);
+    void setProblem(const QString &path, SyncFileStatus::SyncFileStatusTag problem);
+    SyncFileStatus::SyncFileStatusTag lookupProblem(const QString &pathToMatch);
 
     enum SharedFlag { UnknownShared,
         NotShared,
@@ -64,19 +95,24 @@ private:
         PathKnown };
     SyncFileStatus resolveSyncAndErrorStatus(const QString &relativePath, SharedFlag sharedState, PathKnownFlag isPathKnown = PathKnown);
 
+    enum PathKind { FilePath,
+        DirectoryPath };
+    /** Emits fileStatusChanged, unless the last status emitted for the
+     * directory during this sync was the same. */
+    void emitStatus(const QString &relativePath, SyncFileStatus status, PathKind kind = FilePath);
+
     void invalidateParentPaths(const QString &path);
     QString getSystemDestination(const QString &relativePath);
-    void incSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedState);
     void decSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedState);
 
     SyncEngine *_syncEngine;
 
-    ProblemsMap _syncProblems;
+    PathNode _root;
     QSet<QString> _dirtyPaths;
-    // Counts the number direct children currently being synced (has unfinished propagation jobs).
-    // We'll show a file/directory as SYNC as long as its sync count is > 0.
-    // A directory that starts/ends propagation will in turn increase/decrease its own parent by 1.
-    QHash<QString, int> _syncCount;
+    // The statuses emitted for the directories since the sync started, the
+    // parents of many changed files would get the same one again and again
+    QHash<QString, SyncFileStatus> _directoryStatuses;
+    bool _propagating = false;
 };
 }
 
@@ -15,7 +15,9 @@
 #pragma once
 
 #include "owncloudlib.h"
+#include <QSet>
 #include <QString>
+#include <QStringList>
 
 
 namespace OCC {
@@ -32,6 +34,13 @@ struct SyncOptions
     /** If a confirmation should be asked for external storages */
     bool _confirmExternalStorage = false;
 
+    /** Whether new remote files get an empty placeholder instead of being downloaded
+     *
+     * The placeholder has APPLICATION_DOTVIRTUALFILE_SUFFIX appended to the name,
+     * its download is requested with Folder::downloadVirtualFile().
+     */
+    bool _newFilesAreVirtual = false;
+
     /** The initial un-adjusted chunk size in bytes for chunked uploads, both
      * for old and new chunking algorithm, which classifies the item to be chunked
      *
@@ -55,6 +64,177 @@ struct SyncOptions
 
     /** Whether parallel network jobs are allowed. */
     bool _parallelNetworkJobs = true;
+
+    /** Number of remote entries after which discovery stops descending into
+     * new remote folders.
+     *
+     * Such folders are left for a follow-up sync, so the propagation of what
+     * was already discovered starts without waiting for the whole tree. This
+     * mostly matters for the initial sync of a big account.
+     *
+     * Set to 0 it will discover everything in one sync.
+     */
+    qint64 _discoveryBatchSize = 0;
+
+    /** Estimated memory in bytes that the discovery trees may use.
+     *
+     * Above it, subtrees without any change are dropped as soon as they
+     * have been discovered, see csync_s::max_tree_memory.
+     *
+     * Set to 0 everything is kept until the propagation starts.
+     */
+    qint64 _maxDiscoveryMemory = 0;
+
+    /** Bytes the discovery may hash to find out whether a file really changed.
+     *
+     * The checksums of the discovery are computed one after the other on
+     * its thread. Beyond this budget the files are treated as changed, and
+     * the upload finds out that the content is the same when it computes
+     * the content checksum, in parallel with the other uploads.
+     *
+     * Set to -1 there is no limit.
+     */
+    qint64 _discoveryChecksumBudget = 500 * 1000 * 1000; // 500MB
+
+    /** Number of remote directory listings that may run at the same time.
+     *
+     * The subdirectories whose etag changed are listed ahead of the
+     * discovery, which otherwise waits for one round trip per directory.
+     *
+     * Set to 1 the directories are listed one after the other.
+     */
+    int _remoteDiscoveryParallelism = 1;
+
+    /** Directories the user is looking at or working in, most recent first.
+     *
+     * The discovery walks them and their parents before their siblings,
+     * so that they are in the first discovery batch during a long initial
+     * sync. The paths are relative to the folder and don't end with a /.
+     */
+    QStringList _priorityPaths;
+
+    /** Size in bytes from which a download is split into segments that are
+     * fetched in parallel with range requests.
+     *
+     * Set to 0 every file is downloaded with a single request.
+     */
+    quint64 _minSegmentedDownloadSize = 100 * 1000 * 1000; // 100MB
+
+    /** The number of segments of a segmented download */
+    int _downloadSegments = 4;
+
+    /**
+     * Modified files from this size on only upload the blocks that changed,
+     * if the server supports it. See Capabilities::deltaUpload().
+     *
+     * Set to 0 to always upload the whole file.
+     */
+    quint64 _minDeltaUploadSize = 10 * 1000 * 1000; // 10MB
+
+    /** The size of the blocks that are compared for the delta uploads */
+    quint64 _deltaBlockSize = 1024 * 1024; // 1MiB
+
+    /**
+     * New files from this size on are copied on the server if the journal
+     * knows a file with the same content checksum there.
+     *
+     * Set to 0 to always upload the data.
+     */
+    quint64 _minServerSideCopySize = 1000 * 1000; // 1MB
+
+    /**
+     * Transfers of files from this size on only use some of the parallel
+     * transfer slots, and the smaller files that come after them in the
+     * tree are started first while those slots are taken.
+     *
+     * Set to 0 the jobs are started in tree order.
+     */
+    quint64 _minBulkTransferSize = 10 * 1000 * 1000; // 10MB
+
+    /** Downloads of placeholders that were picked ahead of being opened.
+     *
+     * They take the slots of the bulk transfers whatever their size, so the
+     * files the user asked for don't wait behind them.
+     */
+    QSet<QString> _prefetchPaths;
+
+    /**
+     * Milliseconds the file watcher must not have seen a file change before
+     * it is uploaded, see SyncEngine::noteLocalChange().
+     *
+     * A file that is still being written would otherwise be uploaded again
+     * after every sync that sees it change. The upload waits for the sync
+     * the folder schedules once the watcher is quiet instead.
+     *
+     * Set to 0 only the modification time is checked, see
+     * SyncEngine::minimumFileAgeForUpload.
+     */
+    qint64 _uploadStabilityMsec = 5 * 1000;
+
+    enum DownloadDurability {
+        /// The operating system writes the downloaded files when it wants to
+        DurabilityNone,
+        /// Every download is flushed to the disk before its journal record is written
+        DurabilityPerFile,
+        /// Like DurabilityPerFile, but completed downloads are flushed in groups
+        DurabilityBatched
+    };
+
+    /**
+     * Whether the data of a download must be on the disk before the journal
+     * considers the file synced.
+     *
+     * Otherwise a crash or power loss can leave empty or partial files that
+     * the journal describes as up to date, and the next sync uploads them.
+     */
+    DownloadDurability _downloadDurability = DurabilityNone;
+
+    /**
+     * The share of the bandwidth limit this folder gets while other folders
+     * transfer at the same time, relative to their weights.
+     * See BandwidthBudget.
+     */
+    int _bandwidthWeight = 1;
+
+    /**
+     * Whether the discovery, the checksums and the local file operations
+     * read and write the disk with the background I/O priority.
+     * See Utility::setThreadBackgroundIo().
+     *
+     * Off for the command line client, which the user waits for. The folders
+     * of the GUI enable it, see FolderDefinition::backgroundIo.
+     */
+    bool _backgroundIo = false;
+
+    /**
+     * Whether the connection is metered or the computer runs on battery,
+     * see TransferPolicy.
+     *
+     * Only one file is transferred at a time then, and the transfers from
+     * _minDeferredTransferSize on are left for a later sync.
+     */
+    bool _constrainedNetwork = false;
+
+    /** Set to 0 nothing is deferred on a constrained network */
+    quint64 _minDeferredTransferSize = 10 * 1000 * 1000; // 10MB
+
+    /**
+     * Minimum time in milliseconds between two transmissionProgress signals
+     * for the progress of the running jobs and the discovered folders.
+     *
+     * Completed items and the changes of the phase are always sent at once,
+     * with the newest progress. Set to 0 every update is sent.
+     */
+    qint64 _progressInterval = 0;
+
+    /**
+     * Whether the sync stops after the discovery and the reconcile.
+     *
+     * The items are announced with SyncEngine::aboutToPropagate() and the
+     * sync finishes without propagating them, to measure the discovery.
+     * Neither the local files nor the journal are changed.
+     */
+    bool _dryRun = false;
 };
 
 
@@ -157,7 +157,8 @@ void SyncResult::processCompletedItem(const SyncFileItemPtr &item)
             _numOldConflictItems++;
         }
     } else {
-        if (!item->hasErrorStatus() && item->_status != SyncFileItem::FileIgnored && item->_direction == SyncFileItem::Down) {
+        if (!item->hasErrorStatus() && item->_status != SyncFileItem::FileIgnored
+            && item->_status != SyncFileItem::Deferred && item->_direction == SyncFileItem::Down) {
             switch (item->_instruction) {
             case CSYNC_INSTRUCTION_NEW:
             case CSYNC_INSTRUCTION_TYPE_CHANGE:
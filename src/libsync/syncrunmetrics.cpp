@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncrunmetrics.h"
+#include "progressdispatcher.h"
+#include "syncfileitem.h"
+
+#include <QJsonDocument>
+
+namespace OCC {
+
+QJsonObject SyncRunMetrics::toJson() const
+{
+    QJsonObject phases;
+    phases.insert(QStringLiteral("localDiscovery"), _localDiscoveryMs);
+    phases.insert(QStringLiteral("remoteDiscovery"), _remoteDiscoveryMs);
+    phases.insert(QStringLiteral("reconcile"), _reconcileMs);
+    phases.insert(QStringLiteral("treewalk"), _treewalkMs);
+    phases.insert(QStringLiteral("propagation"), _propagationMs);
+    phases.insert(QStringLiteral("total"), _totalMs);
+
+    QJsonObject counters;
+    counters.insert(QStringLiteral("localStats"), _localStats);
+    counters.insert(QStringLiteral("remoteListings"), _remoteListings);
+    counters.insert(QStringLiteral("journalQueries"), _journalQueries);
+    counters.insert(QStringLiteral("networkRequests"), _networkRequests);
+    counters.insert(QStringLiteral("http2Requests"), _http2Requests);
+    counters.insert(QStringLiteral("peakActiveRequests"), _peakActiveRequests);
+    counters.insert(QStringLiteral("newConnections"), _newConnections);
+    counters.insert(QStringLiteral("bytesTransferred"), _bytesTransferred);
+    counters.insert(QStringLiteral("discoveredEntries"), _discoveredEntries);
+    counters.insert(QStringLiteral("peakItemCount"), _peakItemCount);
+
+    QJsonObject result;
+    result.insert(QStringLiteral("success"), _success);
+    result.insert(QStringLiteral("phasesMs"), phases);
+    result.insert(QStringLiteral("counters"), counters);
+
+    QJsonObject requests;
+    for (auto it = _requestTimings.constBegin(); it != _requestTimings.constEnd(); ++it)
+        requests.insert(QString::fromLatin1(it.key()), it.value().toJson());
+    result.insert(QStringLiteral("requests"), requests);
+
+    // The bytes are of the objects themselves, what their strings hold comes on top
+    QJsonObject memory;
+    memory.insert(QStringLiteral("journalCachedRecords"), _journalCachedRecords);
+    if (_peakFileStats >= 0) {
+        auto peak = [](qint64 count, size_t size) {
+            return QJsonObject{ { QStringLiteral("peak"), count }, { QStringLiteral("bytes"), double(count * size) } };
+        };
+        memory.insert(QStringLiteral("fileStats"), peak(_peakFileStats, sizeof(csync_file_stat_t)));
+        memory.insert(QStringLiteral("syncFileItems"), peak(_peakSyncFileItems, sizeof(SyncFileItem)));
+        memory.insert(QStringLiteral("progressItems"), peak(_peakProgressItems, sizeof(ProgressInfo::ProgressItem)));
+    }
+    result.insert(QStringLiteral("memory"), memory);
+    return result;
+}
+
+QByteArray SyncRunMetrics::historyToCsv(const QVector<SyncJournalDb::SyncMetricsEntry> &history)
+{
+    static const char *const phases[] = { "localDiscovery", "remoteDiscovery", "reconcile", "treewalk", "propagation", "total" };
+    static const char *const counters[] = { "discoveredEntries", "peakItemCount", "bytesTransferred", "networkRequests", "journalQueries" };
+
+    QByteArray csv = "finished,success";
+    for (auto phase : phases)
+        csv += QByteArray(",") + phase + "Ms";
+    for (auto counter : counters)
+        csv += QByteArray(",") + counter;
+    csv += ",peakSyncFileItemBytes\n";
+
+    for (const auto &entry : history) {
+        const QJsonObject json = QJsonDocument::fromJson(entry._metrics).object();
+        csv += entry._finished.toUTC().toString(Qt::ISODate).toLatin1();
+        csv += json.value(QStringLiteral("success")).toBool() ? ",1" : ",0";
+        const QJsonObject phasesMs = json.value(QStringLiteral("phasesMs")).toObject();
+        for (auto phase : phases)
+            csv += ',' + QByteArray::number(qint64(phasesMs.value(QLatin1String(phase)).toDouble()));
+        const QJsonObject counterValues = json.value(QStringLiteral("counters")).toObject();
+        for (auto counter : counters)
+            csv += ',' + QByteArray::number(qint64(counterValues.value(QLatin1String(counter)).toDouble()));
+        // Empty unless the instances were counted
+        const QJsonObject items = json.value(QStringLiteral("memory")).toObject().value(QStringLiteral("syncFileItems")).toObject();
+        csv += ',';
+        if (items.contains(QStringLiteral("bytes")))
+            csv += QByteArray::number(qint64(items.value(QStringLiteral("bytes")).toDouble()));
+        csv += '\n';
+    }
+    return csv;
+}
+}
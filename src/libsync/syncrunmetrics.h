@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+#include "requesttimings.h"
+#include "common/syncjournaldb.h"
+
+#include <QJsonObject>
+#include <QMetaType>
+
+namespace OCC {
+
+/**
+ * @brief Timings and counters of one sync run
+ *
+ * Filled by the SyncEngine while it runs and emitted with
+ * SyncEngine::syncMetrics() when the sync is finished.
+ *
+ * @ingroup libsync
+ */
+struct OWNCLOUDSYNC_EXPORT SyncRunMetrics
+{
+    /** Durations of the phases, in milliseconds */
+    qint64 _localDiscoveryMs = 0;
+    qint64 _remoteDiscoveryMs = 0;
+    qint64 _reconcileMs = 0;
+    qint64 _treewalkMs = 0;
+    qint64 _propagationMs = 0;
+    qint64 _totalMs = 0;
+
+    /** Number of local directory entries that were stat'ed */
+    qint64 _localStats = 0;
+    /** Number of remote directories that were listed (PROPFIND) */
+    qint64 _remoteListings = 0;
+    /** Number of statements executed on the sync journal */
+    qint64 _journalQueries = 0;
+    /** Number of requests sent to the server and how many of them used HTTP/2 */
+    qint64 _networkRequests = 0;
+    qint64 _http2Requests = 0;
+    /** The most requests that were in flight at the same time */
+    qint64 _peakActiveRequests = 0;
+    /** Number of encrypted connections opened, the other requests reused a kept-alive one */
+    qint64 _newConnections = 0;
+    /** The latencies of the requests per verb and endpoint */
+    RequestTimingsMap _requestTimings;
+
+    /** Size of the files that were uploaded or downloaded */
+    qint64 _bytesTransferred = 0;
+    /** Number of entries in the discovery trees after the update phase */
+    qint64 _discoveredEntries = 0;
+    /** Number of items that were handed to the propagator */
+    qint64 _peakItemCount = 0;
+
+    /** The most instances alive at the same time, -1 unless counted, see InstanceCounts */
+    qint64 _peakFileStats = -1;
+    qint64 _peakSyncFileItems = -1;
+    qint64 _peakProgressItems = -1;
+    /** Journal records in memory at the end: cached lookups and unwritten records */
+    qint64 _journalCachedRecords = 0;
+
+    bool _success = false;
+
+    QJsonObject toJson() const;
+
+    /**
+     * The main numbers of SyncJournalDb::syncMetricsHistory() as CSV, a line
+     * per sync after a header line, for spreadsheets.
+     */
+    static QByteArray historyToCsv(const QVector<SyncJournalDb::SyncMetricsEntry> &history);
+};
+}
+
+Q_DECLARE_METATYPE(OCC::SyncRunMetrics)
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "transferpolicy.h"
+
+#include <QDir>
+#include <QFile>
+#include <QLoggingCategory>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcTransferPolicy, "sync.transferpolicy", QtInfoMsg)
+
+// The power supply has no change notification that works everywhere
+static const int PollIntervalMsec = 30 * 1000;
+
+TransferPolicy *TransferPolicy::instance()
+{
+    static TransferPolicy *policy = new TransferPolicy;
+    return policy;
+}
+
+TransferPolicy::TransferPolicy()
+{
+    connect(&_networkConfigurationManager, &QNetworkConfigurationManager::configurationChanged,
+        this, &TransferPolicy::refresh);
+    connect(&_pollTimer, &QTimer::timeout, this, &TransferPolicy::refresh);
+    _pollTimer.setInterval(PollIntervalMsec);
+    _pollTimer.start();
+    refresh();
+}
+
+void TransferPolicy::refresh()
+{
+    static const QByteArray overrideEnv = qgetenv("OWNCLOUD_TRANSFER_POLICY");
+
+    Constraints constraints = NoConstraint;
+    if (!overrideEnv.isEmpty()) {
+        const auto parts = overrideEnv.split(',');
+        if (parts.contains("metered"))
+            constraints |= Metered;
+        if (parts.contains("battery"))
+            constraints |= OnBattery;
+    } else {
+        if (isMetered(_networkConfigurationManager.defaultConfiguration()))
+            constraints |= Metered;
+        if (isOnBattery())
+            constraints |= OnBattery;
+    }
+
+    if (constraints == _constraints)
+        return;
+    qCInfo(lcTransferPolicy) << "Transfer constraints changed from" << _constraints << "to" << constraints;
+    _constraints = constraints;
+    emit constraintsChanged(_constraints);
+}
+
+bool TransferPolicy::isMetered(const QNetworkConfiguration &config)
+{
+    if (!config.isValid())
+        return false;
+    switch (config.bearerType()) {
+    case QNetworkConfiguration::Bearer2G:
+    case QNetworkConfiguration::BearerCDMA2000:
+    case QNetworkConfiguration::BearerWCDMA:
+    case QNetworkConfiguration::BearerHSPA:
+    case QNetworkConfiguration::BearerWiMAX:
+    case QNetworkConfiguration::BearerEVDO:
+    case QNetworkConfiguration::BearerLTE:
+    case QNetworkConfiguration::Bearer3G:
+    case QNetworkConfiguration::Bearer4G:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool TransferPolicy::isOnBattery()
+{
+#if defined(Q_OS_WIN)
+    SYSTEM_POWER_STATUS status;
+    if (!GetSystemPowerStatus(&status))
+        return false;
+    // 255 is unknown, desktops without a battery report 1
+    return status.ACLineStatus == 0;
+#elif defined(Q_OS_LINUX)
+    // Only on battery if there is one and no online mains or USB supply
+    QDir supplies(QStringLiteral("/sys/class/power_supply"));
+    bool hasBattery = false;
+    foreach (const QString &name, supplies.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        QFile typeFile(supplies.filePath(name + QStringLiteral("/type")));
+        if (!typeFile.open(QIODevice::ReadOnly))
+            continue;
+        const QByteArray type = typeFile.readAll().trimmed();
+        if (type == "Battery") {
+            hasBattery = true;
+            continue;
+        }
+        QFile onlineFile(supplies.filePath(name + QStringLiteral("/online")));
+        if (onlineFile.open(QIODevice::ReadOnly) && onlineFile.readAll().trimmed() == "1")
+            return false;
+    }
+    return hasBattery;
+#else
+    // Not known on this platform
+    return false;
+#endif
+}
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef TRANSFERPOLICY_H
+#define TRANSFERPOLICY_H
+
+#include "owncloudlib.h"
+
+#include <QObject>
+#include <QNetworkConfigurationManager>
+#include <QTimer>
+
+namespace OCC {
+
+/**
+ * @brief Knows whether transferring a lot of data is expensive right now
+ *
+ * That is the case on a metered connection, like a mobile bearer or a
+ * tethered phone, and when the computer runs on battery. The syncs then
+ * skip the large transfers, see SyncOptions::_constrainedNetwork, and
+ * catch up once the constraints are gone.
+ *
+ * The OWNCLOUD_TRANSFER_POLICY environment variable can force the state
+ * with a comma separated list of "metered" and "battery", or "none".
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT TransferPolicy : public QObject
+{
+    Q_OBJECT
+public:
+    enum Constraint {
+        NoConstraint = 0,
+        Metered = 1,
+        OnBattery = 2
+    };
+    Q_DECLARE_FLAGS(Constraints, Constraint)
+
+    static TransferPolicy *instance();
+
+    Constraints constraints() const { return _constraints; }
+    bool isConstrained() const { return _constraints != NoConstraint; }
+
+signals:
+    void constraintsChanged(TransferPolicy::Constraints constraints);
+
+public slots:
+    /** Checks the network and the power supply again */
+    void refresh();
+
+private:
+    TransferPolicy();
+
+    static bool isMetered(const QNetworkConfiguration &config);
+    static bool isOnBattery();
+
+    QNetworkConfigurationManager _networkConfigurationManager;
+    QTimer _pollTimer;
+    Constraints _constraints = NoConstraint;
+};
+}
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(OCC::TransferPolicy::Constraints)
+
+#endif
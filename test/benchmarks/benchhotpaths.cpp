@@ -0,0 +1,350 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+/*
+ * Micro-benchmarks of the functions that run once per file in a sync, with
+ * synthetic inputs at several scales:
+ *
+ *   HotPathsBench [QTest options] [function]
+ *
+ * For example "HotPathsBench -median 5 benchJournalGet:10000" or
+ * "HotPathsBench -callgrind benchDetectUpdate".
+ */
+
+// _csync_detect_update() is static, like the csync tests do
+#include "csync_update.cpp"
+
+#include "syncenginetestutils.h"
+#include "csync_exclude.h"
+#include "csync_reconcile.h"
+#include "filesystem.h"
+#include "networkjobs.h"
+#include "syncfilestatustracker.h"
+
+#include <QTemporaryDir>
+
+using namespace OCC;
+
+static QByteArray syntheticPath(int i)
+{
+    // 10 files per directory, 10 directories per directory
+    QByteArray path;
+    for (int n = i / 10; n > 0; n /= 10)
+        path += "dir" + QByteArray::number(n % 10) + '/';
+    static const char *const suffixes[] = { ".txt", ".jpg", ".docx", ".pdf", "" };
+    return path + "file" + QByteArray::number(i) + suffixes[i % 5];
+}
+
+static SyncJournalFileRecord syntheticRecord(int i)
+{
+    SyncJournalFileRecord record;
+    record._path = syntheticPath(i);
+    record._inode = 1000 + i;
+    record._modtime = 1500000000 + i;
+    record._type = CSYNC_FTW_TYPE_FILE;
+    record._etag = "etag" + QByteArray::number(i);
+    record._fileId = QByteArray::number(i).rightJustified(8, '0') + "ocabcdefgh";
+    record._fileSize = 1000 + i;
+    record._remotePerm = RemotePermissions("RDNVW");
+    record._checksumHeader = "SHA1:" + QByteArray::number(i).rightJustified(40, '0');
+    return record;
+}
+
+// The entry a local walk finds for the record, changed for one file in 100
+static std::unique_ptr<csync_file_stat_t> syntheticLocalStat(int i)
+{
+    const auto record = syntheticRecord(i);
+    std::unique_ptr<csync_file_stat_t> fs(new csync_file_stat_t);
+    fs->path = record._path;
+    fs->type = CSYNC_FTW_TYPE_FILE;
+    fs->inode = record._inode;
+    fs->modtime = record._modtime + (i % 100 == 0 ? 1 : 0);
+    fs->size = record._fileSize;
+    return fs;
+}
+
+static void addScales(QList<int> scales)
+{
+    QTest::addColumn<int>("count");
+    for (int count : scales)
+        QTest::newRow(QByteArray::number(count).constData()) << count;
+}
+
+static void addTuningScales(QList<int> scales)
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("tuned");
+    for (int count : scales) {
+        QTest::newRow((QByteArray::number(count) + " default").constData()) << count << false;
+        QTest::newRow((QByteArray::number(count) + " tuned").constData()) << count << true;
+    }
+}
+
+class BenchHotPaths : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _tmp;
+
+    // A journal with @a count records, shared by the benchmarks
+    std::unique_ptr<SyncJournalDb> filledJournal(int count)
+    {
+        std::unique_ptr<SyncJournalDb> db(new SyncJournalDb(_tmp.path() + "/bench" + QString::number(count) + ".db"));
+        SyncJournalFileRecord record;
+        if (db->getFileRecord(syntheticPath(count - 1), &record) && record.isValid())
+            return db;
+        for (int i = 0; i < count; ++i)
+            db->setFileRecord(syntheticRecord(i));
+        db->commit("bench");
+        return db;
+    }
+
+    // filledJournal(), reopened with or without the tuning
+    std::unique_ptr<SyncJournalDb> tunedJournal(int count, bool tuned)
+    {
+        auto db = filledJournal(count);
+        db->close();
+        if (tuned)
+            db->setAutoTuneLimits(64 * 1024, 256 * 1000 * 1000);
+        return db;
+    }
+
+private slots:
+    void initTestCase()
+    {
+        // The per file logging would be measured otherwise
+        QLoggingCategory::setFilterRules("*.debug=false\n*.info=false");
+    }
+
+    void benchTraversalPatternMatch_data() { addScales({ 1000, 10000, 100000 }); }
+    void benchTraversalPatternMatch()
+    {
+        QFETCH(int, count);
+        ExcludedFiles excluded;
+        for (const char *pattern : { "*~", ".*.sw?", "*.part", "*.tmp", "]*.bak", "Thumbs.db", "desktop.ini",
+                 ".~lock.*", "~$*", "*.filepart", ".Trash-*", "node_modules/", "build/*.o", "/toplevel" })
+            excluded.addManualExclude(pattern);
+        excluded.reloadExcludeFiles();
+        auto match = excluded.csyncTraversalMatchFun();
+
+        QVector<QByteArray> paths;
+        for (int i = 0; i < count; ++i)
+            paths.append(syntheticPath(i));
+        int matched = 0;
+        QBENCHMARK {
+            for (const auto &path : paths)
+                matched += match(path.constData(), CSYNC_FTW_TYPE_FILE) != CSYNC_NOT_EXCLUDED;
+        }
+        QCOMPARE(matched, 0);
+    }
+
+    void benchDetectUpdate_data() { addScales({ 1000, 10000 }); }
+    void benchDetectUpdate()
+    {
+        QFETCH(int, count);
+        auto db = filledJournal(count);
+        CSYNC ctx(_tmp.path().toUtf8().constData(), db.get());
+        ctx.current = LOCAL_REPLICA;
+        QBENCHMARK {
+            ctx.reinitialize();
+            // Twice as many files as records, the half without one is new
+            for (int i = 0; i < 2 * count; ++i)
+                QCOMPARE(_csync_detect_update(&ctx, syntheticLocalStat(i)), 0);
+        }
+        QCOMPARE(ctx.local.files.size(), size_t(2 * count));
+    }
+
+    void benchReconcile_data() { addScales({ 1000, 10000, 100000 }); }
+    void benchReconcile()
+    {
+        QFETCH(int, count);
+        SyncJournalDb db(_tmp.path() + "/reconcile.db");
+        CSYNC ctx(_tmp.path().toUtf8().constData(), &db);
+        qint64 totalNs = 0;
+        int runs = 0;
+        // The trees are used up by the reconcile, only it is timed
+        for (; runs < 5; ++runs) {
+            ctx.reinitialize();
+            for (int i = 0; i < count; ++i) {
+                auto local = syntheticLocalStat(i);
+                auto remote = syntheticLocalStat(i);
+                local->instruction = i % 100 == 0 ? CSYNC_INSTRUCTION_EVAL : CSYNC_INSTRUCTION_NONE;
+                remote->instruction = i % 100 == 50 ? CSYNC_INSTRUCTION_EVAL : CSYNC_INSTRUCTION_NONE;
+                const QByteArray path = local->path;
+                ctx.local.files[path] = std::move(local);
+                ctx.remote.files[path] = std::move(remote);
+            }
+            QElapsedTimer timer;
+            timer.start();
+            QCOMPARE(csync_reconcile(&ctx), 0);
+            totalNs += timer.nsecsElapsed();
+        }
+        QTest::setBenchmarkResult(totalNs / runs / 1e6, QTest::WalltimeMilliseconds);
+    }
+
+    void benchJournalSet_data() { addScales({ 1000, 10000 }); }
+    void benchJournalSet()
+    {
+        QFETCH(int, count);
+        int run = 0;
+        QBENCHMARK {
+            SyncJournalDb db(_tmp.path() + "/set" + QString::number(run++) + ".db");
+            for (int i = 0; i < count; ++i)
+                QVERIFY(db.setFileRecord(syntheticRecord(i)));
+            db.commit("bench");
+        }
+    }
+
+    void benchJournalGet_data() { addScales({ 1000, 10000, 100000 }); }
+    void benchJournalGet()
+    {
+        QFETCH(int, count);
+        auto db = filledJournal(count);
+        QVector<QByteArray> paths;
+        for (int i = 0; i < count; ++i)
+            paths.append(syntheticPath(i));
+        SyncJournalFileRecord record;
+        QBENCHMARK {
+            for (const auto &path : paths)
+                QVERIFY(db->getFileRecord(path, &record) && record.isValid());
+        }
+    }
+
+    // The same lookups with the page cache and mapping sized by
+    // SyncJournalDb::setAutoTuneLimits(), beyond the lookup cache
+    void benchJournalGetTuned_data() { addTuningScales({ 10000, 100000 }); }
+    void benchJournalGetTuned()
+    {
+        QFETCH(int, count);
+        QFETCH(bool, tuned);
+        auto db = tunedJournal(count, tuned);
+        QVector<QByteArray> paths;
+        for (int i = 0; i < count; ++i)
+            paths.append(syntheticPath(i));
+        SyncJournalFileRecord record;
+        QBENCHMARK {
+            for (const auto &path : paths)
+                QVERIFY(db->getFileRecord(path, &record) && record.isValid());
+        }
+    }
+
+    void benchFillTreeFromDb_data() { addTuningScales({ 10000, 100000 }); }
+    void benchFillTreeFromDb()
+    {
+        QFETCH(int, count);
+        QFETCH(bool, tuned);
+        auto db = tunedJournal(count, tuned);
+        CSYNC ctx(_tmp.path().toUtf8().constData(), db.get());
+        ctx.current = LOCAL_REPLICA;
+        QBENCHMARK {
+            ctx.reinitialize();
+            // Directory by directory, like the update phase does
+            for (int n = 0; n < 10; ++n)
+                QVERIFY(fill_tree_from_db(&ctx, QByteArray("dir" + QByteArray::number(n)).constData()));
+        }
+        QVERIFY(!ctx.local.files.empty());
+    }
+
+    void benchLsColParse_data() { addScales({ 100, 1000, 10000 }); }
+    void benchLsColParse()
+    {
+        QFETCH(int, count);
+        QByteArray xml = "<?xml version='1.0' encoding='utf-8'?>"
+                         "<d:multistatus xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">"
+                         "<d:response><d:href>/oc/remote.php/webdav/dir/</d:href><d:propstat><d:prop>"
+                         "<oc:id>00000000ocabcdefgh</oc:id><oc:permissions>RDNVCK</oc:permissions>"
+                         "<oc:size>1000</oc:size><d:getetag>\"root\"</d:getetag>"
+                         "<d:resourcetype><d:collection/></d:resourcetype>"
+                         "<d:getlastmodified>Fri, 06 Feb 2015 13:49:55 GMT</d:getlastmodified>"
+                         "</d:prop><d:status>HTTP/1.1 200 OK</d:status></d:propstat></d:response>";
+        for (int i = 0; i < count; ++i) {
+            const auto record = syntheticRecord(i);
+            xml += "<d:response><d:href>/oc/remote.php/webdav/dir/file" + QByteArray::number(i) + "</d:href>"
+                   "<d:propstat><d:prop><oc:id>" + record._fileId + "</oc:id>"
+                   "<oc:permissions>RDNVW</oc:permissions><d:getetag>\"" + record._etag + "\"</d:getetag>"
+                   "<d:resourcetype/><d:getlastmodified>Fri, 06 Feb 2015 13:49:55 GMT</d:getlastmodified>"
+                   "<d:getcontentlength>" + QByteArray::number(record._fileSize) + "</d:getcontentlength>"
+                   "<oc:checksums><oc:checksum>" + record._checksumHeader + "</oc:checksum></oc:checksums>"
+                   "</d:prop><d:status>HTTP/1.1 200 OK</d:status></d:propstat></d:response>";
+        }
+        xml += "</d:multistatus>";
+
+        int items = 0;
+        QBENCHMARK {
+            LsColXMLParser parser;
+            connect(&parser, &LsColXMLParser::directoryListingIterated, [&items] { ++items; });
+            QHash<QString, qint64> sizes;
+            QVERIFY(parser.parse(xml, &sizes, "/oc/remote.php/webdav/dir"));
+        }
+        QVERIFY(items > count);
+    }
+
+    void benchChecksum_data()
+    {
+        QTest::addColumn<QByteArray>("type");
+        QTest::addColumn<int>("size");
+        for (const char *type : { "Adler32", "SHA1" }) {
+            for (int size : { 64 * 1024, 1024 * 1024, 32 * 1024 * 1024 })
+                QTest::newRow(QByteArray(type) + ':' + QByteArray::number(size)) << QByteArray(type) << size;
+        }
+    }
+    void benchChecksum()
+    {
+        QFETCH(QByteArray, type);
+        QFETCH(int, size);
+        const QString fileName = _tmp.path() + "/checksum" + QString::number(size);
+        QFile file(fileName);
+        if (file.size() != size) {
+            QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+            QByteArray block(64 * 1024, 'x');
+            for (int written = 0; written < size; written += block.size())
+                file.write(block.constData(), qMin(block.size(), size - written));
+            file.close();
+        }
+        QByteArray checksum;
+        QBENCHMARK {
+            checksum = type == "SHA1" ? FileSystem::calcSha1(fileName) : FileSystem::calcAdler32(fileName);
+        }
+        QVERIFY(!checksum.isEmpty());
+    }
+
+    void benchFileStatus_data() { addScales({ 1000, 10000 }); }
+    void benchFileStatus()
+    {
+        QFETCH(int, count);
+        FakeFolder fakeFolder{ FileInfo{} };
+        QStringList paths;
+        QSet<QString> dirs;
+        for (int i = 0; i < count; ++i) {
+            const QString path = QString::fromUtf8(syntheticPath(i));
+            for (int slash = path.indexOf('/'); slash > 0; slash = path.indexOf('/', slash + 1)) {
+                const QString dir = path.left(slash);
+                if (!dirs.contains(dir)) {
+                    fakeFolder.remoteModifier().mkdir(dir);
+                    dirs.insert(dir);
+                }
+            }
+            fakeFolder.remoteModifier().insert(path);
+            paths.append(path);
+        }
+        // One in 100 keeps failing, its parents are in a warning state
+        for (int i = 0; i < count; i += 100)
+            fakeFolder.serverErrorPaths().append(paths[i]);
+        fakeFolder.syncOnce();
+
+        auto &tracker = fakeFolder.syncEngine().syncFileStatusTracker();
+        int synced = 0;
+        QBENCHMARK {
+            for (const auto &path : paths)
+                synced += tracker.fileStatus(path).tag() == SyncFileStatus::StatusUpToDate;
+        }
+        QVERIFY(synced > 0);
+    }
+};
+
+QTEST_GUILESS_MAIN(BenchHotPaths)
+#include "benchhotpaths.moc"
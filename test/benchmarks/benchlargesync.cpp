@@ -6,44 +6,140 @@
  */
 
 #include "syncenginetestutils.h"
+#include "folderwatcher.h"
 #include <syncengine.h>
 
+#include <QProcess>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
 using namespace OCC;
 
+/*
+ *   LargeSyncBench [--layout FILE] [--drop-caches] [--runs N]
+ *
+ * The tree is created on disk in a temporary folder; point TMPDIR (TMP on
+ * Windows) at the file system to measure, like a network mount. --layout
+ * creates it from a layout of test/scripts, otherwise a generated one is used.
+ *
+ * After the first sync every run measures a sync without changes, with the
+ * local discovery on its own, and the startup of the folder watcher. With
+ * --drop-caches the OS caches are dropped before each run, that takes root
+ * on Linux.
+ */
+
 int numDirs = 0;
 int numFiles = 0;
 
-template<int filesPerDir, int dirPerDir, int maxDepth>
-void addBunchOfFiles(int depth, const QString &path, FileModifier &fi) {
-    for (int fileNum = 1; fileNum <= filesPerDir; ++fileNum) {
-        QString name = QStringLiteral("file") + QString::number(fileNum);
-        fi.insert(path.isEmpty() ? name : path + "/" + name);
-        numFiles++;
+// Lines like "./dir/file.txt:1234", see test/scripts/torture_gen_layout.pl
+static bool addLayout(const QString &fileName, FileModifier &fi)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Could not open" << fileName;
+        return false;
     }
-    if (depth >= maxDepth)
-        return;
-    for (char dirNum = 1; dirNum <= dirPerDir; ++dirNum) {
-        QString name = QStringLiteral("dir") + QString::number(dirNum);
-        QString subPath = path.isEmpty() ? name : path + "/" + name;
-        fi.mkdir(subPath);
-        numDirs++;
-        addBunchOfFiles<filesPerDir, dirPerDir, maxDepth>(depth + 1, subPath, fi);
+    QSet<QString> dirs;
+    while (!file.atEnd()) {
+        const QString line = QString::fromUtf8(file.readLine()).trimmed();
+        const int colon = line.lastIndexOf(':');
+        if (colon <= 0)
+            continue;
+        QString path = line.left(colon);
+        if (path.startsWith(QLatin1String("./")))
+            path = path.mid(2);
+        for (int slash = path.indexOf('/'); slash > 0; slash = path.indexOf('/', slash + 1)) {
+            const QString dir = path.left(slash);
+            if (!dirs.contains(dir)) {
+                fi.mkdir(dir);
+                dirs.insert(dir);
+                numDirs++;
+            }
+        }
+        fi.insert(path, line.mid(colon + 1).toLongLong());
+        numFiles++;
     }
+    return true;
+}
+
+static void dropCaches()
+{
+#if defined(Q_OS_LINUX)
+    ::sync();
+    QFile dropCaches("/proc/sys/vm/drop_caches");
+    if (!dropCaches.open(QIODevice::WriteOnly) || dropCaches.write("3\n") != 2)
+        qWarning() << "Could not drop the caches:" << dropCaches.errorString();
+#elif defined(Q_OS_MAC)
+    if (QProcess::execute("purge") != 0)
+        qWarning() << "Could not drop the caches with purge";
+#else
+    qWarning() << "Dropping the caches is not supported here";
+#endif
+}
+
+// Until the watcher watches the whole tree, where that is known
+static qint64 watcherStartupMs(const QString &path)
+{
+    QElapsedTimer timer;
+    timer.start();
+    FolderWatcher watcher(path);
+#ifdef Q_OS_LINUX
+    // The initial walk of the inotify backend ends with lostChanges()
+    QEventLoop loop;
+    QObject::connect(&watcher, &FolderWatcher::lostChanges, &loop, &QEventLoop::quit);
+    QTimer::singleShot(10 * 60 * 1000, &loop, &QEventLoop::quit);
+    loop.exec();
+#endif
+    return timer.elapsed();
 }
 
 int main(int argc, char *argv[])
 {
     QCoreApplication app(argc, argv);
+
+    QString layout;
+    bool drop = false;
+    int runs = 1;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i] == "--layout" && i + 1 < args.size())
+            layout = args[++i];
+        else if (args[i] == "--drop-caches")
+            drop = true;
+        else if (args[i] == "--runs" && i + 1 < args.size())
+            runs = args[++i].toInt();
+    }
+
     FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
-    addBunchOfFiles<10, 8, 4>(0, "", fakeFolder.localModifier());
+    if (layout.isEmpty()) {
+        QStringList files;
+        addBunchOfFiles<10, 8, 4>(0, "", fakeFolder.localModifier(), &files, &numDirs);
+        numFiles += files.size();
+    } else if (!addLayout(layout, fakeFolder.localModifier())) {
+        return -1;
+    }
 
     qDebug() << "NUMFILES" << numFiles;
     qDebug() << "NUMDIRS" << numDirs;
+    qDebug() << "LOCAL PATH" << fakeFolder.localPath();
     QElapsedTimer timer;
     timer.start();
     bool result1 = fakeFolder.syncOnce();
     qDebug() << "FIRST SYNC: " << result1 << timer.restart();
-    bool result2 = fakeFolder.syncOnce();
-    qDebug() << "SECOND SYNC: " << result2 << timer.restart();
+    bool result2 = true;
+    for (int run = 0; run < runs; ++run) {
+        if (drop)
+            dropCaches();
+        qDebug() << "WATCHER STARTUP: " << watcherStartupMs(fakeFolder.localPath());
+        if (drop)
+            dropCaches();
+        timer.restart();
+        result2 = fakeFolder.syncOnce() && result2;
+        const auto &metrics = fakeFolder.syncEngine().syncRunMetrics();
+        qDebug() << "SECOND SYNC: " << result2 << timer.restart();
+        qDebug() << "LOCAL DISCOVERY: " << metrics._localDiscoveryMs << "ms for" << metrics._localStats << "entries";
+    }
     return (result1 && result2) ? 0 : -1;
 }
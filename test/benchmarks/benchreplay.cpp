@@ -0,0 +1,374 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+#include <QJsonArray>
+#include <QTextStream>
+#include <algorithm>
+
+using namespace OCC;
+
+/*
+ * Replays a sync recorded with owncloudcmd --record or OWNCLOUD_RECORD_SESSION:
+ *
+ *   ReplayBench --recording FILE [--output FILE] [--max-file-size BYTES]
+ *       [--latency MS] [--bandwidth KB/S] [--no-network]
+ *
+ * The trees of the recording, without the changes, are synced first. Then the
+ * recorded items are applied as changes on the side they came from and the
+ * sync that is measured propagates them, like the recorded one did.
+ *
+ * The fake server's link gets the median latency of the recorded requests
+ * other than the transfers and the bandwidth of the transfers, unless it is
+ * given or --no-network is used. The recorded and the replayed SyncRunMetrics
+ * are written as JSON, to stdout without --output.
+ */
+
+struct Node
+{
+    bool isDirectory = false;
+    bool isShared = false;
+    qint64 size = 0;
+};
+
+struct Item
+{
+    QString path;
+    QString renameTarget;
+    QString instruction;
+    bool up = false;
+    bool isDirectory = false;
+    qint64 size = 0;
+};
+
+struct Recording
+{
+    QJsonObject metrics;
+    QMap<QString, Node> local;
+    QMap<QString, Node> remote;
+    QVector<QJsonObject> requests;
+    QVector<Item> items;
+};
+
+// The recorder writes one element of each array per line
+static bool readRecording(const QString &fileName, Recording &recording)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not open" << fileName;
+        return false;
+    }
+    QByteArray section;
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine().trimmed();
+        if (line.endsWith(','))
+            line.chop(1);
+        if (line.startsWith("\"metrics\":")) {
+            recording.metrics = QJsonDocument::fromJson(line.mid(10)).object();
+        } else if (line.startsWith('"') && line.endsWith(":[")) {
+            section = line.mid(1, line.size() - 4);
+        } else if (line == "]") {
+            section.clear();
+        } else if (!section.isEmpty()) {
+            const QJsonDocument doc = QJsonDocument::fromJson(line);
+            if (section == "local" || section == "remote") {
+                const QJsonArray entry = doc.array();
+                Node node;
+                node.isDirectory = entry.at(1).toString() == "dir";
+                node.size = qint64(entry.at(2).toDouble());
+                node.isShared = entry.at(4).toString().contains('S');
+                (section == "local" ? recording.local : recording.remote).insert(entry.at(0).toString(), node);
+            } else if (section == "requests") {
+                recording.requests.append(doc.object());
+            } else if (section == "items") {
+                const QJsonObject obj = doc.object();
+                Item item;
+                item.path = obj.value("path").toString();
+                item.renameTarget = obj.value("renameTarget").toString();
+                item.instruction = obj.value("instruction").toString();
+                item.up = obj.value("direction").toString() == "up";
+                item.isDirectory = obj.value("type").toString() == "dir";
+                item.size = qint64(obj.value("size").toDouble());
+                recording.items.append(item);
+            }
+        }
+    }
+    return true;
+}
+
+static FakeNetworkConditions recordedConditions(const Recording &recording)
+{
+    QVector<qint64> latencies;
+    QVector<QPair<qint64, qint64>> transfers;
+    qint64 transferred = 0;
+    for (const auto &request : recording.requests) {
+        const QString verb = request.value("verb").toString();
+        const qint64 start = qint64(request.value("start").toDouble());
+        const qint64 duration = qint64(request.value("duration").toDouble());
+        if (verb == "GET" || verb == "PUT") {
+            transfers.append(qMakePair(start, start + duration));
+            transferred += qint64(request.value("sent").toDouble() + request.value("received").toDouble());
+        } else {
+            latencies.append(duration);
+        }
+    }
+
+    FakeNetworkConditions conditions;
+    if (!latencies.isEmpty()) {
+        std::sort(latencies.begin(), latencies.end());
+        conditions.latencyMs = int(latencies[latencies.size() / 2]);
+    }
+    // The transfers run in parallel, the bandwidth is that of the time any of them ran
+    std::sort(transfers.begin(), transfers.end());
+    qint64 busyMs = 0;
+    qint64 end = -1;
+    for (const auto &transfer : transfers) {
+        if (transfer.first > end)
+            busyMs += transfer.second - transfer.first;
+        else if (transfer.second > end)
+            busyMs += transfer.second - end;
+        end = qMax(end, transfer.second);
+    }
+    if (busyMs > 0)
+        conditions.bytesPerSecond = transferred * 1000 / busyMs;
+    return conditions;
+}
+
+/** The path before the recorded renames, where the seed has it */
+static QString seedPath(const QString &path, const QVector<Item> &renames)
+{
+    for (const auto &rename : renames) {
+        if (path == rename.renameTarget)
+            return rename.path;
+        if (rename.isDirectory && path.startsWith(rename.renameTarget + '/'))
+            return rename.path + path.mid(rename.renameTarget.size());
+    }
+    return path;
+}
+
+class Replay
+{
+public:
+    Replay(const Recording &recording, qint64 maxFileSize)
+        : _recording(recording)
+        , _maxFileSize(maxFileSize)
+    {
+        for (const auto &item : recording.items) {
+            if (item.instruction == "INSTRUCTION_RENAME")
+                _renames.append(item);
+            else if (item.instruction == "INSTRUCTION_NEW")
+                _newPaths.insert(item.path);
+        }
+    }
+
+    /** Both trees as they were before the recorded changes */
+    FileInfo seed()
+    {
+        QMap<QString, Node> nodes;
+        for (const auto *tree : { &_recording.local, &_recording.remote }) {
+            for (auto it = tree->constBegin(); it != tree->constEnd(); ++it) {
+                const QString path = seedPath(it.key(), _renames);
+                if (!_newPaths.contains(path) && !nodes.contains(path))
+                    nodes.insert(path, it.value());
+            }
+        }
+        // The changed side has one byte more in the measured sync
+        for (const auto &item : _recording.items) {
+            if (item.instruction == "INSTRUCTION_SYNC" || item.instruction == "INSTRUCTION_CONFLICT") {
+                auto it = nodes.find(item.path);
+                if (it != nodes.end() && !it->isDirectory)
+                    it->size = qMax<qint64>(0, item.size - 1);
+            }
+        }
+
+        FileInfo root;
+        // The parents come first in the map
+        for (auto it = nodes.constBegin(); it != nodes.constEnd(); ++it) {
+            const QString parent = it.key().section('/', 0, -2);
+            if (!parent.isEmpty() && !root.find(parent))
+                continue; // below a file of the other tree
+            if (it->isDirectory)
+                root.mkdir(it.key());
+            else
+                root.insert(it.key(), clamped(it->size));
+            root.find(it.key())->isShared = it->isShared;
+            it->isDirectory ? ++_seedDirs : ++_seedFiles;
+        }
+        return root;
+    }
+
+    /** Makes the recorded changes for the measured sync */
+    void applyChanges(FakeFolder &folder)
+    {
+        for (const auto &item : _renames) {
+            if (exists(folder, item.up, item.path) && !exists(folder, item.up, item.renameTarget)) {
+                ensureParent(folder, item.up, item.renameTarget);
+                modifier(folder, item.up).rename(item.path, item.renameTarget);
+                ++_applied;
+            }
+        }
+        for (const auto &item : _recording.items) {
+            const bool up = item.up;
+            if (item.instruction == "INSTRUCTION_REMOVE") {
+                // The removal of a directory takes its content along
+                if (exists(folder, up, item.path)) {
+                    modifier(folder, up).remove(item.path);
+                    ++_applied;
+                }
+            } else if (item.instruction == "INSTRUCTION_NEW") {
+                if (exists(folder, up, item.path))
+                    continue;
+                ensureParent(folder, up, item.path);
+                if (item.isDirectory)
+                    modifier(folder, up).mkdir(item.path);
+                else
+                    modifier(folder, up).insert(item.path, clamped(item.size));
+                ++_applied;
+            } else if (item.instruction == "INSTRUCTION_SYNC" || item.instruction == "INSTRUCTION_CONFLICT") {
+                if (item.isDirectory || !exists(folder, up, item.path))
+                    continue;
+                if (item.instruction == "INSTRUCTION_CONFLICT" && exists(folder, !up, item.path)) {
+                    modifier(folder, !up).setContents(item.path, 'C');
+                    modifier(folder, !up).appendByte(item.path);
+                }
+                modifier(folder, up).appendByte(item.path);
+                ++_applied;
+            }
+        }
+    }
+
+    QJsonObject counts() const
+    {
+        QJsonObject obj;
+        obj.insert("seedFiles", _seedFiles);
+        obj.insert("seedDirectories", _seedDirs);
+        obj.insert("recordedItems", _recording.items.size());
+        obj.insert("appliedChanges", _applied);
+        return obj;
+    }
+
+private:
+    // The changes of an item going up were made locally
+    static FileModifier &modifier(FakeFolder &folder, bool local)
+    {
+        if (local)
+            return folder.localModifier();
+        return folder.remoteModifier();
+    }
+
+    static bool exists(FakeFolder &folder, bool local, const QString &path)
+    {
+        if (local)
+            return QFileInfo::exists(folder.localPath() + path);
+        return folder.remoteModifier().find(path) != nullptr;
+    }
+
+    static void ensureParent(FakeFolder &folder, bool local, const QString &path)
+    {
+        const QStringList components = path.split('/');
+        QString parent;
+        for (int i = 0; i < components.size() - 1; ++i) {
+            parent += (i ? "/" : "") + components[i];
+            if (!exists(folder, local, parent))
+                modifier(folder, local).mkdir(parent);
+        }
+    }
+
+    qint64 clamped(qint64 size) const
+    {
+        return _maxFileSize >= 0 ? qMin(size, _maxFileSize) : size;
+    }
+
+    const Recording &_recording;
+    qint64 _maxFileSize;
+    QVector<Item> _renames;
+    QSet<QString> _newPaths;
+    int _seedFiles = 0;
+    int _seedDirs = 0;
+    int _applied = 0;
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QString recordingFile;
+    QString output;
+    qint64 maxFileSize = -1;
+    int latency = -1;
+    int bandwidth = -1;
+    bool network = true;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        const bool hasValue = i + 1 < args.size();
+        if (args[i] == "--recording" && hasValue)
+            recordingFile = args[++i];
+        else if (args[i] == "--output" && hasValue)
+            output = args[++i];
+        else if (args[i] == "--max-file-size" && hasValue)
+            maxFileSize = args[++i].toLongLong();
+        else if (args[i] == "--latency" && hasValue)
+            latency = args[++i].toInt();
+        else if (args[i] == "--bandwidth" && hasValue)
+            bandwidth = args[++i].toInt();
+        else if (args[i] == "--no-network")
+            network = false;
+    }
+    if (recordingFile.isEmpty()) {
+        qWarning() << "Usage: ReplayBench --recording FILE [--output FILE] [--max-file-size BYTES]"
+                      " [--latency MS] [--bandwidth KB/S] [--no-network]";
+        return -1;
+    }
+
+    Recording recording;
+    if (!readRecording(recordingFile, recording))
+        return -1;
+
+    Replay replay(recording, maxFileSize);
+    FakeFolder fakeFolder{ replay.seed() };
+    replay.applyChanges(fakeFolder);
+
+    FakeNetworkConditions conditions;
+    if (network) {
+        conditions = recordedConditions(recording);
+        if (latency >= 0)
+            conditions.latencyMs = latency;
+        if (bandwidth >= 0)
+            conditions.bytesPerSecond = qint64(bandwidth) * 1024;
+    }
+    fakeFolder.setNetworkConditions(conditions);
+
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = fakeFolder.syncOnce();
+    const qint64 wallMs = timer.elapsed();
+
+    QJsonObject result;
+    result.insert("recording", recordingFile);
+    result.insert("success", ok);
+    result.insert("wallMs", double(wallMs));
+    result.insert("latencyMs", conditions.latencyMs);
+    result.insert("bytesPerSecond", double(conditions.bytesPerSecond));
+    result.insert("replay", replay.counts());
+    result.insert("recorded", recording.metrics);
+    result.insert("replayed", fakeFolder.syncEngine().syncRunMetrics().toJson());
+
+    const QByteArray json = QJsonDocument(result).toJson();
+    if (output.isEmpty()) {
+        QTextStream(stdout) << json;
+    } else {
+        QFile file(output);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "Could not write" << output;
+            return -1;
+        }
+        file.write(json);
+    }
+    return ok ? 0 : -1;
+}
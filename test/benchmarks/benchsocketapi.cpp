@@ -0,0 +1,145 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "syncenginetestutils.h"
+#include "folderman.h"
+#include "socketapi.h"
+#include "theme.h"
+#include <syncengine.h>
+
+#include <QLocalSocket>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <memory>
+
+using namespace OCC;
+
+// Shell extensions connected at the same time
+static const int numClients = 4;
+// Every client asks for this many statuses every millisecond, like a file
+// manager scrolling through a big directory
+static const int requestsPerTick = 5;
+
+QStringList allFiles;
+
+/** A shell extension, it measures how long the STATUS answers take */
+struct BenchClient
+{
+    QLocalSocket socket;
+    QTimer requestTimer;
+    QHash<QString, qint64> outstanding; // the paths asked for, when
+    QVector<qint64> latenciesNs;
+    qint64 messages = 0;
+    int nextFile = 0;
+
+    BenchClient(const QString &socketPath, const QString &localPath, const QElapsedTimer &clock, int offset)
+        : nextFile(offset)
+    {
+        QObject::connect(&socket, &QLocalSocket::readyRead, [this, &clock] {
+            while (socket.canReadLine()) {
+                QString line = QString::fromUtf8(socket.readLine());
+                line.chop(1);
+                ++messages;
+                if (!line.startsWith(QLatin1String("STATUS:")))
+                    continue;
+                const QString path = line.mid(line.indexOf(QLatin1Char(':'), 7) + 1);
+                auto it = outstanding.find(path);
+                if (it == outstanding.end())
+                    continue;
+                latenciesNs.append(clock.nsecsElapsed() - *it);
+                outstanding.erase(it);
+            }
+        });
+        QObject::connect(&requestTimer, &QTimer::timeout, [this, localPath, &clock] {
+            QByteArray data;
+            for (int i = 0; i < requestsPerTick; ++i) {
+                const QString path = localPath + allFiles.at(nextFile++ % allFiles.size());
+                if (outstanding.contains(path))
+                    continue;
+                outstanding.insert(path, clock.nsecsElapsed());
+                data += "RETRIEVE_FILE_STATUS:" + path.toUtf8() + '\n';
+            }
+            socket.write(data);
+        });
+        requestTimer.setInterval(1);
+        socket.connectToServer(socketPath);
+    }
+};
+
+static qint64 percentile(const QVector<qint64> &sorted, int p)
+{
+    if (sorted.isEmpty())
+        return 0;
+    return sorted.at(qMin(sorted.size() - 1, sorted.size() * p / 100));
+}
+
+int main(int argc, char *argv[])
+{
+    // Not the socket of a client that may be running
+    QTemporaryDir runtimeDir;
+    qputenv("XDG_RUNTIME_DIR", runtimeDir.path().toLocal8Bit());
+
+    QCoreApplication app(argc, argv);
+    FolderMan folderMan;
+    FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+    addBunchOfFiles<10, 8, 3>(0, "", fakeFolder.localModifier(), &allFiles);
+    qDebug() << "NUMFILES" << allFiles.size();
+    if (!fakeFolder.syncOnce())
+        return -1;
+
+    // Like the folders of the client do
+    QObject::connect(&fakeFolder.syncEngine().syncFileStatusTracker(), &SyncFileStatusTracker::fileStatusChanged,
+        folderMan.socketApi(), &SocketApi::broadcastStatusPushMessage);
+
+    QElapsedTimer clock;
+    clock.start();
+    const QString socketPath = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation)
+        + "/" + Theme::instance()->appName() + "/socket";
+    std::vector<std::unique_ptr<BenchClient>> clients;
+    for (int i = 0; i < numClients; ++i)
+        clients.emplace_back(new BenchClient(socketPath, fakeFolder.localPath(), clock, i * allFiles.size() / numClients));
+    while (clock.elapsed() < 5000
+        && std::any_of(clients.begin(), clients.end(), [](const std::unique_ptr<BenchClient> &c) {
+               return c->socket.state() != QLocalSocket::ConnectedState;
+           })) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    }
+
+    // Change every third file, the statuses get pushed while the clients ask
+    for (int i = 0; i < allFiles.size(); i += 3)
+        fakeFolder.remoteModifier().appendByte(allFiles.at(i));
+
+    for (auto &client : clients)
+        client->requestTimer.start();
+    QElapsedTimer timer;
+    timer.start();
+    bool result = fakeFolder.syncOnce();
+    const qint64 syncMs = timer.elapsed();
+    for (auto &client : clients)
+        client->requestTimer.stop();
+    // The last answers
+    while (timer.elapsed() < syncMs + 500)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+
+    QVector<qint64> latencies;
+    qint64 messages = 0;
+    qint64 unanswered = 0;
+    for (auto &client : clients) {
+        latencies += client->latenciesNs;
+        messages += client->messages;
+        unanswered += client->outstanding.size();
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    qDebug() << "SYNC: " << result << syncMs;
+    qDebug() << "ANSWERS" << latencies.size() << "UNANSWERED" << unanswered;
+    qDebug() << "LATENCY P50 (us)" << percentile(latencies, 50) / 1000;
+    qDebug() << "LATENCY P99 (us)" << percentile(latencies, 99) / 1000;
+    qDebug() << "MESSAGES PER SECOND" << (syncMs > 0 ? messages * 1000 / syncMs : 0);
+    return result ? 0 : -1;
+}
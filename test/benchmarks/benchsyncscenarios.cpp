@@ -0,0 +1,258 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+#include <QJsonArray>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <atomic>
+#include <functional>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+using namespace OCC;
+
+/*
+ * Runs one sync of a scenario and writes what it cost as JSON:
+ *
+ *   SyncScenariosBench [--files N] [--output FILE] [--scenario NAME]
+ *       [--latency MS] [--jitter MS] [--bandwidth KB/S] [--error-rate RATE]
+ *
+ * Without --scenario every scenario runs in a process of its own, for its
+ * peak RSS, and FILE gets all the results. The log goes to stdout.
+ *
+ * The network options shape the fake server's link for the measured sync,
+ * see FakeNetworkConditions.
+ */
+
+#if defined(__GLIBC__)
+// Counts the heap allocations of the whole process, operator new included
+static std::atomic<qint64> allocations{ 0 };
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *malloc(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+static qint64 allocationCount() { return allocations.load(); }
+#else
+static qint64 allocationCount() { return -1; }
+#endif
+
+static qint64 peakRssKb()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#ifdef Q_OS_MAC
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+/** @a files files of @a size bytes, 10 per directory and 10 directories per directory */
+static QStringList addTree(FileModifier &fi, int files, qint64 size = 64)
+{
+    const int filesPerDir = 10;
+    const int dirsPerDir = 10;
+    QStringList paths;
+    QSet<QString> dirs;
+    for (int i = 0; i < files; ++i) {
+        // The digits of the directory number are the path to it
+        QString dir;
+        for (int n = i / filesPerDir; n > 0; n /= dirsPerDir) {
+            dir = (dir.isEmpty() ? QString() : dir + '/') + 'd' + QString::number(n % dirsPerDir);
+            if (!dirs.contains(dir)) {
+                fi.mkdir(dir);
+                dirs.insert(dir);
+            }
+        }
+        const QString path = (dir.isEmpty() ? QString() : dir + '/') + "file" + QString::number(i % filesPerDir);
+        fi.insert(path, size);
+        paths.append(path);
+    }
+    return paths;
+}
+
+struct Scenario
+{
+    const char *name;
+    // Prepares the folder for the sync that is measured
+    std::function<void(FakeFolder &, int files)> prepare;
+};
+
+static const Scenario scenarios[] = {
+    { "initial_download", [](FakeFolder &f, int files) { addTree(f.remoteModifier(), files); } },
+    { "initial_upload", [](FakeFolder &f, int files) { addTree(f.localModifier(), files); } },
+    { "noop_resync", [](FakeFolder &f, int files) {
+         addTree(f.remoteModifier(), files);
+         f.syncOnce();
+     } },
+    { "one_percent_changes", [](FakeFolder &f, int files) {
+         const auto paths = addTree(f.remoteModifier(), files);
+         f.syncOnce();
+         for (int i = 0; i < paths.size(); i += 200) {
+             f.localModifier().appendByte(paths[i]);
+             if (i + 100 < paths.size())
+                 f.remoteModifier().appendByte(paths[i + 100]);
+         }
+     } },
+    { "deep_renames", [](FakeFolder &f, int files) {
+         addTree(f.remoteModifier(), files);
+         f.syncOnce();
+         // The top directories hold the whole tree
+         for (int d = 1; d < 10; ++d) {
+             const QString dir = "d" + QString::number(d);
+             if (f.remoteModifier().find(dir))
+                 f.remoteModifier().rename(dir, "renamed" + QString::number(d));
+         }
+     } },
+    { "mass_deletes", [](FakeFolder &f, int files) {
+         addTree(f.remoteModifier(), files);
+         f.syncOnce();
+         for (int d = 1; d < 10; d += 2) {
+             const QString dir = "d" + QString::number(d);
+             if (f.remoteModifier().find(dir))
+                 f.remoteModifier().remove(dir);
+         }
+     } },
+    { "many_tiny_files", [](FakeFolder &f, int files) { addTree(f.remoteModifier(), files, 1); } },
+    { "few_huge_files", [](FakeFolder &f, int) {
+         for (int i = 0; i < 4; ++i)
+             f.remoteModifier().insert("huge" + QString::number(i), qint64(128) * 1024 * 1024);
+     } },
+};
+
+static QJsonObject runScenario(const Scenario &scenario, int files, const FakeNetworkConditions &conditions)
+{
+    FakeFolder fakeFolder{ FileInfo{} };
+    scenario.prepare(fakeFolder, files);
+    fakeFolder.setNetworkConditions(conditions);
+
+    qint64 requests = 0;
+    fakeFolder.setServerOverride([&requests](QNetworkAccessManager::Operation, const QNetworkRequest &) -> QNetworkReply * {
+        ++requests;
+        return nullptr;
+    });
+
+    const qint64 allocationsBefore = allocationCount();
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = fakeFolder.syncOnce();
+    const qint64 wallMs = timer.elapsed();
+    const qint64 allocationsDuring = allocationCount() - allocationsBefore;
+
+    const auto &metrics = fakeFolder.syncEngine().syncRunMetrics();
+    QJsonObject result;
+    result.insert("scenario", QLatin1String(scenario.name));
+    result.insert("files", files);
+    result.insert("latencyMs", conditions.latencyMs);
+    result.insert("bytesPerSecond", double(conditions.bytesPerSecond));
+    result.insert("success", ok);
+    result.insert("wallMs", double(wallMs));
+    result.insert("peakRssKb", double(peakRssKb()));
+    result.insert("allocations", allocationCount() < 0 ? -1.0 : double(allocationsDuring));
+    result.insert("journalQueries", double(metrics._journalQueries));
+    result.insert("requests", double(requests));
+    result.insert("metrics", metrics.toJson());
+    return result;
+}
+
+static bool writeJson(const QString &fileName, const QJsonObject &json)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    file.write(QJsonDocument(json).toJson());
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    // Before any sync structure exists, the metrics then include the instance counts
+    qputenv("OWNCLOUD_COUNT_INSTANCES", "1");
+    QCoreApplication app(argc, argv);
+
+    int files = 10000;
+    QString output = "syncscenarios.json";
+    QString scenarioName;
+    FakeNetworkConditions conditions;
+    QStringList forwardedArgs; // for the processes of the scenarios
+    QStringList args = app.arguments();
+    for (int i = 1; i + 1 < args.size(); i += 2) {
+        if (args[i] == "--files")
+            files = args[i + 1].toInt();
+        else if (args[i] == "--output")
+            output = args[i + 1];
+        else if (args[i] == "--scenario")
+            scenarioName = args[i + 1];
+        else if (args[i] == "--latency")
+            conditions.latencyMs = args[i + 1].toInt();
+        else if (args[i] == "--jitter")
+            conditions.jitterMs = args[i + 1].toInt();
+        else if (args[i] == "--bandwidth")
+            conditions.bytesPerSecond = args[i + 1].toLongLong() * 1024;
+        else if (args[i] == "--error-rate")
+            conditions.errorRate = args[i + 1].toDouble();
+        else
+            continue;
+        if (args[i] != "--output" && args[i] != "--scenario")
+            forwardedArgs << args[i] << args[i + 1];
+    }
+
+    if (!scenarioName.isEmpty()) {
+        for (const auto &scenario : scenarios) {
+            if (scenarioName == scenario.name) {
+                const auto result = runScenario(scenario, files, conditions);
+                qInfo() << "RESULT" << QJsonDocument(result).toJson(QJsonDocument::Compact).constData();
+                return writeJson(output, result) && result.value("success").toBool() ? 0 : 1;
+            }
+        }
+        qWarning() << "Unknown scenario" << scenarioName;
+        return 2;
+    }
+
+    // Every scenario in a process of its own
+    QTemporaryDir tmp;
+    QJsonArray results;
+    bool allOk = true;
+    for (const auto &scenario : scenarios) {
+        const QString resultFile = tmp.path() + '/' + scenario.name + ".json";
+        QProcess process;
+        process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        process.setStandardOutputFile(QProcess::nullDevice());
+        process.start(app.applicationFilePath(),
+            QStringList{ "--scenario", scenario.name, "--output", resultFile } + forwardedArgs);
+        process.waitForFinished(-1);
+        QFile file(resultFile);
+        if (process.exitCode() != 0 || !file.open(QIODevice::ReadOnly)) {
+            qWarning() << "Scenario" << scenario.name << "failed";
+            allOk = false;
+        }
+        const auto result = QJsonDocument::fromJson(file.readAll()).object();
+        results.append(result);
+        qInfo() << "RESULT" << QJsonDocument(result).toJson(QJsonDocument::Compact).constData();
+    }
+
+    QJsonObject json;
+    json.insert("files", files);
+    json.insert("results", results);
+    if (!writeJson(output, json)) {
+        qWarning() << "Could not write" << output;
+        return 1;
+    }
+    return allOk ? 0 : 1;
+}
@@ -116,10 +116,16 @@ static void check_csync_exclude_add(void **)
     assert_true(excludedFiles->_allExcludes.contains("/tmp/check_csync1/*"));
 
     assert_true(excludedFiles->_fullRegexFile.pattern().contains("csync1"));
-    assert_false(excludedFiles->_bnameActivationRegexFile.pattern().contains("csync1"));
+    // The basename is "*", every file has to be checked against the full regex
+    assert_true(excludedFiles->_bnameActivationFile.matchAll);
+    assert_false(excludedFiles->_bnameActivationFile.names.contains("csync1"));
 
     excludedFiles->addManualExclude("foo");
-    assert_true(excludedFiles->_bnameActivationRegexFile.pattern().contains("foo"));
+    assert_true(excludedFiles->_bnameActivationFile.names.contains("foo"));
+    assert_true(excludedFiles->_bnameActivationDir.names.contains("foo"));
+
+    excludedFiles->addManualExclude("*.part");
+    assert_true(excludedFiles->_bnameActivationFile.suffixes.contains(".part"));
 }
 
 static void check_csync_excluded(void **)
@@ -287,6 +293,9 @@ static void check_csync_excluded_traversal(void **)
     assert_int_equal(check_file_traversal("word_tmp/my_manuscript.run.xml"), CSYNC_NOT_EXCLUDED);
     assert_int_equal(check_file_traversal("latex/my_manuscript.tex.tmp"), CSYNC_NOT_EXCLUDED);
     assert_int_equal(check_file_traversal("latex/songbook/my_manuscript.tex.tmp"), CSYNC_FILE_EXCLUDE_LIST);
+    assert_int_equal(check_file_traversal("latex/songbook/other/my_manuscript.tex.tmp"), CSYNC_NOT_EXCLUDED);
+    assert_int_equal(check_file_traversal("latex/poems/my_manuscript.tex.tmp"), CSYNC_FILE_EXCLUDE_LIST);
+    assert_int_equal(check_file_traversal("latex/songbook/my_manuscript.tex.tmp"), CSYNC_FILE_EXCLUDE_LIST);
 
 #ifdef _WIN32
     assert_int_equal(check_file_traversal("file_trailing_space "), CSYNC_FILE_EXCLUDE_TRAILING_SPACE);
@@ -87,6 +87,34 @@ static void check_iconv_ascii(void **state)
     (void) state; /* unused */
 }
 
+static void check_iconv_from_native_repeated(void **state)
+{
+#ifdef _WIN32
+    const mbchar_t *in = L"\x48\xe4/abc"; // UTF-16
+    const int name_len = 2;
+#else
+#ifdef __APPLE__
+    const mbchar_t *in = "\x48\x61\xcc\x88/abc"; // UTF-8-MAC
+    const int name_len = 4;
+#else
+    const mbchar_t *in = "\x48\xc3\xa4/abc"; // UTF-8
+    const int name_len = 3;
+#endif
+#endif
+    const char *exp_out = "\x48\xc3\xa4"; // UTF-8
+
+    // The second conversion of a name may come from the cache
+    for (int i = 0; i < 2; ++i) {
+        QByteArray out = c_utf8_from_locale(in, name_len);
+        assert_string_equal(out, exp_out);
+    }
+
+    QByteArray ascii = c_utf8_from_locale(in + name_len + 1, 2);
+    assert_string_equal(ascii, "ab");
+
+    (void) state; /* unused */
+}
+
 #define TESTSTRING "#cA\\#fß§4"
 #define LTESTSTRING L"#cA\\#fß§4"
 
@@ -176,6 +204,7 @@ int torture_run_tests(void)
         cmocka_unit_test(check_iconv_ascii),
         cmocka_unit_test(check_iconv_to_native_normalization),
         cmocka_unit_test(check_iconv_from_native_normalization),
+        cmocka_unit_test(check_iconv_from_native_repeated),
 
     };
 
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "davhandler.h"
+
+#include <QBuffer>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocale>
+#include <QRegExp>
+#include <QXmlStreamWriter>
+
+#include <algorithm>
+#include <functional>
+
+static const QString davUri = QStringLiteral("DAV:");
+static const QString ocUri = QStringLiteral("http://owncloud.org/ns");
+
+static QString parentPath(const QString &path)
+{
+    const int slash = path.lastIndexOf('/');
+    return slash < 0 ? QString() : path.left(slash);
+}
+
+static QByteArray httpDate(qint64 mtime)
+{
+    return QLocale::c().toString(QDateTime::fromTime_t(mtime).toUTC(), "ddd, dd MMM yyyy HH:mm:ss 'GMT'").toLatin1();
+}
+
+static HttpResponse jsonResponse(const QJsonObject &json)
+{
+    HttpResponse response(200, QJsonDocument(json).toJson(QJsonDocument::Compact));
+    response.setHeader("Content-Type", "application/json; charset=utf-8");
+    return response;
+}
+
+static QJsonObject statusJson()
+{
+    return QJsonObject{
+        { "installed", true },
+        { "maintenance", false },
+        { "needsDbUpgrade", false },
+        { "version", "10.0.3.3" },
+        { "versionstring", "10.0.3" },
+        { "edition", "Community" },
+        { "productname", "ownCloud" },
+    };
+}
+
+static QJsonObject capabilitiesJson()
+{
+    QJsonObject capabilities{
+        { "core", QJsonObject{ { "pollinterval", 60 }, { "webdav-root", "remote.php/webdav" }, { "status", statusJson() } } },
+        { "dav", QJsonObject{ { "chunking", "1.0" } } },
+        { "checksums", QJsonObject{ { "supportedTypes", QJsonArray{ "SHA1" } }, { "preferredUploadType", "SHA1" } } },
+    };
+    QJsonObject data{
+        { "version", QJsonObject{ { "major", 10 }, { "minor", 0 }, { "micro", 3 }, { "string", "10.0.3" } } },
+        { "capabilities", capabilities },
+    };
+    return QJsonObject{
+        { "ocs", QJsonObject{ { "meta", QJsonObject{ { "status", "ok" }, { "statuscode", 100 }, { "message", "OK" } } }, { "data", data } } },
+    };
+}
+
+DavHandler::DavHandler(std::unique_ptr<DavStorage> files)
+    : _files(std::move(files))
+{
+}
+
+DavStorage *DavHandler::resolve(const QString &urlPath, QString *path, QString *davPrefix)
+{
+    const int remote = urlPath.indexOf(QLatin1String("/remote.php/"));
+    if (remote < 0)
+        return nullptr;
+    const QString rest = urlPath.mid(remote + 12);
+    DavStorage *storage = nullptr;
+    int prefixLength = remote + 12;
+    if (rest == QLatin1String("webdav") || rest.startsWith(QLatin1String("webdav/"))) {
+        storage = _files.get();
+        prefixLength += 6;
+    } else {
+        // dav/files/<user> or dav/uploads/<user>
+        QRegExp dav("^(dav/(files|uploads)/[^/]+)(/.*)?$");
+        if (!dav.exactMatch(rest))
+            return nullptr;
+        storage = dav.cap(2) == QLatin1String("files") ? _files.get() : &_uploads;
+        prefixLength += dav.cap(1).size();
+    }
+    *davPrefix = urlPath.left(prefixLength) + '/';
+    QString relative = urlPath.mid(prefixLength);
+    while (relative.startsWith('/'))
+        relative.remove(0, 1);
+    while (relative.endsWith('/'))
+        relative.chop(1);
+    *path = relative;
+    return storage;
+}
+
+HttpResponse DavHandler::handle(const HttpRequest &request)
+{
+    const QString urlPath = request.url.path();
+    if (urlPath.endsWith(QLatin1String("/status.php")))
+        return jsonResponse(statusJson());
+    if (urlPath.endsWith(QLatin1String("/ocs/v1.php/cloud/capabilities")) || urlPath.endsWith(QLatin1String("/ocs/v2.php/cloud/capabilities")))
+        return jsonResponse(capabilitiesJson());
+
+    QString path;
+    QString davPrefix;
+    DavStorage *storage = resolve(urlPath, &path, &davPrefix);
+    if (!storage)
+        return HttpResponse(404);
+
+    const QByteArray &method = request.method;
+    if (method == "PROPFIND")
+        return propfind(request, storage, path, davPrefix);
+    if (method == "GET" || method == "HEAD")
+        return get(request, storage, path);
+    if (method == "PUT")
+        return put(request, storage, path);
+    if (method == "MKCOL")
+        return mkcol(storage, path);
+    if (method == "DELETE")
+        return remove(storage, path);
+    if (method == "MOVE")
+        return move(request, storage, path);
+    return HttpResponse(501);
+}
+
+DavHandler::Meta &DavHandler::meta(DavStorage *storage, const QString &path)
+{
+    auto &meta = _meta[storage][path];
+    if (meta.etag.isEmpty()) {
+        meta.etag = QByteArray::number(++_lastEtag, 16);
+        meta.fileId = QByteArray::number(++_lastFileId).rightJustified(8, '0') + "ocmock";
+    }
+    return meta;
+}
+
+void DavHandler::changed(DavStorage *storage, const QString &path)
+{
+    QString p = path;
+    forever {
+        meta(storage, p).etag = QByteArray::number(++_lastEtag, 16);
+        if (p.isEmpty())
+            break;
+        p = parentPath(p);
+    }
+}
+
+void DavHandler::addFileHeaders(HttpResponse *response, DavStorage *storage, const QString &path)
+{
+    const Meta &m = meta(storage, path);
+    response->setHeader("ETag", '"' + m.etag + '"');
+    response->setHeader("OC-ETag", '"' + m.etag + '"');
+    response->setHeader("OC-FileId", m.fileId);
+    if (!m.checksum.isEmpty())
+        response->setHeader("OC-Checksum", m.checksum);
+}
+
+HttpResponse DavHandler::propfind(const HttpRequest &request, DavStorage *storage, const QString &path, const QString &davPrefix)
+{
+    DavEntry root;
+    if (!storage->stat(path, &root))
+        return HttpResponse(404);
+    const QByteArray depth = request.header("Depth");
+
+    QByteArray payload;
+    QBuffer buffer(&payload);
+    buffer.open(QIODevice::WriteOnly);
+    QXmlStreamWriter xml(&buffer);
+    xml.writeStartDocument();
+    xml.writeNamespace(davUri, "d");
+    xml.writeNamespace(ocUri, "oc");
+    xml.writeStartElement(davUri, QStringLiteral("multistatus"));
+
+    std::function<qint64(const QString &)> treeSize = [&](const QString &dirPath) {
+        qint64 size = 0;
+        for (const auto &child : storage->list(dirPath)) {
+            const QString childPath = dirPath.isEmpty() ? child.name : dirPath + '/' + child.name;
+            size += child.isDir ? treeSize(childPath) : child.size;
+        }
+        return size;
+    };
+    auto writeEntry = [&](const QString &entryPath, const DavEntry &entry) {
+        const Meta &m = meta(storage, entryPath);
+        xml.writeStartElement(davUri, QStringLiteral("response"));
+        QString href = davPrefix + entryPath;
+        if (entry.isDir && !entryPath.isEmpty())
+            href += '/';
+        xml.writeTextElement(davUri, QStringLiteral("href"), QString::fromLatin1(QUrl::toPercentEncoding(href, "/")));
+        xml.writeStartElement(davUri, QStringLiteral("propstat"));
+        xml.writeStartElement(davUri, QStringLiteral("prop"));
+        xml.writeStartElement(davUri, QStringLiteral("resourcetype"));
+        if (entry.isDir)
+            xml.writeEmptyElement(davUri, QStringLiteral("collection"));
+        xml.writeEndElement(); // resourcetype
+        xml.writeTextElement(davUri, QStringLiteral("getlastmodified"), QString::fromLatin1(httpDate(entry.mtime)));
+        if (entry.isDir)
+            xml.writeTextElement(ocUri, QStringLiteral("size"), QString::number(treeSize(entryPath)));
+        else
+            xml.writeTextElement(davUri, QStringLiteral("getcontentlength"), QString::number(entry.size));
+        xml.writeTextElement(davUri, QStringLiteral("getetag"), '"' + QString::fromLatin1(m.etag) + '"');
+        xml.writeTextElement(ocUri, QStringLiteral("id"), QString::fromLatin1(m.fileId));
+        xml.writeTextElement(ocUri, QStringLiteral("permissions"), entry.isDir ? QStringLiteral("RDNVCK") : QStringLiteral("RDNVW"));
+        if (!m.checksum.isEmpty()) {
+            xml.writeStartElement(ocUri, QStringLiteral("checksums"));
+            xml.writeTextElement(ocUri, QStringLiteral("checksum"), QString::fromLatin1(m.checksum));
+            xml.writeEndElement(); // checksums
+        }
+        xml.writeEndElement(); // prop
+        xml.writeTextElement(davUri, QStringLiteral("status"), QStringLiteral("HTTP/1.1 200 OK"));
+        xml.writeEndElement(); // propstat
+        xml.writeEndElement(); // response
+    };
+    std::function<void(const QString &)> writeChildren = [&](const QString &dirPath) {
+        for (const auto &child : storage->list(dirPath)) {
+            const QString childPath = dirPath.isEmpty() ? child.name : dirPath + '/' + child.name;
+            writeEntry(childPath, child);
+            if (child.isDir && depth == "infinity")
+                writeChildren(childPath);
+        }
+    };
+
+    writeEntry(path, root);
+    if (root.isDir && depth != "0")
+        writeChildren(path);
+    xml.writeEndElement(); // multistatus
+    xml.writeEndDocument();
+
+    HttpResponse response(207, payload);
+    response.setHeader("Content-Type", "application/xml; charset=utf-8");
+    return response;
+}
+
+HttpResponse DavHandler::get(const HttpRequest &request, DavStorage *storage, const QString &path)
+{
+    DavEntry entry;
+    if (!storage->stat(path, &entry) || entry.isDir)
+        return HttpResponse(404);
+
+    HttpResponse response;
+    QRegExp range("bytes=(\\d+)-(\\d*)");
+    if (range.exactMatch(QString::fromLatin1(request.header("Range")))) {
+        const qint64 first = range.cap(1).toLongLong();
+        const qint64 last = range.cap(2).isEmpty() ? entry.size - 1 : qMin(range.cap(2).toLongLong(), entry.size - 1);
+        if (first >= entry.size || last < first) {
+            response.status = 416;
+            response.setHeader("Content-Range", "bytes */" + QByteArray::number(entry.size));
+            return response;
+        }
+        response.status = 206;
+        response.body = storage->read(path, first, last - first + 1);
+        response.setHeader("Content-Range", "bytes " + QByteArray::number(first) + '-' + QByteArray::number(last)
+                + '/' + QByteArray::number(entry.size));
+    } else {
+        response.body = storage->read(path);
+    }
+    response.setHeader("Content-Type", "application/octet-stream");
+    response.setHeader("Last-Modified", httpDate(entry.mtime));
+    addFileHeaders(&response, storage, path);
+    return response;
+}
+
+HttpResponse DavHandler::put(const HttpRequest &request, DavStorage *storage, const QString &path)
+{
+    DavEntry entry;
+    const bool existed = storage->stat(path, &entry);
+    if (existed && entry.isDir)
+        return HttpResponse(409);
+    const QByteArray mtimeHeader = request.header("X-OC-Mtime");
+    const qint64 mtime = mtimeHeader.isEmpty() ? QDateTime::currentDateTimeUtc().toTime_t() : mtimeHeader.toLongLong();
+    if (!storage->write(path, request.body, mtime))
+        return HttpResponse(409);
+    changed(storage, path);
+    meta(storage, path).checksum = request.header("OC-Checksum");
+
+    HttpResponse response(existed ? 204 : 201);
+    addFileHeaders(&response, storage, path);
+    if (!mtimeHeader.isEmpty())
+        response.setHeader("X-OC-MTime", "accepted");
+    return response;
+}
+
+HttpResponse DavHandler::mkcol(DavStorage *storage, const QString &path)
+{
+    DavEntry entry;
+    if (storage->stat(path, &entry))
+        return HttpResponse(405);
+    if (!storage->mkdir(path))
+        return HttpResponse(409);
+    changed(storage, path);
+    HttpResponse response(201);
+    response.setHeader("OC-FileId", meta(storage, path).fileId);
+    return response;
+}
+
+HttpResponse DavHandler::remove(DavStorage *storage, const QString &path)
+{
+    DavEntry entry;
+    if (path.isEmpty() || !storage->stat(path, &entry))
+        return HttpResponse(404);
+    if (!storage->remove(path))
+        return HttpResponse(500);
+    auto &metas = _meta[storage];
+    const QString prefix = path + '/';
+    for (auto it = metas.begin(); it != metas.end();) {
+        if (it.key() == path || it.key().startsWith(prefix))
+            it = metas.erase(it);
+        else
+            ++it;
+    }
+    changed(storage, parentPath(path));
+    return HttpResponse(204);
+}
+
+HttpResponse DavHandler::move(const HttpRequest &request, DavStorage *storage, const QString &path)
+{
+    QString destination;
+    QString davPrefix;
+    DavStorage *destinationStorage = resolve(QUrl::fromEncoded(request.header("Destination")).path(), &destination, &davPrefix);
+    if (!destinationStorage)
+        return HttpResponse(400);
+    if (storage == &_uploads && destinationStorage == _files.get() && path.endsWith(QLatin1String("/.file")))
+        return assembleChunks(request, parentPath(path), destinationStorage, destination);
+    if (storage != destinationStorage)
+        return HttpResponse(501);
+
+    DavEntry entry;
+    if (!storage->stat(path, &entry))
+        return HttpResponse(404);
+    DavEntry existing;
+    const bool existed = storage->stat(destination, &existing);
+    if (existed && request.header("Overwrite") == "F")
+        return HttpResponse(412);
+    if (!storage->move(path, destination))
+        return HttpResponse(409);
+
+    // The file ids move along
+    auto &metas = _meta[storage];
+    QHash<QString, Meta> moved;
+    const QString prefix = path + '/';
+    for (auto it = metas.begin(); it != metas.end();) {
+        if (it.key() == path || it.key().startsWith(prefix)) {
+            moved.insert(destination + it.key().mid(path.size()), it.value());
+            it = metas.erase(it);
+        } else if (it.key() == destination || it.key().startsWith(destination + '/')) {
+            it = metas.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto it = moved.begin(); it != moved.end(); ++it)
+        metas.insert(it.key(), it.value());
+    changed(storage, parentPath(path));
+    changed(storage, destination);
+
+    HttpResponse response(existed ? 204 : 201);
+    if (!entry.isDir)
+        addFileHeaders(&response, storage, destination);
+    return response;
+}
+
+HttpResponse DavHandler::assembleChunks(const HttpRequest &request, const QString &uploadDir, DavStorage *storage, const QString &path)
+{
+    auto chunks = _uploads.list(uploadDir);
+    std::sort(chunks.begin(), chunks.end(), [](const DavEntry &a, const DavEntry &b) { return a.name < b.name; });
+    QByteArray data;
+    for (const auto &chunk : chunks) {
+        if (!chunk.isDir && chunk.name != QLatin1String(".file"))
+            data += _uploads.read(uploadDir + '/' + chunk.name);
+    }
+    const QByteArray totalLength = request.header("OC-Total-Length");
+    if (!totalLength.isEmpty() && totalLength.toLongLong() != data.size())
+        return HttpResponse(400);
+
+    DavEntry existing;
+    const bool existed = storage->stat(path, &existing);
+    const QByteArray mtimeHeader = request.header("X-OC-Mtime");
+    const qint64 mtime = mtimeHeader.isEmpty() ? QDateTime::currentDateTimeUtc().toTime_t() : mtimeHeader.toLongLong();
+    if (!storage->write(path, data, mtime))
+        return HttpResponse(409);
+    remove(&_uploads, uploadDir);
+    changed(storage, path);
+    meta(storage, path).checksum = request.header("OC-Checksum");
+
+    HttpResponse response(existed ? 204 : 201);
+    addFileHeaders(&response, storage, path);
+    if (!mtimeHeader.isEmpty())
+        response.setHeader("X-OC-MTime", "accepted");
+    return response;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "davstorage.h"
+#include "httpserver.h"
+
+#include <QHash>
+#include <memory>
+
+/**
+ * @brief The ownCloud server as far as the sync client needs it
+ *
+ * Serves status.php, the capabilities and WebDAV below remote.php/webdav
+ * and remote.php/dav/files/<user>: PROPFIND, GET with ranges, PUT, MKCOL,
+ * DELETE and MOVE, as well as the uploads of chunking NG below
+ * remote.php/dav/uploads/<user>. Any credentials are accepted.
+ *
+ * The etags and file ids are kept in memory: the etag of a directory
+ * changes with anything below it, as on a real server.
+ */
+class DavHandler
+{
+public:
+    explicit DavHandler(std::unique_ptr<DavStorage> files);
+
+    HttpResponse handle(const HttpRequest &request);
+
+private:
+    struct Meta
+    {
+        QByteArray etag;
+        QByteArray fileId;
+        QByteArray checksum;
+    };
+
+    // The storage and the path in it for @a urlPath, the prefix of the path in @a davPrefix
+    DavStorage *resolve(const QString &urlPath, QString *path, QString *davPrefix);
+
+    HttpResponse propfind(const HttpRequest &request, DavStorage *storage, const QString &path, const QString &davPrefix);
+    HttpResponse get(const HttpRequest &request, DavStorage *storage, const QString &path);
+    HttpResponse put(const HttpRequest &request, DavStorage *storage, const QString &path);
+    HttpResponse mkcol(DavStorage *storage, const QString &path);
+    HttpResponse remove(DavStorage *storage, const QString &path);
+    HttpResponse move(const HttpRequest &request, DavStorage *storage, const QString &path);
+    HttpResponse assembleChunks(const HttpRequest &request, const QString &uploadDir, DavStorage *storage, const QString &path);
+
+    Meta &meta(DavStorage *storage, const QString &path);
+    // New etags for @a path and the directories above it
+    void changed(DavStorage *storage, const QString &path);
+    void addFileHeaders(HttpResponse *response, DavStorage *storage, const QString &path);
+
+    std::unique_ptr<DavStorage> _files;
+    // Chunks are collected in memory, whatever the storage of the files
+    MemoryStorage _uploads;
+    QHash<DavStorage *, QHash<QString, Meta>> _meta;
+    qint64 _lastEtag = 0;
+    qint64 _lastFileId = 0;
+};
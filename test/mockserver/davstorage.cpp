@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "davstorage.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_WIN
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+static QString parentPath(const QString &path)
+{
+    const int slash = path.lastIndexOf('/');
+    return slash < 0 ? QString() : path.left(slash);
+}
+
+static QString fileName(const QString &path)
+{
+    return path.mid(path.lastIndexOf('/') + 1);
+}
+
+MemoryStorage::MemoryStorage()
+{
+    _nodes.insert(QString(), Node{ true, QDateTime::currentDateTimeUtc().toTime_t(), QByteArray() });
+}
+
+bool MemoryStorage::parentExists(const QString &path) const
+{
+    auto it = _nodes.find(parentPath(path));
+    return it != _nodes.end() && it->isDir;
+}
+
+bool MemoryStorage::stat(const QString &path, DavEntry *entry)
+{
+    auto it = _nodes.find(path);
+    if (it == _nodes.end())
+        return false;
+    entry->name = fileName(path);
+    entry->isDir = it->isDir;
+    entry->size = it->data.size();
+    entry->mtime = it->mtime;
+    return true;
+}
+
+QList<DavEntry> MemoryStorage::list(const QString &path)
+{
+    QList<DavEntry> entries;
+    const QString prefix = path.isEmpty() ? QString() : path + '/';
+    for (auto it = _nodes.lowerBound(prefix); it != _nodes.end() && it.key().startsWith(prefix); ++it) {
+        if (it.key() == path || it.key().indexOf('/', prefix.size()) >= 0)
+            continue;
+        DavEntry entry;
+        stat(it.key(), &entry);
+        entries.append(entry);
+    }
+    return entries;
+}
+
+QByteArray MemoryStorage::read(const QString &path, qint64 offset, qint64 length)
+{
+    auto it = _nodes.find(path);
+    if (it == _nodes.end() || it->isDir)
+        return QByteArray();
+    return it->data.mid(offset, length);
+}
+
+bool MemoryStorage::write(const QString &path, const QByteArray &data, qint64 mtime)
+{
+    if (!parentExists(path) || (_nodes.contains(path) && _nodes[path].isDir))
+        return false;
+    _nodes.insert(path, Node{ false, mtime, data });
+    return true;
+}
+
+bool MemoryStorage::mkdir(const QString &path)
+{
+    if (!parentExists(path) || _nodes.contains(path))
+        return false;
+    _nodes.insert(path, Node{ true, QDateTime::currentDateTimeUtc().toTime_t(), QByteArray() });
+    return true;
+}
+
+bool MemoryStorage::remove(const QString &path)
+{
+    if (path.isEmpty() || !_nodes.remove(path))
+        return false;
+    const QString prefix = path + '/';
+    auto it = _nodes.lowerBound(prefix);
+    while (it != _nodes.end() && it.key().startsWith(prefix))
+        it = _nodes.erase(it);
+    return true;
+}
+
+bool MemoryStorage::move(const QString &from, const QString &to)
+{
+    if (from.isEmpty() || !_nodes.contains(from) || !parentExists(to)
+        || to == from || to.startsWith(from + '/'))
+        return false;
+    remove(to);
+    QMap<QString, Node> moved;
+    moved.insert(to, _nodes.take(from));
+    const QString prefix = from + '/';
+    auto it = _nodes.lowerBound(prefix);
+    while (it != _nodes.end() && it.key().startsWith(prefix)) {
+        moved.insert(to + it.key().mid(from.size()), it.value());
+        it = _nodes.erase(it);
+    }
+    for (auto m = moved.begin(); m != moved.end(); ++m)
+        _nodes.insert(m.key(), m.value());
+    return true;
+}
+
+DirectoryStorage::DirectoryStorage(const QString &root)
+    : _root(root)
+{
+    _root.mkpath(".");
+}
+
+bool DirectoryStorage::stat(const QString &path, DavEntry *entry)
+{
+    const QFileInfo info(filePath(path));
+    if (!info.exists())
+        return false;
+    entry->name = fileName(path);
+    entry->isDir = info.isDir();
+    entry->size = info.isDir() ? 0 : info.size();
+    entry->mtime = info.lastModified().toTime_t();
+    return true;
+}
+
+QList<DavEntry> DirectoryStorage::list(const QString &path)
+{
+    QList<DavEntry> entries;
+    const QDir dir(filePath(path));
+    for (const auto &info : dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden)) {
+        DavEntry entry;
+        entry.name = info.fileName();
+        entry.isDir = info.isDir();
+        entry.size = info.isDir() ? 0 : info.size();
+        entry.mtime = info.lastModified().toTime_t();
+        entries.append(entry);
+    }
+    return entries;
+}
+
+QByteArray DirectoryStorage::read(const QString &path, qint64 offset, qint64 length)
+{
+    QFile file(filePath(path));
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(offset))
+        return QByteArray();
+    return length < 0 ? file.readAll() : file.read(length);
+}
+
+bool DirectoryStorage::write(const QString &path, const QByteArray &data, qint64 mtime)
+{
+    QFile file(filePath(path));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(data) != data.size())
+        return false;
+    file.close();
+#ifdef Q_OS_WIN
+    struct _utimbuf times = { time_t(mtime), time_t(mtime) };
+    return _wutime(reinterpret_cast<const wchar_t *>(file.fileName().utf16()), &times) == 0;
+#else
+    struct utimbuf times = { time_t(mtime), time_t(mtime) };
+    return utime(QFile::encodeName(file.fileName()).constData(), &times) == 0;
+#endif
+}
+
+bool DirectoryStorage::mkdir(const QString &path)
+{
+    return _root.mkdir(path);
+}
+
+bool DirectoryStorage::remove(const QString &path)
+{
+    if (path.isEmpty())
+        return false;
+    const QFileInfo info(filePath(path));
+    if (info.isDir())
+        return QDir(info.filePath()).removeRecursively();
+    return QFile::remove(info.filePath());
+}
+
+bool DirectoryStorage::move(const QString &from, const QString &to)
+{
+    if (from.isEmpty() || to == from || to.startsWith(from + '/'))
+        return false;
+    if (QFileInfo::exists(filePath(to)))
+        remove(to);
+    return _root.rename(from, to);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) by the ownCloud developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include <QDir>
+#include <QList>
+#include <QMap>
+#include <QString>
+
+/** A file or directory of a DavStorage */
+struct DavEntry
+{
+    QString name;
+    bool isDir = false;
+    qint64 size = 0;
+    qint64 mtime = 0; // seconds since the epoch
+};
+
+/**
+ * @brief Where the WebDAV mock keeps the content of the files
+ *
+ * The paths are relative to the root, without a leading slash; the root
+ * itself is the empty path. The etags and file ids are kept by the caller.
+ */
+class DavStorage
+{
+public:
+    virtual ~DavStorage() {}
+
+    virtual bool stat(const QString &path, DavEntry *entry) = 0;
+    virtual QList<DavEntry> list(const QString &path) = 0;
+    /** At most @a length bytes from @a offset, -1 for all of them */
+    virtual QByteArray read(const QString &path, qint64 offset = 0, qint64 length = -1) = 0;
+    /** Creates or replaces the file, its parent must exist */
+    virtual bool write(const QString &path, const QByteArray &data, qint64 mtime) = 0;
+    virtual bool mkdir(const QString &path) = 0;
+    /** Removes a file or a directory with all of its content */
+    virtual bool remove(const QString &path) = 0;
+    /** Moves a file or directory, replacing the destination */
+    virtual bool move(const QString &from, const QString &to) = 0;
+};
+
+/** Keeps everything in memory, for measuring without the disk */
+class MemoryStorage : public DavStorage
+{
+public:
+    MemoryStorage();
+
+    bool stat(const QString &path, DavEntry *entry) override;
+    QList<DavEntry> list(const QString &path) override;
+    QByteArray read(const QString &path, qint64 offset, qint64 length) override;
+    bool write(const QString &path, const QByteArray &data, qint64 mtime) override;
+    bool mkdir(const QString &path) override;
+    bool remove(const QString &path) override;
+    bool move(const QString &from, const QString &to) override;
+
+private:
+    struct Node
+    {
+        bool isDir;
+        qint64 mtime;
+        QByteArray data;
+    };
+    bool parentExists(const QString &path) const;
+
+    // By path, the children of a directory follow it
+    QMap<QString, Node> _nodes;
+};
+
+/** Keeps the files in a directory of the local file system */
+class DirectoryStorage : public DavStorage
+{
+public:
+    explicit DirectoryStorage(const QString &root);
+
+    bool stat(const QString &path, DavEntry *entry) override;
+    QList<DavEntry> list(const QString &path) override;
+    QByteArray read(const QString &path, qint64 offset, qint64 length) override;
+    bool write(const QString &path, const QByteArray &data, qint64 mtime) override;
+    bool mkdir(const QString &path) override;
+    bool remove(const QString &path) override;
+    bool move(const QString &from, const QString &to) override;
+
+private:
+    QString filePath(const QString &path) const { return _root.filePath(path); }
+
+    QDir _root;
+};
@@ -14,51 +14,197 @@
 
 #include "httpserver.h"
 
-HttpServer::HttpServer(quint16 port, QObject* parent)
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocale>
+#include <QSslSocket>
+#include <QTextStream>
+
+static const char *reasonPhrase(int status)
+{
+    switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 207: return "Multi-Status";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 412: return "Precondition Failed";
+    case 416: return "Range Not Satisfiable";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    default: return "Unknown";
+    }
+}
+
+HttpServer::HttpServer(const Handler &handler, QObject *parent)
     : QTcpServer(parent)
+    , _handler(handler)
 {
-    listen(QHostAddress::Any, port);
 }
 
-void HttpServer::readClient()
+void HttpServer::setSslConfiguration(const QSslConfiguration &configuration)
+{
+    _sslConfiguration = configuration;
+    _ssl = true;
+}
+
+void HttpServer::incomingConnection(qintptr socketDescriptor)
 {
-    QTcpSocket* socket = (QTcpSocket*)sender();
-    if (socket->canReadLine()) {
-        QStringList tokens = QString(socket->readLine()).split(QRegExp("[ \r\n][ \r\n]*"));
-        if (tokens[0] == "GET") {
-            QTextStream os(socket);
-            os.setAutoDetectUnicode(true);
-            os << "HTTP/1.0 200 Ok\r\n"
-                "Content-Type: text/html; charset=\"utf-8\"\r\n"
-                "\r\n"
-                "<h1>Nothing to see here</h1>\n"
-                << QDateTime::currentDateTimeUtc().toString() << "\n";
-            socket->close();
+    QTcpSocket *socket;
+    if (_ssl) {
+        auto sslSocket = new QSslSocket(this);
+        sslSocket->setSslConfiguration(_sslConfiguration);
+        socket = sslSocket;
+    } else {
+        socket = new QTcpSocket(this);
+    }
+    connect(socket, &QTcpSocket::readyRead, this, &HttpServer::readClient);
+    connect(socket, &QTcpSocket::disconnected, this, &HttpServer::discardClient);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        delete socket;
+        return;
+    }
+    if (_ssl)
+        static_cast<QSslSocket *>(socket)->startServerEncryption();
+    _buffers.insert(socket, QByteArray());
+    ++_connections;
+}
 
-            QtServiceBase::instance()->logMessage("Wrote to client");
+void HttpServer::readClient()
+{
+    auto socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket || !_buffers.contains(socket))
+        return;
+    QByteArray &buffer = _buffers[socket];
+    const QByteArray data = socket->readAll();
+    _bytesReceived += data.size();
+    buffer += data;
 
-            if (socket->state() == QTcpSocket::UnconnectedState) {
-                delete socket;
-                QtServiceBase::instance()->logMessage("Connection closed");
-            }
+    HttpRequest request;
+    while (takeRequest(buffer, &request)) {
+        QElapsedTimer timer;
+        timer.start();
+        HttpResponse response = request.method.isEmpty() ? HttpResponse(400) : _handler(request);
+        const qint64 ns = timer.nsecsElapsed();
+        _handlerNs += ns;
+        ++_requests[request.method];
+        if (_verbose) {
+            QTextStream(stdout) << request.method << ' ' << request.url.path() << ' ' << response.status
+                                << ' ' << ns / 1000 << "us" << endl;
+        }
+        writeResponse(socket, request, response);
+        if (request.method.isEmpty() || request.version == "HTTP/1.0"
+            || request.header("Connection").toLower() == "close") {
+            socket->disconnectFromHost();
+            return;
         }
+        request = HttpRequest();
     }
 }
+
 void HttpServer::discardClient()
 {
-    QTcpSocket* socket = (QTcpSocket*)sender();
+    auto socket = qobject_cast<QTcpSocket *>(sender());
+    _buffers.remove(socket);
     socket->deleteLater();
+}
 
-    QtServiceBase::instance()->logMessage("Connection closed");
+bool HttpServer::takeRequest(QByteArray &buffer, HttpRequest *request)
+{
+    const int headerEnd = buffer.indexOf("\r\n\r\n");
+    if (headerEnd < 0)
+        return false;
+    const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+    const QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+    if (requestLine.size() != 3) {
+        // Answered with 400 and the connection is closed
+        buffer.clear();
+        return true;
+    }
+    QMap<QByteArray, QByteArray> headers;
+    for (int i = 1; i < lines.size(); ++i) {
+        const int colon = lines[i].indexOf(':');
+        if (colon > 0)
+            headers.insert(lines[i].left(colon).trimmed().toLower(), lines[i].mid(colon + 1).trimmed());
+    }
+
+    int pos = headerEnd + 4;
+    QByteArray body;
+    if (headers.value("transfer-encoding").toLower() == "chunked") {
+        forever {
+            const int lineEnd = buffer.indexOf("\r\n", pos);
+            if (lineEnd < 0)
+                return false;
+            bool ok = false;
+            const int size = buffer.mid(pos, lineEnd - pos).split(';').first().trimmed().toInt(&ok, 16);
+            if (!ok) {
+                buffer.clear();
+                return true;
+            }
+            if (buffer.size() < lineEnd + 2 + size + 2)
+                return false;
+            body += buffer.mid(lineEnd + 2, size);
+            pos = lineEnd + 2 + size + 2;
+            if (size == 0)
+                break;
+        }
+    } else {
+        const qint64 length = headers.value("content-length").toLongLong();
+        if (buffer.size() - pos < length)
+            return false;
+        body = buffer.mid(pos, length);
+        pos += length;
+    }
+
+    request->method = requestLine[0];
+    request->url = QUrl::fromEncoded(requestLine[1]);
+    request->version = requestLine[2];
+    request->headers = headers;
+    request->body = body;
+    buffer.remove(0, pos);
+    return true;
+}
+
+void HttpServer::writeResponse(QTcpSocket *socket, const HttpRequest &request, const HttpResponse &response)
+{
+    QByteArray head = "HTTP/1.1 " + QByteArray::number(response.status) + ' ' + reasonPhrase(response.status) + "\r\n";
+    head += "Date: " + QLocale::c().toString(QDateTime::currentDateTimeUtc(), "ddd, dd MMM yyyy HH:mm:ss 'GMT'").toLatin1() + "\r\n";
+    head += "Content-Length: " + QByteArray::number(response.body.size()) + "\r\n";
+    for (const auto &header : response.headers)
+        head += header.first + ": " + header.second + "\r\n";
+    head += "\r\n";
+    socket->write(head);
+    _bytesSent += head.size();
+    if (request.method != "HEAD") {
+        socket->write(response.body);
+        _bytesSent += response.body.size();
+    }
 }
 
+QByteArray HttpServer::stats() const
+{
+    QJsonObject requests;
+    for (auto it = _requests.begin(); it != _requests.end(); ++it)
+        requests.insert(QString::fromLatin1(it.key()), double(it.value()));
+    QJsonObject json;
+    json.insert("requests", requests);
+    json.insert("connections", double(_connections));
+    json.insert("bytesReceived", double(_bytesReceived));
+    json.insert("bytesSent", double(_bytesSent));
+    json.insert("handlerMs", _handlerNs / 1e6);
+    return QJsonDocument(json).toJson();
+}
 
-void HttpServer::incomingConnection(int socket)
+void HttpServer::resetStats()
 {
-    if (disabled)
-        return;
-    QTcpSocket* s = new QTcpSocket(this);
-    connect(s, SIGNAL(readyRead()), this, SLOT(readClient()));
-    connect(s, SIGNAL(disconnected()), this, SLOT(discardClient()));
-    s->setSocketDescriptor(socket);
+    _requests.clear();
+    _bytesReceived = 0;
+    _bytesSent = 0;
+    _handlerNs = 0;
+    _connections = 0;
 }
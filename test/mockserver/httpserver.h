@@ -12,16 +12,90 @@
  * for more details.
  */
 
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QSslConfiguration>
 #include <QTcpServer>
+#include <QUrl>
+
+#include <functional>
+
+class QTcpSocket;
+
+struct HttpRequest
+{
+    QByteArray method;
+    QUrl url;
+    QByteArray version;
+    QMap<QByteArray, QByteArray> headers; // the names in lower case
+    QByteArray body;
+
+    QByteArray header(const QByteArray &name) const { return headers.value(name.toLower()); }
+};
 
+struct HttpResponse
+{
+    int status = 200;
+    QList<QPair<QByteArray, QByteArray>> headers;
+    QByteArray body;
+
+    HttpResponse() {}
+    HttpResponse(int status, const QByteArray &body = QByteArray())
+        : status(status)
+        , body(body)
+    {
+    }
+    void setHeader(const QByteArray &name, const QByteArray &value) { headers.append(qMakePair(name, value)); }
+};
+
+/**
+ * A HTTP/1.1 server with persistent connections, optionally over TLS.
+ *
+ * The requests are answered by the handler one at a time, in the order
+ * they arrive on a connection. The server counts what it did, see stats().
+ */
 class HttpServer : public QTcpServer
- {
-     Q_OBJECT
- public:
-    HttpServer(qint16 port, QObject* parent = 0);
-    void incomingConnection(int socket);
-
- private slots:
-     void readClient();
-     void discardClient();
- };
+{
+    Q_OBJECT
+public:
+    using Handler = std::function<HttpResponse(const HttpRequest &)>;
+
+    HttpServer(const Handler &handler, QObject *parent = 0);
+
+    /** Serves HTTPS with the certificate and key of @a configuration */
+    void setSslConfiguration(const QSslConfiguration &configuration);
+
+    /** Prints every request with the time it took to answer */
+    void setVerbose(bool verbose) { _verbose = verbose; }
+
+    /** The requests per method, the bytes transferred and the time spent in the handler */
+    QByteArray stats() const;
+    void resetStats();
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private slots:
+    void readClient();
+    void discardClient();
+
+private:
+    // Whether a complete request was taken from the front of @a buffer
+    bool takeRequest(QByteArray &buffer, HttpRequest *request);
+    void writeResponse(QTcpSocket *socket, const HttpRequest &request, const HttpResponse &response);
+
+    Handler _handler;
+    QSslConfiguration _sslConfiguration;
+    bool _ssl = false;
+    bool _verbose = false;
+    QHash<QTcpSocket *, QByteArray> _buffers;
+
+    QMap<QByteArray, qint64> _requests;
+    qint64 _bytesReceived = 0;
+    qint64 _bytesSent = 0;
+    qint64 _handlerNs = 0;
+    qint64 _connections = 0;
+};
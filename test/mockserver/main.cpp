@@ -13,12 +13,90 @@
  */
 
 #include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QSslCertificate>
+#include <QSslKey>
+#include <QSslSocket>
+#include <QTextStream>
 
+#include "davhandler.h"
 #include "httpserver.h"
 
-int main(int argc, char* argv[])
+/*
+ * A WebDAV server for running owncloudcmd against over real sockets:
+ *
+ *   mockserver [--port N] [--storage memory|DIR] [--cert FILE --key FILE] [--verbose]
+ *
+ *   owncloudcmd --trust --non-interactive -u user -p pass LOCALDIR https://localhost:N/
+ *
+ * GET /_mock/stats answers what the server did since the start or the last
+ * POST /_mock/reset: the requests per method, the bytes and the time spent
+ * answering, the rest of the time of a sync is the client's.
+ */
+int main(int argc, char *argv[])
 {
-  QCoreApplication app(argc, argv);
-  HttpServer server;
-  return app.exec();
+    QCoreApplication app(argc, argv);
+
+    quint16 port = 8080;
+    QString storageName = "memory";
+    QString certFile;
+    QString keyFile;
+    bool verbose = false;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        const bool hasValue = i + 1 < args.size();
+        if (args[i] == "--port" && hasValue)
+            port = args[++i].toUShort();
+        else if (args[i] == "--storage" && hasValue)
+            storageName = args[++i];
+        else if (args[i] == "--cert" && hasValue)
+            certFile = args[++i];
+        else if (args[i] == "--key" && hasValue)
+            keyFile = args[++i];
+        else if (args[i] == "--verbose")
+            verbose = true;
+    }
+
+    std::unique_ptr<DavStorage> storage;
+    if (storageName == "memory")
+        storage.reset(new MemoryStorage);
+    else
+        storage.reset(new DirectoryStorage(storageName));
+    DavHandler dav(std::move(storage));
+
+    HttpServer *serverPtr = nullptr;
+    HttpServer server([&dav, &serverPtr](const HttpRequest &request) {
+        if (request.url.path() == QLatin1String("/_mock/stats"))
+            return HttpResponse(200, serverPtr->stats());
+        if (request.url.path() == QLatin1String("/_mock/reset")) {
+            serverPtr->resetStats();
+            return HttpResponse(204);
+        }
+        return dav.handle(request);
+    });
+    serverPtr = &server;
+    server.setVerbose(verbose);
+
+    if (!certFile.isEmpty()) {
+        QFile cert(certFile);
+        QFile key(keyFile);
+        if (!cert.open(QIODevice::ReadOnly) || !key.open(QIODevice::ReadOnly)) {
+            qWarning() << "Could not read the certificate or the key";
+            return 1;
+        }
+        QSslConfiguration configuration = QSslConfiguration::defaultConfiguration();
+        configuration.setLocalCertificate(QSslCertificate(&cert, QSsl::Pem));
+        configuration.setPrivateKey(QSslKey(&key, QSsl::Rsa, QSsl::Pem));
+        configuration.setPeerVerifyMode(QSslSocket::VerifyNone);
+        server.setSslConfiguration(configuration);
+    }
+
+    if (!server.listen(QHostAddress::Any, port)) {
+        qWarning() << "Could not listen on port" << port << server.errorString();
+        return 1;
+    }
+    QTextStream(stdout) << "Serving " << storageName << " on port " << server.serverPort()
+                        << (certFile.isEmpty() ? "" : " with TLS") << endl;
+    return app.exec();
 }
@@ -14,10 +14,16 @@
 #include "common/syncjournaldb.h"
 
 #include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QNetworkReply>
 #include <QMap>
 #include <QtTest>
 
+#include <functional>
+#include <random>
+#include <zlib.h>
+
 /*
  * TODO: In theory we should use QVERIFY instead of Q_ASSERT for testing, but this
  * only works when directly called from a QTest :-(
@@ -27,6 +33,7 @@
 static const QUrl sRootUrl("owncloud://somehost/owncloud/remote.php/webdav/");
 static const QUrl sRootUrl2("owncloud://somehost/owncloud/remote.php/dav/files/admin/");
 static const QUrl sUploadUrl("owncloud://somehost/owncloud/remote.php/dav/uploads/admin/");
+static const QUrl sBulkUrl("owncloud://somehost/owncloud/remote.php/dav/bulk");
 
 inline QString getFilePathFromUrl(const QUrl &url) {
     QString path = url.path();
@@ -43,6 +50,82 @@ inline QString getFilePathFromUrl(const QUrl &url) {
 inline QString generateEtag() {
     return QString::number(QDateTime::currentDateTimeUtc().toMSecsSinceEpoch(), 16);
 }
+
+/*
+ * How the fake server link behaves, see FakeQNAM::setNetworkConditions().
+ *
+ * Every request waits latencyMs plus up to jitterMs, then its payload goes over
+ * one link of bytesPerSecond that all the requests share. A request fails with
+ * errorCode at errorRate. The same seed gives the same jitter and failures, so
+ * a benchmark can be repeated.
+ */
+struct FakeNetworkConditions
+{
+    int latencyMs = 0;
+    int jitterMs = 0;
+    qint64 bytesPerSecond = 0; // 0 for no limit
+    double errorRate = 0;
+    int errorCode = 503;
+    quint32 seed = 1;
+
+    bool isInstant() const { return latencyMs <= 0 && jitterMs <= 0 && bytesPerSecond <= 0; }
+};
+
+class FakeNetwork
+{
+public:
+    virtual ~FakeNetwork() = default;
+
+    const FakeNetworkConditions &networkConditions() const { return _conditions; }
+    void setNetworkConditions(const FakeNetworkConditions &conditions)
+    {
+        _conditions = conditions;
+        _random.seed(conditions.seed);
+        _clock.start();
+        _linkFreeAtMs = 0;
+    }
+
+    // When a reply that transfers @a bytes finishes, in ms from now
+    qint64 nextDelay(qint64 bytes)
+    {
+        if (_conditions.isInstant())
+            return 0;
+        const qint64 now = _clock.elapsed();
+        qint64 start = now + std::max(0, _conditions.latencyMs);
+        if (_conditions.jitterMs > 0)
+            start += std::uniform_int_distribution<int>(0, _conditions.jitterMs)(_random);
+        if (_conditions.bytesPerSecond <= 0)
+            return start - now;
+        // The transfers queue on the link
+        start = std::max(start, _linkFreeAtMs);
+        _linkFreeAtMs = start + bytes * 1000 / _conditions.bytesPerSecond;
+        return _linkFreeAtMs - now;
+    }
+
+    bool nextFails()
+    {
+        return _conditions.errorRate > 0
+            && std::uniform_real_distribution<double>(0, 1)(_random) < _conditions.errorRate;
+    }
+
+private:
+    FakeNetworkConditions _conditions;
+    std::mt19937 _random;
+    QElapsedTimer _clock;
+    qint64 _linkFreeAtMs = 0;
+};
+
+// Calls @a method of @a reply once its transfer of @a bytes is over
+inline void scheduleResponse(QNetworkReply *reply, const char *method, qint64 bytes = 0)
+{
+    auto network = dynamic_cast<FakeNetwork *>(reply->parent());
+    const qint64 delay = network ? network->nextDelay(bytes) : 0;
+    if (delay <= 0) {
+        QMetaObject::invokeMethod(reply, method, Qt::QueuedConnection);
+        return;
+    }
+    QTimer::singleShot(delay, reply, [reply, method] { QMetaObject::invokeMethod(reply, method); });
+}
 inline QByteArray generateFileId() {
     return QByteArray::number(qrand(), 16);
 }
@@ -328,7 +411,7 @@ public:
         Q_ASSERT(!fileName.isNull()); // for root, it should be empty
         const FileInfo *fileInfo = remoteRootFileInfo.find(fileName);
         if (!fileInfo) {
-            QMetaObject::invokeMethod(this, "respond404", Qt::QueuedConnection);
+            scheduleResponse(this, "respond404");
             return;
         }
         QString prefix = request.url().path().left(request.url().path().size() - fileName.size());
@@ -343,6 +426,14 @@ public:
         xml.writeNamespace(ocUri, "oc");
         xml.writeStartDocument();
         xml.writeStartElement(davUri, QStringLiteral("multistatus"));
+        std::function<qint64(const FileInfo &)> totalSize = [&](const FileInfo &fileInfo) -> qint64 {
+            if (!fileInfo.isDir)
+                return fileInfo.size;
+            qint64 size = 0;
+            foreach (const FileInfo &childFileInfo, fileInfo.children)
+                size += totalSize(childFileInfo);
+            return size;
+        };
         auto writeFileResponse = [&](const FileInfo &fileInfo) {
             xml.writeStartElement(davUri, QStringLiteral("response"));
 
@@ -365,6 +456,8 @@ public:
             xml.writeTextElement(ocUri, QStringLiteral("permissions"), fileInfo.isShared ? QStringLiteral("SRDNVCKW") : QStringLiteral("RDNVCKW"));
             xml.writeTextElement(ocUri, QStringLiteral("id"), fileInfo.fileId);
             xml.writeTextElement(ocUri, QStringLiteral("checksums"), fileInfo.checksums);
+            if (fileInfo.isDir)
+                xml.writeTextElement(ocUri, QStringLiteral("size"), QString::number(totalSize(fileInfo)));
             buffer.write(fileInfo.extraDavProperties);
             xml.writeEndElement(); // prop
             xml.writeTextElement(davUri, QStringLiteral("status"), "HTTP/1.1 200 OK");
@@ -373,12 +466,19 @@ public:
         };
 
         writeFileResponse(*fileInfo);
-        foreach(const FileInfo &childFileInfo, fileInfo->children)
-           writeFileResponse(childFileInfo);
+        const bool infinity = request.rawHeader("Depth") == "infinity";
+        std::function<void(const FileInfo &)> writeChildren = [&](const FileInfo &parentInfo) {
+            foreach (const FileInfo &childFileInfo, parentInfo.children) {
+                writeFileResponse(childFileInfo);
+                if (infinity)
+                    writeChildren(childFileInfo);
+            }
+        };
+        writeChildren(*fileInfo);
         xml.writeEndElement(); // multistatus
         xml.writeEndDocument();
 
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        scheduleResponse(this, "respond", payload.size());
     }
 
     Q_INVOKABLE void respond() {
@@ -410,6 +510,28 @@ public:
     }
 };
 
+// The body of an upload sent with Content-Encoding gzip, null if it is not valid
+inline QByteArray gunzip(const QByteArray &data)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 16) != Z_OK)
+        return QByteArray();
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    stream.avail_in = data.size();
+    QByteArray result;
+    char buffer[16 * 1024];
+    int ret;
+    do {
+        stream.next_out = reinterpret_cast<Bytef *>(buffer);
+        stream.avail_out = sizeof(buffer);
+        ret = inflate(&stream, Z_NO_FLUSH);
+        result.append(buffer, int(sizeof(buffer) - stream.avail_out));
+    } while (ret == Z_OK);
+    inflateEnd(&stream);
+    return ret == Z_STREAM_END ? result : QByteArray();
+}
+
 class FakePutReply : public QNetworkReply
 {
     Q_OBJECT
@@ -438,7 +560,7 @@ public:
         }
         fileInfo->lastModified = OCC::Utility::qDateTimeFromTime_t(request.rawHeader("X-OC-Mtime").toLongLong());
         remoteRootFileInfo.find(fileName, /*invalidate_etags=*/true);
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        scheduleResponse(this, "respond", putPayload.size());
     }
 
     Q_INVOKABLE void respond() {
@@ -455,6 +577,85 @@ public:
     qint64 readData(char *, qint64) override { return 0; }
 };
 
+// Answers a bundle of uploads, see OCC::BundleUploadJob
+class FakeBulkUploadReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    QByteArray payload;
+
+    FakeBulkUploadReply(FileInfo &remoteRootFileInfo, const QHash<QString, int> &errorPaths, QNetworkAccessManager::Operation op,
+                        const QNetworkRequest &request, const QByteArray &body, QObject *parent)
+    : QNetworkReply{parent} {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+
+        const QByteArray contentType = request.rawHeader("Content-Type");
+        const QByteArray delimiter = "--" + contentType.mid(contentType.indexOf("boundary=") + 9) + "\r\n";
+        QJsonObject result;
+        int pos = body.indexOf(delimiter);
+        while (pos >= 0) {
+            pos += delimiter.size();
+            const int headersEnd = body.indexOf("\r\n\r\n", pos);
+            Q_ASSERT(headersEnd > 0);
+            QMap<QByteArray, QByteArray> headers;
+            for (const auto &line : body.mid(pos, headersEnd - pos).split('\n')) {
+                const int colon = line.indexOf(':');
+                headers[line.left(colon)] = line.mid(colon + 1).trimmed();
+            }
+            const int size = headers["Content-Length"].toInt();
+            const QByteArray data = body.mid(headersEnd + 4, size);
+            pos = body.indexOf(delimiter, headersEnd + 4 + size);
+
+            const QString path = QString::fromUtf8(headers["X-File-Path"]);
+            const QString fileName = path.mid(1);
+            QJsonObject fileResult;
+            if (errorPaths.contains(fileName)) {
+                fileResult["error"] = true;
+                result[path] = fileResult;
+                continue;
+            }
+            FileInfo *fileInfo = remoteRootFileInfo.find(fileName);
+            if (fileInfo) {
+                fileInfo->size = data.size();
+                fileInfo->contentChar = data.at(0);
+            } else {
+                fileInfo = remoteRootFileInfo.create(fileName, data.size(), data.at(0));
+            }
+            fileInfo->lastModified = OCC::Utility::qDateTimeFromTime_t(headers["X-File-Mtime"].toLongLong());
+            remoteRootFileInfo.find(fileName, /*invalidate_etags=*/true);
+            fileResult["error"] = false;
+            fileResult["etag"] = fileInfo->etag;
+            fileResult["fileid"] = QString::fromUtf8(fileInfo->fileId);
+            result[path] = fileResult;
+        }
+        payload = QJsonDocument(result).toJson();
+        scheduleResponse(this, "respond", body.size());
+    }
+
+    Q_INVOKABLE void respond() {
+        setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        setFinished(true);
+        emit metaDataChanged();
+        if (bytesAvailable())
+            emit readyRead();
+        emit finished();
+    }
+
+    void abort() override { }
+
+    qint64 bytesAvailable() const override { return payload.size() + QIODevice::bytesAvailable(); }
+    qint64 readData(char *data, qint64 maxlen) override {
+        qint64 len = std::min(qint64{payload.size()}, maxlen);
+        std::copy(payload.cbegin(), payload.cbegin() + len, data);
+        payload.remove(0, len);
+        return len;
+    }
+};
+
 class FakeMkcolReply : public QNetworkReply
 {
     Q_OBJECT
@@ -475,7 +676,7 @@ public:
             abort();
             return;
         }
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        scheduleResponse(this, "respond");
     }
 
     Q_INVOKABLE void respond() {
@@ -503,7 +704,7 @@ public:
         QString fileName = getFilePathFromUrl(request.url());
         Q_ASSERT(!fileName.isEmpty());
         remoteRootFileInfo.remove(fileName);
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        scheduleResponse(this, "respond");
     }
 
     Q_INVOKABLE void respond() {
@@ -532,7 +733,7 @@ public:
         QString dest = getFilePathFromUrl(QUrl::fromEncoded(request.rawHeader("Destination")));
         Q_ASSERT(!dest.isEmpty());
         remoteRootFileInfo.rename(fileName, dest);
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        scheduleResponse(this, "respond");
     }
 
     Q_INVOKABLE void respond() {
@@ -545,6 +746,56 @@ public:
     qint64 readData(char *, qint64) override { return 0; }
 };
 
+class FakeCopyReply : public QNetworkReply
+{
+    Q_OBJECT
+    FileInfo *fileInfo = nullptr;
+public:
+    FakeCopyReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
+    : QNetworkReply{parent} {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+
+        QString fileName = getFilePathFromUrl(request.url());
+        Q_ASSERT(!fileName.isEmpty());
+        QString dest = getFilePathFromUrl(QUrl::fromEncoded(request.rawHeader("Destination")));
+        Q_ASSERT(!dest.isEmpty());
+        const FileInfo *source = remoteRootFileInfo.find(fileName);
+        // Fails if the source changed or if the destination exists
+        if (source && request.rawHeader("If").endsWith("([\"" + source->etag.toLatin1() + "\"])")
+            && !(request.rawHeader("Overwrite") == "F" && remoteRootFileInfo.find(dest))) {
+            const qint64 size = source->size;
+            const char contentChar = source->contentChar;
+            fileInfo = remoteRootFileInfo.create(dest, size, contentChar);
+            fileInfo->lastModified = OCC::Utility::qDateTimeFromTime_t(request.rawHeader("X-OC-Mtime").toLongLong());
+            remoteRootFileInfo.find(dest, /*invalidate_etags=*/true);
+        }
+        scheduleResponse(this, "respond");
+    }
+
+    Q_INVOKABLE void respond() {
+        if (!fileInfo) {
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 412);
+            setError(InternalServerError, "Precondition Failed");
+            emit metaDataChanged();
+            emit finished();
+            return;
+        }
+        setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
+        setRawHeader("ETag", fileInfo->etag.toLatin1());
+        setRawHeader("OC-FileId", fileInfo->fileId);
+        setRawHeader("X-OC-MTime", "accepted");
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 201);
+        emit metaDataChanged();
+        emit finished();
+    }
+
+    void abort() override { }
+    qint64 readData(char *, qint64) override { return 0; }
+};
+
 class FakeGetReply : public QNetworkReply
 {
     Q_OBJECT
@@ -564,7 +815,7 @@ public:
         QString fileName = getFilePathFromUrl(request.url());
         Q_ASSERT(!fileName.isEmpty());
         fileInfo = remoteRootFileInfo.find(fileName);
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        scheduleResponse(this, "respond", fileInfo ? fileInfo->size : 0);
     }
 
     Q_INVOKABLE void respond() {
@@ -576,18 +827,32 @@ public:
         }
         payload = fileInfo->contentChar;
         size = fileInfo->size;
+        // Only the closed ranges of the segmented downloads are supported
+        QRegExp range("bytes=(\\d+)-(\\d+)");
+        if (range.exactMatch(QString::fromLatin1(request().rawHeader("Range")))) {
+            const qint64 first = range.cap(1).toLongLong();
+            const qint64 last = std::min<qint64>(range.cap(2).toLongLong(), fileInfo->size - 1);
+            size = last - first + 1;
+            setRawHeader("Content-Range", "bytes " + QByteArray::number(first) + '-' + QByteArray::number(last)
+                    + '/' + QByteArray::number(fileInfo->size));
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 206);
+        } else {
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        }
         setHeader(QNetworkRequest::ContentLengthHeader, size);
-        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
         setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
         setRawHeader("ETag", fileInfo->etag.toLatin1());
         setRawHeader("OC-FileId", fileInfo->fileId);
         emit metaDataChanged();
         if (bytesAvailable())
             emit readyRead();
+        // Like a real reply, so that a job that was choked can still finish once it read the rest
+        setFinished(true);
         emit finished();
     }
 
     void abort() override {
+        setError(OperationCanceledError, "Operation Canceled");
         aborted = true;
     }
     qint64 bytesAvailable() const override {
@@ -647,7 +912,9 @@ public:
             ++count;
         } while(true);
 
-        Q_ASSERT(count > 1); // There should be at least two chunks, otherwise why would we use chunking?
+        // A delta upload only has the chunks that changed
+        const bool delta = request.hasRawHeader("OC-Delta-Base");
+        Q_ASSERT(delta || count > 1); // There should be at least two chunks, otherwise why would we use chunking?
         QCOMPARE(sourceFolder->children.count(), count); // There should not be holes or extra files
 
         QString fileName = getFilePathFromUrl(QUrl::fromEncoded(request.rawHeader("Destination")));
@@ -660,10 +927,18 @@ public:
                 QMetaObject::invokeMethod(this, "respondPreconditionFailed", Qt::QueuedConnection);
                 return;
             }
+            if (delta) {
+                QCOMPARE(request.rawHeader("OC-Delta-Base"), fileInfo->etag.toLatin1());
+                // The chunks replace parts of the existing content
+                size = request.rawHeader("OC-Total-Length").toInt();
+                if (!payload)
+                    payload = fileInfo->contentChar;
+            }
             fileInfo->size = size;
             fileInfo->contentChar = payload;
         } else {
             Q_ASSERT(!request.hasRawHeader("If"));
+            Q_ASSERT(!delta);
             // Assume that the file is filled with the same character
             fileInfo = remoteRootFileInfo.create(fileName, size, payload);
         }
@@ -710,7 +985,7 @@ public:
         setUrl(request.url());
         setOperation(op);
         open(QIODevice::ReadOnly);
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        scheduleResponse(this, "respond");
     }
 
     Q_INVOKABLE void respond() {
@@ -726,6 +1001,47 @@ public:
     int _httpErrorCode;
 };
 
+// A reply with a fixed body, for the requests that are not about the files
+class FakePayloadReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    FakePayloadReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request,
+        const QByteArray &body, QObject *parent, int httpCode = 200)
+        : QNetworkReply{ parent }
+        , _body(body)
+        , _httpCode(httpCode)
+    {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+        scheduleResponse(this, "respond", _body.size());
+    }
+
+    Q_INVOKABLE void respond()
+    {
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, _httpCode);
+        setHeader(QNetworkRequest::ContentLengthHeader, _body.size());
+        emit metaDataChanged();
+        emit readyRead();
+        emit finished();
+    }
+
+    void abort() override { }
+    qint64 bytesAvailable() const override { return _body.size() + QIODevice::bytesAvailable(); }
+    qint64 readData(char *data, qint64 maxlen) override
+    {
+        qint64 len = std::min(qint64(_body.size()), maxlen);
+        std::copy(_body.cbegin(), _body.cbegin() + len, data);
+        _body.remove(0, static_cast<int>(len));
+        return len;
+    }
+
+    QByteArray _body;
+    int _httpCode;
+};
+
 // A reply that never responds
 class FakeHangingReply : public QNetworkReply
 {
@@ -740,11 +1056,15 @@ public:
         open(QIODevice::ReadOnly);
     }
 
-    void abort() override {}
+    void abort() override {
+        setError(OperationCanceledError, "Operation Canceled");
+        emit metaDataChanged();
+        emit finished();
+    }
     qint64 readData(char *, qint64) override { return 0; }
 };
 
-class FakeQNAM : public QNetworkAccessManager
+class FakeQNAM : public QNetworkAccessManager, public FakeNetwork
 {
 public:
     using Override = std::function<QNetworkReply *(Operation, const QNetworkRequest &)>;
@@ -773,6 +1093,10 @@ protected:
             if (auto reply = _override(op, request))
                 return reply;
         }
+        if (nextFails())
+            return new FakeErrorReply{op, request, this, networkConditions().errorCode};
+        if (request.url().path() == sBulkUrl.path())
+            return new FakeBulkUploadReply{_remoteRootFileInfo, _errorPaths, op, request, outgoingData->readAll(), this};
         const QString fileName = getFilePathFromUrl(request.url());
         Q_ASSERT(!fileName.isNull());
         if (_errorPaths.contains(fileName))
@@ -787,12 +1111,18 @@ protected:
             return new FakePropfindReply{info, op, request, this};
         else if (verb == QLatin1String("GET") || op == QNetworkAccessManager::GetOperation)
             return new FakeGetReply{info, op, request, this};
-        else if (verb == QLatin1String("PUT") || op == QNetworkAccessManager::PutOperation)
-            return new FakePutReply{info, op, request, outgoingData->readAll(), this};
+        else if (verb == QLatin1String("PUT") || op == QNetworkAccessManager::PutOperation) {
+            QByteArray payload = outgoingData->readAll();
+            if (request.rawHeader("Content-Encoding") == "gzip")
+                payload = gunzip(payload);
+            return new FakePutReply{info, op, request, payload, this};
+        }
         else if (verb == QLatin1String("MKCOL"))
             return new FakeMkcolReply{info, op, request, this};
         else if (verb == QLatin1String("DELETE") || op == QNetworkAccessManager::DeleteOperation)
             return new FakeDeleteReply{info, op, request, this};
+        else if (verb == QLatin1String("COPY"))
+            return new FakeCopyReply{info, op, request, this};
         else if (verb == QLatin1String("MOVE") && !isUpload)
             return new FakeMoveReply{info, op, request, this};
         else if (verb == QLatin1String("MOVE") && isUpload)
@@ -813,7 +1143,7 @@ public:
     virtual QString user() const { return "admin"; }
     virtual QNetworkAccessManager *createQNAM() const { return _qnam; }
     virtual bool ready() const { return true; }
-    virtual void fetchFromKeychain() { }
+    virtual void fetchFromKeychain() { _wasFetched = true; emit fetched(); }
     virtual void askFromUser() { }
     virtual bool stillValid(QNetworkReply *) { return true; }
     virtual void persist() { }
@@ -881,6 +1211,7 @@ public:
     };
     ErrorList serverErrorPaths() { return {_fakeQnam}; }
     void setServerOverride(const FakeQNAM::Override &override) { _fakeQnam->setOverride(override); }
+    void setNetworkConditions(const FakeNetworkConditions &conditions) { _fakeQnam->setNetworkConditions(conditions); }
 
     QString localPath() const {
         // SyncEngine wants a trailing slash
@@ -974,6 +1305,35 @@ namespace OCC {
     }
 }
 
+/** Adds filesPerDir files and dirPerDir directories to @a path, and as much to
+ * the new directories down to maxDepth
+ *
+ * The paths of the new files are appended to @a files and the number of new
+ * directories is added to @a dirCount, when they are set.
+ */
+template <int filesPerDir, int dirPerDir, int maxDepth>
+void addBunchOfFiles(int depth, const QString &path, FileModifier &fi,
+    QStringList *files = nullptr, int *dirCount = nullptr)
+{
+    for (int fileNum = 1; fileNum <= filesPerDir; ++fileNum) {
+        QString name = QStringLiteral("file") + QString::number(fileNum);
+        QString filePath = path.isEmpty() ? name : path + "/" + name;
+        fi.insert(filePath);
+        if (files)
+            files->append(filePath);
+    }
+    if (depth >= maxDepth)
+        return;
+    for (char dirNum = 1; dirNum <= dirPerDir; ++dirNum) {
+        QString name = QStringLiteral("dir") + QString::number(dirNum);
+        QString subPath = path.isEmpty() ? name : path + "/" + name;
+        fi.mkdir(subPath);
+        if (dirCount)
+            ++*dirCount;
+        addBunchOfFiles<filesPerDir, dirPerDir, maxDepth>(depth + 1, subPath, fi, files, dirCount);
+    }
+}
+
 inline void addFiles(QStringList &dest, const FileInfo &fi)
 {
     if (fi.isDir) {
@@ -146,6 +146,50 @@ using namespace OCC;
 #endif
     }
 
+    void testChecksumCalculator() {
+        QFile file(_testfile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const QByteArray data = file.readAll();
+
+        QList<QByteArray> types = { checkSumMD5C, checkSumSHA1C, checkSumXXH64C };
+#ifdef ZLIB_FOUND
+        types.append(checkSumAdlerC);
+#endif
+        foreach (const QByteArray &type, types) {
+            ChecksumCalculator calculator(type);
+            QVERIFY(calculator.isValid());
+            // In uneven pieces, like the network delivers them
+            for (int pos = 0; pos < data.size(); pos += 1000)
+                calculator.addData(data.constData() + pos, qMin(1000, data.size() - pos));
+            QCOMPARE(calculator.result(), ComputeChecksum::computeNow(_testfile, type));
+        }
+        QVERIFY(!ChecksumCalculator("Klaas32").isValid());
+    }
+
+    void testXXHash64() {
+        // The reference values of xxHash
+        ChecksumCalculator empty(checkSumXXH64C);
+        QCOMPARE(empty.result(), QByteArray("ef46db3751d8e999"));
+        ChecksumCalculator abc(checkSumXXH64C);
+        abc.addData("abc", 3);
+        QCOMPARE(abc.result(), QByteArray("44bc2cf5ad770999"));
+
+        QCOMPARE(findBestChecksum("SHA1:abc XXH64:def MD5:123"), QByteArray("XXH64:def"));
+        QVERIFY(isChecksumTypeSupported(checkSumXXH64C));
+        QVERIFY(!isChecksumTypeSupported("BLAKE3"));
+    }
+
+    void testKnownChecksum() {
+        _successDown = false;
+        ValidateChecksumHeader vali;
+        connect(&vali, SIGNAL(validated(QByteArray,QByteArray)), this, SLOT(slotDownValidated()));
+        // The file isn't read when the checksum is known
+        QMap<QByteArray, QByteArray> known;
+        known[checkSumSHA1C] = "abcdef";
+        vali.setKnownChecksums(known);
+        vali.start(_root + "/nonexistent", "SHA1:abcdef");
+        QVERIFY(_successDown);
+    }
 
     void cleanupTestCase() {
     }
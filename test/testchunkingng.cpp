@@ -65,6 +65,142 @@ private slots:
     }
 
 
+    // Several chunks of a big file are uploaded at the same time
+    void testParallelChunkUpload() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"} } } });
+        const int size = 300 * 1000 * 1000; // 300 MB
+
+        int runningPuts = 0;
+        int maxRunningPuts = 0;
+        QList<quint64> offsets;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation) {
+                offsets.append(request.rawHeader("OC-Chunk-Offset").toULongLong());
+                maxRunningPuts = qMax(maxRunningPuts, ++runningPuts);
+            }
+            return nullptr;
+        });
+        // Counted from the creation of a PUT until it's done
+        QObject::connect(fakeFolder.syncEngine().account()->networkAccessManager(), &QNetworkAccessManager::finished,
+            [&](QNetworkReply *reply) {
+                if (reply->operation() == QNetworkAccessManager::PutOperation)
+                    --runningPuts;
+            });
+
+        fakeFolder.localModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size);
+        QCOMPARE(runningPuts, 0);
+        QVERIFY(maxRunningPuts > 1);
+        // Every part of the file was sent once
+        QVERIFY(std::is_sorted(offsets.begin(), offsets.end()));
+        QCOMPARE(offsets.toSet().size(), offsets.size());
+
+        // Unless the server can't handle it
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"}, {"chunkingParallelUploadDisabled", true} } } });
+        maxRunningPuts = 0;
+        fakeFolder.localModifier().appendByte("A/a0");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(maxRunningPuts, 1);
+    }
+
+    // The chunks are sized from the throughput measured by earlier uploads
+    void testChunkSizeFromAccountThroughput() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"} } } });
+        SyncOptions syncOptions;
+        syncOptions._targetChunkUploadDuration = 1000;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+        fakeFolder.syncEngine().account()->setChunkUploadThroughput(2 * 1000 * 1000);
+
+        QList<quint64> offsets;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                offsets.append(request.rawHeader("OC-Chunk-Offset").toULongLong());
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("A/a0", 20 * 1000 * 1000);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(offsets.size() > 1);
+        QCOMPARE(offsets[1], quint64(2 * 1000 * 1000));
+        // The fake server is faster than that
+        QVERIFY(fakeFolder.syncEngine().account()->chunkUploadThroughput() > 2 * 1000 * 1000);
+    }
+
+    // The next upload doesn't wait for the server to assemble the chunks
+    void testNextUploadDuringFinalMove() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"} } } });
+        SyncOptions syncOptions;
+        syncOptions._parallelNetworkJobs = false; // a single transfer slot
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        bool holdMove = true;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (holdMove && request.attribute(QNetworkRequest::CustomVerbAttribute) == "MOVE")
+                return new FakeHangingReply{ op, request, this };
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("A/big", 30 * 1000 * 1000);
+        fakeFolder.localModifier().insert("A/small", 10);
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilItemCompleted("A/small");
+        QVERIFY(fakeFolder.currentRemoteState().find("A/small"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/big"));
+
+        fakeFolder.syncEngine().abort();
+        fakeFolder.execUntilFinished();
+        holdMove = false;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // Only the changed blocks of a modified file are uploaded
+    void testDeltaUpload() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"}, {"chunking-delta", "1.0"} } } });
+        const int size = 20 * 1000 * 1000; // 20 MB
+        const quint64 blockSize = SyncOptions()._deltaBlockSize;
+        fakeFolder.localModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        QList<quint64> offsets;
+        QByteArray deltaBase;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                offsets.append(request.rawHeader("OC-Chunk-Offset").toULongLong());
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "MOVE")
+                deltaBase = request.rawHeader("OC-Delta-Base");
+            return nullptr;
+        });
+
+        // Only the last block changes
+        const QByteArray etag = fakeFolder.currentRemoteState().find("A/a0")->etag.toLatin1();
+        fakeFolder.localModifier().appendByte("A/a0");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size + 1);
+        QCOMPARE(offsets, QList<quint64>() << size / blockSize * blockSize);
+        QCOMPARE(deltaBase, etag);
+
+        // Without block checksums for the current etag the whole file is sent
+        offsets.clear();
+        fakeFolder.remoteModifier().appendByte("A/a0");
+        QVERIFY(fakeFolder.syncOnce());
+        fakeFolder.localModifier().appendByte("A/a0");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(offsets.first(), quint64(0));
+        QVERIFY(offsets.size() > 1);
+    }
+
     void testResume () {
         FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
         fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"} } } });
@@ -339,8 +475,9 @@ private slots:
 
         QVERIFY(!fakeFolder.syncOnce());
 
-        // There should be a followup sync
-        QCOMPARE(fakeFolder.syncEngine().isAnotherSyncNeeded(), ImmediateFollowUp);
+        // There should be a followup sync, of just that file
+        QCOMPARE(fakeFolder.syncEngine().isAnotherSyncNeeded(), RetryFollowUp);
+        QCOMPARE(fakeFolder.syncEngine().retryPaths(), QSet<QString>{ "A/a0" });
 
         QCOMPARE(fakeFolder.uploadState().children.count(), 1); // We did not clean the chunks at this point
         auto chunkingId = fakeFolder.uploadState().children.first().name;
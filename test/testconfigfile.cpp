@@ -0,0 +1,53 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "configfile.h"
+
+using namespace OCC;
+
+class TestConfigFile : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _dir;
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(_dir.isValid());
+        ConfigFile::setConfDir(_dir.path()); // we don't want to pollute the user's config file
+    }
+
+    void testCachedValues()
+    {
+        ConfigFile cfg;
+        QCOMPARE(cfg.maxLogLines(), 20000);
+
+        // The setters update the cache right away
+        cfg.setMaxLogLines(123);
+        QCOMPARE(cfg.maxLogLines(), 123);
+        QCOMPARE(ConfigFile().maxLogLines(), 123);
+        cfg.setRemotePollInterval(45000);
+        QCOMPARE(cfg.remotePollInterval(), 45000);
+
+        // Edits from outside are seen after the next check of the file
+        {
+            QSettings settings(cfg.configFile(), QSettings::IniFormat);
+            settings.setValue("Logging/maxLogLines", 456);
+            settings.setValue("timeout", 42);
+        }
+        QTRY_COMPARE(cfg.maxLogLines(), 456);
+        QCOMPARE(cfg.timeout(), 42);
+        QCOMPARE(cfg.remotePollInterval(), 45000);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestConfigFile)
+#include "testconfigfile.moc"
@@ -0,0 +1,130 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include "connectionvalidator.h"
+
+using namespace OCC;
+
+class TestConnectionValidator : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRefreshAfterConnected()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        AccountPtr account = fakeFolder.syncEngine().account();
+        // Known from the last connection
+        QVariantMap capabilities;
+        capabilities["dav"] = QVariantMap{ { "chunking", "1.0" } };
+        account->setCapabilities(capabilities);
+        account->setServerVersion("10.0.0.1");
+        QSignalSpy savedSpy(account.data(), &Account::wantsAccountSaved);
+
+        int connected = 0;
+        QStringList ocsBeforeConnected;
+        QStringList ocsAfterConnected;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            const QString path = request.url().path();
+            if (path.endsWith("/status.php"))
+                return new FakePayloadReply{ op, request, "{\"installed\":true,\"maintenance\":false,\"version\":\"10.0.0.1\",\"versionstring\":\"10.0.0\"}", this };
+            if (!path.contains("/ocs/"))
+                return nullptr;
+            (connected ? ocsAfterConnected : ocsBeforeConnected).append(path);
+            if (path.endsWith("/cloud/capabilities"))
+                return new FakePayloadReply{ op, request, "{\"ocs\":{\"data\":{\"capabilities\":{\"dav\":{\"chunking\":\"1.0\"},\"files\":{\"bigfilechunking\":true}}}}}", this };
+            return new FakePayloadReply{ op, request, "{\"ocs\":{\"data\":{}}}", this };
+        });
+
+        auto validator = new ConnectionValidator(account);
+        connect(validator, &ConnectionValidator::connectionResult, this, [&](ConnectionValidator::Status status) {
+            QCOMPARE(status, ConnectionValidator::Connected);
+            ++connected;
+        });
+        validator->checkServerAndAuth();
+        QTRY_COMPARE(connected, 1);
+
+        // The refresh starts once the credentials are known to work
+        QTRY_COMPARE(ocsAfterConnected.size(), 3);
+        QVERIFY(ocsBeforeConnected.isEmpty());
+
+        // The new capabilities are saved for the next start
+        QTRY_VERIFY(account->capabilities().toVariantMap().contains("files"));
+        QVERIFY(savedSpy.count() >= 1);
+    }
+
+    void testSharedServerStatus()
+    {
+        // Two accounts of the same server
+        FakeFolder fakeFolderA{ FileInfo{} };
+        FakeFolder fakeFolderB{ FileInfo{} };
+        QCOMPARE(fakeFolderA.syncEngine().account()->url(), fakeFolderB.syncEngine().account()->url());
+
+        int statusRequests = 0;
+        int propfinds = 0;
+        auto override = [&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            const QString path = request.url().path();
+            if (path.endsWith("/status.php")) {
+                ++statusRequests;
+                return new FakePayloadReply{ op, request, "{\"installed\":true,\"maintenance\":false,\"version\":\"10.0.0.1\",\"versionstring\":\"10.0.0\"}", this };
+            }
+            if (path.endsWith("/cloud/capabilities"))
+                return new FakePayloadReply{ op, request, "{\"ocs\":{\"data\":{\"capabilities\":{\"dav\":{\"chunking\":\"1.0\"}}}}}", this };
+            if (path.contains("/ocs/"))
+                return new FakePayloadReply{ op, request, "{\"ocs\":{\"data\":{}}}", this };
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND")
+                ++propfinds;
+            return nullptr;
+        };
+        fakeFolderA.setServerOverride(override);
+        fakeFolderB.setServerOverride(override);
+
+        auto check = [&](FakeFolder &fakeFolder) {
+            auto validator = new ConnectionValidator(fakeFolder.syncEngine().account());
+            int connected = 0;
+            connect(validator, &ConnectionValidator::connectionResult, this, [&](ConnectionValidator::Status status) {
+                QCOMPARE(status, ConnectionValidator::Connected);
+                ++connected;
+            });
+            validator->checkServerAndAuth();
+            QTRY_COMPARE(connected, 1);
+        };
+
+        const qint64 reuseMsec = ConnectionValidator::serverStatusReuseMsec;
+
+        // Whatever an earlier test left is too old
+        ConnectionValidator::serverStatusReuseMsec = 0;
+        check(fakeFolderA);
+        QCOMPARE(statusRequests, 1);
+        QCOMPARE(propfinds, 1);
+
+        // The other account and the next check use that status,
+        // the authentication is still checked by each of them
+        ConnectionValidator::serverStatusReuseMsec = 60 * 1000;
+        check(fakeFolderB);
+        check(fakeFolderA);
+        QCOMPARE(statusRequests, 1);
+        QCOMPARE(propfinds, 3);
+
+        // Once it expired the server is asked again
+        ConnectionValidator::serverStatusReuseMsec = 50;
+        QTest::qWait(100);
+        check(fakeFolderB);
+        QCOMPARE(statusRequests, 2);
+        ConnectionValidator::serverStatusReuseMsec = 60 * 1000;
+        check(fakeFolderA);
+        QCOMPARE(statusRequests, 2);
+        QCOMPARE(propfinds, 5);
+
+        ConnectionValidator::serverStatusReuseMsec = reuseMsec;
+    }
+};
+
+QTEST_GUILESS_MAIN(TestConnectionValidator)
+#include "testconnectionvalidator.moc"
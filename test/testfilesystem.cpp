@@ -70,6 +70,33 @@ private slots:
         QCOMPARE(sSum, sum);
     }
 
+    void testCopyFast()
+    {
+        QString source(_root.path() + "/file_c.bin");
+        QString target(_root.path() + "/file_c_copy.bin");
+        QVERIFY(writeRandomFile(source, 1024 * 1024));
+
+        QString error;
+        QVERIFY(copyFast(source, target, &error));
+        QVERIFY(error.isEmpty());
+        QCOMPARE(getSize(target), getSize(source));
+        QCOMPARE(calcMd5(target), calcMd5(source));
+
+        // Like QFile::copy, an existing target is kept
+        QVERIFY(!copyFast(source, target, &error));
+        QVERIFY(!error.isEmpty());
+        QCOMPARE(calcMd5(target), calcMd5(source));
+
+        QVERIFY(!copyFast(_root.path() + "/missing.bin", _root.path() + "/missing_copy.bin"));
+        QVERIFY(!QFileInfo::exists(_root.path() + "/missing_copy.bin"));
+
+        QString empty(_root.path() + "/empty.bin");
+        QFile emptyFile(empty);
+        QVERIFY(emptyFile.open(QIODevice::WriteOnly));
+        emptyFile.close();
+        QVERIFY(copyFast(empty, _root.path() + "/empty_copy.bin"));
+        QCOMPARE(getSize(_root.path() + "/empty_copy.bin"), qint64(0));
+    }
 };
 
 QTEST_APPLESS_MAIN(TestFileSystem)
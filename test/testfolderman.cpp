@@ -9,12 +9,14 @@
 #include <QTemporaryDir>
 #include <QtTest>
 
+#include "config.h"
 #include "common/utility.h"
 #include "folderman.h"
 #include "account.h"
 #include "accountstate.h"
 #include "configfile.h"
 #include "creds/httpcredentials.h"
+#include "syncenginetestutils.h"
 
 using namespace OCC;
 
@@ -29,6 +31,19 @@ public:
     }
 };
 
+// The status and the OCS replies a connection check needs, nullptr for the others
+static QNetworkReply *fakeServerReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
+{
+    const QString path = request.url().path();
+    if (path.endsWith("/status.php"))
+        return new FakePayloadReply{ op, request, "{\"installed\":true,\"maintenance\":false,\"version\":\"10.0.0.1\",\"versionstring\":\"10.0.0\"}", parent };
+    if (path.endsWith("/cloud/capabilities"))
+        return new FakePayloadReply{ op, request, "{\"ocs\":{\"data\":{\"capabilities\":{\"dav\":{\"chunking\":\"1.0\"}}}}}", parent };
+    if (path.contains("/ocs/"))
+        return new FakePayloadReply{ op, request, "{\"ocs\":{\"data\":{}}}", parent };
+    return nullptr;
+}
+
 static FolderDefinition folderDefinition(const QString &path) {
     FolderDefinition d;
     d.localPath = path;
@@ -37,6 +52,24 @@ static FolderDefinition folderDefinition(const QString &path) {
     return d;
 }
 
+// A folder of a connected account that syncs the fake folder, nullptr if that fails
+static Folder *addFakeFolder(FakeFolder &fakeFolder, AccountStatePtr *accountState, bool newFilesAreVirtual = false)
+{
+    *accountState = AccountStatePtr(new AccountState(fakeFolder.syncEngine().account()));
+    (*accountState)->checkConnectivity();
+    QElapsedTimer timer;
+    timer.start();
+    while (!(*accountState)->isConnected() && timer.elapsed() < 5000)
+        QTest::qWait(10);
+    if (!(*accountState)->isConnected())
+        return nullptr;
+
+    FolderDefinition definition = folderDefinition(fakeFolder.localPath());
+    // The remote path of the fake folder's own engine
+    definition.targetPath = QString();
+    definition.newFilesAreVirtual = newFilesAreVirtual;
+    return FolderMan::instance()->addFolder(accountState->data(), definition);
+}
 
 class TestFolderMan: public QObject
 {
@@ -191,7 +224,180 @@ private slots:
         QCOMPARE(folderman->findGoodPathForNewSyncFolder(dirPath + "/sub", url),
                  QString(dirPath + "/sub2"));
     }
+
+    void testSyncsBlocking()
+    {
+        QTemporaryDir dir;
+        ConfigFile::setConfDir(dir.path());
+        QVERIFY(dir.isValid());
+        QDir dir2(dir.path());
+        const QString dirPath = dir2.canonicalPath();
+
+        auto newAccountState = [](const QString &url) {
+            AccountPtr account = Account::create();
+            account->setCredentials(new HttpCredentialsTest("testuser", "secret"));
+            account->setUrl(QUrl(url));
+            return AccountStatePtr(new AccountState(account));
+        };
+        AccountStatePtr accountA = newAccountState("http://a.example.de");
+        AccountStatePtr accountB = newAccountState("http://b.example.de");
+        AccountStatePtr accountC = newAccountState("http://c.example.de");
+        FolderMan *folderman = FolderMan::instance();
+        QVERIFY(dir2.mkpath("a1") && dir2.mkpath("a2") && dir2.mkpath("b1") && dir2.mkpath("c1"));
+        Folder *a1 = folderman->addFolder(accountA.data(), folderDefinition(dirPath + "/a1"));
+        Folder *a2 = folderman->addFolder(accountA.data(), folderDefinition(dirPath + "/a2"));
+        Folder *b1 = folderman->addFolder(accountB.data(), folderDefinition(dirPath + "/b1"));
+        Folder *c1 = folderman->addFolder(accountC.data(), folderDefinition(dirPath + "/c1"));
+        QVERIFY(a1 && a2 && b1 && c1);
+
+        // Only the sync of the same account is in the way
+        folderman->_currentSyncFolders = { a1, b1 };
+        QCOMPARE(folderman->syncsBlocking(a2), QList<Folder *>{ a1 });
+        QCOMPARE(folderman->syncsBlocking(a1), QList<Folder *>{ a1 });
+        QCOMPARE(folderman->syncsBlocking(b1), QList<Folder *>{ b1 });
+
+        // Another account waits for a free slot, and with one it waits for nothing
+        QCOMPARE(folderman->syncsBlocking(c1), QList<Folder *>{ b1 });
+        folderman->_currentSyncFolders = { a1 };
+        QVERIFY(folderman->syncsBlocking(c1).isEmpty());
+        QVERIFY(folderman->syncsBlocking(b1).isEmpty());
+
+        folderman->_currentSyncFolders.clear();
+    }
+
+    void testRetryFailedItem()
+    {
+        QTemporaryDir dir;
+        ConfigFile::setConfDir(dir.path());
+        FolderMan *folderman = FolderMan::instance();
+        folderman->unloadAndDeleteAllFolders();
+
+        FakeFolder fakeFolder{ FileInfo{} };
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1");
+        fakeFolder.remoteModifier().mkdir("B");
+        fakeFolder.remoteModifier().insert("B/b1");
+        QObject parent;
+
+        bool badChecksum = true;
+        int a1Downloads = 0;
+        QStringList propfinds;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (auto reply = fakeServerReply(op, request, &parent))
+                return reply;
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND")
+                propfinds.append(getFilePathFromUrl(request.url()));
+            if (op == QNetworkAccessManager::GetOperation && getFilePathFromUrl(request.url()) == "A/a1") {
+                ++a1Downloads;
+                auto reply = new FakeGetReply(fakeFolder.remoteModifier(), op, request, &parent);
+                if (badChecksum)
+                    reply->setRawHeader("OC-Checksum", "SHA1:bad");
+                return reply;
+            }
+            return nullptr;
+        });
+
+        AccountStatePtr accountState;
+        Folder *folder = addFakeFolder(fakeFolder, &accountState);
+        QVERIFY(folder);
+        int finished = 0;
+        connect(folder, &Folder::syncFinished, &parent, [&] { ++finished; });
+
+        // The download fails its checksum and is put in the retry queue
+        folderman->scheduleFolder(folder);
+        QTRY_COMPARE_WITH_TIMEOUT(finished, 1, 10000);
+        QCOMPARE(a1Downloads, 1);
+        QVERIFY(fakeFolder.currentLocalState().find("B/b1"));
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a1"));
+        QVERIFY(folderman->scheduleQueue().isEmpty());
+        QTest::qWait(500);
+        QCOMPARE(a1Downloads, 1);
+
+        // Once due, a sync of just that file runs
+        badChecksum = false;
+        propfinds.clear();
+        QTRY_COMPARE_WITH_TIMEOUT(finished, 2, 20000);
+        QCOMPARE(a1Downloads, 2);
+        QVERIFY(fakeFolder.currentLocalState().find("A/a1"));
+        QVERIFY(!propfinds.isEmpty());
+        for (const auto &path : propfinds)
+            QVERIFY(!path.startsWith("B"));
+
+        // Nothing is left to retry
+        QTest::qWait(500);
+        QCOMPARE(finished, 2);
+        QVERIFY(folderman->scheduleQueue().isEmpty());
+
+        folderman->unloadAndDeleteAllFolders();
+    }
+
+    void testPrefetchSiblings()
+    {
+        QTemporaryDir dir;
+        ConfigFile::setConfDir(dir.path());
+        {
+            QSettings settings(ConfigFile().configFile(), QSettings::IniFormat);
+            settings.setValue("virtualFilePrefetchBudget", 70);
+        }
+        FolderMan *folderman = FolderMan::instance();
+        folderman->unloadAndDeleteAllFolders();
+
+        FakeFolder fakeFolder{ FileInfo{} };
+        auto &remote = fakeFolder.remoteModifier();
+        remote.mkdir("A");
+        remote.insert("A/a1", 10);
+        remote.insert("A/a2", 10);
+        remote.insert("A/a3", 30);
+        remote.insert("A/a4", 40);
+        remote.insert("A/a5", 100);
+        remote.mkdir("B");
+        remote.insert("B/b1", 10);
+        remote.insert("B/b2", 10);
+        remote.insert("B/b3", 30);
+        remote.insert("B/b4", 100);
+        QObject parent;
+
+        QStringList downloads;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (auto reply = fakeServerReply(op, request, &parent))
+                return reply;
+            if (op == QNetworkAccessManager::GetOperation)
+                downloads.append(getFilePathFromUrl(request.url()));
+            return nullptr;
+        });
+
+        AccountStatePtr accountState;
+        Folder *folder = addFakeFolder(fakeFolder, &accountState, true);
+        QVERIFY(folder);
+        int finished = 0;
+        connect(folder, &Folder::syncFinished, &parent, [&] { ++finished; });
+        folderman->scheduleFolder(folder);
+        QTRY_COMPARE_WITH_TIMEOUT(finished, 1, 10000);
+        QVERIFY(downloads.isEmpty());
+
+        // Two placeholders of each directory are opened. The picks of A
+        // and B don't fit in the budget together, the oldest one goes.
+        const QString suffix = QStringLiteral(APPLICATION_DOTVIRTUALFILE_SUFFIX);
+        for (const QString path : { "A/a1", "A/a2", "B/b1", "B/b2" })
+            folder->downloadVirtualFile(path + suffix);
+
+        // The requested files come first, the picks in the sync after it
+        QTRY_COMPARE_WITH_TIMEOUT(downloads.size(), 6, 20000);
+        QCOMPARE(QSet<QString>::fromList(downloads.mid(0, 4)), (QSet<QString>{ "A/a1", "A/a2", "B/b1", "B/b2" }));
+        QCOMPARE(QSet<QString>::fromList(downloads.mid(4)), (QSet<QString>{ "A/a4", "B/b3" }));
+        QTRY_VERIFY(!folder->isBusy() && fakeFolder.currentLocalState().find("B/b3"));
+
+        auto local = fakeFolder.currentLocalState();
+        for (const QString path : { "A/a1", "A/a2", "A/a4", "B/b1", "B/b2", "B/b3" })
+            QVERIFY(local.find(path));
+        for (const QString path : { "A/a3", "A/a5", "B/b4" })
+            QVERIFY(local.find(path + suffix));
+        QTest::qWait(500);
+        QCOMPARE(downloads.size(), 6);
+
+        folderman->unloadAndDeleteAllFolders();
+    }
 };
 
-QTEST_APPLESS_MAIN(TestFolderMan)
+QTEST_GUILESS_MAIN(TestFolderMan)
 #include "testfolderman.moc"
@@ -0,0 +1,135 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+
+#include "account.h"
+#include "imagecache.h"
+
+using namespace OCC;
+
+struct LookupResult
+{
+    bool done = false;
+    bool found = false;
+    bool fresh = false;
+    ImageCache::Entry entry;
+};
+
+class TestImageCache : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _dir;
+    AccountPtr _account = Account::create();
+
+    LookupResult lookup(const QUrl &url)
+    {
+        LookupResult result;
+        QObject context;
+        ImageCache::lookup(*_account, url, &context, [&](bool found, const ImageCache::Entry &entry, bool fresh) {
+            result.done = true;
+            result.found = found;
+            result.fresh = fresh;
+            result.entry = entry;
+        });
+        [&] { QTRY_VERIFY(result.done); }();
+        return result;
+    }
+
+private slots:
+    void init()
+    {
+        QVERIFY(_dir.isValid());
+        ImageCache::setDirectory(_dir.path());
+    }
+
+    void cleanup()
+    {
+        ImageCache::waitForDone();
+        for (const auto &name : QDir(_dir.path()).entryList(QDir::Files))
+            QFile::remove(_dir.path() + "/" + name);
+    }
+
+    void testInsertLookup()
+    {
+        const QUrl url("http://example.com/avatars/admin/128.png");
+        QVERIFY(!lookup(url).found);
+
+        ImageCache::insert(*_account, url, ImageCache::Entry{ "\"etag1\"", "image1" });
+        auto result = lookup(url);
+        QVERIFY(result.found);
+        QVERIFY(result.fresh);
+        QCOMPARE(result.entry.etag, QByteArray("\"etag1\""));
+        QCOMPARE(result.entry.data, QByteArray("image1"));
+
+        // Another url doesn't find it
+        QVERIFY(!lookup(QUrl("http://example.com/avatars/admin/64.png")).found);
+
+        // A 200 replaces the image
+        ImageCache::insert(*_account, url, ImageCache::Entry{ "\"etag2\"", "image2" });
+        result = lookup(url);
+        QCOMPARE(result.entry.etag, QByteArray("\"etag2\""));
+        QCOMPARE(result.entry.data, QByteArray("image2"));
+    }
+
+    void testRevalidation()
+    {
+        const QUrl url("http://example.com/thumbnail/A/a1");
+        ImageCache::insert(*_account, url, ImageCache::Entry{ "\"etag1\"", "image1" });
+        ImageCache::waitForDone();
+
+        // Found on the disk, but not validated in this session
+        ImageCache::setDirectory(_dir.path());
+        auto result = lookup(url);
+        QVERIFY(result.found);
+        QVERIFY(!result.fresh);
+        QCOMPARE(result.entry.etag, QByteArray("\"etag1\""));
+
+        // A 304 only validates it again, the image stays
+        ImageCache::insert(*_account, url, ImageCache::Entry());
+        result = lookup(url);
+        QVERIFY(result.found);
+        QVERIFY(result.fresh);
+        QCOMPARE(result.entry.data, QByteArray("image1"));
+    }
+
+    void testUnreadableFile()
+    {
+        const QUrl url("http://example.com/thumbnail/A/a2");
+        ImageCache::insert(*_account, url, ImageCache::Entry{ "\"etag1\"", "image1" });
+        ImageCache::waitForDone();
+        const QStringList files = QDir(_dir.path()).entryList(QDir::Files);
+        QCOMPARE(files.size(), 1);
+        const QString fileName = _dir.path() + "/" + files.first();
+        {
+            QFile file(fileName);
+            QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+            file.write("x");
+        }
+
+        QVERIFY(!lookup(url).found);
+        QVERIFY(!QFile::exists(fileName));
+    }
+
+    void testContextDestroyed()
+    {
+        const QUrl url("http://example.com/thumbnail/A/a3");
+        ImageCache::insert(*_account, url, ImageCache::Entry{ "\"etag1\"", "image1" });
+
+        bool called = false;
+        auto context = new QObject;
+        ImageCache::lookup(*_account, url, context, [&](bool, const ImageCache::Entry &, bool) { called = true; });
+        delete context;
+        ImageCache::waitForDone();
+        QTest::qWait(50);
+        QVERIFY(!called);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestImageCache)
+#include "testimagecache.moc"
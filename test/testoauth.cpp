@@ -9,6 +9,7 @@
 #include <QDesktopServices>
 
 #include "gui/creds/oauth.h"
+#include "creds/httpcredentials.h"
 #include "syncenginetestutils.h"
 #include "theme.h"
 #include "common/asserts.h"
@@ -185,6 +186,32 @@ public:
     }
 };
 
+// The state of the credentials right after the keychain read: a refresh token, no access token
+class RefreshingCredentials : public HttpCredentials
+{
+public:
+    FakeQNAM::Override tokenReply;
+
+    RefreshingCredentials()
+    {
+        _user = "789";
+        _refreshToken = "456";
+    }
+
+    QNetworkAccessManager *createQNAM() const override
+    {
+        auto qnam = new FakeQNAM({});
+        qnam->setOverride([this](QNetworkAccessManager::Operation op, const QNetworkRequest &req) {
+            return tokenReply(op, req);
+        });
+        return qnam;
+    }
+    void persist() override {}
+
+    bool refreshScheduled() const { return _refreshTimer.isActive(); }
+    int refreshInterval() const { return _refreshTimer.interval(); }
+};
+
 class TestOAuth: public QObject
 {
     Q_OBJECT
@@ -275,6 +302,54 @@ private slots:
         } test;
         test.test();
     }
+
+    void testRefreshAfterKeychainRead()
+    {
+        auto creds = new RefreshingCredentials;
+        int tokenRequests = 0;
+        QByteArray payload;
+        creds->tokenReply = [&](QNetworkAccessManager::Operation op, const QNetworkRequest &req) -> QNetworkReply * {
+            ++tokenRequests;
+            if (payload.isEmpty())
+                return new FakeErrorReply{ op, req, nullptr, 500 };
+            std::unique_ptr<QBuffer> body(new QBuffer);
+            body->setData(payload);
+            return new FakePostReply(op, req, std::move(body), nullptr);
+        };
+        auto account = Account::create();
+        account->setUrl(sOAuthTestServer);
+        account->setCredentials(creds);
+        QSignalSpy fetchedSpy(creds, &AbstractCredentials::fetched);
+
+        // The server can't be reached: retried later
+        QVERIFY(creds->refreshAccessToken());
+        QTRY_COMPARE(fetchedSpy.count(), 1);
+        QCOMPARE(tokenRequests, 1);
+        QVERIFY(!creds->ready());
+        QVERIFY(creds->refreshScheduled());
+        QCOMPARE(creds->refreshInterval(), 60 * 1000);
+
+        // The new token tells when to refresh again
+        payload = QJsonDocument(QJsonObject{
+                                    { "access_token", "123" },
+                                    { "refresh_token", "457" },
+                                    { "expires_in", 3600 },
+                                    { "token_type", "Bearer" } })
+                      .toJson();
+        QVERIFY(creds->refreshAccessToken());
+        QTRY_COMPARE(fetchedSpy.count(), 2);
+        QVERIFY(creds->ready());
+        QCOMPARE(creds->password(), QString("123"));
+        QVERIFY(creds->refreshScheduled());
+        QCOMPARE(creds->refreshInterval(), 3600 * 1000 * 4 / 5);
+
+        // An expired refresh token is not retried
+        payload = QJsonDocument(QJsonObject{ { "error", "invalid_grant" } }).toJson();
+        QVERIFY(creds->refreshAccessToken());
+        QTRY_COMPARE(fetchedSpy.count(), 3);
+        QVERIFY(!creds->refreshScheduled());
+        QCOMPARE(tokenRequests, 3);
+    }
 };
 
 QTEST_GUILESS_MAIN(TestOAuth)
@@ -9,6 +9,10 @@
 
 #include "propagatedownload.h"
 #include "owncloudpropagator_p.h"
+#include "concurrencycontroller.h"
+#include "bandwidthbudget.h"
+#include "account.h"
+#include "common/syncjournaldb.h"
 
 using namespace OCC;
 namespace OCC {
@@ -76,6 +80,228 @@ private slots:
             QCOMPARE(parseEtag(test.first), QByteArray(test.second));
         }
     }
+
+    void testActiveJobListCounters()
+    {
+        QTemporaryDir dir;
+        SyncJournalDb journal(dir.path() + "/.sync_test.db");
+        OwncloudPropagator propagator(Account::create(), dir.path(), "/", &journal);
+
+        auto makeItem = [](const QString &file, quint64 size) {
+            SyncFileItemPtr item(new SyncFileItem);
+            item->_file = file;
+            item->_type = SyncFileItem::File;
+            item->_instruction = CSYNC_INSTRUCTION_NEW;
+            item->_direction = SyncFileItem::Down;
+            item->_size = size;
+            return item;
+        };
+        PropagateDownloadFile small(&propagator, makeItem("small", 100));
+        PropagateDownloadFile big(&propagator, makeItem("big", 100 * 1000 * 1000));
+
+        ActiveJobList &list = propagator._activeJobList;
+        list.append(&small);
+        list.append(&big);
+        // A job with several requests has several entries, but is one bulk transfer
+        list.append(&big);
+        QCOMPARE(list.count(), 3);
+        QCOMPARE(list.count(&big), 2);
+        QCOMPARE(list.likelyFinishedQuicklyCount(), 1);
+        QCOMPARE(list.bulkTransferCount(), 1);
+        QCOMPARE(list.metadataOnlyCount(), 0);
+
+        QVERIFY(list.removeOne(&big));
+        QCOMPARE(list.count(), 2);
+        QCOMPARE(list.bulkTransferCount(), 1);
+        QCOMPARE(list.removeAll(&big), 1);
+        QCOMPARE(list.bulkTransferCount(), 0);
+        QVERIFY(!list.removeOne(&big));
+        QCOMPARE(list.removeAll(&big), 0);
+
+        // An entry keeps the kind it was added with
+        list.appendMetadataOnly(&small);
+        QCOMPARE(list.count(&small), 2);
+        QCOMPARE(list.likelyFinishedQuicklyCount(), 2);
+        QCOMPARE(list.metadataOnlyCount(), 0);
+        QCOMPARE(list.removeAll(&small), 2);
+        QVERIFY(list.isEmpty());
+        QCOMPARE(list.likelyFinishedQuicklyCount(), 0);
+
+        // Metadata-only entries are neither quick nor bulk transfers
+        list.appendMetadataOnly(&big);
+        QCOMPARE(list.metadataOnlyCount(), 1);
+        QCOMPARE(list.likelyFinishedQuicklyCount(), 0);
+        QCOMPARE(list.bulkTransferCount(), 0);
+        QVERIFY(list.removeOne(&big));
+        QCOMPARE(list.metadataOnlyCount(), 0);
+        QVERIFY(list.isEmpty());
+    }
+
+    void testConcurrencyController()
+    {
+        // Slow start grows up to the maximum on a fast network
+        ConcurrencyController controller(6, 2, 32);
+        QCOMPARE(controller.limit(), 6);
+        for (int i = 0; i < 40; ++i)
+            controller.reportLatency(10);
+        QCOMPARE(controller.limit(), 32);
+        QVERIFY(controller.state().slowStart);
+
+        // An overload error halves it, once per round of requests
+        controller.reportFailure();
+        QCOMPARE(controller.limit(), 16);
+        QVERIFY(!controller.state().slowStart);
+        controller.reportFailure();
+        QCOMPARE(controller.limit(), 16);
+        for (int i = 0; i < 16; ++i)
+            controller.reportFailure();
+        QCOMPARE(controller.limit(), 8);
+
+        // Never below the minimum
+        for (int i = 0; i < 100; ++i)
+            controller.reportFailure();
+        QCOMPARE(controller.limit(), 2);
+        QCOMPARE(controller.state().failures, qint64(118));
+
+        // Additive increase afterwards: about one per round
+        for (int i = 0; i < 20; ++i)
+            controller.reportLatency(10);
+        QVERIFY(controller.limit() > 2);
+        QVERIFY(controller.limit() < 10);
+    }
+
+    void testConcurrencyControllerLatency()
+    {
+        ConcurrencyController controller(6, 2, 32);
+        for (int i = 0; i < 20; ++i)
+            controller.reportLatency(10);
+        QCOMPARE(controller.limit(), 26);
+
+        // The requests get much slower: the limit goes down
+        for (int i = 0; i < 10; ++i)
+            controller.reportLatency(500);
+        QVERIFY(controller.limit() < 26);
+        QVERIFY(!controller.state().slowStart);
+        QCOMPARE(controller.state().baseLatencyMs, qint64(10));
+
+        // A steady higher latency becomes the new base and the limit grows again
+        const int reduced = controller.limit();
+        for (int i = 0; i < 300; ++i)
+            controller.reportLatency(50);
+        QCOMPARE(controller.state().baseLatencyMs, qint64(50));
+        QVERIFY(controller.limit() > reduced);
+    }
+
+    void testBandwidthBudgetShare()
+    {
+        auto budget = BandwidthBudget::instance();
+        int a, b;
+        budget->setWeight(&a, BandwidthBudget::Download, 1);
+        QCOMPARE(budget->share(&a, BandwidthBudget::Download, 1000), qint64(1000));
+
+        budget->setWeight(&b, BandwidthBudget::Download, 3);
+        QCOMPARE(budget->share(&a, BandwidthBudget::Download, 1000), qint64(250));
+        QCOMPARE(budget->share(&b, BandwidthBudget::Download, 1000), qint64(750));
+        // The uploads are shared separately
+        QCOMPARE(budget->share(&a, BandwidthBudget::Upload, 1000), qint64(1000));
+
+        budget->setWeight(&b, BandwidthBudget::Download, 0);
+        QCOMPARE(budget->share(&a, BandwidthBudget::Download, 1000), qint64(1000));
+        budget->setWeight(&a, BandwidthBudget::Download, 0);
+    }
+
+    void testBandwidthSchedule()
+    {
+        const auto schedule = BandwidthBudget::parseSchedule(
+            QStringLiteral("08:00-18:00 100/500, garbage, 22:00-06:00 0/50%"));
+        QCOMPARE(schedule.size(), 2);
+
+        auto budget = BandwidthBudget::instance();
+        budget->setSchedule(schedule);
+        QCOMPARE(budget->limit(BandwidthBudget::Upload, 7, QTime(9, 30)), qint64(100000));
+        QCOMPARE(budget->limit(BandwidthBudget::Download, 7, QTime(9, 30)), qint64(500000));
+        QCOMPARE(budget->limit(BandwidthBudget::Upload, 7, QTime(18, 0)), qint64(7));
+        // Past midnight
+        QCOMPARE(budget->limit(BandwidthBudget::Upload, 7, QTime(23, 0)), qint64(0));
+        QCOMPARE(budget->limit(BandwidthBudget::Download, 7, QTime(5, 59)), qint64(-50));
+        budget->setSchedule({});
+    }
+
+    void testSmallFileSize()
+    {
+        auto account = Account::create();
+        OwncloudPropagator propagator(account, QStringLiteral("/tmp"), QStringLiteral("/"), nullptr);
+        // Nothing measured yet
+        QCOMPARE(propagator.smallFileSize(), quint64(100 * 1024));
+
+        account->reportRequestLatency(200);
+        account->reportTransfer(1000 * 1000, 1000);
+        QCOMPARE(account->requestLatency(), qint64(200));
+        QCOMPARE(account->transferThroughput(), quint64(1000 * 1000));
+        // A transfer that took no time after the latency is no sample
+        account->reportTransfer(1000 * 1000, 0);
+        account->reportTransfer(1000 * 1000, -50);
+        QCOMPARE(account->transferThroughput(), quint64(1000 * 1000));
+        // 800ms left of the second at 1MB/s
+        QCOMPARE(propagator.smallFileSize(), quint64(800 * 1000));
+
+        account->reportRequestLatency(1000);
+        QCOMPARE(account->requestLatency(), qint64(400));
+        QCOMPARE(propagator.smallFileSize(), quint64(600 * 1000));
+
+        // A slow server still lets the tiny files count as quick
+        for (int i = 0; i < 16; ++i)
+            account->reportTransfer(1000, 1000);
+        QCOMPARE(propagator.smallFileSize(), quint64(16 * 1024));
+    }
+
+    void testCaseClashIndex()
+    {
+        QTemporaryDir dir;
+        QVERIFY(QDir(dir.path()).mkpath("A/Sub"));
+        QFile file(dir.path() + "/A/b");
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.close();
+
+        LocalCaseClashIndex index(dir.path() + "/");
+        QVERIFY(!index.mayClash("A/b"));
+        QVERIFY(index.mayClash("a/b"));
+        QVERIFY(index.mayClash("A/B"));
+        QVERIFY(!index.mayClash("A/Sub/c"));
+        QVERIFY(index.mayClash("A/sub/c"));
+        // The same directories and names with the native separators
+        QVERIFY(!index.mayClash(QDir::toNativeSeparators("A/b")));
+        QVERIFY(index.mayClash(QDir::toNativeSeparators("A/B")));
+        QVERIFY(index.mayClash(QDir::toNativeSeparators("A/sub/c")));
+
+        // A file the propagator creates, however it names it
+        index.add(QDir::toNativeSeparators(dir.path() + "/A/Sub/new"));
+        QVERIFY(!index.mayClash("A/Sub/new"));
+        QVERIFY(index.mayClash("A/Sub/NEW"));
+    }
+
+    void testLocalOperationThreads()
+    {
+        auto account = Account::create();
+        SyncOptions options;
+        OwncloudPropagator first(account, QStringLiteral("/tmp"), QStringLiteral("/"), nullptr);
+        first.setSyncOptions(options);
+        QCOMPARE(first.localOperationsPool()->maxThreadCount(), OwncloudPropagator::localOperationThreads);
+
+        // The threads are shared by the weights of the syncing folders
+        {
+            OwncloudPropagator second(account, QStringLiteral("/tmp"), QStringLiteral("/"), nullptr);
+            options._bandwidthWeight = 3;
+            second.setSyncOptions(options);
+            first.adjustLocalOperationThreads();
+            QCOMPARE(first.localOperationsPool()->maxThreadCount(), 1);
+            QCOMPARE(second.localOperationsPool()->maxThreadCount(), 3);
+        }
+
+        // All of them again once the other folder is done
+        first.adjustLocalOperationThreads();
+        QCOMPARE(first.localOperationsPool()->maxThreadCount(), OwncloudPropagator::localOperationThreads);
+    }
 };
 
 QTEST_APPLESS_MAIN(TestOwncloudPropagator)
@@ -126,6 +126,71 @@ private slots:
         }
     }
 
+    void testStatementReuse() {
+        const char *sql = "SELECT name FROM addresses WHERE id=?1";
+        QByteArray names;
+        for (qint64 id : { 2, 3, 2 }) {
+            // Each query gets the statement the previous one left behind
+            SqlQuery q(_db);
+            QCOMPARE(q.prepare(sql), SQLITE_OK);
+            q.bindInt64(1, id);
+            QVERIFY(q.exec());
+            QVERIFY(q.next());
+            names += q.baValue(0) + ';';
+        }
+        QCOMPARE(names, QByteArray("Brucely Lafayette;") + QString::fromUtf8("пятницы").toUtf8() + ";Brucely Lafayette;");
+
+        // Two live queries with the same SQL don't share a statement
+        SqlQuery q1(_db);
+        SqlQuery q2(_db);
+        q1.prepare(sql);
+        q2.prepare(sql);
+        q1.bindInt64(1, 2);
+        q2.bindByteArray(1, "3");
+        QVERIFY(q1.exec() && q1.next());
+        QVERIFY(q2.exec() && q2.next());
+        QCOMPARE(q1.stringValue(0), QString("Brucely Lafayette"));
+        QCOMPARE(q2.stringValue(0), QString::fromUtf8("пятницы"));
+    }
+
+    void testValueViews() {
+        SqlQuery q(_db);
+        q.prepare("SELECT name, address FROM addresses WHERE id=2");
+        QVERIFY(q.exec());
+        QVERIFY(q.next());
+        QCOMPARE(q.baView(0), QByteArray("Brucely Lafayette"));
+        QCOMPARE(q.bytesValue(1), int(qstrlen("Nurderway5, New York")));
+        QVERIFY(q.valueEquals(0, "Brucely Lafayette"));
+        QVERIFY(!q.valueEquals(0, "Brucely"));
+        QVERIFY(!q.valueEquals(1, QByteArray()));
+    }
+
+    void testOpenMarker() {
+        const QString fileName = _tempDir.path() + "/testdb.sqlite";
+        const QString marker = fileName + "-open";
+        QVERIFY(QFile::exists(marker));
+        {
+            // Another connection doesn't check again and leaves the marker
+            SqlDatabase other;
+            QVERIFY(other.openOrCreateReadWrite(fileName));
+            other.close();
+            QVERIFY(QFile::exists(marker));
+        }
+        _db.close();
+        QVERIFY(!QFile::exists(marker));
+
+        // A marker that is left behind makes the next open check the database
+        QFile file(marker);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.close();
+        QVERIFY(_db.openOrCreateReadWrite(fileName));
+        SqlQuery q(_db);
+        q.prepare("SELECT name FROM addresses WHERE id=2");
+        QVERIFY(q.exec() && q.next());
+        _db.close();
+        QVERIFY(!QFile::exists(marker));
+    }
+
 private:
     SqlDatabase _db;
 };
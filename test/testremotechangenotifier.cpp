@@ -0,0 +1,116 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include "accountstate.h"
+#include "remotechangenotifier.h"
+
+using namespace OCC;
+
+static QByteArray activities(const QByteArray &data)
+{
+    return "{\"ocs\":{\"meta\":{\"statuscode\":200,\"status\":\"ok\"},\"data\":[" + data + "]}}";
+}
+
+class TestRemoteChangeNotifier : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testActivities()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        AccountPtr account = fakeFolder.syncEngine().account();
+        QVariantMap capabilities;
+        capabilities["activity"] = QVariantMap{ { "apiv2", QVariantList{ "filters", "rich-strings" } } };
+        account->setCapabilities(capabilities);
+
+        QList<QUrlQuery> queries;
+        int httpCode = 200;
+        QByteArray answer;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (!request.url().path().endsWith("/ocs/v2.php/apps/activity/api/v2/activity/all"))
+                return new FakeErrorReply{ op, request, this, 404 };
+            queries.append(QUrlQuery(request.url()));
+            return new FakePayloadReply{ op, request, answer, this, httpCode };
+        });
+
+        AccountStatePtr accountState(new AccountState(account));
+        RemoteChangeNotifier *notifier = accountState->remoteChangeNotifier();
+        QSignalSpy changedSpy(notifier, &RemoteChangeNotifier::remoteChanged);
+        auto poll = [&] {
+            const int before = queries.size();
+            QMetaObject::invokeMethod(notifier, "slotPoll");
+            QTRY_COMPARE(queries.size(), before + 1);
+        };
+
+        // Right after connecting, only to find the newest activity
+        answer = activities("{\"activity_id\":41,\"object_type\":\"files\",\"object_name\":\"/A/a1\",\"objects\":{\"3\":\"/A/a1\"}}");
+        QVERIFY(QMetaObject::invokeMethod(accountState.data(), "slotConnectionValidatorResult", Qt::DirectConnection,
+            Q_ARG(ConnectionValidator::Status, ConnectionValidator::Connected), Q_ARG(QStringList, QStringList())));
+        QTRY_COMPARE_WITH_TIMEOUT(queries.size(), 1, 1000);
+        QVERIFY(!queries[0].hasQueryItem("since"));
+        QCOMPARE(queries[0].queryItemValue("limit"), QString("1"));
+        QTRY_VERIFY(notifier->isActive());
+        QCOMPARE(changedSpy.size(), 0);
+
+        // The files of the activities after it, not the other ones
+        answer = activities(
+            "{\"activity_id\":42,\"object_type\":\"files\",\"object_name\":\"/A/a2\",\"objects\":{\"4\":\"/A/a2\"}},"
+            "{\"activity_id\":43,\"object_type\":\"files\",\"object_name\":\"/C/c1\",\"objects\":{\"7\":\"/B/b1\",\"8\":\"/C/c1\"}},"
+            "{\"activity_id\":44,\"object_type\":\"calendar\",\"object_name\":\"Personal\",\"objects\":{}}");
+        poll();
+        QCOMPARE(queries[1].queryItemValue("since"), QString("41"));
+        QCOMPARE(queries[1].queryItemValue("sort"), QString("asc"));
+        QTRY_COMPARE(changedSpy.size(), 1);
+        QStringList paths = changedSpy[0][0].toStringList();
+        paths.sort();
+        QCOMPARE(paths, QStringList() << "/A/a2" << "/B/b1" << "/C/c1");
+
+        // Nothing new
+        httpCode = 304;
+        answer.clear();
+        poll();
+        QCOMPARE(queries[2].queryItemValue("since"), QString("44"));
+        QTest::qWait(50);
+        QCOMPARE(changedSpy.size(), 1);
+        QVERIFY(notifier->isActive());
+
+        // The etag polling takes over after an error
+        httpCode = 500;
+        poll();
+        QTRY_VERIFY(!notifier->isActive());
+        QCOMPARE(changedSpy.size(), 1);
+
+        // Disconnected, no more polls
+        QVERIFY(QMetaObject::invokeMethod(accountState.data(), "slotConnectionValidatorResult", Qt::DirectConnection,
+            Q_ARG(ConnectionValidator::Status, ConnectionValidator::Timeout), Q_ARG(QStringList, QStringList())));
+        QMetaObject::invokeMethod(notifier, "slotPoll");
+        QTest::qWait(50);
+        QCOMPARE(queries.size(), 4);
+    }
+
+    void testNoActivityApp()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        int requests = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            ++requests;
+            return new FakeErrorReply{ op, request, this, 404 };
+        });
+        AccountStatePtr accountState(new AccountState(fakeFolder.syncEngine().account()));
+        QVERIFY(QMetaObject::invokeMethod(accountState.data(), "slotConnectionValidatorResult", Qt::DirectConnection,
+            Q_ARG(ConnectionValidator::Status, ConnectionValidator::Connected), Q_ARG(QStringList, QStringList())));
+        QTest::qWait(50);
+        QCOMPARE(requests, 0);
+        QVERIFY(!accountState->remoteChangeNotifier()->isActive());
+    }
+};
+
+QTEST_GUILESS_MAIN(TestRemoteChangeNotifier)
+#include "testremotechangenotifier.moc"
@@ -0,0 +1,61 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QJsonArray>
+
+#include "requesttimings.h"
+
+using namespace OCC;
+
+class TestRequestTimings : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testQuantiles()
+    {
+        RequestTimings timings;
+        QCOMPARE(timings.quantileMs(0.5), qint64(0));
+
+        // 90 fast requests and 10 slow ones
+        for (int i = 0; i < 90; ++i)
+            timings.add(0, 10, 2); // 12 ms, in the bucket up to 15 ms
+        for (int i = 0; i < 10; ++i)
+            timings.add(100, 900, 0); // 1000 ms, in the bucket up to 1023 ms
+
+        QCOMPARE(timings.count(), qint64(100));
+        QCOMPARE(timings.maxMs(), qint64(1000));
+        QCOMPARE(timings.quantileMs(0.5), qint64(15));
+        QCOMPARE(timings.quantileMs(0.9), qint64(15));
+        QCOMPARE(timings.quantileMs(0.99), qint64(1000));
+
+        const auto json = timings.toJson();
+        QCOMPARE(json.value("meanWaitMs").toInt(), 99);
+        QCOMPARE(json.value("meanSendMs").toInt(), 10);
+        QCOMPARE(json.value("buckets").toArray().size(), 11);
+
+        RequestTimings other;
+        other.add(0, 70000, 0);
+        timings.merge(other);
+        QCOMPARE(timings.count(), qint64(101));
+        QCOMPARE(timings.quantileMs(1.0), qint64(70000));
+    }
+
+    void testKey()
+    {
+        QCOMPARE(RequestTimings::key("PROPFIND", "/owncloud/remote.php/webdav/A"), QByteArray("PROPFIND files"));
+        QCOMPARE(RequestTimings::key("PUT", "/remote.php/dav/files/admin/A/a1"), QByteArray("PUT files"));
+        QCOMPARE(RequestTimings::key("MOVE", "/remote.php/dav/uploads/admin/1234/.file"), QByteArray("MOVE uploads"));
+        QCOMPARE(RequestTimings::key("GET", "/ocs/v1.php/cloud/capabilities"), QByteArray("GET ocs"));
+        QCOMPARE(RequestTimings::key("GET", "/status.php"), QByteArray("GET status"));
+        QCOMPARE(RequestTimings::key("GET", "/index.php/avatar"), QByteArray("GET other"));
+    }
+};
+
+QTEST_APPLESS_MAIN(TestRequestTimings)
+#include "testrequesttimings.moc"
@@ -0,0 +1,122 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+
+#include "discoveryphase.h"
+
+using namespace OCC;
+
+class TestSelectiveSyncPathTrie : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testEmpty()
+    {
+        SelectiveSyncPathTrie trie;
+        QVERIFY(trie.isEmpty());
+        QVERIFY(!trie.containsPathOrParent("A"));
+        QVERIFY(!trie.containsExactly(""));
+        QVERIFY(!trie.containsPathOrChild("A"));
+    }
+
+    void testPrefix()
+    {
+        SelectiveSyncPathTrie trie;
+        trie.insert("A/B/");
+        QVERIFY(!trie.isEmpty());
+
+        QVERIFY(trie.containsPathOrParent("A/B"));
+        QVERIFY(trie.containsPathOrParent("A/B/c"));
+        QVERIFY(trie.containsPathOrParent("A/B/c/d"));
+        QVERIFY(!trie.containsPathOrParent("A"));
+        // Whole components only, not a string prefix
+        QVERIFY(!trie.containsPathOrParent("A/BB"));
+        QVERIFY(!trie.containsPathOrParent("A/B.txt"));
+        QVERIFY(!trie.containsPathOrParent("AA/B"));
+        // Case matters
+        QVERIFY(!trie.containsPathOrParent("a/b"));
+
+        QVERIFY(trie.containsExactly("A/B"));
+        QVERIFY(!trie.containsExactly("A"));
+        QVERIFY(!trie.containsExactly("A/B/c"));
+
+        QVERIFY(trie.containsPathOrChild("A"));
+        QVERIFY(trie.containsPathOrChild("A/B"));
+        QVERIFY(!trie.containsPathOrChild("A/B/c"));
+        QVERIFY(!trie.containsPathOrChild("B"));
+
+        // With or without the trailing '/'
+        SelectiveSyncPathTrie noSlash;
+        noSlash.insert("A/B");
+        QVERIFY(noSlash.containsExactly("A/B"));
+        QVERIFY(noSlash.containsPathOrParent("A/B/c"));
+    }
+
+    void testNested()
+    {
+        SelectiveSyncPathTrie trie;
+        trie.insert("A/B/C/");
+        trie.insert("A/");
+        trie.insert(QString::fromUtf8("A/\xc3\xa9t\xc3\xa9/"));
+
+        // The outer folder covers the inner ones
+        QVERIFY(trie.containsPathOrParent("A"));
+        QVERIFY(trie.containsPathOrParent("A/x"));
+        QVERIFY(trie.containsPathOrParent("A/B/C/d"));
+        QVERIFY(trie.containsExactly("A"));
+        QVERIFY(trie.containsExactly("A/B/C"));
+        QVERIFY(!trie.containsExactly("A/B"));
+        QVERIFY(trie.containsExactly(QString::fromUtf8("A/\xc3\xa9t\xc3\xa9").toUtf8()));
+        QVERIFY(trie.containsPathOrChild("A/B"));
+
+        // "/" is everything
+        SelectiveSyncPathTrie all;
+        all.insert("/");
+        QVERIFY(all.containsPathOrParent("A"));
+        QVERIFY(all.containsPathOrParent("A/B/c"));
+    }
+
+    void testRemove()
+    {
+        SelectiveSyncPathTrie trie;
+        trie.insert("A/");
+        trie.insert("A/B/C/");
+        trie.insert("D/E/");
+
+        // The folders below a removed one stay
+        trie.remove("A/");
+        QVERIFY(!trie.containsPathOrParent("A/x"));
+        QVERIFY(!trie.containsExactly("A"));
+        QVERIFY(trie.containsPathOrParent("A/B/C/d"));
+        QVERIFY(trie.containsPathOrChild("A"));
+
+        // Nothing leads to the removed one anymore
+        trie.remove("A/B/C");
+        QVERIFY(!trie.containsPathOrParent("A/B/C/d"));
+        QVERIFY(!trie.containsPathOrChild("A"));
+        QVERIFY(!trie.containsPathOrChild("A/B"));
+        QVERIFY(trie.containsPathOrParent("D/E"));
+
+        // Unknown paths and parents that aren't folders of the list
+        trie.remove("X/Y");
+        trie.remove("D");
+        QVERIFY(trie.containsPathOrParent("D/E/f"));
+
+        trie.remove("D/E/");
+        QVERIFY(trie.isEmpty());
+        QVERIFY(!trie.containsPathOrChild("D"));
+
+        // And added again
+        trie.insert("D/E/");
+        QVERIFY(trie.containsExactly("D/E"));
+    }
+};
+
+QTEST_APPLESS_MAIN(TestSelectiveSyncPathTrie)
+#include "testselectivesyncpathtrie.moc"
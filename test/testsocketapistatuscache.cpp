@@ -0,0 +1,151 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#include <QtTest>
+
+#include "socketapistatuscache.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace OCC;
+
+class TestSocketApiStatusCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testLookup()
+    {
+        SocketApiStatusCache cache{ QString() };
+        QVERIFY(!cache.isShared());
+        QVERIFY(cache.fileName().isEmpty());
+
+        SyncFileStatus status;
+        QVERIFY(!cache.status("/sync/A/a1", &status));
+
+        cache.setStatus("/sync/A/a1", SyncFileStatus::StatusSync);
+        SyncFileStatus shared(SyncFileStatus::StatusUpToDate);
+        shared.setShared(true);
+        cache.setStatus("/sync/A/a2", shared);
+
+        QVERIFY(cache.status("/sync/A/a1", &status));
+        QCOMPARE(status, SyncFileStatus(SyncFileStatus::StatusSync));
+        QVERIFY(cache.status("/sync/A/a2", &status));
+        QCOMPARE(status, shared);
+        QVERIFY(!cache.status("/sync/A", &status));
+
+        // The new status replaces the old one
+        cache.setStatus("/sync/A/a1", SyncFileStatus::StatusError);
+        QVERIFY(cache.status("/sync/A/a1", &status));
+        QCOMPARE(status, SyncFileStatus(SyncFileStatus::StatusError));
+
+        // With or without native separators
+        QCOMPARE(SocketApiStatusCache::pathHash("/sync/A/a1"),
+            SocketApiStatusCache::pathHash(QDir::toNativeSeparators("/sync/A/a1")));
+
+        cache.clear();
+        QVERIFY(!cache.status("/sync/A/a1", &status));
+        QVERIFY(!cache.status("/sync/A/a2", &status));
+    }
+
+    void testFull()
+    {
+        SocketApiStatusCache cache{ QString() };
+        SyncFileStatus status;
+        int count = 0;
+        // A new path clears the table once it is three quarters full
+        for (; count < 100000; ++count) {
+            cache.setStatus(QString("/sync/f%1").arg(count), SyncFileStatus::StatusUpToDate);
+            if (!cache.status("/sync/f0", &status))
+                break;
+        }
+        QCOMPARE(count, (1 << 16) / 4 * 3);
+        QVERIFY(cache.status(QString("/sync/f%1").arg(count), &status));
+        QVERIFY(!cache.status(QString("/sync/f%1").arg(count - 1), &status));
+    }
+
+    void testConcurrentReads()
+    {
+        SocketApiStatusCache cache{ QString() };
+        SyncFileStatus sharedUpToDate(SyncFileStatus::StatusUpToDate);
+        sharedUpToDate.setShared(true);
+        cache.setStatus("/sync/stable", sharedUpToDate);
+
+        // The reader only ever sees one of the statuses that were written
+        std::atomic<bool> done(false);
+        std::atomic<int> reads(0);
+        std::atomic<int> badReads(0);
+        std::thread reader([&] {
+            SyncFileStatus status;
+            while (!done.load()) {
+                if (cache.status("/sync/stable", &status)) {
+                    if (status != sharedUpToDate && status != SyncFileStatus(SyncFileStatus::StatusSync))
+                        ++badReads;
+                    ++reads;
+                }
+                if (cache.status("/sync/missing", &status))
+                    ++badReads;
+            }
+        });
+
+        for (int i = 0; i < 200000; ++i) {
+            cache.setStatus("/sync/stable", i % 2 ? SyncFileStatus(SyncFileStatus::StatusSync) : sharedUpToDate);
+            cache.setStatus(QString("/sync/f%1").arg(i % 5000), SyncFileStatus::StatusError);
+            if (i % 20000 == 0)
+                cache.clear();
+        }
+        // Let the reader see the final state at least once
+        while (reads.load() == 0)
+            QThread::yieldCurrentThread();
+        done.store(true);
+        reader.join();
+
+        QCOMPARE(badReads.load(), 0);
+        QVERIFY(reads.load() > 0);
+    }
+
+    void testSharedFile()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.path() + "/statuscache";
+        {
+            SocketApiStatusCache cache(fileName);
+            QVERIFY(cache.isShared());
+            QCOMPARE(cache.fileName(), fileName);
+
+            SyncFileStatus shared(SyncFileStatus::StatusWarning);
+            shared.setShared(true);
+            cache.setStatus("/sync/A/a1", shared);
+
+            // Read it the way the extensions do
+            QFile file(fileName);
+            QVERIFY(file.open(QIODevice::ReadOnly));
+            const QByteArray data = file.readAll();
+            const auto word = [&](int offset) { return *reinterpret_cast<const quint32 *>(data.constData() + offset); };
+            QCOMPARE(word(0), quint32(0x4353434f));
+            QCOMPARE(word(4), quint32(1));
+            QCOMPARE(word(8) % 2, quint32(0));
+            const quint32 capacity = word(12);
+            QCOMPARE(data.size(), int(16 + capacity * 16));
+
+            const quint64 hash = SocketApiStatusCache::pathHash("/sync/A/a1");
+            quint32 value = 0;
+            for (quint32 index = hash & (capacity - 1); word(16 + index * 16 + 8) != 0; index = (index + 1) & (capacity - 1)) {
+                if (*reinterpret_cast<const quint64 *>(data.constData() + 16 + index * 16) == hash) {
+                    value = word(16 + index * 16 + 8);
+                    break;
+                }
+            }
+            QCOMPARE(value, quint32(SyncFileStatus::StatusWarning + 1) | 0x100);
+        }
+        // Removed with the cache
+        QVERIFY(!QFile::exists(fileName));
+    }
+};
+
+QTEST_APPLESS_MAIN(TestSocketApiStatusCache)
+#include "testsocketapistatuscache.moc"
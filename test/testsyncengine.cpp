@@ -8,6 +8,9 @@
 #include <QtTest>
 #include "syncenginetestutils.h"
 #include <syncengine.h>
+#include "abstractnetworkjob.h"
+#include "common/sessionrecorder.h"
+#include "common/tracing.h"
 
 using namespace OCC;
 
@@ -31,6 +34,74 @@ bool itemDidCompleteSuccessfully(const QSignalSpy &spy, const QString &path)
     return false;
 }
 
+// Sets a variable for the lifetime of the guard, also when a check fails early
+template <typename T>
+class ValueGuard
+{
+public:
+    ValueGuard(T &variable, const T &value)
+        : _variable(variable)
+        , _previous(variable)
+    {
+        _variable = value;
+    }
+    ~ValueGuard() { _variable = _previous; }
+
+private:
+    T &_variable;
+    T _previous;
+};
+
+// Accepts an upload that the server assembles in the background, see OCC::PollJob
+class FakeAsyncPutReply : public FakePayloadReply
+{
+public:
+    FakeAsyncPutReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request,
+        const QByteArray &pollPath, QObject *parent)
+        : FakePayloadReply(op, request, QByteArray(), parent, 202)
+    {
+        setRawHeader("OC-Finish-Poll", pollPath);
+    }
+};
+
+/**
+ * Lets the download of A/a1 hang until the sync gives up on it after @a interrupt ran,
+ * with the timeout @a shortTimeoutMsec set to 100ms. Checks that this takes far less
+ * than the regular timeout and that the next sync completes.
+ */
+static void checkHangingDownloadIsGivenUp(qint64 &shortTimeoutMsec,
+    const std::function<void(QNetworkReply *)> &onReply,
+    const std::function<void(FakeFolder &)> &interrupt)
+{
+    QObject parent;
+    FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+    bool hold = true;
+    fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+        if (hold && op == QNetworkAccessManager::GetOperation && getFilePathFromUrl(request.url()) == "A/a1") {
+            auto reply = new FakeHangingReply{ op, request, &parent };
+            onReply(reply);
+            return reply;
+        }
+        return nullptr;
+    });
+    fakeFolder.remoteModifier().appendByte("A/a1");
+    fakeFolder.remoteModifier().appendByte("A/a2");
+
+    {
+        ValueGuard<qint64> timeout(shortTimeoutMsec, 100);
+        QElapsedTimer timer;
+        timer.start();
+        fakeFolder.scheduleSync();
+        interrupt(fakeFolder);
+        QVERIFY(!fakeFolder.execUntilFinished());
+        QVERIFY(timer.elapsed() < 60 * 1000);
+    }
+
+    hold = false;
+    QVERIFY(fakeFolder.syncOnce());
+    QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+}
+
 class TestSyncEngine : public QObject
 {
     Q_OBJECT
@@ -335,6 +406,75 @@ private slots:
         QCOMPARE(nGET, expectedGET);
     }
 
+    /**
+     * Checks that a conflict between files of the same size is decided by
+     * the comparison during the download, and that the checksum of the local
+     * file is computed rather than taken from the cache.
+     */
+    void testConflictContentComparison()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+
+        int nGET = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++nGET;
+            return nullptr;
+        });
+        auto conflictFiles = [&]() {
+            QStringList files;
+            for (const auto &item : fakeFolder.currentLocalState().find("A")->children) {
+                if (item.name.contains("_conflict"))
+                    files.append(item.name);
+            }
+            return files;
+        };
+
+        auto mtime = QDateTime::currentDateTimeUtc().addDays(-4);
+        mtime.setMSecsSinceEpoch(mtime.toMSecsSinceEpoch() / 1000 * 1000);
+
+        // The same content: downloaded, but no conflict
+        fakeFolder.localModifier().setContents("A/a1", 'C');
+        fakeFolder.localModifier().setModTime("A/a1", mtime);
+        fakeFolder.remoteModifier().setContents("A/a1", 'C');
+        fakeFolder.remoteModifier().setModTime("A/a1", mtime.addDays(1));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 1);
+        QVERIFY(conflictFiles().isEmpty());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Different content of the same size: a conflict
+        fakeFolder.localModifier().setContents("A/a1", 'D');
+        fakeFolder.localModifier().setModTime("A/a1", mtime);
+        fakeFolder.remoteModifier().setContents("A/a1", 'E');
+        fakeFolder.remoteModifier().setModTime("A/a1", mtime.addDays(2));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 2);
+        QCOMPARE(conflictFiles().size(), 1);
+        QCOMPARE(fakeFolder.currentLocalState().find("A/" + conflictFiles().first())->contentChar, 'D');
+        QCOMPARE(fakeFolder.currentLocalState().find("A/a1")->contentChar, 'E');
+        fakeFolder.localModifier().remove("A/" + conflictFiles().first());
+
+        // A cache entry that matches the server's checksum is not trusted:
+        // the local file is read and the conflict found.
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("A/a2"), &record));
+        fakeFolder.localModifier().setContents("A/a2", 'G');
+        fakeFolder.localModifier().setModTime("A/a2", mtime);
+        fakeFolder.remoteModifier().setContents("A/a2", 'H');
+        fakeFolder.remoteModifier().setModTime("A/a2", mtime);
+        auto remoteA2 = fakeFolder.remoteModifier().find("A/a2");
+        remoteA2->checksums = "SHA1:" + QCryptographicHash::hash(QByteArray(int(remoteA2->size), 'H'), QCryptographicHash::Sha1).toHex();
+        const QString a2path = fakeFolder.localPath() + "A/a2";
+        fakeFolder.syncJournal().setCachedChecksum(record._inode, FileSystem::getModTimeNsecs(a2path),
+            FileSystem::getSize(a2path), remoteA2->checksums);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 3);
+        QCOMPARE(conflictFiles().size(), 1);
+        QCOMPARE(fakeFolder.currentLocalState().find("A/" + conflictFiles().first())->contentChar, 'G');
+        QCOMPARE(fakeFolder.currentLocalState().find("A/a2")->contentChar, 'H');
+    }
+
     /**
      * Checks whether SyncFileItems have the expected properties before start
      * of propagation.
@@ -463,6 +603,60 @@ private slots:
         QCOMPARE(n507, 3);
     }
 
+    /**
+     * Checks that the quota of the root listing is the first quota guess of the root folder
+     */
+    void testRootQuota()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._parallelNetworkJobs = false;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+        QSignalSpy quotaSpy(&fakeFolder.syncEngine(), &SyncEngine::rootQuota);
+
+        int nPUT = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                nPUT++;
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().extraDavProperties =
+            "<d:quota-used-bytes>300</d:quota-used-bytes>"
+            "<d:quota-available-bytes>1000.5</d:quota-available-bytes>";
+        fakeFolder.localModifier().insert("big", 1200); // skipped
+        fakeFolder.localModifier().insert("A/big", 1200); // other folders have no guess
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(nPUT, 1);
+        QVERIFY(!fakeFolder.currentRemoteState().find("big"));
+        QVERIFY(fakeFolder.currentRemoteState().find("A/big"));
+        QCOMPARE(quotaSpy.count(), 1);
+        QCOMPARE(quotaSpy.first().at(0).toLongLong(), qint64(300));
+        QCOMPARE(quotaSpy.first().at(1).toLongLong(), qint64(1000));
+
+        // Each sync starts from the new listing
+        nPUT = 0;
+        fakeFolder.remoteModifier().extraDavProperties =
+            "<d:quota-used-bytes>300</d:quota-used-bytes>"
+            "<d:quota-available-bytes>2000</d:quota-available-bytes>";
+        fakeFolder.syncJournal().wipeErrorBlacklist();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nPUT, 1);
+        QVERIFY(fakeFolder.currentRemoteState().find("big"));
+
+        // A negative value is no limit
+        nPUT = 0;
+        fakeFolder.remoteModifier().extraDavProperties =
+            "<d:quota-used-bytes>300</d:quota-used-bytes>"
+            "<d:quota-available-bytes>-3</d:quota-available-bytes>";
+        fakeFolder.localModifier().insert("big2", 5000);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nPUT, 1);
+        QCOMPARE(quotaSpy.count(), 3);
+        QCOMPARE(quotaSpy.last().at(1).toLongLong(), qint64(-3));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
     // Checks whether downloads with bad checksums are accepted
     void testChecksumValidation()
     {
@@ -595,6 +789,122 @@ private slots:
         QCOMPARE(fakeFolder.syncEngine().lastLocalDiscoveryStyle(), LocalDiscoveryStyle::FilesystemOnly);
     }
 
+    // Check that a sync for some paths leaves the remote changes elsewhere for the next one
+    void testRemoteDiscoveryPaths()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.remoteModifier().mkdir("A/X");
+        fakeFolder.remoteModifier().insert("A/X/x1");
+        QVERIFY(fakeFolder.syncOnce());
+
+        fakeFolder.localModifier().insert("A/X/x2");
+        fakeFolder.remoteModifier().insert("A/X/x3");
+        fakeFolder.remoteModifier().insert("A/a3");
+        fakeFolder.remoteModifier().insert("B/b3");
+        // Moved out of a directory that isn't discovered
+        fakeFolder.remoteModifier().rename("C/c1", "A/c1");
+
+        QSignalSpy rootEtag(&fakeFolder.syncEngine(), &SyncEngine::rootEtag);
+        fakeFolder.syncEngine().setRemoteDiscoveryPaths({ "A/X/x2" });
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentRemoteState().find("A/X/x2"));
+        QVERIFY(fakeFolder.currentLocalState().find("A/X/x3"));
+        QVERIFY(fakeFolder.currentLocalState().find("A/a3"));
+        QVERIFY(!fakeFolder.currentLocalState().find("B/b3"));
+        QVERIFY(fakeFolder.currentLocalState().find("A/c1"));
+        QVERIFY(fakeFolder.currentLocalState().find("C/c1"));
+        QVERIFY(rootEtag.isEmpty());
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(rootEtag.size(), 1);
+    }
+
+    // Check that a deferred directory inside a discovered one is discovered by the next sync
+    void testRemoteDiscoveryPathsNested()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.remoteModifier().mkdir("A/X");
+        fakeFolder.remoteModifier().mkdir("A/Y");
+        fakeFolder.remoteModifier().mkdir("A/Y/Z");
+        fakeFolder.remoteModifier().insert("A/Y/Z/z1");
+        QVERIFY(fakeFolder.syncOnce());
+
+        fakeFolder.localModifier().insert("A/X/x1");
+        fakeFolder.remoteModifier().insert("A/Y/Z/z2");
+        fakeFolder.syncEngine().setRemoteDiscoveryPaths({ "A/X/x1" });
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentRemoteState().find("A/X/x1"));
+        QVERIFY(!fakeFolder.currentLocalState().find("A/Y/Z/z2"));
+
+        // A got its new etag, but A/Y and A/Y/Z still have to be listed
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentLocalState().find("A/Y/Z/z2"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // Check that the uploads are compressed when the server takes it, and arrive intact
+    void testUploadCompression()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "upload-compression", QStringList{ "gzip" } } } } });
+
+        QMap<QString, QByteArray> encodings;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                encodings[getFilePathFromUrl(request.url())] = request.rawHeader("Content-Encoding");
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("A/big", 1000 * 1000);
+        fakeFolder.localModifier().insert("A/small", 100);
+        fakeFolder.localModifier().insert("A/photo.jpg", 1000 * 1000);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(encodings.value("A/big"), QByteArray("gzip"));
+        QCOMPARE(encodings.value("A/small"), QByteArray());
+        QCOMPARE(encodings.value("A/photo.jpg"), QByteArray());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/big")->size, qint64(1000 * 1000));
+
+        // Not without the capability
+        fakeFolder.syncEngine().account()->setCapabilities({});
+        fakeFolder.localModifier().appendByte("A/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(encodings.value("A/big"), QByteArray());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // Check that a dry run leaves the files and the journal alone
+    void testDryRun()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        fakeFolder.localModifier().insert("B/b3");
+        auto &journal = fakeFolder.syncJournal();
+        journal.setDiscoveryListing("C", "etag", "listing");
+        SyncJournalFileRecord before;
+        QVERIFY(journal.getFileRecord(QByteArray("A/a1"), &before));
+
+        SyncOptions options;
+        options._dryRun = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        QSignalSpy aboutToPropagate(&fakeFolder.syncEngine(), &SyncEngine::aboutToPropagate);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(aboutToPropagate.size(), 1);
+
+        QVERIFY(!fakeFolder.currentRemoteState().find("B/b3"));
+        QVERIFY(fakeFolder.currentLocalState() != fakeFolder.currentRemoteState());
+        QVERIFY(journal.hasDiscoveryListings());
+        SyncJournalFileRecord after;
+        QVERIFY(journal.getFileRecord(QByteArray("A/a1"), &after));
+        QCOMPARE(after._etag, before._etag);
+        QVERIFY(!journal.getFileRecord(QByteArray("B/b3"), &after) || !after.isValid());
+
+        fakeFolder.syncEngine().setSyncOptions(SyncOptions());
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
     void testDiscoveryHiddenFile()
     {
         FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
@@ -620,6 +930,1076 @@ private slots:
         QVERIFY(localFileExists("A/.hidden"));
         QVERIFY(fakeFolder.currentRemoteState().find("B/.hidden"));
     }
+
+    void testDiscoveryBatches()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        for (const QString dir : { "A", "B", "C", "D" }) {
+            fakeFolder.remoteModifier().mkdir(dir);
+            fakeFolder.remoteModifier().mkdir(dir + "/sub");
+            fakeFolder.remoteModifier().insert(dir + "/sub/file");
+        }
+
+        SyncOptions syncOptions;
+        syncOptions._discoveryBatchSize = 1;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        // Only the first new folder is listed, everything after it is left for later
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.syncEngine().isAnotherSyncNeeded(), BatchFollowUp);
+        QVERIFY(fakeFolder.currentLocalState().find("A"));
+        QVERIFY(!fakeFolder.currentLocalState().find("A/sub"));
+        QVERIFY(!fakeFolder.currentLocalState().find("B"));
+
+        int syncs = 1;
+        while (fakeFolder.syncEngine().isAnotherSyncNeeded() == BatchFollowUp && syncs < 20) {
+            QVERIFY(fakeFolder.syncOnce());
+            ++syncs;
+        }
+        QVERIFY(syncs > 2);
+        QCOMPARE(fakeFolder.syncEngine().isAnotherSyncNeeded(), NoFollowUpSync);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testDiscoveryPriorityPaths()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        for (const QString dir : { "A", "B", "C", "D" }) {
+            fakeFolder.remoteModifier().mkdir(dir);
+            fakeFolder.remoteModifier().mkdir(dir + "/sub");
+            fakeFolder.remoteModifier().insert(dir + "/sub/file");
+        }
+
+        SyncOptions syncOptions;
+        syncOptions._discoveryBatchSize = 1;
+        syncOptions._priorityPaths = QStringList{ QStringLiteral("C/sub") };
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        // The directory the user looks at comes first
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.syncEngine().isAnotherSyncNeeded(), BatchFollowUp);
+        QVERIFY(fakeFolder.currentLocalState().find("C"));
+        QVERIFY(!fakeFolder.currentLocalState().find("A"));
+
+        int syncs = 1;
+        while (fakeFolder.syncEngine().isAnotherSyncNeeded() == BatchFollowUp && syncs < 20) {
+            QVERIFY(fakeFolder.syncOnce());
+            ++syncs;
+        }
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testResumeInterruptedDiscovery()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1");
+        fakeFolder.remoteModifier().mkdir("A/sub");
+        fakeFolder.remoteModifier().insert("A/sub/a2");
+        fakeFolder.remoteModifier().mkdir("B");
+        fakeFolder.remoteModifier().insert("B/b1");
+        fakeFolder.remoteModifier().mkdir("C");
+        fakeFolder.remoteModifier().insert("C/c1");
+
+        QStringList listed;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::CustomOperation
+                && request.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND")
+                listed.append(getFilePathFromUrl(request.url()));
+            return nullptr;
+        });
+
+        // The first sync is interrupted after A and B were listed
+        fakeFolder.serverErrorPaths().append("C", 503);
+        QVERIFY(!fakeFolder.syncOnce());
+        QVERIFY(listed.contains("A/sub"));
+        QVERIFY(fakeFolder.syncJournal().hasDiscoveryListings());
+
+        // The next one only lists again what changed in between
+        listed.clear();
+        fakeFolder.serverErrorPaths().clear();
+        fakeFolder.remoteModifier().insert("B/b2");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(!listed.contains("A"));
+        QVERIFY(!listed.contains("A/sub"));
+        QVERIFY(listed.contains("B"));
+        QVERIFY(listed.contains("C"));
+
+        // Not needed anymore after a successful sync
+        QVERIFY(!fakeFolder.syncJournal().hasDiscoveryListings());
+    }
+
+    void testSyncRunMetrics()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        QVERIFY(fakeFolder.syncOnce());
+
+        QSignalSpy metricsSpy(&fakeFolder.syncEngine(), &SyncEngine::syncMetrics);
+        fakeFolder.remoteModifier().insert("A/new", 100);
+        fakeFolder.localModifier().insert("B/new", 50);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        QCOMPARE(metricsSpy.count(), 1);
+        const auto &metrics = fakeFolder.syncEngine().syncRunMetrics();
+        QVERIFY(metrics._success);
+        QCOMPARE(metrics._bytesTransferred, qint64(150));
+        QVERIFY(metrics._localStats >= 10);
+        // B and C are unchanged on the server and read from the db
+        QVERIFY(metrics._remoteListings >= 2);
+        QVERIFY(metrics._remoteListings < 5);
+        QVERIFY(metrics._journalQueries > 0);
+        QVERIFY(metrics._peakItemCount >= 2);
+        QVERIFY(metrics.toJson().contains(QStringLiteral("phasesMs")));
+    }
+
+    void testSyncMetricsHistory()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        const int before = fakeFolder.syncJournal().syncMetricsHistory().size();
+
+        fakeFolder.localModifier().insert("A/new", 100);
+        QVERIFY(fakeFolder.syncOnce());
+
+        const auto history = fakeFolder.syncJournal().syncMetricsHistory();
+        QCOMPARE(history.size(), before + 1);
+        const QJsonObject json = QJsonDocument::fromJson(history.last()._metrics).object();
+        QVERIFY(json.value("success").toBool());
+        QCOMPARE(json.value("counters").toObject().value("bytesTransferred").toInt(), 100);
+
+        const QList<QByteArray> csv = SyncRunMetrics::historyToCsv(history).split('\n');
+        QVERIFY(csv.first().startsWith("finished,success,localDiscoveryMs"));
+        // The header, a line per sync and the empty string after the last newline
+        QCOMPARE(csv.size(), history.size() + 2);
+        QVERIFY(csv.at(history.size()).contains(",1,"));
+    }
+
+    void testLiveMetrics()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        QVERIFY(fakeFolder.syncOnce());
+
+        QJsonObject duringUpload;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                duringUpload = fakeFolder.syncEngine().liveMetrics();
+            return nullptr;
+        });
+        fakeFolder.localModifier().insert("A/new", 100);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        QVERIFY(duringUpload.value("running").toBool());
+        QCOMPARE(duringUpload.value("phase").toString(), QStringLiteral("propagation"));
+        QVERIFY(duringUpload.value("discoveredFolders").toInt() >= 1);
+        const QJsonObject propagation = duringUpload.value("propagation").toObject();
+        QCOMPARE(propagation.value("totalFiles").toInt(), 1);
+        QCOMPARE(propagation.value("completedFiles").toInt(), 0);
+        QVERIFY(propagation.value("activeJobs").toInt() >= 1);
+        QVERIFY(duringUpload.value("journal").toObject().value("queries").toInt() > 0);
+
+        QVERIFY(!fakeFolder.syncEngine().liveMetrics().value("running").toBool());
+    }
+
+    void testDropUnchangedSubtrees()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._maxDiscoveryMemory = 1;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // C and S are unchanged and get dropped during discovery
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        fakeFolder.localModifier().insert("B/b3");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Their records are kept
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("C/c1"), &record));
+        QVERIFY(record.isValid());
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("C"), &record));
+        QVERIFY(record.isValid());
+
+        // and changes in them are still noticed
+        fakeFolder.remoteModifier().appendByte("C/c1");
+        fakeFolder.localModifier().remove("C/c2");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(!fakeFolder.currentRemoteState().find("C/c2"));
+    }
+
+    void testSkipUnchangedSubtrees()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        QVERIFY(fakeFolder.syncOnce());
+
+        // B, C and S are unchanged on both sides: their contents don't
+        // get into the trees at all
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(fakeFolder.syncEngine().syncRunMetrics()._discoveredEntries <= 12);
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("C/c1"), &record));
+        QVERIFY(record.isValid());
+
+        // Local changes below a directory that is unchanged on the server still count
+        fakeFolder.localModifier().remove("C/c2");
+        fakeFolder.localModifier().insert("B/b3");
+        fakeFolder.localModifier().appendByte("S/s1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(!fakeFolder.currentRemoteState().find("C/c2"));
+        QVERIFY(fakeFolder.currentRemoteState().find("B/b3"));
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("A/a2"), &record));
+        QVERIFY(record.isValid());
+    }
+
+    void testParallelRemoteDiscovery()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._remoteDiscoveryParallelism = 4;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        QStringList listed;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::CustomOperation
+                && request.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND")
+                listed.append(request.url().path());
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().mkdir("A/x");
+        fakeFolder.remoteModifier().mkdir("A/x/y");
+        fakeFolder.remoteModifier().insert("A/x/y/f");
+        fakeFolder.remoteModifier().mkdir("S/z");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        // Every directory is listed exactly once
+        QCOMPARE(listed.size(), 8);
+        QCOMPARE(listed.toSet().size(), listed.size());
+
+        // Only the changed directories are listed, the others come from the db
+        listed.clear();
+        fakeFolder.remoteModifier().appendByte("A/x/y/f");
+        fakeFolder.remoteModifier().insert("C/c3");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(listed.size(), 5);
+        QCOMPARE(listed.toSet().size(), listed.size());
+    }
+
+    void testRecursiveListingOfNewFolders()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "propfind", QVariantMap{ { "depth_infinity", true } } } } } });
+
+        int propfinds = 0;
+        int recursivePropfinds = 0;
+        bool refuseRecursive = false;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::CustomOperation
+                || request.attribute(QNetworkRequest::CustomVerbAttribute) != "PROPFIND")
+                return nullptr;
+            ++propfinds;
+            if (request.rawHeader("Depth") == "infinity") {
+                ++recursivePropfinds;
+                if (refuseRecursive)
+                    return new FakeErrorReply{ op, request, this, 403 };
+            }
+            return nullptr;
+        });
+
+        // root, A and one request for the whole new subtree
+        fakeFolder.remoteModifier().mkdir("A/new");
+        fakeFolder.remoteModifier().mkdir("A/new/a");
+        fakeFolder.remoteModifier().mkdir("A/new/a/b");
+        fakeFolder.remoteModifier().insert("A/new/a/b/f");
+        fakeFolder.remoteModifier().mkdir("A/new/c");
+        fakeFolder.remoteModifier().insert("A/new/c/g");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(propfinds, 3);
+        QCOMPARE(recursivePropfinds, 1);
+
+        // If the server refuses, the folders are listed one by one
+        propfinds = 0;
+        recursivePropfinds = 0;
+        refuseRecursive = true;
+        fakeFolder.remoteModifier().mkdir("B/new");
+        fakeFolder.remoteModifier().mkdir("B/new/a");
+        fakeFolder.remoteModifier().insert("B/new/a/f");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(recursivePropfinds, 1);
+        QCOMPARE(propfinds, 5);
+    }
+
+    void testNewBigFolderSizeFromListing()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._newBigFolderSizeLimit = 100;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        QStringList bigFolders;
+        QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::newBigFolder,
+            [&](const QString &folder, bool) { bigFolders.append(folder); });
+        int sizePropfinds = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::CustomOperation
+                && request.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND"
+                && request.rawHeader("Depth") == "0")
+                ++sizePropfinds;
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().mkdir("A/big");
+        fakeFolder.remoteModifier().insert("A/big/f", 150);
+        fakeFolder.remoteModifier().mkdir("A/small");
+        fakeFolder.remoteModifier().insert("A/small/f", 50);
+        QVERIFY(fakeFolder.syncOnce());
+
+        // The sizes came with the listing of A, no extra request was needed
+        QCOMPARE(sizePropfinds, 0);
+        QCOMPARE(bigFolders, QStringList{ QStringLiteral("A/big") });
+        QVERIFY(!fakeFolder.currentLocalState().find("A/big"));
+        QVERIFY(fakeFolder.currentLocalState().find("A/small/f"));
+    }
+
+    void testBundledUpload()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "bulkupload", "1.0" } } } });
+
+        int bundles = 0;
+        int puts = 0;
+        bool refuseBundles = false;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (request.url().path() == sBulkUrl.path()) {
+                ++bundles;
+                if (refuseBundles)
+                    return new FakeErrorReply{ op, request, this, 404 };
+            } else if (op == QNetworkAccessManager::PutOperation) {
+                ++puts;
+            }
+            return nullptr;
+        });
+
+        for (int i = 0; i < 10; ++i)
+            fakeFolder.localModifier().insert(QString("A/new%1").arg(i), 100 + i);
+        fakeFolder.localModifier().insert("B/new", 10);
+        fakeFolder.localModifier().insert("C/big", 1000 * 1000);
+        fakeFolder.localModifier().appendByte("A/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        // The new files of A in one bundle, B/new alone, the big and the changed file with PUTs
+        QCOMPARE(bundles, 1);
+        QCOMPARE(puts, 3);
+
+        // A file with an error in the bundle is uploaded again on its own
+        bundles = 0;
+        puts = 0;
+        fakeFolder.localModifier().insert("B/x", 10);
+        fakeFolder.localModifier().insert("B/y", 10);
+        fakeFolder.serverErrorPaths().append("B/y");
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(bundles, 1);
+        QCOMPARE(puts, 1);
+        QVERIFY(fakeFolder.currentRemoteState().find("B/x"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("B/y"));
+        fakeFolder.serverErrorPaths().clear();
+        fakeFolder.localModifier().remove("B/y");
+
+        // A server without the endpoint gets regular uploads
+        bundles = 0;
+        puts = 0;
+        refuseBundles = true;
+        fakeFolder.localModifier().insert("C/x", 10);
+        fakeFolder.localModifier().insert("C/y", 10);
+        fakeFolder.localModifier().insert("C/z", 10);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(bundles, 1);
+        QCOMPARE(puts, 3);
+    }
+
+    // A new file with the content of a file on the server is copied there
+    void testServerSideCopy()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        const int size = 2 * 1000 * 1000;
+        fakeFolder.localModifier().insert("A/big", size);
+        QVERIFY(fakeFolder.syncOnce());
+
+        int puts = 0;
+        int copies = 0;
+        bool refuseCopies = false;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation) {
+                ++puts;
+            } else if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "COPY") {
+                ++copies;
+                if (refuseCopies)
+                    return new FakeErrorReply{ op, request, this, 412 };
+            }
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("B/big", size);
+        fakeFolder.localModifier().insert("C/other", size, 'X');
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(copies, 1);
+        QCOMPARE(puts, 1);
+
+        // A failed copy, e.g. because the source changed, falls back to the upload
+        copies = 0;
+        puts = 0;
+        refuseCopies = true;
+        fakeFolder.localModifier().insert("C/big", size);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(copies, 1);
+        QCOMPARE(puts, 1);
+
+        // Of two new files with the same content one is uploaded, the other one copied
+        copies = 0;
+        puts = 0;
+        refuseCopies = false;
+        fakeFolder.localModifier().insert("A/twin", size, 'T');
+        fakeFolder.localModifier().insert("B/twin", size, 'T');
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(copies, 1);
+        QCOMPARE(puts, 1);
+    }
+
+    void testTouchedFileNotUploaded()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.localModifier().insert("A/touched", 100);
+        QVERIFY(fakeFolder.syncOnce());
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("A/touched"), &record));
+        QVERIFY(!record._checksumHeader.isEmpty());
+
+        int puts = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                ++puts;
+            return nullptr;
+        });
+
+        // The content checksum of the upload finds out that only the mtime changed
+        auto mtime = QDateTime::currentDateTimeUtc().addDays(-2);
+        mtime.setMSecsSinceEpoch(mtime.toMSecsSinceEpoch() / 1000 * 1000);
+        fakeFolder.localModifier().setModTime("A/touched", mtime);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(puts, 0);
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("A/touched"), &record));
+        QCOMPARE(record._modtime, Utility::qDateTimeToTime_t(mtime));
+
+        // Nothing left to do
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(puts, 0);
+
+        // A real change is still uploaded
+        fakeFolder.localModifier().appendByte("A/touched");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(puts, 1);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testSegmentedDownload()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._minSegmentedDownloadSize = 1000;
+        syncOptions._downloadSegments = 3;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        QByteArrayList ranges;
+        bool ignoreRanges = false;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::GetOperation
+                && request.attribute(QNetworkRequest::CustomVerbAttribute) != "GET")
+                return nullptr;
+            ranges.append(request.rawHeader("Range"));
+            if (ignoreRanges) {
+                QNetworkRequest withoutRange = request;
+                withoutRange.setRawHeader("Range", QByteArray());
+                return new FakeGetReply{ fakeFolder.remoteModifier(), op, withoutRange, this };
+            }
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().insert("A/big", 1200);
+        fakeFolder.remoteModifier().insert("A/small", 999);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        std::sort(ranges.begin(), ranges.end());
+        QCOMPARE(ranges, QByteArrayList() << "" << "bytes=0-399" << "bytes=400-799" << "bytes=800-1199");
+        QCOMPARE(fakeFolder.syncJournal().downloadInfoCount(), 0);
+
+        // A server that ignores the ranges gets a single request
+        ranges.clear();
+        ignoreRanges = true;
+        fakeFolder.remoteModifier().insert("A/big2", 1200);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(ranges.size(), 4);
+        QCOMPARE(ranges.last(), QByteArray());
+    }
+
+    void testBulkTransferLane()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._minBulkTransferSize = 1000;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        QStringList requested;
+        bool holdBig = true;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::GetOperation)
+                return nullptr;
+            const QString path = getFilePathFromUrl(request.url());
+            requested.append(path);
+            if (holdBig && (path.startsWith("A/big") || path.startsWith("A/guess")))
+                return new FakeHangingReply{ op, request, this };
+            return nullptr;
+        });
+
+        for (int i = 1; i <= 4; ++i)
+            fakeFolder.remoteModifier().insert(QString("A/big%1").arg(i), 2000);
+        for (int i = 1; i <= 6; ++i)
+            fakeFolder.remoteModifier().insert(QString("A/small%1").arg(i), 10);
+
+        // The small files behind the big ones don't wait for them
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilItemCompleted("A/small6");
+        QCOMPARE(requested.filter("A/big").size(), 2);
+        QCOMPARE(requested.filter("A/small").size(), 6);
+
+        fakeFolder.syncEngine().abort();
+        fakeFolder.execUntilFinished();
+        holdBig = false;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // The prefetched files go to that lane whatever their size
+        for (int i = 1; i <= 4; ++i)
+            fakeFolder.remoteModifier().insert(QString("A/guess%1").arg(i), 10);
+        for (int i = 1; i <= 3; ++i)
+            fakeFolder.remoteModifier().insert(QString("A/wanted%1").arg(i), 10);
+        syncOptions._prefetchPaths = { "A/guess1", "A/guess2", "A/guess3", "A/guess4" };
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+        requested.clear();
+        holdBig = true;
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilItemCompleted("A/wanted3");
+        QCOMPARE(requested.filter("A/guess").size(), 2);
+        QCOMPARE(requested.filter("A/wanted").size(), 3);
+
+        fakeFolder.syncEngine().abort();
+        fakeFolder.execUntilFinished();
+        holdBig = false;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testMetadataJobsDontWaitForTransfers()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._minBulkTransferSize = 0;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        bool hold = true;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (hold && op == QNetworkAccessManager::GetOperation)
+                return new FakeHangingReply{ op, request, this };
+            return nullptr;
+        });
+
+        // Enough downloads to take all the transfer slots
+        for (int i = 1; i <= 8; ++i)
+            fakeFolder.remoteModifier().insert(QString("A/big%1").arg(i), 200 * 1000);
+        fakeFolder.localModifier().remove("B/b1");
+        fakeFolder.localModifier().remove("C/c2");
+        fakeFolder.localModifier().mkdir("D");
+        fakeFolder.localModifier().mkdir("D/E");
+
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilItemCompleted("D/E");
+        QVERIFY(!fakeFolder.currentRemoteState().find("B/b1"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("C/c2"));
+        QVERIFY(fakeFolder.currentRemoteState().find("D/E"));
+
+        fakeFolder.syncEngine().abort();
+        fakeFolder.execUntilFinished();
+        hold = false;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testBatchedDownloadDurability()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._downloadDurability = SyncOptions::DurabilityBatched;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        for (int i = 0; i < 60; ++i)
+            fakeFolder.remoteModifier().insert(QString("B/new%1").arg(i), 10 + i);
+        fakeFolder.remoteModifier().appendByte("A/a1");
+
+        // The downloads finish one by one but complete together, after a flush
+        int finishedGets = 0;
+        QObject::connect(fakeFolder.syncEngine().account()->networkAccessManager(), &QNetworkAccessManager::finished,
+            [&](QNetworkReply *reply) {
+                if (reply->operation() == QNetworkAccessManager::GetOperation)
+                    ++finishedGets;
+            });
+        QList<int> finishedGetsAtCompletion;
+        QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, [&](const SyncFileItemPtr &item) {
+            if (item->_instruction == CSYNC_INSTRUCTION_NEW || item->_instruction == CSYNC_INSTRUCTION_SYNC)
+                finishedGetsAtCompletion.append(finishedGets);
+        });
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(finishedGetsAtCompletion.size(), 61);
+        QVERIFY(finishedGetsAtCompletion.first() > 1);
+        QVERIFY(finishedGetsAtCompletion.toSet().size() < finishedGetsAtCompletion.size() / 2);
+
+        // The journal records were written after the flush
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("B/new59"), &record));
+        QVERIFY(record.isValid());
+        QCOMPARE(record._fileSize, 69);
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("A/a1"), &record));
+        QCOMPARE(record._fileSize, 5);
+    }
+
+    void testConstrainedNetworkDefersLargeTransfers()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._constrainedNetwork = true;
+        syncOptions._minDeferredTransferSize = 1000;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        fakeFolder.remoteModifier().insert("A/big", 2000);
+        fakeFolder.remoteModifier().insert("A/small", 10);
+        fakeFolder.localModifier().insert("B/bigUp", 2000);
+
+        auto deferredItem = [](const QSignalSpy &spy, const QString &path) {
+            for (const QList<QVariant> &args : spy) {
+                auto item = args[0].value<SyncFileItemPtr>();
+                if (item->destination() == path)
+                    return item->_status == SyncFileItem::Deferred && item->_errorString.isEmpty();
+            }
+            return false;
+        };
+
+        // Only the small file is transferred, the others are deferred silently
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/small"));
+        QVERIFY(deferredItem(completeSpy, "A/big"));
+        QVERIFY(deferredItem(completeSpy, "B/bigUp"));
+        QVERIFY(!fakeFolder.currentLocalState().find("A/big"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("B/bigUp"));
+        QVERIFY(!fakeFolder.syncJournal().errorBlacklistEntry("A/big").isValid());
+        QVERIFY(!fakeFolder.syncJournal().errorBlacklistEntry("B/bigUp").isValid());
+
+        // A follow-up sync that is still constrained finds them again
+        completeSpy.clear();
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(deferredItem(completeSpy, "A/big"));
+        QVERIFY(deferredItem(completeSpy, "B/bigUp"));
+        QVERIFY(!itemDidComplete(completeSpy, "A/small"));
+
+        // The next sync without constraints catches up
+        syncOptions._constrainedNetwork = false;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testThrottledProgress()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        int updates = 0;
+        ProgressInfo::Status lastStatus = ProgressInfo::Starting;
+        QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::transmissionProgress,
+            [&](const ProgressInfo &progress) {
+                ++updates;
+                lastStatus = progress.status();
+            });
+        auto syncNewFiles = [&](const QString &dir) {
+            updates = 0;
+            for (int i = 0; i < 20; ++i)
+                fakeFolder.localModifier().insert(dir + "/new" + QString::number(i), 100);
+            QVERIFY(fakeFolder.syncOnce());
+            QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        };
+
+        syncNewFiles("A");
+        const int unthrottledUpdates = updates;
+
+        // The upload progress of the files is held back
+        SyncOptions syncOptions;
+        syncOptions._progressInterval = 3600 * 1000;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+        syncNewFiles("B");
+        QVERIFY(updates < unthrottledUpdates);
+        // One per phase and one per completed file are still sent
+        QVERIFY(updates >= 20);
+        QCOMPARE(lastStatus, ProgressInfo::Done);
+    }
+
+    void testRediscoveryOfIgnoredFiles()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().excludedFiles().addManualExclude("B/ignored");
+        fakeFolder.remoteModifier().insert("B/ignored");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentLocalState().find("B/ignored"));
+
+        QStringList listed;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::CustomOperation
+                && request.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND")
+                listed.append(request.url().path());
+            return nullptr;
+        });
+
+        // Only the directory that had the ignored file is listed again
+        fakeFolder.syncEngine().excludedFiles().clearManualExcludes();
+        fakeFolder.syncJournal().forceRemoteDiscoveryOfIgnoredFilesNextSync();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        bool listedB = false;
+        for (const auto &path : listed) {
+            QVERIFY(!path.endsWith("/A") && !path.endsWith("/C") && !path.endsWith("/S"));
+            listedB = listedB || path.endsWith("/B");
+        }
+        QVERIFY(listedB);
+    }
+
+    void testNetworkChange()
+    {
+        // The stalled download doesn't wait for the regular timeout
+        checkHangingDownloadIsGivenUp(AbstractNetworkJob::networkChangeTimeoutMsec, [](QNetworkReply *) {}, [](FakeFolder &fakeFolder) {
+            fakeFolder.execUntilItemCompleted("A/a2");
+            fakeFolder.syncEngine().account()->handleNetworkChange();
+        });
+    }
+
+    void testUploadWaitsForStableFile()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._uploadStabilityMsec = 200;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        int puts = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                ++puts;
+            return nullptr;
+        });
+
+        // The watcher just saw it change, it is held until the watcher's next sync
+        fakeFolder.localModifier().appendByte("A/a1");
+        fakeFolder.syncEngine().noteLocalChange("A/a1");
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        fakeFolder.syncOnce();
+        QCOMPARE(puts, 0);
+        QVERIFY(itemDidComplete(completeSpy, "A/a1"));
+        QVERIFY(!itemDidCompleteSuccessfully(completeSpy, "A/a1"));
+        // Immediate follow-ups would only find it still changing
+        QCOMPARE(fakeFolder.syncEngine().isAnotherSyncNeeded(), NoFollowUpSync);
+
+        // Left alone long enough, it is uploaded once
+        QTest::qWait(300);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(puts, 1);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testStalledTransfer()
+    {
+        checkHangingDownloadIsGivenUp(AbstractNetworkJob::stallTimeoutMsec, [](QNetworkReply *reply) {
+            // Some data arrives, then nothing
+            QTimer::singleShot(0, reply, [reply] { emit reply->downloadProgress(1, 100); });
+        }, [](FakeFolder &) {});
+    }
+
+    void testPausedSync()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.remoteModifier().insert("A/new");
+        fakeFolder.localModifier().insert("B/new");
+
+        // The discovery goes on, the propagation waits
+        fakeFolder.syncEngine().setPaused(true);
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        QSignalSpy finishedSpy(&fakeFolder.syncEngine(), SIGNAL(finished(bool)));
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilBeforePropagation();
+        QVERIFY(!finishedSpy.wait(300));
+        QVERIFY(!itemDidComplete(completeSpy, "A/new"));
+        QVERIFY(!itemDidComplete(completeSpy, "B/new"));
+
+        fakeFolder.syncEngine().setPaused(false);
+        QVERIFY(fakeFolder.execUntilFinished());
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/new"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "B/new"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    /**
+     * Checks that a pause chokes a download that already has its reply, and
+     * that it continues on the same request.
+     */
+    void testPauseChokesRunningTransfer()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        QObject parent;
+        int nGET = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::GetOperation || !request.url().path().endsWith("A/big"))
+                return nullptr;
+            ++nGET;
+            auto reply = new FakeGetReply(fakeFolder.remoteModifier(), op, request, &parent);
+            // The headers are there, the body is not read yet
+            connect(reply, &QNetworkReply::metaDataChanged, &parent, [&]() { fakeFolder.syncEngine().setPaused(true); });
+            return reply;
+        });
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        QSignalSpy finishedSpy(&fakeFolder.syncEngine(), SIGNAL(finished(bool)));
+
+        fakeFolder.remoteModifier().insert("A/big", 300 * 1000);
+        fakeFolder.scheduleSync();
+        QTRY_COMPARE(nGET, 1);
+        QVERIFY(!finishedSpy.wait(300));
+        QVERIFY(!itemDidComplete(completeSpy, "A/big"));
+        QVERIFY(!fakeFolder.currentLocalState().find("A/big"));
+
+        fakeFolder.syncEngine().setPaused(false);
+        QVERIFY(fakeFolder.execUntilFinished());
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/big"));
+        QCOMPARE(nGET, 1);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testBatchedItemsCompleted()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        int batches = 0;
+        QStringList batchedFiles;
+        bool finished = false;
+        QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::itemsCompleted,
+            [&](const SyncFileItemVector &items) {
+                QVERIFY(!finished);
+                ++batches;
+                for (const auto &item : items)
+                    batchedFiles.append(item->_file);
+            });
+        QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::finished, [&] { finished = true; });
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+
+        for (int i = 0; i < 20; ++i)
+            fakeFolder.localModifier().insert("A/new" + QString::number(i), 100);
+        QVERIFY(fakeFolder.syncOnce());
+
+        // The same items, in the same order, but not one signal each
+        QStringList completedFiles;
+        for (const auto &args : completeSpy)
+            completedFiles.append(args[0].value<SyncFileItemPtr>()->_file);
+        QCOMPARE(batchedFiles, completedFiles);
+        QVERIFY(batches < completedFiles.size());
+    }
+
+    void testProgressSnapshots()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        QVector<ProgressInfo> snapshots;
+        QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::transmissionProgress,
+            [&](const ProgressInfo &progress) { snapshots.append(progress); });
+
+        fakeFolder.remoteModifier().insert("A/down1", 1000);
+        fakeFolder.remoteModifier().insert("A/down2", 2000);
+        fakeFolder.localModifier().insert("B/up1", 3000);
+        fakeFolder.remoteModifier().appendByte("C/c1");
+        QVERIFY(fakeFolder.syncOnce());
+
+        // The copies keep the state of their moment
+        QVERIFY(snapshots.size() > 2);
+        quint64 previous = 0;
+        for (const auto &snapshot : snapshots) {
+            QVERIFY(snapshot.completedSize() <= snapshot.totalSize());
+            QVERIFY(snapshot.completedSize() >= previous);
+            previous = snapshot.completedSize();
+        }
+        const auto &done = snapshots.last();
+        QCOMPARE(done.status(), ProgressInfo::Done);
+        QCOMPARE(done.totalSize(), quint64(1000 + 2000 + 3000 + 25));
+        QCOMPARE(done.completedSize(), done.totalSize());
+        QCOMPARE(done.completedFiles(), done.totalFiles());
+        QVERIFY(done._currentItems.isEmpty());
+    }
+
+    void testTraceFile()
+    {
+        QTemporaryDir dir;
+        const QString traceFile = dir.path() + "/trace.json";
+        Tracing::setOutputFile(traceFile);
+
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.localModifier().insert("A/new", 100);
+        fakeFolder.remoteModifier().insert("B/new", 100);
+        QVERIFY(fakeFolder.syncOnce());
+        Tracing::setOutputFile(QString());
+
+        QFile file(traceFile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QJsonParseError error;
+        auto events = QJsonDocument::fromJson(file.readAll(), &error).object().value("traceEvents").toArray();
+        QCOMPARE(error.error, QJsonParseError::NoError);
+        QSet<QString> categories;
+        for (const auto &event : events)
+            categories.insert(event.toObject().value("cat").toString());
+        QVERIFY(categories.contains("network"));
+        QVERIFY(categories.contains("propagation"));
+        QVERIFY(categories.contains("discovery"));
+        QVERIFY(categories.contains("journal"));
+    }
+
+    void testNetworkConditions()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        FakeNetworkConditions conditions;
+        conditions.latencyMs = 20;
+        conditions.bytesPerSecond = 100000;
+        fakeFolder.setNetworkConditions(conditions);
+
+        // Both downloads go over the same link
+        fakeFolder.remoteModifier().insert("A/big1", 10000);
+        fakeFolder.remoteModifier().insert("A/big2", 10000);
+        QElapsedTimer timer;
+        timer.start();
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(timer.elapsed() >= 200);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Every request fails
+        conditions = FakeNetworkConditions();
+        conditions.errorRate = 1;
+        fakeFolder.setNetworkConditions(conditions);
+        fakeFolder.remoteModifier().insert("A/failing");
+        QVERIFY(!fakeFolder.syncOnce());
+
+        fakeFolder.setNetworkConditions(FakeNetworkConditions());
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    /**
+     * Checks that the polls of an asynchronous upload back off, and that an
+     * abort stops them.
+     */
+    void testPollBackoff()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        QObject parent;
+        QVector<qint64> pollTimes;
+        int unfinishedPolls = 2;
+        QElapsedTimer timer;
+        timer.start();
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                return new FakeAsyncPutReply(op, request, "/poll/upload", &parent);
+            if (op == QNetworkAccessManager::GetOperation && request.url().path() == "/poll/upload") {
+                pollTimes.append(timer.elapsed());
+                if (pollTimes.size() <= unfinishedPolls)
+                    return new FakePayloadReply(op, request, "{\"unfinished\":true}", &parent);
+                return new FakePayloadReply(op, request, "{\"etag\":\"polled\",\"fileid\":\"polledid\"}", &parent);
+            }
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("A/async", 100);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(pollTimes.size(), 3);
+        // 500ms, then 1s; the timers may be a bit early
+        const qint64 firstDelay = pollTimes[1] - pollTimes[0];
+        const qint64 secondDelay = pollTimes[2] - pollTimes[1];
+        QVERIFY(firstDelay >= 450);
+        QVERIFY(secondDelay >= 900);
+        QVERIFY(secondDelay > firstDelay);
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("A/async"), &record));
+        QCOMPARE(record._etag, QByteArray("polled"));
+        QVERIFY(fakeFolder.syncJournal().getPollInfos().isEmpty());
+
+        // An abort while waiting for the next poll: no poll after it
+        pollTimes.clear();
+        unfinishedPolls = 1000;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                return new FakeAsyncPutReply(op, request, "/poll/upload", &parent);
+            if (op == QNetworkAccessManager::GetOperation && request.url().path() == "/poll/upload") {
+                pollTimes.append(timer.elapsed());
+                if (pollTimes.size() == 1)
+                    QTimer::singleShot(50, &parent, [&]() { fakeFolder.syncEngine().abort(); });
+                return new FakePayloadReply(op, request, "{\"unfinished\":true}", &parent);
+            }
+            return nullptr;
+        });
+        fakeFolder.localModifier().insert("A/async2", 100);
+        QVERIFY(!fakeFolder.syncOnce());
+        QTest::qWait(1000);
+        QCOMPARE(pollTimes.size(), 1);
+        // The next sync polls again
+        QCOMPARE(fakeFolder.syncJournal().getPollInfos().size(), 1);
+    }
+
+    void testSessionRecording()
+    {
+        QTemporaryDir dir;
+        const QString fileName = dir.path() + "/session.json";
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SessionRecorder::setOutputFile(fileName);
+        fakeFolder.remoteModifier().insert("A/secret.txt", 123);
+        fakeFolder.localModifier().appendByte("B/b1");
+        QVERIFY(fakeFolder.syncOnce());
+        SessionRecorder::setOutputFile(QString());
+
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const QByteArray recording = file.readAll();
+        // No name is in the recording, the short extensions are
+        QVERIFY(!recording.contains("secret"));
+        QVERIFY(!recording.contains("\"A/"));
+        QVERIFY(recording.contains(".txt"));
+
+        // The anonymized paths are the same in the whole process
+        const QString target = SessionRecorder::anonymizedPath("A/secret.txt");
+        QVERIFY(target.endsWith(".txt"));
+        QCOMPARE(target.section('/', 0, 0), SessionRecorder::anonymizedPath("A"));
+        QVERIFY(recording.contains(target.toUtf8()));
+        QVERIFY(recording.contains("INSTRUCTION_NEW"));
+        QVERIFY(recording.contains(SessionRecorder::anonymizedPath("B/b1").toUtf8()));
+    }
 };
 
 QTEST_GUILESS_MAIN(TestSyncEngine)
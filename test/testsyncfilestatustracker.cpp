@@ -29,6 +29,16 @@ public:
         return SyncFileStatus();
     }
 
+    int pushCount(const QString &relativePath) const {
+        QFileInfo file(_syncEngine.localPath(), relativePath);
+        int count = 0;
+        for (int i = 0; i < size(); ++i) {
+            if (QFileInfo(at(i)[0].toString()) == file)
+                ++count;
+        }
+        return count;
+    }
+
     bool statusEmittedBefore(const QString &firstPath, const QString &secondPath) const {
         QFileInfo firstFile(_syncEngine.localPath(), firstPath);
         QFileInfo secondFile(_syncEngine.localPath(), secondPath);
@@ -427,6 +437,50 @@ private slots:
         QCOMPARE(statusSpy.statusOf("C/c1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
     }
 
+    void parentsReportedOnce() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.localModifier().mkdir("B/sub");
+        for (int i = 0; i < 10; ++i)
+            fakeFolder.localModifier().insert(QString("B/sub/file%1").arg(i));
+        fakeFolder.localModifier().appendByte("B/b1");
+        StatusPushSpy statusSpy(fakeFolder.syncEngine());
+
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilBeforePropagation();
+        verifyThatPushMatchesPull(fakeFolder, statusSpy);
+        QCOMPARE(statusSpy.statusOf("B"), SyncFileStatus(SyncFileStatus::StatusSync));
+        QCOMPARE(statusSpy.statusOf("B/sub"), SyncFileStatus(SyncFileStatus::StatusSync));
+        QCOMPARE(statusSpy.statusOf("B/sub/file3"), SyncFileStatus(SyncFileStatus::StatusSync));
+        QCOMPARE(statusSpy.pushCount("B"), 1);
+
+        fakeFolder.execUntilFinished();
+        verifyThatPushMatchesPull(fakeFolder, statusSpy);
+        QCOMPARE(statusSpy.statusOf("B"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void parentOfErrorsReportedOnce() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        for (int i = 0; i < 5; ++i) {
+            const QString path = QString("B/error%1").arg(i);
+            fakeFolder.serverErrorPaths().append(path);
+            fakeFolder.localModifier().insert(path);
+        }
+        StatusPushSpy statusSpy(fakeFolder.syncEngine());
+
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilBeforePropagation();
+        QCOMPARE(statusSpy.statusOf("B"), SyncFileStatus(SyncFileStatus::StatusSync));
+        statusSpy.clear();
+
+        fakeFolder.execUntilFinished();
+        verifyThatPushMatchesPull(fakeFolder, statusSpy);
+        QCOMPARE(statusSpy.statusOf("B"), SyncFileStatus(SyncFileStatus::StatusWarning));
+        QCOMPARE(statusSpy.statusOf("B/error3"), SyncFileStatus(SyncFileStatus::StatusError));
+        // Not again for each of the errors below it
+        QCOMPARE(statusSpy.pushCount("B"), 1);
+    }
+
     void sharedStatus() {
         SyncFileStatus sharedUpToDateStatus(SyncFileStatus::StatusUpToDate);
         sharedUpToDateStatus.setShared(true);
@@ -7,9 +7,14 @@
 #include <QtTest>
 
 #include <sqlite3.h>
+#include <algorithm>
+#include <thread>
 
 #include "common/syncjournaldb.h"
 #include "common/syncjournalfilerecord.h"
+#include "common/filesystembase.h"
+#include "common/ownsql.h"
+#include "csync.h"
 
 using namespace OCC;
 
@@ -125,6 +130,517 @@ private slots:
         }
     }
 
+    void testFileRecordQueue()
+    {
+        SyncJournalFileRecord record;
+        record._path = "queued";
+        record._inode = 5678;
+        record._type = 2;
+        record._etag = "abc";
+        record._fileId = "queuedId";
+        record._remotePerm = RemotePermissions("RW");
+        record._checksumHeader = "SHA1:queuedchecksum";
+        QVERIFY(_db.setFileRecord(record));
+        record._path = "queued/file";
+        record._type = 0;
+        QVERIFY(_db.setFileRecord(record));
+        record._etag = "def";
+        QVERIFY(_db.setFileRecord(record));
+
+        // The queued records are visible before they are written
+        SyncJournalFileRecord storedRecord;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("queued/file"), &storedRecord));
+        QCOMPARE(storedRecord._etag, QByteArray("def"));
+        QVERIFY(storedRecord == record);
+
+        QStringList below;
+        QVERIFY(_db.getFilesBelowPath("queued", [&](const SyncJournalFileRecord &rec) {
+            below.append(QString::fromUtf8(rec._path));
+        }));
+        QCOMPARE(below, QStringList{ "queued/file" });
+
+        // Once flushed, they are committed for other connections too
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.flushFileRecords());
+        {
+            SyncJournalDb other(_db.databaseFilePath());
+            QVERIFY(other.getFileRecord(QByteArrayLiteral("queued/file"), &storedRecord));
+            QVERIFY(storedRecord == record);
+        }
+
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.deleteFileRecord("queued", true));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("queued/file"), &storedRecord));
+        QVERIFY(!storedRecord.isValid());
+    }
+
+    void testLookupCache()
+    {
+        SyncJournalFileRecord record;
+        record._path = "cached";
+        record._etag = "1";
+        record._remotePerm = RemotePermissions("RW");
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.flushFileRecords());
+
+        auto stats = _db.lookupCacheStatistics();
+        SyncJournalFileRecord storedRecord;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("cached"), &storedRecord));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("cached"), &storedRecord));
+        QVERIFY(storedRecord == record);
+        QCOMPARE(_db.lookupCacheStatistics()._fileRecordMisses, stats._fileRecordMisses + 1);
+        QCOMPARE(_db.lookupCacheStatistics()._fileRecordHits, stats._fileRecordHits + 1);
+
+        // Writes invalidate the cached entry
+        record._etag = "2";
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.flushFileRecords());
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("cached"), &storedRecord));
+        QCOMPARE(storedRecord._etag, QByteArray("2"));
+
+        // Records that are not found are cached too
+        stats = _db.lookupCacheStatistics();
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("cached-missing"), &storedRecord));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("cached-missing"), &storedRecord));
+        QVERIFY(!storedRecord.isValid());
+        QCOMPARE(_db.lookupCacheStatistics()._fileRecordHits, stats._fileRecordHits + 1);
+
+        QVERIFY(_db.deleteFileRecord("cached"));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("cached"), &storedRecord));
+        QVERIFY(!storedRecord.isValid());
+
+        // The error blacklist is read once and updated by the writes
+        QVERIFY(!_db.errorBlacklistEntry("cached").isValid());
+        stats = _db.lookupCacheStatistics();
+        SyncJournalErrorBlacklistRecord entry;
+        entry._file = "cached";
+        entry._errorString = "error";
+        entry._lastTryEtag = "123";
+        entry._retryCount = 1;
+        entry._lastTryTime = Utility::qDateTimeToTime_t(QDateTime::currentDateTimeUtc());
+        entry._ignoreDuration = 60;
+        _db.setErrorBlacklistEntry(entry);
+        QCOMPARE(_db.errorBlacklistEntry("cached")._errorString, QString("error"));
+        QCOMPARE(_db.errorBlacklistEntry("cached")._errorString, QString("error"));
+        QCOMPARE(_db.lookupCacheStatistics()._errorBlacklistMisses, stats._errorBlacklistMisses);
+        QCOMPARE(_db.lookupCacheStatistics()._errorBlacklistHits, stats._errorBlacklistHits + 2);
+        QCOMPARE(_db.lookupCacheStatistics()._cachedErrorBlacklistEntries, stats._cachedErrorBlacklistEntries + 1);
+        _db.wipeErrorBlacklistEntry("cached");
+        QVERIFY(!_db.errorBlacklistEntry("cached").isValid());
+
+        // The table is read again after a close
+        _db.setErrorBlacklistEntry(entry);
+        _db.close();
+        QCOMPARE(_db.errorBlacklistEntry("cached")._retryCount, 1);
+        QCOMPARE(_db.lookupCacheStatistics()._errorBlacklistMisses, stats._errorBlacklistMisses + 1);
+        _db.wipeErrorBlacklistCategory(SyncJournalErrorBlacklistRecord::Normal);
+        QVERIFY(!_db.errorBlacklistEntry("cached").isValid());
+    }
+
+    void testReadOnlyLookup()
+    {
+        SyncJournalFileRecord record;
+        record._path = "readonly/file";
+        record._etag = "ro";
+        record._remotePerm = RemotePermissions("RWS");
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.flushFileRecords());
+
+        SyncJournalFileRecord storedRecord;
+        QVERIFY(_db.getFileRecordReadOnly(QByteArrayLiteral("readonly/file"), &storedRecord));
+        QVERIFY(storedRecord == record);
+
+        // Keep the journal busy in another thread while looking up the record
+        QSemaphore started, done;
+        std::thread busy([&] {
+            _db.getFilesBelowPath("readonly", [&](const SyncJournalFileRecord &) {
+                started.release();
+                done.acquire();
+            });
+        });
+        started.acquire();
+        storedRecord = SyncJournalFileRecord();
+        QVERIFY(_db.getFileRecordReadOnly(QByteArrayLiteral("readonly/file"), &storedRecord));
+        QVERIFY(storedRecord == record);
+        QVERIFY(_db.getFileRecordReadOnly(QByteArrayLiteral("readonly/missing"), &storedRecord));
+        QVERIFY(!storedRecord.isValid());
+        done.release();
+        busy.join();
+
+        QVERIFY(_db.deleteFileRecord("readonly", true));
+    }
+
+    void testAsyncLookup()
+    {
+        SyncJournalFileRecord record;
+        record._path = "async/file";
+        record._etag = "as";
+        record._remotePerm = RemotePermissions("RWS");
+        QVERIFY(_db.setFileRecord(record));
+
+        SyncJournalFileRecord storedRecord;
+        bool done = false;
+        QObject context;
+        _db.getFileRecordAsync("async/file", &context, [&](const SyncJournalFileRecord &rec) {
+            storedRecord = rec;
+            done = true;
+        });
+        // Delivered by the event loop of the caller
+        QVERIFY(!done);
+        QTRY_VERIFY(done);
+        QVERIFY(storedRecord == record);
+
+        // Nothing is delivered to a context that is gone, the job still runs
+        bool wiped = false;
+        bool called = false;
+        {
+            QObject gone;
+            _db.runAsync(&gone, [&](SyncJournalDb *db) { wiped = db->deleteFileRecord("async", true); }, [&] { called = true; });
+        }
+        done = false;
+        _db.runAsync(&context, [](SyncJournalDb *) {}, [&] { done = true; });
+        QTRY_VERIFY(done);
+        QVERIFY(wiped);
+        QVERIFY(!called);
+    }
+
+    void testInodeIndex()
+    {
+        _db.close();
+        for (int i = 1; i <= 3; ++i) {
+            SyncJournalFileRecord record;
+            record._path = "inode/" + QByteArray::number(i);
+            record._inode = 1000 + i;
+            record._remotePerm = RemotePermissions("RW");
+            QVERIFY(_db.setFileRecord(record));
+        }
+        QVERIFY(_db.flushFileRecords());
+
+        // Enough lookups for the index to be built
+        SyncJournalFileRecord storedRecord;
+        for (int i = 0; i < 100; ++i) {
+            QVERIFY(_db.getFileRecordByInode(999, &storedRecord));
+            QVERIFY(!storedRecord.isValid());
+        }
+        QCOMPARE(_db.lookupCacheStatistics()._indexedInodes, 3);
+        QVERIFY(_db.getFileRecordByInode(1002, &storedRecord));
+        QCOMPARE(storedRecord._path, QByteArray("inode/2"));
+
+        // Written records are found, removed ones aren't
+        SyncJournalFileRecord record;
+        record._path = "inode/4";
+        record._inode = 1004;
+        record._remotePerm = RemotePermissions("RW");
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.getFileRecordByInode(1004, &storedRecord));
+        QCOMPARE(storedRecord._path, QByteArray("inode/4"));
+        QVERIFY(_db.deleteFileRecord("inode/2"));
+        QVERIFY(_db.getFileRecordByInode(1002, &storedRecord));
+        QVERIFY(!storedRecord.isValid());
+
+        // A moved inode is found at its new path
+        QVERIFY(_db.updateLocalMetadata("inode/3", 0, 0, 1002));
+        QVERIFY(_db.getFileRecordByInode(1002, &storedRecord));
+        QCOMPARE(storedRecord._path, QByteArray("inode/3"));
+
+        QVERIFY(_db.deleteFileRecord("inode", true));
+        _db.close();
+        QCOMPARE(_db.lookupCacheStatistics()._indexedInodes, 0);
+    }
+
+    void testFileIdIndex()
+    {
+        _db.close();
+        for (int i = 1; i <= 3; ++i) {
+            SyncJournalFileRecord record;
+            record._path = "fileid/" + QByteArray::number(i);
+            record._fileId = "id" + QByteArray::number(i);
+            record._remotePerm = RemotePermissions("RW");
+            QVERIFY(_db.setFileRecord(record));
+        }
+        QVERIFY(_db.flushFileRecords());
+
+        QStringList paths;
+        auto collect = [&](const SyncJournalFileRecord &rec) { paths.append(QString::fromUtf8(rec._path)); };
+        // Enough lookups for the index to be built
+        for (int i = 0; i < 100; ++i)
+            QVERIFY(_db.getFileRecordsByFileId("unknown", collect));
+        QVERIFY(paths.isEmpty());
+        QCOMPARE(_db.lookupCacheStatistics()._indexedFileIds, 3);
+        QVERIFY(_db.getFileRecordsByFileId("id2", collect));
+        QCOMPARE(paths, QStringList{ "fileid/2" });
+
+        // Written records are found, removed and changed ones aren't
+        SyncJournalFileRecord record;
+        record._path = "fileid/4";
+        record._fileId = "id4";
+        record._remotePerm = RemotePermissions("RW");
+        QVERIFY(_db.setFileRecord(record));
+        paths.clear();
+        QVERIFY(_db.getFileRecordsByFileId("id4", collect));
+        QCOMPARE(paths, QStringList{ "fileid/4" });
+        QVERIFY(_db.deleteFileRecord("fileid/2"));
+        record._path = "fileid/3";
+        record._fileId = "id5";
+        QVERIFY(_db.setFileRecord(record));
+        paths.clear();
+        QVERIFY(_db.getFileRecordsByFileId("id2", collect));
+        QVERIFY(_db.getFileRecordsByFileId("id3", collect));
+        QVERIFY(paths.isEmpty());
+
+        QVERIFY(_db.deleteFileRecord("fileid", true));
+        _db.close();
+        QCOMPARE(_db.lookupCacheStatistics()._indexedFileIds, 0);
+    }
+
+    void testSubtreeQueries()
+    {
+        auto makeRecord = [](const QByteArray &path, int type) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._type = type;
+            record._etag = "etag";
+            record._remotePerm = RemotePermissions("RW");
+            return record;
+        };
+        auto etag = [&](const QByteArray &path) {
+            SyncJournalFileRecord record;
+            _db.getFileRecord(path, &record);
+            return record._etag;
+        };
+        // Wildcard characters of LIKE must not match anything else
+        for (const auto &path : { "sub_tree", "sub_tree/a", "sub_tree/a/b", "subXtree", "subXtree/a", "sub%", "sub%/a" }) {
+            QVERIFY(_db.setFileRecord(makeRecord(path, QByteArray(path).contains("/a/b") ? 0 : 2)));
+        }
+
+        _db.avoidReadFromDbOnNextSync(QByteArrayLiteral("sub_tree/a/b"));
+        QCOMPARE(etag("sub_tree"), QByteArray("_invalid_"));
+        QCOMPARE(etag("sub_tree/a"), QByteArray("_invalid_"));
+        QCOMPARE(etag("sub_tree/a/b"), QByteArray("etag"));
+        QCOMPARE(etag("subXtree"), QByteArray("etag"));
+
+        QVERIFY(_db.deleteFileRecord("sub_tree", true));
+        QVERIFY(etag("sub_tree/a").isEmpty());
+        QVERIFY(etag("sub_tree/a/b").isEmpty());
+        QCOMPARE(etag("subXtree/a"), QByteArray("etag"));
+
+        QVERIFY(_db.deleteFileRecord("sub%", true));
+        QVERIFY(etag("sub%/a").isEmpty());
+        QCOMPARE(etag("subXtree/a"), QByteArray("etag"));
+
+        QVERIFY(_db.deleteFileRecord("subXtree", true));
+    }
+
+    void testPathHash()
+    {
+        SyncJournalFileRecord record;
+        record._path = "hashed/a";
+        record._etag = "etag";
+        record._remotePerm = RemotePermissions("RW");
+        QVERIFY(_db.setFileRecord(record));
+
+        // The rows and the tree entries share the hash of the journal
+        qint64 rowHash = 0;
+        QVERIFY(_db.getFileRowsBelowPath("hashed", [&](SqlQuery &row) {
+            rowHash = row.int64Value(SyncJournalDb::PHashColumn);
+        }));
+        QCOMPARE(rowHash, SyncJournalDb::getPHash("hashed/a"));
+        QCOMPARE(csync_path_hash(QByteArray("hashed/a")), rowHash);
+
+        SyncJournalFileRecord stored;
+        QVERIFY(_db.getFileRecord(record._path, rowHash, &stored));
+        QCOMPARE(stored._etag, record._etag);
+        QVERIFY(_db.deleteFileRecord("hashed", true));
+    }
+
+    void testMoveSubtree()
+    {
+        auto makeRecord = [](const QByteArray &path, const QByteArray &etag) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._etag = etag;
+            record._remotePerm = RemotePermissions("RW");
+            return record;
+        };
+        auto etag = [&](const QByteArray &path) {
+            SyncJournalFileRecord record;
+            _db.getFileRecord(path, &record);
+            return record._etag;
+        };
+        for (const auto &path : { "old", "old/a", "old/a/b", "old/c", "oldX/a" }) {
+            QVERIFY(_db.setFileRecord(makeRecord(path, "old")));
+        }
+        // Written by the propagation of a change in the moved directory
+        QVERIFY(_db.setFileRecord(makeRecord("new/c", "new")));
+
+        QVERIFY(_db.moveSubtree("old", "new"));
+        QCOMPARE(etag("new/a"), QByteArray("old"));
+        QCOMPARE(etag("new/a/b"), QByteArray("old"));
+        QCOMPARE(etag("new/c"), QByteArray("new"));
+        QVERIFY(etag("old/a").isEmpty());
+        QVERIFY(etag("old/c").isEmpty());
+        QCOMPARE(etag("old"), QByteArray("old"));
+        QCOMPARE(etag("oldX/a"), QByteArray("old"));
+
+        // The moved records are found by their new path hash
+        SyncJournalFileRecord record;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("new/a/b"), &record));
+        QCOMPARE(record._path, QByteArray("new/a/b"));
+        int below = 0;
+        QVERIFY(_db.getFilesBelowPath("new", [&](const SyncJournalFileRecord &) { ++below; }));
+        QCOMPARE(below, 3);
+
+        QVERIFY(_db.deleteFileRecord("old", true));
+        QVERIFY(_db.deleteFileRecord("oldX", true));
+        QVERIFY(_db.deleteFileRecord("new", true));
+    }
+
+    void testMoveLargeSubtree()
+    {
+        // The lengths are in characters, not bytes
+        const QByteArray from = QString::fromUtf8("gro\xc3\x9f").toUtf8();
+        const QByteArray to = QString::fromUtf8("\xc3\xa9t\xc3\xa9/big").toUtf8();
+        const int count = 10000;
+        for (int i = 0; i < count; ++i) {
+            SyncJournalFileRecord record;
+            record._path = from + "/dir" + QByteArray::number(i % 100) + "/file" + QByteArray::number(i);
+            record._inode = 100000 + i;
+            record._remotePerm = RemotePermissions("RW");
+            QVERIFY(_db.setFileRecord(record));
+        }
+
+        QVERIFY(_db.moveSubtree(from, to));
+
+        SyncJournalFileRecord record;
+        QVERIFY(_db.getFileRecord(to + "/dir42/file4242", &record));
+        QCOMPARE(record._path, to + "/dir42/file4242");
+        QCOMPARE(record._inode, quint64(104242));
+        QVERIFY(_db.getFileRecordByInode(104242, &record));
+        QCOMPARE(record._path, to + "/dir42/file4242");
+
+        // The SQL phash() gave every moved record the hash of its new path
+        QList<SyncJournalFileRecord> moved;
+        QVERIFY(_db.getFilesBelowPath(to, [&](const SyncJournalFileRecord &rec) { moved.append(rec); }));
+        QCOMPARE(moved.size(), count);
+        int wrongHashes = 0;
+        for (const auto &rec : moved) {
+            SyncJournalFileRecord found;
+            if (!_db.getFileRecord(rec._path, &found) || found._inode != rec._inode)
+                ++wrongHashes;
+        }
+        QCOMPARE(wrongHashes, 0);
+        int below = 0;
+        QVERIFY(_db.getFilesBelowPath(from, [&](const SyncJournalFileRecord &) { ++below; }));
+        QCOMPARE(below, 0);
+
+        QVERIFY(_db.deleteFileRecord(QString::fromUtf8(to), true));
+    }
+
+    void testPostSyncCleanup()
+    {
+        for (const auto &path : { "cleanup", "cleanup/seen", "cleanup/gone", "cleanup/keep/a", "cleanup/tree/a", "cleanup/tree/b" }) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._remotePerm = RemotePermissions("RW");
+            QVERIFY(_db.setFileRecord(record));
+        }
+
+        std::vector<qint64> seen = { SyncJournalDb::getPHash("cleanup"), SyncJournalDb::getPHash("cleanup/seen") };
+        std::sort(seen.begin(), seen.end());
+        QSet<QString> prefixes = { QStringLiteral("cleanup/keep/") };
+        QVERIFY(_db.postSyncCleanup(seen, prefixes, { QStringLiteral("cleanup/tree/") }));
+
+        auto exists = [&](const QByteArray &path) {
+            SyncJournalFileRecord record;
+            _db.getFileRecord(path, &record);
+            return record.isValid();
+        };
+        QVERIFY(exists("cleanup"));
+        QVERIFY(exists("cleanup/seen"));
+        QVERIFY(!exists("cleanup/gone"));
+        QVERIFY(exists("cleanup/keep/a"));
+        QVERIFY(exists("cleanup/tree/a"));
+        QVERIFY(exists("cleanup/tree/b"));
+
+        QVERIFY(_db.deleteFileRecord("cleanup", true));
+    }
+
+    void testMaintenance()
+    {
+        auto stats = _db.fileStatistics();
+        QVERIFY(stats._pageSize > 0);
+        QVERIFY(stats._pageCount > 0);
+        QVERIFY(stats._freelistCount >= 0);
+        QVERIFY(stats.freeSize() <= stats.databaseSize());
+
+        QVERIFY(_db.maintain() >= 0);
+
+        // Still usable afterwards
+        SyncJournalFileRecord record;
+        record._path = "after-maintenance";
+        record._remotePerm = RemotePermissions("RW");
+        QVERIFY(_db.setFileRecord(record));
+        SyncJournalFileRecord storedRecord;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("after-maintenance"), &storedRecord));
+        QVERIFY(storedRecord == record);
+        QVERIFY(_db.deleteFileRecord("after-maintenance"));
+    }
+
+    void testCacheSize()
+    {
+        SyncJournalFileRecord record;
+        record._path = "cachesize";
+        record._remotePerm = RemotePermissions("RW");
+        QVERIFY(_db.setFileRecord(record));
+
+        // Applies to the open connection and survives reopening, a negative
+        // cache_size is in KiB
+        _db.setCacheSize(256);
+        QCOMPARE(_db.pragmaValue("cache_size"), qint64(-256));
+        SyncJournalFileRecord stored;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("cachesize"), &stored));
+        QVERIFY(stored.isValid());
+        _db.close();
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("cachesize"), &stored));
+        QVERIFY(stored.isValid());
+        QCOMPARE(_db.pragmaValue("cache_size"), qint64(-256));
+
+        _db.setCacheSize(0);
+        QCOMPARE(_db.pragmaValue("cache_size"), qint64(-2000));
+        QVERIFY(_db.deleteFileRecord("cachesize"));
+    }
+
+    void testAutoTuneLimits()
+    {
+        SyncJournalFileRecord record;
+        record._path = "autotune";
+        record._remotePerm = RemotePermissions("RW");
+        QVERIFY(_db.setFileRecord(record));
+
+        // Applies to the open connection, to reopening and to the readers
+        _db.setAutoTuneLimits(64 * 1024, 256 * 1000 * 1000);
+        SyncJournalFileRecord stored;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("autotune"), &stored));
+        QVERIFY(stored.isValid());
+        _db.close();
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("autotune"), &stored));
+        QVERIFY(stored.isValid());
+        stored = SyncJournalFileRecord();
+        QVERIFY(_db.getFileRecordReadOnly(QByteArrayLiteral("autotune"), &stored));
+        QVERIFY(stored.isValid());
+
+        // A journal this small keeps the default page cache, the mapping
+        // stays within the limit. SQLite may cap it lower, down to 0.
+        QCOMPARE(_db.pragmaValue("cache_size"), qint64(-2000));
+        const qint64 mmapSize = _db.pragmaValue("mmap_size");
+        QVERIFY(mmapSize >= 0 && mmapSize <= 256 * 1000 * 1000);
+
+        _db.setAutoTuneLimits(0, 0);
+        QCOMPARE(_db.pragmaValue("cache_size"), qint64(-2000));
+        QCOMPARE(_db.pragmaValue("mmap_size"), qint64(0));
+        QVERIFY(_db.deleteFileRecord("autotune"));
+    }
+
     void testDownloadInfo()
     {
         typedef SyncJournalDb::DownloadInfo Info;
@@ -140,6 +656,11 @@ private slots:
         Info storedRecord = _db.getDownloadInfo("foo");
         QVERIFY(storedRecord == record);
 
+        record._segments = { { 0, 99 }, { 150, 199 }, { 5000000000ull, 9999999999ull } };
+        _db.setDownloadInfo("foo", record);
+        storedRecord = _db.getDownloadInfo("foo");
+        QVERIFY(storedRecord == record);
+
         _db.setDownloadInfo("foo", Info());
         Info wipedRecord = _db.getDownloadInfo("foo");
         QVERIFY(!wipedRecord._valid);
@@ -180,6 +701,212 @@ private slots:
         QCOMPARE(record.numericFileId(), QByteArray("123456789"));
     }
 
+    void testFilesInDirectory()
+    {
+        auto makeRecord = [&](const QByteArray &path, int type) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._type = type;
+            record._etag = "etag";
+            record._fileId = path;
+            QVERIFY(_db.setFileRecord(record));
+        };
+        makeRecord("dir", CSYNC_FTW_TYPE_DIR);
+        makeRecord("dir/a", CSYNC_FTW_TYPE_FILE);
+        makeRecord("dir/sub", CSYNC_FTW_TYPE_DIR);
+        makeRecord("dir/sub/b", CSYNC_FTW_TYPE_FILE);
+        makeRecord("dir a", CSYNC_FTW_TYPE_FILE);
+
+        QSet<QByteArray> found;
+        auto collect = [&](const SyncJournalFileRecord &rec) { found.insert(rec._path); };
+
+        QVERIFY(_db.getFilesInDirectory("dir", collect));
+        QCOMPARE(found, QSet<QByteArray>({ "dir/a", "dir/sub" }));
+
+        found.clear();
+        QVERIFY(_db.getFilesInDirectory("", collect));
+        QVERIFY(found.contains("dir"));
+        QVERIFY(found.contains("dir a"));
+        QVERIFY(!found.contains("dir/a"));
+    }
+
+    void testLocalDirectoryInfo()
+    {
+        SyncJournalDb::LocalDirectoryInfo info;
+        QVERIFY(!_db.getLocalDirectoryInfo("dir", &info));
+
+        info._modtime = 1234;
+        info._inode = 42;
+        _db.setLocalDirectoryInfo("dir", info);
+
+        SyncJournalDb::LocalDirectoryInfo stored;
+        QVERIFY(_db.getLocalDirectoryInfo("dir", &stored));
+        QCOMPARE(stored._modtime, info._modtime);
+        QCOMPARE(stored._inode, info._inode);
+
+        // Deleting an entry forces its parent to be listed again
+        _db.setFileRecord([] { SyncJournalFileRecord r; r._path = "dir/x"; return r; }());
+        QVERIFY(_db.deleteFileRecord("dir/x"));
+        QVERIFY(!_db.getLocalDirectoryInfo("dir", &stored));
+
+        _db.setLocalDirectoryInfo("dir", info);
+        _db.clearLocalDirectoryInfos();
+        QVERIFY(!_db.getLocalDirectoryInfo("dir", &stored));
+    }
+
+    void testLocalFileSnapshot()
+    {
+        for (int i = 0; i < 100; ++i) {
+            SyncJournalFileRecord record;
+            record._path = "snapshot/file" + QByteArray::number(i);
+            record._modtime = 1000 + i;
+            record._fileSize = 10 * i;
+            record._inode = 500 + i;
+            record._type = CSYNC_FTW_TYPE_FILE;
+            record._remotePerm = RemotePermissions("RW");
+            QVERIFY(_db.setFileRecord(record));
+        }
+
+        // The queued records are in it too
+        SyncJournalDb::LocalFileSnapshot snapshot;
+        QVERIFY(_db.getLocalFileSnapshot(&snapshot));
+        QVERIFY(snapshot.size() >= 100);
+        QVERIFY(std::is_sorted(snapshot.phashes(), snapshot.phashes() + snapshot.size()));
+
+        QVERIFY(snapshot.matches("snapshot/file42", 1042, 420, 542, CSYNC_FTW_TYPE_FILE));
+        QVERIFY(!snapshot.matches("snapshot/file42", 1043, 420, 542, CSYNC_FTW_TYPE_FILE));
+        QVERIFY(!snapshot.matches("snapshot/file42", 1042, 421, 542, CSYNC_FTW_TYPE_FILE));
+        QVERIFY(!snapshot.matches("snapshot/file42", 1042, 420, 543, CSYNC_FTW_TYPE_FILE));
+        QVERIFY(!snapshot.matches("snapshot/file42", 1042, 420, 542, CSYNC_FTW_TYPE_DIR));
+        QVERIFY(!snapshot.matches("snapshot/missing", 1042, 420, 542, CSYNC_FTW_TYPE_FILE));
+        QVERIFY(!SyncJournalDb::LocalFileSnapshot().matches("snapshot/file42", 1042, 420, 542, CSYNC_FTW_TYPE_FILE));
+
+        // The next one is read from the file, until a record is written
+        QVERIFY(QFile::exists(_db.localFileSnapshotFilePath()));
+        SyncJournalDb::LocalFileSnapshot mapped;
+        QVERIFY(_db.getLocalFileSnapshot(&mapped));
+        QCOMPARE(mapped.size(), snapshot.size());
+        QVERIFY(mapped.matches("snapshot/file42", 1042, 420, 542, CSYNC_FTW_TYPE_FILE));
+
+        SyncJournalFileRecord record;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snapshot/file42"), &record));
+        record._modtime = 2042;
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.flushFileRecords());
+        QVERIFY(!QFile::exists(_db.localFileSnapshotFilePath()));
+        QVERIFY(_db.getLocalFileSnapshot(&snapshot));
+        QVERIFY(snapshot.matches("snapshot/file42", 2042, 420, 542, CSYNC_FTW_TYPE_FILE));
+        // The mapped one stays usable
+        QVERIFY(mapped.matches("snapshot/file42", 1042, 420, 542, CSYNC_FTW_TYPE_FILE));
+
+        // An outdated file that is still there after a restart isn't used,
+        // even with as many records
+        const QString fileName = _db.localFileSnapshotFilePath();
+        QVERIFY(QFile::copy(fileName, fileName + ".old"));
+        record._modtime = 3042;
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.flushFileRecords());
+        _db.commit("test");
+        _db.close();
+        QVERIFY(!QFile::exists(fileName));
+        QVERIFY(QFile::rename(fileName + ".old", fileName));
+        QVERIFY(_db.getLocalFileSnapshot(&snapshot));
+        QVERIFY(snapshot.matches("snapshot/file42", 3042, 420, 542, CSYNC_FTW_TYPE_FILE));
+        QVERIFY(!snapshot.matches("snapshot/file42", 2042, 420, 542, CSYNC_FTW_TYPE_FILE));
+
+        // Deleting records removes the file too
+        QVERIFY(_db.deleteFileRecord("snapshot", true));
+        QVERIFY(_db.getLocalFileSnapshot(&snapshot));
+        QVERIFY(!snapshot.matches("snapshot/file42", 2042, 420, 542, CSYNC_FTW_TYPE_FILE));
+    }
+
+    void testDeferredCommit()
+    {
+        const QString fileName = _tempDir.path() + "/commit.db";
+        SyncJournalDb db(fileName);
+        SyncJournalDb::DownloadInfo info;
+        info._valid = true;
+        info._tmpfile = "tmp";
+        db.setDownloadInfo("committed", info);
+        db.commit("test");
+
+        // Another connection only sees what was committed
+        auto committedRows = [&] {
+            SqlDatabase reader;
+            if (!reader.openReadOnly(fileName))
+                return -1;
+            SqlQuery query(reader);
+            if (query.prepare("SELECT COUNT(*) FROM downloadinfo") != 0 || !query.exec() || !query.next())
+                return -1;
+            return query.intValue(0);
+        };
+        QCOMPARE(committedRows(), 1);
+
+        // Right after a commit and with few changes, it waits
+        db.setDownloadInfo("deferred", info);
+        db.commitIfNeededAndStartNewTransaction("test");
+        QCOMPARE(committedRows(), 1);
+
+        // Enough changed rows commit all of them
+        for (int i = 0; i < 1000; ++i)
+            db.setDownloadInfo(QString("file%1").arg(i), info);
+        db.commitIfNeededAndStartNewTransaction("test");
+        QCOMPARE(committedRows(), 1002);
+
+        db.setDownloadInfo("last", info);
+        db.commitIfNeededAndStartNewTransaction("test");
+        QCOMPARE(committedRows(), 1002);
+        db.close();
+        QCOMPARE(committedRows(), 1003);
+    }
+
+    void testCachedChecksum()
+    {
+        QVERIFY(_db.getCachedChecksum(77, 1000, 10, "SHA1").isEmpty());
+
+        _db.setCachedChecksum(77, 1000, 10, "SHA1:abcd");
+        QCOMPARE(_db.getCachedChecksum(77, 1000, 10, "SHA1"), QByteArray("SHA1:abcd"));
+        // Changed since, or another type
+        QVERIFY(_db.getCachedChecksum(77, 1001, 10, "SHA1").isEmpty());
+        QVERIFY(_db.getCachedChecksum(77, 1000, 11, "SHA1").isEmpty());
+        QVERIFY(_db.getCachedChecksum(77, 1000, 10, "MD5").isEmpty());
+
+        _db.setCachedChecksum(77, 1002, 12, "MD5:ef");
+        QVERIFY(_db.getCachedChecksum(77, 1000, 10, "SHA1").isEmpty());
+        QCOMPARE(_db.getCachedChecksum(77, 1002, 12, "MD5"), QByteArray("MD5:ef"));
+
+        // The key is in nanoseconds: two writes within the same second differ
+        const qint64 second = Q_INT64_C(1500000000) * 1000000000;
+        _db.setCachedChecksum(78, second + 100, 10, "SHA1:aa");
+        QVERIFY(_db.getCachedChecksum(78, second + 200, 10, "SHA1").isEmpty());
+
+        QTemporaryFile file;
+        QVERIFY(file.open());
+        const qint64 modtimeNsecs = FileSystem::getModTimeNsecs(file.fileName());
+        QVERIFY(modtimeNsecs != -1);
+        QCOMPARE(modtimeNsecs / 1000000000, qint64(QFileInfo(file.fileName()).lastModified().toTime_t()));
+    }
+
+    void testSyncMetricsHistory()
+    {
+        QVERIFY(_db.syncMetricsHistory().isEmpty());
+
+        const int count = SyncJournalDb::SyncMetricsHistorySize + 5;
+        for (int i = 0; i < count; ++i)
+            _db.addSyncMetrics(QByteArray::number(i));
+
+        // Only the last ones are kept, oldest first
+        const auto history = _db.syncMetricsHistory();
+        QCOMPARE(history.size(), int(SyncJournalDb::SyncMetricsHistorySize));
+        QCOMPARE(history.first()._metrics, QByteArray::number(5));
+        QCOMPARE(history.last()._metrics, QByteArray::number(count - 1));
+        QVERIFY(history.last()._finished.isValid());
+
+        // It isn't about the files
+        _db.clearFileTable();
+        QCOMPARE(_db.syncMetricsHistory().size(), int(SyncJournalDb::SyncMetricsHistorySize));
+    }
+
 private:
     SyncJournalDb _db;
 };
@@ -91,6 +91,53 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), oldState);
     }
 
+    void testMovedFolderWithFailingChild()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        auto hasRecord = [&](const QString &path) {
+            SyncJournalFileRecord record;
+            return fakeFolder.syncJournal().getFileRecord(path, &record) && record.isValid();
+        };
+
+        // a1 changed too, it has a job of its own that fails
+        fakeFolder.remoteModifier().rename("A", "AA");
+        fakeFolder.remoteModifier().setContents("AA/a1", 'x');
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("AA/a1"))
+                return new FakeErrorReply{ op, request, this, 500 };
+            return nullptr;
+        });
+        QVERIFY(!fakeFolder.syncOnce());
+
+        // The records moved with the directory anyway
+        QVERIFY(hasRecord("AA/a2"));
+        QVERIFY(!hasRecord("A/a2"));
+        QVERIFY(hasRecord("AA/a1"));
+        QVERIFY(!hasRecord("A/a1"));
+
+        fakeFolder.setServerOverride(nullptr);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(!hasRecord("A"));
+    }
+
+    void testMovedFolderChildPermissions()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+
+        // Only the permissions of a2 changed, its record must get them
+        fakeFolder.remoteModifier().rename("A", "AA");
+        fakeFolder.currentRemoteState().find("AA/a2")->isShared = true;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("AA/a2"), &record));
+        QVERIFY(record._remotePerm.hasPermission(RemotePermissions::IsShared));
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("AA/a1"), &record));
+        QVERIFY(!record._remotePerm.hasPermission(RemotePermissions::IsShared));
+    }
+
     void testSelectiveSyncMovedFolder()
     {
         // issue #5224
@@ -555,6 +602,119 @@ private slots:
         QCOMPARE(nDELETE, 0);
     }
 
+    // The moves out of renamed and removed folders don't follow the tree order
+    void testMoveOutOfMovedFolder()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        auto &local = fakeFolder.localModifier();
+        auto &remote = fakeFolder.remoteModifier();
+
+        // B sorts before the new names of the folders
+        remote.rename("A", "Z");
+        remote.rename("Z/a1", "B/a1");
+        local.rename("C", "Y");
+        local.rename("Y/c1", "B/c1");
+        remote.rename("S/s1", "B/s1");
+        remote.remove("S");
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(itemSuccessfulMove(completeSpy, "Z"));
+        QVERIFY(itemSuccessfulMove(completeSpy, "B/a1"));
+        QVERIFY(itemSuccessfulMove(completeSpy, "Y"));
+        QVERIFY(itemSuccessfulMove(completeSpy, "B/c1"));
+        QVERIFY(itemSuccessfulMove(completeSpy, "B/s1"));
+        QVERIFY(itemSuccessful(completeSpy, "S", CSYNC_INSTRUCTION_REMOVE));
+
+        // A new folder where one was renamed from
+        remote.rename("Z", "A");
+        remote.mkdir("Z");
+        remote.insert("Z/new");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // The jobs waiting for a subtree that doesn't run still run
+    void testFailedMkcolReleasesPrerequisites()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request) -> QNetworkReply * {
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "MKCOL"
+                && getFilePathFromUrl(request.url()) == "N")
+                return new FakeErrorReply{ op, request, this, 500 };
+            return nullptr;
+        });
+
+        // The removal of B waits for the move into the new folder
+        auto &local = fakeFolder.localModifier();
+        local.mkdir("N");
+        local.rename("B/b1", "N/b1");
+        local.remove("B");
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        QSignalSpy finishedSpy(&fakeFolder.syncEngine(), SIGNAL(finished(bool)));
+        fakeFolder.scheduleSync();
+        QVERIFY(finishedSpy.wait(10000));
+        QCOMPARE(finishedSpy.count(), 1);
+        QVERIFY(!finishedSpy[0][0].toBool());
+        QVERIFY(itemSuccessful(completeSpy, "B", CSYNC_INSTRUCTION_REMOVE));
+        QVERIFY(!fakeFolder.currentRemoteState().find("B"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("N"));
+
+        // The folder and its file are uploaded the next time
+        fakeFolder.setServerOverride(nullptr);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(fakeFolder.currentRemoteState().find("N/b1"));
+    }
+
+    void testReconcileEngines_data()
+    {
+        QTest::addColumn<QByteArray>("envName");
+        QTest::addColumn<QByteArray>("envValue");
+
+        QTest::newRow("lookups") << QByteArray() << QByteArray();
+        QTest::newRow("parallel") << QByteArray("OWNCLOUD_PARALLEL_RECONCILE_THRESHOLD") << QByteArray("0");
+        QTest::newRow("sorted") << QByteArray("OWNCLOUD_SORTED_RECONCILE") << QByteArray("1");
+    }
+
+    // The ways to reconcile the trees must agree, renames included
+    void testReconcileEngines()
+    {
+        QFETCH(QByteArray, envName);
+        QFETCH(QByteArray, envValue);
+
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        auto &local = fakeFolder.localModifier();
+        auto &remote = fakeFolder.remoteModifier();
+
+        local.rename("A", "A2");
+        remote.rename("B/b1", "B/b1m");
+        local.setContents("C/c1", 'L');
+        remote.setContents("C/c1", 'R');
+        remote.insert("C/c3");
+        local.remove("S/s1");
+        local.mkdir("N");
+        local.insert("N/n1");
+
+        if (!envName.isEmpty())
+            qputenv(envName.constData(), envValue);
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        const bool ok = fakeFolder.syncOnce();
+        if (!envName.isEmpty())
+            qunsetenv(envName.constData());
+        QVERIFY(ok);
+
+        QVERIFY(itemSuccessfulMove(completeSpy, "A2"));
+        QVERIFY(itemSuccessfulMove(completeSpy, "B/b1m"));
+        QVERIFY(itemConflict(completeSpy, "C/c1"));
+        QVERIFY(itemSuccessful(completeSpy, "C/c3", CSYNC_INSTRUCTION_NEW));
+        QVERIFY(itemSuccessful(completeSpy, "S/s1", CSYNC_INSTRUCTION_REMOVE));
+        QVERIFY(itemSuccessful(completeSpy, "N/n1", CSYNC_INSTRUCTION_NEW));
+        QVERIFY(expectAndWipeConflict(local, fakeFolder.currentLocalState(), "C/c1"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(remote.find("C/c1")->contentChar, 'R');
+    }
+
     // Check interaction of moves with file type changes
     void testMoveAndTypeChange()
     {
@@ -0,0 +1,177 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "config.h"
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+using namespace OCC;
+
+static const QString suffix = QStringLiteral(APPLICATION_DOTVIRTUALFILE_SUFFIX);
+
+static SyncJournalFileRecord dbRecord(FakeFolder &folder, const QString &path)
+{
+    SyncJournalFileRecord record;
+    folder.syncJournal().getFileRecord(path, &record);
+    return record;
+}
+
+static void enableVirtualFiles(FakeFolder &folder)
+{
+    SyncOptions options;
+    options._newFilesAreVirtual = true;
+    folder.syncEngine().setSyncOptions(options);
+}
+
+// What Folder::downloadVirtualFile() does
+static void requestDownload(FakeFolder &folder, const QString &path)
+{
+    auto record = dbRecord(folder, path);
+    QVERIFY(record.isValid());
+    record._type = SyncFileItem::VirtualFileDownload;
+    folder.syncJournal().setFileRecord(record);
+    folder.syncJournal().avoidReadFromDbOnNextSync(record._path);
+}
+
+class TestSyncVirtualFiles : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testVirtualFileLifecycle()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        enableVirtualFiles(fakeFolder);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1", 64);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a1"));
+        QVERIFY(fakeFolder.currentLocalState().find("A/a1" + suffix));
+        QCOMPARE(fakeFolder.currentLocalState().find("A/a1" + suffix)->size, 0);
+        QCOMPARE(dbRecord(fakeFolder, "A/a1" + suffix)._type, int(SyncFileItem::VirtualFile));
+        QCOMPARE(dbRecord(fakeFolder, "A/a1" + suffix)._fileSize, 64);
+
+        // Another sync doesn't touch the placeholder or upload it
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentLocalState().find("A/a1" + suffix));
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/a1" + suffix));
+
+        // A remote change only updates the placeholder
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a1"));
+        QCOMPARE(dbRecord(fakeFolder, "A/a1" + suffix)._fileSize, 65);
+
+        // The download replaces the placeholder
+        requestDownload(fakeFolder, "A/a1" + suffix);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a1" + suffix));
+        QVERIFY(!dbRecord(fakeFolder, "A/a1" + suffix).isValid());
+        QCOMPARE(dbRecord(fakeFolder, "A/a1")._type, int(SyncFileItem::File));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testVirtualFileRemoveAndRename()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        enableVirtualFiles(fakeFolder);
+
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1", 64);
+        fakeFolder.remoteModifier().insert("A/a2", 64);
+        fakeFolder.remoteModifier().insert("A/a3", 64);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentLocalState().find("A/a1" + suffix));
+        QVERIFY(fakeFolder.currentLocalState().find("A/a2" + suffix));
+        QVERIFY(fakeFolder.currentLocalState().find("A/a3" + suffix));
+
+        // Removed on the server: the placeholder goes
+        fakeFolder.remoteModifier().remove("A/a1");
+        // Removed locally: the file goes on the server
+        fakeFolder.localModifier().remove("A/a2" + suffix);
+        // Renamed locally: the file is moved on the server
+        fakeFolder.localModifier().rename("A/a3" + suffix, "A/b3" + suffix);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a1" + suffix));
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/a2"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/a3"));
+        QVERIFY(fakeFolder.currentRemoteState().find("A/b3"));
+        QCOMPARE(dbRecord(fakeFolder, "A/b3" + suffix)._type, int(SyncFileItem::VirtualFile));
+    }
+
+    void testPlaceholderRecordsSurvive()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        enableVirtualFiles(fakeFolder);
+        int transfers = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation || op == QNetworkAccessManager::PutOperation
+                || op == QNetworkAccessManager::DeleteOperation)
+                ++transfers;
+            return nullptr;
+        });
+        auto checkPlaceholder = [&](const QString &path) {
+            QVERIFY(fakeFolder.currentLocalState().find(path + suffix));
+            QVERIFY(!fakeFolder.currentLocalState().find(path));
+            QCOMPARE(dbRecord(fakeFolder, path + suffix)._type, int(SyncFileItem::VirtualFile));
+            QVERIFY(!dbRecord(fakeFolder, path).isValid());
+        };
+
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1", 64);
+        fakeFolder.remoteModifier().insert("A/a2", 64);
+        QVERIFY(fakeFolder.syncOnce());
+        checkPlaceholder("A/a1");
+        checkPlaceholder("A/a2");
+
+        // The next syncs find the placeholders where the first one put them
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.syncOnce());
+        checkPlaceholder("A/a1");
+        checkPlaceholder("A/a2");
+
+        // Moved on the server, the placeholder moves along
+        fakeFolder.remoteModifier().rename("A/a2", "A/b2");
+        QVERIFY(fakeFolder.syncOnce());
+        checkPlaceholder("A/b2");
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a2" + suffix));
+        QVERIFY(!dbRecord(fakeFolder, "A/a2" + suffix).isValid());
+        QVERIFY(fakeFolder.syncOnce());
+        checkPlaceholder("A/a1");
+        checkPlaceholder("A/b2");
+
+        // Nothing was downloaded, uploaded or removed
+        QCOMPARE(transfers, 0);
+        QVERIFY(fakeFolder.currentRemoteState().find("A/a1"));
+        QVERIFY(fakeFolder.currentRemoteState().find("A/b2"));
+    }
+
+    void testExistingLocalFileIsKept()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        enableVirtualFiles(fakeFolder);
+
+        // A local file of the same name is compared with the remote one, as usual
+        fakeFolder.remoteModifier().insert("a1", 64);
+        fakeFolder.localModifier().insert("a1", 64);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentLocalState().find("a1" + suffix));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // A placeholder unknown to the journal is not uploaded
+        fakeFolder.localModifier().insert("copy" + suffix, 0);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentRemoteState().find("copy" + suffix));
+        QVERIFY(!fakeFolder.currentRemoteState().find("copy"));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestSyncVirtualFiles)
+#include "testsyncvirtualfiles.moc"
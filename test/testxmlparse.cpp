@@ -439,6 +439,128 @@ private slots:
         QVERIFY(_subdirs.size() == 1);
     }
 
+    void testParserChunked_data() {
+        QTest::addColumn<int>("chunkSize");
+        QTest::newRow("1") << 1;
+        QTest::newRow("7") << 7;
+        QTest::newRow("64") << 64;
+    }
+
+    void testParserChunked() {
+        QFETCH(int, chunkSize);
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/%C3%A4/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:size>4711</oc:size>"
+              "<d:getetag>\"dir-etag\"</d:getetag>"
+              "<d:resourcetype><d:collection/></d:resourcetype>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/%C3%A4/file%20one</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<d:getetag>\"file-etag\"</d:getetag>"
+              "<d:resourcetype/>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+        connect( &parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
+                 this, SLOT(slotDirectoryListingSubFolders(const QStringList&)) );
+        connect( &parser, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)),
+                 this, SLOT(slotDirectoryListingIterated(const QString&, const QMap<QString,QString>&)) );
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+        QStringList etags;
+        connect(&parser, &LsColXMLParser::directoryListingIterated, this,
+            [&](const QString &, const QMap<QString, QString> &properties) { etags.append(properties.value("getetag")); });
+
+        QHash <QString, qint64> sizes;
+        parser.begin(&sizes, QString::fromUtf8("/ä"));
+        for (int pos = 0; pos < testXml.size(); pos += chunkSize) {
+            QVERIFY(parser.addData(testXml.mid(pos, chunkSize)));
+            QVERIFY(!_success);
+        }
+        QVERIFY(parser.finish());
+        QVERIFY(_success);
+
+        QCOMPARE(_items, QStringList() << QString::fromUtf8("/ä") << QString::fromUtf8("/ä/file one"));
+        QCOMPARE(etags, QStringList() << "\"dir-etag\"" << "\"file-etag\"");
+        QCOMPARE(_subdirs, QStringList() << QString::fromUtf8("/ä/"));
+        QCOMPARE(sizes.value(QString::fromUtf8("/ä/")), qint64(4711));
+    }
+
+    void testParserChunkedTruncated() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>";
+
+        LsColXMLParser parser;
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+        parser.begin(nullptr, "/oc/remote.php/webdav/sharefolder");
+        QVERIFY(parser.addData(testXml));
+        QVERIFY(!parser.finish());
+        QVERIFY(!_success);
+    }
+
+    void testParserEntries() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/quitte.pdf</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004215ocobzus5kn6s</oc:id>"
+              "<oc:permissions>RDNVW</oc:permissions>"
+              "<d:getetag>\"2fa2f0d9ed49ea0c3e409d49e652dea0\"</d:getetag>"
+              "<d:resourcetype/>"
+              "<d:getcontentlength>121780</d:getcontentlength>"
+              "<d:quota-used-bytes>121780</d:quota-used-bytes>"
+              "<d:quota-available-bytes>1374532061.2</d:quota-available-bytes>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:downloadURL/>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 404 Not Found</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+        QList<RemoteEntryInfo> entries;
+        connect(&parser, &LsColXMLParser::directoryListingEntry, this,
+            [&](const QString &, const RemoteEntryInfo &entry) { entries.append(entry); });
+
+        QVERIFY(parser.parse(testXml, nullptr, "/oc/remote.php/webdav/sharefolder"));
+        QCOMPARE(entries.size(), 1);
+        const auto &entry = entries.first();
+        QVERIFY(entry.has(RemoteEntryInfo::ResourceType));
+        QVERIFY(!entry._isDirectory);
+        QCOMPARE(entry._fileId, QByteArray("00004215ocobzus5kn6s"));
+        QCOMPARE(entry._permissions, QByteArray("RDNVW"));
+        QCOMPARE(entry._etag, QByteArray("\"2fa2f0d9ed49ea0c3e409d49e652dea0\""));
+        QCOMPARE(entry._contentLength, QByteArray("121780"));
+        QCOMPARE(entry._quotaUsedBytes, QByteArray("121780"));
+        QCOMPARE(entry._quotaAvailableBytes, QByteArray("1374532061.2"));
+        // Only the properties with a 200 status are reported
+        QVERIFY(!entry.has(RemoteEntryInfo::DownloadUrl));
+        QVERIFY(!entry.has(RemoteEntryInfo::Checksums));
+    }
+
 };
 
     QTEST_GUILESS_MAIN(TestXmlParse)